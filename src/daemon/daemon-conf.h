@@ -30,6 +30,7 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/core.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/rtpoll.h>
 
 #ifdef HAVE_SYS_RESOURCE_H
 #include <sys/resource.h>
@@ -68,8 +69,10 @@ typedef struct pa_daemon_conf {
         system_instance,
         no_cpu_limit,
         disable_shm,
+        disable_memfd,
         disable_remixing,
         disable_lfe_remixing,
+        disable_scache_preconvert,
         load_default_script_file,
         disallow_exit,
         log_meta,
@@ -134,6 +137,7 @@ typedef struct pa_daemon_conf {
     uint32_t alternate_sample_rate;
     pa_channel_map default_channel_map;
     size_t shm_size;
+    pa_rtpoll_backend_t rtpoll_backend;
 } pa_daemon_conf;
 
 /* Allocate a new structure and fill it with sane defaults */
@@ -1007,6 +1007,9 @@ int main(int argc, char *argv[]) {
 
     pa_memtrap_install();
 
+    /* Needs to happen before any module creates an IO thread */
+    pa_rtpoll_set_default_backend(conf->rtpoll_backend);
+
     pa_assert_se(mainloop = pa_mainloop_new());
 
     if (!(c = pa_core_new(pa_mainloop_get_api(mainloop), !conf->disable_shm, conf->shm_size))) {
@@ -1029,6 +1032,8 @@ int main(int argc, char *argv[]) {
     c->disable_remixing = !!conf->disable_remixing;
     c->disable_lfe_remixing = !!conf->disable_lfe_remixing;
     c->deferred_volume = !!conf->deferred_volume;
+    c->disable_memfd = !!conf->disable_memfd;
+    c->disable_scache_preconvert = !!conf->disable_scache_preconvert;
     c->running_as_daemon = !!conf->daemonize;
     c->disallow_exit = conf->disallow_exit;
     c->flat_volumes = conf->flat_volumes;
@@ -3356,6 +3356,7 @@ void pa_alsa_profile_set_free(pa_alsa_profile_set *ps) {
     if (ps->decibel_fixes)
         pa_hashmap_free(ps->decibel_fixes, (pa_free_cb_t) decibel_fix_free);
 
+    pa_xfree(ps->fname);
     pa_xfree(ps);
 }
 
@@ -4189,7 +4190,7 @@ pa_alsa_profile_set* pa_alsa_profile_set_new(const char *fname, const pa_channel
                               PA_ALSA_PROFILE_SETS_DIR);
 
     r = pa_config_parse(fn, NULL, items, NULL, ps);
-    pa_xfree(fn);
+    ps->fname = fn;
 
     if (r < 0)
         goto fail;
@@ -4432,6 +4433,271 @@ void pa_alsa_profile_set_probe(
     ps->probed = TRUE;
 }
 
+static uint64_t hash_data(uint64_t h, const void *data, size_t length) {
+    const uint8_t *d = data;
+
+    /* FNV-1a */
+    for (; length > 0; length--, d++)
+        h = (h ^ *d) * 1099511628211ULL;
+
+    return h;
+}
+
+static uint64_t hash_string(uint64_t h, const char *s) {
+    /* Including the terminating NUL, so that "a" "bc" and "ab" "c" differ */
+    return hash_data(h, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+static uint64_t hash_mapping_names(uint64_t h, pa_idxset *mappings) {
+    pa_alsa_mapping *m;
+    uint32_t idx;
+
+    if (!mappings)
+        return hash_string(h, NULL);
+
+    PA_IDXSET_FOREACH(m, mappings, idx)
+        h = hash_string(h, m->name);
+
+    return hash_string(h, NULL);
+}
+
+/* The contents rather than the mtime, which tools that copy or unpack
+ * files tend to preserve */
+static uint64_t hash_file(uint64_t h, const char *fn) {
+    FILE *f;
+    char buf[4096];
+    size_t n;
+
+    h = hash_string(h, fn);
+
+    if (!fn || !(f = pa_fopen_cloexec(fn, "r")))
+        return hash_string(h, NULL);
+
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        h = hash_data(h, buf, n);
+
+    fclose(f);
+
+    return h;
+}
+
+static uint64_t hash_path_files(uint64_t h, char **path_names) {
+    char **in;
+
+    for (in = path_names; in && *in; in++) {
+        char *fn, *full;
+
+        /* Resolved the same way pa_alsa_path_set_new() does */
+        fn = pa_sprintf_malloc("%s.conf", *in);
+        full = pa_maybe_prefix_path(fn, get_default_paths_dir());
+        h = hash_file(h, full);
+        pa_xfree(full);
+        pa_xfree(fn);
+    }
+
+    return hash_string(h, NULL);
+}
+
+/* Hashes everything that pa_alsa_profile_set_probe() looks at to decide
+ * which profiles are supported, including the profile set and path
+ * configuration files the mappings were built from. If the hash is the same as the last time
+ * on the same card, the profiles found supported then can be handed to
+ * pa_alsa_profile_set_probe_cached(). */
+uint64_t pa_alsa_profile_set_probe_hash(
+        pa_alsa_profile_set *ps,
+        const pa_sample_spec *ss,
+        unsigned default_n_fragments,
+        unsigned default_fragment_size_msec) {
+
+    uint64_t h = 14695981039346656037ULL;
+    uint32_t u;
+    pa_alsa_mapping *m;
+    pa_alsa_profile *p;
+    void *state;
+    char **d;
+
+    pa_assert(ps);
+    pa_assert(ss);
+
+    h = hash_string(h, snd_asoundlib_version());
+    h = hash_file(h, ps->fname);
+
+    u = ss->format;
+    h = hash_data(h, &u, sizeof(u));
+    h = hash_data(h, &ss->rate, sizeof(ss->rate));
+    h = hash_data(h, &default_n_fragments, sizeof(default_n_fragments));
+    h = hash_data(h, &default_fragment_size_msec, sizeof(default_fragment_size_msec));
+
+    PA_HASHMAP_FOREACH(m, ps->mappings, state) {
+        h = hash_string(h, m->name);
+        h = hash_data(h, &m->channel_map.channels, sizeof(m->channel_map.channels));
+        h = hash_data(h, m->channel_map.map, m->channel_map.channels * sizeof(m->channel_map.map[0]));
+
+        for (d = m->device_strings; d && *d; d++)
+            h = hash_string(h, *d);
+
+        h = hash_string(h, NULL);
+
+        h = hash_path_files(h, m->output_path_names);
+        h = hash_path_files(h, m->input_path_names);
+    }
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state) {
+        h = hash_string(h, p->name);
+        h = hash_data(h, p->supported ? "s" : "p", 1);
+        h = hash_mapping_names(h, p->output_mappings);
+        h = hash_mapping_names(h, p->input_mappings);
+    }
+
+    return h;
+}
+
+static pa_bool_t probe_cached_mappings(
+        pa_alsa_profile *p,
+        pa_alsa_direction_t direction,
+        pa_hashmap *opened,
+        const char *dev_id,
+        const pa_sample_spec *ss,
+        unsigned default_n_fragments,
+        unsigned default_fragment_size_msec) {
+
+    pa_idxset *mappings;
+    pa_alsa_mapping *m;
+    uint32_t idx;
+    snd_pcm_t **pcm;
+
+    mappings = direction == PA_ALSA_DIRECTION_OUTPUT ? p->output_mappings : p->input_mappings;
+
+    if (!mappings)
+        return TRUE;
+
+    PA_IDXSET_FOREACH(m, mappings, idx) {
+
+        pcm = direction == PA_ALSA_DIRECTION_OUTPUT ? &m->output_pcm : &m->input_pcm;
+
+        /* Every mapping is opened only once, just to probe its paths */
+        if (pa_hashmap_get(opened, pcm))
+            continue;
+
+        pa_log_debug("Checking for %s on %s (%s)",
+                     direction == PA_ALSA_DIRECTION_OUTPUT ? "playback" : "recording",
+                     m->description, m->name);
+
+        if (!(*pcm = mapping_open_pcm(m, ss, dev_id,
+                                      direction == PA_ALSA_DIRECTION_OUTPUT ? SND_PCM_STREAM_PLAYBACK : SND_PCM_STREAM_CAPTURE,
+                                      default_n_fragments,
+                                      default_fragment_size_msec)))
+            return FALSE;
+
+        pa_hashmap_put(opened, pcm, pcm);
+
+        mapping_paths_probe(m, p, direction);
+
+        snd_pcm_close(*pcm);
+        *pcm = NULL;
+    }
+
+    return TRUE;
+}
+
+/* Like pa_alsa_profile_set_probe(), but takes the profiles in the
+ * NULL-terminated list supported to be the ones that are supported,
+ * instead of trying to open each profile's PCMs. The mappings of these
+ * profiles are opened once each to probe their mixer paths. If the list
+ * turns out to be out of date, this probes the profile set fully.
+ * Returns TRUE if the list could be used. */
+pa_bool_t pa_alsa_profile_set_probe_cached(
+        pa_alsa_profile_set *ps,
+        const char *dev_id,
+        const pa_sample_spec *ss,
+        unsigned default_n_fragments,
+        unsigned default_fragment_size_msec,
+        const char * const *supported) {
+
+    void *state;
+    pa_alsa_profile *p;
+    pa_alsa_mapping *m;
+    pa_hashmap *skip_probe, *opened;
+    const char * const *n;
+    pa_bool_t valid = TRUE;
+    uint32_t idx;
+
+    pa_assert(ps);
+    pa_assert(dev_id);
+    pa_assert(ss);
+    pa_assert(supported);
+
+    if (ps->probed)
+        return TRUE;
+
+    for (n = supported; *n; n++)
+        if (!pa_hashmap_get(ps->profiles, *n)) {
+            pa_log_debug("Cached profile %s doesn't exist anymore.", *n);
+            pa_alsa_profile_set_probe(ps, dev_id, ss, default_n_fragments, default_fragment_size_msec);
+            return FALSE;
+        }
+
+    skip_probe = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    opened = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state)
+        if (p->supported)
+            pa_hashmap_put(skip_probe, p, p);
+
+    for (n = supported; *n; n++)
+        ((pa_alsa_profile*) pa_hashmap_get(ps->profiles, *n))->supported = TRUE;
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state) {
+
+        if (!p->supported || pa_hashmap_get(skip_probe, p))
+            continue;
+
+        if (!probe_cached_mappings(p, PA_ALSA_DIRECTION_OUTPUT, opened, dev_id, ss, default_n_fragments, default_fragment_size_msec) ||
+            !probe_cached_mappings(p, PA_ALSA_DIRECTION_INPUT, opened, dev_id, ss, default_n_fragments, default_fragment_size_msec)) {
+
+            pa_log_info("Profile %s can't be opened anymore, probing all profiles.", p->name);
+            valid = FALSE;
+            break;
+        }
+    }
+
+    if (valid) {
+        PA_HASHMAP_FOREACH(p, ps->profiles, state) {
+
+            if (!p->supported || pa_hashmap_get(skip_probe, p))
+                continue;
+
+            pa_log_debug("Profile %s supported (cached).", p->name);
+
+            if (p->output_mappings)
+                PA_IDXSET_FOREACH(m, p->output_mappings, idx)
+                    m->supported++;
+
+            if (p->input_mappings)
+                PA_IDXSET_FOREACH(m, p->input_mappings, idx)
+                    m->supported++;
+        }
+
+        pa_alsa_profile_set_drop_unsupported(ps);
+
+        paths_drop_unsupported(ps->input_paths);
+        paths_drop_unsupported(ps->output_paths);
+
+        ps->probed = TRUE;
+    } else {
+        /* The paths that were probed already stay probed */
+        PA_HASHMAP_FOREACH(p, ps->profiles, state)
+            p->supported = !!pa_hashmap_get(skip_probe, p);
+
+        pa_alsa_profile_set_probe(ps, dev_id, ss, default_n_fragments, default_fragment_size_msec);
+    }
+
+    pa_hashmap_free(skip_probe, NULL);
+    pa_hashmap_free(opened, NULL);
+
+    return valid;
+}
+
 void pa_alsa_profile_set_dump(pa_alsa_profile_set *ps) {
     pa_alsa_profile *p;
     pa_alsa_mapping *m;
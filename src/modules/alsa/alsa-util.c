@@ -1305,6 +1305,29 @@ char *pa_alsa_get_driver_name_by_pcm(snd_pcm_t *pcm) {
     return pa_alsa_get_driver_name(card);
 }
 
+char *pa_alsa_get_card_id(int card) {
+    char *name, *id = NULL;
+    snd_ctl_t *ctl;
+    snd_ctl_card_info_t *info;
+
+    pa_assert(card >= 0);
+
+    snd_ctl_card_info_alloca(&info);
+
+    name = pa_sprintf_malloc("hw:%i", card);
+
+    if (snd_ctl_open(&ctl, name, 0) >= 0) {
+        if (snd_ctl_card_info(ctl, info) >= 0)
+            id = pa_xstrdup(snd_ctl_card_info_get_id(info));
+
+        snd_ctl_close(ctl);
+    }
+
+    pa_xfree(name);
+
+    return id;
+}
+
 char *pa_alsa_get_reserve_name(const char *device) {
     const char *t;
     int i;
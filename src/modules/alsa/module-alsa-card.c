@@ -23,12 +23,15 @@
 #include <config.h>
 #endif
 
+#include <pulse/rtclock.h>
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/core-util.h>
+#include <pulsecore/database.h>
 #include <pulsecore/i18n.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/queue.h>
+#include <pulsecore/tagstruct.h>
 
 #include <modules/reserve-wrap.h>
 
@@ -71,6 +74,7 @@ PA_MODULE_USAGE(
         "profile_set=<profile set configuration file> "
         "paths_dir=<directory containing the path configuration files> "
         "use_ucm=<load use case manager> "
+        "use_probe_cache=<reuse the profiles found on this card the last time? Not for UCM> "
 );
 
 static const char* const valid_modargs[] = {
@@ -98,11 +102,14 @@ static const char* const valid_modargs[] = {
     "profile_set",
     "paths_dir",
     "use_ucm",
+    "use_probe_cache",
     NULL
 };
 
 #define DEFAULT_DEVICE_ID "0"
 
+#define PROBE_CACHE_VERSION 1
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -603,10 +610,169 @@ static pa_hook_result_t source_output_unlink_hook_callback(pa_core *c, pa_source
     return PA_HOOK_OK;
 }
 
+/* Cards are told apart by what ALSA knows about the hardware, not by
+ * their index, which may change between boots. Two identical cards
+ * only differ in their ALSA card ID and where they are plugged in. */
+static char *probe_cache_key(struct userdata *u) {
+    pa_proplist *p;
+    char *ctl, *id, *key;
+
+    p = pa_proplist_new();
+    pa_alsa_init_proplist_card(u->core, p, u->alsa_card_index);
+
+    ctl = pa_sprintf_malloc("hw:%i", u->alsa_card_index);
+    pa_alsa_init_proplist_ctl(p, ctl);
+    pa_xfree(ctl);
+
+    id = pa_alsa_get_card_id(u->alsa_card_index);
+
+    key = pa_sprintf_malloc("%s\t%s\t%s\t%s\t%s\t%s",
+                            pa_strempty(id),
+                            pa_strempty(pa_proplist_gets(p, PA_PROP_DEVICE_BUS_PATH)),
+                            pa_strempty(pa_proplist_gets(p, "alsa.driver_name")),
+                            pa_strempty(pa_proplist_gets(p, "alsa.long_card_name")),
+                            pa_strempty(pa_proplist_gets(p, "alsa.mixer_name")),
+                            pa_strempty(pa_proplist_gets(p, "alsa.components")));
+
+    pa_xfree(id);
+    pa_proplist_free(p);
+    return key;
+}
+
+/* Returns the NULL-terminated list of the profiles that were found
+ * supported the last time, if nothing they depend on changed since */
+static char **probe_cache_read(struct userdata *u, pa_database *db, const char *name, uint64_t hash) {
+    pa_datum key, data;
+    pa_tagstruct *t = NULL;
+    uint8_t version;
+    uint64_t h;
+    uint32_t n, i;
+    char **supported = NULL;
+
+    key.data = (char*) name;
+    key.size = strlen(name);
+
+    pa_zero(data);
+
+    if (!pa_database_get(db, &key, &data))
+        return NULL;
+
+    t = pa_tagstruct_new(data.data, data.size);
+
+    if (pa_tagstruct_getu8(t, &version) < 0 ||
+        version != PROBE_CACHE_VERSION ||
+        pa_tagstruct_getu64(t, &h) < 0 ||
+        pa_tagstruct_getu32(t, &n) < 0 ||
+        n > pa_hashmap_size(u->profile_set->profiles))
+        goto fail;
+
+    if (h != hash) {
+        pa_log_debug("Profile set or probing parameters changed, ignoring the probe cache.");
+        goto fail;
+    }
+
+    supported = pa_xnew0(char*, n + 1);
+
+    for (i = 0; i < n; i++) {
+        const char *profile;
+
+        if (pa_tagstruct_gets(t, &profile) < 0 || !profile)
+            goto fail;
+
+        supported[i] = pa_xstrdup(profile);
+    }
+
+    if (!pa_tagstruct_eof(t))
+        goto fail;
+
+    pa_tagstruct_free(t);
+    pa_datum_free(&data);
+
+    return supported;
+
+fail:
+    pa_xstrfreev(supported);
+
+    pa_tagstruct_free(t);
+    pa_datum_free(&data);
+
+    return NULL;
+}
+
+static void probe_cache_write(struct userdata *u, pa_database *db, const char *name, uint64_t hash) {
+    pa_datum key, data;
+    pa_tagstruct *t;
+    pa_alsa_profile *p;
+    void *state;
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu8(t, PROBE_CACHE_VERSION);
+    pa_tagstruct_putu64(t, hash);
+
+    /* Only the supported profiles are left after probing */
+    pa_tagstruct_putu32(t, pa_hashmap_size(u->profile_set->profiles));
+    PA_HASHMAP_FOREACH(p, u->profile_set->profiles, state)
+        pa_tagstruct_puts(t, p->name);
+
+    key.data = (char*) name;
+    key.size = strlen(name);
+
+    data.data = (void*) pa_tagstruct_data(t, &data.size);
+
+    if (pa_database_set(db, &key, &data, TRUE) < 0 || pa_database_sync(db) < 0)
+        pa_log_warn("Failed to write the probe cache.");
+
+    pa_tagstruct_free(t);
+}
+
+/* Opening the PCMs of every profile is what makes loading a card slow,
+ * so we remember which profiles worked the last time and only check
+ * that these still do. Returns TRUE if the cached profiles were used.
+ * UCM profile sets are probed while they are created, so they can't
+ * use the cache. */
+static pa_bool_t probe_profile_set(struct userdata *u, pa_bool_t use_cache) {
+    pa_core *c = u->core;
+    pa_database *db = NULL;
+    char *fname, *key = NULL, **supported = NULL;
+    uint64_t hash = 0;
+    pa_bool_t cached = FALSE;
+
+    if (use_cache && (fname = pa_state_path("alsa-probe-cache", TRUE))) {
+        if (!(db = pa_database_open(fname, TRUE)))
+            pa_log_warn("Failed to open probe cache '%s'.", fname);
+
+        pa_xfree(fname);
+    }
+
+    if (db) {
+        hash = pa_alsa_profile_set_probe_hash(u->profile_set, &c->default_sample_spec, c->default_n_fragments, c->default_fragment_size_msec);
+        key = probe_cache_key(u);
+        supported = probe_cache_read(u, db, key, hash);
+    }
+
+    if (supported)
+        cached = pa_alsa_profile_set_probe_cached(u->profile_set, u->device_id, &c->default_sample_spec, c->default_n_fragments, c->default_fragment_size_msec, (const char * const *) supported);
+    else
+        pa_alsa_profile_set_probe(u->profile_set, u->device_id, &c->default_sample_spec, c->default_n_fragments, c->default_fragment_size_msec);
+
+    if (db) {
+        if (!cached)
+            probe_cache_write(u, db, key, hash);
+
+        pa_database_close(db);
+    }
+
+    pa_xstrfreev(supported);
+    pa_xfree(key);
+
+    return cached;
+}
+
 int pa__init(pa_module *m) {
     pa_card_new_data data;
     pa_modargs *ma;
-    pa_bool_t ignore_dB = FALSE;
+    pa_bool_t ignore_dB = FALSE, use_probe_cache = TRUE, cached;
+    pa_usec_t probe_start;
     struct userdata *u;
     pa_reserve_wrapper *reserve = NULL;
     const char *description;
@@ -654,6 +820,14 @@ int pa__init(pa_module *m) {
         }
     }
 
+    if (pa_modargs_get_value_boolean(ma, "use_probe_cache", &use_probe_cache) < 0) {
+        pa_log("Failed to parse use_probe_cache argument.");
+        goto fail;
+    }
+
+    /* UCM probes while it sets up the profile set */
+    probe_start = pa_rtclock_now();
+
     pa_modargs_get_value_boolean(ma, "use_ucm", &u->use_ucm);
     if (u->use_ucm && !pa_alsa_ucm_query_profiles(&u->ucm, u->alsa_card_index)) {
         pa_log_info("Found UCM profiles");
@@ -694,7 +868,13 @@ int pa__init(pa_module *m) {
 
     u->profile_set->ignore_dB = ignore_dB;
 
-    pa_alsa_profile_set_probe(u->profile_set, u->device_id, &m->core->default_sample_spec, m->core->default_n_fragments, m->core->default_fragment_size_msec);
+    cached = probe_profile_set(u, use_probe_cache && !u->use_ucm);
+
+    pa_log_info("Probing card %s took %0.1f ms%s.",
+                u->device_id,
+                (double) (pa_rtclock_now() - probe_start) / PA_USEC_PER_MSEC,
+                cached ? " (profiles from the probe cache)" : "");
+
     pa_alsa_profile_set_dump(u->profile_set);
 
     pa_card_new_data_init(&data);
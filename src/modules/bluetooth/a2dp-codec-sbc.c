@@ -0,0 +1,351 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <sbc/sbc.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "a2dp-codec.h"
+#include "a2dp-codecs.h"
+#include "rtp.h"
+
+#define BITPOOL_DEC_LIMIT 32
+#define BITPOOL_DEC_STEP 5
+
+/* The frame count in the payload header only has four bits */
+#define MAX_FRAME_COUNT 15
+
+struct sbc_info {
+    sbc_t sbc;                           /* Codec data */
+    size_t codesize, frame_length;       /* SBC Codesize, frame_length. We simply cache those values here */
+
+    uint8_t min_bitpool;
+    uint8_t max_bitpool;
+};
+
+static void *sbc_codec_init(const uint8_t *config_data, size_t config_size, bool for_encoding, pa_sample_spec *ss) {
+    struct sbc_info *info;
+    const a2dp_sbc_t *config;
+
+    if (config_size != sizeof(a2dp_sbc_t)) {
+        pa_log_error("Invalid SBC configuration size %lu", (unsigned long) config_size);
+        return NULL;
+    }
+
+    config = (const a2dp_sbc_t *) config_data;
+
+    info = pa_xnew0(struct sbc_info, 1);
+    sbc_init(&info->sbc, 0);
+
+    ss->format = PA_SAMPLE_S16LE;
+
+    switch (config->frequency) {
+        case SBC_SAMPLING_FREQ_16000:
+            info->sbc.frequency = SBC_FREQ_16000;
+            ss->rate = 16000U;
+            break;
+        case SBC_SAMPLING_FREQ_32000:
+            info->sbc.frequency = SBC_FREQ_32000;
+            ss->rate = 32000U;
+            break;
+        case SBC_SAMPLING_FREQ_44100:
+            info->sbc.frequency = SBC_FREQ_44100;
+            ss->rate = 44100U;
+            break;
+        case SBC_SAMPLING_FREQ_48000:
+            info->sbc.frequency = SBC_FREQ_48000;
+            ss->rate = 48000U;
+            break;
+        default:
+            goto fail;
+    }
+
+    switch (config->channel_mode) {
+        case SBC_CHANNEL_MODE_MONO:
+            info->sbc.mode = SBC_MODE_MONO;
+            ss->channels = 1;
+            break;
+        case SBC_CHANNEL_MODE_DUAL_CHANNEL:
+            info->sbc.mode = SBC_MODE_DUAL_CHANNEL;
+            ss->channels = 2;
+            break;
+        case SBC_CHANNEL_MODE_STEREO:
+            info->sbc.mode = SBC_MODE_STEREO;
+            ss->channels = 2;
+            break;
+        case SBC_CHANNEL_MODE_JOINT_STEREO:
+            info->sbc.mode = SBC_MODE_JOINT_STEREO;
+            ss->channels = 2;
+            break;
+        default:
+            goto fail;
+    }
+
+    switch (config->allocation_method) {
+        case SBC_ALLOCATION_SNR:
+            info->sbc.allocation = SBC_AM_SNR;
+            break;
+        case SBC_ALLOCATION_LOUDNESS:
+            info->sbc.allocation = SBC_AM_LOUDNESS;
+            break;
+        default:
+            goto fail;
+    }
+
+    switch (config->subbands) {
+        case SBC_SUBBANDS_4:
+            info->sbc.subbands = SBC_SB_4;
+            break;
+        case SBC_SUBBANDS_8:
+            info->sbc.subbands = SBC_SB_8;
+            break;
+        default:
+            goto fail;
+    }
+
+    switch (config->block_length) {
+        case SBC_BLOCK_LENGTH_4:
+            info->sbc.blocks = SBC_BLK_4;
+            break;
+        case SBC_BLOCK_LENGTH_8:
+            info->sbc.blocks = SBC_BLK_8;
+            break;
+        case SBC_BLOCK_LENGTH_12:
+            info->sbc.blocks = SBC_BLK_12;
+            break;
+        case SBC_BLOCK_LENGTH_16:
+            info->sbc.blocks = SBC_BLK_16;
+            break;
+        default:
+            goto fail;
+    }
+
+    info->min_bitpool = config->min_bitpool;
+    info->max_bitpool = config->max_bitpool;
+
+    /* Set minimum bitpool for source to get the maximum possible block_size */
+    info->sbc.bitpool = for_encoding ? info->max_bitpool : info->min_bitpool;
+    info->codesize = sbc_get_codesize(&info->sbc);
+    info->frame_length = sbc_get_frame_length(&info->sbc);
+
+    pa_log_info("SBC parameters:\n\tallocation=%u\n\tsubbands=%u\n\tblocks=%u\n\tbitpool=%u\n",
+                info->sbc.allocation, info->sbc.subbands, info->sbc.blocks, info->sbc.bitpool);
+
+    return info;
+
+fail:
+    pa_log_error("Unsupported SBC configuration");
+    sbc_finish(&info->sbc);
+    pa_xfree(info);
+
+    return NULL;
+}
+
+static void sbc_codec_done(void *state) {
+    struct sbc_info *info = state;
+
+    sbc_finish(&info->sbc);
+    pa_xfree(info);
+}
+
+static size_t sbc_codec_get_block_size(void *state, size_t mtu) {
+    struct sbc_info *info = state;
+    size_t frame_count;
+
+    pa_assert(mtu > sizeof(struct rtp_payload));
+
+    frame_count = (mtu - sizeof(struct rtp_payload)) / info->frame_length;
+    frame_count = PA_MIN(frame_count, (size_t) MAX_FRAME_COUNT);
+
+    return frame_count * info->codesize;
+}
+
+static bool sbc_set_bitpool(struct sbc_info *info, uint8_t bitpool) {
+    if (bitpool > info->max_bitpool)
+        bitpool = info->max_bitpool;
+    else if (bitpool < info->min_bitpool)
+        bitpool = info->min_bitpool;
+
+    if (info->sbc.bitpool == bitpool)
+        return false;
+
+    info->sbc.bitpool = bitpool;
+
+    info->codesize = sbc_get_codesize(&info->sbc);
+    info->frame_length = sbc_get_frame_length(&info->sbc);
+
+    pa_log_debug("Bitpool has changed to %u", info->sbc.bitpool);
+
+    return true;
+}
+
+static bool sbc_codec_reset_bitrate(void *state) {
+    struct sbc_info *info = state;
+
+    return sbc_set_bitpool(info, info->max_bitpool);
+}
+
+static bool sbc_codec_reduce_bitrate(void *state) {
+    struct sbc_info *info = state;
+    uint8_t bitpool;
+
+    /* Check if bitpool is already at its limit */
+    if (info->sbc.bitpool <= BITPOOL_DEC_LIMIT)
+        return false;
+
+    bitpool = info->sbc.bitpool - BITPOOL_DEC_STEP;
+
+    if (bitpool < BITPOOL_DEC_LIMIT)
+        bitpool = BITPOOL_DEC_LIMIT;
+
+    return sbc_set_bitpool(info, bitpool);
+}
+
+static size_t sbc_codec_encode(void *state, const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size, size_t *written) {
+    struct sbc_info *info = state;
+    struct rtp_payload *payload;
+    const uint8_t *p;
+    uint8_t *d;
+    size_t to_write, to_encode;
+    unsigned frame_count;
+
+    pa_assert(out_size >= sizeof(*payload));
+
+    payload = (struct rtp_payload*) out;
+
+    p = in;
+    to_encode = in_size;
+
+    d = out + sizeof(*payload);
+    to_write = out_size - sizeof(*payload);
+
+    frame_count = 0;
+
+    while (PA_LIKELY(to_encode >= info->codesize && to_write >= info->frame_length && frame_count < MAX_FRAME_COUNT)) {
+        ssize_t frame_written;
+        ssize_t encoded;
+
+        encoded = sbc_encode(&info->sbc,
+                             p, to_encode,
+                             d, to_write,
+                             &frame_written);
+
+        if (PA_UNLIKELY(encoded <= 0)) {
+            pa_log_error("SBC encoding error (%li)", (long) encoded);
+            return 0;
+        }
+
+        pa_assert_fp((size_t) encoded == info->codesize);
+        pa_assert_fp((size_t) frame_written == info->frame_length);
+
+        p += encoded;
+        to_encode -= encoded;
+
+        d += frame_written;
+        to_write -= frame_written;
+
+        frame_count++;
+    }
+
+    memset(payload, 0, sizeof(*payload));
+    payload->frame_count = frame_count;
+
+    *written = d - out;
+
+    return p - in;
+}
+
+static size_t sbc_codec_decode(void *state, const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size, size_t *written) {
+    struct sbc_info *info = state;
+    const uint8_t *p;
+    uint8_t *d;
+    size_t to_write, to_decode;
+
+    if (PA_UNLIKELY(in_size < sizeof(struct rtp_payload))) {
+        pa_log_error("SBC packet too short (%lu)", (unsigned long) in_size);
+        return 0;
+    }
+
+    p = in + sizeof(struct rtp_payload);
+    to_decode = in_size - sizeof(struct rtp_payload);
+
+    d = out;
+    to_write = out_size;
+
+    while (PA_LIKELY(to_decode > 0)) {
+        size_t frame_written;
+        ssize_t decoded;
+
+        decoded = sbc_decode(&info->sbc,
+                             p, to_decode,
+                             d, to_write,
+                             &frame_written);
+
+        if (PA_UNLIKELY(decoded <= 0)) {
+            pa_log_error("SBC decoding error (%li)", (long) decoded);
+            return 0;
+        }
+
+        /* Reset frame length, it can be changed due to bitpool change */
+        info->frame_length = sbc_get_frame_length(&info->sbc);
+
+        pa_assert_fp((size_t) decoded <= to_decode);
+        pa_assert_fp((size_t) decoded == info->frame_length);
+
+        pa_assert_fp((size_t) frame_written <= to_write);
+
+        p += decoded;
+        to_decode -= decoded;
+
+        d += frame_written;
+        to_write -= frame_written;
+    }
+
+    *written = d - out;
+
+    return p - in;
+}
+
+static const char *sbc_codec_get_info(void *state) {
+    struct sbc_info *info = state;
+
+    return sbc_get_implementation_info(&info->sbc);
+}
+
+const pa_a2dp_codec pa_a2dp_codec_sbc = {
+    .name = "sbc",
+    .id = A2DP_CODEC_SBC,
+    .init = sbc_codec_init,
+    .done = sbc_codec_done,
+    .get_block_size = sbc_codec_get_block_size,
+    .reset_bitrate = sbc_codec_reset_bitrate,
+    .reduce_bitrate = sbc_codec_reduce_bitrate,
+    .encode = sbc_codec_encode,
+    .decode = sbc_codec_decode,
+    .get_info = sbc_codec_get_info,
+};
@@ -0,0 +1,77 @@
+#ifndef fooa2dpcodechfoo
+#define fooa2dpcodechfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include <pulse/sample.h>
+
+/* An A2DP codec, as used by module-bluetooth-device. The module only
+ * deals with the RTP header, everything after it (including any codec
+ * specific payload header) is up to the codec.
+ *
+ * All functions except init() and done() are called from the IO thread
+ * and must not allocate memory. */
+
+typedef struct pa_a2dp_codec pa_a2dp_codec;
+
+struct pa_a2dp_codec {
+    const char *name;
+    uint8_t id; /* A2DP_CODEC_* */
+
+    /* Sets up codec state for the configuration negotiated over the
+     * transport and fills in the sample spec the codec works with.
+     * Returns NULL if the configuration isn't usable. */
+    void *(*init)(const uint8_t *config, size_t config_size, bool for_encoding, pa_sample_spec *ss);
+    void (*done)(void *state);
+
+    /* Number of PCM bytes that go into one packet payload of at most
+     * mtu bytes. Changes when the bitrate does. */
+    size_t (*get_block_size)(void *state, size_t mtu);
+
+    /* Switch back to the highest bitrate the configuration allows, or
+     * to a lower one after we failed to keep up. Return true if the
+     * bitrate changed. */
+    bool (*reset_bitrate)(void *state);
+    bool (*reduce_bitrate)(void *state);
+
+    /* Encode one packet payload from at most in_size PCM bytes into
+     * out. Returns the number of PCM bytes consumed, 0 on error, and sets
+     * *written to the size of the payload. */
+    size_t (*encode)(void *state, const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size, size_t *written);
+
+    /* Decode one packet payload. Returns the number of payload bytes
+     * consumed, 0 on error, and sets *written to the number of PCM
+     * bytes produced. */
+    size_t (*decode)(void *state, const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size, size_t *written);
+
+    /* Optional, for logging */
+    const char *(*get_info)(void *state);
+};
+
+extern const pa_a2dp_codec pa_a2dp_codec_sbc;
+
+/* Returns NULL if we don't know the codec */
+const pa_a2dp_codec *pa_a2dp_codec_get(uint8_t id);
+
+#endif
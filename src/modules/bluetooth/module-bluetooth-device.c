@@ -29,6 +29,7 @@
 #include <math.h>
 #include <linux/sockios.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
 
 #include <pulse/rtclock.h>
 #include <pulse/sample.h>
@@ -50,15 +51,14 @@
 #include <pulsecore/time-smoother.h>
 #include <pulsecore/namereg.h>
 
-#include <sbc/sbc.h>
-
 #include "module-bluetooth-device-symdef.h"
-#include "a2dp-codecs.h"
+#include "a2dp-codec.h"
 #include "rtp.h"
 #include "bluetooth-util.h"
 
-#define BITPOOL_DEC_LIMIT 32
-#define BITPOOL_DEC_STEP 5
+/* How many A2DP packets we encode and hand to the kernel at once at
+ * most, when more than one is due */
+#define A2DP_MAX_BATCH 4
 
 PA_MODULE_AUTHOR("Joao Paulo Rechi Vita");
 PA_MODULE_DESCRIPTION("Bluetooth audio sink and source");
@@ -103,16 +103,20 @@ static const char* const valid_modargs[] = {
 };
 
 struct a2dp_info {
-    sbc_t sbc;                           /* Codec data */
-    bool sbc_initialized;                /* Keep track if the encoder is initialized */
-    size_t codesize, frame_length;       /* SBC Codesize, frame_length. We simply cache those values here */
+    const pa_a2dp_codec *codec;          /* Codec implementation */
+    void *codec_state;                   /* Codec data */
 
-    void* buffer;                        /* Codec transfer buffer */
+    void* buffer;                        /* Codec transfer buffer, room for A2DP_MAX_BATCH packets */
     size_t buffer_size;                  /* Size of the buffer */
+    size_t packet_size;                  /* Room for one packet in the buffer */
+
+    /* Packets encoded into the buffer, and how many of them have been
+     * written out already */
+    size_t packet_length[A2DP_MAX_BATCH];
+    size_t packet_pcm_length[A2DP_MAX_BATCH];
+    unsigned n_packets, n_written;
 
     uint16_t seq_num;                    /* Cumulative packet sequence */
-    uint8_t min_bitpool;
-    uint8_t max_bitpool;
 };
 
 struct hsp_info {
@@ -208,36 +212,15 @@ enum {
 static int init_profile(struct userdata *u);
 
 /* from IO thread */
-static void a2dp_set_bitpool(struct userdata *u, uint8_t bitpool)
-{
+static void a2dp_bitrate_changed(struct userdata *u) {
     struct a2dp_info *a2dp;
 
     pa_assert(u);
 
     a2dp = &u->a2dp;
 
-    if (a2dp->sbc.bitpool == bitpool)
-        return;
-
-    if (bitpool > a2dp->max_bitpool)
-        bitpool = a2dp->max_bitpool;
-    else if (bitpool < a2dp->min_bitpool)
-        bitpool = a2dp->min_bitpool;
-
-    a2dp->sbc.bitpool = bitpool;
-
-    a2dp->codesize = sbc_get_codesize(&a2dp->sbc);
-    a2dp->frame_length = sbc_get_frame_length(&a2dp->sbc);
-
-    pa_log_debug("Bitpool has changed to %u", a2dp->sbc.bitpool);
-
-    u->read_block_size =
-        (u->read_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-        / a2dp->frame_length * a2dp->codesize;
-
-    u->write_block_size =
-        (u->write_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-        / a2dp->frame_length * a2dp->codesize;
+    u->read_block_size = a2dp->codec->get_block_size(a2dp->codec_state, u->read_link_mtu - sizeof(struct rtp_header));
+    u->write_block_size = a2dp->codec->get_block_size(a2dp->codec_state, u->write_link_mtu - sizeof(struct rtp_header));
 
     pa_sink_set_max_request_within_thread(u->sink, u->write_block_size);
     pa_sink_set_fixed_latency_within_thread(u->sink,
@@ -251,13 +234,8 @@ static void bt_transport_config_mtu(struct userdata *u) {
         u->read_block_size = u->read_link_mtu;
         u->write_block_size = u->write_link_mtu;
     } else {
-        u->read_block_size =
-            (u->read_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-            / u->a2dp.frame_length * u->a2dp.codesize;
-
-        u->write_block_size =
-            (u->write_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-            / u->a2dp.frame_length * u->a2dp.codesize;
+        u->read_block_size = u->a2dp.codec->get_block_size(u->a2dp.codec_state, u->read_link_mtu - sizeof(struct rtp_header));
+        u->write_block_size = u->a2dp.codec->get_block_size(u->a2dp.codec_state, u->write_link_mtu - sizeof(struct rtp_header));
     }
 
     if (USE_SCO_OVER_PCM(u))
@@ -297,8 +275,8 @@ static void setup_stream(struct userdata *u) {
 
     pa_log_debug("Stream properly set up, we're ready to roll!");
 
-    if (u->profile == PROFILE_A2DP)
-        a2dp_set_bitpool(u, u->a2dp.max_bitpool);
+    if (u->profile == PROFILE_A2DP && u->a2dp.codec->reset_bitrate(u->a2dp.codec_state))
+        a2dp_bitrate_changed(u);
 
     u->rtpoll_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER, 1);
     pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
@@ -340,6 +318,8 @@ static void teardown_stream(struct userdata *u) {
         pa_memchunk_reset(&u->write_memchunk);
     }
 
+    u->a2dp.n_packets = u->a2dp.n_written = 0;
+
     pa_log_debug("Audio stream torn down");
 }
 
@@ -708,10 +688,12 @@ static int hsp_process_push(struct userdata *u) {
 
 /* Run from IO thread */
 static void a2dp_prepare_buffer(struct userdata *u) {
-    size_t min_buffer_size = PA_MAX(u->read_link_mtu, u->write_link_mtu);
+    size_t min_buffer_size = PA_MAX(u->read_link_mtu, A2DP_MAX_BATCH * u->write_link_mtu);
 
     pa_assert(u);
 
+    u->a2dp.packet_size = u->write_link_mtu;
+
     if (u->a2dp.buffer_size >= min_buffer_size)
         return;
 
@@ -720,100 +702,72 @@ static void a2dp_prepare_buffer(struct userdata *u) {
     u->a2dp.buffer = pa_xmalloc(u->a2dp.buffer_size);
 }
 
-/* Run from IO thread */
-static int a2dp_process_render(struct userdata *u) {
-    struct a2dp_info *a2dp;
-    struct rtp_header *header;
-    struct rtp_payload *payload;
-    size_t nbytes;
-    void *d;
-    const void *p;
-    size_t to_write, to_encode;
-    unsigned frame_count;
-    int ret = 0;
+/* Hands the encoded packets to the kernel, all in one syscall if we
+ * can. Returns how many were written, which is less than what was
+ * pending if the socket filled up.
+ *
+ * Run from IO thread */
+static int a2dp_write_packets(struct userdata *u) {
+    struct a2dp_info *a2dp = &u->a2dp;
+    unsigned first = a2dp->n_written;
 
-    pa_assert(u);
-    pa_assert(u->profile == PROFILE_A2DP);
-    pa_assert(u->sink);
+    while (a2dp->n_written < a2dp->n_packets) {
+        unsigned i = a2dp->n_written;
+        const void *packet = (uint8_t*) a2dp->buffer + i * a2dp->packet_size;
+        size_t nbytes = a2dp->packet_length[i];
+        ssize_t l;
 
-    /* First, render some data */
-    if (!u->write_memchunk.memblock)
-        pa_sink_render_full(u->sink, u->write_block_size, &u->write_memchunk);
+#ifdef HAVE_SENDMMSG
+        if (u->stream_write_type == 0 && a2dp->n_packets - i > 1) {
+            struct mmsghdr msgs[A2DP_MAX_BATCH];
+            struct iovec iov[A2DP_MAX_BATCH];
+            unsigned k, n = a2dp->n_packets - i;
+            int r;
 
-    pa_assert(u->write_memchunk.length == u->write_block_size);
+            memset(msgs, 0, sizeof(msgs));
 
-    a2dp_prepare_buffer(u);
+            for (k = 0; k < n; k++) {
+                iov[k].iov_base = (uint8_t*) a2dp->buffer + (i + k) * a2dp->packet_size;
+                iov[k].iov_len = a2dp->packet_length[i + k];
+                msgs[k].msg_hdr.msg_iov = &iov[k];
+                msgs[k].msg_hdr.msg_iovlen = 1;
+            }
 
-    a2dp = &u->a2dp;
-    header = a2dp->buffer;
-    payload = (struct rtp_payload*) ((uint8_t*) a2dp->buffer + sizeof(*header));
+            if ((r = sendmmsg(u->stream_fd, msgs, n, MSG_NOSIGNAL)) >= 0) {
 
-    frame_count = 0;
+                for (k = 0; k < (unsigned) r; k++) {
+                    if (msgs[k].msg_len != iov[k].iov_len) {
+                        pa_log_warn("Wrote memory block to socket only partially! %llu written, wanted to write %llu.",
+                                    (unsigned long long) msgs[k].msg_len,
+                                    (unsigned long long) iov[k].iov_len);
+                        return -1;
+                    }
 
-    /* Try to create a packet of the full MTU */
+                    u->write_index += (uint64_t) a2dp->packet_pcm_length[i + k];
+                    a2dp->n_written++;
+                }
 
-    p = (const uint8_t *) pa_memblock_acquire_chunk(&u->write_memchunk);
-    to_encode = u->write_memchunk.length;
+                continue;
+            }
 
-    d = (uint8_t*) a2dp->buffer + sizeof(*header) + sizeof(*payload);
-    to_write = a2dp->buffer_size - sizeof(*header) - sizeof(*payload);
+            if (errno == EINTR)
+                /* Retry right away if we got interrupted */
+                continue;
 
-    while (PA_LIKELY(to_encode > 0 && to_write > 0)) {
-        ssize_t written;
-        ssize_t encoded;
+            else if (errno == EAGAIN)
+                /* Hmm, apparently the socket was not writable, give up for now */
+                break;
 
-        encoded = sbc_encode(&a2dp->sbc,
-                             p, to_encode,
-                             d, to_write,
-                             &written);
+            else if (errno != ENOTSOCK) {
+                pa_log_error("Failed to write data to socket: %s", pa_cstrerror(errno));
+                return -1;
+            }
 
-        if (PA_UNLIKELY(encoded <= 0)) {
-            pa_log_error("SBC encoding error (%li)", (long) encoded);
-            pa_memblock_release(u->write_memchunk.memblock);
-            return -1;
+            /* Not a socket after all, let pa_write() take it from here */
         }
+#endif
 
-/*         pa_log_debug("SBC: encoded: %lu; written: %lu", (unsigned long) encoded, (unsigned long) written); */
-/*         pa_log_debug("SBC: codesize: %lu; frame_length: %lu", (unsigned long) a2dp->codesize, (unsigned long) a2dp->frame_length); */
-
-        pa_assert_fp((size_t) encoded <= to_encode);
-        pa_assert_fp((size_t) encoded == a2dp->codesize);
-
-        pa_assert_fp((size_t) written <= to_write);
-        pa_assert_fp((size_t) written == a2dp->frame_length);
-
-        p = (const uint8_t*) p + encoded;
-        to_encode -= encoded;
-
-        d = (uint8_t*) d + written;
-        to_write -= written;
-
-        frame_count++;
-    }
-
-    pa_memblock_release(u->write_memchunk.memblock);
-
-    pa_assert(to_encode == 0);
-
-    PA_ONCE_BEGIN {
-        pa_log_debug("Using SBC encoder implementation: %s", pa_strnull(sbc_get_implementation_info(&a2dp->sbc)));
-    } PA_ONCE_END;
-
-    /* write it to the fifo */
-    memset(a2dp->buffer, 0, sizeof(*header) + sizeof(*payload));
-    header->v = 2;
-    header->pt = 1;
-    header->sequence_number = htons(a2dp->seq_num++);
-    header->timestamp = htonl(u->write_index / pa_frame_size(&u->sample_spec));
-    header->ssrc = htonl(1);
-    payload->frame_count = frame_count;
-
-    nbytes = (uint8_t*) d - (uint8_t*) a2dp->buffer;
-
-    for (;;) {
-        ssize_t l;
-
-        l = pa_write(u->stream_fd, a2dp->buffer, nbytes, &u->stream_write_type);
+        l = pa_write(u->stream_fd, packet, nbytes, &u->stream_write_type);
 
         pa_assert(l != 0);
 
@@ -828,8 +782,7 @@ static int a2dp_process_render(struct userdata *u) {
                 break;
 
             pa_log_error("Failed to write data to socket: %s", pa_cstrerror(errno));
-            ret = -1;
-            break;
+            return -1;
         }
 
         pa_assert((size_t) l <= nbytes);
@@ -838,20 +791,92 @@ static int a2dp_process_render(struct userdata *u) {
             pa_log_warn("Wrote memory block to socket only partially! %llu written, wanted to write %llu.",
                         (unsigned long long) l,
                         (unsigned long long) nbytes);
-            ret = -1;
-            break;
+            return -1;
         }
 
-        u->write_index += (uint64_t) u->write_memchunk.length;
-        pa_memblock_unref(u->write_memchunk.memblock);
-        pa_memchunk_reset(&u->write_memchunk);
+        u->write_index += (uint64_t) a2dp->packet_pcm_length[i];
+        a2dp->n_written++;
+    }
 
-        ret = 1;
+    return (int) (a2dp->n_written - first);
+}
 
-        break;
+/* Renders and encodes up to n_due packets at once, so that when we are
+ * behind they are written out with a single syscall.
+ *
+ * Run from IO thread */
+static int a2dp_process_render(struct userdata *u, unsigned n_due) {
+    struct a2dp_info *a2dp;
+    pa_memchunk memchunk;
+    const uint8_t *p;
+    unsigned i, n;
+
+    pa_assert(u);
+    pa_assert(u->profile == PROFILE_A2DP);
+    pa_assert(u->sink);
+
+    a2dp = &u->a2dp;
+
+    /* Only encode new packets once the last batch is out */
+    if (a2dp->n_written >= a2dp->n_packets) {
+        a2dp_prepare_buffer(u);
+
+        n = PA_CLAMP(n_due, 1U, (unsigned) A2DP_MAX_BATCH);
+        n = PA_CLAMP((unsigned) (pa_mempool_block_size_max(u->core->mempool) / u->write_block_size), 1U, n);
+
+        /* First, render some data */
+        pa_sink_render_full(u->sink, n * u->write_block_size, &memchunk);
+
+        pa_assert(memchunk.length == n * u->write_block_size);
+
+        p = pa_memblock_acquire_chunk(&memchunk);
+
+        for (i = 0; i < n; i++) {
+            struct rtp_header *header;
+            size_t encoded, written;
+
+            header = (struct rtp_header*) ((uint8_t*) a2dp->buffer + i * a2dp->packet_size);
+
+            encoded = a2dp->codec->encode(a2dp->codec_state,
+                                          p + i * u->write_block_size, u->write_block_size,
+                                          (uint8_t*) header + sizeof(*header), a2dp->packet_size - sizeof(*header),
+                                          &written);
+
+            if (PA_UNLIKELY(encoded != u->write_block_size)) {
+                if (encoded > 0)
+                    pa_log_error("Encoder only took %lu of %lu bytes", (unsigned long) encoded, (unsigned long) u->write_block_size);
+
+                pa_memblock_release(memchunk.memblock);
+                pa_memblock_unref(memchunk.memblock);
+                a2dp->n_packets = a2dp->n_written = 0;
+                return -1;
+            }
+
+            memset(header, 0, sizeof(*header));
+            header->v = 2;
+            header->pt = 1;
+            header->sequence_number = htons(a2dp->seq_num++);
+            header->timestamp = htonl((u->write_index + i * u->write_block_size) / pa_frame_size(&u->sample_spec));
+            header->ssrc = htonl(1);
+
+            a2dp->packet_length[i] = sizeof(*header) + written;
+            a2dp->packet_pcm_length[i] = u->write_block_size;
+        }
+
+        pa_memblock_release(memchunk.memblock);
+        pa_memblock_unref(memchunk.memblock);
+
+        a2dp->n_packets = n;
+        a2dp->n_written = 0;
+
+        PA_ONCE_BEGIN {
+            if (a2dp->codec->get_info)
+                pa_log_debug("Using %s encoder implementation: %s", a2dp->codec->name,
+                             pa_strnull(a2dp->codec->get_info(a2dp->codec_state)));
+        } PA_ONCE_END;
     }
 
-    return ret;
+    return a2dp_write_packets(u);
 }
 
 static int a2dp_process_push(struct userdata *u) {
@@ -871,17 +896,14 @@ static int a2dp_process_push(struct userdata *u) {
         pa_usec_t tstamp;
         struct a2dp_info *a2dp;
         struct rtp_header *header;
-        struct rtp_payload *payload;
-        const void *p;
         void *d;
         ssize_t l;
-        size_t to_write, to_decode;
+        size_t written, decoded;
 
         a2dp_prepare_buffer(u);
 
         a2dp = &u->a2dp;
         header = a2dp->buffer;
-        payload = (struct rtp_payload*) ((uint8_t*) a2dp->buffer + sizeof(*header));
 
         l = pa_read(u->stream_fd, a2dp->buffer, a2dp->buffer_size, &u->stream_write_type);
 
@@ -913,47 +935,26 @@ static int a2dp_process_push(struct userdata *u) {
         pa_smoother_put(u->read_smoother, tstamp, pa_bytes_to_usec(u->read_index, &u->sample_spec));
         pa_smoother_resume(u->read_smoother, tstamp, true);
 
-        p = (uint8_t*) a2dp->buffer + sizeof(*header) + sizeof(*payload);
-        to_decode = l - sizeof(*header) - sizeof(*payload);
+        if (PA_UNLIKELY((size_t) l < sizeof(*header))) {
+            pa_log_error("Received packet too short (%li)", (long) l);
+            ret = -1;
+            break;
+        }
 
         d = pa_memblock_acquire(memchunk.memblock);
-        to_write = memchunk.length = pa_memblock_get_length(memchunk.memblock);
-
-        while (PA_LIKELY(to_decode > 0)) {
-            size_t written;
-            ssize_t decoded;
-
-            decoded = sbc_decode(&a2dp->sbc,
-                                 p, to_decode,
-                                 d, to_write,
-                                 &written);
-
-            if (PA_UNLIKELY(decoded <= 0)) {
-                pa_log_error("SBC decoding error (%li)", (long) decoded);
-                pa_memblock_release(memchunk.memblock);
-                pa_memblock_unref(memchunk.memblock);
-                return -1;
-            }
 
-/*             pa_log_debug("SBC: decoded: %lu; written: %lu", (unsigned long) decoded, (unsigned long) written); */
-/*             pa_log_debug("SBC: frame_length: %lu; codesize: %lu", (unsigned long) a2dp->frame_length, (unsigned long) a2dp->codesize); */
+        decoded = a2dp->codec->decode(a2dp->codec_state,
+                                      (uint8_t*) a2dp->buffer + sizeof(*header), l - sizeof(*header),
+                                      d, pa_memblock_get_length(memchunk.memblock),
+                                      &written);
 
-            /* Reset frame length, it can be changed due to bitpool change */
-            a2dp->frame_length = sbc_get_frame_length(&a2dp->sbc);
-
-            pa_assert_fp((size_t) decoded <= to_decode);
-            pa_assert_fp((size_t) decoded == a2dp->frame_length);
-
-            pa_assert_fp((size_t) written == a2dp->codesize);
-
-            p = (const uint8_t*) p + decoded;
-            to_decode -= decoded;
-
-            d = (uint8_t*) d + written;
-            to_write -= written;
+        if (PA_UNLIKELY(decoded == 0)) {
+            pa_memblock_release(memchunk.memblock);
+            pa_memblock_unref(memchunk.memblock);
+            return -1;
         }
 
-        memchunk.length -= to_write;
+        memchunk.length = written;
 
         pa_memblock_release(memchunk.memblock);
 
@@ -968,25 +969,11 @@ static int a2dp_process_push(struct userdata *u) {
     return ret;
 }
 
-static void a2dp_reduce_bitpool(struct userdata *u)
-{
-    struct a2dp_info *a2dp;
-    uint8_t bitpool;
-
+static void a2dp_reduce_bitrate(struct userdata *u) {
     pa_assert(u);
 
-    a2dp = &u->a2dp;
-
-    /* Check if bitpool is already at its limit */
-    if (a2dp->sbc.bitpool <= BITPOOL_DEC_LIMIT)
-        return;
-
-    bitpool = a2dp->sbc.bitpool - BITPOOL_DEC_STEP;
-
-    if (bitpool < BITPOOL_DEC_LIMIT)
-        bitpool = BITPOOL_DEC_LIMIT;
-
-    a2dp_set_bitpool(u, bitpool);
+    if (u->a2dp.codec->reduce_bitrate(u->a2dp.codec_state))
+        a2dp_bitrate_changed(u);
 }
 
 static void thread_func(void *userdata) {
@@ -1084,12 +1071,20 @@ static void thread_func(void *userdata) {
                                 u->write_index += skip_bytes;
 
                                 if (u->profile == PROFILE_A2DP)
-                                    a2dp_reduce_bitpool(u);
+                                    a2dp_reduce_bitrate(u);
                             }
                         }
 
                         do_write = 1;
                         pending_read_bytes = 0;
+
+                        /* If more than one packet is due already, encode
+                         * and send them in one go. Not on the first write
+                         * though: started_at isn't set before it. */
+                        if (u->profile == PROFILE_A2DP && u->write_index > 0) {
+                            audio_to_send = PA_MIN(audio_to_send, MAX_PLAYBACK_CATCH_UP_USEC);
+                            do_write += (unsigned) (pa_usec_to_bytes(audio_to_send, &u->sample_spec) / u->write_block_size);
+                        }
                     }
                 }
 
@@ -1100,7 +1095,7 @@ static void thread_func(void *userdata) {
                         u->started_at = pa_rtclock_now();
 
                     if (u->profile == PROFILE_A2DP) {
-                        if ((n_written = a2dp_process_render(u)) < 0)
+                        if ((n_written = a2dp_process_render(u, do_write)) < 0)
                             goto io_fail;
                     } else {
                         if ((n_written = hsp_process_render(u)) < 0)
@@ -1685,124 +1680,40 @@ static int add_source(struct userdata *u) {
     return 0;
 }
 
-static void bt_transport_config_a2dp(struct userdata *u) {
+static int bt_transport_config_a2dp(struct userdata *u) {
     const pa_bluetooth_transport *t;
     struct a2dp_info *a2dp = &u->a2dp;
-    a2dp_sbc_t *config;
 
     t = u->transport;
     pa_assert(t);
 
-    config = (a2dp_sbc_t *) t->config;
-
-    u->sample_spec.format = PA_SAMPLE_S16LE;
-
-    if (a2dp->sbc_initialized)
-        sbc_reinit(&a2dp->sbc, 0);
-    else
-        sbc_init(&a2dp->sbc, 0);
-    a2dp->sbc_initialized = true;
-
-    switch (config->frequency) {
-        case SBC_SAMPLING_FREQ_16000:
-            a2dp->sbc.frequency = SBC_FREQ_16000;
-            u->sample_spec.rate = 16000U;
-            break;
-        case SBC_SAMPLING_FREQ_32000:
-            a2dp->sbc.frequency = SBC_FREQ_32000;
-            u->sample_spec.rate = 32000U;
-            break;
-        case SBC_SAMPLING_FREQ_44100:
-            a2dp->sbc.frequency = SBC_FREQ_44100;
-            u->sample_spec.rate = 44100U;
-            break;
-        case SBC_SAMPLING_FREQ_48000:
-            a2dp->sbc.frequency = SBC_FREQ_48000;
-            u->sample_spec.rate = 48000U;
-            break;
-        default:
-            pa_assert_not_reached();
-    }
-
-    switch (config->channel_mode) {
-        case SBC_CHANNEL_MODE_MONO:
-            a2dp->sbc.mode = SBC_MODE_MONO;
-            u->sample_spec.channels = 1;
-            break;
-        case SBC_CHANNEL_MODE_DUAL_CHANNEL:
-            a2dp->sbc.mode = SBC_MODE_DUAL_CHANNEL;
-            u->sample_spec.channels = 2;
-            break;
-        case SBC_CHANNEL_MODE_STEREO:
-            a2dp->sbc.mode = SBC_MODE_STEREO;
-            u->sample_spec.channels = 2;
-            break;
-        case SBC_CHANNEL_MODE_JOINT_STEREO:
-            a2dp->sbc.mode = SBC_MODE_JOINT_STEREO;
-            u->sample_spec.channels = 2;
-            break;
-        default:
-            pa_assert_not_reached();
+    if (a2dp->codec_state) {
+        a2dp->codec->done(a2dp->codec_state);
+        a2dp->codec_state = NULL;
     }
 
-    switch (config->allocation_method) {
-        case SBC_ALLOCATION_SNR:
-            a2dp->sbc.allocation = SBC_AM_SNR;
-            break;
-        case SBC_ALLOCATION_LOUDNESS:
-            a2dp->sbc.allocation = SBC_AM_LOUDNESS;
-            break;
-        default:
-            pa_assert_not_reached();
-    }
-
-    switch (config->subbands) {
-        case SBC_SUBBANDS_4:
-            a2dp->sbc.subbands = SBC_SB_4;
-            break;
-        case SBC_SUBBANDS_8:
-            a2dp->sbc.subbands = SBC_SB_8;
-            break;
-        default:
-            pa_assert_not_reached();
-    }
-
-    switch (config->block_length) {
-        case SBC_BLOCK_LENGTH_4:
-            a2dp->sbc.blocks = SBC_BLK_4;
-            break;
-        case SBC_BLOCK_LENGTH_8:
-            a2dp->sbc.blocks = SBC_BLK_8;
-            break;
-        case SBC_BLOCK_LENGTH_12:
-            a2dp->sbc.blocks = SBC_BLK_12;
-            break;
-        case SBC_BLOCK_LENGTH_16:
-            a2dp->sbc.blocks = SBC_BLK_16;
-            break;
-        default:
-            pa_assert_not_reached();
+    if (!(a2dp->codec = pa_a2dp_codec_get(t->codec))) {
+        pa_log_error("Unsupported A2DP codec %u", t->codec);
+        return -1;
     }
 
-    a2dp->min_bitpool = config->min_bitpool;
-    a2dp->max_bitpool = config->max_bitpool;
+    if (!(a2dp->codec_state = a2dp->codec->init(t->config, (size_t) t->config_size, u->profile == PROFILE_A2DP, &u->sample_spec)))
+        return -1;
 
-    /* Set minimum bitpool for source to get the maximum possible block_size */
-    a2dp->sbc.bitpool = u->profile == PROFILE_A2DP ? a2dp->max_bitpool : a2dp->min_bitpool;
-    a2dp->codesize = sbc_get_codesize(&a2dp->sbc);
-    a2dp->frame_length = sbc_get_frame_length(&a2dp->sbc);
+    pa_log_info("Using A2DP codec %s", a2dp->codec->name);
 
-    pa_log_info("SBC parameters:\n\tallocation=%u\n\tsubbands=%u\n\tblocks=%u\n\tbitpool=%u\n",
-                a2dp->sbc.allocation, a2dp->sbc.subbands, a2dp->sbc.blocks, a2dp->sbc.bitpool);
+    return 0;
 }
 
-static void bt_transport_config(struct userdata *u) {
+static int bt_transport_config(struct userdata *u) {
     if (u->profile == PROFILE_HSP || u->profile == PROFILE_HFGW) {
         u->sample_spec.format = PA_SAMPLE_S16LE;
         u->sample_spec.channels = 1;
         u->sample_spec.rate = 8000;
-    } else
-        bt_transport_config_a2dp(u);
+        return 0;
+    }
+
+    return bt_transport_config_a2dp(u);
 }
 
 /* Run from main thread */
@@ -1841,9 +1752,7 @@ static int setup_transport(struct userdata *u) {
     else if (bt_transport_acquire(u, false) < 0)
         return -1; /* We need to fail here until the interactions with module-suspend-on-idle and alike get improved */
 
-    bt_transport_config(u);
-
-    return 0;
+    return bt_transport_config(u);
 }
 
 /* Run from main thread */
@@ -2599,7 +2508,8 @@ void pa__done(pa_module *m) {
     if (u->a2dp.buffer)
         pa_xfree(u->a2dp.buffer);
 
-    sbc_finish(&u->a2dp.sbc);
+    if (u->a2dp.codec_state)
+        u->a2dp.codec->done(u->a2dp.codec_state);
 
     if (u->modargs)
         pa_modargs_free(u->modargs);
@@ -39,6 +39,9 @@ static void handle_get_current_memblocks_size(DBusConnection *conn, DBusMessage
 static void handle_get_accumulated_memblocks(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_accumulated_memblocks_size(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_sample_cache_size(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_pool_slot_sizes(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_pool_slots(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_pool_slots_used(DBusConnection *conn, DBusMessage *msg, void *userdata);
 
 static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata);
 
@@ -54,6 +57,9 @@ enum property_handler_index {
     PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS,
     PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS_SIZE,
     PROPERTY_HANDLER_SAMPLE_CACHE_SIZE,
+    PROPERTY_HANDLER_POOL_SLOT_SIZES,
+    PROPERTY_HANDLER_POOL_SLOTS,
+    PROPERTY_HANDLER_POOL_SLOTS_USED,
     PROPERTY_HANDLER_MAX
 };
 
@@ -62,7 +68,10 @@ static pa_dbus_property_handler property_handlers[PROPERTY_HANDLER_MAX] = {
     [PROPERTY_HANDLER_CURRENT_MEMBLOCKS_SIZE]     = { .property_name = "CurrentMemblocksSize",     .type = "u", .get_cb = handle_get_current_memblocks_size,     .set_cb = NULL },
     [PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS]      = { .property_name = "AccumulatedMemblocks",     .type = "u", .get_cb = handle_get_accumulated_memblocks,      .set_cb = NULL },
     [PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS_SIZE] = { .property_name = "AccumulatedMemblocksSize", .type = "u", .get_cb = handle_get_accumulated_memblocks_size, .set_cb = NULL },
-    [PROPERTY_HANDLER_SAMPLE_CACHE_SIZE]          = { .property_name = "SampleCacheSize",          .type = "u", .get_cb = handle_get_sample_cache_size,          .set_cb = NULL }
+    [PROPERTY_HANDLER_SAMPLE_CACHE_SIZE]          = { .property_name = "SampleCacheSize",          .type = "u", .get_cb = handle_get_sample_cache_size,          .set_cb = NULL },
+    [PROPERTY_HANDLER_POOL_SLOT_SIZES]            = { .property_name = "PoolSlotSizes",            .type = "au", .get_cb = handle_get_pool_slot_sizes,           .set_cb = NULL },
+    [PROPERTY_HANDLER_POOL_SLOTS]                 = { .property_name = "PoolSlots",                .type = "au", .get_cb = handle_get_pool_slots,                .set_cb = NULL },
+    [PROPERTY_HANDLER_POOL_SLOTS_USED]            = { .property_name = "PoolSlotsUsed",            .type = "au", .get_cb = handle_get_pool_slots_used,           .set_cb = NULL }
 };
 
 static pa_dbus_interface_info memstats_interface_info = {
@@ -153,6 +162,63 @@ static void handle_get_sample_cache_size(DBusConnection *conn, DBusMessage *msg,
     pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_UINT32, &sample_cache_size);
 }
 
+/* The pool properties have one entry per slot size, smallest first */
+static void get_pool_slot_sizes(pa_dbusiface_memstats *m, dbus_uint32_t *sizes) {
+    unsigned k;
+
+    for (k = 0; k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++)
+        sizes[k] = (dbus_uint32_t) pa_mempool_slot_class_size(m->core->mempool, k);
+}
+
+static void get_pool_slots(pa_dbusiface_memstats *m, dbus_uint32_t *slots, pa_bool_t used) {
+    const pa_mempool_stat *stat;
+    unsigned k;
+
+    stat = pa_mempool_get_stat(m->core->mempool);
+
+    for (k = 0; k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++)
+        slots[k] = pa_atomic_load(used ? &stat->n_used_slots_by_class[k] : &stat->n_slots_by_class[k]);
+}
+
+static void handle_get_pool_slot_sizes(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_memstats *m = userdata;
+    dbus_uint32_t pool_slot_sizes[PA_MEMPOOL_SLOT_CLASSES_MAX];
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(m);
+
+    get_pool_slot_sizes(m, pool_slot_sizes);
+
+    pa_dbus_send_basic_array_variant_reply(conn, msg, DBUS_TYPE_UINT32, pool_slot_sizes, PA_MEMPOOL_SLOT_CLASSES_MAX);
+}
+
+static void handle_get_pool_slots(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_memstats *m = userdata;
+    dbus_uint32_t pool_slots[PA_MEMPOOL_SLOT_CLASSES_MAX];
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(m);
+
+    get_pool_slots(m, pool_slots, FALSE);
+
+    pa_dbus_send_basic_array_variant_reply(conn, msg, DBUS_TYPE_UINT32, pool_slots, PA_MEMPOOL_SLOT_CLASSES_MAX);
+}
+
+static void handle_get_pool_slots_used(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_memstats *m = userdata;
+    dbus_uint32_t pool_slots_used[PA_MEMPOOL_SLOT_CLASSES_MAX];
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(m);
+
+    get_pool_slots(m, pool_slots_used, TRUE);
+
+    pa_dbus_send_basic_array_variant_reply(conn, msg, DBUS_TYPE_UINT32, pool_slots_used, PA_MEMPOOL_SLOT_CLASSES_MAX);
+}
+
 static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata) {
     pa_dbusiface_memstats *m = userdata;
     const pa_mempool_stat *stat;
@@ -161,6 +227,9 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     dbus_uint32_t accumulated_memblocks;
     dbus_uint32_t accumulated_memblocks_size;
     dbus_uint32_t sample_cache_size;
+    dbus_uint32_t pool_slot_sizes[PA_MEMPOOL_SLOT_CLASSES_MAX];
+    dbus_uint32_t pool_slots[PA_MEMPOOL_SLOT_CLASSES_MAX];
+    dbus_uint32_t pool_slots_used[PA_MEMPOOL_SLOT_CLASSES_MAX];
     DBusMessage *reply = NULL;
     DBusMessageIter msg_iter;
     DBusMessageIter dict_iter;
@@ -176,6 +245,9 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     accumulated_memblocks = pa_atomic_load(&stat->n_accumulated);
     accumulated_memblocks_size = pa_atomic_load(&stat->accumulated_size);
     sample_cache_size = pa_scache_total_size(m->core);
+    get_pool_slot_sizes(m, pool_slot_sizes);
+    get_pool_slots(m, pool_slots, FALSE);
+    get_pool_slots(m, pool_slots_used, TRUE);
 
     pa_assert_se((reply = dbus_message_new_method_return(msg)));
 
@@ -187,6 +259,9 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS].property_name, DBUS_TYPE_UINT32, &accumulated_memblocks);
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS_SIZE].property_name, DBUS_TYPE_UINT32, &accumulated_memblocks_size);
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_SAMPLE_CACHE_SIZE].property_name, DBUS_TYPE_UINT32, &sample_cache_size);
+    pa_dbus_append_basic_array_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_POOL_SLOT_SIZES].property_name, DBUS_TYPE_UINT32, pool_slot_sizes, PA_MEMPOOL_SLOT_CLASSES_MAX);
+    pa_dbus_append_basic_array_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_POOL_SLOTS].property_name, DBUS_TYPE_UINT32, pool_slots, PA_MEMPOOL_SLOT_CLASSES_MAX);
+    pa_dbus_append_basic_array_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_POOL_SLOTS_USED].property_name, DBUS_TYPE_UINT32, pool_slots_used, PA_MEMPOOL_SLOT_CLASSES_MAX);
 
     pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
 
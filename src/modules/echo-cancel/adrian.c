@@ -103,10 +103,10 @@ fail:
     return FALSE;
 }
 
-void pa_adrian_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out) {
-    unsigned int i;
+static void adrian_ec_process(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out, size_t length) {
+    size_t i;
 
-    for (i = 0; i < ec->params.priv.adrian.blocksize; i += 2) {
+    for (i = 0; i < length; i += 2) {
         /* We know it's S16NE mono data */
         int r = *(int16_t *)(rec + i);
         int p = *(int16_t *)(play + i);
@@ -114,6 +114,16 @@ void pa_adrian_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *
     }
 }
 
+void pa_adrian_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out) {
+    adrian_ec_process(ec, rec, play, out, ec->params.priv.adrian.blocksize);
+}
+
+/* The filter runs sample by sample anyway, so several blocks are just one
+ * longer loop */
+void pa_adrian_ec_run_blocks(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out, unsigned n) {
+    adrian_ec_process(ec, rec, play, out, (size_t) n * ec->params.priv.adrian.blocksize);
+}
+
 void pa_adrian_ec_done(pa_echo_canceller *ec) {
     if (ec->params.priv.adrian.aec) {
         AEC_done(ec->params.priv.adrian.aec);
@@ -53,6 +53,7 @@ struct pa_echo_canceller_params {
         struct {
             SpeexEchoState *state;
             SpeexPreprocessState *pp_state;
+            uint32_t blocksize;
         } speex;
 #endif
 #ifdef HAVE_ADRIAN_EC
@@ -108,6 +109,11 @@ struct pa_echo_canceller {
      * effort at keeping the two in sync. nframes processed frames are
      * returned in out. */
     void        (*run)                  (pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out);
+    /* Optional batched version of run(): feed the engine n * nframes
+     * playback and record frames in one go. Engines that can keep their
+     * per-call state across blocks set this, otherwise run() is called n
+     * times. */
+    void        (*run_blocks)           (pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out, unsigned n);
 
     /* Optional callback to set the drift, expressed as the ratio of the
      * difference in number of playback and capture samples to the number of
@@ -144,6 +150,7 @@ pa_bool_t pa_null_ec_init(pa_core *c, pa_echo_canceller *ec,
                           pa_sample_spec *out_ss, pa_channel_map *out_map,
                           uint32_t *nframes, const char *args);
 void pa_null_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out);
+void pa_null_ec_run_blocks(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out, unsigned n);
 void pa_null_ec_done(pa_echo_canceller *ec);
 
 #ifdef HAVE_SPEEX
@@ -154,6 +161,7 @@ pa_bool_t pa_speex_ec_init(pa_core *c, pa_echo_canceller *ec,
                            pa_sample_spec *out_ss, pa_channel_map *out_map,
                            uint32_t *nframes, const char *args);
 void pa_speex_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out);
+void pa_speex_ec_run_blocks(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out, unsigned n);
 void pa_speex_ec_done(pa_echo_canceller *ec);
 #endif
 
@@ -165,6 +173,7 @@ pa_bool_t pa_adrian_ec_init(pa_core *c, pa_echo_canceller *ec,
                             pa_sample_spec *out_ss, pa_channel_map *out_map,
                             uint32_t *nframes, const char *args);
 void pa_adrian_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out);
+void pa_adrian_ec_run_blocks(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out, unsigned n);
 void pa_adrian_ec_done(pa_echo_canceller *ec);
 #endif
 
@@ -180,6 +189,7 @@ void pa_webrtc_ec_play(pa_echo_canceller *ec, const uint8_t *play);
 void pa_webrtc_ec_record(pa_echo_canceller *ec, const uint8_t *rec, uint8_t *out);
 void pa_webrtc_ec_set_drift(pa_echo_canceller *ec, float drift);
 void pa_webrtc_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out);
+void pa_webrtc_ec_run_blocks(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out, unsigned n);
 void pa_webrtc_ec_done(pa_echo_canceller *ec);
 PA_C_DECL_END
 #endif
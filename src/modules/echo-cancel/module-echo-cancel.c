@@ -74,6 +74,7 @@ PA_MODULE_USAGE(
           "channel_map=<channel map> "
           "aec_method=<implementation to use> "
           "aec_args=<parameters for the AEC engine> "
+          "batch_blocks=<maximum number of queued blocks to hand to the AEC engine at once> "
           "save_aec=<save AEC data in /tmp> "
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
@@ -105,6 +106,7 @@ static const pa_echo_canceller ec_table[] = {
         /* Null, Dummy echo canceller (just copies data) */
         .init                   = pa_null_ec_init,
         .run                    = pa_null_ec_run,
+        .run_blocks             = pa_null_ec_run_blocks,
         .done                   = pa_null_ec_done,
     },
 #ifdef HAVE_SPEEX
@@ -112,6 +114,7 @@ static const pa_echo_canceller ec_table[] = {
         /* Speex */
         .init                   = pa_speex_ec_init,
         .run                    = pa_speex_ec_run,
+        .run_blocks             = pa_speex_ec_run_blocks,
         .done                   = pa_speex_ec_done,
     },
 #endif
@@ -120,6 +123,7 @@ static const pa_echo_canceller ec_table[] = {
         /* Adrian Andre's NLMS implementation */
         .init                   = pa_adrian_ec_init,
         .run                    = pa_adrian_ec_run,
+        .run_blocks             = pa_adrian_ec_run_blocks,
         .done                   = pa_adrian_ec_done,
     },
 #endif
@@ -131,6 +135,7 @@ static const pa_echo_canceller ec_table[] = {
         .record                 = pa_webrtc_ec_record,
         .set_drift              = pa_webrtc_ec_set_drift,
         .run                    = pa_webrtc_ec_run,
+        .run_blocks             = pa_webrtc_ec_run_blocks,
         .done                   = pa_webrtc_ec_done,
     },
 #endif
@@ -142,6 +147,8 @@ static const pa_echo_canceller ec_table[] = {
 #define DEFAULT_ADJUST_TOLERANCE (5*PA_USEC_PER_MSEC)
 #define DEFAULT_SAVE_AEC FALSE
 #define DEFAULT_AUTOLOADED FALSE
+#define DEFAULT_BATCH_BLOCKS 8
+#define PUBLISH_COUNTERS_USEC (10*PA_USEC_PER_SEC)
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
@@ -200,6 +207,11 @@ struct snapshot {
     int64_t recv_counter;
     size_t rlen;
     size_t plen;
+
+    /* CPU time spent in the source IO thread */
+    pa_usec_t canceller_usec;
+    pa_usec_t buffering_usec;
+    uint64_t blocks;
 };
 
 struct userdata {
@@ -214,6 +226,7 @@ struct userdata {
     uint32_t source_output_blocksize;
     uint32_t source_blocksize;
     uint32_t sink_blocksize;
+    uint32_t batch_blocks;
 
     pa_bool_t need_realign;
 
@@ -254,7 +267,17 @@ struct userdata {
 
     struct {
         pa_cvolume current_volume;
+
+        /* CPU time spent running the canceller, and everything else
+         * we do on captured data (queueing, alignment, posting) */
+        pa_usec_t canceller_usec;
+        pa_usec_t buffering_usec;
+        uint64_t blocks;
     } thread_info;
+
+    /* When the counters were last put into the source proplist */
+    pa_usec_t counters_published_at;
+    uint64_t published_blocks;
 };
 
 static void source_output_snapshot_within_thread(struct userdata *u, struct snapshot *snapshot);
@@ -274,6 +297,7 @@ static const char* const valid_modargs[] = {
     "channel_map",
     "aec_method",
     "aec_args",
+    "batch_blocks",
     "save_aec",
     "autoloaded",
     "use_volume_sharing",
@@ -333,6 +357,35 @@ static int64_t calc_diff(struct userdata *u, struct snapshot *snapshot) {
     return diff_time;
 }
 
+/* Called from main context. Every proplist change is sent to every
+ * subscribed client, so the counters only go there every
+ * PUBLISH_COUNTERS_USEC. */
+static void publish_counters(struct userdata *u, struct snapshot *snapshot) {
+    pa_proplist *pl;
+    pa_usec_t now;
+
+    now = pa_rtclock_now();
+
+    if (snapshot->blocks == u->published_blocks ||
+        (u->counters_published_at > 0 && now < u->counters_published_at + PUBLISH_COUNTERS_USEC))
+        return;
+
+    pa_log_debug("Canceller %llu usec, buffering %llu usec for %llu blocks",
+                 (unsigned long long) snapshot->canceller_usec,
+                 (unsigned long long) snapshot->buffering_usec,
+                 (unsigned long long) snapshot->blocks);
+
+    u->counters_published_at = now;
+    u->published_blocks = snapshot->blocks;
+
+    pl = pa_proplist_new();
+    pa_proplist_setf(pl, "echo_cancel.canceller_usec", "%llu", (unsigned long long) snapshot->canceller_usec);
+    pa_proplist_setf(pl, "echo_cancel.buffering_usec", "%llu", (unsigned long long) snapshot->buffering_usec);
+    pa_proplist_setf(pl, "echo_cancel.blocks", "%llu", (unsigned long long) snapshot->blocks);
+    pa_source_update_proplist(u->source, PA_UPDATE_REPLACE, pl);
+    pa_proplist_free(pl);
+}
+
 /* Called from main context */
 static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
     struct userdata *u = userdata;
@@ -353,6 +406,8 @@ static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct tim
     pa_asyncmsgq_send(u->source_output->source->asyncmsgq, PA_MSGOBJECT(u->source_output), SOURCE_OUTPUT_MESSAGE_LATENCY_SNAPSHOT, &latency_snapshot, 0, NULL);
     pa_asyncmsgq_send(u->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_LATENCY_SNAPSHOT, &latency_snapshot, 0, NULL);
 
+    publish_counters(u, &latency_snapshot);
+
     /* calculate drift between capture and playback */
     diff_time = calc_diff(u, &latency_snapshot);
 
@@ -720,6 +775,7 @@ static void do_push_drift_comp(struct userdata *u) {
     size_t rlen, plen;
     pa_memchunk rchunk, pchunk, cchunk;
     uint8_t *rdata, *pdata, *cdata;
+    pa_usec_t start;
     float drift;
     int unused PA_GCC_UNUSED;
 
@@ -754,7 +810,9 @@ static void do_push_drift_comp(struct userdata *u) {
         pdata = pa_memblock_acquire(pchunk.memblock);
         pdata += pchunk.index;
 
+        start = pa_thread_cpu_now();
         u->ec->play(u->ec, pdata);
+        u->thread_info.canceller_usec += pa_thread_cpu_now() - start;
 
         if (u->save_aec) {
             if (u->drift_file)
@@ -782,7 +840,10 @@ static void do_push_drift_comp(struct userdata *u) {
         cchunk.memblock = pa_memblock_new(u->source->core->mempool, cchunk.length);
         cdata = pa_memblock_acquire(cchunk.memblock);
 
+        start = pa_thread_cpu_now();
         u->ec->record(u->ec, rdata, cdata);
+        u->thread_info.canceller_usec += pa_thread_cpu_now() - start;
+        u->thread_info.blocks++;
 
         if (u->save_aec) {
             if (u->drift_file)
@@ -808,13 +869,18 @@ static void do_push_drift_comp(struct userdata *u) {
 
 /* This one's simpler than the drift compensation case -- we just iterate over
  * the capture buffer, and pass the canceller blocksize bytes of playback and
- * capture data.
+ * capture data. Whatever whole blocks are queued are taken out in one go (up
+ * to batch_blocks of them), so the canceller is called, and data is peeked,
+ * posted and dropped, once per batch instead of once per block.
  *
  * Called from source I/O thread context. */
 static void do_push(struct userdata *u) {
     size_t rlen, plen;
     pa_memchunk rchunk, pchunk, cchunk;
     uint8_t *rdata, *pdata, *cdata;
+    size_t rbytes, pbytes, cbytes;
+    pa_usec_t start;
+    unsigned n, i;
     int unused PA_GCC_UNUSED;
 
     rlen = pa_memblockq_get_length(u->source_memblockq);
@@ -822,13 +888,18 @@ static void do_push(struct userdata *u) {
 
     while (rlen >= u->source_output_blocksize) {
 
+        n = PA_MIN(rlen / u->source_output_blocksize, u->batch_blocks);
+        rbytes = n * u->source_output_blocksize;
+        pbytes = n * u->sink_blocksize;
+        cbytes = n * u->source_blocksize;
+
         /* take fixed blocks from recorded and played samples */
-        pa_memblockq_peek_fixed_size(u->source_memblockq, u->source_output_blocksize, &rchunk);
-        pa_memblockq_peek_fixed_size(u->sink_memblockq, u->sink_blocksize, &pchunk);
+        pa_memblockq_peek_fixed_size(u->source_memblockq, rbytes, &rchunk);
+        pa_memblockq_peek_fixed_size(u->sink_memblockq, pbytes, &pchunk);
 
         /* we ran out of played data and pchunk has been filled with silence bytes */
-        if (plen < u->sink_blocksize)
-            pa_memblockq_seek(u->sink_memblockq, u->sink_blocksize - plen, PA_SEEK_RELATIVE, true);
+        if (plen < pbytes)
+            pa_memblockq_seek(u->sink_memblockq, pbytes - plen, PA_SEEK_RELATIVE, true);
 
         rdata = pa_memblock_acquire(rchunk.memblock);
         rdata += rchunk.index;
@@ -836,23 +907,35 @@ static void do_push(struct userdata *u) {
         pdata += pchunk.index;
 
         cchunk.index = 0;
-        cchunk.length = u->source_blocksize;
+        cchunk.length = cbytes;
         cchunk.memblock = pa_memblock_new(u->source->core->mempool, cchunk.length);
         cdata = pa_memblock_acquire(cchunk.memblock);
 
         if (u->save_aec) {
             if (u->captured_file)
-                unused = fwrite(rdata, 1, u->source_output_blocksize, u->captured_file);
+                unused = fwrite(rdata, 1, rbytes, u->captured_file);
             if (u->played_file)
-                unused = fwrite(pdata, 1, u->sink_blocksize, u->played_file);
+                unused = fwrite(pdata, 1, pbytes, u->played_file);
         }
 
         /* perform echo cancellation */
-        u->ec->run(u->ec, rdata, pdata, cdata);
+        start = pa_thread_cpu_now();
+
+        if (u->ec->run_blocks)
+            u->ec->run_blocks(u->ec, rdata, pdata, cdata, n);
+        else
+            for (i = 0; i < n; i++)
+                u->ec->run(u->ec,
+                           rdata + i * u->source_output_blocksize,
+                           pdata + i * u->sink_blocksize,
+                           cdata + i * u->source_blocksize);
+
+        u->thread_info.canceller_usec += pa_thread_cpu_now() - start;
+        u->thread_info.blocks += n;
 
         if (u->save_aec) {
             if (u->canceled_file)
-                unused = fwrite(cdata, 1, u->source_blocksize, u->canceled_file);
+                unused = fwrite(cdata, 1, cbytes, u->canceled_file);
         }
 
         pa_memblock_release(cchunk.memblock);
@@ -860,16 +943,16 @@ static void do_push(struct userdata *u) {
         pa_memblock_release(rchunk.memblock);
 
         /* drop consumed source samples */
-        pa_memblockq_drop(u->source_memblockq, u->source_output_blocksize);
+        pa_memblockq_drop(u->source_memblockq, rbytes);
         pa_memblock_unref(rchunk.memblock);
-        rlen -= u->source_output_blocksize;
+        rlen -= rbytes;
 
         /* drop consumed sink samples */
-        pa_memblockq_drop(u->sink_memblockq, u->sink_blocksize);
+        pa_memblockq_drop(u->sink_memblockq, pbytes);
         pa_memblock_unref(pchunk.memblock);
 
-        if (plen >= u->sink_blocksize)
-            plen -= u->sink_blocksize;
+        if (plen >= pbytes)
+            plen -= pbytes;
         else
             plen = 0;
 
@@ -884,6 +967,7 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
     struct userdata *u;
     size_t rlen, plen, to_skip;
     pa_memchunk rchunk;
+    pa_usec_t start, canceller_usec;
 
     pa_source_output_assert_ref(o);
     pa_source_output_assert_io_context(o);
@@ -904,14 +988,19 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
     while (pa_asyncmsgq_process_one(u->asyncmsgq) > 0)
         ;
 
+    start = pa_thread_cpu_now();
+    canceller_usec = u->thread_info.canceller_usec;
+
     pa_memblockq_push_align(u->source_memblockq, chunk);
 
     rlen = pa_memblockq_get_length(u->source_memblockq);
     plen = pa_memblockq_get_length(u->sink_memblockq);
 
     /* Let's not do anything else till we have enough data to process */
-    if (rlen < u->source_output_blocksize)
+    if (rlen < u->source_output_blocksize) {
+        u->thread_info.buffering_usec += pa_thread_cpu_now() - start;
         return;
+    }
 
     /* See if we need to drop samples in order to sync */
     if (pa_atomic_cmpxchg (&u->request_resync, 1, 0)) {
@@ -961,6 +1050,8 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
         do_push_drift_comp(u);
     else
         do_push(u);
+
+    u->thread_info.buffering_usec += pa_thread_cpu_now() - start - (u->thread_info.canceller_usec - canceller_usec);
 }
 
 /* Called from sink I/O thread context. */
@@ -1044,6 +1135,10 @@ static void source_output_snapshot_within_thread(struct userdata *u, struct snap
     snapshot->recv_counter = u->recv_counter;
     snapshot->rlen = rlen + u->sink_skip;
     snapshot->plen = plen + u->source_skip;
+
+    snapshot->canceller_usec = u->thread_info.canceller_usec;
+    snapshot->buffering_usec = u->thread_info.buffering_usec;
+    snapshot->blocks = u->thread_info.blocks;
 }
 
 /* Called from source I/O thread context. */
@@ -1636,6 +1731,7 @@ static int init_common(pa_modargs *ma, struct userdata *u, pa_sample_spec *sourc
     u->ec->record = ec_table[ec_method].record;
     u->ec->set_drift = ec_table[ec_method].set_drift;
     u->ec->run = ec_table[ec_method].run;
+    u->ec->run_blocks = ec_table[ec_method].run_blocks;
     u->ec->done = ec_table[ec_method].done;
 
     return 0;
@@ -1657,7 +1753,7 @@ int pa__init(pa_module*m) {
     pa_source_new_data source_data;
     pa_sink_new_data sink_data;
     pa_memchunk silence;
-    uint32_t temp;
+    uint32_t temp, max_blocksize;
     uint32_t nframes = 0;
 
     pa_assert(m);
@@ -1769,6 +1865,19 @@ int pa__init(pa_module*m) {
     u->source_blocksize = nframes * pa_frame_size(&source_ss);
     u->sink_blocksize = nframes * pa_frame_size(&sink_ss);
 
+    u->batch_blocks = DEFAULT_BATCH_BLOCKS;
+    if (pa_modargs_get_value_u32(ma, "batch_blocks", &u->batch_blocks) < 0 || u->batch_blocks < 1) {
+        pa_log("Invalid batch_blocks value");
+        goto fail;
+    }
+
+    /* A batch has to fit into a single memblock */
+    max_blocksize = PA_MAX(u->source_output_blocksize, PA_MAX(u->source_blocksize, u->sink_blocksize));
+    if (u->batch_blocks * max_blocksize > pa_mempool_block_size_max(u->core->mempool)) {
+        u->batch_blocks = PA_MAX(pa_mempool_block_size_max(u->core->mempool) / max_blocksize, 1U);
+        pa_log_info("Limiting batch_blocks to %u", u->batch_blocks);
+    }
+
     if (u->ec->params.drift_compensation)
         pa_assert(u->ec->set_drift);
 
@@ -1999,6 +2108,7 @@ int pa__init(pa_module*m) {
 
     pa_sink_input_put(u->sink_input);
     pa_source_output_put(u->source_output);
+
     pa_modargs_free(ma);
 
     return 0;
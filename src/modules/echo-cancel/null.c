@@ -52,5 +52,9 @@ void pa_null_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *pl
     memcpy(out, rec, 256 * pa_frame_size(&ec->params.priv.null.out_ss));
 }
 
+void pa_null_ec_run_blocks(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out, unsigned n) {
+    memcpy(out, rec, n * 256 * pa_frame_size(&ec->params.priv.null.out_ss));
+}
+
 void pa_null_ec_done(pa_echo_canceller *ec) {
 }
@@ -179,6 +179,7 @@ pa_bool_t pa_speex_ec_init(pa_core *c, pa_echo_canceller *ec,
 
     rate = out_ss->rate;
     *nframes = pa_echo_canceller_blocksize_power2(rate, frame_size_ms);
+    ec->params.priv.speex.blocksize = *nframes * pa_frame_size(out_ss);
 
     pa_log_debug ("Using nframes %d, channels %d, rate %d", *nframes, out_ss->channels, out_ss->rate);
     ec->params.priv.speex.state = speex_echo_state_init_mc(*nframes, (rate * filter_size_ms) / 1000, out_ss->channels, out_ss->channels);
@@ -217,6 +218,14 @@ void pa_speex_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *p
         speex_preprocess_run(ec->params.priv.speex.pp_state, (spx_int16_t *) out);
 }
 
+void pa_speex_ec_run_blocks(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out, unsigned n) {
+    const uint32_t blocksize = ec->params.priv.speex.blocksize;
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        pa_speex_ec_run(ec, rec + i * blocksize, play + i * blocksize, out + i * blocksize);
+}
+
 void pa_speex_ec_done(pa_echo_canceller *ec) {
     if (ec->params.priv.speex.pp_state) {
         speex_preprocess_state_destroy(ec->params.priv.speex.pp_state);
@@ -287,6 +287,53 @@ void pa_webrtc_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *
     pa_webrtc_ec_record(ec, rec, out);
 }
 
+/* Runs n blocks through the same pair of frames, and only asks for and
+ * updates the capture volume once per batch, since both go through the
+ * main thread. In between blocks, the AGC keeps working with the level it
+ * computed itself. */
+void pa_webrtc_ec_run_blocks(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out, unsigned n) {
+    webrtc::AudioProcessing *apm = (webrtc::AudioProcessing*)ec->params.priv.webrtc.apm;
+    webrtc::AudioFrame play_frame, out_frame;
+    const pa_sample_spec *ss = &ec->params.priv.webrtc.sample_spec;
+    const uint32_t blocksize = ec->params.priv.webrtc.blocksize;
+    int level = 0;
+    pa_cvolume v;
+    unsigned i;
+
+    play_frame._audioChannel = out_frame._audioChannel = ss->channels;
+    play_frame._frequencyInHz = out_frame._frequencyInHz = ss->rate;
+    play_frame._payloadDataLengthInSamples = out_frame._payloadDataLengthInSamples = blocksize / pa_frame_size(ss);
+
+    if (ec->params.priv.webrtc.agc) {
+        pa_cvolume_init(&v);
+        pa_echo_canceller_get_capture_volume(ec, &v);
+        level = pa_cvolume_avg(&v);
+    }
+
+    for (i = 0; i < n; i++) {
+        memcpy(play_frame._payloadData, play + i * blocksize, blocksize);
+        apm->AnalyzeReverseStream(&play_frame);
+
+        memcpy(out_frame._payloadData, rec + i * blocksize, blocksize);
+
+        if (ec->params.priv.webrtc.agc)
+            apm->gain_control()->set_stream_analog_level(level);
+
+        apm->set_stream_delay_ms(0);
+        apm->ProcessStream(&out_frame);
+
+        if (ec->params.priv.webrtc.agc)
+            level = apm->gain_control()->stream_analog_level();
+
+        memcpy(out + i * blocksize, out_frame._payloadData, blocksize);
+    }
+
+    if (ec->params.priv.webrtc.agc) {
+        pa_cvolume_set(&v, ss->channels, level);
+        pa_echo_canceller_set_capture_volume(ec, &v);
+    }
+}
+
 void pa_webrtc_ec_done(pa_echo_canceller *ec) {
     if (ec->params.priv.webrtc.apm) {
         webrtc::AudioProcessing::Destroy((webrtc::AudioProcessing*)ec->params.priv.webrtc.apm);
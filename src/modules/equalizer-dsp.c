@@ -0,0 +1,101 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include "equalizer-dsp.h"
+
+void *pa_equalizer_alloc(size_t n, size_t s) {
+    size_t f;
+    void *t;
+
+    f = PA_ROUND_UP(n * s, sizeof(float) * PA_EQUALIZER_V_SIZE);
+    pa_assert_se(t = fftwf_malloc(f));
+    pa_memzero(t, f);
+
+    return t;
+}
+
+void pa_equalizer_hanning_window(float *W, size_t window_size) {
+    /* h=.5*(1-cos(2*pi*j/(window_size+1)), COLA for R=(M+1)/2 */
+    for (size_t i = 0; i < window_size; ++i)
+        W[i] = (float).5 * (1 - cos(2*M_PI*i / (window_size+1)));
+}
+
+size_t pa_equalizer_spectrum_stride(size_t fft_size) {
+    /* Keep every channel's spectrum aligned like the first one */
+    return PA_ROUND_UP(fft_size / 2 + 1, PA_EQUALIZER_V_SIZE / 2);
+}
+
+fftwf_plan pa_equalizer_plan_forward(size_t fft_size, size_t channels, float *work_buffer, fftwf_complex *spectrum) {
+    int n = (int) fft_size;
+
+    return fftwf_plan_many_dft_r2c(1, &n, (int) channels,
+                                   work_buffer, NULL, 1, (int) fft_size,
+                                   spectrum, NULL, 1, (int) pa_equalizer_spectrum_stride(fft_size),
+                                   FFTW_ESTIMATE);
+}
+
+fftwf_plan pa_equalizer_plan_inverse(size_t fft_size, size_t channels, fftwf_complex *spectrum, float *work_buffer) {
+    int n = (int) fft_size;
+
+    return fftwf_plan_many_dft_c2r(1, &n, (int) channels,
+                                   spectrum, NULL, 1, (int) pa_equalizer_spectrum_stride(fft_size),
+                                   work_buffer, NULL, 1, (int) fft_size,
+                                   FFTW_ESTIMATE);
+}
+
+void pa_equalizer_window(float *dst, const float *src, const float *W, size_t window_size, size_t fft_size) {
+    const size_t n = PA_ROUND_UP(window_size, PA_EQUALIZER_V_SIZE);
+    float * restrict d = dst;
+    const float * restrict s = src;
+    const float * restrict w = W;
+
+    /* W is zero beyond window_size, so this zero pads up to n */
+    for (size_t j = 0; j < n; ++j)
+        d[j] = w[j] * s[j];
+
+    memset(d + n, 0, (fft_size - n) * sizeof(float));
+}
+
+void pa_equalizer_filter(fftwf_complex *spectrum, const float *H, float X, size_t fft_size) {
+    const size_t n = fft_size / 2 + 1;
+    float * restrict d = (float *) spectrum;
+    const float * restrict h = H;
+
+    for (size_t j = 0; j < n; ++j) {
+        d[2 * j] *= X * h[j];
+        d[2 * j + 1] *= X * h[j];
+    }
+}
+
+void pa_equalizer_overlap_add(float *dst, float *overlap, size_t overlap_size, size_t R) {
+    float * restrict d = dst;
+    float * restrict o = overlap;
+
+    for (size_t j = 0; j < overlap_size; ++j) {
+        d[j] += o[j];
+        o[j] = d[R + j];
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef fooequalizerdsphfoo
+#define fooequalizerdsphfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <fftw3.h>
+
+#include <pulsecore/macro.h>
+
+/* The sliding STFT of module-equalizer-sink. Every hop, the windowed
+ * input of each channel is laid out fft_size floats apart in the work
+ * buffer, transformed with a single batched forward FFT into the
+ * spectrum (pa_equalizer_spectrum_stride() complex values per channel),
+ * scaled by each channel's filter and transformed back with a single
+ * batched inverse FFT. All buffers come from pa_equalizer_alloc() and
+ * are padded to PA_EQUALIZER_V_SIZE floats, so the loops run on whole,
+ * aligned vectors and the compiler is free to vectorize them. */
+
+#define PA_EQUALIZER_V_SIZE 4
+
+/* Returns zeroed, aligned memory for n elements of size s, padded to
+ * whole vectors */
+void *pa_equalizer_alloc(size_t n, size_t s);
+
+/* A Hanning window, which is COLA for R = (window_size + 1) / 2 */
+void pa_equalizer_hanning_window(float *W, size_t window_size);
+
+/* The distance of the spectra of two channels, in complex values */
+size_t pa_equalizer_spectrum_stride(size_t fft_size);
+
+/* Plans the batched transforms between work_buffer (fft_size *
+ * channels floats) and spectrum (pa_equalizer_spectrum_stride() *
+ * channels complex values) */
+fftwf_plan pa_equalizer_plan_forward(size_t fft_size, size_t channels, float *work_buffer, fftwf_complex *spectrum);
+fftwf_plan pa_equalizer_plan_inverse(size_t fft_size, size_t channels, fftwf_complex *spectrum, float *work_buffer);
+
+/* Windows window_size samples of src into dst and zero pads it to
+ * fft_size. src has to be readable up to the next whole vector. */
+void pa_equalizer_window(float *dst, const float *src, const float *W, size_t window_size, size_t fft_size);
+
+/* Scales the spectrum of one channel by the filter H and the preamp
+ * X. This is purely magnitude based, and linear. */
+void pa_equalizer_filter(fftwf_complex *spectrum, const float *H, float X, size_t fft_size);
+
+/* Overlap-adds the first R samples of the filtered window dst and
+ * keeps the rest of it for the next hop (linear phase) */
+void pa_equalizer_overlap_add(float *dst, float *overlap, size_t overlap_size, size_t R);
+
+#endif
@@ -0,0 +1,129 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+
+#include "ladspa-control.h"
+
+static int parse_control_parameters(const char *cdata, unsigned long n_control, double *read_values, pa_bool_t *use_default) {
+    unsigned long p = 0;
+    const char *state = NULL;
+    char *k;
+
+    pa_assert(read_values || n_control == 0);
+    pa_assert(use_default || n_control == 0);
+
+    pa_log_debug("Trying to read %lu control values", n_control);
+
+    if (n_control == 0) {
+        if (cdata && *cdata) {
+            pa_log("Control values passed for a plugin without controls.");
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /* Nothing given at all for this plugin */
+    if (!cdata || *cdata == 0) {
+        for (p = 0; p < n_control; p++)
+            use_default[p] = TRUE;
+
+        return 0;
+    }
+
+    pa_log_debug("cdata: '%s'", cdata);
+
+    while ((k = pa_split(cdata, ",", &state)) && p < n_control) {
+        double f;
+
+        if (*k == 0) {
+            pa_log_debug("Read empty config value (p=%lu)", p);
+            use_default[p++] = TRUE;
+            pa_xfree(k);
+            continue;
+        }
+
+        if (pa_atod(k, &f) < 0) {
+            pa_log_debug("Failed to parse control value '%s' (p=%lu)", k, p);
+            pa_xfree(k);
+            return -1;
+        }
+
+        pa_xfree(k);
+
+        pa_log_debug("Read config value %f (p=%lu)", f, p);
+
+        use_default[p] = FALSE;
+        read_values[p++] = f;
+    }
+
+    /* The previous loop doesn't take the last control value into account
+       if it is left empty, so we do it here. */
+    if (cdata[strlen(cdata) - 1] == ',') {
+        if (p < n_control)
+            use_default[p] = TRUE;
+        p++;
+    }
+
+    if (p > n_control || k) {
+        pa_log("Too many control values passed, %lu expected.", n_control);
+        pa_xfree(k);
+        return -1;
+    }
+
+    if (p < n_control) {
+        pa_log("Not enough control values passed, %lu expected, %lu passed.", n_control, p);
+        return -1;
+    }
+
+    return 0;
+}
+
+int pa_ladspa_parse_control_chain(const char *control, const unsigned long *n_control, unsigned n_plugins, double *values, pa_bool_t *use_default) {
+    const char *state = NULL;
+    unsigned long offset = 0;
+    unsigned i;
+    int r = 0;
+
+    pa_assert(n_control || n_plugins == 0);
+
+    for (i = 0; i < n_plugins; offset += n_control[i], i++) {
+        char *cdata;
+
+        /* There may be fewer segments than plugins */
+        cdata = control ? pa_split(control, "|", &state) : NULL;
+
+        if (r == 0)
+            r = parse_control_parameters(cdata, n_control[i], values + offset, use_default + offset);
+
+        pa_xfree(cdata);
+    }
+
+    return r;
+}
@@ -0,0 +1,34 @@
+#ifndef fooladspacontrolhfoo
+#define fooladspacontrolhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulsecore/macro.h>
+
+/* Parses the control argument of module-ladspa-sink for a chain of
+ * n_plugins plugins, plugin i having n_control[i] input controls. The
+ * argument has one '|' separated segment per plugin, each a comma
+ * separated list of values. An empty value stands for the default of
+ * that control, a missing or empty segment for the defaults of all
+ * controls of the plugin. The values of all plugins are stored one
+ * after the other. */
+int pa_ladspa_parse_control_chain(const char *control, const unsigned long *n_control, unsigned n_plugins, double *values, pa_bool_t *use_default);
+
+#endif
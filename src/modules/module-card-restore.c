@@ -44,6 +44,7 @@
 #include <pulsecore/card.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/database.h>
+#include <pulsecore/database-cache.h>
 #include <pulsecore/tagstruct.h>
 
 #include "module-card-restore-symdef.h"
@@ -52,10 +53,16 @@ PA_MODULE_AUTHOR("Lennart Poettering");
 PA_MODULE_DESCRIPTION("Automatically restore profile of cards");
 PA_MODULE_VERSION(PACKAGE_VERSION);
 PA_MODULE_LOAD_ONCE(TRUE);
+PA_MODULE_USAGE(
+        "save_interval_msec=<Time after a change until it is written out> "
+        "save_max_bytes=<Amount of changes that are written out right away>");
 
 #define SAVE_INTERVAL (10 * PA_USEC_PER_SEC)
+#define SAVE_MAX_BYTES (64 * 1024)
 
 static const char* const valid_modargs[] = {
+    "save_interval_msec",
+    "save_max_bytes",
     NULL
 };
 
@@ -66,8 +73,8 @@ struct userdata {
     pa_hook_slot *card_put_hook_slot;
     pa_hook_slot *card_profile_hook_slot;
     pa_hook_slot *port_offset_hook_slot;
-    pa_time_event *save_time_event;
     pa_database *database;
+    pa_database_cache *cache;
     bool hooks_connected;
 };
 
@@ -84,28 +91,6 @@ struct entry {
     pa_hashmap *ports; /* Port name -> struct port_info */
 };
 
-static void save_time_callback(pa_mainloop_api*a, pa_time_event* e, const struct timeval *t, void *userdata) {
-    struct userdata *u = userdata;
-
-    pa_assert(a);
-    pa_assert(e);
-    pa_assert(u);
-
-    pa_assert(e == u->save_time_event);
-    u->core->mainloop->time_free(u->save_time_event);
-    u->save_time_event = NULL;
-
-    pa_database_sync(u->database);
-    pa_log_info("Synced.");
-}
-
-static void trigger_save(struct userdata *u) {
-    if (u->save_time_event)
-        return;
-
-    u->save_time_event = pa_core_rttime_new(u->core, pa_rtclock_now() + SAVE_INTERVAL, save_time_callback, u);
-}
-
 static struct entry* entry_new(void) {
     struct entry *r = pa_xnew0(struct entry, 1);
     r->version = ENTRY_VERSION;
@@ -210,7 +195,7 @@ static pa_bool_t entry_write(struct userdata *u, const char *name, const struct
 
     data.data = (void*)pa_tagstruct_data(t, &data.size);
 
-    r = (pa_database_set(u->database, &key, &data, TRUE) == 0);
+    r = (pa_database_cache_set(u->cache, &key, &data, TRUE) == 0);
 
     pa_tagstruct_free(t);
 
@@ -268,7 +253,7 @@ static struct entry* entry_read(struct userdata *u, const char *name) {
 
     pa_zero(data);
 
-    if (!pa_database_get(u->database, &key, &data))
+    if (!pa_database_cache_get(u->cache, &key, &data))
         goto fail;
 
     t = pa_tagstruct_new(data.data, data.size);
@@ -332,8 +317,7 @@ fail:
     pa_log_debug("Attempting to load legacy (pre-v1.0) data for key: %s", name);
     if ((e = legacy_entry_read(u, &data))) {
         pa_log_debug("Success. Saving new format for key: %s", name);
-        if (entry_write(u, name, e))
-            trigger_save(u);
+        entry_write(u, name, e);
         pa_datum_free(&data);
         return e;
     } else
@@ -369,8 +353,7 @@ static pa_hook_result_t card_put_hook_callback(pa_core *c, pa_card *card, struct
 
     show_full_info(card);
 
-    if (entry_write(u, card->name, entry))
-        trigger_save(u);
+    entry_write(u, card->name, entry);
 
 finish:
     entry_free(entry);
@@ -396,8 +379,7 @@ static pa_hook_result_t card_profile_change_callback(pa_core *c, pa_card *card,
         show_full_info(card);
     }
 
-    if (entry_write(u, card->name, entry))
-        trigger_save(u);
+    entry_write(u, card->name, entry);
 
     entry_free(entry);
     return PA_HOOK_OK;
@@ -427,8 +409,7 @@ static pa_hook_result_t port_offset_change_callback(pa_core *c, pa_device_port *
         show_full_info(card);
     }
 
-    if (entry_write(u, card->name, entry))
-        trigger_save(u);
+    entry_write(u, card->name, entry);
 
     entry_free(entry);
     return PA_HOOK_OK;
@@ -473,6 +454,8 @@ int pa__init(pa_module*m) {
     pa_modargs *ma = NULL;
     struct userdata *u;
     char *fname;
+    uint32_t save_interval_msec = SAVE_INTERVAL / PA_USEC_PER_MSEC;
+    uint32_t save_max_bytes = SAVE_MAX_BYTES;
 
     pa_assert(m);
 
@@ -481,6 +464,12 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "save_interval_msec", &save_interval_msec) < 0 ||
+        pa_modargs_get_value_u32(ma, "save_max_bytes", &save_max_bytes) < 0) {
+        pa_log("save_interval_msec= and save_max_bytes= expect unsigned integer arguments");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
@@ -503,6 +492,8 @@ int pa__init(pa_module*m) {
     pa_log_info("Successfully opened database file '%s'.", fname);
     pa_xfree(fname);
 
+    u->cache = pa_database_cache_new(m, u->database, save_interval_msec * PA_USEC_PER_MSEC, save_max_bytes);
+
     pa_modargs_free(ma);
     return 0;
 
@@ -530,8 +521,8 @@ void pa__done(pa_module*m) {
         pa_hook_slot_free(u->port_offset_hook_slot);
     }
 
-    if (u->save_time_event)
-        u->core->mainloop->time_free(u->save_time_event);
+    if (u->cache)
+        pa_database_cache_free(u->cache);
 
     if (u->database)
         pa_database_close(u->database);
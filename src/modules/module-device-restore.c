@@ -52,6 +52,7 @@
 #include <pulsecore/pstream.h>
 #include <pulsecore/pstream-util.h>
 #include <pulsecore/database.h>
+#include <pulsecore/database-cache.h>
 #include <pulsecore/tagstruct.h>
 
 #include "module-device-restore-symdef.h"
@@ -64,15 +65,20 @@ PA_MODULE_USAGE(
         "restore_port=<Save/restore port?> "
         "restore_volume=<Save/restore volumes?> "
         "restore_muted=<Save/restore muted states?> "
-        "restore_formats=<Save/restore saved formats?>");
+        "restore_formats=<Save/restore saved formats?> "
+        "save_interval_msec=<Time after a change until it is written out> "
+        "save_max_bytes=<Amount of changes that are written out right away>");
 
 #define SAVE_INTERVAL (10 * PA_USEC_PER_SEC)
+#define SAVE_MAX_BYTES (64 * 1024)
 
 static const char* const valid_modargs[] = {
     "restore_volume",
     "restore_muted",
     "restore_port",
     "restore_formats",
+    "save_interval_msec",
+    "save_max_bytes",
     NULL
 };
 
@@ -89,8 +95,8 @@ struct userdata {
         *source_fixate_hook_slot,
         *source_port_hook_slot,
         *connection_unlink_hook_slot;
-    pa_time_event *save_time_event;
     pa_database *database;
+    pa_database_cache *cache;
 
     pa_native_protocol *protocol;
     pa_idxset *subscribed;
@@ -131,21 +137,6 @@ struct perportentry {
     pa_idxset *formats;
 };
 
-static void save_time_callback(pa_mainloop_api*a, pa_time_event* e, const struct timeval *t, void *userdata) {
-    struct userdata *u = userdata;
-
-    pa_assert(a);
-    pa_assert(e);
-    pa_assert(u);
-
-    pa_assert(e == u->save_time_event);
-    u->core->mainloop->time_free(u->save_time_event);
-    u->save_time_event = NULL;
-
-    pa_database_sync(u->database);
-    pa_log_info("Synced.");
-}
-
 static void trigger_save(struct userdata *u, pa_device_type_t type, uint32_t sink_idx) {
     pa_native_connection *c;
     uint32_t idx;
@@ -167,10 +158,6 @@ static void trigger_save(struct userdata *u, pa_device_type_t type, uint32_t sin
         }
     }
 
-    if (u->save_time_event)
-        return;
-
-    u->save_time_event = pa_core_rttime_new(u->core, pa_rtclock_now() + SAVE_INTERVAL, save_time_callback, u);
 }
 
 
@@ -214,7 +201,7 @@ static pa_bool_t entry_write(struct userdata *u, const char *name, const struct
 
     data.data = (void*)pa_tagstruct_data(t, &data.size);
 
-    r = (pa_database_set(u->database, &key, &data, TRUE) == 0);
+    r = (pa_database_cache_set(u->cache, &key, &data, TRUE) == 0);
 
     pa_tagstruct_free(t);
 
@@ -235,7 +222,7 @@ static struct entry* entry_read(struct userdata *u, const char *name) {
 
     pa_zero(data);
 
-    if (!pa_database_get(u->database, &key, &data))
+    if (!pa_database_cache_get(u->cache, &key, &data))
         goto fail;
 
     t = pa_tagstruct_new(data.data, data.size);
@@ -391,7 +378,7 @@ static pa_bool_t perportentry_write(struct userdata *u, const char *basekeyname,
 
     data.data = (void*)pa_tagstruct_data(t, &data.size);
 
-    r = (pa_database_set(u->database, &key, &data, TRUE) == 0);
+    r = (pa_database_cache_set(u->cache, &key, &data, TRUE) == 0);
 
     pa_tagstruct_free(t);
     pa_xfree(name);
@@ -416,7 +403,7 @@ static struct perportentry* perportentry_read(struct userdata *u, const char *ba
 
     pa_zero(data);
 
-    if (!pa_database_get(u->database, &key, &data))
+    if (!pa_database_cache_get(u->cache, &key, &data))
         goto fail;
 
     t = pa_tagstruct_new(data.data, data.size);
@@ -1215,6 +1202,8 @@ int pa__init(pa_module*m) {
     pa_source *source;
     uint32_t idx;
     pa_bool_t restore_volume = TRUE, restore_muted = TRUE, restore_port = TRUE, restore_formats = TRUE;
+    uint32_t save_interval_msec = SAVE_INTERVAL / PA_USEC_PER_MSEC;
+    uint32_t save_max_bytes = SAVE_MAX_BYTES;
 
     pa_assert(m);
 
@@ -1231,6 +1220,12 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "save_interval_msec", &save_interval_msec) < 0 ||
+        pa_modargs_get_value_u32(ma, "save_max_bytes", &save_max_bytes) < 0) {
+        pa_log("save_interval_msec= and save_max_bytes= expect unsigned integer arguments");
+        goto fail;
+    }
+
     if (!restore_muted && !restore_volume && !restore_port && !restore_formats)
         pa_log_warn("Neither restoring volume, nor restoring muted, nor restoring port enabled!");
 
@@ -1279,6 +1274,8 @@ int pa__init(pa_module*m) {
     pa_log_info("Successfully opened database file '%s'.", fname);
     pa_xfree(fname);
 
+    u->cache = pa_database_cache_new(m, u->database, save_interval_msec * PA_USEC_PER_MSEC, save_max_bytes);
+
     PA_IDXSET_FOREACH(sink, m->core->sinks, idx)
         subscribe_callback(m->core, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_NEW, sink->index, u);
 
@@ -1326,8 +1323,8 @@ void pa__done(pa_module*m) {
     if (u->connection_unlink_hook_slot)
         pa_hook_slot_free(u->connection_unlink_hook_slot);
 
-    if (u->save_time_event)
-        u->core->mainloop->time_free(u->save_time_event);
+    if (u->cache)
+        pa_database_cache_free(u->cache);
 
     if (u->database)
         pa_database_close(u->database);
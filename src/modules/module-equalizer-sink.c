@@ -37,12 +37,6 @@
 #include <string.h>
 #include <stdint.h>
 
-//#undef __SSE2__
-#ifdef __SSE2__
-#include <xmmintrin.h>
-#include <emmintrin.h>
-#endif
-
 #include <fftw3.h>
 
 #include <pulse/xmalloc.h>
@@ -66,6 +60,7 @@
 #include <pulsecore/protocol-dbus.h>
 #include <pulsecore/dbus-util.h>
 
+#include "equalizer-dsp.h"
 #include "module-equalizer-sink-symdef.h"
 
 PA_MODULE_AUTHOR("Jason Newton");
@@ -82,10 +77,13 @@ PA_MODULE_USAGE(
           "channel_map=<channel map> "
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
+          "hop_size=<samples between filter windows, trades latency for CPU> "
          ));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 #define DEFAULT_AUTOLOADED FALSE
+#define DEFAULT_HOP_SIZE 8000
+#define MIN_HOP_SIZE 64
 
 struct userdata {
     pa_module *module;
@@ -109,9 +107,10 @@ struct userdata {
     size_t input_buffer_max;
     //message
     float *W;//windowing function (time domain)
-    float *work_buffer, **input, **overlap_accum;
-    fftwf_complex *output_window;
-    fftwf_plan forward_plan, inverse_plan;
+    float *work_buffer, **input, **overlap_accum;//work_buffer holds fft_size floats per channel
+    fftwf_complex *output_window;//spectrum_stride bins per channel
+    size_t spectrum_stride;
+    fftwf_plan forward_plan, inverse_plan;//transform all channels at once
     //size_t samplings;
 
     float **Xs;
@@ -141,10 +140,10 @@ static const char* const valid_modargs[] = {
     "channel_map",
     "autoloaded",
     "use_volume_sharing",
+    "hop_size",
     NULL
 };
 
-#define v_size 4
 #define SINKLIST "equalized_sinklist"
 #define EQDB "equalizer_db"
 #define EQ_STATE_DB "equalizer-state"
@@ -155,12 +154,6 @@ static const char* const valid_modargs[] = {
 static void dbus_init(struct userdata *u);
 static void dbus_done(struct userdata *u);
 
-static void hanning_window(float *W, size_t window_size){
-    /* h=.5*(1-cos(2*pi*j/(window_size+1)), COLA for R=(M+1)/2 */
-    for (size_t i = 0; i < window_size; ++i)
-        W[i] = (float).5 * (1 - cos(2*M_PI*i / (window_size+1)));
-}
-
 static void fix_filter(float *H, size_t fft_size){
     /* divide out the fft gain */
     for (size_t i = 0; i < fft_size / 2 + 1; ++i)
@@ -210,25 +203,13 @@ static pa_bool_t is_monotonic(const uint32_t *xs, size_t length) {
     return TRUE;
 }
 
-/* ensures memory allocated is a multiple of v_size and aligned */
-static void * alloc(size_t x, size_t s){
-    size_t f;
-    float *t;
-
-    f = PA_ROUND_UP(x*s, sizeof(float)*v_size);
-    pa_assert_se(t = fftwf_malloc(f));
-    pa_memzero(t, f);
-
-    return t;
-}
-
 static void alloc_input_buffers(struct userdata *u, size_t min_buffer_length){
     if (min_buffer_length <= u->input_buffer_max)
         return;
 
     pa_assert(min_buffer_length >= u->window_size);
     for (size_t c = 0; c < u->channels; ++c) {
-        float *tmp = alloc(min_buffer_length, sizeof(float));
+        float *tmp = pa_equalizer_alloc(min_buffer_length, sizeof(float));
         if (u->input[c]) {
             if (!u->first_iteration)
                 memcpy(tmp, u->input[c], u->overlap_size * sizeof(float));
@@ -350,158 +331,23 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
-#if 1
-//reference implementation
-static void dsp_logic(
-    float * restrict dst,//used as a temp array too, needs to be fft_length!
-    float * restrict src,/*input data w/ overlap at start,
-                               *automatically cycled in routine
-                               */
-    float * restrict overlap,
-    const float X,//multiplier
-    const float * restrict H,//The freq. magnitude scalers filter
-    const float * restrict W,//The windowing function
-    fftwf_complex * restrict output_window,//The transformed windowed src
-    struct userdata *u){
-
-    //use a linear-phase sliding STFT and overlap-add method (for each channel)
-    //window the data
-    for(size_t j = 0; j < u->window_size; ++j){
-        dst[j] = X * W[j] * src[j];
-    }
-    //zero pad the remaining fft window
-    memset(dst + u->window_size, 0, (u->fft_size - u->window_size) * sizeof(float));
-    //Processing is done here!
-    //do fft
-    fftwf_execute_dft_r2c(u->forward_plan, dst, output_window);
-    //perform filtering
-    for(size_t j = 0; j < FILTER_SIZE(u); ++j){
-        u->output_window[j][0] *= H[j];
-        u->output_window[j][1] *= H[j];
-    }
-    //inverse fft
-    fftwf_execute_dft_c2r(u->inverse_plan, output_window, dst);
-    ////debug: tests overlapping add
-    ////and negates ALL PREVIOUS processing
-    ////yields a perfect reconstruction if COLA is held
-    //for(size_t j = 0; j < u->window_size; ++j){
-    //    u->work_buffer[j] = u->W[j] * u->input[c][j];
-    //}
-
-    //overlap add and preserve overlap component from this window (linear phase)
-    for(size_t j = 0; j < u->overlap_size; ++j){
-        u->work_buffer[j] += overlap[j];
-        overlap[j] = dst[u->R + j];
-    }
-    ////debug: tests if basic buffering works
-    ////shouldn't modify the signal AT ALL (beyond roundoff)
-    //for(size_t j = 0; j < u->window_size;++j){
-    //    u->work_buffer[j] = u->input[c][j];
-    //}
-
-    //preserve the needed input for the next window's overlap
-    memmove(src, src + u->R,
-        (u->samples_gathered - u->R) * sizeof(float)
-    );
-}
-#else
-typedef float v4sf __attribute__ ((__aligned__(v_size * sizeof(float))));
-typedef union float_vector {
-    float f[v_size];
-    v4sf v;
-    __m128 m;
-} float_vector_t;
-
-//regardless of sse enabled, the loops in here assume
-//16 byte aligned addresses and memory allocations divisible by v_size
-static void dsp_logic(
-    float * restrict dst,//used as a temp array too, needs to be fft_length!
-    float * restrict src,/*input data w/ overlap at start,
-                               *automatically cycled in routine
-                               */
-    float * restrict overlap,//The size of the overlap
-    const float X,//multiplier
-    const float * restrict H,//The freq. magnitude scalers filter
-    const float * restrict W,//The windowing function
-    fftwf_complex * restrict output_window,//The transformed windowed src
-    struct userdata *u){//Collection of constants
-    const size_t overlap_size = PA_ROUND_UP(u->overlap_size, v_size);
-    float_vector_t x;
-    x.f[0] = x.f[1] = x.f[2] = x.f[3] = X;
-
-    //assert(u->samples_gathered >= u->R);
-    //use a linear-phase sliding STFT and overlap-add method
-    for(size_t j = 0; j < u->window_size; j += v_size){
-        //dst[j] = W[j] * src[j];
-        float_vector_t *d = (float_vector_t*) (dst + j);
-        float_vector_t *w = (float_vector_t*) (W + j);
-        float_vector_t *s = (float_vector_t*) (src + j);
-//#if __SSE2__
-        d->m = _mm_mul_ps(x.m, _mm_mul_ps(w->m, s->m));
-//        d->v = x->v * w->v * s->v;
-//#endif
-    }
-    //zero pad the remaining fft window
-    memset(dst + u->window_size, 0, (u->fft_size - u->window_size) * sizeof(float));
-
-    //Processing is done here!
-    //do fft
-    fftwf_execute_dft_r2c(u->forward_plan, dst, output_window);
-    //perform filtering - purely magnitude based
-    for(size_t j = 0; j < FILTER_SIZE; j += v_size / 2){
-        //output_window[j][0]*=H[j];
-        //output_window[j][1]*=H[j];
-        float_vector_t *d = (float_vector_t*)( ((float *) output_window) + 2 * j);
-        float_vector_t h;
-        h.f[0] = h.f[1] = H[j];
-        h.f[2] = h.f[3] = H[j + 1];
-//#if __SSE2__
-        d->m = _mm_mul_ps(d->m, h.m);
-//#else
-//        d->v = d->v * h.v;
-//#endif
-    }
-
-    //inverse fft
-    fftwf_execute_dft_c2r(u->inverse_plan, output_window, dst);
-
-    ////debug: tests overlapping add
-    ////and negates ALL PREVIOUS processing
-    ////yields a perfect reconstruction if COLA is held
-    //for(size_t j = 0; j < u->window_size; ++j){
-    //    dst[j] = W[j] * src[j];
-    //}
-
-    //overlap add and preserve overlap component from this window (linear phase)
-    for(size_t j = 0; j < overlap_size; j += v_size){
-        //dst[j]+=overlap[j];
-        //overlap[j]+=dst[j+R];
-        float_vector_t *d = (float_vector_t*)(dst + j);
-        float_vector_t *o = (float_vector_t*)(overlap + j);
-//#if __SSE2__
-        d->m = _mm_add_ps(d->m, o->m);
-        o->m = ((float_vector_t*)(dst + u->R + j))->m;
-//#else
-//        d->v = d->v + o->v;
-//        o->v = ((float_vector_t*)(dst + u->R + j))->v;
-//#endif
-    }
-    //memcpy(overlap, dst+u->R, u->overlap_size * sizeof(float)); //overlap preserve (debug)
-    //zero out the bit beyond the real overlap so we don't add garbage next iteration
-    memset(overlap + u->overlap_size, 0, overlap_size - u->overlap_size);
-
-    ////debug: tests if basic buffering works
-    ////shouldn't modify the signal AT ALL (beyond roundoff)
-    //for(size_t j = 0; j < u->window_size; ++j){
-    //    dst[j] = src[j];
-    //}
-
-    //preserve the needed input for the next window's overlap
-    memmove(src, src + u->R,
-        (u->samples_gathered - u->R) * sizeof(float)
-    );
+/* Called from I/O thread context, see equalizer-dsp.h for how the
+ * channels are laid out */
+static void window_inputs(struct userdata *u) {
+    for (size_t c = 0; c < u->channels; ++c)
+        pa_equalizer_window(u->work_buffer + c * u->fft_size, u->input[c], u->W, u->window_size, u->fft_size);
+}
+
+static void apply_filters(struct userdata *u) {
+    for (size_t c = 0; c < u->channels; ++c) {
+        unsigned a_i;
+
+        /* The preamp is folded into the filter */
+        a_i = pa_aupdate_read_begin(u->a_H[c]);
+        pa_equalizer_filter(u->output_window + c * u->spectrum_stride, u->Hs[c][a_i], u->Xs[c][a_i], u->fft_size);
+        pa_aupdate_read_end(u->a_H[c]);
+    }
 }
-#endif
 
 static void flatten_to_memblockq(struct userdata *u){
     size_t mbs = pa_mempool_block_size_max(u->sink->core->mempool);
@@ -524,8 +370,6 @@ static void flatten_to_memblockq(struct userdata *u){
 
 static void process_samples(struct userdata *u){
     size_t fs = pa_frame_size(&(u->sink->sample_spec));
-    unsigned a_i;
-    float *H, X;
     size_t iterations, offset;
     pa_assert(u->samples_gathered >= u->window_size);
     iterations = (u->samples_gathered - u->overlap_size) / u->R;
@@ -539,30 +383,29 @@ static void process_samples(struct userdata *u){
 
     for(size_t iter = 0; iter < iterations; ++iter){
         offset = iter * u->R * fs;
-        for(size_t c = 0;c < u->channels; c++) {
-            a_i = pa_aupdate_read_begin(u->a_H[c]);
-            X = u->Xs[c][a_i];
-            H = u->Hs[c][a_i];
-            dsp_logic(
-                u->work_buffer,
-                u->input[c],
-                u->overlap_accum[c],
-                X,
-                H,
-                u->W,
-                u->output_window,
-                u
-            );
-            pa_aupdate_read_end(u->a_H[c]);
+
+        //use a linear-phase sliding STFT and overlap-add method
+        window_inputs(u);
+        fftwf_execute(u->forward_plan);
+        apply_filters(u);
+        fftwf_execute(u->inverse_plan);
+
+        for(size_t c = 0; c < u->channels; c++) {
+            float *dst = u->work_buffer + c * u->fft_size;
+
+            pa_equalizer_overlap_add(dst, u->overlap_accum[c], u->overlap_size, u->R);
             if(u->first_iteration){
                 /* The windowing function will make the audio ramped in, as a cheap fix we can
                  * undo the windowing (for non-zero window values)
                  */
                 for(size_t i = 0; i < u->overlap_size; ++i){
-                    u->work_buffer[i] = u->W[i] <= FLT_EPSILON ? u->work_buffer[i] : u->work_buffer[i] / u->W[i];
+                    dst[i] = u->W[i] <= FLT_EPSILON ? dst[i] : dst[i] / u->W[i];
                 }
             }
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, (uint8_t *) (((float *)u->output_buffer) + c) + offset, fs, u->work_buffer, sizeof(float), u->R);
+            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, (uint8_t *) (((float *)u->output_buffer) + c) + offset, fs, dst, sizeof(float), u->R);
+
+            //preserve the needed input for the next window's overlap
+            memmove(u->input[c], u->input[c] + u->R, (u->samples_gathered - u->R) * sizeof(float));
         }
         if(u->first_iteration){
             u->first_iteration = FALSE;
@@ -1094,6 +937,8 @@ int pa__init(pa_module*m) {
     float *H;
     unsigned a_i;
     pa_bool_t use_volume_sharing = TRUE;
+    size_t fft_size;
+    uint32_t hop_size;
 
     pa_assert(m);
 
@@ -1122,17 +967,29 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    /* The window has to fit into the fft, and a shorter hop means
+     * less latency but more transforms per second */
+    fft_size = pow(2, ceil(log(ss.rate) / log(2)));
+    hop_size = PA_MIN(DEFAULT_HOP_SIZE, fft_size / 2);
+    if (pa_modargs_get_value_u32(ma, "hop_size", &hop_size) < 0 ||
+        hop_size < MIN_HOP_SIZE || hop_size > fft_size / 2) {
+        pa_log("hop_size= expects a number of samples between %u and %zu", MIN_HOP_SIZE, fft_size / 2);
+        goto fail;
+    }
+
     u = pa_xnew0(struct userdata, 1);
     u->module = m;
     m->userdata = u;
 
     u->channels = ss.channels;
-    u->fft_size = pow(2, ceil(log(ss.rate) / log(2)));//probably unstable near corner cases of powers of 2
+    u->fft_size = fft_size;//probably unstable near corner cases of powers of 2
     pa_log_debug("fft size: %zd", u->fft_size);
-    u->window_size = 15999;
-    if (u->window_size % 2 == 0)
-        u->window_size--;
-    u->R = (u->window_size + 1) / 2;
+
+
+    /* Hanning windows are COLA for R=(M+1)/2 */
+    u->R = hop_size;
+    u->window_size = 2 * u->R - 1;
+    pa_log_debug("hop size: %zd, window size: %zd", u->R, u->window_size);
     u->overlap_size = u->window_size - u->R;
     u->samples_gathered = 0;
     u->input_buffer_max = 0;
@@ -1145,23 +1002,24 @@ int pa__init(pa_module*m) {
         u->Xs[c] = pa_xnew0(float, 2);
         u->Hs[c] = pa_xnew0(float *, 2);
         for (i = 0; i < 2; ++i)
-            u->Hs[c][i] = alloc(FILTER_SIZE(u), sizeof(float));
+            u->Hs[c][i] = pa_equalizer_alloc(FILTER_SIZE(u), sizeof(float));
     }
 
-    u->W = alloc(u->window_size, sizeof(float));
-    u->work_buffer = alloc(u->fft_size, sizeof(float));
+    u->W = pa_equalizer_alloc(u->window_size, sizeof(float));
+    u->work_buffer = pa_equalizer_alloc(u->fft_size * u->channels, sizeof(float));
     u->input = pa_xnew0(float *, u->channels);
     u->overlap_accum = pa_xnew0(float *, u->channels);
     for (c = 0; c < u->channels; ++c) {
         u->a_H[c] = pa_aupdate_new();
         u->input[c] = NULL;
-        u->overlap_accum[c] = alloc(u->overlap_size, sizeof(float));
+        u->overlap_accum[c] = pa_equalizer_alloc(u->overlap_size, sizeof(float));
     }
-    u->output_window = alloc(FILTER_SIZE(u), sizeof(fftwf_complex));
-    u->forward_plan = fftwf_plan_dft_r2c_1d(u->fft_size, u->work_buffer, u->output_window, FFTW_ESTIMATE);
-    u->inverse_plan = fftwf_plan_dft_c2r_1d(u->fft_size, u->output_window, u->work_buffer, FFTW_ESTIMATE);
+    u->spectrum_stride = pa_equalizer_spectrum_stride(u->fft_size);
+    u->output_window = pa_equalizer_alloc(u->spectrum_stride * u->channels, sizeof(fftwf_complex));
+    u->forward_plan = pa_equalizer_plan_forward(u->fft_size, u->channels, u->work_buffer, u->output_window);
+    u->inverse_plan = pa_equalizer_plan_inverse(u->fft_size, u->channels, u->output_window, u->work_buffer);
 
-    hanning_window(u->W, u->window_size);
+    pa_equalizer_hanning_window(u->W, u->window_size);
     u->first_iteration = TRUE;
 
     u->base_profiles = pa_xnew0(char *, u->channels);
@@ -40,6 +40,7 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/ltdl-helper.h>
+#include <pulsecore/strbuf.h>
 
 #ifdef HAVE_DBUS
 #include <pulsecore/protocol-dbus.h>
@@ -48,6 +49,7 @@
 
 #include "module-ladspa-sink-symdef.h"
 #include "ladspa.h"
+#include "ladspa-control.h"
 
 PA_MODULE_AUTHOR("Lennart Poettering");
 PA_MODULE_DESCRIPTION(_("Virtual LADSPA sink"));
@@ -65,24 +67,55 @@ PA_MODULE_USAGE(
       "label=<ladspa plugin label> "
       "control=<comma separated list of input control values> "
       "input_ladspaport_map=<comma separated list of input LADSPA port names> "
-      "output_ladspaport_map=<comma separated list of output LADSPA port names> "));
+      "output_ladspaport_map=<comma separated list of output LADSPA port names> "
+      "(to chain several plugins, separate the values for each of them with '|')"));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
+/* Alignment of the per-channel buffers, in bytes */
+#define BUFFER_ALIGN 64
+
 /* PLEASE NOTICE: The PortAudio ports and the LADSPA ports are two different concepts.
 They are not related and where possible the names of the LADSPA port variables contains "ladspa" to avoid confusion */
 
+/* One plugin of the chain. Enough instances of it are run to cover
+ * all channels, instance h processing the channels starting at
+ * h * max_ladspaport_count. */
+struct plugin {
+    lt_dlhandle dl;
+
+    const LADSPA_Descriptor *descriptor;
+    LADSPA_Handle handle[PA_CHANNELS_MAX];
+    unsigned long max_ladspaport_count, input_count, output_count, n_instances;
+
+    /* Only for plugins that cannot process in place: output buffers
+     * shared by all instances, copied back after each run */
+    LADSPA_Data **output;
+
+    /* This plugin's part of the control values in userdata */
+    LADSPA_Data *control;
+    pa_bool_t *use_default;
+    long unsigned n_control;
+};
+
 struct userdata {
     pa_module *module;
 
     pa_sink *sink;
     pa_sink_input *sink_input;
 
-    const LADSPA_Descriptor *descriptor;
-    LADSPA_Handle handle[PA_CHANNELS_MAX];
-    unsigned long max_ladspaport_count, input_count, output_count, channels;
-    LADSPA_Data **input, **output;
+    struct plugin *plugins;
+    unsigned n_plugins;
+    unsigned long channels;
+
+    /* One deinterleaved buffer per channel. The input is split into
+     * them once per block, all plugins of the chain process them in
+     * place and they are interleaved again at the end. */
+    LADSPA_Data *buffer[PA_CHANNELS_MAX];
+    void *buffer_data;
     size_t block_size;
+
+    /* The control values of all plugins, in chain order */
     LADSPA_Data *control;
     long unsigned n_control;
 
@@ -437,12 +470,42 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
+/* Called from I/O thread context */
+static void run_plugin(struct userdata *u, struct plugin *pl, unsigned n) {
+    unsigned long h, c;
+
+    for (h = 0; h < pl->n_instances; h++) {
+        pl->descriptor->run(pl->handle[h], n);
+
+        if (pl->output)
+            for (c = 0; c < pl->output_count; c++)
+                memcpy(u->buffer[h * pl->max_ladspaport_count + c], pl->output[c], n * sizeof(LADSPA_Data));
+    }
+}
+
+/* Called from I/O thread context */
+static void reset_plugins(struct userdata *u) {
+    unsigned i;
+    unsigned long h;
+
+    for (i = 0; i < u->n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
+
+        if (pl->descriptor->deactivate)
+            for (h = 0; h < pl->n_instances; h++)
+                pl->descriptor->deactivate(pl->handle[h]);
+        if (pl->descriptor->activate)
+            for (h = 0; h < pl->n_instances; h++)
+                pl->descriptor->activate(pl->handle[h]);
+    }
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
     float *src, *dst;
     size_t fs;
-    unsigned n, h, c;
+    unsigned n, c, p;
     pa_memchunk tchunk;
 
     pa_sink_input_assert_ref(i);
@@ -477,13 +540,14 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     src = pa_memblock_acquire_chunk(&tchunk);
     dst = pa_memblock_acquire(chunk->memblock);
 
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        for (c = 0; c < u->input_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[c], sizeof(float), src+ h*u->max_ladspaport_count + c, u->channels*sizeof(float), n);
-        u->descriptor->run(u->handle[h], n);
-        for (c = 0; c < u->output_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + h*u->max_ladspaport_count + c, u->channels*sizeof(float), u->output[c], sizeof(float), n);
-    }
+    for (c = 0; c < u->channels; c++)
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->buffer[c], sizeof(float), src + c, u->channels*sizeof(float), n);
+
+    for (p = 0; p < u->n_plugins; p++)
+        run_plugin(u, &u->plugins[p], n);
+
+    for (c = 0; c < u->channels; c++)
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + c, u->channels*sizeof(float), u->buffer[c], sizeof(float), n);
 
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
@@ -509,19 +573,13 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
         u->sink->thread_info.rewind_nbytes = 0;
 
         if (amount > 0) {
-            unsigned c;
-
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, TRUE);
 
-            pa_log_debug("Resetting plugin");
+            pa_log_debug("Resetting plugins");
 
-            /* Reset the plugin */
-            if (u->descriptor->deactivate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->deactivate(u->handle[c]);
-            if (u->descriptor->activate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->activate(u->handle[c]);
+            /* The whole chain shares one rewind buffer, so every
+             * plugin restarts from the same point */
+            reset_plugins(u);
         }
     }
 
@@ -678,100 +736,45 @@ static void sink_input_mute_changed_cb(pa_sink_input *i) {
     pa_sink_mute_changed(u->sink, i->muted);
 }
 
-static int parse_control_parameters(struct userdata *u, const char *cdata, double *read_values, pa_bool_t *use_default) {
-    unsigned long p = 0;
-    const char *state = NULL;
-    char *k;
-
-    pa_assert(read_values);
-    pa_assert(use_default);
-    pa_assert(u);
-
-    pa_log_debug("Trying to read %lu control values", u->n_control);
-
-    if (!cdata && u->n_control > 0)
-        return -1;
-
-    pa_log_debug("cdata: '%s'", cdata);
-
-    while ((k = pa_split(cdata, ",", &state)) && p < u->n_control) {
-        double f;
-
-        if (*k == 0) {
-            pa_log_debug("Read empty config value (p=%lu)", p);
-            use_default[p++] = TRUE;
-            pa_xfree(k);
-            continue;
-        }
-
-        if (pa_atod(k, &f) < 0) {
-            pa_log_debug("Failed to parse control value '%s' (p=%lu)", k, p);
-            pa_xfree(k);
-            goto fail;
-        }
-
-        pa_xfree(k);
-
-        pa_log_debug("Read config value %f (p=%lu)", f, p);
-
-        use_default[p] = FALSE;
-        read_values[p++] = f;
-    }
-
-    /* The previous loop doesn't take the last control value into account
-       if it is left empty, so we do it here. */
-    if (*cdata == 0 || cdata[strlen(cdata) - 1] == ',') {
-        if (p < u->n_control)
-            use_default[p] = TRUE;
-        p++;
-    }
-
-    if (p > u->n_control || k) {
-        pa_log("Too many control values passed, %lu expected.", u->n_control);
-        pa_xfree(k);
-        goto fail;
-    }
-
-    if (p < u->n_control) {
-        pa_log("Not enough control values passed, %lu expected, %lu passed.", u->n_control, p);
-        goto fail;
-    }
-
-    return 0;
-
-fail:
-    return -1;
-}
-
-static void connect_control_ports(struct userdata *u) {
+static void connect_plugin_control_ports(struct userdata *u, struct plugin *pl) {
     unsigned long p = 0, h = 0, c;
     const LADSPA_Descriptor *d;
 
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
+    pa_assert(pl);
+    pa_assert_se(d = pl->descriptor);
 
     for (p = 0; p < d->PortCount; p++) {
         if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
             continue;
 
         if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-            for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
+            for (c = 0; c < pl->n_instances; c++)
+                d->connect_port(pl->handle[c], p, &u->control_out);
             continue;
         }
 
         /* input control port */
 
-        pa_log_debug("Binding %f to port %s", u->control[h], d->PortNames[p]);
+        pa_log_debug("Binding %f to port %s", pl->control[h], d->PortNames[p]);
 
-        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-            d->connect_port(u->handle[c], p, &u->control[h]);
+        for (c = 0; c < pl->n_instances; c++)
+            d->connect_port(pl->handle[c], p, &pl->control[h]);
 
         h++;
     }
 }
 
-static int validate_control_parameters(struct userdata *u, double *control_values, pa_bool_t *use_default) {
+static void connect_control_ports(struct userdata *u) {
+    unsigned i;
+
+    pa_assert(u);
+
+    for (i = 0; i < u->n_plugins; i++)
+        connect_plugin_control_ports(u, &u->plugins[i]);
+}
+
+static int validate_control_parameters(struct userdata *u, struct plugin *pl, double *control_values, pa_bool_t *use_default) {
     unsigned long p = 0, h = 0;
     const LADSPA_Descriptor *d;
     pa_sample_spec ss;
@@ -779,7 +782,8 @@ static int validate_control_parameters(struct userdata *u, double *control_value
     pa_assert(control_values);
     pa_assert(use_default);
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
+    pa_assert(pl);
+    pa_assert_se(d = pl->descriptor);
 
     ss = u->ss;
 
@@ -834,7 +838,7 @@ static int validate_control_parameters(struct userdata *u, double *control_value
     return 0;
 }
 
-static int write_control_parameters(struct userdata *u, double *control_values, pa_bool_t *use_default) {
+static void write_plugin_control_parameters(struct userdata *u, struct plugin *pl, double *control_values, pa_bool_t *use_default) {
     unsigned long p = 0, h = 0, c;
     const LADSPA_Descriptor *d;
     pa_sample_spec ss;
@@ -842,13 +846,11 @@ static int write_control_parameters(struct userdata *u, double *control_values,
     pa_assert(control_values);
     pa_assert(use_default);
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
+    pa_assert(pl);
+    pa_assert_se(d = pl->descriptor);
 
     ss = u->ss;
 
-    if (validate_control_parameters(u, control_values, use_default) < 0)
-        return -1;
-
     /* p iterates over all ports, h is the control port iterator */
 
     for (p = 0; p < d->PortCount; p++) {
@@ -858,8 +860,8 @@ static int write_control_parameters(struct userdata *u, double *control_values,
             continue;
 
         if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-            for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
+            for (c = 0; c < pl->n_instances; c++)
+                d->connect_port(pl->handle[c], p, &u->control_out);
             continue;
         }
 
@@ -878,48 +880,48 @@ static int write_control_parameters(struct userdata *u, double *control_values,
             switch (hint & LADSPA_HINT_DEFAULT_MASK) {
 
             case LADSPA_HINT_DEFAULT_MINIMUM:
-                u->control[h] = lower;
+                pl->control[h] = lower;
                 break;
 
             case LADSPA_HINT_DEFAULT_MAXIMUM:
-                u->control[h] = upper;
+                pl->control[h] = upper;
                 break;
 
             case LADSPA_HINT_DEFAULT_LOW:
                 if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
+                    pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
                 else
-                    u->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
+                    pl->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
                 break;
 
             case LADSPA_HINT_DEFAULT_MIDDLE:
                 if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
+                    pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
                 else
-                    u->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
+                    pl->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
                 break;
 
             case LADSPA_HINT_DEFAULT_HIGH:
                 if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
+                    pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
                 else
-                    u->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
+                    pl->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
                 break;
 
             case LADSPA_HINT_DEFAULT_0:
-                u->control[h] = 0;
+                pl->control[h] = 0;
                 break;
 
             case LADSPA_HINT_DEFAULT_1:
-                u->control[h] = 1;
+                pl->control[h] = 1;
                 break;
 
             case LADSPA_HINT_DEFAULT_100:
-                u->control[h] = 100;
+                pl->control[h] = 100;
                 break;
 
             case LADSPA_HINT_DEFAULT_440:
-                u->control[h] = 440;
+                pl->control[h] = 440;
                 break;
 
             default:
@@ -928,10 +930,10 @@ static int write_control_parameters(struct userdata *u, double *control_values,
         }
         else {
             if (LADSPA_IS_HINT_INTEGER(hint)) {
-                u->control[h] = roundf(control_values[h]);
+                pl->control[h] = roundf(control_values[h]);
             }
             else {
-                u->control[h] = control_values[h];
+                pl->control[h] = control_values[h];
             }
         }
 
@@ -939,77 +941,38 @@ static int write_control_parameters(struct userdata *u, double *control_values,
     }
 
     /* set the use_default array to the user data */
-    memcpy(u->use_default, use_default, u->n_control * sizeof(u->use_default[0]));
-
-    return 0;
+    memcpy(pl->use_default, use_default, pl->n_control * sizeof(pl->use_default[0]));
 }
 
+/* control_values and use_default hold the values for all plugins of
+ * the chain. Nothing is written unless all of them are valid. */
+static int write_control_parameters(struct userdata *u, double *control_values, pa_bool_t *use_default) {
+    unsigned i;
+    unsigned long offset;
 
-int pa__init(pa_module*m) {
-    struct userdata *u;
-    pa_sample_spec ss;
-    pa_channel_map map;
-    pa_modargs *ma;
-    char *t;
-    pa_sink *master;
-    pa_sink_input_new_data sink_input_data;
-    pa_sink_new_data sink_data;
-    const char *plugin, *label, *input_ladspaport_map, *output_ladspaport_map;
-    LADSPA_Descriptor_Function descriptor_func;
-    unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
-    const char *e, *cdata;
-    const LADSPA_Descriptor *d;
-    unsigned long p, h, j, n_control, c;
-
-    pa_assert(m);
-
-    pa_assert_cc(sizeof(LADSPA_Data) == sizeof(float));
-
-    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
-        pa_log("Failed to parse module arguments.");
-        goto fail;
-    }
-
-    if (!(master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "master", NULL), PA_NAMEREG_SINK))) {
-        pa_log("Master sink not found");
-        goto fail;
-    }
-
-    ss = master->sample_spec;
-    ss.format = PA_SAMPLE_FLOAT32;
-    map = master->channel_map;
-    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
-        pa_log("Invalid sample format specification or channel map");
-        goto fail;
-    }
+    pa_assert(u);
 
-    if (!(plugin = pa_modargs_get_value(ma, "plugin", NULL))) {
-        pa_log("Missing LADSPA plugin name");
-        goto fail;
-    }
+    for (i = 0, offset = 0; i < u->n_plugins; offset += u->plugins[i].n_control, i++)
+        if (validate_control_parameters(u, &u->plugins[i], control_values + offset, use_default + offset) < 0)
+            return -1;
 
-    if (!(label = pa_modargs_get_value(ma, "label", NULL))) {
-        pa_log("Missing LADSPA plugin label");
-        goto fail;
-    }
-
-    if (!(input_ladspaport_map = pa_modargs_get_value(ma, "input_ladspaport_map", NULL)))
-        pa_log_debug("Using default input ladspa port mapping");
+    for (i = 0, offset = 0; i < u->n_plugins; offset += u->plugins[i].n_control, i++)
+        write_plugin_control_parameters(u, &u->plugins[i], control_values + offset, use_default + offset);
 
-    if (!(output_ladspaport_map = pa_modargs_get_value(ma, "output_ladspaport_map", NULL)))
-        pa_log_debug("Using default output ladspa port mapping");
+    return 0;
+}
 
-    cdata = pa_modargs_get_value(ma, "control", NULL);
 
-    u = pa_xnew0(struct userdata, 1);
-    u->module = m;
-    m->userdata = u;
-    u->memblockq = pa_memblockq_new("module-ladspa-sink memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0, &ss, 1, 1, 0, NULL);
-    u->max_ladspaport_count = 1; /*to avoid division by zero etc. in pa__done when failing before this value has been set*/
-    u->channels = 0;
-    u->input = NULL;
-    u->output = NULL;
-    u->ss = ss;
+/* Loads the plugin, instantiates it for all channels and connects its
+ * audio ports to the channel buffers */
+static int load_plugin(struct userdata *u, struct plugin *pl, const char *plugin, const char *label,
+                       const char *input_ladspaport_map, const char *output_ladspaport_map) {
+    LADSPA_Descriptor_Function descriptor_func;
+    unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
+    const LADSPA_Descriptor *d;
+    const char *e;
+    char *t;
+    unsigned long p, h, j, c;
 
     if (!(e = getenv("LADSPA_PATH")))
         e = LADSPA_PATH;
@@ -1017,32 +980,32 @@ int pa__init(pa_module*m) {
     /* FIXME: This is not exactly thread safe */
     t = pa_xstrdup(lt_dlgetsearchpath());
     lt_dlsetsearchpath(e);
-    m->dl = lt_dlopenext(plugin);
+    pl->dl = lt_dlopenext(plugin);
     lt_dlsetsearchpath(t);
     pa_xfree(t);
 
-    if (!m->dl) {
+    if (!pl->dl) {
         pa_log("Failed to load LADSPA plugin: %s", lt_dlerror());
-        goto fail;
+        return -1;
     }
 
-    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(m->dl, NULL, "ladspa_descriptor"))) {
+    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(pl->dl, NULL, "ladspa_descriptor"))) {
         pa_log("LADSPA module lacks ladspa_descriptor() symbol.");
-        goto fail;
+        return -1;
     }
 
     for (j = 0;; j++) {
 
         if (!(d = descriptor_func(j))) {
             pa_log("Failed to find plugin label '%s' in plugin '%s'.", label, plugin);
-            goto fail;
+            return -1;
         }
 
         if (pa_streq(d->Label, label))
             break;
     }
 
-    u->descriptor = d;
+    pl->descriptor = d;
 
     pa_log_debug("Module: %s", plugin);
     pa_log_debug("Label: %s", d->Label);
@@ -1051,8 +1014,7 @@ int pa__init(pa_module*m) {
     pa_log_debug("Maker: %s", d->Maker);
     pa_log_debug("Copyright: %s", d->Copyright);
 
-    n_control = 0;
-    u->channels = ss.channels;
+    pl->max_ladspaport_count = 1;
 
     /*
     * Enumerate ladspa ports
@@ -1062,33 +1024,34 @@ int pa__init(pa_module*m) {
         if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p])) {
             if (LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
                 pa_log_debug("Port %lu is input: %s", p, d->PortNames[p]);
-                input_ladspaport[u->input_count] = p;
-                u->input_count++;
+                input_ladspaport[pl->input_count] = p;
+                pl->input_count++;
             } else if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
                 pa_log_debug("Port %lu is output: %s", p, d->PortNames[p]);
-                output_ladspaport[u->output_count] = p;
-                u->output_count++;
+                output_ladspaport[pl->output_count] = p;
+                pl->output_count++;
             }
         } else if (LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]) && LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
             pa_log_debug("Port %lu is control: %s", p, d->PortNames[p]);
-            n_control++;
+            pl->n_control++;
         } else
             pa_log_debug("Ignored port %s", d->PortNames[p]);
         /* XXX: Has anyone ever seen an in-place plugin with non-equal number of input and output ports? */
         /* Could be if the plugin is for up-mixing stereo to 5.1 channels */
         /* Or if the plugin is down-mixing 5.1 to two channel stereo or binaural encoded signal */
-        if (u->input_count > u->max_ladspaport_count)
-            u->max_ladspaport_count = u->input_count;
+        if (pl->input_count > pl->max_ladspaport_count)
+            pl->max_ladspaport_count = pl->input_count;
         else
-            u->max_ladspaport_count = u->output_count;
+            pl->max_ladspaport_count = pl->output_count;
     }
 
-    if (u->channels % u->max_ladspaport_count) {
+    if (pl->max_ladspaport_count == 0 || u->channels % pl->max_ladspaport_count) {
         pa_log("Cannot handle non-integral number of plugins required for given number of channels");
-        goto fail;
+        return -1;
     }
 
-    pa_log_debug("Will run %lu plugin instances", u->channels / u->max_ladspaport_count);
+    pl->n_instances = u->channels / pl->max_ladspaport_count;
+    pa_log_debug("Will run %lu plugin instances", pl->n_instances);
 
     /* Parse data for input ladspa port map */
     if (input_ladspaport_map) {
@@ -1096,10 +1059,10 @@ int pa__init(pa_module*m) {
         char *pname;
         c = 0;
         while ((pname = pa_split(input_ladspaport_map, ",", &state))) {
-            if (c == u->input_count) {
+            if (c == pl->input_count) {
                 pa_log("Too many ports in input ladspa port map");
                 pa_xfree(pname);
-                goto fail;
+                return -1;
             }
 
             for (p = 0; p < d->PortCount; p++) {
@@ -1109,7 +1072,7 @@ int pa__init(pa_module*m) {
                     } else {
                         pa_log("Port %s is not an audio input ladspa port", pname);
                         pa_xfree(pname);
-                        goto fail;
+                        return -1;
                     }
                 }
             }
@@ -1124,10 +1087,10 @@ int pa__init(pa_module*m) {
         char *pname;
         c = 0;
         while ((pname = pa_split(output_ladspaport_map, ",", &state))) {
-            if (c == u->output_count) {
+            if (c == pl->output_count) {
                 pa_log("Too many ports in output ladspa port map");
                 pa_xfree(pname);
-                goto fail;
+                return -1;
             }
             for (p = 0; p < d->PortCount; p++) {
                 if (pa_streq(d->PortNames[p], pname)) {
@@ -1136,7 +1099,7 @@ int pa__init(pa_module*m) {
                     } else {
                         pa_log("Port %s is not an output ladspa port", pname);
                         pa_xfree(pname);
-                        goto fail;
+                        return -1;
                     }
                 }
             }
@@ -1145,52 +1108,217 @@ int pa__init(pa_module*m) {
         }
     }
 
-
-    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
-
-    /* Create buffers */
+    /* Plugins that can process in place read and write the channel
+     * buffers directly, the others get their own output buffers */
     if (LADSPA_IS_INPLACE_BROKEN(d->Properties)) {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->input_count);
-        for (c = 0; c < u->input_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->output_count);
-        for (c = 0; c < u->output_count; c++)
-            u->output[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-    } else {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->max_ladspaport_count);
-        for (c = 0; c < u->max_ladspaport_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = u->input;
+        pl->output = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) pl->output_count);
+        for (c = 0; c < pl->output_count; c++)
+            pl->output[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
     }
+
     /* Initialize plugin instances */
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        if (!(u->handle[h] = d->instantiate(d, ss.rate))) {
+    for (h = 0; h < pl->n_instances; h++) {
+        if (!(pl->handle[h] = d->instantiate(d, u->ss.rate))) {
             pa_log("Failed to instantiate plugin %s with label %s", plugin, d->Label);
+            return -1;
+        }
+
+        for (c = 0; c < pl->input_count; c++)
+            d->connect_port(pl->handle[h], input_ladspaport[c], u->buffer[h * pl->max_ladspaport_count + c]);
+        for (c = 0; c < pl->output_count; c++)
+            d->connect_port(pl->handle[h], output_ladspaport[c],
+                            pl->output ? pl->output[c] : u->buffer[h * pl->max_ladspaport_count + c]);
+    }
+
+    return 0;
+}
+
+static void free_plugin(struct plugin *pl) {
+    unsigned long c;
+
+    for (c = 0; c < pl->n_instances; c++) {
+        if (pl->handle[c]) {
+            if (pl->descriptor->deactivate)
+                pl->descriptor->deactivate(pl->handle[c]);
+            pl->descriptor->cleanup(pl->handle[c]);
+        }
+    }
+
+    if (pl->output) {
+        for (c = 0; c < pl->output_count; c++)
+            pa_xfree(pl->output[c]);
+        pa_xfree(pl->output);
+    }
+
+    if (pl->dl)
+        lt_dlclose(pl->dl);
+}
+
+/* Returns the next '|' separated part of a chain argument, or NULL if
+ * the argument is missing or has no more parts */
+static char *next_chain_value(const char *value, const char **state) {
+    return value ? pa_split(value, "|", state) : NULL;
+}
+
+int pa__init(pa_module*m) {
+    struct userdata *u;
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_modargs *ma;
+    pa_sink *master;
+    pa_sink_input_new_data sink_input_data;
+    pa_sink_new_data sink_data;
+    const char *plugin, *label, *input_ladspaport_map, *output_ladspaport_map;
+    const char *plugin_state = NULL, *label_state = NULL;
+    const char *input_map_state = NULL, *output_map_state = NULL;
+    const char *cdata;
+    char *k, *t, *name;
+    unsigned long c, n_control;
+    size_t stride;
+    unsigned i;
+    pa_strbuf *names, *makers, *copyrights, *unique_ids;
+
+    pa_assert(m);
+
+    pa_assert_cc(sizeof(LADSPA_Data) == sizeof(float));
+
+    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
+        pa_log("Failed to parse module arguments.");
+        goto fail;
+    }
+
+    if (!(master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "master", NULL), PA_NAMEREG_SINK))) {
+        pa_log("Master sink not found");
+        goto fail;
+    }
+
+    ss = master->sample_spec;
+    ss.format = PA_SAMPLE_FLOAT32;
+    map = master->channel_map;
+    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
+        pa_log("Invalid sample format specification or channel map");
+        goto fail;
+    }
+
+    if (!(plugin = pa_modargs_get_value(ma, "plugin", NULL))) {
+        pa_log("Missing LADSPA plugin name");
+        goto fail;
+    }
+
+    if (!(label = pa_modargs_get_value(ma, "label", NULL))) {
+        pa_log("Missing LADSPA plugin label");
+        goto fail;
+    }
+
+    if (!(input_ladspaport_map = pa_modargs_get_value(ma, "input_ladspaport_map", NULL)))
+        pa_log_debug("Using default input ladspa port mapping");
+
+    if (!(output_ladspaport_map = pa_modargs_get_value(ma, "output_ladspaport_map", NULL)))
+        pa_log_debug("Using default output ladspa port mapping");
+
+    cdata = pa_modargs_get_value(ma, "control", NULL);
+
+    u = pa_xnew0(struct userdata, 1);
+    u->module = m;
+    m->userdata = u;
+    u->memblockq = pa_memblockq_new("module-ladspa-sink memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0, &ss, 1, 1, 0, NULL);
+    u->channels = ss.channels;
+    u->ss = ss;
+
+    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
+
+    /* Create the channel buffers, all in one piece */
+    stride = PA_ROUND_UP(u->block_size / pa_frame_size(&ss) * sizeof(LADSPA_Data), BUFFER_ALIGN);
+    u->buffer_data = pa_xmalloc(stride * u->channels + BUFFER_ALIGN);
+    for (c = 0; c < u->channels; c++)
+        u->buffer[c] = (LADSPA_Data*) (PA_ROUND_UP((uintptr_t) u->buffer_data, BUFFER_ALIGN) + c * stride);
+
+    /* Count the plugins of the chain */
+    while ((k = pa_split(plugin, "|", &plugin_state))) {
+        u->n_plugins++;
+        pa_xfree(k);
+    }
+
+    if (u->n_plugins == 0) {
+        pa_log("Missing LADSPA plugin name");
+        goto fail;
+    }
+
+    u->plugins = pa_xnew0(struct plugin, u->n_plugins);
+    plugin_state = NULL;
+
+    for (i = 0; i < u->n_plugins; i++) {
+        char *plugin_name, *label_name, *input_map, *output_map;
+        int r;
+
+        plugin_name = pa_split(plugin, "|", &plugin_state);
+
+        if (!(label_name = pa_split(label, "|", &label_state))) {
+            pa_log("Missing LADSPA plugin label for plugin %s", plugin_name);
+            pa_xfree(plugin_name);
             goto fail;
         }
 
-        for (c = 0; c < u->input_count; c++)
-            d->connect_port(u->handle[h], input_ladspaport[c], u->input[c]);
-        for (c = 0; c < u->output_count; c++)
-            d->connect_port(u->handle[h], output_ladspaport[c], u->output[c]);
+        /* Empty port maps stand for the default mapping */
+        input_map = next_chain_value(input_ladspaport_map, &input_map_state);
+        output_map = next_chain_value(output_ladspaport_map, &output_map_state);
+
+        r = load_plugin(u, &u->plugins[i], plugin_name, label_name,
+                        input_map && *input_map ? input_map : NULL,
+                        output_map && *output_map ? output_map : NULL);
+
+        pa_xfree(output_map);
+        pa_xfree(input_map);
+        pa_xfree(label_name);
+        pa_xfree(plugin_name);
+
+        if (r < 0)
+            goto fail;
     }
 
+    if ((k = pa_split(label, "|", &label_state))) {
+        pa_log("More LADSPA plugin labels than plugins given");
+        pa_xfree(k);
+        goto fail;
+    }
+
+    if (u->n_plugins > 1)
+        pa_log_debug("Will run a chain of %u plugins", u->n_plugins);
+
+    n_control = 0;
+    for (i = 0; i < u->n_plugins; i++)
+        n_control += u->plugins[i].n_control;
+
     u->n_control = n_control;
 
     if (u->n_control > 0) {
         double *control_values;
         pa_bool_t *use_default;
+        unsigned long *plugin_n_control;
+        unsigned long offset;
+        int r;
 
         /* temporary storage for parser */
         control_values = pa_xnew(double, (unsigned) u->n_control);
         use_default = pa_xnew(pa_bool_t, (unsigned) u->n_control);
+        plugin_n_control = pa_xnew(unsigned long, u->n_plugins);
 
         /* real storage */
         u->control = pa_xnew(LADSPA_Data, (unsigned) u->n_control);
         u->use_default = pa_xnew(pa_bool_t, (unsigned) u->n_control);
 
-        if ((parse_control_parameters(u, cdata, control_values, use_default) < 0) ||
-            (write_control_parameters(u, control_values, use_default) < 0)) {
+        for (i = 0, offset = 0; i < u->n_plugins; offset += u->plugins[i].n_control, i++) {
+            struct plugin *pl = &u->plugins[i];
+
+            pl->control = u->control + offset;
+            pl->use_default = u->use_default + offset;
+            plugin_n_control[i] = pl->n_control;
+        }
+
+        r = pa_ladspa_parse_control_chain(cdata, plugin_n_control, u->n_plugins, control_values, use_default);
+        pa_xfree(plugin_n_control);
+
+        if (r < 0 || write_control_parameters(u, control_values, use_default) < 0) {
             pa_xfree(control_values);
             pa_xfree(use_default);
 
@@ -1203,9 +1331,13 @@ int pa__init(pa_module*m) {
         pa_xfree(use_default);
     }
 
-    if (d->activate)
-        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-            d->activate(u->handle[c]);
+    for (i = 0; i < u->n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
+
+        if (pl->descriptor->activate)
+            for (c = 0; c < pl->n_instances; c++)
+                pl->descriptor->activate(pl->handle[c]);
+    }
 
     /* Create sink */
     pa_sink_new_data_init(&sink_data);
@@ -1218,15 +1350,39 @@ int pa__init(pa_module*m) {
     pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, master->name);
     pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_CLASS, "filter");
     pa_proplist_sets(sink_data.proplist, "device.ladspa.module", plugin);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.label", d->Label);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.name", d->Name);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.maker", d->Maker);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.copyright", d->Copyright);
-    pa_proplist_setf(sink_data.proplist, "device.ladspa.unique_id", "%lu", (unsigned long) d->UniqueID);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.label", label);
+
+    /* For a chain, these list the plugins separated by '|', like the
+     * module arguments do */
+    names = pa_strbuf_new();
+    makers = pa_strbuf_new();
+    copyrights = pa_strbuf_new();
+    unique_ids = pa_strbuf_new();
+    for (i = 0; i < u->n_plugins; i++) {
+        const LADSPA_Descriptor *d = u->plugins[i].descriptor;
+        const char *sep = i > 0 ? "|" : "";
+
+        pa_strbuf_printf(names, "%s%s", sep, d->Name);
+        pa_strbuf_printf(makers, "%s%s", sep, d->Maker);
+        pa_strbuf_printf(copyrights, "%s%s", sep, d->Copyright);
+        pa_strbuf_printf(unique_ids, "%s%lu", sep, (unsigned long) d->UniqueID);
+    }
+    name = pa_strbuf_tostring_free(names);
+    t = pa_strbuf_tostring_free(makers);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.maker", t);
+    pa_xfree(t);
+    t = pa_strbuf_tostring_free(copyrights);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.copyright", t);
+    pa_xfree(t);
+    t = pa_strbuf_tostring_free(unique_ids);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.unique_id", t);
+    pa_xfree(t);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.name", name);
 
     if (pa_modargs_get_proplist(ma, "sink_properties", sink_data.proplist, PA_UPDATE_REPLACE) < 0) {
         pa_log("Invalid properties");
         pa_sink_new_data_done(&sink_data);
+        pa_xfree(name);
         goto fail;
     }
 
@@ -1234,9 +1390,11 @@ int pa__init(pa_module*m) {
         const char *z;
 
         z = pa_proplist_gets(master->proplist, PA_PROP_DEVICE_DESCRIPTION);
-        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "LADSPA Plugin %s on %s", d->Name, z ? z : master->name);
+        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "LADSPA Plugin %s on %s", name, z ? z : master->name);
     }
 
+    pa_xfree(name);
+
     u->sink = pa_sink_new(m->core, &sink_data,
                           (master->flags & (PA_SINK_LATENCY|PA_SINK_DYNAMIC_LATENCY)) | PA_SINK_SHARE_VOLUME_WITH_MASTER);
     pa_sink_new_data_done(&sink_data);
@@ -1345,32 +1503,11 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
-    for (c = 0; c < (u->channels / u->max_ladspaport_count); c++) {
-        if (u->handle[c]) {
-            if (u->descriptor->deactivate)
-                u->descriptor->deactivate(u->handle[c]);
-            u->descriptor->cleanup(u->handle[c]);
-        }
-    }
+    for (c = 0; c < u->n_plugins; c++)
+        free_plugin(&u->plugins[c]);
+    pa_xfree(u->plugins);
 
-    if (u->output == u->input) {
-        if (u->input != NULL) {
-            for (c = 0; c < u->max_ladspaport_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
-        }
-    } else {
-        if (u->input != NULL) {
-            for (c = 0; c < u->input_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
-        }
-        if (u->output != NULL) {
-            for (c = 0; c < u->output_count; c++)
-                pa_xfree(u->output[c]);
-            pa_xfree(u->output);
-        }
-    }
+    pa_xfree(u->buffer_data);
 
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
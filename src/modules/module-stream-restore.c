@@ -50,6 +50,7 @@
 #include <pulsecore/pstream.h>
 #include <pulsecore/pstream-util.h>
 #include <pulsecore/database.h>
+#include <pulsecore/database-cache.h>
 #include <pulsecore/tagstruct.h>
 #include <pulsecore/proplist-util.h>
 
@@ -70,9 +71,12 @@ PA_MODULE_USAGE(
         "restore_muted=<Save/restore muted states?> "
         "on_hotplug=<When new device becomes available, recheck streams?> "
         "on_rescue=<When device becomes unavailable, recheck streams?> "
-        "fallback_table=<filename>");
+        "fallback_table=<filename> "
+        "save_interval_msec=<Time after a change until it is written out> "
+        "save_max_bytes=<Amount of changes that are written out right away>");
 
 #define SAVE_INTERVAL (10 * PA_USEC_PER_SEC)
+#define SAVE_MAX_BYTES (64 * 1024)
 #define IDENTIFICATION_PROPERTY "module-stream-restore.id"
 
 #define DEFAULT_FALLBACK_FILE PA_DEFAULT_CONFIG_DIR"/stream-restore.table"
@@ -87,6 +91,8 @@ static const char* const valid_modargs[] = {
     "on_hotplug",
     "on_rescue",
     "fallback_table",
+    "save_interval_msec",
+    "save_max_bytes",
     NULL
 };
 
@@ -104,8 +110,8 @@ struct userdata {
         *sink_unlink_hook_slot,
         *source_unlink_hook_slot,
         *connection_unlink_hook_slot;
-    pa_time_event *save_time_event;
     pa_database* database;
+    pa_database_cache *cache;
 
     pa_bool_t restore_device:1;
     pa_bool_t restore_volume:1;
@@ -945,7 +951,7 @@ static void handle_entry_remove(DBusConnection *conn, DBusMessage *msg, void *us
     key.data = de->entry_name;
     key.size = strlen(de->entry_name);
 
-    pa_assert_se(pa_database_unset(de->userdata->database, &key) == 0);
+    pa_assert_se(pa_database_cache_unset(de->userdata->cache, &key) == 0);
 
     send_entry_removed_signal(de);
     trigger_save(de->userdata);
@@ -958,21 +964,6 @@ static void handle_entry_remove(DBusConnection *conn, DBusMessage *msg, void *us
 
 #endif /* HAVE_DBUS */
 
-static void save_time_callback(pa_mainloop_api*a, pa_time_event* e, const struct timeval *t, void *userdata) {
-    struct userdata *u = userdata;
-
-    pa_assert(a);
-    pa_assert(e);
-    pa_assert(u);
-
-    pa_assert(e == u->save_time_event);
-    u->core->mainloop->time_free(u->save_time_event);
-    u->save_time_event = NULL;
-
-    pa_database_sync(u->database);
-    pa_log_info("Synced.");
-}
-
 static struct entry* entry_new(void) {
     struct entry *r = pa_xnew0(struct entry, 1);
     r->version = ENTRY_VERSION;
@@ -1013,7 +1004,7 @@ static pa_bool_t entry_write(struct userdata *u, const char *name, const struct
 
     data.data = (void*)pa_tagstruct_data(t, &data.size);
 
-    r = (pa_database_set(u->database, &key, &data, replace) == 0);
+    r = (pa_database_cache_set(u->cache, &key, &data, replace) == 0);
 
     pa_tagstruct_free(t);
 
@@ -1047,7 +1038,7 @@ static struct entry *legacy_entry_read(struct userdata *u, const char *name) {
 
     pa_zero(data);
 
-    if (!pa_database_get(u->database, &key, &data))
+    if (!pa_database_cache_get(u->cache, &key, &data))
         goto fail;
 
     if (data.size != sizeof(struct legacy_entry)) {
@@ -1125,7 +1116,7 @@ static struct entry *entry_read(struct userdata *u, const char *name) {
 
     pa_zero(data);
 
-    if (!pa_database_get(u->database, &key, &data))
+    if (!pa_database_cache_get(u->cache, &key, &data))
         goto fail;
 
     t = pa_tagstruct_new(data.data, data.size);
@@ -1214,11 +1205,6 @@ static void trigger_save(struct userdata *u) {
 
         pa_pstream_send_tagstruct(pa_native_connection_get_pstream(c), t);
     }
-
-    if (u->save_time_event)
-        return;
-
-    u->save_time_event = pa_core_rttime_new(u->core, pa_rtclock_now() + SAVE_INTERVAL, save_time_callback, u);
 }
 
 static pa_bool_t entries_equal(const struct entry *a, const struct entry *b) {
@@ -1848,7 +1834,7 @@ static int fill_db(struct userdata *u, const char *filename) {
                 data.data = (void *) &e;
                 data.size = sizeof(e);
 
-                if (pa_database_set(u->database, &key, &data, FALSE) == 0)
+                if (pa_database_cache_set(u->cache, &key, &data, FALSE) == 0)
                     pa_log_debug("Setting %s to %0.2f dB.", ln, db);
             } else
                 pa_log_warn("[%s:%u] Positive dB values are not allowed, not setting entry %s.", fn, n, ln);
@@ -1979,14 +1965,14 @@ PA_GCC_UNUSED static void stream_restore_dump_database(struct userdata *u) {
     pa_datum key;
     pa_bool_t done;
 
-    done = !pa_database_first(u->database, &key, NULL);
+    done = !pa_database_cache_first(u->cache, &key, NULL);
 
     while (!done) {
         pa_datum next_key;
         struct entry *e;
         char *name;
 
-        done = !pa_database_next(u->database, &key, &next_key, NULL);
+        done = !pa_database_cache_next(u->cache, &key, &next_key, NULL);
 
         name = pa_xstrndup(key.data, key.size);
         pa_datum_free(&key);
@@ -2045,14 +2031,14 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
             if (!pa_tagstruct_eof(t))
                 goto fail;
 
-            done = !pa_database_first(u->database, &key, NULL);
+            done = !pa_database_cache_first(u->cache, &key, NULL);
 
             while (!done) {
                 pa_datum next_key;
                 struct entry *e;
                 char *name;
 
-                done = !pa_database_next(u->database, &key, &next_key, NULL);
+                done = !pa_database_cache_next(u->cache, &key, &next_key, NULL);
 
                 name = pa_xstrndup(key.data, key.size);
                 pa_datum_free(&key);
@@ -2101,7 +2087,7 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
                     dbus_entry_free(pa_hashmap_remove(u->dbus_entries, de->entry_name));
                 }
 #endif
-                pa_database_clear(u->database);
+                pa_database_cache_clear(u->cache);
             }
 
             while (!pa_tagstruct_eof(t)) {
@@ -2217,7 +2203,7 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
                 key.data = (char*) name;
                 key.size = strlen(name);
 
-                pa_database_unset(u->database, &key);
+                pa_database_cache_unset(u->cache, &key);
             }
 
             trigger_save(u);
@@ -2292,7 +2278,7 @@ static void clean_up_db(struct userdata *u) {
     PA_LLIST_HEAD_INIT(struct clean_up_item, to_be_converted);
 #endif
 
-    done = !pa_database_first(u->database, &key, NULL);
+    done = !pa_database_cache_first(u->cache, &key, NULL);
     while (!done) {
         pa_datum next_key;
         char *entry_name = NULL;
@@ -2325,7 +2311,7 @@ static void clean_up_db(struct userdata *u) {
             entry_free(e);
         }
 
-        done = !pa_database_next(u->database, &key, &next_key, NULL);
+        done = !pa_database_cache_next(u->cache, &key, &next_key, NULL);
         pa_datum_free(&key);
         key = next_key;
     }
@@ -2336,7 +2322,7 @@ static void clean_up_db(struct userdata *u) {
 
         pa_log_debug("Removing an invalid entry: %s", item->entry_name);
 
-        pa_assert_se(pa_database_unset(u->database, &key) >= 0);
+        pa_assert_se(pa_database_cache_unset(u->cache, &key) >= 0);
         trigger_save(u);
 
         PA_LLIST_REMOVE(struct clean_up_item, to_be_removed, item);
@@ -2367,6 +2353,8 @@ int pa__init(pa_module*m) {
     pa_source_output *so;
     uint32_t idx;
     pa_bool_t restore_device = TRUE, restore_volume = TRUE, restore_muted = TRUE, on_hotplug = TRUE, on_rescue = TRUE;
+    uint32_t save_interval_msec = SAVE_INTERVAL / PA_USEC_PER_MSEC;
+    uint32_t save_max_bytes = SAVE_MAX_BYTES;
 #ifdef HAVE_DBUS
     pa_datum key;
     pa_bool_t done;
@@ -2388,6 +2376,12 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "save_interval_msec", &save_interval_msec) < 0 ||
+        pa_modargs_get_value_u32(ma, "save_max_bytes", &save_max_bytes) < 0) {
+        pa_log("save_interval_msec= and save_max_bytes= expect unsigned integer arguments");
+        goto fail;
+    }
+
     if (!restore_muted && !restore_volume && !restore_device)
         pa_log_warn("Neither restoring volume, nor restoring muted, nor restoring device enabled!");
 
@@ -2443,6 +2437,8 @@ int pa__init(pa_module*m) {
     pa_log_info("Successfully opened database file '%s'.", fname);
     pa_xfree(fname);
 
+    u->cache = pa_database_cache_new(m, u->database, save_interval_msec * PA_USEC_PER_MSEC, save_max_bytes);
+
     clean_up_db(u);
 
     if (fill_db(u, pa_modargs_get_value(ma, "fallback_table", NULL)) < 0)
@@ -2456,7 +2452,7 @@ int pa__init(pa_module*m) {
     pa_assert_se(pa_dbus_protocol_register_extension(u->dbus_protocol, INTERFACE_STREAM_RESTORE) >= 0);
 
     /* Create the initial dbus entries. */
-    done = !pa_database_first(u->database, &key, NULL);
+    done = !pa_database_cache_first(u->cache, &key, NULL);
     while (!done) {
         pa_datum next_key;
         char *name;
@@ -2467,7 +2463,7 @@ int pa__init(pa_module*m) {
         pa_assert_se(pa_hashmap_put(u->dbus_entries, de->entry_name, de) == 0);
         pa_xfree(name);
 
-        done = !pa_database_next(u->database, &key, &next_key, NULL);
+        done = !pa_database_cache_next(u->cache, &key, &next_key, NULL);
         pa_datum_free(&key);
         key = next_key;
     }
@@ -2537,8 +2533,8 @@ void pa__done(pa_module*m) {
     if (u->connection_unlink_hook_slot)
         pa_hook_slot_free(u->connection_unlink_hook_slot);
 
-    if (u->save_time_event)
-        u->core->mainloop->time_free(u->save_time_event);
+    if (u->cache)
+        pa_database_cache_free(u->cache);
 
     if (u->database)
         pa_database_close(u->database);
@@ -40,6 +40,11 @@
 #include <pulsecore/ltdl-helper.h>
 #include <pulsecore/sound-file.h>
 #include <pulsecore/resampler.h>
+#include <pulsecore/worker-pool.h>
+
+#ifdef HAVE_FFTW
+#include <pulsecore/convolver.h>
+#endif
 
 #include <math.h>
 
@@ -60,10 +65,22 @@ PA_MODULE_USAGE(
           "use_volume_sharing=<yes or no> "
           "force_flat_volume=<yes or no> "
           "hrir=/path/to/left_hrir.wav "
+          "use_worker_pool=<yes or no> "
         ));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
+#ifdef HAVE_FFTW
+/* The convolver works best when it is fed whole blocks, so don't make
+ * them much larger than what the master sink usually asks for */
+#define CONVOLVER_BLOCK_SIZE_MIN 64
+#define CONVOLVER_BLOCK_SIZE_MAX 512
+#else
+/* Direct convolution costs hrir_samples * channels * 2 multiply-adds
+ * per frame */
+#define DIRECT_HRIR_SAMPLES_MAX 64
+#endif
+
 struct userdata {
     pa_module *module;
 
@@ -87,8 +104,19 @@ struct userdata {
     unsigned hrir_samples;
     float *hrir_data;
 
+#ifdef HAVE_FFTW
+    pa_convolver *convolver;
+#else
     float *input_buffer;
     int input_buffer_offset;
+#endif
+
+    /* When the convolution runs on the worker pool, each block is
+     * handed out one pop_cb() call after it was rendered. These are
+     * the input and output of the block in flight. */
+    pa_worker_pool *worker_pool;
+    pa_worker_job *job;
+    pa_memchunk job_input, job_output;
 };
 
 static const char* const valid_modargs[] = {
@@ -102,6 +130,7 @@ static const char* const valid_modargs[] = {
     "use_volume_sharing",
     "force_flat_volume",
     "hrir",
+    "use_worker_pool",
     NULL
 };
 
@@ -128,7 +157,10 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
                 pa_sink_get_latency_within_thread(u->sink_input->sink) +
 
                 /* Add the latency internal to our sink input on top */
-                pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec);
+                pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec) +
+
+                /* And the block that is still being processed */
+                pa_bytes_to_usec(u->job && pa_worker_job_is_pending(u->job) ? u->job_output.length : 0, &u->sink_input->sink->sample_spec);
 
             return 0;
     }
@@ -165,7 +197,8 @@ static void sink_request_rewind_cb(pa_sink *s) {
     /* Just hand this one over to the master sink */
     pa_sink_input_request_rewind(u->sink_input,
                                  s->thread_info.rewind_nbytes +
-                                 pa_memblockq_get_length(u->memblockq), TRUE, FALSE, FALSE);
+                                 pa_memblockq_get_length(u->memblockq) +
+                                 (u->job && pa_worker_job_is_pending(u->job) ? u->job_input.length : 0), TRUE, FALSE, FALSE);
 }
 
 /* Called from I/O thread context */
@@ -213,47 +246,30 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
-/* Called from I/O thread context */
-static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
-    struct userdata *u;
-    float *src, *dst;
-    unsigned n;
-    pa_memchunk tchunk;
-
-    unsigned j, k, l;
-    float sum_right, sum_left;
-    float current_sample;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert(chunk);
-    pa_assert_se(u = i->userdata);
-
-    /* Hmm, process any rewind request that might be queued up */
-    pa_sink_process_rewind(u->sink, 0);
-
-    while (pa_memblockq_peek(u->memblockq, &tchunk) < 0) {
-        pa_memchunk nchunk;
-
-        pa_sink_render(u->sink, nbytes * u->sink_fs / u->fs, &nchunk);
-        pa_memblockq_push(u->memblockq, &nchunk);
-        pa_memblock_unref(nchunk.memblock);
-    }
+#ifdef HAVE_FFTW
 
-    tchunk.length = PA_MIN(nbytes * u->sink_fs / u->fs, tchunk.length);
-    pa_assert(tchunk.length > 0);
+/* Called from I/O thread context */
+static void convolve(struct userdata *u, const float *src, float *dst, unsigned n) {
+    unsigned l;
 
-    n = (unsigned) (tchunk.length / u->sink_fs);
+    pa_convolver_process(u->convolver, src, dst, n);
 
-    pa_assert(n > 0);
+    for (l = 0; l < 2 * n; l++)
+        dst[l] = PA_CLAMP_UNLIKELY(dst[l], -1.0f, 1.0f);
+}
 
-    chunk->index = 0;
-    chunk->length = n * u->fs;
-    chunk->memblock = pa_memblock_new(i->sink->core->mempool, chunk->length);
+/* Called from I/O thread context */
+static void reset_convolution(struct userdata *u) {
+    pa_convolver_reset(u->convolver);
+}
 
-    pa_memblockq_drop(u->memblockq, n * u->sink_fs);
+#else
 
-    src = pa_memblock_acquire_chunk(&tchunk);
-    dst = pa_memblock_acquire(chunk->memblock);
+/* Called from I/O thread context */
+static void convolve(struct userdata *u, const float *src, float *dst, unsigned n) {
+    unsigned j, k, l;
+    float sum_right, sum_left;
+    float current_sample;
 
     for (l = 0; l < n; l++) {
         memcpy(((char*) u->input_buffer) + u->input_buffer_offset * u->sink_fs, ((char *) src) + l * u->sink_fs, u->sink_fs);
@@ -278,11 +294,119 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
         if (u->input_buffer_offset < 0)
             u->input_buffer_offset += u->hrir_samples;
     }
+}
+
+/* Called from I/O thread context */
+static void reset_convolution(struct userdata *u) {
+    memset(u->input_buffer, 0, u->hrir_samples * u->sink_fs);
+    u->input_buffer_offset = 0;
+}
+
+#endif
+
+/* Called from I/O thread context. Takes the next block of at most
+ * nbytes output bytes from our queue and allocates the output for it. */
+static void get_block(struct userdata *u, size_t nbytes, pa_memchunk *input, pa_memchunk *output) {
+    unsigned n;
+
+    while (pa_memblockq_peek(u->memblockq, input) < 0) {
+        pa_memchunk nchunk;
+
+        pa_sink_render(u->sink, nbytes * u->sink_fs / u->fs, &nchunk);
+        pa_memblockq_push(u->memblockq, &nchunk);
+        pa_memblock_unref(nchunk.memblock);
+    }
+
+    input->length = PA_MIN(nbytes * u->sink_fs / u->fs, input->length);
+    pa_assert(input->length > 0);
+
+    n = (unsigned) (input->length / u->sink_fs);
+
+    pa_assert(n > 0);
+
+    input->length = n * u->sink_fs;
+
+    output->index = 0;
+    output->length = n * u->fs;
+    output->memblock = pa_memblock_new(u->module->core->mempool, output->length);
+
+    pa_memblockq_drop(u->memblockq, input->length);
+}
+
+/* Called from I/O thread or worker context */
+static void process_block(struct userdata *u, const pa_memchunk *input, const pa_memchunk *output) {
+    float *src, *dst;
+
+    src = pa_memblock_acquire_chunk(input);
+    dst = pa_memblock_acquire_chunk(output);
+
+    convolve(u, src, dst, (unsigned) (output->length / u->fs));
+
+    pa_memblock_release(input->memblock);
+    pa_memblock_release(output->memblock);
+}
+
+/* Called from worker or I/O thread context */
+static void job_cb(void *userdata) {
+    struct userdata *u = userdata;
+
+    process_block(u, &u->job_input, &u->job_output);
+}
+
+/* Called from I/O thread context. Throws away the block in flight and
+ * puts its input back into our queue, so that it is rendered again. */
+static void cancel_job(struct userdata *u) {
+    if (!u->job || !pa_worker_job_is_pending(u->job))
+        return;
+
+    pa_worker_job_wait(u->job);
+
+    pa_memblockq_rewind(u->memblockq, u->job_input.length);
+
+    pa_memblock_unref(u->job_input.memblock);
+    pa_memblock_unref(u->job_output.memblock);
+    pa_memchunk_reset(&u->job_input);
+    pa_memchunk_reset(&u->job_output);
+}
+
+/* Called from I/O thread context */
+static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert(chunk);
+    pa_assert_se(u = i->userdata);
+
+    /* Hmm, process any rewind request that might be queued up */
+    pa_sink_process_rewind(u->sink, 0);
+
+    if (u->job && pa_worker_job_is_pending(u->job)) {
+
+        /* Hand out the block the worker pool has been processing
+         * since the last call */
+        pa_worker_job_wait(u->job);
 
-    pa_memblock_release(tchunk.memblock);
-    pa_memblock_release(chunk->memblock);
+        *chunk = u->job_output;
+        pa_memblock_unref(u->job_input.memblock);
+        pa_memchunk_reset(&u->job_input);
+        pa_memchunk_reset(&u->job_output);
 
-    pa_memblock_unref(tchunk.memblock);
+    } else {
+        pa_memchunk tchunk;
+
+        /* Nothing in flight, either because we do all the work here or
+         * because we just started or rewound: process this block
+         * ourselves, so that we don't have to play silence */
+        get_block(u, nbytes, &tchunk, chunk);
+        process_block(u, &tchunk, chunk);
+        pa_memblock_unref(tchunk.memblock);
+    }
+
+    if (u->job) {
+        /* And start on the next one right away */
+        get_block(u, nbytes, &u->job_input, &u->job_output);
+        pa_worker_job_submit(u->job);
+    }
 
     return 0;
 }
@@ -295,6 +419,11 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
 
+    /* The block in flight hasn't been played yet, so it has to be
+     * rendered again whenever anything before it changes */
+    if (nbytes > 0 || u->sink->thread_info.rewind_nbytes > 0)
+        cancel_job(u);
+
     if (u->sink->thread_info.rewind_nbytes > 0) {
         size_t max_rewrite;
 
@@ -306,8 +435,7 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, TRUE);
 
             /* Reset the input buffer */
-            memset(u->input_buffer, 0, u->hrir_samples * u->sink_fs);
-            u->input_buffer_offset = 0;
+            reset_convolution(u);
         }
     }
 
@@ -315,6 +443,17 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
     pa_memblockq_rewind(u->memblockq, nbytes * u->sink_fs / u->fs);
 }
 
+/* Called from I/O thread context */
+static void update_memblockq_maxrewind(struct userdata *u, size_t max_rewind, size_t max_request) {
+
+    /* cancel_job() needs to be able to put the block in flight back,
+     * which is at most max_request long */
+    if (u->job)
+        max_rewind += max_request;
+
+    pa_memblockq_set_maxrewind(u->memblockq, max_rewind * u->sink_fs / u->fs);
+}
+
 /* Called from I/O thread context */
 static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
     struct userdata *u;
@@ -324,7 +463,7 @@ static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
 
     /* FIXME: Too small max_rewind:
      * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
-    pa_memblockq_set_maxrewind(u->memblockq, nbytes * u->sink_fs / u->fs);
+    update_memblockq_maxrewind(u, nbytes, pa_sink_input_get_max_request(i));
     pa_sink_set_max_rewind_within_thread(u->sink, nbytes * u->sink_fs / u->fs);
 }
 
@@ -335,6 +474,7 @@ static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
 
+    update_memblockq_maxrewind(u, pa_sink_input_get_max_rewind(i), nbytes);
     pa_sink_set_max_request_within_thread(u->sink, nbytes * u->sink_fs / u->fs);
 }
 
@@ -365,6 +505,8 @@ static void sink_input_detach_cb(pa_sink_input *i) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
 
+    cancel_job(u);
+
     pa_sink_detach_within_thread(u->sink);
 
     pa_sink_set_rtpoll(u->sink, NULL);
@@ -529,6 +671,7 @@ int pa__init(pa_module*m) {
     pa_sink_new_data sink_data;
     pa_bool_t use_volume_sharing = TRUE;
     pa_bool_t force_flat_volume = FALSE;
+    pa_bool_t use_worker_pool = FALSE;
     pa_memchunk silence;
 
     const char *hrir_file;
@@ -606,6 +749,11 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "use_worker_pool", &use_worker_pool) < 0) {
+        pa_log("use_worker_pool= expects a boolean argument");
+        goto fail;
+    }
+
     if (use_volume_sharing && force_flat_volume) {
         pa_log("Flat volume can't be forced when using volume sharing.");
         goto fail;
@@ -713,10 +861,13 @@ int pa__init(pa_module*m) {
                                  PA_RESAMPLER_SRC_SINC_BEST_QUALITY, PA_RESAMPLER_NO_REMAP);
 
     u->hrir_samples = hrir_temp_chunk.length / pa_frame_size(&hrir_temp_ss) * hrir_ss.rate / hrir_temp_ss.rate;
-    if (u->hrir_samples > 64) {
-        u->hrir_samples = 64;
-        pa_log("The (resampled) hrir contains more than 64 samples. Only the first 64 samples will be used to limit processor usage.");
+#ifndef HAVE_FFTW
+    if (u->hrir_samples > DIRECT_HRIR_SAMPLES_MAX) {
+        u->hrir_samples = DIRECT_HRIR_SAMPLES_MAX;
+        pa_log("The (resampled) hrir contains more than %u samples. Only the first %u samples will be used to limit processor usage.",
+               DIRECT_HRIR_SAMPLES_MAX, DIRECT_HRIR_SAMPLES_MAX);
     }
+#endif
 
     hrir_total_length = u->hrir_samples * pa_frame_size(&hrir_ss);
     u->hrir_channels = hrir_ss.channels;
@@ -737,10 +888,10 @@ int pa__init(pa_module*m) {
             hrir_data = (float *) pa_memblock_acquire(hrir_temp_chunk_resampled.memblock);
 
             if (hrir_total_length - hrir_copied_length >= hrir_temp_chunk_resampled.length) {
-                memcpy(u->hrir_data + hrir_copied_length, hrir_data, hrir_temp_chunk_resampled.length);
+                memcpy((char *) u->hrir_data + hrir_copied_length, hrir_data, hrir_temp_chunk_resampled.length);
                 hrir_copied_length += hrir_temp_chunk_resampled.length;
             } else {
-                memcpy(u->hrir_data + hrir_copied_length, hrir_data, hrir_total_length - hrir_copied_length);
+                memcpy((char *) u->hrir_data + hrir_copied_length, hrir_data, hrir_total_length - hrir_copied_length);
                 hrir_copied_length = hrir_total_length;
             }
 
@@ -806,8 +957,23 @@ int pa__init(pa_module*m) {
         }
     }
 
+#ifdef HAVE_FFTW
+    u->convolver = pa_convolver_new(PA_CLAMP(pa_make_power_of_two(u->hrir_samples), CONVOLVER_BLOCK_SIZE_MIN, CONVOLVER_BLOCK_SIZE_MAX),
+                                    u->hrir_samples, u->channels, 2);
+
+    for (i = 0; i < u->channels; i++) {
+        pa_convolver_set_filter(u->convolver, i, 0, u->hrir_data + u->mapping_left[i], u->hrir_channels);
+        pa_convolver_set_filter(u->convolver, i, 1, u->hrir_data + u->mapping_right[i], u->hrir_channels);
+    }
+#else
     u->input_buffer = pa_xmalloc0(u->hrir_samples * u->sink_fs);
     u->input_buffer_offset = 0;
+#endif
+
+    if (use_worker_pool) {
+        u->worker_pool = pa_worker_pool_get(m->core);
+        u->job = pa_worker_job_new(u->worker_pool, job_cb, u);
+    }
 
     pa_sink_put(u->sink);
     pa_sink_input_put(u->sink_input);
@@ -862,14 +1028,32 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
+    /* Waits for the block in flight, if any */
+    if (u->job)
+        pa_worker_job_free(u->job);
+
+    if (u->job_input.memblock)
+        pa_memblock_unref(u->job_input.memblock);
+
+    if (u->job_output.memblock)
+        pa_memblock_unref(u->job_output.memblock);
+
+    if (u->worker_pool)
+        pa_worker_pool_unref(u->worker_pool);
+
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
     if (u->hrir_data)
         pa_xfree(u->hrir_data);
 
+#ifdef HAVE_FFTW
+    if (u->convolver)
+        pa_convolver_free(u->convolver);
+#else
     if (u->input_buffer)
         pa_xfree(u->input_buffer);
+#endif
 
     if (u->mapping_left)
         pa_xfree(u->mapping_left);
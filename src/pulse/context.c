@@ -60,6 +60,7 @@
 #include <pulsecore/hashmap.h>
 #include <pulsecore/socket-client.h>
 #include <pulsecore/pstream-util.h>
+#include <pulsecore/srbchannel.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/log.h>
@@ -72,6 +73,8 @@
 #include "context.h"
 
 void pa_command_extension(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_register_memfd_shmid(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 
 static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_REQUEST] = pa_command_request,
@@ -85,12 +88,15 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_RECORD_STREAM_SUSPENDED] = pa_command_stream_suspended,
     [PA_COMMAND_STARTED] = pa_command_stream_started,
     [PA_COMMAND_SUBSCRIBE_EVENT] = pa_command_subscribe_event,
+    [PA_COMMAND_SUBSCRIBE_EVENT_BATCH] = pa_command_subscribe_event_batch,
     [PA_COMMAND_EXTENSION] = pa_command_extension,
     [PA_COMMAND_PLAYBACK_STREAM_EVENT] = pa_command_stream_event,
     [PA_COMMAND_RECORD_STREAM_EVENT] = pa_command_stream_event,
     [PA_COMMAND_CLIENT_EVENT] = pa_command_client_event,
     [PA_COMMAND_PLAYBACK_BUFFER_ATTR_CHANGED] = pa_command_stream_buffer_attr,
-    [PA_COMMAND_RECORD_BUFFER_ATTR_CHANGED] = pa_command_stream_buffer_attr
+    [PA_COMMAND_RECORD_BUFFER_ATTR_CHANGED] = pa_command_stream_buffer_attr,
+    [PA_COMMAND_ENABLE_SRBCHANNEL] = command_enable_srbchannel,
+    [PA_COMMAND_REGISTER_MEMFD_SHMID] = command_register_memfd_shmid
 };
 static void context_free(pa_context *c);
 
@@ -111,6 +117,9 @@ static void reset_callbacks(pa_context *c) {
     c->subscribe_callback = NULL;
     c->subscribe_userdata = NULL;
 
+    c->subscribe_batch_callback = NULL;
+    c->subscribe_batch_userdata = NULL;
+
     c->event_callback = NULL;
     c->event_userdata = NULL;
 
@@ -172,16 +181,23 @@ pa_context *pa_context_new_with_proplist(pa_mainloop_api *mainloop, const char *
 #endif
     pa_client_conf_env(c->conf);
 
-    if (!(c->mempool = pa_mempool_new(!c->conf->disable_shm, c->conf->shm_size))) {
+    if (!c->conf->disable_shm) {
+#ifdef HAVE_MEMFD
+        /* A memfd pool works even where /dev/shm is not accessible,
+         * but only with servers that know about it */
+        if (!c->conf->disable_memfd)
+            c->mempool = pa_mempool_new(PA_MEM_TYPE_SHARED_MEMFD, c->conf->shm_size);
+#endif
 
-        if (!c->conf->disable_shm)
-            c->mempool = pa_mempool_new(FALSE, c->conf->shm_size);
+        if (!c->mempool)
+            c->mempool = pa_mempool_new(PA_MEM_TYPE_SHARED_POSIX, c->conf->shm_size);
+    }
 
-        if (!c->mempool) {
+    if (!c->mempool)
+        if (!(c->mempool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, c->conf->shm_size))) {
             context_free(c);
             return NULL;
         }
-    }
 
     return c;
 }
@@ -323,7 +339,7 @@ static void pstream_die_callback(pa_pstream *p, void *userdata) {
     pa_context_fail(c, PA_ERR_CONNECTIONTERMINATED);
 }
 
-static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata) {
+static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
     pa_context *c = userdata;
 
     pa_assert(p);
@@ -332,7 +348,7 @@ static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_c
 
     pa_context_ref(c);
 
-    if (pa_pdispatch_run(c->pdispatch, packet, creds, c) < 0)
+    if (pa_pdispatch_run(c->pdispatch, packet, ancil_data, c) < 0)
         pa_context_fail(c, PA_ERR_PROTOCOL);
 
     pa_context_unref(c);
@@ -369,6 +385,94 @@ static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t o
     pa_context_unref(c);
 }
 
+/* The server offers us a shared memory ring buffer channel */
+static void command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_context *c = userdata;
+    pa_srbchannel_template srbt;
+    pa_srbchannel *srb;
+    pa_tagstruct *reply;
+    const int *fds;
+    int nfd, i, dupfds[3];
+
+    pa_assert(pd);
+    pa_assert(command == PA_COMMAND_ENABLE_SRBCHANNEL);
+    pa_assert(t);
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    if (pa_tagstruct_getu32(t, &srbt.shm_id) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        pa_context_fail(c, PA_ERR_PROTOCOL);
+        return;
+    }
+
+    fds = pa_pdispatch_fds(pd, &nfd);
+
+    /* Two eventfds, and the segment itself if it is a memfd */
+    if (!fds || (nfd != 2 && nfd != 3) || !c->do_shm) {
+        pa_context_fail(c, PA_ERR_PROTOCOL);
+        return;
+    }
+
+    /* The pstream closes the file descriptors once we return. If we
+     * don't answer, the server simply keeps using the socket. */
+    for (i = 0; i < nfd; i++)
+        if ((dupfds[i] = dup(fds[i])) < 0) {
+            pa_log_debug("Failed to duplicate ring buffer file descriptor: %s", pa_cstrerror(errno));
+
+            while (i > 0)
+                pa_close(dupfds[--i]);
+
+            return;
+        }
+
+    srbt.readfd = dupfds[0];
+    srbt.writefd = dupfds[1];
+    srbt.memfd = nfd > 2 ? dupfds[2] : -1;
+
+    if (!(srb = pa_srbchannel_new_from_template(c->mainloop, &srbt))) {
+        pa_log_debug("Failed to open the ring buffer channel, using the socket.");
+        return;
+    }
+
+    reply = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(reply, PA_COMMAND_ENABLE_SRBCHANNEL);
+    pa_tagstruct_putu32(reply, tag);
+    pa_pstream_send_tagstruct(c->pstream, reply);
+
+    pa_pstream_set_srbchannel(c->pstream, srb);
+}
+
+/* The server sends us the memfd of the pool it exports blocks from */
+static void command_register_memfd_shmid(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_context *c = userdata;
+    uint32_t shm_id;
+    const int *fds;
+    int nfd;
+
+    pa_assert(pd);
+    pa_assert(command == PA_COMMAND_REGISTER_MEMFD_SHMID);
+    pa_assert(t);
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    if (pa_tagstruct_getu32(t, &shm_id) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        pa_context_fail(c, PA_ERR_PROTOCOL);
+        return;
+    }
+
+    fds = pa_pdispatch_fds(pd, &nfd);
+
+    if (!fds || nfd != 1 || !c->do_shm) {
+        pa_context_fail(c, PA_ERR_PROTOCOL);
+        return;
+    }
+
+    if (pa_pstream_attach_memfd_shmid(c->pstream, shm_id, fds[0]) < 0)
+        pa_context_fail(c, PA_ERR_PROTOCOL);
+}
+
 int pa_context_handle_error(pa_context *c, uint32_t command, pa_tagstruct *t, pa_bool_t fail) {
     uint32_t err;
     pa_assert(c);
@@ -425,7 +529,7 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
     switch(c->state) {
         case PA_CONTEXT_AUTHORIZING: {
             pa_tagstruct *reply;
-            pa_bool_t shm_on_remote = FALSE;
+            pa_bool_t shm_on_remote = FALSE, memfd_on_remote = FALSE, do_memfd;
 
             if (pa_tagstruct_getu32(t, &c->version) < 0 ||
                 !pa_tagstruct_eof(t)) {
@@ -441,10 +545,15 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
 
             /* Starting with protocol version 13 the MSB of the version
                tag reflects if shm is available for this connection or
-               not. */
+               not, starting with version 30 the next bit if memfd
+               is. */
             if (c->version >= 13) {
-                shm_on_remote = !!(c->version & 0x80000000U);
-                c->version &= 0x7FFFFFFFU;
+                shm_on_remote = !!(c->version & PA_PROTOCOL_FLAG_SHM);
+                memfd_on_remote = !!(c->version & PA_PROTOCOL_FLAG_MEMFD);
+                c->version &= PA_PROTOCOL_VERSION_MASK;
+
+                if (c->version < 30)
+                    memfd_on_remote = FALSE;
             }
 
             pa_log_debug("Protocol version: remote %u, local %u", c->version, PA_PROTOCOL_VERSION);
@@ -470,6 +579,15 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
             pa_log_debug("Negotiated SHM: %s", pa_yes_no(c->do_shm));
             pa_pstream_enable_shm(c->pstream, c->do_shm);
 
+            /* If the server can't take our memfd pool, what we send
+             * is copied over the socket. */
+            do_memfd = c->do_shm && memfd_on_remote && pa_mempool_is_memfd_backed(c->mempool);
+
+            if (do_memfd && pa_pstream_register_memfd_mempool(c->pstream, c->mempool) < 0)
+                do_memfd = FALSE;
+
+            pa_log_debug("Negotiated memfd: %s", pa_yes_no(do_memfd));
+
             reply = pa_tagstruct_command(c, PA_COMMAND_SET_CLIENT_NAME, &tag);
 
             if (c->version >= 13) {
@@ -536,8 +654,11 @@ static void setup_context(pa_context *c, pa_iochannel *io) {
     pa_log_debug("SHM possible: %s", pa_yes_no(c->do_shm));
 
     /* Starting with protocol version 13 we use the MSB of the version
-     * tag for informing the other side if we could do SHM or not */
-    pa_tagstruct_putu32(t, PA_PROTOCOL_VERSION | (c->do_shm ? 0x80000000U : 0));
+     * tag for informing the other side if we could do SHM or not,
+     * starting with version 30 the next bit for memfd */
+    pa_tagstruct_putu32(t, PA_PROTOCOL_VERSION |
+                        (c->do_shm ? PA_PROTOCOL_FLAG_SHM : 0) |
+                        (c->do_shm && pa_mempool_is_memfd_backed(c->mempool) ? PA_PROTOCOL_FLAG_MEMFD : 0));
     pa_tagstruct_put_arbitrary(t, c->conf->cookie, sizeof(c->conf->cookie));
 
 #ifdef HAVE_CREDS
@@ -32,6 +32,7 @@
 #include <pulse/ext-device-restore.h>
 #include <pulse/ext-stream-restore.h>
 
+#include <pulsecore/atomic.h>
 #include <pulsecore/socket-client.h>
 #include <pulsecore/pstream.h>
 #include <pulsecore/pdispatch.h>
@@ -42,6 +43,7 @@
 #include <pulsecore/memblockq.h>
 #include <pulsecore/hashmap.h>
 #include <pulsecore/refcnt.h>
+#include <pulsecore/shmring.h>
 #include <pulsecore/time-smoother.h>
 #ifdef HAVE_DBUS
 #include <pulsecore/dbus-util.h>
@@ -80,6 +82,8 @@ struct pa_context {
     void *state_userdata;
     pa_context_subscribe_cb_t subscribe_callback;
     void *subscribe_userdata;
+    pa_context_subscribe_batch_cb_t subscribe_batch_callback;
+    void *subscribe_batch_userdata;
     pa_context_event_cb_t event_callback;
     void *event_userdata;
 
@@ -169,6 +173,9 @@ struct pa_stream {
     /* playback */
     pa_memblock *write_memblock;
     void *write_data;
+    /* pa_shmring*, set once from the main loop and read from
+     * whatever thread calls pa_stream_ring_write() */
+    pa_atomic_ptr_t ring;
     int64_t latest_underrun_at_index;
 
     /* recording */
@@ -243,6 +250,7 @@ struct pa_operation {
 void pa_command_request(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_stream_killed(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_subscribe_event(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+void pa_command_subscribe_event_batch(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_overflow_or_underflow(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_stream_suspended(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_stream_moved(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
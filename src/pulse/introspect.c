@@ -1777,6 +1777,298 @@ pa_operation* pa_context_get_sample_info_list(pa_context *c, pa_sample_info_cb_t
     return pa_context_send_simple_command(c, PA_COMMAND_GET_SAMPLE_INFO_LIST, context_get_sample_info_callback, (pa_operation_cb_t) cb, userdata);
 }
 
+/*** Filtered lists ***/
+
+struct pa_info_filter {
+    PA_REFCNT_DECLARE;
+
+    /* NULL-terminated, NULL for all properties */
+    char **keys;
+    unsigned n_keys;
+
+    char **match_keys, **match_values;
+    unsigned n_match;
+
+    /* What the last reply said */
+    uint64_t generation;
+    pa_bool_t complete;
+    uint32_t *removed;
+    unsigned n_removed;
+};
+
+/* What a filtered list operation needs until its reply arrives */
+struct filtered_list {
+    pa_info_filter *filter;
+    pa_pdispatch_cb_t parse;
+};
+
+pa_info_filter* pa_info_filter_new(void) {
+    pa_info_filter *f;
+
+    f = pa_xnew0(pa_info_filter, 1);
+    PA_REFCNT_INIT(f);
+
+    return f;
+}
+
+pa_info_filter* pa_info_filter_ref(pa_info_filter *f) {
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+
+    PA_REFCNT_INC(f);
+    return f;
+}
+
+static void free_strv(char **v, unsigned n) {
+    unsigned k;
+
+    for (k = 0; k < n; k++)
+        pa_xfree(v[k]);
+
+    pa_xfree(v);
+}
+
+void pa_info_filter_unref(pa_info_filter *f) {
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+
+    if (PA_REFCNT_DEC(f) > 0)
+        return;
+
+    free_strv(f->keys, f->n_keys);
+    free_strv(f->match_keys, f->n_match);
+    free_strv(f->match_values, f->n_match);
+    pa_xfree(f->removed);
+    pa_xfree(f);
+}
+
+int pa_info_filter_set_keys(pa_info_filter *f, const char *const keys[]) {
+    unsigned n, k;
+
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+
+    for (n = 0; keys && keys[n]; n++)
+        if (!pa_proplist_key_valid(keys[n]))
+            return -1;
+
+    if (n > PA_INFO_FILTER_MAX)
+        return -1;
+
+    free_strv(f->keys, f->n_keys);
+    f->keys = NULL;
+    f->n_keys = 0;
+
+    if (!keys)
+        return 0;
+
+    f->keys = pa_xnew0(char*, n + 1);
+    for (k = 0; k < n; k++)
+        f->keys[k] = pa_xstrdup(keys[k]);
+    f->n_keys = n;
+
+    return 0;
+}
+
+int pa_info_filter_add_match(pa_info_filter *f, const char *key, const char *value) {
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+    pa_assert(key);
+
+    if (!pa_proplist_key_valid(key) || f->n_match >= PA_INFO_FILTER_MAX)
+        return -1;
+
+    f->match_keys = pa_xrenew(char*, f->match_keys, f->n_match + 1);
+    f->match_values = pa_xrenew(char*, f->match_values, f->n_match + 1);
+    f->match_keys[f->n_match] = pa_xstrdup(key);
+    f->match_values[f->n_match] = pa_xstrdup(value);
+    f->n_match++;
+
+    return 0;
+}
+
+uint64_t pa_info_filter_get_generation(const pa_info_filter *f) {
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+
+    return f->generation;
+}
+
+void pa_info_filter_set_generation(pa_info_filter *f, uint64_t generation) {
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+
+    f->generation = generation;
+}
+
+int pa_info_filter_is_complete(const pa_info_filter *f) {
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+
+    return f->complete;
+}
+
+const uint32_t* pa_info_filter_get_removed(const pa_info_filter *f, unsigned *n) {
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+    pa_assert(n);
+
+    *n = f->n_removed;
+    return f->removed;
+}
+
+/* Reads what comes before the entries of the list */
+static int info_filter_read_reply(pa_info_filter *f, pa_tagstruct *t) {
+    uint64_t generation;
+    pa_bool_t complete;
+    uint32_t n = 0, k, size = 0, *removed = NULL;
+
+    if (pa_tagstruct_getu64(t, &generation) < 0 ||
+        pa_tagstruct_get_boolean(t, &complete) < 0 ||
+        (!complete && pa_tagstruct_getu32(t, &n) < 0))
+        return -1;
+
+    /* Don't trust n before the indexes were actually read */
+    for (k = 0; k < n; k++) {
+        if (k >= size) {
+            size = size > 0 ? 2 * size : 16;
+            removed = pa_xrenew(uint32_t, removed, size);
+        }
+
+        if (pa_tagstruct_getu32(t, &removed[k]) < 0) {
+            pa_xfree(removed);
+            return -1;
+        }
+    }
+
+    pa_xfree(f->removed);
+    f->removed = removed;
+    f->n_removed = n;
+    f->generation = generation;
+    f->complete = complete;
+
+    return 0;
+}
+
+static void filtered_list_free(struct filtered_list *l) {
+    pa_info_filter_unref(l->filter);
+    pa_xfree(l);
+}
+
+/* Called instead of the reply callback if the reply never arrives */
+static void filtered_list_operation_free(pa_operation *o) {
+    pa_assert(o);
+
+    if (o->private) {
+        filtered_list_free(o->private);
+        o->private = NULL;
+    }
+
+    pa_operation_unref(o);
+}
+
+static void context_get_info_list_filtered_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    struct filtered_list *l;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+    pa_assert_se(l = o->private);
+
+    o->private = NULL;
+
+    if (o->context && command == PA_COMMAND_REPLY && info_filter_read_reply(l->filter, t) < 0) {
+        pa_context_fail(o->context, PA_ERR_PROTOCOL);
+        pa_operation_done(o);
+        pa_operation_unref(o);
+    } else
+        /* The rest is an ordinary list, and this takes care of the
+         * operation */
+        l->parse(pd, command, tag, t, o);
+
+    filtered_list_free(l);
+}
+
+static pa_operation* get_info_list_filtered(pa_context *c, uint32_t command, pa_info_filter *f, pa_pdispatch_cb_t parse, pa_operation_cb_t cb, void *userdata) {
+    pa_tagstruct *t;
+    pa_operation *o;
+    struct filtered_list *l;
+    uint32_t tag;
+    unsigned k;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+    pa_assert(cb);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 31, PA_ERR_NOTSUPPORTED);
+
+    o = pa_operation_new(c, NULL, cb, userdata);
+
+    l = pa_xnew(struct filtered_list, 1);
+    l->filter = pa_info_filter_ref(f);
+    l->parse = parse;
+    o->private = l;
+
+    t = pa_tagstruct_command(c, PA_COMMAND_GET_INFO_LIST_FILTERED, &tag);
+    pa_tagstruct_putu32(t, command);
+    pa_tagstruct_putu64(t, f->generation);
+
+    if (f->keys) {
+        pa_tagstruct_putu32(t, f->n_keys);
+        for (k = 0; k < f->n_keys; k++)
+            pa_tagstruct_puts(t, f->keys[k]);
+    } else
+        pa_tagstruct_putu32(t, PA_INVALID_INDEX);
+
+    pa_tagstruct_putu32(t, f->n_match);
+    for (k = 0; k < f->n_match; k++) {
+        pa_tagstruct_puts(t, f->match_keys[k]);
+        pa_tagstruct_puts(t, f->match_values[k]);
+    }
+
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, context_get_info_list_filtered_callback, pa_operation_ref(o), (pa_free_cb_t) filtered_list_operation_free);
+
+    return o;
+}
+
+pa_operation* pa_context_get_sink_info_list_filtered(pa_context *c, pa_info_filter *f, pa_sink_info_cb_t cb, void *userdata) {
+    return get_info_list_filtered(c, PA_COMMAND_GET_SINK_INFO_LIST, f, context_get_sink_info_callback, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_source_info_list_filtered(pa_context *c, pa_info_filter *f, pa_source_info_cb_t cb, void *userdata) {
+    return get_info_list_filtered(c, PA_COMMAND_GET_SOURCE_INFO_LIST, f, context_get_source_info_callback, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_module_info_list_filtered(pa_context *c, pa_info_filter *f, pa_module_info_cb_t cb, void *userdata) {
+    return get_info_list_filtered(c, PA_COMMAND_GET_MODULE_INFO_LIST, f, context_get_module_info_callback, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_client_info_list_filtered(pa_context *c, pa_info_filter *f, pa_client_info_cb_t cb, void *userdata) {
+    return get_info_list_filtered(c, PA_COMMAND_GET_CLIENT_INFO_LIST, f, context_get_client_info_callback, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_card_info_list_filtered(pa_context *c, pa_info_filter *f, pa_card_info_cb_t cb, void *userdata) {
+    return get_info_list_filtered(c, PA_COMMAND_GET_CARD_INFO_LIST, f, context_get_card_info_callback, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_sink_input_info_list_filtered(pa_context *c, pa_info_filter *f, pa_sink_input_info_cb_t cb, void *userdata) {
+    return get_info_list_filtered(c, PA_COMMAND_GET_SINK_INPUT_INFO_LIST, f, context_get_sink_input_info_callback, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_source_output_info_list_filtered(pa_context *c, pa_info_filter *f, pa_source_output_info_cb_t cb, void *userdata) {
+    return get_info_list_filtered(c, PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST, f, context_get_source_output_info_callback, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_sample_info_list_filtered(pa_context *c, pa_info_filter *f, pa_sample_info_cb_t cb, void *userdata) {
+    return get_info_list_filtered(c, PA_COMMAND_GET_SAMPLE_INFO_LIST, f, context_get_sample_info_callback, (pa_operation_cb_t) cb, userdata);
+}
+
 static pa_operation* command_kill(pa_context *c, uint32_t command, uint32_t idx, pa_context_success_cb_t cb, void *userdata) {
     pa_operation *o;
     pa_tagstruct *t;
@@ -136,6 +136,24 @@
  * either pa_context_get_client_info() or pa_context_get_client_info_list().
  * The information structure is called pa_client_info.
  *
+ * \subsection filter_subsec Filtered Lists
+ *
+ * Clients that keep a view of many objects, like a mixer that shows all
+ * streams, can have the server do the filtering with a #pa_info_filter and
+ * the pa_context_get_*_info_list_filtered() functions, e.g.
+ * pa_context_get_sink_input_info_list_filtered(). The server then only
+ * lists the objects whose properties match the ones set with
+ * pa_info_filter_add_match(), and only includes the properties set with
+ * pa_info_filter_set_keys() in the property lists.
+ *
+ * The filter also remembers how far the client got: the first query lists
+ * everything, the following ones only what changed since the previous one.
+ * After each query, pa_info_filter_get_removed() tells which objects are
+ * gone or don't match anymore. If pa_info_filter_is_complete() returns
+ * non-zero, the server listed everything again, and objects that weren't
+ * listed can be forgotten. This needs a server that supports protocol
+ * version 31.
+ *
  * \section ctrl_sec Control
  *
  * Some parts of the server are only possible to read, but most can also be
@@ -665,6 +683,78 @@ pa_operation* pa_context_get_sample_info_list(pa_context *c, pa_sample_info_cb_t
 
 /** @} */
 
+/** @{ \name Filtered Lists */
+
+/** An opaque filter for the pa_context_get_*_info_list_filtered()
+ * functions, which also keeps track of what the client has seen
+ * already. Use one filter per kind of object. \since 5.0 */
+typedef struct pa_info_filter pa_info_filter;
+
+/** Create a new filter that matches everything. \since 5.0 */
+pa_info_filter* pa_info_filter_new(void);
+
+/** Increase the reference count by one. \since 5.0 */
+pa_info_filter* pa_info_filter_ref(pa_info_filter *f);
+
+/** Decrease the reference count by one. \since 5.0 */
+void pa_info_filter_unref(pa_info_filter *f);
+
+/** Only include these properties in the property lists of the objects
+ * listed. keys is terminated by NULL, or NULL itself to include all of
+ * them, which is the default. Returns a negative value if a key is
+ * invalid. \since 5.0 */
+int pa_info_filter_set_keys(pa_info_filter *f, const char *const keys[]);
+
+/** Only list objects whose property key is set to value. If value is
+ * NULL, the object only needs to have the property. If this is called
+ * more than once, all of the matches have to apply. Returns a negative
+ * value if the key is invalid. \since 5.0 */
+int pa_info_filter_add_match(pa_info_filter *f, const char *key, const char *value);
+
+/** Return the generation the server was at when it answered the last
+ * query with this filter. The next query only lists what changed after
+ * it. \since 5.0 */
+uint64_t pa_info_filter_get_generation(const pa_info_filter *f);
+
+/** Only list what changed after the given generation. 0, the default,
+ * lists everything. \since 5.0 */
+void pa_info_filter_set_generation(pa_info_filter *f, uint64_t generation);
+
+/** Return non-zero if the last query listed all objects that match the
+ * filter, and not only what changed. \since 5.0 */
+int pa_info_filter_is_complete(const pa_info_filter *f);
+
+/** Return the indexes of the objects that were removed, or don't match
+ * anymore, since the query before the last one. The array stays valid
+ * until the next query with this filter finishes. \since 5.0 */
+const uint32_t* pa_info_filter_get_removed(const pa_info_filter *f, unsigned *n);
+
+/** Get the sinks that match the filter and changed since the last query. \since 5.0 */
+pa_operation* pa_context_get_sink_info_list_filtered(pa_context *c, pa_info_filter *f, pa_sink_info_cb_t cb, void *userdata);
+
+/** Get the sources that match the filter and changed since the last query. \since 5.0 */
+pa_operation* pa_context_get_source_info_list_filtered(pa_context *c, pa_info_filter *f, pa_source_info_cb_t cb, void *userdata);
+
+/** Get the modules that match the filter and changed since the last query. \since 5.0 */
+pa_operation* pa_context_get_module_info_list_filtered(pa_context *c, pa_info_filter *f, pa_module_info_cb_t cb, void *userdata);
+
+/** Get the clients that match the filter and changed since the last query. \since 5.0 */
+pa_operation* pa_context_get_client_info_list_filtered(pa_context *c, pa_info_filter *f, pa_client_info_cb_t cb, void *userdata);
+
+/** Get the cards that match the filter and changed since the last query. \since 5.0 */
+pa_operation* pa_context_get_card_info_list_filtered(pa_context *c, pa_info_filter *f, pa_card_info_cb_t cb, void *userdata);
+
+/** Get the sink inputs that match the filter and changed since the last query. \since 5.0 */
+pa_operation* pa_context_get_sink_input_info_list_filtered(pa_context *c, pa_info_filter *f, pa_sink_input_info_cb_t cb, void *userdata);
+
+/** Get the source outputs that match the filter and changed since the last query. \since 5.0 */
+pa_operation* pa_context_get_source_output_info_list_filtered(pa_context *c, pa_info_filter *f, pa_source_output_info_cb_t cb, void *userdata);
+
+/** Get the samples that match the filter and changed since the last query. \since 5.0 */
+pa_operation* pa_context_get_sample_info_list_filtered(pa_context *c, pa_info_filter *f, pa_sample_info_cb_t cb, void *userdata);
+
+/** @} */
+
 /** \cond fulldocs */
 
 /** @{ \name Autoload Entries */
@@ -57,7 +57,9 @@ struct pa_io_event {
 
     int fd;
     pa_io_event_flags_t events;
-    struct pollfd *pollfd;
+
+    /* Index into pollfds[], 0 while the event has no slot yet */
+    unsigned pollfd_idx;
 
     pa_io_event_cb_t callback;
     void *userdata;
@@ -74,6 +76,10 @@ struct pa_time_event {
     pa_bool_t use_rtclock:1;
     pa_usec_t time;
 
+    /* Index into time_heap[], only valid while enabled */
+    unsigned heap_idx;
+    unsigned dispatch_serial;
+
     pa_time_event_cb_t callback;
     void *userdata;
     pa_time_event_destroy_cb_t destroy_callback;
@@ -95,19 +101,32 @@ struct pa_defer_event {
 };
 
 struct pa_mainloop {
+    /* Freed io and time events are moved to the dead lists right away,
+     * so that cleaning them up doesn't need to walk all the others */
     PA_LLIST_HEAD(pa_io_event, io_events);
+    PA_LLIST_HEAD(pa_io_event, dead_io_events);
     PA_LLIST_HEAD(pa_time_event, time_events);
+    PA_LLIST_HEAD(pa_time_event, dead_time_events);
     PA_LLIST_HEAD(pa_defer_event, defer_events);
 
     unsigned n_enabled_defer_events, n_enabled_time_events, n_io_events;
     unsigned io_events_please_scan, time_events_please_scan, defer_events_please_scan;
 
+    /* New io events are prepended to io_events, so the first
+     * n_new_io_events entries are the ones without a pollfd slot */
+    unsigned n_new_io_events;
+
     pa_bool_t rebuild_pollfds:1;
     struct pollfd *pollfds;
+    pa_io_event **pollfd_events;
     unsigned max_pollfds, n_pollfds;
 
+    /* Binary min-heap of the enabled time events, ordered by time */
+    pa_time_event **time_heap;
+    unsigned max_time_heap;
+    unsigned time_dispatch_serial;
+
     pa_usec_t prepared_timeout;
-    pa_time_event *cached_next_time_event;
 
     pa_mainloop_api api;
 
@@ -178,6 +197,7 @@ static pa_io_event* mainloop_io_new(
     PA_LLIST_PREPEND(pa_io_event, m->io_events, e);
     m->rebuild_pollfds = TRUE;
     m->n_io_events ++;
+    m->n_new_io_events ++;
 
     pa_mainloop_wakeup(m);
 
@@ -193,23 +213,34 @@ static void mainloop_io_enable(pa_io_event *e, pa_io_event_flags_t events) {
 
     e->events = events;
 
-    if (e->pollfd)
-        e->pollfd->events = map_flags_to_libc(events);
-    else
-        e->mainloop->rebuild_pollfds = TRUE;
+    if (e->pollfd_idx > 0)
+        e->mainloop->pollfds[e->pollfd_idx].events = map_flags_to_libc(events);
 
     pa_mainloop_wakeup(e->mainloop);
 }
 
 static void mainloop_io_free(pa_io_event *e) {
+    pa_mainloop *m;
+
     pa_assert(e);
     pa_assert(!e->dead);
 
+    m = e->mainloop;
+
+    /* The pollfd slot is kept until the next prepare, since poll() or
+     * dispatching might be going on right now */
+    if (e->pollfd_idx == 0) {
+        pa_assert(m->n_new_io_events > 0);
+        m->n_new_io_events --;
+    }
+
+    PA_LLIST_REMOVE(pa_io_event, m->io_events, e);
+    PA_LLIST_PREPEND(pa_io_event, m->dead_io_events, e);
+
     e->dead = TRUE;
-    e->mainloop->io_events_please_scan ++;
+    m->io_events_please_scan ++;
 
-    e->mainloop->n_io_events --;
-    e->mainloop->rebuild_pollfds = TRUE;
+    m->n_io_events --;
 
     pa_mainloop_wakeup(e->mainloop);
 }
@@ -308,6 +339,81 @@ static pa_usec_t make_rt(const struct timeval *tv, pa_bool_t *use_rtclock) {
     return pa_timeval_load(&ttv);
 }
 
+static void time_heap_set(pa_mainloop *m, unsigned idx, pa_time_event *e) {
+    m->time_heap[idx] = e;
+    e->heap_idx = idx;
+}
+
+static void time_heap_sift_up(pa_mainloop *m, unsigned idx) {
+    pa_time_event *e = m->time_heap[idx];
+
+    while (idx > 0) {
+        unsigned parent = (idx - 1) / 2;
+
+        if (m->time_heap[parent]->time <= e->time)
+            break;
+
+        time_heap_set(m, idx, m->time_heap[parent]);
+        idx = parent;
+    }
+
+    time_heap_set(m, idx, e);
+}
+
+static void time_heap_sift_down(pa_mainloop *m, unsigned idx) {
+    pa_time_event *e = m->time_heap[idx];
+
+    for (;;) {
+        unsigned child = 2 * idx + 1;
+
+        if (child >= m->n_enabled_time_events)
+            break;
+
+        if (child + 1 < m->n_enabled_time_events &&
+            m->time_heap[child + 1]->time < m->time_heap[child]->time)
+            child++;
+
+        if (e->time <= m->time_heap[child]->time)
+            break;
+
+        time_heap_set(m, idx, m->time_heap[child]);
+        idx = child;
+    }
+
+    time_heap_set(m, idx, e);
+}
+
+static void time_heap_insert(pa_mainloop *m, pa_time_event *e) {
+
+    if (m->n_enabled_time_events >= m->max_time_heap) {
+        m->max_time_heap = PA_MAX(m->max_time_heap * 2, 16U);
+        m->time_heap = pa_xrenew(pa_time_event*, m->time_heap, m->max_time_heap);
+    }
+
+    time_heap_set(m, m->n_enabled_time_events++, e);
+    time_heap_sift_up(m, e->heap_idx);
+}
+
+static void time_heap_remove(pa_mainloop *m, pa_time_event *e) {
+    unsigned idx = e->heap_idx;
+
+    pa_assert(m->n_enabled_time_events > 0);
+    pa_assert(m->time_heap[idx] == e);
+
+    m->n_enabled_time_events--;
+
+    if (idx == m->n_enabled_time_events)
+        return;
+
+    /* Move the last entry into the hole and let it find its place */
+    time_heap_set(m, idx, m->time_heap[m->n_enabled_time_events]);
+
+    if (idx > 0 && m->time_heap[idx]->time < m->time_heap[(idx - 1) / 2]->time)
+        time_heap_sift_up(m, idx);
+    else
+        time_heap_sift_down(m, idx);
+}
+
 static pa_time_event* mainloop_time_new(
         pa_mainloop_api *a,
         const struct timeval *tv,
@@ -335,14 +441,7 @@ static pa_time_event* mainloop_time_new(
         e->time = t;
         e->use_rtclock = use_rtclock;
 
-        m->n_enabled_time_events++;
-
-        if (m->cached_next_time_event) {
-            pa_assert(m->cached_next_time_event->enabled);
-
-            if (t < m->cached_next_time_event->time)
-                m->cached_next_time_event = e;
-        }
+        time_heap_insert(m, e);
     }
 
     e->callback = callback;
@@ -368,41 +467,52 @@ static void mainloop_time_restart(pa_time_event *e, const struct timeval *tv) {
 
     valid = (t != PA_USEC_INVALID);
     if (e->enabled && !valid) {
-        pa_assert(e->mainloop->n_enabled_time_events > 0);
-        e->mainloop->n_enabled_time_events--;
-    } else if (!e->enabled && valid)
-        e->mainloop->n_enabled_time_events++;
+        time_heap_remove(e->mainloop, e);
+        e->enabled = FALSE;
+        return;
+    }
+
+    if (!valid)
+        return;
+
+    e->use_rtclock = use_rtclock;
+
+    if (e->enabled) {
+        pa_usec_t old = e->time;
 
-    if ((e->enabled = valid)) {
         e->time = t;
-        e->use_rtclock = use_rtclock;
-        pa_mainloop_wakeup(e->mainloop);
-    }
 
-    if (e->mainloop->cached_next_time_event && e->enabled) {
-        pa_assert(e->mainloop->cached_next_time_event->enabled);
+        if (t < old)
+            time_heap_sift_up(e->mainloop, e->heap_idx);
+        else
+            time_heap_sift_down(e->mainloop, e->heap_idx);
+    } else {
+        e->time = t;
+        e->enabled = TRUE;
+        time_heap_insert(e->mainloop, e);
+    }
 
-        if (t < e->mainloop->cached_next_time_event->time)
-            e->mainloop->cached_next_time_event = e;
-    } else if (e->mainloop->cached_next_time_event == e)
-        e->mainloop->cached_next_time_event = NULL;
+    pa_mainloop_wakeup(e->mainloop);
 }
 
 static void mainloop_time_free(pa_time_event *e) {
+    pa_mainloop *m;
+
     pa_assert(e);
     pa_assert(!e->dead);
 
-    e->dead = TRUE;
-    e->mainloop->time_events_please_scan ++;
+    m = e->mainloop;
 
     if (e->enabled) {
-        pa_assert(e->mainloop->n_enabled_time_events > 0);
-        e->mainloop->n_enabled_time_events--;
+        time_heap_remove(m, e);
         e->enabled = FALSE;
     }
 
-    if (e->mainloop->cached_next_time_event == e)
-        e->mainloop->cached_next_time_event = NULL;
+    PA_LLIST_REMOVE(pa_time_event, m->time_events, e);
+    PA_LLIST_PREPEND(pa_time_event, m->dead_time_events, e);
+
+    e->dead = TRUE;
+    m->time_events_please_scan ++;
 
     /* no wakeup needed here. Think about it! */
 }
@@ -476,63 +586,96 @@ pa_mainloop *pa_mainloop_new(void) {
     return m;
 }
 
-static void cleanup_io_events(pa_mainloop *m, pa_bool_t force) {
-    pa_io_event *e, *n;
+static void remove_pollfd(pa_mainloop *m, pa_io_event *e) {
+    unsigned last;
 
-    PA_LLIST_FOREACH_SAFE(e, n, m->io_events) {
+    if (e->pollfd_idx == 0)
+        return;
 
-        if (!force && m->io_events_please_scan <= 0)
-            break;
+    /* Fill the hole with the last slot */
+    last = m->n_pollfds - 1;
+    if (e->pollfd_idx != last) {
+        m->pollfds[e->pollfd_idx] = m->pollfds[last];
+        m->pollfd_events[e->pollfd_idx] = m->pollfd_events[last];
+        m->pollfd_events[e->pollfd_idx]->pollfd_idx = e->pollfd_idx;
+    }
 
-        if (force || e->dead) {
+    m->n_pollfds--;
+    e->pollfd_idx = 0;
+}
+
+static void free_io_event(pa_mainloop *m, pa_io_event *e) {
+    remove_pollfd(m, e);
+
+    if (e->destroy_callback)
+        e->destroy_callback(&m->api, e, e->userdata);
+
+    pa_xfree(e);
+}
+
+static void cleanup_io_events(pa_mainloop *m, pa_bool_t force) {
+    pa_io_event *e;
+
+    if (force) {
+        while ((e = m->io_events)) {
             PA_LLIST_REMOVE(pa_io_event, m->io_events, e);
 
-            if (e->dead) {
-                pa_assert(m->io_events_please_scan > 0);
-                m->io_events_please_scan--;
+            if (e->pollfd_idx == 0) {
+                pa_assert(m->n_new_io_events > 0);
+                m->n_new_io_events--;
             }
 
-            if (e->destroy_callback)
-                e->destroy_callback(&m->api, e, e->userdata);
-
-            pa_xfree(e);
+            pa_assert(m->n_io_events > 0);
+            m->n_io_events--;
 
-            m->rebuild_pollfds = TRUE;
+            free_io_event(m, e);
         }
     }
 
+    while ((e = m->dead_io_events)) {
+        PA_LLIST_REMOVE(pa_io_event, m->dead_io_events, e);
+
+        pa_assert(m->io_events_please_scan > 0);
+        m->io_events_please_scan--;
+
+        free_io_event(m, e);
+    }
+
     pa_assert(m->io_events_please_scan == 0);
 }
 
-static void cleanup_time_events(pa_mainloop *m, pa_bool_t force) {
-    pa_time_event *e, *n;
+static void free_time_event(pa_mainloop *m, pa_time_event *e) {
+    if (e->destroy_callback)
+        e->destroy_callback(&m->api, e, e->userdata);
 
-    PA_LLIST_FOREACH_SAFE(e, n, m->time_events) {
+    pa_xfree(e);
+}
 
-        if (!force && m->time_events_please_scan <= 0)
-            break;
+static void cleanup_time_events(pa_mainloop *m, pa_bool_t force) {
+    pa_time_event *e;
 
-        if (force || e->dead) {
+    if (force) {
+        while ((e = m->time_events)) {
             PA_LLIST_REMOVE(pa_time_event, m->time_events, e);
 
-            if (e->dead) {
-                pa_assert(m->time_events_please_scan > 0);
-                m->time_events_please_scan--;
-            }
-
-            if (!e->dead && e->enabled) {
-                pa_assert(m->n_enabled_time_events > 0);
-                m->n_enabled_time_events--;
+            if (e->enabled) {
+                time_heap_remove(m, e);
                 e->enabled = FALSE;
             }
 
-            if (e->destroy_callback)
-                e->destroy_callback(&m->api, e, e->userdata);
-
-            pa_xfree(e);
+            free_time_event(m, e);
         }
     }
 
+    while ((e = m->dead_time_events)) {
+        PA_LLIST_REMOVE(pa_time_event, m->dead_time_events, e);
+
+        pa_assert(m->time_events_please_scan > 0);
+        m->time_events_please_scan--;
+
+        free_time_event(m, e);
+    }
+
     pa_assert(m->time_events_please_scan == 0);
 }
 
@@ -577,6 +720,8 @@ void pa_mainloop_free(pa_mainloop *m) {
     cleanup_time_events(m, TRUE);
 
     pa_xfree(m->pollfds);
+    pa_xfree(m->pollfd_events);
+    pa_xfree(m->time_heap);
 
     pa_close_pipe(m->wakeup_pipe);
 
@@ -596,68 +741,84 @@ static void scan_dead(pa_mainloop *m) {
         cleanup_defer_events(m, FALSE);
 }
 
+/* Dead events have already given up their slots in cleanup_io_events(),
+ * so only the ones created since the last call need to be added */
 static void rebuild_pollfds(pa_mainloop *m) {
-    pa_io_event*e;
-    struct pollfd *p;
+    pa_io_event *e;
     unsigned l;
 
     l = m->n_io_events + 1;
     if (m->max_pollfds < l) {
         l *= 2;
-        m->pollfds = pa_xrealloc(m->pollfds, sizeof(struct pollfd)*l);
+        m->pollfds = pa_xrenew(struct pollfd, m->pollfds, l);
+        m->pollfd_events = pa_xrenew(pa_io_event*, m->pollfd_events, l);
         m->max_pollfds = l;
     }
 
-    m->n_pollfds = 0;
-    p = m->pollfds;
+    if (m->n_pollfds == 0) {
+        m->pollfds[0].fd = m->wakeup_pipe[0];
+        m->pollfds[0].events = POLLIN;
+        m->pollfds[0].revents = 0;
+        m->pollfd_events[0] = NULL;
+        m->n_pollfds++;
+    }
+
+    for (e = m->io_events; m->n_new_io_events > 0; e = e->next, m->n_new_io_events--) {
+        struct pollfd *p;
 
-    m->pollfds[0].fd = m->wakeup_pipe[0];
-    m->pollfds[0].events = POLLIN;
-    m->pollfds[0].revents = 0;
-    p++;
-    m->n_pollfds++;
+        pa_assert(e);
+        pa_assert(!e->dead);
+        pa_assert(e->pollfd_idx == 0);
 
-    PA_LLIST_FOREACH(e, m->io_events) {
-        if (e->dead) {
-            e->pollfd = NULL;
-            continue;
-        }
+        e->pollfd_idx = m->n_pollfds++;
+        m->pollfd_events[e->pollfd_idx] = e;
 
-        e->pollfd = p;
+        p = &m->pollfds[e->pollfd_idx];
         p->fd = e->fd;
         p->events = map_flags_to_libc(e->events);
         p->revents = 0;
-
-        p++;
-        m->n_pollfds++;
     }
 
+    pa_assert(m->n_pollfds == m->n_io_events + 1);
+
     m->rebuild_pollfds = FALSE;
 }
 
 static unsigned dispatch_pollfds(pa_mainloop *m) {
-    pa_io_event *e;
-    unsigned r = 0, k;
+    unsigned r = 0, k, i;
 
     pa_assert(m->poll_func_ret > 0);
 
     k = m->poll_func_ret;
 
-    PA_LLIST_FOREACH(e, m->io_events) {
+    /* Slot 0 is the wakeup pipe, which is drained in prepare */
+    if (m->pollfds[0].revents)
+        k--;
+
+    for (i = 1; i < m->n_pollfds; i++) {
+        pa_io_event *e;
+        short revents;
 
         if (k <= 0 || m->quit)
             break;
 
-        if (e->dead || !e->pollfd || !e->pollfd->revents)
+        if (!(revents = m->pollfds[i].revents))
             continue;
 
-        pa_assert(e->pollfd->fd == e->fd);
+        m->pollfds[i].revents = 0;
+        k--;
+
+        e = m->pollfd_events[i];
+
+        /* Freed events keep their slot until the next prepare */
+        if (e->dead)
+            continue;
+
+        pa_assert(m->pollfds[i].fd == e->fd);
         pa_assert(e->callback);
 
-        e->callback(&m->api, e, e->fd, map_flags_from_libc(e->pollfd->revents), e->userdata);
-        e->pollfd->revents = 0;
+        e->callback(&m->api, e, e->fd, map_flags_from_libc(revents), e->userdata);
         r++;
-        k--;
     }
 
     return r;
@@ -686,31 +847,6 @@ static unsigned dispatch_defer(pa_mainloop *m) {
     return r;
 }
 
-static pa_time_event* find_next_time_event(pa_mainloop *m) {
-    pa_time_event *t, *n = NULL;
-    pa_assert(m);
-
-    if (m->cached_next_time_event)
-        return m->cached_next_time_event;
-
-    PA_LLIST_FOREACH(t, m->time_events) {
-
-        if (t->dead || !t->enabled)
-            continue;
-
-        if (!n || t->time < n->time) {
-            n = t;
-
-            /* Shortcut for time == 0 */
-            if (n->time == 0)
-                break;
-        }
-    }
-
-    m->cached_next_time_event = n;
-    return n;
-}
-
 static pa_usec_t calc_next_timeout(pa_mainloop *m) {
     pa_time_event *t;
     pa_usec_t clock_now;
@@ -718,7 +854,7 @@ static pa_usec_t calc_next_timeout(pa_mainloop *m) {
     if (m->n_enabled_time_events <= 0)
         return PA_USEC_INVALID;
 
-    pa_assert_se(t = find_next_time_event(m));
+    t = m->time_heap[0];
 
     if (t->time <= 0)
         return 0;
@@ -742,25 +878,29 @@ static unsigned dispatch_timeout(pa_mainloop *m) {
 
     now = pa_rtclock_now();
 
-    PA_LLIST_FOREACH(e, m->time_events) {
+    /* Every event fires at most once per iteration, even if its
+     * callback restarts it with a time that has already passed. If
+     * that happens, the remaining elapsed events are dispatched in the
+     * next iteration, which won't block. */
+    m->time_dispatch_serial++;
 
-        if (m->quit)
-            break;
+    while (m->n_enabled_time_events > 0 && !m->quit) {
+        struct timeval tv;
 
-        if (e->dead || !e->enabled)
-            continue;
+        e = m->time_heap[0];
 
-        if (e->time <= now) {
-            struct timeval tv;
-            pa_assert(e->callback);
+        if (e->time > now || e->dispatch_serial == m->time_dispatch_serial)
+            break;
 
-            /* Disable time event */
-            mainloop_time_restart(e, NULL);
+        pa_assert(e->callback);
+        e->dispatch_serial = m->time_dispatch_serial;
 
-            e->callback(&m->api, e, pa_timeval_rtstore(&tv, e->time, e->use_rtclock), e->userdata);
+        /* Disable time event */
+        mainloop_time_restart(e, NULL);
 
-            r++;
-        }
+        e->callback(&m->api, e, pa_timeval_rtstore(&tv, e->time, e->use_rtclock), e->userdata);
+
+        r++;
     }
 
     return r;
@@ -173,6 +173,7 @@ static pa_stream *pa_stream_new_with_proplist_internal(
 
     s->write_memblock = NULL;
     s->write_data = NULL;
+    pa_atomic_ptr_store(&s->ring, NULL);
 
     pa_memchunk_reset(&s->peek_memchunk);
     s->peek_data = NULL;
@@ -279,6 +280,7 @@ static void stream_unlink(pa_stream *s) {
 }
 
 static void stream_free(pa_stream *s) {
+    pa_shmring *ring;
     unsigned int i;
 
     pa_assert(s);
@@ -291,6 +293,9 @@ static void stream_free(pa_stream *s) {
         pa_memblock_unref(s->write_memblock);
     }
 
+    if ((ring = pa_atomic_ptr_load(&s->ring)))
+        pa_shmring_free(ring);
+
     if (s->peek_memchunk.memblock) {
         if (s->peek_data)
             pa_memblock_release(s->peek_memchunk.memblock);
@@ -838,6 +843,19 @@ void pa_command_request(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tag
     if (s->state != PA_STREAM_READY)
         goto finish;
 
+    if (pa_atomic_ptr_load(&s->ring)) {
+        size_t l;
+
+        /* Nothing is written with pa_stream_write() any more, so the
+         * requests would only add up. What counts is the ring. */
+        s->requested_bytes = 0;
+
+        if ((l = pa_stream_ring_writable_size(s)) > 0 && s->write_callback)
+            s->write_callback(s, l, s->write_userdata);
+
+        goto finish;
+    }
+
     s->requested_bytes += bytes;
 
 #ifdef STREAM_DEBUG
@@ -1421,6 +1439,7 @@ int pa_stream_begin_write(
     PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
     PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || s->direction == PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, !pa_atomic_ptr_load(&s->ring), PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY(s->context, data, PA_ERR_INVALID);
     PA_CHECK_VALIDITY(s->context, nbytes && *nbytes != 0, PA_ERR_INVALID);
 
@@ -1482,6 +1501,7 @@ int pa_stream_write(
     PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
     PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || s->direction == PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, !pa_atomic_ptr_load(&s->ring), PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY(s->context, seek <= PA_SEEK_RELATIVE_END, PA_ERR_INVALID);
     PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || (seek == PA_SEEK_RELATIVE && offset == 0), PA_ERR_INVALID);
     PA_CHECK_VALIDITY(s->context,
@@ -1664,6 +1684,9 @@ size_t pa_stream_writable_size(pa_stream *s) {
     PA_CHECK_VALIDITY_RETURN_ANY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE, (size_t) -1);
     PA_CHECK_VALIDITY_RETURN_ANY(s->context, s->direction != PA_STREAM_RECORD, PA_ERR_BADSTATE, (size_t) -1);
 
+    if (pa_atomic_ptr_load(&s->ring))
+        return pa_stream_ring_writable_size(s);
+
     return s->requested_bytes > 0 ? (size_t) s->requested_bytes : 0;
 }
 
@@ -1774,6 +1797,7 @@ static void stream_get_timing_info_callback(pa_pdispatch *pd, uint32_t command,
     pa_operation *o = userdata;
     struct timeval local, remote, now;
     pa_timing_info *i;
+    pa_shmring *ring;
     pa_bool_t playing = FALSE;
     uint64_t underrun_for = 0, playing_for = 0;
 
@@ -1899,6 +1923,11 @@ static void stream_get_timing_info_callback(pa_pdispatch *pd, uint32_t command,
                 if (o->stream->write_index_corrections[n].tag <= tag)
                     o->stream->write_index_corrections[n].valid = FALSE;
             }
+
+            /* What is still in the ring was written, but the server
+             * didn't count it yet */
+            if ((ring = pa_atomic_ptr_load(&o->stream->ring)) && !i->write_index_corrupt)
+                i->write_index += (int64_t) pa_shmring_readable(ring);
         }
 
         if (o->stream->direction == PA_STREAM_RECORD) {
@@ -2906,3 +2935,135 @@ uint32_t pa_stream_get_monitor_stream(pa_stream *s) {
 
     return s->direct_on_input;
 }
+
+static void stream_enable_ring_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    int success = 1;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    if (!o->context || !o->stream)
+        goto finish;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, FALSE) < 0)
+            goto finish;
+
+        success = 0;
+    } else {
+        uint32_t shm_id, capacity;
+        const int *fds;
+        int nfd;
+        pa_shmring *ring;
+
+        if (pa_tagstruct_getu32(t, &shm_id) < 0 ||
+            pa_tagstruct_getu32(t, &capacity) < 0 ||
+            !pa_tagstruct_eof(t)) {
+            pa_context_fail(o->context, PA_ERR_PROTOCOL);
+            goto finish;
+        }
+
+        fds = pa_pdispatch_fds(pd, &nfd);
+
+        if (capacity <= 0 || capacity > PA_STREAM_RING_SIZE_MAX ||
+            capacity % pa_frame_size(&o->stream->sample_spec) != 0 ||
+            (fds && nfd != 1)) {
+            pa_context_fail(o->context, PA_ERR_PROTOCOL);
+            goto finish;
+        }
+
+        if (!(ring = pa_shmring_attach(fds ? PA_MEM_TYPE_SHARED_MEMFD : PA_MEM_TYPE_SHARED_POSIX, shm_id, fds ? fds[0] : -1)))
+            success = 0;
+        else if (pa_shmring_get_capacity(ring) != capacity) {
+            pa_shmring_free(ring);
+            pa_context_fail(o->context, PA_ERR_PROTOCOL);
+            goto finish;
+        } else if (pa_atomic_ptr_load(&o->stream->ring))
+            /* Somebody asked twice, and the server didn't mind */
+            pa_shmring_free(ring);
+        else {
+            /* Publishes the ring to the writing threads. The store has a
+             * full barrier, so they never see a ring that isn't set up. */
+            pa_atomic_ptr_store(&o->stream->ring, ring);
+            o->stream->requested_bytes = 0;
+        }
+
+        if (!success)
+            pa_context_set_error(o->context, PA_ERR_INTERNAL);
+    }
+
+    if (o->callback) {
+        pa_stream_success_cb_t cb = (pa_stream_success_cb_t) o->callback;
+        cb(o->stream, success, o->userdata);
+    }
+
+finish:
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
+
+pa_operation *pa_stream_enable_ring(pa_stream *s, pa_stream_success_cb_t cb, void *userdata) {
+    pa_operation *o;
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(s->context, s->direction == PA_STREAM_PLAYBACK, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(s->context, !pa_atomic_ptr_load(&s->ring) && !s->write_memblock, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(s->context, s->context->version >= 33, PA_ERR_NOTSUPPORTED);
+    PA_CHECK_VALIDITY_RETURN_NULL(s->context, s->context->do_shm, PA_ERR_NOTSUPPORTED);
+
+    o = pa_operation_new(s->context, s, (pa_operation_cb_t) cb, userdata);
+
+    t = pa_tagstruct_command(s->context, PA_COMMAND_ENABLE_STREAM_RING, &tag);
+    pa_tagstruct_putu32(t, s->channel);
+
+    pa_pstream_send_tagstruct(s->context->pstream, t);
+    pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, stream_enable_ring_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
+
+/* Neither of these two touches the context, so that they can be called
+ * from other threads than the one running the main loop */
+
+size_t pa_stream_ring_writable_size(pa_stream *s) {
+    pa_shmring *ring;
+    size_t fs;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    if (!(ring = pa_atomic_ptr_load(&s->ring)))
+        return (size_t) -1;
+
+    fs = pa_frame_size(&s->sample_spec);
+    return (pa_shmring_writable(ring) / fs) * fs;
+}
+
+size_t pa_stream_ring_write(pa_stream *s, const void *data, size_t nbytes) {
+    pa_shmring *ring;
+    size_t fs, l;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(data || nbytes == 0);
+
+    if (!(ring = pa_atomic_ptr_load(&s->ring)))
+        return (size_t) -1;
+
+    fs = pa_frame_size(&s->sample_spec);
+    l = PA_MIN(nbytes, pa_shmring_writable(ring));
+    l = (l / fs) * fs;
+
+    if (l <= 0)
+        return 0;
+
+    return pa_shmring_write(ring, data, l);
+}
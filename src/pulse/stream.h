@@ -790,6 +790,34 @@ int pa_stream_set_monitor_stream(pa_stream *s, uint32_t sink_input_idx);
  * \since 0.9.11 */
 uint32_t pa_stream_get_monitor_stream(pa_stream *s);
 
+/** For playback streams: ask the server to take the data of this
+ * stream from a ring buffer in shared memory from now on, instead of
+ * from pa_stream_write(). Writing to the ring with
+ * pa_stream_ring_write() involves neither the main loop nor the
+ * server, and doesn't allocate memory, so it can be done from a real
+ * time thread without taking the main loop lock. The server takes
+ * data from the ring only when it needs some, so whatever waits in the
+ * ring adds to the latency, like data in the server side buffer does.
+ * The ring holds at most tlength bytes. Write and underflow callbacks
+ * keep being called, the write callback is passed the free space in
+ * the ring then. pa_stream_write() and pa_stream_begin_write()
+ * fail with PA_ERR_BADSTATE once the ring is enabled. Only available
+ * if SHM is in use. \since 5.0 */
+pa_operation *pa_stream_enable_ring(pa_stream *s, pa_stream_success_cb_t cb, void *userdata);
+
+/** Return how many bytes can be written to the ring of a playback
+ * stream right now, always a multiple of the frame size. Returns
+ * (size_t) -1 if the ring is not enabled. Safe to call from any thread
+ * while the stream exists. \since 5.0 */
+size_t pa_stream_ring_writable_size(pa_stream *s);
+
+/** Write whole frames to the ring of a playback stream, as many as
+ * fit. Returns the number of bytes written, which is less than nbytes
+ * if the ring is full, or (size_t) -1 if the ring is not enabled. The
+ * data is copied right away. Safe to call from any thread while the
+ * stream exists, but only from one at a time. \since 5.0 */
+size_t pa_stream_ring_write(pa_stream *s, const void *data, size_t nbytes);
+
 PA_C_DECL_END
 
 #endif
@@ -25,6 +25,8 @@
 
 #include <stdio.h>
 
+#include <pulse/xmalloc.h>
+
 #include <pulsecore/macro.h>
 #include <pulsecore/pstream-util.h>
 
@@ -58,7 +60,52 @@ finish:
     pa_context_unref(c);
 }
 
-pa_operation* pa_context_subscribe(pa_context *c, pa_subscription_mask_t m, pa_context_success_cb_t cb, void *userdata) {
+void pa_command_subscribe_event_batch(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_context *c = userdata;
+    pa_subscription_event_info *events = NULL;
+    uint32_t n, k;
+
+    pa_assert(pd);
+    pa_assert(command == PA_COMMAND_SUBSCRIBE_EVENT_BATCH);
+    pa_assert(t);
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    pa_context_ref(c);
+
+    if (pa_tagstruct_getu32(t, &n) < 0 ||
+        n > PA_SUBSCRIBE_BATCH_EVENTS_MAX)
+        goto fail;
+
+    events = pa_xnew(pa_subscription_event_info, PA_MAX(n, 1U));
+
+    for (k = 0; k < n; k++)
+        if (pa_tagstruct_getu32(t, &events[k].type) < 0 ||
+            pa_tagstruct_getu32(t, &events[k].index) < 0)
+            goto fail;
+
+    if (!pa_tagstruct_eof(t))
+        goto fail;
+
+    if (c->subscribe_batch_callback)
+        c->subscribe_batch_callback(c, events, n, c->subscribe_batch_userdata);
+    else
+        /* The callback might disconnect us, so check the state every
+         * time */
+        for (k = 0; k < n && c->subscribe_callback && c->state == PA_CONTEXT_READY; k++)
+            c->subscribe_callback(c, events[k].type, events[k].index, c->subscribe_userdata);
+
+    goto finish;
+
+fail:
+    pa_context_fail(c, PA_ERR_PROTOCOL);
+
+finish:
+    pa_xfree(events);
+    pa_context_unref(c);
+}
+
+static pa_operation* context_subscribe(pa_context *c, uint32_t command, pa_subscription_mask_t m, pa_usec_t max_delay, pa_context_success_cb_t cb, void *userdata) {
     pa_operation *o;
     pa_tagstruct *t;
     uint32_t tag;
@@ -70,14 +117,33 @@ pa_operation* pa_context_subscribe(pa_context *c, pa_subscription_mask_t m, pa_c
 
     o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
 
-    t = pa_tagstruct_command(c, PA_COMMAND_SUBSCRIBE, &tag);
+    t = pa_tagstruct_command(c, command, &tag);
     pa_tagstruct_putu32(t, m);
+
+    if (command == PA_COMMAND_SUBSCRIBE_BATCHED)
+        pa_tagstruct_put_usec(t, max_delay);
+
     pa_pstream_send_tagstruct(c->pstream, t);
     pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, pa_context_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
 
     return o;
 }
 
+pa_operation* pa_context_subscribe(pa_context *c, pa_subscription_mask_t m, pa_context_success_cb_t cb, void *userdata) {
+    return context_subscribe(c, PA_COMMAND_SUBSCRIBE, m, 0, cb, userdata);
+}
+
+pa_operation* pa_context_subscribe_batched(pa_context *c, pa_subscription_mask_t m, pa_usec_t max_delay, pa_context_success_cb_t cb, void *userdata) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 32, PA_ERR_NOTSUPPORTED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, max_delay <= PA_SUBSCRIBE_BATCH_DELAY_MAX, PA_ERR_INVALID);
+
+    return context_subscribe(c, PA_COMMAND_SUBSCRIBE_BATCHED, m, max_delay, cb, userdata);
+}
+
 void pa_context_set_subscribe_callback(pa_context *c, pa_context_subscribe_cb_t cb, void *userdata) {
     pa_assert(c);
     pa_assert(PA_REFCNT_VALUE(c) >= 1);
@@ -88,3 +154,14 @@ void pa_context_set_subscribe_callback(pa_context *c, pa_context_subscribe_cb_t
     c->subscribe_callback = cb;
     c->subscribe_userdata = userdata;
 }
+
+void pa_context_set_subscribe_batch_callback(pa_context *c, pa_context_subscribe_batch_cb_t cb, void *userdata) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    if (c->state == PA_CONTEXT_TERMINATED || c->state == PA_CONTEXT_FAILED)
+        return;
+
+    c->subscribe_batch_callback = cb;
+    c->subscribe_batch_userdata = userdata;
+}
@@ -62,6 +62,18 @@ void my_subscription_callback(pa_context *c, pa_subscription_event_type_t t,
     }
 }
 @endverbatim
+ *
+ * \section batch_sec Batched Events
+ *
+ * Clients that monitor a busy server, for example while a stream's volume
+ * is being ramped, can use pa_context_subscribe_batched() instead. The
+ * server then holds the events back for up to the given delay and sends
+ * them together to the function set with
+ * pa_context_set_subscribe_batch_callback(). A batch has at most one
+ * event per object: an object that was created and changed is only
+ * reported as new, and an object that was created and removed again is
+ * not reported at all. If no batch callback is set, the events of a batch
+ * are passed to the ordinary subscription callback one by one.
  */
 
 /** \file
@@ -75,12 +87,32 @@ PA_C_DECL_BEGIN
 /** Subscription event callback prototype */
 typedef void (*pa_context_subscribe_cb_t)(pa_context *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata);
 
+/** An event in a batch. \since 5.0 */
+typedef struct pa_subscription_event_info {
+    pa_subscription_event_type_t type; /**< Facility and type of the event */
+    uint32_t index;                    /**< Index of the object */
+} pa_subscription_event_info;
+
+/** Batched subscription event callback prototype. \since 5.0 */
+typedef void (*pa_context_subscribe_batch_cb_t)(pa_context *c, const pa_subscription_event_info *events, unsigned n, void *userdata);
+
 /** Enable event notification */
 pa_operation* pa_context_subscribe(pa_context *c, pa_subscription_mask_t m, pa_context_success_cb_t cb, void *userdata);
 
+/** Enable event notification in batches. The server sends the events
+ * at the latest max_delay after the first of them, which may be at most
+ * one second. A delay of 0 still coalesces the events of one main loop
+ * iteration of the server. Replaces what pa_context_subscribe() asked
+ * for. \since 5.0 */
+pa_operation* pa_context_subscribe_batched(pa_context *c, pa_subscription_mask_t m, pa_usec_t max_delay, pa_context_success_cb_t cb, void *userdata);
+
 /** Set the context specific call back function that is called whenever the state of the daemon changes */
 void pa_context_set_subscribe_callback(pa_context *c, pa_context_subscribe_cb_t cb, void *userdata);
 
+/** Set the context specific call back function that is called with the
+ * events of pa_context_subscribe_batched(). \since 5.0 */
+void pa_context_set_subscribe_batch_callback(pa_context *c, pa_context_subscribe_batch_cb_t cb, void *userdata);
+
 PA_C_DECL_END
 
 #endif
@@ -404,6 +404,13 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_b
                          (unsigned) pa_atomic_load(&mstat->n_allocated_by_type[k]),
                          (unsigned) pa_atomic_load(&mstat->n_accumulated_by_type[k]));
 
+    for (k = 0; k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++)
+        pa_strbuf_printf(buf,
+                         "Memory pool slots of size %s: %u used/%u allocated.\n",
+                         pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_mempool_slot_class_size(c->mempool, k)),
+                         (unsigned) pa_atomic_load(&mstat->n_used_slots_by_class[k]),
+                         (unsigned) pa_atomic_load(&mstat->n_slots_by_class[k]));
+
     return 0;
 }
 
@@ -0,0 +1,275 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <fftw3.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/macro.h>
+
+#include "convolver.h"
+
+/* Method of operation: for block k of block_size frames, input i is
+ * transformed together with the preceding block, giving X_k[i]. The
+ * impulse response from i to output o is cut into n_partitions
+ * pieces H_p[i][o] of block_size taps, each zero padded to fft_size
+ * and transformed once in pa_convolver_set_filter(). Output block k
+ * is then the second half of
+ *
+ *     IFFT(sum_i sum_p X_{k-p}[i] * H_p[i][o])
+ *
+ * The spectra of the last n_partitions blocks of each input are kept
+ * in a ring (the "frequency domain delay line"). The terms for p >= 1
+ * only depend on complete blocks, so they are summed up once per
+ * block into tail[o]. The p = 0 term is recomputed on every call from
+ * the partially filled current block, with the frames not yet seen
+ * set to zero. Since the filter is causal, the output frames we hand
+ * out only depend on frames we have already seen, so no latency is
+ * added. */
+
+struct pa_convolver {
+    unsigned block_size, fft_size, history_stride;
+    unsigned n_bins, bin_stride;
+    unsigned n_taps, n_partitions, n_inputs, n_outputs;
+
+    /* Frames of the current block we have seen so far, and the
+     * delay line slot the current block is transformed into */
+    unsigned pos, slot;
+
+    /* Per input: the previous and the current block */
+    float *history;
+
+    /* fft_size real samples */
+    float *work;
+
+    /* n_bins complex values */
+    fftwf_complex *acc;
+
+    /* [input][partition][output] spectra of the impulse responses,
+     * already scaled by 1/fft_size */
+    fftwf_complex *filters;
+
+    /* [input][slot] spectra of the last n_partitions input blocks */
+    fftwf_complex *fdl;
+
+    /* [output] sum of the terms for all complete blocks */
+    fftwf_complex *tail;
+
+    fftwf_plan forward_plan, inverse_plan;
+};
+
+static inline fftwf_complex *filter_spectrum(pa_convolver *c, unsigned input, unsigned partition, unsigned output) {
+    return c->filters + ((input * c->n_partitions + partition) * c->n_outputs + output) * c->bin_stride;
+}
+
+static inline fftwf_complex *fdl_spectrum(pa_convolver *c, unsigned input, unsigned slot) {
+    return c->fdl + (input * c->n_partitions + slot) * c->bin_stride;
+}
+
+static void *alloc(size_t n, size_t size) {
+    void *p;
+
+    pa_assert_se(p = fftwf_malloc(n * size));
+    memset(p, 0, n * size);
+
+    return p;
+}
+
+pa_convolver *pa_convolver_new(unsigned block_size, unsigned n_taps, unsigned n_inputs, unsigned n_outputs) {
+    pa_convolver *c;
+
+    pa_assert(block_size > 0);
+    pa_assert(n_taps > 0);
+    pa_assert(n_inputs > 0);
+    pa_assert(n_outputs > 0);
+
+    c = pa_xnew0(pa_convolver, 1);
+
+    c->block_size = block_size;
+    c->fft_size = 2 * block_size;
+    c->n_bins = block_size + 1;
+
+    /* Keep every spectrum aligned the same way as the ones the plans
+     * were created for, so that we can use the new-array execute
+     * functions on all of them */
+    c->bin_stride = PA_ROUND_UP(c->n_bins, 4);
+    c->history_stride = PA_ROUND_UP(c->fft_size, 8);
+
+    c->n_taps = n_taps;
+    c->n_partitions = (n_taps + block_size - 1) / block_size;
+    c->n_inputs = n_inputs;
+    c->n_outputs = n_outputs;
+
+    c->history = alloc(c->history_stride * n_inputs, sizeof(float));
+    c->work = alloc(c->fft_size, sizeof(float));
+    c->acc = alloc(c->bin_stride, sizeof(fftwf_complex));
+    c->filters = alloc(c->bin_stride * n_inputs * c->n_partitions * n_outputs, sizeof(fftwf_complex));
+    c->fdl = alloc(c->bin_stride * n_inputs * c->n_partitions, sizeof(fftwf_complex));
+    c->tail = alloc(c->bin_stride * n_outputs, sizeof(fftwf_complex));
+
+    c->forward_plan = fftwf_plan_dft_r2c_1d(c->fft_size, c->work, c->acc, FFTW_ESTIMATE);
+    c->inverse_plan = fftwf_plan_dft_c2r_1d(c->fft_size, c->acc, c->work, FFTW_ESTIMATE);
+
+    pa_assert(c->forward_plan);
+    pa_assert(c->inverse_plan);
+
+    return c;
+}
+
+void pa_convolver_free(pa_convolver *c) {
+    pa_assert(c);
+
+    fftwf_destroy_plan(c->inverse_plan);
+    fftwf_destroy_plan(c->forward_plan);
+
+    fftwf_free(c->tail);
+    fftwf_free(c->fdl);
+    fftwf_free(c->filters);
+    fftwf_free(c->acc);
+    fftwf_free(c->work);
+    fftwf_free(c->history);
+
+    pa_xfree(c);
+}
+
+void pa_convolver_set_filter(pa_convolver *c, unsigned input, unsigned output, const float *ir, unsigned stride) {
+    unsigned p, j;
+    float scale;
+
+    pa_assert(c);
+    pa_assert(input < c->n_inputs);
+    pa_assert(output < c->n_outputs);
+    pa_assert(ir);
+    pa_assert(stride > 0);
+
+    /* Fold the normalization of the inverse transform into the filter */
+    scale = 1.0f / (float) c->fft_size;
+
+    for (p = 0; p < c->n_partitions; p++) {
+        fftwf_complex *h = filter_spectrum(c, input, p, output);
+
+        memset(c->work, 0, c->fft_size * sizeof(float));
+
+        /* The last partition may be shorter than block_size */
+        for (j = 0; j < c->block_size && p * c->block_size + j < c->n_taps; j++)
+            c->work[j] = ir[(p * c->block_size + j) * stride] * scale;
+
+        fftwf_execute_dft_r2c(c->forward_plan, c->work, h);
+    }
+}
+
+void pa_convolver_reset(pa_convolver *c) {
+    pa_assert(c);
+
+    memset(c->history, 0, c->history_stride * c->n_inputs * sizeof(float));
+    memset(c->fdl, 0, c->bin_stride * c->n_inputs * c->n_partitions * sizeof(fftwf_complex));
+    memset(c->tail, 0, c->bin_stride * c->n_outputs * sizeof(fftwf_complex));
+
+    c->pos = 0;
+    c->slot = 0;
+}
+
+/* dst += a * b */
+static void complex_mac(fftwf_complex * restrict dst, const fftwf_complex * restrict a, const fftwf_complex * restrict b, unsigned n) {
+    unsigned j;
+
+    for (j = 0; j < n; j++) {
+        dst[j][0] += a[j][0] * b[j][0] - a[j][1] * b[j][1];
+        dst[j][1] += a[j][0] * b[j][1] + a[j][1] * b[j][0];
+    }
+}
+
+/* Sum up the contributions of all complete blocks to the block that
+ * is about to start */
+static void update_tail(pa_convolver *c) {
+    unsigned i, o, p;
+
+    memset(c->tail, 0, c->bin_stride * c->n_outputs * sizeof(fftwf_complex));
+
+    for (p = 1; p < c->n_partitions; p++) {
+        unsigned slot = (c->slot + c->n_partitions - p) % c->n_partitions;
+
+        for (i = 0; i < c->n_inputs; i++) {
+            const fftwf_complex *x = fdl_spectrum(c, i, slot);
+
+            for (o = 0; o < c->n_outputs; o++)
+                complex_mac(c->tail + o * c->bin_stride, x, filter_spectrum(c, i, p, o), c->n_bins);
+        }
+    }
+}
+
+void pa_convolver_process(pa_convolver *c, const float *src, float *dst, unsigned n) {
+    pa_assert(c);
+    pa_assert(src);
+    pa_assert(dst);
+
+    while (n > 0) {
+        unsigned i, o, j, m;
+
+        m = PA_MIN(n, c->block_size - c->pos);
+
+        for (i = 0; i < c->n_inputs; i++) {
+            float *h = c->history + i * c->history_stride;
+
+            for (j = 0; j < m; j++)
+                h[c->block_size + c->pos + j] = src[j * c->n_inputs + i];
+
+            /* The part of the current block we haven't seen yet is
+             * still zero */
+            fftwf_execute_dft_r2c(c->forward_plan, h, fdl_spectrum(c, i, c->slot));
+        }
+
+        for (o = 0; o < c->n_outputs; o++) {
+            memcpy(c->acc, c->tail + o * c->bin_stride, c->n_bins * sizeof(fftwf_complex));
+
+            for (i = 0; i < c->n_inputs; i++)
+                complex_mac(c->acc, fdl_spectrum(c, i, c->slot), filter_spectrum(c, i, 0, o), c->n_bins);
+
+            fftwf_execute_dft_c2r(c->inverse_plan, c->acc, c->work);
+
+            for (j = 0; j < m; j++)
+                dst[j * c->n_outputs + o] = c->work[c->block_size + c->pos + j];
+        }
+
+        src += m * c->n_inputs;
+        dst += m * c->n_outputs;
+        n -= m;
+
+        c->pos += m;
+
+        if (c->pos >= c->block_size) {
+            for (i = 0; i < c->n_inputs; i++) {
+                float *h = c->history + i * c->history_stride;
+
+                memcpy(h, h + c->block_size, c->block_size * sizeof(float));
+                memset(h + c->block_size, 0, c->block_size * sizeof(float));
+            }
+
+            c->pos = 0;
+            c->slot = (c->slot + 1) % c->n_partitions;
+
+            update_tail(c);
+        }
+    }
+}
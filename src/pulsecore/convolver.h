@@ -0,0 +1,59 @@
+#ifndef fooconvolverhfoo
+#define fooconvolverhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* A multichannel FIR convolution engine using uniformly partitioned
+ * overlap-save in the frequency domain. Each of the n_outputs output
+ * channels is the sum of the n_inputs input channels, each convolved
+ * with its own impulse response of up to n_taps taps.
+ *
+ * The impulse responses are split into partitions of block_size
+ * taps. Per block of input, the cost is one FFT per input and one
+ * inverse FFT per output plus one complex multiply-add per partition
+ * and input/output pair, instead of n_taps multiply-adds per frame
+ * and pair for direct convolution.
+ *
+ * The convolver adds no latency: pa_convolver_process() may be called
+ * with any number of frames and produces exactly as many output
+ * frames. Calls that do not end on a block boundary cost an extra
+ * transform of the partial block, so callers should prefer to feed
+ * multiples of block_size frames.
+ *
+ * Only available when PulseAudio is built with FFTW. */
+
+typedef struct pa_convolver pa_convolver;
+
+pa_convolver *pa_convolver_new(unsigned block_size, unsigned n_taps, unsigned n_inputs, unsigned n_outputs);
+void pa_convolver_free(pa_convolver *c);
+
+/* Set the impulse response used from input to output. The n_taps
+ * coefficients are read from ir, stride floats apart. Impulse
+ * responses that are never set are zero. */
+void pa_convolver_set_filter(pa_convolver *c, unsigned input, unsigned output, const float *ir, unsigned stride);
+
+/* Forget all input history, e.g. after a rewind */
+void pa_convolver_reset(pa_convolver *c);
+
+/* Convolve n frames of interleaved float samples with n_inputs
+ * channels from src into n frames with n_outputs channels in dst. */
+void pa_convolver_process(pa_convolver *c, const float *src, float *dst, unsigned n);
+
+#endif
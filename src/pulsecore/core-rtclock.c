@@ -232,6 +232,17 @@ struct timespec* pa_timespec_store(struct timespec *ts, pa_usec_t v) {
 }
 #endif
 
+pa_usec_t pa_thread_cpu_now(void) {
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return pa_timespec_load(&ts);
+#endif
+
+    return 0;
+}
+
 static struct timeval* wallclock_from_rtclock(struct timeval *tv) {
     struct timeval wc_now, rt_now;
 
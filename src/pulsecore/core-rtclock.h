@@ -50,4 +50,8 @@ struct timespec* pa_timespec_store(struct timespec *ts, pa_usec_t v);
 
 struct timeval* pa_timeval_rtstore(struct timeval *tv, pa_usec_t v, pa_bool_t rtclock);
 
+/* CPU time the calling thread has used so far, or 0 if the system
+ * can't tell */
+pa_usec_t pa_thread_cpu_now(void);
+
 #endif
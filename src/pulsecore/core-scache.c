@@ -26,6 +26,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/stat.h>
@@ -51,6 +52,7 @@
 
 #include <pulsecore/sink-input.h>
 #include <pulsecore/play-memchunk.h>
+#include <pulsecore/resampler.h>
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sound-file.h>
@@ -59,11 +61,53 @@
 #include <pulsecore/log.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/scache-converted.h>
 
 #include "core-scache.h"
 
 #define UNLOAD_POLL_TIME (60 * PA_USEC_PER_SEC)
 
+/* Samples that come from files are played from copies that were
+ * converted to the sample spec of the sink once. The copies are kept in
+ * files in the state directory, from where they are mapped straight into
+ * fixed memory blocks, so that event sounds start without being decoded
+ * or resampled, even after a restart. A file is made again when the
+ * sample file or the conversion settings changed since; another sink
+ * spec gets a file of its own. See scache-converted.c for the files.
+ *
+ * Converting happens in steps of CONVERT_STEP_BYTES of the sample per
+ * main loop iteration. Until a copy is complete the sample is played as
+ * it is. */
+
+#define CONVERT_STEP_BYTES (64*1024)
+
+struct converted {
+    char *key;
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    pa_memchunk memchunk;
+
+    /* The mapped file, if the data is in there */
+    pa_scache_converted_map map;
+};
+
+struct pa_scache_conversion {
+    pa_scache_entry *entry;
+    pa_defer_event *defer_event;
+
+    char *key;
+    pa_scache_converted_params params;
+    pa_sample_spec source_sample_spec;
+    pa_channel_map source_channel_map;
+
+    pa_memchunk source;
+    size_t offset;
+    pa_resampler *resampler;
+
+    uint8_t *data;
+    size_t size, length;
+};
+
 static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
     pa_core *c = userdata;
 
@@ -76,9 +120,77 @@ static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct
     pa_core_rttime_restart(c, e, pa_rtclock_now() + UNLOAD_POLL_TIME);
 }
 
+static void converted_free(struct converted *v) {
+    pa_assert(v);
+
+    if (v->map.map) {
+        /* Whoever still plays it gets a copy */
+        pa_memblock_unref_fixed(v->memchunk.memblock);
+        pa_scache_converted_unmap(&v->map);
+    } else
+        pa_memblock_unref(v->memchunk.memblock);
+
+    pa_xfree(v->key);
+    pa_xfree(v);
+}
+
+static void conversion_free(struct pa_scache_conversion *j) {
+    pa_assert(j);
+    pa_assert(j->entry->conversion == j);
+
+    j->entry->conversion = NULL;
+
+    j->entry->core->mainloop->defer_free(j->defer_event);
+
+    if (j->resampler)
+        pa_resampler_free(j->resampler);
+
+    pa_memblock_unref(j->source.memblock);
+    pa_xfree(j->data);
+    pa_xfree(j->key);
+    pa_xfree(j);
+}
+
+static void free_converted(pa_scache_entry *e) {
+    pa_assert(e);
+
+    if (e->conversion)
+        conversion_free(e->conversion);
+
+    if (!e->converted)
+        return;
+
+    pa_hashmap_free(e->converted, (pa_free_cb_t) converted_free);
+    e->converted = NULL;
+}
+
+/* Removes the converted files of a sample file that no other entry
+ * uses anymore */
+static void prune_converted(pa_scache_entry *e) {
+    pa_scache_entry *other;
+    uint32_t idx;
+    char *dir;
+
+    pa_assert(e);
+
+    if (!e->filename)
+        return;
+
+    PA_IDXSET_FOREACH(other, e->core->scache, idx)
+        if (other != e && other->filename && pa_streq(other->filename, e->filename))
+            return;
+
+    if (!(dir = pa_state_path("scache", TRUE)))
+        return;
+
+    pa_scache_converted_prune(dir, e->filename);
+    pa_xfree(dir);
+}
+
 static void free_entry(pa_scache_entry *e) {
     pa_assert(e);
 
+    free_converted(e);
     pa_namereg_unregister(e->core, e->name);
     pa_subscription_post(e->core, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_REMOVE, e->index);
     pa_xfree(e->name);
@@ -100,6 +212,9 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name) {
         if (e->memchunk.memblock)
             pa_memblock_unref(e->memchunk.memblock);
 
+        free_converted(e);
+        prune_converted(e);
+
         pa_xfree(e->filename);
         pa_proplist_clear(e->proplist);
 
@@ -116,6 +231,8 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name) {
 
         e->name = pa_xstrdup(name);
         e->core = c;
+        e->converted = NULL;
+        e->conversion = NULL;
         e->proplist = pa_proplist_new();
 
         pa_idxset_put(c->scache, e, &e->index);
@@ -200,6 +317,7 @@ int pa_scache_add_item(
 }
 
 int pa_scache_add_file(pa_core *c, const char *name, const char *filename, uint32_t *idx) {
+    pa_scache_entry *e;
     pa_sample_spec ss;
     pa_channel_map map;
     pa_memchunk chunk;
@@ -229,6 +347,12 @@ int pa_scache_add_file(pa_core *c, const char *name, const char *filename, uint3
     pa_memblock_unref(chunk.memblock);
     pa_proplist_free(p);
 
+    /* So that it can be played from a converted copy, too */
+    if (r >= 0) {
+        pa_assert_se(e = pa_namereg_get(c, name, PA_NAMEREG_SAMPLE));
+        e->filename = pa_xstrdup(filename);
+    }
+
     return r;
 }
 
@@ -276,6 +400,7 @@ int pa_scache_remove_item(pa_core *c, const char *name) {
 
     pa_log_debug("Removed sample \"%s\"", name);
 
+    prune_converted(e);
     free_entry(e);
 
     return 0;
@@ -292,8 +417,322 @@ void pa_scache_free_all(pa_core *c) {
     }
 }
 
+/* Sets the sample spec of a lazy sample, once we know it */
+static void set_sample_spec(pa_scache_entry *e, const pa_sample_spec *ss, const pa_channel_map *map) {
+    pa_channel_map old_channel_map = e->channel_map;
+
+    e->sample_spec = *ss;
+    e->channel_map = *map;
+
+    pa_subscription_post(e->core, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
+
+    if (e->volume_is_set) {
+        if (pa_cvolume_valid(&e->volume))
+            pa_cvolume_remap(&e->volume, &old_channel_map, &e->channel_map);
+        else
+            pa_cvolume_reset(&e->volume, e->sample_spec.channels);
+    }
+}
+
+static int load_lazy(pa_scache_entry *e, pa_proplist *p) {
+    pa_sample_spec ss;
+    pa_channel_map map;
+
+    pa_assert(e->lazy);
+    pa_assert(!e->memchunk.memblock);
+
+    if (pa_sound_file_load(e->core->mempool, e->filename, &ss, &map, &e->memchunk, p) < 0)
+        return -1;
+
+    set_sample_spec(e, &ss, &map);
+    return 0;
+}
+
+static pa_resample_flags_t resample_flags(pa_core *c) {
+    return
+        (c->disable_remixing ? PA_RESAMPLER_NO_REMIX : 0) |
+        (c->disable_lfe_remixing ? PA_RESAMPLER_NO_LFE : 0);
+}
+
+static char *converted_key(const pa_sample_spec *ss, const pa_channel_map *map) {
+    char st[PA_SAMPLE_SPEC_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX];
+
+    return pa_sprintf_malloc("%s %s",
+                             pa_sample_spec_snprint(st, sizeof(st), ss),
+                             pa_channel_map_snprint(cm, sizeof(cm), map));
+}
+
+static char *converted_path(const pa_scache_converted_params *params) {
+    char *dir, *path;
+
+    if (!(dir = pa_state_path("scache", TRUE)))
+        return NULL;
+
+    if (pa_make_secure_dir(dir, 0700U, (uid_t) -1, (gid_t) -1, FALSE) < 0) {
+        pa_log_warn("Failed to create sample cache directory %s: %s", dir, pa_cstrerror(errno));
+        pa_xfree(dir);
+        return NULL;
+    }
+
+    path = pa_scache_converted_path(dir, params);
+    pa_xfree(dir);
+
+    return path;
+}
+
+static void add_converted(pa_scache_entry *e, struct converted *v) {
+    if (!e->converted)
+        e->converted = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+    pa_assert_se(pa_hashmap_put(e->converted, v->key, v) >= 0);
+}
+
+/* Maps the converted file, if it is still good */
+static struct converted *converted_load(pa_core *c, const char *path, const pa_scache_converted_params *params) {
+    struct converted *v;
+    pa_scache_converted_map m;
+
+    if (pa_scache_converted_load(path, params, &m) < 0)
+        return NULL;
+
+    v = pa_xnew0(struct converted, 1);
+    v->sample_spec = params->sample_spec;
+    v->channel_map = params->channel_map;
+    v->map = m;
+
+    v->memchunk.memblock = pa_memblock_new_fixed(c->mempool, (void*) m.data, m.length, TRUE);
+    v->memchunk.index = 0;
+    v->memchunk.length = m.length;
+
+    return v;
+}
+
+/* Converts the next CONVERT_STEP_BYTES of the sample. Returns 1 when
+ * done, 0 when there is more to do. */
+static int conversion_step(struct pa_scache_conversion *j) {
+    size_t end;
+    void *src;
+
+    end = PA_MIN(j->source.length, j->offset + CONVERT_STEP_BYTES);
+
+    if (!j->resampler) {
+        src = pa_memblock_acquire(j->source.memblock);
+        memcpy(j->data + j->length, (uint8_t*) src + j->source.index + j->offset, end - j->offset);
+        pa_memblock_release(j->source.memblock);
+
+        j->length += end - j->offset;
+        j->offset = end;
+
+        return j->offset >= j->source.length;
+    }
+
+    while (j->offset < end) {
+        pa_memchunk in, out;
+
+        in = j->source;
+        in.index += j->offset;
+        in.length = PA_MIN(pa_resampler_max_block_size(j->resampler), end - j->offset);
+        j->offset += in.length;
+
+        pa_resampler_run(j->resampler, &in, &out);
+
+        if (!out.memblock)
+            continue;
+
+        if (j->length + out.length > PA_SCACHE_ENTRY_SIZE_MAX) {
+            pa_memblock_unref(out.memblock);
+            return -1;
+        }
+
+        if (j->length + out.length > j->size) {
+            j->size = PA_MAX(2 * j->size, j->length + out.length);
+            j->data = pa_xrealloc(j->data, j->size);
+        }
+
+        src = pa_memblock_acquire(out.memblock);
+        memcpy(j->data + j->length, (uint8_t*) src + out.index, out.length);
+        pa_memblock_release(out.memblock);
+        pa_memblock_unref(out.memblock);
+
+        j->length += out.length;
+    }
+
+    return j->offset >= j->source.length;
+}
+
+/* Stores what was converted, in a file if possible */
+static struct converted *conversion_finish(struct pa_scache_conversion *j) {
+    pa_scache_entry *e = j->entry;
+    struct converted *v = NULL;
+    char *path;
+
+    pa_log_debug("Converted sample \"%s\" to %s", e->name, j->key);
+
+    if ((path = converted_path(&j->params))) {
+        if (pa_scache_converted_save(path, &j->params, &j->source_sample_spec, &j->source_channel_map, j->data, j->length) >= 0)
+            v = converted_load(e->core, path, &j->params);
+
+        pa_xfree(path);
+    }
+
+    if (v)
+        pa_xfree(j->data);
+    else {
+        /* Without the file we can at least keep it in memory */
+        v = pa_xnew0(struct converted, 1);
+        v->sample_spec = j->params.sample_spec;
+        v->channel_map = j->params.channel_map;
+        v->memchunk.memblock = pa_memblock_new_malloced(e->core->mempool, j->data, j->length);
+        v->memchunk.index = 0;
+        v->memchunk.length = j->length;
+    }
+
+    j->data = NULL;
+
+    v->key = j->key;
+    j->key = NULL;
+
+    add_converted(e, v);
+    conversion_free(j);
+
+    return v;
+}
+
+static void conversion_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
+    struct pa_scache_conversion *j = userdata;
+    int r;
+
+    pa_assert(j);
+    pa_assert(j->defer_event == de);
+
+    if ((r = conversion_step(j)) == 0)
+        return;
+
+    if (r < 0 || j->length <= 0) {
+        pa_log_debug("Failed to convert sample \"%s\" to %s", j->entry->name, j->key);
+        conversion_free(j);
+        return;
+    }
+
+    conversion_finish(j);
+}
+
+/* Starts converting the sample. If it is small enough to be done in
+ * one step, returns the converted copy right away. */
+static struct converted *conversion_start(pa_scache_entry *e, char *key, const pa_scache_converted_params *params) {
+    struct pa_scache_conversion *j;
+    int r;
+
+    pa_assert(!e->conversion);
+    pa_assert(e->memchunk.memblock);
+
+    j = pa_xnew0(struct pa_scache_conversion, 1);
+    j->entry = e;
+    j->key = key;
+    j->params = *params;
+    j->source_sample_spec = e->sample_spec;
+    j->source_channel_map = e->channel_map;
+    j->source = e->memchunk;
+    pa_memblock_ref(j->source.memblock);
+
+    if (!pa_sample_spec_equal(&e->sample_spec, &params->sample_spec) || !pa_channel_map_equal(&e->channel_map, &params->channel_map)) {
+        if (!(j->resampler = pa_resampler_new(e->core->mempool, &e->sample_spec, &e->channel_map, &params->sample_spec, &params->channel_map, params->resample_method, params->resample_flags))) {
+            pa_memblock_unref(j->source.memblock);
+            pa_xfree(j->key);
+            pa_xfree(j);
+            return NULL;
+        }
+
+        j->size = pa_resampler_result(j->resampler, j->source.length) + pa_frame_size(&params->sample_spec);
+    } else
+        j->size = j->source.length;
+
+    j->data = pa_xmalloc(j->size);
+    j->defer_event = e->core->mainloop->defer_new(e->core->mainloop, conversion_cb, j);
+    e->conversion = j;
+
+    if ((r = conversion_step(j)) == 0)
+        return NULL;
+
+    if (r < 0 || j->length <= 0) {
+        conversion_free(j);
+        return NULL;
+    }
+
+    return conversion_finish(j);
+}
+
+/* Returns the sample converted to the sample spec of the sink, from
+ * memory or from the cache on disk. Otherwise the conversion is started
+ * and NULL returned until it is done. */
+static struct converted *get_converted(pa_scache_entry *e, pa_sink *sink, pa_proplist *p) {
+    pa_core *c = e->core;
+    struct converted *v;
+    struct stat st;
+    pa_scache_converted_params params;
+    char *key, *path;
+
+    pa_assert(e->filename);
+
+    key = converted_key(&sink->sample_spec, &sink->channel_map);
+
+    if (e->converted && (v = pa_hashmap_get(e->converted, key))) {
+        pa_xfree(key);
+        return v;
+    }
+
+    if (stat(e->filename, &st) < 0) {
+        pa_xfree(key);
+        return NULL;
+    }
+
+    pa_zero(params);
+    params.filename = e->filename;
+    params.mtime = (uint64_t) st.st_mtime;
+    params.size = (uint64_t) st.st_size;
+    params.resample_method = c->resample_method;
+    params.resample_flags = resample_flags(c);
+    params.sample_spec = sink->sample_spec;
+    params.channel_map = sink->channel_map;
+
+    if ((path = converted_path(&params)) && (v = converted_load(c, path, &params))) {
+        pa_xfree(path);
+
+        /* We know what is in the file now, even if we never loaded it */
+        if (!pa_sample_spec_equal(&e->sample_spec, &v->map.source_sample_spec) || !pa_channel_map_equal(&e->channel_map, &v->map.source_channel_map))
+            set_sample_spec(e, &v->map.source_sample_spec, &v->map.source_channel_map);
+
+        v->key = key;
+        add_converted(e, v);
+
+        return v;
+    }
+
+    pa_xfree(path);
+
+    /* One conversion at a time, the sample is played as it is
+     * meanwhile */
+    if (e->conversion) {
+        pa_xfree(key);
+        return NULL;
+    }
+
+    if (e->lazy && !e->memchunk.memblock && load_lazy(e, p) < 0) {
+        pa_xfree(key);
+        return NULL;
+    }
+
+    if (!e->memchunk.memblock) {
+        pa_xfree(key);
+        return NULL;
+    }
+
+    return conversion_start(e, key, &params);
+}
+
 int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, uint32_t *sink_input_idx) {
     pa_scache_entry *e;
+    struct converted *v = NULL;
     pa_cvolume r;
     pa_proplist *merged;
     pa_bool_t pass_volume;
@@ -309,25 +748,20 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     pa_proplist_sets(merged, PA_PROP_MEDIA_NAME, name);
     pa_proplist_sets(merged, PA_PROP_EVENT_ID, name);
 
-    if (e->lazy && !e->memchunk.memblock) {
-        pa_channel_map old_channel_map = e->channel_map;
+    /* Samples that are in memory already and match the sink are played
+     * as they are */
+    if (e->filename && !c->disable_scache_preconvert &&
+        (e->lazy || !pa_sample_spec_equal(&e->sample_spec, &sink->sample_spec) || !pa_channel_map_equal(&e->channel_map, &sink->channel_map)))
+        v = get_converted(e, sink, merged);
 
-        if (pa_sound_file_load(c->mempool, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
+    if (!v) {
+        if (e->lazy && !e->memchunk.memblock && load_lazy(e, merged) < 0)
             goto fail;
 
-        pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
-
-        if (e->volume_is_set) {
-            if (pa_cvolume_valid(&e->volume))
-                pa_cvolume_remap(&e->volume, &old_channel_map, &e->channel_map);
-            else
-                pa_cvolume_reset(&e->volume, e->sample_spec.channels);
-        }
+        if (!e->memchunk.memblock)
+            goto fail;
     }
 
-    if (!e->memchunk.memblock)
-        goto fail;
-
     pa_log_debug("Playing sample \"%s\" on \"%s\"", name, sink->name);
 
     pass_volume = TRUE;
@@ -342,14 +776,18 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     else
         pass_volume = FALSE;
 
+    if (v && pass_volume)
+        pa_cvolume_remap(&r, &e->channel_map, &v->channel_map);
+
     pa_proplist_update(merged, PA_UPDATE_REPLACE, e->proplist);
 
     if (p)
         pa_proplist_update(merged, PA_UPDATE_REPLACE, p);
 
     if (pa_play_memchunk(sink,
-                         &e->sample_spec, &e->channel_map,
-                         &e->memchunk,
+                         v ? &v->sample_spec : &e->sample_spec,
+                         v ? &v->channel_map : &e->channel_map,
+                         v ? &v->memchunk : &e->memchunk,
                          pass_volume ? &r : NULL,
                          merged,
                          PA_SINK_INPUT_NO_CREATE_ON_SUSPEND|PA_SINK_INPUT_KILL_ON_SUSPEND, sink_input_idx) < 0)
@@ -434,12 +872,17 @@ void pa_scache_unload_unused(pa_core *c) {
 
     PA_IDXSET_FOREACH(e, c->scache, idx) {
 
-        if (!e->lazy || !e->memchunk.memblock)
+        if (!e->lazy || (!e->memchunk.memblock && !e->converted && !e->conversion))
             continue;
 
         if (e->last_used_time + c->scache_idle_time > now)
             continue;
 
+        free_converted(e);
+
+        if (!e->memchunk.memblock)
+            continue;
+
         pa_memblock_unref(e->memchunk.memblock);
         pa_memchunk_reset(&e->memchunk);
 
@@ -24,6 +24,7 @@
 ***/
 
 #include <pulsecore/core.h>
+#include <pulsecore/hashmap.h>
 #include <pulsecore/memchunk.h>
 #include <pulsecore/sink.h>
 
@@ -46,6 +47,12 @@ typedef struct pa_scache_entry {
     pa_bool_t lazy;
     time_t last_used_time;
 
+    /* For samples from files: copies converted to the sample specs of
+     * the sinks they were played on, see pa_scache_play_item(), and the
+     * one that is being converted right now */
+    pa_hashmap *converted;
+    struct pa_scache_conversion *conversion;
+
     pa_proplist *proplist;
 } pa_scache_entry;
 
@@ -25,8 +25,11 @@
 
 #include <stdio.h>
 
+#include <pulse/rtclock.h>
 #include <pulse/xmalloc.h>
 
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 
@@ -37,7 +40,19 @@
  * register a callback function that is called whenever an event
  * matching a subscription mask happens. The execution of the callback
  * function is postponed to the next main loop iteration, i.e. is not
- * called from within the stack frame the entity was created in. */
+ * called from within the stack frame the entity was created in.
+ *
+ * Batched subscriptions collect the events for a while and coalesce
+ * those of the same object, so that monitoring clients aren't woken up
+ * for every step of, say, a volume ramp. */
+
+struct batch_item {
+    pa_subscription_batch_event event;
+
+    /* Whether the subscriber might know of the object, i.e. the batch
+     * doesn't start with it being created */
+    pa_bool_t known;
+};
 
 struct pa_subscription {
     pa_core *core;
@@ -47,6 +62,12 @@ struct pa_subscription {
     void *userdata;
     pa_subscription_mask_t mask;
 
+    /* Only for batched subscriptions */
+    pa_subscription_batch_cb_t batch_callback;
+    pa_usec_t max_delay;
+    pa_hashmap *batch;
+    pa_time_event *batch_event;
+
     PA_LLIST_FIELDS(pa_subscription);
 };
 
@@ -56,9 +77,36 @@ struct pa_subscription_event {
     pa_subscription_event_type_t type;
     uint32_t index;
 
+    /* A remove event that replaced the new event of its object */
+    pa_bool_t unannounced;
+
     PA_LLIST_FIELDS(pa_subscription_event);
 };
 
+/* How many removed objects are remembered per facility */
+#define REMOVED_MAX 64
+
+struct generation {
+    uint32_t index;
+    uint64_t generation;
+    pa_bool_t removed;
+
+    /* Removed objects, oldest first */
+    PA_LLIST_FIELDS(struct generation);
+};
+
+struct pa_subscription_generations {
+    pa_hashmap *objects;
+
+    PA_LLIST_HEAD(struct generation, removed);
+    struct generation *removed_last;
+    unsigned n_removed;
+
+    /* The newest generation of the removed objects that were
+     * forgotten */
+    uint64_t forgotten;
+};
+
 static void sched_event(pa_core *c);
 
 /* Allocate a new subscription object for the given subscription mask. Use the specified callback function and user data */
@@ -69,7 +117,7 @@ pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m, pa_su
     pa_assert(m);
     pa_assert(callback);
 
-    s = pa_xnew(pa_subscription, 1);
+    s = pa_xnew0(pa_subscription, 1);
     s->core = c;
     s->dead = FALSE;
     s->callback = callback;
@@ -80,11 +128,63 @@ pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m, pa_su
     return s;
 }
 
+static unsigned batch_hash_func(const void *p) {
+    const pa_subscription_batch_event *e = p;
+
+    return e->index * 31U + (e->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK);
+}
+
+static int batch_compare_func(const void *a, const void *b) {
+    const pa_subscription_batch_event *x = a, *y = b;
+
+    if (x->index != y->index)
+        return x->index < y->index ? -1 : 1;
+
+    return (int) (x->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) - (int) (y->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK);
+}
+
+/* Allocate a new subscription object whose events are handed to the
+ * callback in batches, at the latest max_delay after the first of them */
+pa_subscription* pa_subscription_new_batched(pa_core *c, pa_subscription_mask_t m, pa_usec_t max_delay, pa_subscription_batch_cb_t callback, void *userdata) {
+    pa_subscription *s;
+
+    pa_assert(c);
+    pa_assert(m);
+    pa_assert(callback);
+
+    s = pa_xnew0(pa_subscription, 1);
+    s->core = c;
+    s->dead = FALSE;
+    s->batch_callback = callback;
+    s->userdata = userdata;
+    s->mask = m;
+    s->max_delay = max_delay;
+    s->batch = pa_hashmap_new(batch_hash_func, batch_compare_func);
+
+    PA_LLIST_PREPEND(pa_subscription, c->subscriptions, s);
+    return s;
+}
+
+static void free_batch(pa_subscription *s) {
+    if (s->batch_event) {
+        s->core->mainloop->time_free(s->batch_event);
+        s->batch_event = NULL;
+    }
+
+    if (s->batch) {
+        pa_hashmap_free(s->batch, pa_xfree);
+        s->batch = NULL;
+    }
+}
+
 /* Free a subscription object, effectively marking it for deletion */
 void pa_subscription_free(pa_subscription*s) {
     pa_assert(s);
     pa_assert(!s->dead);
 
+    /* Whatever was collected is not going to be delivered anymore */
+    free_batch(s);
+
     s->dead = TRUE;
     sched_event(s->core);
 }
@@ -93,6 +193,8 @@ static void free_subscription(pa_subscription *s) {
     pa_assert(s);
     pa_assert(s->core);
 
+    free_batch(s);
+
     PA_LLIST_REMOVE(pa_subscription, s->core->subscriptions, s);
     pa_xfree(s);
 }
@@ -110,6 +212,8 @@ static void free_event(pa_subscription_event *s) {
 
 /* Free all subscription objects */
 void pa_subscription_free_all(pa_core *c) {
+    unsigned i;
+
     pa_assert(c);
 
     while (c->subscriptions)
@@ -122,6 +226,15 @@ void pa_subscription_free_all(pa_core *c) {
         c->mainloop->defer_free(c->subscription_defer_event);
         c->subscription_defer_event = NULL;
     }
+
+    for (i = 0; i < PA_ELEMENTSOF(c->generations); i++) {
+        if (!c->generations[i])
+            continue;
+
+        pa_hashmap_free(c->generations[i]->objects, pa_xfree);
+        pa_xfree(c->generations[i]);
+        c->generations[i] = NULL;
+    }
 }
 
 #ifdef DEBUG
@@ -152,6 +265,87 @@ static void dump_event(const char * prefix, pa_subscription_event*e) {
 }
 #endif
 
+/* Hand everything collected so far to a batched subscription */
+static void flush_batch(pa_subscription *s) {
+    pa_subscription_batch_event *events;
+    struct batch_item *i;
+    unsigned n = 0;
+
+    pa_assert(s);
+    pa_assert(!s->dead);
+
+    if (s->batch_event) {
+        s->core->mainloop->time_free(s->batch_event);
+        s->batch_event = NULL;
+    }
+
+    if (pa_hashmap_isempty(s->batch))
+        return;
+
+    events = pa_xnew(pa_subscription_batch_event, pa_hashmap_size(s->batch));
+
+    while ((i = pa_hashmap_steal_first(s->batch))) {
+        events[n++] = i->event;
+        pa_xfree(i);
+    }
+
+    s->batch_callback(s->core, events, n, s->userdata);
+    pa_xfree(events);
+}
+
+static void batch_time_cb(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_subscription *s = userdata;
+
+    pa_assert(s);
+    pa_assert(s->batch_event == e);
+
+    flush_batch(s);
+}
+
+/* Merge an event into the batch of a subscription */
+static void batch_event(pa_subscription *s, pa_subscription_event *e) {
+    pa_subscription_batch_event key;
+    struct batch_item *i;
+    pa_subscription_event_type_t type = e->type & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+
+    pa_assert(s);
+    pa_assert(s->batch);
+
+    key.type = e->type;
+    key.index = e->index;
+
+    if (!(i = pa_hashmap_get(s->batch, &key))) {
+
+        /* Nobody got to hear of the object before it was gone */
+        if (e->unannounced)
+            return;
+
+        i = pa_xnew(struct batch_item, 1);
+        i->event = key;
+        i->known = type != PA_SUBSCRIPTION_EVENT_NEW;
+        pa_assert_se(pa_hashmap_put(s->batch, &i->event, i) >= 0);
+
+        /* Deliver the batch at the latest max_delay after its first
+         * event. Without a delay, defer_cb() delivers it right away. */
+        if (s->max_delay > 0 && !s->batch_event)
+            s->batch_event = pa_core_rttime_new(s->core, pa_rtclock_now() + s->max_delay, batch_time_cb, s);
+
+        return;
+    }
+
+    if (type == PA_SUBSCRIPTION_EVENT_REMOVE && !i->known) {
+        /* The subscriber never heard of it, so better not tell */
+        pa_hashmap_remove(s->batch, &key);
+        pa_xfree(i);
+        return;
+    }
+
+    /* A new object stays new no matter how often it changes */
+    if (type != PA_SUBSCRIPTION_EVENT_CHANGE ||
+        (i->event.type & PA_SUBSCRIPTION_EVENT_TYPE_MASK) != PA_SUBSCRIPTION_EVENT_NEW)
+        i->event.type = e->type;
+}
+
 /* Deferred callback for dispatching subscription events */
 static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
     pa_core *c = userdata;
@@ -170,7 +364,12 @@ static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
 
         for (s = c->subscriptions; s; s = s->next) {
 
-            if (!s->dead && pa_subscription_match_flags(s->mask, e->type))
+            if (s->dead || !pa_subscription_match_flags(s->mask, e->type))
+                continue;
+
+            if (s->batch_callback)
+                batch_event(s, e);
+            else
                 s->callback(c, e->type, e->index, s->userdata);
         }
 
@@ -180,6 +379,12 @@ static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
         free_event(e);
     }
 
+    /* Batches that don't wait for more go out now */
+
+    for (s = c->subscriptions; s; s = s->next)
+        if (!s->dead && s->batch_callback && s->max_delay <= 0)
+            flush_batch(s);
+
     /* Remove dead subscriptions */
 
     s = c->subscriptions;
@@ -203,11 +408,112 @@ static void sched_event(pa_core *c) {
     c->mainloop->defer_enable(c->subscription_defer_event, 1);
 }
 
+static void unlink_removed(pa_subscription_generations *g, struct generation *o) {
+    if (!o->next)
+        g->removed_last = o->prev;
+
+    PA_LLIST_REMOVE(struct generation, g->removed, o);
+    g->n_removed--;
+}
+
+/* Stamp the object with a new generation */
+static void update_generation(pa_core *c, pa_subscription_event_type_t t, uint32_t idx) {
+    pa_subscription_generations *g;
+    struct generation *o;
+    unsigned facility = t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+
+    if (!(g = c->generations[facility])) {
+        g = c->generations[facility] = pa_xnew0(pa_subscription_generations, 1);
+        g->objects = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    }
+
+    if (!(o = pa_hashmap_get(g->objects, PA_UINT32_TO_PTR(idx)))) {
+        o = pa_xnew0(struct generation, 1);
+        o->index = idx;
+        pa_assert_se(pa_hashmap_put(g->objects, PA_UINT32_TO_PTR(idx), o) >= 0);
+    } else if (o->removed) {
+        /* The index is in use again */
+        unlink_removed(g, o);
+        o->removed = FALSE;
+    }
+
+    o->generation = ++c->generation;
+
+    if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) != PA_SUBSCRIPTION_EVENT_REMOVE)
+        return;
+
+    o->removed = TRUE;
+    PA_LLIST_INSERT_AFTER(struct generation, g->removed, g->removed_last, o);
+    g->removed_last = o;
+    g->n_removed++;
+
+    while (g->n_removed > REMOVED_MAX) {
+        struct generation *f = g->removed;
+
+        unlink_removed(g, f);
+        g->forgotten = f->generation;
+        pa_hashmap_remove(g->objects, PA_UINT32_TO_PTR(f->index));
+        pa_xfree(f);
+    }
+}
+
+uint64_t pa_subscription_get_generation(pa_core *c, pa_subscription_event_type_t facility, uint32_t idx) {
+    pa_subscription_generations *g;
+    struct generation *o;
+
+    pa_assert(c);
+
+    if (!(g = c->generations[facility & PA_SUBSCRIPTION_EVENT_FACILITY_MASK]))
+        return 0;
+
+    if (!(o = pa_hashmap_get(g->objects, PA_UINT32_TO_PTR(idx))) || o->removed)
+        return 0;
+
+    return o->generation;
+}
+
+int pa_subscription_get_removed(pa_core *c, pa_subscription_event_type_t facility, uint64_t since, uint32_t **indexes, unsigned *n) {
+    pa_subscription_generations *g;
+    struct generation *o;
+    unsigned k = 0;
+
+    pa_assert(c);
+    pa_assert(indexes);
+    pa_assert(n);
+
+    *indexes = NULL;
+    *n = 0;
+
+    if (!(g = c->generations[facility & PA_SUBSCRIPTION_EVENT_FACILITY_MASK]))
+        return 0;
+
+    if (since < g->forgotten)
+        return -1;
+
+    /* The list is ordered by generation, so look from the end */
+    for (o = g->removed_last; o && o->generation > since; o = o->prev)
+        k++;
+
+    if (k <= 0)
+        return 0;
+
+    *indexes = pa_xnew(uint32_t, k);
+    *n = k;
+
+    for (o = g->removed_last; k > 0; o = o->prev)
+        (*indexes)[--k] = o->index;
+
+    return 0;
+}
+
 /* Append a new subscription event to the subscription event queue and schedule a main loop event */
 void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t idx) {
     pa_subscription_event *e;
+    pa_bool_t unannounced = FALSE;
     pa_assert(c);
 
+    update_generation(c, t, idx);
+
     /* No need for queuing subscriptions of no one is listening */
     if (!c->subscriptions)
         return;
@@ -232,6 +538,9 @@ void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t i
                  * point in keeping the old events regarding this
                  * entry in the queue. */
 
+                if ((i->type & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_NEW)
+                    unannounced = TRUE;
+
                 free_event(i);
                 pa_log_debug("Dropped redundant event due to remove event.");
                 continue;
@@ -251,6 +560,7 @@ void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t i
     e->core = c;
     e->type = t;
     e->index = idx;
+    e->unannounced = unannounced;
 
     PA_LLIST_INSERT_AFTER(pa_subscription_event, c->subscription_event_queue, c->subscription_event_last, e);
     c->subscription_event_last = e;
@@ -24,16 +24,45 @@
 
 typedef struct pa_subscription pa_subscription;
 typedef struct pa_subscription_event pa_subscription_event;
+typedef struct pa_subscription_generations pa_subscription_generations;
+typedef struct pa_subscription_batch_event pa_subscription_batch_event;
 
 #include <pulsecore/core.h>
 #include <pulsecore/native-common.h>
 
 typedef void (*pa_subscription_cb_t)(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata);
 
+struct pa_subscription_batch_event {
+    pa_subscription_event_type_t type;
+    uint32_t index;
+};
+
+typedef void (*pa_subscription_batch_cb_t)(pa_core *c, const pa_subscription_batch_event *events, unsigned n, void *userdata);
+
 pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m,  pa_subscription_cb_t cb, void *userdata);
+
+/* Like pa_subscription_new(), but the events are collected for up to
+ * max_delay and handed to the callback together. There is at most one
+ * event per object in a batch: a change after a new event is dropped, as
+ * is everything about an object that came and went in the meantime. The
+ * events are in the order in which their objects first showed up. */
+pa_subscription* pa_subscription_new_batched(pa_core *c, pa_subscription_mask_t m, pa_usec_t max_delay, pa_subscription_batch_cb_t cb, void *userdata);
 void pa_subscription_free(pa_subscription*s);
 void pa_subscription_free_all(pa_core *c);
 
 void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t idx);
 
+/* Every event posted stamps its object with the next value of a
+ * counter, the generation, so that clients can ask for what changed
+ * since they last looked. Returns 0 for objects that never had an event
+ * posted. */
+uint64_t pa_subscription_get_generation(pa_core *c, pa_subscription_event_type_t facility, uint32_t idx);
+
+/* Returns the indexes of the objects of the facility that were removed
+ * after the given generation, in an array to be freed with pa_xfree(),
+ * or NULL if there are none. Only a limited number of removals is
+ * remembered: returns -1 if the ones since that generation have been
+ * forgotten already. */
+int pa_subscription_get_removed(pa_core *c, pa_subscription_event_type_t facility, uint64_t since, uint32_t **indexes, unsigned *n);
+
 #endif
@@ -162,7 +162,12 @@ struct pa_core {
     PA_LLIST_HEAD(pa_subscription_event, subscription_event_queue);
     pa_subscription_event *subscription_event_last;
 
+    /* When each object last changed, for incremental introspection */
+    uint64_t generation;
+    pa_subscription_generations *generations[PA_SUBSCRIPTION_EVENT_FACILITY_MASK+1];
+
     pa_mempool *mempool;
+    size_t shm_size;
     pa_silence_cache silence_cache;
 
     pa_time_event *exit_event;
@@ -178,6 +183,8 @@ struct pa_core {
     pa_bool_t disable_remixing:1;
     pa_bool_t disable_lfe_remixing:1;
     pa_bool_t deferred_volume:1;
+    pa_bool_t disable_memfd:1;
+    pa_bool_t disable_scache_preconvert:1;
 
     pa_resample_method_t resample_method;
     int realtime_priority;
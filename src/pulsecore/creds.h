@@ -29,8 +29,10 @@
 #endif
 
 #include <pulsecore/socket.h>
+#include <pulsecore/macro.h>
 
 typedef struct pa_creds pa_creds;
+typedef struct pa_cmsg_ancil_data pa_cmsg_ancil_data;
 
 #if defined(SCM_CREDENTIALS)
 
@@ -41,6 +43,20 @@ struct pa_creds {
     uid_t uid;
 };
 
+/* Maximum number of file descriptors passed along with one packet */
+#define MAX_ANCIL_FDS 3
+
+/* Credentials and file descriptors that came in alongside a packet
+ * on a UNIX socket */
+struct pa_cmsg_ancil_data {
+    pa_creds creds;
+    pa_bool_t creds_valid;
+    int nfd;
+    int fds[MAX_ANCIL_FDS];
+};
+
+void pa_cmsg_ancil_data_close_fds(pa_cmsg_ancil_data *ancil);
+
 #else
 #undef HAVE_CREDS
 #endif
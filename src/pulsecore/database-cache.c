@@ -0,0 +1,431 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "database-cache.h"
+
+struct pending {
+    pa_datum key;
+    pa_datum data;
+    pa_bool_t deleted;
+};
+
+struct pa_database_cache {
+    pa_core *core;
+    pa_module *module;
+    pa_database *database;
+
+    pa_usec_t flush_interval;
+    size_t max_bytes;
+
+    pa_hashmap *pending;
+    size_t pending_bytes;
+
+    /* pa_database_cache_clear() was called since the last flush, so
+     * the database doesn't count anymore */
+    pa_bool_t cleared;
+
+    pa_time_event *time_event;
+
+    uint64_t n_flushes;
+    uint64_t n_entries_written;
+    uint64_t n_bytes_written;
+    uint64_t n_updates_coalesced;
+};
+
+static unsigned datum_hash_func(const void *p) {
+    const pa_datum *d = p;
+    const uint8_t *c = d->data;
+    unsigned hash = 0;
+    size_t i;
+
+    for (i = 0; i < d->size; i++)
+        hash = 31 * hash + c[i];
+
+    return hash;
+}
+
+static int datum_compare_func(const void *a, const void *b) {
+    const pa_datum *aa = a, *bb = b;
+
+    if (aa->size != bb->size)
+        return aa->size > bb->size ? 1 : -1;
+
+    return aa->size > 0 ? memcmp(aa->data, bb->data, aa->size) : 0;
+}
+
+static void copy_datum(pa_datum *to, const pa_datum *from) {
+    to->data = from->size > 0 ? pa_xmemdup(from->data, from->size) : NULL;
+    to->size = from->size;
+}
+
+static size_t pending_size(struct pending *p) {
+    return p->key.size + p->data.size;
+}
+
+static void pending_free(struct pending *p) {
+    pa_datum_free(&p->key);
+    pa_datum_free(&p->data);
+    pa_xfree(p);
+}
+
+static void publish_stats(pa_database_cache *c) {
+    pa_proplist *p;
+
+    p = pa_proplist_new();
+    pa_proplist_setf(p, "module.database.flushes", "%llu", (unsigned long long) c->n_flushes);
+    pa_proplist_setf(p, "module.database.entries_written", "%llu", (unsigned long long) c->n_entries_written);
+    pa_proplist_setf(p, "module.database.bytes_written", "%llu", (unsigned long long) c->n_bytes_written);
+    pa_proplist_setf(p, "module.database.updates_coalesced", "%llu", (unsigned long long) c->n_updates_coalesced);
+    pa_module_update_proplist(c->module, PA_UPDATE_REPLACE, p);
+    pa_proplist_free(p);
+}
+
+static int flush(pa_database_cache *c, pa_bool_t publish) {
+    struct pending *p;
+    unsigned n = 0;
+    size_t bytes = 0;
+    int r = 0;
+
+    if (c->time_event) {
+        c->core->mainloop->time_free(c->time_event);
+        c->time_event = NULL;
+    }
+
+    if (!c->cleared && pa_hashmap_isempty(c->pending))
+        return 0;
+
+    if (c->cleared && pa_database_clear(c->database) < 0)
+        r = -1;
+
+    c->cleared = FALSE;
+
+    while ((p = pa_hashmap_steal_first(c->pending))) {
+        /* Something that is deleted may never have made it to the
+         * database, so failing to unset it is fine */
+        if (p->deleted)
+            pa_database_unset(c->database, &p->key);
+        else if (pa_database_set(c->database, &p->key, &p->data, TRUE) < 0)
+            r = -1;
+
+        n++;
+        bytes += pending_size(p);
+
+        pending_free(p);
+    }
+
+    c->pending_bytes = 0;
+
+    if (pa_database_sync(c->database) < 0)
+        r = -1;
+
+    c->n_flushes++;
+    c->n_entries_written += n;
+    c->n_bytes_written += bytes;
+
+    pa_log_info("Synced %u entries, %lu bytes.", n, (unsigned long) bytes);
+
+    if (publish)
+        publish_stats(c);
+
+    return r;
+}
+
+static void time_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_database_cache *c = userdata;
+
+    pa_assert(c);
+    pa_assert(e == c->time_event);
+
+    flush(c, TRUE);
+}
+
+/* Called after every change */
+static void schedule_flush(pa_database_cache *c) {
+    if (c->pending_bytes >= c->max_bytes) {
+        flush(c, TRUE);
+        return;
+    }
+
+    if (!c->time_event)
+        c->time_event = pa_core_rttime_new(c->core, pa_rtclock_now() + c->flush_interval, time_cb, c);
+}
+
+pa_database_cache* pa_database_cache_new(pa_module *m, pa_database *db, pa_usec_t flush_interval, size_t max_bytes) {
+    pa_database_cache *c;
+
+    pa_assert(m);
+    pa_assert(db);
+
+    c = pa_xnew0(pa_database_cache, 1);
+    c->core = m->core;
+    c->module = m;
+    c->database = db;
+    c->flush_interval = flush_interval;
+    c->max_bytes = max_bytes;
+    c->pending = pa_hashmap_new(datum_hash_func, datum_compare_func);
+
+    publish_stats(c);
+
+    return c;
+}
+
+void pa_database_cache_free(pa_database_cache *c) {
+    pa_assert(c);
+
+    /* The module is going away, nobody is interested in the numbers
+     * anymore */
+    flush(c, FALSE);
+
+    pa_hashmap_free(c->pending, NULL);
+    pa_xfree(c);
+}
+
+/* Returns the pending change for the key, or NULL if there is none
+ * and the database is to be asked */
+static struct pending *lookup(pa_database_cache *c, const pa_datum *key, pa_bool_t *exists) {
+    struct pending *p;
+
+    if ((p = pa_hashmap_get(c->pending, key))) {
+        *exists = !p->deleted;
+        return p;
+    }
+
+    *exists = FALSE;
+
+    return NULL;
+}
+
+static pa_bool_t exists_in_database(pa_database_cache *c, const pa_datum *key) {
+    pa_datum data;
+
+    if (c->cleared || !pa_database_get(c->database, key, &data))
+        return FALSE;
+
+    pa_datum_free(&data);
+
+    return TRUE;
+}
+
+pa_datum* pa_database_cache_get(pa_database_cache *c, const pa_datum *key, pa_datum* data) {
+    struct pending *p;
+    pa_bool_t exists;
+
+    pa_assert(c);
+    pa_assert(key);
+    pa_assert(data);
+
+    if ((p = lookup(c, key, &exists))) {
+        if (!exists)
+            return NULL;
+
+        copy_datum(data, &p->data);
+        return data;
+    }
+
+    if (c->cleared)
+        return NULL;
+
+    return pa_database_get(c->database, key, data);
+}
+
+static void put(pa_database_cache *c, struct pending *p, const pa_datum *key, const pa_datum *data) {
+    if (p) {
+        c->n_updates_coalesced++;
+        c->pending_bytes -= pending_size(p);
+        pa_datum_free(&p->data);
+    } else {
+        p = pa_xnew0(struct pending, 1);
+        copy_datum(&p->key, key);
+        pa_assert_se(pa_hashmap_put(c->pending, &p->key, p) >= 0);
+    }
+
+    p->deleted = !data;
+
+    if (data)
+        copy_datum(&p->data, data);
+
+    c->pending_bytes += pending_size(p);
+
+    schedule_flush(c);
+}
+
+int pa_database_cache_set(pa_database_cache *c, const pa_datum *key, const pa_datum* data, pa_bool_t overwrite) {
+    struct pending *p;
+    pa_bool_t exists;
+
+    pa_assert(c);
+    pa_assert(key);
+    pa_assert(data);
+
+    p = lookup(c, key, &exists);
+
+    if (!overwrite && (exists || (!p && exists_in_database(c, key))))
+        return -1;
+
+    /* Nothing changes */
+    if (exists && datum_compare_func(&p->data, data) == 0) {
+        c->n_updates_coalesced++;
+        return 0;
+    }
+
+    put(c, p, key, data);
+
+    return 0;
+}
+
+int pa_database_cache_unset(pa_database_cache *c, const pa_datum *key) {
+    struct pending *p;
+    pa_bool_t exists;
+
+    pa_assert(c);
+    pa_assert(key);
+
+    p = lookup(c, key, &exists);
+
+    if (!exists && (p || !exists_in_database(c, key)))
+        return -1;
+
+    put(c, p, key, NULL);
+
+    return 0;
+}
+
+int pa_database_cache_clear(pa_database_cache *c) {
+    pa_assert(c);
+
+    pa_hashmap_remove_all(c->pending, (pa_free_cb_t) pending_free);
+    c->pending_bytes = 0;
+    c->cleared = TRUE;
+
+    schedule_flush(c);
+
+    return 0;
+}
+
+/* Iterating goes over what is stored first, with the pending changes
+ * applied, and then over the keys that are only pending. Whether a key
+ * is stored tells in which of the two parts we are. */
+static pa_datum* database_next(pa_database_cache *c, const pa_datum *key, pa_datum *next, pa_datum *data) {
+    struct pending *p;
+    pa_datum d, *got;
+
+    if (c->cleared)
+        return NULL;
+
+    got = key ? pa_database_next(c->database, key, next, &d) : pa_database_first(c->database, next, &d);
+
+    while (got) {
+        pa_datum k;
+
+        if (!(p = pa_hashmap_get(c->pending, next))) {
+            if (data)
+                *data = d;
+            else
+                pa_datum_free(&d);
+
+            return next;
+        }
+
+        pa_datum_free(&d);
+
+        if (!p->deleted) {
+            if (data)
+                copy_datum(data, &p->data);
+
+            return next;
+        }
+
+        /* Deleted, but not flushed yet */
+        k = *next;
+        got = pa_database_next(c->database, &k, next, &d);
+        pa_datum_free(&k);
+    }
+
+    return NULL;
+}
+
+static pa_datum* pending_next(pa_database_cache *c, const pa_datum *key, pa_datum *next, pa_datum *data) {
+    struct pending *p;
+    void *state = NULL;
+    pa_bool_t found = !key;
+
+    while ((p = pa_hashmap_iterate(c->pending, &state, NULL))) {
+        if (!found) {
+            found = datum_compare_func(&p->key, key) == 0;
+            continue;
+        }
+
+        /* Already seen with the stored keys */
+        if (p->deleted || exists_in_database(c, &p->key))
+            continue;
+
+        copy_datum(next, &p->key);
+
+        if (data)
+            copy_datum(data, &p->data);
+
+        return next;
+    }
+
+    return NULL;
+}
+
+pa_datum* pa_database_cache_first(pa_database_cache *c, pa_datum *key, pa_datum *data) {
+    pa_assert(c);
+    pa_assert(key);
+
+    if (database_next(c, NULL, key, data))
+        return key;
+
+    return pending_next(c, NULL, key, data);
+}
+
+pa_datum* pa_database_cache_next(pa_database_cache *c, const pa_datum *key, pa_datum *next, pa_datum *data) {
+    pa_assert(c);
+    pa_assert(key);
+    pa_assert(next);
+
+    if (!exists_in_database(c, key))
+        return pending_next(c, key, next, data);
+
+    if (database_next(c, key, next, data))
+        return next;
+
+    return pending_next(c, NULL, next, data);
+}
+
+int pa_database_cache_flush(pa_database_cache *c) {
+    pa_assert(c);
+
+    return flush(c, TRUE);
+}
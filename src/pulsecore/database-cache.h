@@ -0,0 +1,62 @@
+#ifndef foopulsecoredatabasecachehfoo
+#define foopulsecoredatabasecachehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/sample.h>
+
+#include <pulsecore/database.h>
+#include <pulsecore/module.h>
+
+/* A write-behind cache in front of a pa_database, for modules that
+ * save often, like the restore modules do while a volume slider is
+ * dragged. Changes are kept in memory, only the last one per key is
+ * kept, and they are all written out and synced together once
+ * flush_interval has passed since the first of them, or once they take
+ * up more than max_bytes. Until then, reads are answered from the
+ * pending changes.
+ *
+ * How much has been written is published in the module's property
+ * list, so it shows up in "pactl list modules". */
+
+typedef struct pa_database_cache pa_database_cache;
+
+/* Doesn't take ownership of the database, it has to stay open until
+ * the cache is freed */
+pa_database_cache* pa_database_cache_new(pa_module *m, pa_database *db, pa_usec_t flush_interval, size_t max_bytes);
+
+/* Flushes anything that is still pending */
+void pa_database_cache_free(pa_database_cache *c);
+
+pa_datum* pa_database_cache_get(pa_database_cache *c, const pa_datum *key, pa_datum* data);
+
+int pa_database_cache_set(pa_database_cache *c, const pa_datum *key, const pa_datum* data, pa_bool_t overwrite);
+int pa_database_cache_unset(pa_database_cache *c, const pa_datum *key);
+
+int pa_database_cache_clear(pa_database_cache *c);
+
+/* Iterating sees the pending changes, without flushing them */
+pa_datum* pa_database_cache_first(pa_database_cache *c, pa_datum *key, pa_datum *data /* may be NULL */);
+pa_datum* pa_database_cache_next(pa_database_cache *c, const pa_datum *key, pa_datum *next, pa_datum *data /* may be NULL */);
+
+/* Writes out and syncs everything that is pending right away */
+int pa_database_cache_flush(pa_database_cache *c);
+
+#endif
@@ -0,0 +1,1025 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "database.h"
+
+/* A database made of two files:
+ *
+ * The log (<fn>.<host>.mmap) is a header followed by records, which are
+ * only ever appended. Setting a key appends the key and its new data,
+ * removing it appends a deletion record. Every record carries a
+ * checksum, so a record that was only partially written when we crashed
+ * is detected and dropped.
+ *
+ * The index (<fn>.<host>.mmap-index) is an open addressing hash table
+ * that maps the hash of each key to the offset of its latest record in
+ * the log. Both files are mmap()ed, so a lookup touches one or two index
+ * slots and the record itself, and nothing needs to be loaded at
+ * startup.
+ *
+ * The index is marked dirty on disk before it is first modified after a
+ * sync, and marked clean again once the log has been flushed. If we
+ * find it dirty (or missing) when opening, it is rebuilt by replaying the
+ * log. When enough of the log is taken up by overwritten or deleted
+ * records, pa_database_sync() compacts it by writing the live records to
+ * a new file and renaming that over the old one. */
+
+#define LOG_MAGIC "PADBLOG"
+#define INDEX_MAGIC "PADBIDX"
+#define VERSION 1
+
+#define RECORD_DELETED ((uint32_t) -1)
+
+#define SLOT_EMPTY 0
+#define SLOT_DELETED 1
+
+#define MIN_SLOTS 64
+
+/* Compact once dead records take up more than half of a log of at
+ * least this size */
+#define COMPACT_MIN_SIZE (64*1024)
+
+#define ALIGN8(x) (((x) + 7) & ~((uint64_t) 7))
+
+struct log_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct record {
+    uint32_t checksum;  /* over the rest of the header, the key and the data */
+    uint32_t hash;
+    uint32_t key_size;
+    uint32_t data_size; /* RECORD_DELETED for a deletion */
+    /* key and data follow, padded to a multiple of 8 bytes */
+};
+
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t dirty;
+    uint64_t log_length; /* Valid length of the log, if not dirty */
+    uint64_t dead_bytes; /* Length of the log records that are no longer current */
+    uint32_t n_slots;    /* Power of two */
+    uint32_t n_live;     /* Slots that point to a record */
+    uint32_t n_used;     /* Slots that are not SLOT_EMPTY */
+    uint32_t reserved;
+};
+
+struct slot {
+    uint32_t hash;
+    uint32_t reserved;
+    uint64_t offset;     /* SLOT_EMPTY, SLOT_DELETED or a record offset */
+};
+
+typedef struct mmap_data {
+    char *filename;
+    char *index_filename;
+    pa_bool_t read_only;
+
+    int log_fd;
+    uint8_t *log;
+    size_t log_map_size;
+    uint64_t log_length;
+
+    /* Either a mapping of the index file or, when read-only, an
+     * anonymous mapping the index was rebuilt into */
+    int index_fd;
+    struct index_header *index;
+    size_t index_map_size;
+
+    pa_bool_t dirty;
+} mmap_data;
+
+void pa_datum_free(pa_datum *d) {
+    pa_assert(d);
+
+    pa_xfree(d->data);
+    d->data = NULL;
+    d->size = 0;
+}
+
+/* FNV-1a */
+static uint32_t hash_bytes(uint32_t hash, const void *p, size_t size) {
+    const uint8_t *c = p;
+
+    while (size-- > 0) {
+        hash ^= *(c++);
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static uint32_t key_hash(const void *key, size_t size) {
+    return hash_bytes(2166136261U, key, size);
+}
+
+static uint32_t record_checksum(const struct record *r, const void *key, const void *data) {
+    uint32_t sum;
+
+    sum = hash_bytes(2166136261U, &r->hash, sizeof(*r) - sizeof(r->checksum));
+    sum = hash_bytes(sum, key, r->key_size);
+
+    if (r->data_size != RECORD_DELETED)
+        sum = hash_bytes(sum, data, r->data_size);
+
+    return sum;
+}
+
+static uint64_t record_size(uint32_t key_size, uint32_t data_size) {
+    return ALIGN8(sizeof(struct record) + (uint64_t) key_size + (data_size == RECORD_DELETED ? 0 : data_size));
+}
+
+static struct slot *index_slots(mmap_data *db) {
+    return (struct slot*) ((uint8_t*) db->index + sizeof(struct index_header));
+}
+
+static const struct record *record_at(mmap_data *db, uint64_t offset) {
+    pa_assert(offset + sizeof(struct record) <= db->log_length);
+
+    return (const struct record*) (db->log + offset);
+}
+
+static const uint8_t *record_key(const struct record *r) {
+    return (const uint8_t*) r + sizeof(*r);
+}
+
+static const uint8_t *record_data(const struct record *r) {
+    return record_key(r) + r->key_size;
+}
+
+static int map_log(mmap_data *db, uint64_t length) {
+    size_t size;
+    void *p;
+
+    if (length <= db->log_map_size)
+        return 0;
+
+    /* Map more than we need, so that we don't have to remap on every
+     * append. Pages beyond the end of the file are never touched. */
+    size = PA_PAGE_ALIGN((size_t) PA_MAX(2 * length, (uint64_t) COMPACT_MIN_SIZE));
+
+    if ((p = mmap(NULL, size, PROT_READ, MAP_SHARED, db->log_fd, 0)) == MAP_FAILED) {
+        pa_log_warn("Failed to map %s: %s", db->filename, pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (db->log)
+        munmap(db->log, db->log_map_size);
+
+    db->log = p;
+    db->log_map_size = size;
+
+    return 0;
+}
+
+static void unmap_log(mmap_data *db) {
+    if (db->log)
+        munmap(db->log, db->log_map_size);
+
+    db->log = NULL;
+    db->log_map_size = 0;
+}
+
+static int map_index(mmap_data *db, uint32_t n_slots) {
+    size_t size;
+    void *p;
+
+    size = PA_PAGE_ALIGN(sizeof(struct index_header) + n_slots * sizeof(struct slot));
+
+    if (db->index_fd >= 0 && !db->read_only) {
+        if (ftruncate(db->index_fd, (off_t) size) < 0) {
+            pa_log_warn("Failed to resize %s: %s", db->index_filename, pa_cstrerror(errno));
+            return -1;
+        }
+
+        p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, db->index_fd, 0);
+    } else if (db->index_fd >= 0)
+        p = mmap(NULL, size, PROT_READ, MAP_SHARED, db->index_fd, 0);
+    else
+        p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) {
+        pa_log_warn("Failed to map the index: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (db->index)
+        munmap(db->index, db->index_map_size);
+
+    db->index = p;
+    db->index_map_size = size;
+
+    return 0;
+}
+
+/* Must be called before the log or the index is modified, so that
+ * a crash in the middle of the modification makes us rebuild the index
+ * on the next start */
+static int mark_dirty(mmap_data *db) {
+    if (db->dirty)
+        return 0;
+
+    db->index->dirty = 1;
+
+    if (db->index_fd >= 0 && msync(db->index, db->index_map_size, MS_SYNC) < 0) {
+        pa_log_warn("Failed to sync %s: %s", db->index_filename, pa_cstrerror(errno));
+        return -1;
+    }
+
+    db->dirty = TRUE;
+
+    return 0;
+}
+
+static void reset_index(mmap_data *db, uint32_t n_slots) {
+    memset(db->index, 0, sizeof(struct index_header));
+    memcpy(db->index->magic, INDEX_MAGIC, sizeof(db->index->magic));
+    db->index->version = VERSION;
+    db->index->dirty = db->dirty;
+    db->index->n_slots = n_slots;
+
+    memset(index_slots(db), 0, db->index->n_slots * sizeof(struct slot));
+}
+
+/* Returns the slot of the key, or -1 if it isn't in the index. In that
+ * case *free_slot is set to where it should be inserted. */
+static int64_t find_slot(mmap_data *db, const void *key, uint32_t key_size, uint32_t hash, uint32_t *free_slot) {
+    struct slot *slots = index_slots(db);
+    uint32_t mask = db->index->n_slots - 1;
+    uint32_t i, n;
+    pa_bool_t have_free = FALSE;
+
+    for (i = hash & mask, n = 0; n < db->index->n_slots; i = (i + 1) & mask, n++) {
+        const struct record *r;
+
+        if (slots[i].offset == SLOT_EMPTY) {
+            if (!have_free && free_slot)
+                *free_slot = i;
+
+            return -1;
+        }
+
+        if (slots[i].offset == SLOT_DELETED) {
+            if (!have_free && free_slot)
+                *free_slot = i;
+
+            have_free = TRUE;
+            continue;
+        }
+
+        if (slots[i].hash != hash)
+            continue;
+
+        r = record_at(db, slots[i].offset);
+
+        if (r->key_size == key_size && memcmp(record_key(r), key, key_size) == 0)
+            return i;
+    }
+
+    /* We never let the table fill up, but there may be no empty slot
+     * left between all the deleted ones */
+    pa_assert(have_free);
+
+    return -1;
+}
+
+static uint64_t slot_record_size(mmap_data *db, const struct slot *s) {
+    const struct record *r = record_at(db, s->offset);
+
+    return record_size(r->key_size, r->data_size);
+}
+
+static int grow_index(mmap_data *db) {
+    struct index_header h;
+    struct slot *old;
+    uint32_t n_slots, i;
+    size_t old_size;
+
+    /* Keep the table at most 3/4 full, counting deleted slots */
+    if ((uint64_t) (db->index->n_used + 1) * 4 <= (uint64_t) db->index->n_slots * 3)
+        return 0;
+
+    n_slots = db->index->n_slots;
+
+    /* If it's mostly deleted slots, rehashing at the same size is
+     * enough */
+    while ((uint64_t) (db->index->n_live + 1) * 2 > n_slots)
+        n_slots *= 2;
+
+    h = *db->index;
+    old_size = h.n_slots * sizeof(struct slot);
+    old = pa_xmemdup(index_slots(db), old_size);
+
+    if (map_index(db, n_slots) < 0) {
+        pa_xfree(old);
+        return -1;
+    }
+
+    /* An anonymous mapping starts out empty */
+    *db->index = h;
+    db->index->n_slots = n_slots;
+    db->index->n_used = db->index->n_live;
+    memset(index_slots(db), 0, db->index->n_slots * sizeof(struct slot));
+
+    for (i = 0; i < old_size / sizeof(struct slot); i++) {
+        struct slot *slots = index_slots(db);
+        uint32_t mask = db->index->n_slots - 1, k;
+
+        if (old[i].offset == SLOT_EMPTY || old[i].offset == SLOT_DELETED)
+            continue;
+
+        for (k = old[i].hash & mask; slots[k].offset != SLOT_EMPTY; k = (k + 1) & mask)
+            ;
+
+        slots[k] = old[i];
+    }
+
+    pa_xfree(old);
+
+    return 0;
+}
+
+/* Points the index at the record at offset, which must be the latest
+ * one for its key */
+static int index_record(mmap_data *db, uint64_t offset) {
+    const struct record *r = record_at(db, offset);
+    struct slot *slots;
+    uint32_t free_slot = 0;
+    int64_t i;
+
+    if (grow_index(db) < 0)
+        return -1;
+
+    slots = index_slots(db);
+    i = find_slot(db, record_key(r), r->key_size, r->hash, &free_slot);
+
+    if (r->data_size == RECORD_DELETED) {
+        /* The deletion record itself is dead right away */
+        db->index->dead_bytes += record_size(r->key_size, r->data_size);
+
+        if (i < 0)
+            return 0;
+
+        db->index->dead_bytes += slot_record_size(db, &slots[i]);
+        slots[i].offset = SLOT_DELETED;
+        db->index->n_live--;
+
+        return 0;
+    }
+
+    if (i >= 0) {
+        db->index->dead_bytes += slot_record_size(db, &slots[i]);
+        slots[i].offset = offset;
+
+        return 0;
+    }
+
+    if (slots[free_slot].offset == SLOT_EMPTY)
+        db->index->n_used++;
+
+    slots[free_slot].hash = r->hash;
+    slots[free_slot].offset = offset;
+    db->index->n_live++;
+
+    return 0;
+}
+
+static pa_bool_t record_valid(mmap_data *db, uint64_t offset, uint64_t length) {
+    const struct record *r;
+
+    if (offset + sizeof(struct record) > length)
+        return FALSE;
+
+    r = (const struct record*) (db->log + offset);
+
+    if (offset + record_size(r->key_size, r->data_size) > length)
+        return FALSE;
+
+    if (r->hash != key_hash(record_key(r), r->key_size))
+        return FALSE;
+
+    return r->checksum == record_checksum(r, record_key(r), record_data(r));
+}
+
+/* Replays the whole log into an empty index. Everything from the first
+ * broken record on is dropped. */
+static int rebuild_index(mmap_data *db, uint64_t file_length) {
+    uint64_t offset = sizeof(struct log_header);
+    unsigned n = 0;
+
+    if (map_index(db, MIN_SLOTS) < 0)
+        return -1;
+
+    reset_index(db, MIN_SLOTS);
+    db->log_length = sizeof(struct log_header);
+
+    if (!db->read_only && mark_dirty(db) < 0)
+        return -1;
+
+    if (file_length > db->log_length && map_log(db, file_length) < 0)
+        return -1;
+
+    while (record_valid(db, offset, file_length)) {
+        const struct record *r = (const struct record*) (db->log + offset);
+
+        db->log_length = offset + record_size(r->key_size, r->data_size);
+
+        if (index_record(db, offset) < 0)
+            return -1;
+
+        offset = db->log_length;
+        n++;
+    }
+
+    if (offset < file_length) {
+        pa_log_warn("Dropping %llu bytes of broken records at the end of %s.",
+                    (unsigned long long) (file_length - offset), db->filename);
+
+        if (!db->read_only && ftruncate(db->log_fd, (off_t) offset) < 0) {
+            pa_log_warn("Failed to truncate %s: %s", db->filename, pa_cstrerror(errno));
+            return -1;
+        }
+    }
+
+    db->index->log_length = db->log_length;
+
+    pa_log_debug("Rebuilt the index of %s from %u records, %u keys.", db->filename, n, db->index->n_live);
+
+    return 0;
+}
+
+static int write_log_header(int fd) {
+    struct log_header h;
+
+    pa_zero(h);
+    memcpy(h.magic, LOG_MAGIC, sizeof(h.magic));
+    h.version = VERSION;
+
+    if (pa_loop_write(fd, &h, sizeof(h), NULL) != (ssize_t) sizeof(h))
+        return -1;
+
+    return 0;
+}
+
+/* The index on disk may have been damaged without being marked dirty,
+ * so check that every slot points to a record we can read before any
+ * of them is followed */
+static pa_bool_t index_slots_valid(mmap_data *db) {
+    const struct slot *slots = index_slots(db);
+    uint32_t i, n_live = 0, n_used = 0;
+
+    for (i = 0; i < db->index->n_slots; i++) {
+        const struct record *r;
+
+        if (slots[i].offset == SLOT_EMPTY)
+            continue;
+
+        n_used++;
+
+        if (slots[i].offset == SLOT_DELETED)
+            continue;
+
+        if (slots[i].offset < sizeof(struct log_header) ||
+            slots[i].offset != ALIGN8(slots[i].offset) ||
+            slots[i].offset + sizeof(struct record) > db->log_length)
+            return FALSE;
+
+        r = (const struct record*) (db->log + slots[i].offset);
+
+        if (r->data_size == RECORD_DELETED ||
+            slots[i].offset + record_size(r->key_size, r->data_size) > db->log_length ||
+            r->hash != slots[i].hash)
+            return FALSE;
+
+        n_live++;
+    }
+
+    return n_live == db->index->n_live &&
+        n_used == db->index->n_used &&
+        (uint64_t) n_used * 4 <= (uint64_t) db->index->n_slots * 3 &&
+        db->index->dead_bytes <= db->log_length;
+}
+
+static pa_bool_t index_usable(mmap_data *db, uint64_t file_length) {
+    struct index_header h;
+    struct stat st;
+
+    if (db->index_fd < 0)
+        return FALSE;
+
+    if (pa_loop_read(db->index_fd, &h, sizeof(h), NULL) != (ssize_t) sizeof(h))
+        return FALSE;
+
+    if (memcmp(h.magic, INDEX_MAGIC, sizeof(h.magic)) != 0 || h.version != VERSION || h.dirty)
+        return FALSE;
+
+    if (h.n_slots < MIN_SLOTS || (h.n_slots & (h.n_slots - 1)) != 0 || h.log_length > file_length)
+        return FALSE;
+
+    if (fstat(db->index_fd, &st) < 0 || (uint64_t) st.st_size < sizeof(struct index_header) + (uint64_t) h.n_slots * sizeof(struct slot))
+        return FALSE;
+
+    if (h.log_length < sizeof(struct log_header))
+        return FALSE;
+
+    if (map_index(db, h.n_slots) < 0)
+        return FALSE;
+
+    db->log_length = h.log_length;
+
+    if (map_log(db, db->log_length) < 0)
+        return FALSE;
+
+    if (!index_slots_valid(db)) {
+        pa_log_warn("The index of %s is corrupt, rebuilding it.", db->filename);
+        return FALSE;
+    }
+
+    /* Anything beyond the synced length was written after the last
+     * sync and isn't in the index. Only happens if we crashed before
+     * marking the index dirty, i.e. while appending to the log. */
+    if (file_length > db->log_length && !db->read_only && ftruncate(db->log_fd, (off_t) db->log_length) < 0)
+        return FALSE;
+
+    return TRUE;
+}
+
+static int open_log(mmap_data *db, uint64_t *file_length) {
+    struct log_header h;
+    struct stat st;
+
+    if ((db->log_fd = pa_open_cloexec(db->filename, db->read_only ? O_RDONLY : O_RDWR|O_CREAT, 0644)) < 0)
+        return -1;
+
+    if (fstat(db->log_fd, &st) < 0)
+        return -1;
+
+    if (st.st_size == 0 && !db->read_only) {
+        if (write_log_header(db->log_fd) < 0)
+            return -1;
+
+        *file_length = sizeof(h);
+        return 0;
+    }
+
+    if (pa_loop_read(db->log_fd, &h, sizeof(h), NULL) != (ssize_t) sizeof(h) ||
+        memcmp(h.magic, LOG_MAGIC, sizeof(h.magic)) != 0 || h.version != VERSION) {
+        pa_log_warn("%s is not a database file.", db->filename);
+        errno = EINVAL;
+        return -1;
+    }
+
+    *file_length = (uint64_t) st.st_size;
+
+    return 0;
+}
+
+pa_database* pa_database_open(const char *fn, pa_bool_t for_write) {
+    mmap_data *db;
+    uint64_t file_length = 0;
+    int saved_errno;
+
+    pa_assert(fn);
+
+    db = pa_xnew0(mmap_data, 1);
+    db->filename = pa_sprintf_malloc("%s."CANONICAL_HOST".mmap", fn);
+    db->index_filename = pa_sprintf_malloc("%s."CANONICAL_HOST".mmap-index", fn);
+    db->read_only = !for_write;
+    db->log_fd = db->index_fd = -1;
+
+    errno = 0;
+
+    if (open_log(db, &file_length) < 0) {
+        /* A database that doesn't exist yet is empty */
+        if (errno != ENOENT || !db->read_only)
+            goto fail;
+
+        db->log_length = file_length = sizeof(struct log_header);
+
+        if (map_index(db, MIN_SLOTS) < 0)
+            goto fail;
+
+        reset_index(db, MIN_SLOTS);
+
+        return (pa_database*) db;
+    }
+
+    db->index_fd = pa_open_cloexec(db->index_filename, db->read_only ? O_RDONLY : O_RDWR|O_CREAT, 0644);
+
+    if (index_usable(db, file_length))
+        return (pa_database*) db;
+
+    if (db->index)
+        munmap(db->index, db->index_map_size);
+    db->index = NULL;
+
+    /* We can't fix up an index we may not write to, so rebuild it into
+     * memory instead */
+    if (db->read_only && db->index_fd >= 0) {
+        pa_close(db->index_fd);
+        db->index_fd = -1;
+    }
+
+    if (rebuild_index(db, file_length) < 0)
+        goto fail;
+
+    if (!db->read_only && pa_database_sync((pa_database*) db) < 0)
+        goto fail;
+
+    return (pa_database*) db;
+
+fail:
+    saved_errno = errno ? errno : EIO;
+
+    pa_log_warn("Failed to open database %s: %s", db->filename, pa_cstrerror(saved_errno));
+
+    unmap_log(db);
+    if (db->index)
+        munmap(db->index, db->index_map_size);
+    if (db->log_fd >= 0)
+        pa_close(db->log_fd);
+    if (db->index_fd >= 0)
+        pa_close(db->index_fd);
+
+    pa_xfree(db->filename);
+    pa_xfree(db->index_filename);
+    pa_xfree(db);
+
+    errno = saved_errno;
+
+    return NULL;
+}
+
+void pa_database_close(pa_database *database) {
+    mmap_data *db = (mmap_data*)database;
+    pa_assert(db);
+
+    pa_database_sync(database);
+
+    unmap_log(db);
+    munmap(db->index, db->index_map_size);
+
+    if (db->log_fd >= 0)
+        pa_close(db->log_fd);
+    if (db->index_fd >= 0)
+        pa_close(db->index_fd);
+
+    pa_xfree(db->filename);
+    pa_xfree(db->index_filename);
+    pa_xfree(db);
+}
+
+static const struct record *lookup(mmap_data *db, const pa_datum *key) {
+    int64_t i;
+
+    i = find_slot(db, key->data, (uint32_t) key->size, key_hash(key->data, key->size), NULL);
+
+    if (i < 0)
+        return NULL;
+
+    return record_at(db, index_slots(db)[i].offset);
+}
+
+static void copy_datum(pa_datum *d, const uint8_t *p, size_t size) {
+    d->data = size > 0 ? pa_xmemdup(p, size) : NULL;
+    d->size = size;
+}
+
+pa_datum* pa_database_get(pa_database *database, const pa_datum *key, pa_datum* data) {
+    mmap_data *db = (mmap_data*)database;
+    const struct record *r;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(data);
+
+    if (!(r = lookup(db, key)))
+        return NULL;
+
+    copy_datum(data, record_data(r), r->data_size);
+
+    return data;
+}
+
+static int append_record(mmap_data *db, const pa_datum *key, const pa_datum *data) {
+    struct record *r;
+    uint64_t size, offset;
+    uint8_t *buf;
+
+    if (key->size >= RECORD_DELETED || (data && data->size >= RECORD_DELETED))
+        return -1;
+
+    if (mark_dirty(db) < 0)
+        return -1;
+
+    size = record_size((uint32_t) key->size, data ? (uint32_t) data->size : RECORD_DELETED);
+    buf = pa_xmalloc0((size_t) size);
+
+    r = (struct record*) buf;
+    r->hash = key_hash(key->data, key->size);
+    r->key_size = (uint32_t) key->size;
+    r->data_size = data ? (uint32_t) data->size : RECORD_DELETED;
+
+    if (key->size > 0)
+        memcpy(buf + sizeof(*r), key->data, key->size);
+    if (data && data->size > 0)
+        memcpy(buf + sizeof(*r) + key->size, data->data, data->size);
+
+    r->checksum = record_checksum(r, buf + sizeof(*r), buf + sizeof(*r) + key->size);
+
+    offset = db->log_length;
+
+    if (lseek(db->log_fd, (off_t) offset, SEEK_SET) == (off_t) -1 ||
+        pa_loop_write(db->log_fd, buf, (size_t) size, NULL) != (ssize_t) size) {
+        pa_log_warn("Failed to write to %s: %s", db->filename, pa_cstrerror(errno));
+        pa_xfree(buf);
+
+        /* Don't leave a partial record behind for the next append to
+         * follow */
+        if (ftruncate(db->log_fd, (off_t) offset) < 0)
+            pa_log_warn("Failed to truncate %s: %s", db->filename, pa_cstrerror(errno));
+
+        return -1;
+    }
+
+    pa_xfree(buf);
+
+    if (map_log(db, offset + size) < 0)
+        return -1;
+
+    db->log_length = offset + size;
+
+    return index_record(db, offset);
+}
+
+int pa_database_set(pa_database *database, const pa_datum *key, const pa_datum* data, pa_bool_t overwrite) {
+    mmap_data *db = (mmap_data*)database;
+    const struct record *r;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(data);
+
+    if (db->read_only)
+        return -1;
+
+    if ((r = lookup(db, key))) {
+        if (!overwrite)
+            return -1;
+
+        /* Don't grow the log for nothing, the restore modules tend to
+         * save the same thing over and over */
+        if (r->data_size == data->size && (data->size == 0 || memcmp(record_data(r), data->data, data->size) == 0))
+            return 0;
+    }
+
+    return append_record(db, key, data);
+}
+
+int pa_database_unset(pa_database *database, const pa_datum *key) {
+    mmap_data *db = (mmap_data*)database;
+
+    pa_assert(db);
+    pa_assert(key);
+
+    if (db->read_only)
+        return -1;
+
+    if (!lookup(db, key))
+        return -1;
+
+    return append_record(db, key, NULL);
+}
+
+int pa_database_clear(pa_database *database) {
+    mmap_data *db = (mmap_data*)database;
+
+    pa_assert(db);
+
+    if (db->read_only)
+        return -1;
+
+    if (mark_dirty(db) < 0)
+        return -1;
+
+    if (ftruncate(db->log_fd, (off_t) sizeof(struct log_header)) < 0) {
+        pa_log_warn("Failed to truncate %s: %s", db->filename, pa_cstrerror(errno));
+        return -1;
+    }
+
+    db->log_length = sizeof(struct log_header);
+    reset_index(db, db->index->n_slots);
+
+    return 0;
+}
+
+signed pa_database_size(pa_database *database) {
+    mmap_data *db = (mmap_data*)database;
+    pa_assert(db);
+
+    return (signed) db->index->n_live;
+}
+
+/* Returns the first slot from i on that points to a record */
+static const struct record *live_record_from(mmap_data *db, uint32_t i) {
+    struct slot *slots = index_slots(db);
+
+    for (; i < db->index->n_slots; i++)
+        if (slots[i].offset != SLOT_EMPTY && slots[i].offset != SLOT_DELETED)
+            return record_at(db, slots[i].offset);
+
+    return NULL;
+}
+
+static pa_datum *return_record(const struct record *r, pa_datum *key, pa_datum *data) {
+    if (!r)
+        return NULL;
+
+    copy_datum(key, record_key(r), r->key_size);
+
+    if (data)
+        copy_datum(data, record_data(r), r->data_size);
+
+    return key;
+}
+
+pa_datum* pa_database_first(pa_database *database, pa_datum *key, pa_datum *data) {
+    mmap_data *db = (mmap_data*)database;
+
+    pa_assert(db);
+    pa_assert(key);
+
+    return return_record(live_record_from(db, 0), key, data);
+}
+
+pa_datum* pa_database_next(pa_database *database, const pa_datum *key, pa_datum *next, pa_datum *data) {
+    mmap_data *db = (mmap_data*)database;
+    int64_t i;
+
+    pa_assert(db);
+    pa_assert(next);
+
+    if (!key)
+        return pa_database_first(database, next, data);
+
+    i = find_slot(db, key->data, (uint32_t) key->size, key_hash(key->data, key->size), NULL);
+
+    if (i < 0)
+        return NULL;
+
+    return return_record(live_record_from(db, (uint32_t) i + 1), next, data);
+}
+
+/* Writes the current records to a new log and replaces the old one
+ * with it */
+static int compact(mmap_data *db) {
+    struct slot *slots = index_slots(db);
+    uint64_t *offsets = NULL, length;
+    char *tmp_filename;
+    int fd;
+    uint32_t i;
+
+    pa_assert(db->dirty);
+
+    tmp_filename = pa_sprintf_malloc("%s.tmp", db->filename);
+
+    if ((fd = pa_open_cloexec(tmp_filename, O_RDWR|O_CREAT|O_TRUNC, 0644)) < 0) {
+        pa_log_warn("Failed to open %s: %s", tmp_filename, pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (write_log_header(fd) < 0)
+        goto fail;
+
+    length = sizeof(struct log_header);
+    offsets = pa_xnew(uint64_t, db->index->n_slots);
+
+    for (i = 0; i < db->index->n_slots; i++) {
+        const struct record *r;
+        uint64_t size;
+
+        if (slots[i].offset == SLOT_EMPTY || slots[i].offset == SLOT_DELETED)
+            continue;
+
+        r = record_at(db, slots[i].offset);
+        size = record_size(r->key_size, r->data_size);
+
+        if (pa_loop_write(fd, r, (size_t) size, NULL) != (ssize_t) size)
+            goto fail;
+
+        offsets[i] = length;
+        length += size;
+    }
+
+    if (fdatasync(fd) < 0)
+        goto fail;
+
+    if (rename(tmp_filename, db->filename) < 0)
+        goto fail;
+
+    pa_log_debug("Compacted %s from %llu to %llu bytes.", db->filename,
+                 (unsigned long long) db->log_length, (unsigned long long) length);
+
+    unmap_log(db);
+    pa_close(db->log_fd);
+    db->log_fd = fd;
+    db->log_length = length;
+
+    for (i = 0; i < db->index->n_slots; i++)
+        if (slots[i].offset != SLOT_EMPTY && slots[i].offset != SLOT_DELETED)
+            slots[i].offset = offsets[i];
+
+    db->index->dead_bytes = 0;
+
+    pa_xfree(offsets);
+    pa_xfree(tmp_filename);
+
+    /* If this fails we can't read the records anymore, and there's no
+     * good way to recover */
+    pa_assert_se(map_log(db, db->log_length) >= 0);
+
+    return 0;
+
+fail:
+    pa_log_warn("Failed to compact %s: %s", db->filename, pa_cstrerror(errno));
+
+    if (fd >= 0) {
+        pa_close(fd);
+        unlink(tmp_filename);
+    }
+
+    pa_xfree(offsets);
+    pa_xfree(tmp_filename);
+
+    return -1;
+}
+
+int pa_database_sync(pa_database *database) {
+    mmap_data *db = (mmap_data*)database;
+
+    pa_assert(db);
+
+    if (db->read_only || !db->dirty)
+        return 0;
+
+    /* A failed compaction leaves everything as it was, so just carry
+     * on */
+    if (db->log_length >= COMPACT_MIN_SIZE && db->index->dead_bytes * 2 > db->log_length)
+        compact(db);
+
+    if (fdatasync(db->log_fd) < 0)
+        goto fail;
+
+    db->index->log_length = db->log_length;
+    db->index->dirty = 0;
+
+    if (msync(db->index, db->index_map_size, MS_SYNC) < 0)
+        goto fail;
+
+    db->dirty = FALSE;
+
+    return 0;
+
+fail:
+    pa_log_warn("Failed to sync %s: %s", db->filename, pa_cstrerror(errno));
+
+    return -1;
+}
@@ -115,6 +115,7 @@ pa_fdsem *pa_fdsem_new_shm(pa_fdsem_data *data, int* event_fd) {
         return NULL;
     }
 
+    *event_fd = f->efd;
     f->fds[0] = f->fds[1] = -1;
     f->data = data;
 
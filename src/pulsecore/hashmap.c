@@ -32,11 +32,15 @@
 
 #include "hashmap.h"
 
-#define NBUCKETS 127
+/* The bucket array grows when there are more entries than buckets and
+ * shrinks when it is less than a quarter full. Its size is always a
+ * power of two, no less than 1 << BUCKET_BITS_MIN. */
+#define BUCKET_BITS_MIN 7
 
 struct hashmap_entry {
     const void *key;
     void *value;
+    unsigned hash;
 
     struct hashmap_entry *bucket_next, *bucket_previous;
     struct hashmap_entry *iterate_next, *iterate_previous;
@@ -46,28 +50,65 @@ struct pa_hashmap {
     pa_hash_func_t hash_func;
     pa_compare_func_t compare_func;
 
+    struct hashmap_entry **buckets;
+    unsigned n_buckets, bucket_bits;
+
     struct hashmap_entry *iterate_list_head, *iterate_list_tail;
     unsigned n_entries;
 };
 
-#define BY_HASH(h) ((struct hashmap_entry**) ((uint8_t*) (h) + PA_ALIGN(sizeof(pa_hashmap))))
-
 PA_STATIC_FLIST_DECLARE(entries, 0, pa_xfree);
 
+/* Fibonacci hashing: take the top bits of the product, so that hash
+ * functions which leave the low bits constant (like pointers) still
+ * spread over all buckets */
+static inline unsigned bucket_of(pa_hashmap *h, unsigned hash) {
+    return (unsigned) (((uint32_t) hash * UINT32_C(0x9E3779B1)) >> (32 - h->bucket_bits));
+}
+
 pa_hashmap *pa_hashmap_new(pa_hash_func_t hash_func, pa_compare_func_t compare_func) {
     pa_hashmap *h;
 
-    h = pa_xmalloc0(PA_ALIGN(sizeof(pa_hashmap)) + NBUCKETS*sizeof(struct hashmap_entry*));
+    h = pa_xnew(pa_hashmap, 1);
 
     h->hash_func = hash_func ? hash_func : pa_idxset_trivial_hash_func;
     h->compare_func = compare_func ? compare_func : pa_idxset_trivial_compare_func;
 
+    h->bucket_bits = BUCKET_BITS_MIN;
+    h->n_buckets = 1U << BUCKET_BITS_MIN;
+    h->buckets = pa_xnew0(struct hashmap_entry*, h->n_buckets);
+
     h->n_entries = 0;
     h->iterate_list_head = h->iterate_list_tail = NULL;
 
     return h;
 }
 
+static void resize(pa_hashmap *h, unsigned bucket_bits) {
+    struct hashmap_entry *e;
+
+    pa_assert(h);
+    pa_assert(bucket_bits < 32);
+
+    pa_xfree(h->buckets);
+
+    h->bucket_bits = bucket_bits;
+    h->n_buckets = 1U << bucket_bits;
+    h->buckets = pa_xnew0(struct hashmap_entry*, h->n_buckets);
+
+    /* The order within a bucket doesn't matter, so we can simply walk
+     * the iteration list */
+    for (e = h->iterate_list_head; e; e = e->iterate_next) {
+        unsigned b = bucket_of(h, e->hash);
+
+        e->bucket_next = h->buckets[b];
+        e->bucket_previous = NULL;
+        if (h->buckets[b])
+            h->buckets[b]->bucket_previous = e;
+        h->buckets[b] = e;
+    }
+}
+
 static void remove_entry(pa_hashmap *h, struct hashmap_entry *e) {
     pa_assert(h);
     pa_assert(e);
@@ -89,32 +130,33 @@ static void remove_entry(pa_hashmap *h, struct hashmap_entry *e) {
 
     if (e->bucket_previous)
         e->bucket_previous->bucket_next = e->bucket_next;
-    else {
-        unsigned hash = h->hash_func(e->key) % NBUCKETS;
-        BY_HASH(h)[hash] = e->bucket_next;
-    }
+    else
+        h->buckets[bucket_of(h, e->hash)] = e->bucket_next;
 
     if (pa_flist_push(PA_STATIC_FLIST_GET(entries), e) < 0)
         pa_xfree(e);
 
     pa_assert(h->n_entries >= 1);
     h->n_entries--;
+
+    if (h->bucket_bits > BUCKET_BITS_MIN && h->n_entries < h->n_buckets / 4)
+        resize(h, h->bucket_bits - 1);
 }
 
 void pa_hashmap_free(pa_hashmap *h, pa_free_cb_t free_cb) {
     pa_assert(h);
 
     pa_hashmap_remove_all(h, free_cb);
+    pa_xfree(h->buckets);
     pa_xfree(h);
 }
 
 static struct hashmap_entry *hash_scan(pa_hashmap *h, unsigned hash, const void *key) {
     struct hashmap_entry *e;
     pa_assert(h);
-    pa_assert(hash < NBUCKETS);
 
-    for (e = BY_HASH(h)[hash]; e; e = e->bucket_next)
-        if (h->compare_func(e->key, key) == 0)
+    for (e = h->buckets[bucket_of(h, hash)]; e; e = e->bucket_next)
+        if (e->hash == hash && h->compare_func(e->key, key) == 0)
             return e;
 
     return NULL;
@@ -122,27 +164,32 @@ static struct hashmap_entry *hash_scan(pa_hashmap *h, unsigned hash, const void
 
 int pa_hashmap_put(pa_hashmap *h, const void *key, void *value) {
     struct hashmap_entry *e;
-    unsigned hash;
+    unsigned hash, b;
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
     if (hash_scan(h, hash, key))
         return -1;
 
+    if (h->n_entries >= h->n_buckets)
+        resize(h, h->bucket_bits + 1);
+
     if (!(e = pa_flist_pop(PA_STATIC_FLIST_GET(entries))))
         e = pa_xnew(struct hashmap_entry, 1);
 
     e->key = key;
     e->value = value;
+    e->hash = hash;
 
     /* Insert into hash table */
-    e->bucket_next = BY_HASH(h)[hash];
+    b = bucket_of(h, hash);
+    e->bucket_next = h->buckets[b];
     e->bucket_previous = NULL;
-    if (BY_HASH(h)[hash])
-        BY_HASH(h)[hash]->bucket_previous = e;
-    BY_HASH(h)[hash] = e;
+    if (h->buckets[b])
+        h->buckets[b]->bucket_previous = e;
+    h->buckets[b] = e;
 
     /* Insert into iteration list */
     e->iterate_previous = h->iterate_list_tail;
@@ -168,7 +215,7 @@ void* pa_hashmap_get(pa_hashmap *h, const void *key) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
     if (!(e = hash_scan(h, hash, key)))
         return NULL;
@@ -183,7 +230,7 @@ void* pa_hashmap_remove(pa_hashmap *h, const void *key) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
     if (!(e = hash_scan(h, hash, key)))
         return NULL;
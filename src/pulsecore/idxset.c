@@ -34,11 +34,15 @@
 
 #include "idxset.h"
 
-#define NBUCKETS 127
+/* Both bucket arrays grow when there are more entries than buckets
+ * and shrink when they are less than a quarter full. Their size is
+ * always a power of two, no less than 1 << BUCKET_BITS_MIN. */
+#define BUCKET_BITS_MIN 7
 
 struct idxset_entry {
     uint32_t idx;
     void *data;
+    unsigned data_hash;
 
     struct idxset_entry *data_next, *data_previous;
     struct idxset_entry *index_next, *index_previous;
@@ -51,15 +55,26 @@ struct pa_idxset {
 
     uint32_t current_index;
 
+    /* The data buckets followed by the index buckets */
+    struct idxset_entry **buckets;
+    unsigned n_buckets, bucket_bits;
+
     struct idxset_entry *iterate_list_head, *iterate_list_tail;
     unsigned n_entries;
 };
 
-#define BY_DATA(i) ((struct idxset_entry**) ((uint8_t*) (i) + PA_ALIGN(sizeof(pa_idxset))))
-#define BY_INDEX(i) (BY_DATA(i) + NBUCKETS)
+#define BY_DATA(i) ((i)->buckets)
+#define BY_INDEX(i) ((i)->buckets + (i)->n_buckets)
 
 PA_STATIC_FLIST_DECLARE(entries, 0, pa_xfree);
 
+/* Fibonacci hashing: take the top bits of the product, so that hash
+ * functions which leave the low bits constant (like pointers) still
+ * spread over all buckets */
+static inline unsigned bucket_of(pa_idxset *s, unsigned hash) {
+    return (unsigned) (((uint32_t) hash * UINT32_C(0x9E3779B1)) >> (32 - s->bucket_bits));
+}
+
 unsigned pa_idxset_string_hash_func(const void *p) {
     unsigned hash = 0;
     const char *c;
@@ -85,11 +100,15 @@ int pa_idxset_trivial_compare_func(const void *a, const void *b) {
 pa_idxset* pa_idxset_new(pa_hash_func_t hash_func, pa_compare_func_t compare_func) {
     pa_idxset *s;
 
-    s = pa_xmalloc0(PA_ALIGN(sizeof(pa_idxset)) + NBUCKETS*2*sizeof(struct idxset_entry*));
+    s = pa_xnew(pa_idxset, 1);
 
     s->hash_func = hash_func ? hash_func : pa_idxset_trivial_hash_func;
     s->compare_func = compare_func ? compare_func : pa_idxset_trivial_compare_func;
 
+    s->bucket_bits = BUCKET_BITS_MIN;
+    s->n_buckets = 1U << BUCKET_BITS_MIN;
+    s->buckets = pa_xnew0(struct idxset_entry*, s->n_buckets * 2);
+
     s->current_index = 0;
     s->n_entries = 0;
     s->iterate_list_head = s->iterate_list_tail = NULL;
@@ -97,6 +116,44 @@ pa_idxset* pa_idxset_new(pa_hash_func_t hash_func, pa_compare_func_t compare_fun
     return s;
 }
 
+static void link_entry(pa_idxset *s, struct idxset_entry *e) {
+    unsigned hash;
+
+    /* Insert into data hash table */
+    hash = bucket_of(s, e->data_hash);
+    e->data_next = BY_DATA(s)[hash];
+    e->data_previous = NULL;
+    if (BY_DATA(s)[hash])
+        BY_DATA(s)[hash]->data_previous = e;
+    BY_DATA(s)[hash] = e;
+
+    /* Insert into index hash table */
+    hash = bucket_of(s, e->idx);
+    e->index_next = BY_INDEX(s)[hash];
+    e->index_previous = NULL;
+    if (BY_INDEX(s)[hash])
+        BY_INDEX(s)[hash]->index_previous = e;
+    BY_INDEX(s)[hash] = e;
+}
+
+static void resize(pa_idxset *s, unsigned bucket_bits) {
+    struct idxset_entry *e;
+
+    pa_assert(s);
+    pa_assert(bucket_bits < 32);
+
+    pa_xfree(s->buckets);
+
+    s->bucket_bits = bucket_bits;
+    s->n_buckets = 1U << bucket_bits;
+    s->buckets = pa_xnew0(struct idxset_entry*, s->n_buckets * 2);
+
+    /* The order within a bucket doesn't matter, so we can simply walk
+     * the iteration list */
+    for (e = s->iterate_list_head; e; e = e->iterate_next)
+        link_entry(s, e);
+}
+
 static void remove_entry(pa_idxset *s, struct idxset_entry *e) {
     pa_assert(s);
     pa_assert(e);
@@ -118,10 +175,8 @@ static void remove_entry(pa_idxset *s, struct idxset_entry *e) {
 
     if (e->data_previous)
         e->data_previous->data_next = e->data_next;
-    else {
-        unsigned hash = s->hash_func(e->data) % NBUCKETS;
-        BY_DATA(s)[hash] = e->data_next;
-    }
+    else
+        BY_DATA(s)[bucket_of(s, e->data_hash)] = e->data_next;
 
     /* Remove from index hash table */
     if (e->index_next)
@@ -130,41 +185,43 @@ static void remove_entry(pa_idxset *s, struct idxset_entry *e) {
     if (e->index_previous)
         e->index_previous->index_next = e->index_next;
     else
-        BY_INDEX(s)[e->idx % NBUCKETS] = e->index_next;
+        BY_INDEX(s)[bucket_of(s, e->idx)] = e->index_next;
 
     if (pa_flist_push(PA_STATIC_FLIST_GET(entries), e) < 0)
         pa_xfree(e);
 
     pa_assert(s->n_entries >= 1);
     s->n_entries--;
+
+    if (s->bucket_bits > BUCKET_BITS_MIN && s->n_entries < s->n_buckets / 4)
+        resize(s, s->bucket_bits - 1);
 }
 
 void pa_idxset_free(pa_idxset *s, pa_free_cb_t free_cb) {
     pa_assert(s);
 
     pa_idxset_remove_all(s, free_cb);
+    pa_xfree(s->buckets);
     pa_xfree(s);
 }
 
 static struct idxset_entry* data_scan(pa_idxset *s, unsigned hash, const void *p) {
     struct idxset_entry *e;
     pa_assert(s);
-    pa_assert(hash < NBUCKETS);
     pa_assert(p);
 
-    for (e = BY_DATA(s)[hash]; e; e = e->data_next)
-        if (s->compare_func(e->data, p) == 0)
+    for (e = BY_DATA(s)[bucket_of(s, hash)]; e; e = e->data_next)
+        if (e->data_hash == hash && s->compare_func(e->data, p) == 0)
             return e;
 
     return NULL;
 }
 
-static struct idxset_entry* index_scan(pa_idxset *s, unsigned hash, uint32_t idx) {
+static struct idxset_entry* index_scan(pa_idxset *s, uint32_t idx) {
     struct idxset_entry *e;
     pa_assert(s);
-    pa_assert(hash < NBUCKETS);
 
-    for (e = BY_INDEX(s)[hash]; e; e = e->index_next)
+    for (e = BY_INDEX(s)[bucket_of(s, idx)]; e; e = e->index_next)
         if (e->idx == idx)
             return e;
 
@@ -177,7 +234,7 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
 
     pa_assert(s);
 
-    hash = s->hash_func(p) % NBUCKETS;
+    hash = s->hash_func(p);
 
     if ((e = data_scan(s, hash, p))) {
         if (idx)
@@ -186,27 +243,17 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
         return -1;
     }
 
+    if (s->n_entries >= s->n_buckets)
+        resize(s, s->bucket_bits + 1);
+
     if (!(e = pa_flist_pop(PA_STATIC_FLIST_GET(entries))))
         e = pa_xnew(struct idxset_entry, 1);
 
     e->data = p;
+    e->data_hash = hash;
     e->idx = s->current_index++;
 
-    /* Insert into data hash table */
-    e->data_next = BY_DATA(s)[hash];
-    e->data_previous = NULL;
-    if (BY_DATA(s)[hash])
-        BY_DATA(s)[hash]->data_previous = e;
-    BY_DATA(s)[hash] = e;
-
-    hash = e->idx % NBUCKETS;
-
-    /* Insert into index hash table */
-    e->index_next = BY_INDEX(s)[hash];
-    e->index_previous = NULL;
-    if (BY_INDEX(s)[hash])
-        BY_INDEX(s)[hash]->index_previous = e;
-    BY_INDEX(s)[hash] = e;
+    link_entry(s, e);
 
     /* Insert into iteration list */
     e->iterate_previous = s->iterate_list_tail;
@@ -230,14 +277,11 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
 }
 
 void* pa_idxset_get_by_index(pa_idxset*s, uint32_t idx) {
-    unsigned hash;
     struct idxset_entry *e;
 
     pa_assert(s);
 
-    hash = idx % NBUCKETS;
-
-    if (!(e = index_scan(s, hash, idx)))
+    if (!(e = index_scan(s, idx)))
         return NULL;
 
     return e->data;
@@ -249,7 +293,7 @@ void* pa_idxset_get_by_data(pa_idxset*s, const void *p, uint32_t *idx) {
 
     pa_assert(s);
 
-    hash = s->hash_func(p) % NBUCKETS;
+    hash = s->hash_func(p);
 
     if (!(e = data_scan(s, hash, p)))
         return NULL;
@@ -262,14 +306,11 @@ void* pa_idxset_get_by_data(pa_idxset*s, const void *p, uint32_t *idx) {
 
 void* pa_idxset_remove_by_index(pa_idxset*s, uint32_t idx) {
     struct idxset_entry *e;
-    unsigned hash;
     void *data;
 
     pa_assert(s);
 
-    hash = idx % NBUCKETS;
-
-    if (!(e = index_scan(s, hash, idx)))
+    if (!(e = index_scan(s, idx)))
         return NULL;
 
     data = e->data;
@@ -285,7 +326,7 @@ void* pa_idxset_remove_by_data(pa_idxset*s, const void *data, uint32_t *idx) {
 
     pa_assert(s);
 
-    hash = s->hash_func(data) % NBUCKETS;
+    hash = s->hash_func(data);
 
     if (!(e = data_scan(s, hash, data)))
         return NULL;
@@ -314,15 +355,12 @@ void pa_idxset_remove_all(pa_idxset *s, pa_free_cb_t free_cb) {
 }
 
 void* pa_idxset_rrobin(pa_idxset *s, uint32_t *idx) {
-    unsigned hash;
     struct idxset_entry *e;
 
     pa_assert(s);
     pa_assert(idx);
 
-    hash = *idx % NBUCKETS;
-
-    e = index_scan(s, hash, *idx);
+    e = index_scan(s, *idx);
 
     if (e && e->iterate_next)
         e = e->iterate_next;
@@ -404,7 +442,6 @@ void* pa_idxset_first(pa_idxset *s, uint32_t *idx) {
 
 void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
     struct idxset_entry *e;
-    unsigned hash;
 
     pa_assert(s);
     pa_assert(idx);
@@ -412,9 +449,7 @@ void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
     if (*idx == PA_IDXSET_INVALID)
         return NULL;
 
-    hash = *idx % NBUCKETS;
-
-    if ((e = index_scan(s, hash, *idx))) {
+    if ((e = index_scan(s, *idx))) {
 
         e = e->iterate_next;
 
@@ -433,9 +468,7 @@ void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
 
         for ((*idx)++; *idx < s->current_index; (*idx)++) {
 
-            hash = *idx % NBUCKETS;
-
-            if ((e = index_scan(s, hash, *idx))) {
+            if ((e = index_scan(s, *idx))) {
                 *idx = e->idx;
                 return e->data;
             }
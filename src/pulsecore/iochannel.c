@@ -250,6 +250,69 @@ ssize_t pa_iochannel_read(pa_iochannel*io, void*data, size_t l) {
     return r;
 }
 
+#ifdef HAVE_SYS_UIO_H
+
+ssize_t pa_iochannel_writev(pa_iochannel*io, const struct iovec *iov, int n) {
+    ssize_t r;
+
+    pa_assert(io);
+    pa_assert(iov);
+    pa_assert(n > 0);
+    pa_assert(io->ofd >= 0);
+
+    for (;;) {
+        if (io->ofd_type == 0) {
+            struct msghdr mh;
+
+            pa_zero(mh);
+            mh.msg_iov = (struct iovec*) iov;
+            mh.msg_iovlen = (size_t) n;
+
+            /* Like pa_write() we use sendmsg() on sockets, so that a
+             * hung up peer doesn't SIGPIPE us */
+            if ((r = sendmsg(io->ofd, &mh, MSG_NOSIGNAL)) < 0 && errno == ENOTSOCK) {
+                io->ofd_type = 1;
+                continue;
+            }
+        } else
+            r = writev(io->ofd, iov, n);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        break;
+    }
+
+    if (r >= 0) {
+        io->writable = io->hungup = FALSE;
+        enable_events(io);
+    }
+
+    return r;
+}
+
+ssize_t pa_iochannel_readv(pa_iochannel*io, const struct iovec *iov, int n) {
+    ssize_t r;
+
+    pa_assert(io);
+    pa_assert(iov);
+    pa_assert(n > 0);
+    pa_assert(io->ifd >= 0);
+
+    while ((r = readv(io->ifd, iov, n)) < 0 && errno == EINTR)
+        ;
+
+    if (r >= 0) {
+        /* See pa_iochannel_read() */
+        io->readable = io->hungup = FALSE;
+        enable_events(io);
+    }
+
+    return r;
+}
+
+#endif
+
 #ifdef HAVE_CREDS
 
 pa_bool_t pa_iochannel_creds_supported(pa_iochannel *io) {
@@ -337,52 +400,121 @@ ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l
     return r;
 }
 
-ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_creds *creds, pa_bool_t *creds_valid) {
+ssize_t pa_iochannel_write_with_fds(pa_iochannel*io, const void*data, size_t l, int nfd, const int *fds) {
     ssize_t r;
     struct msghdr mh;
     struct iovec iov;
     union {
         struct cmsghdr hdr;
-        uint8_t data[CMSG_SPACE(sizeof(struct ucred))];
+        uint8_t data[CMSG_SPACE(sizeof(int) * MAX_ANCIL_FDS)];
     } cmsg;
 
     pa_assert(io);
     pa_assert(data);
     pa_assert(l);
-    pa_assert(io->ifd >= 0);
-    pa_assert(creds);
-    pa_assert(creds_valid);
+    pa_assert(io->ofd >= 0);
+    pa_assert(fds);
+    pa_assert(nfd > 0);
+    pa_assert(nfd <= MAX_ANCIL_FDS);
 
     pa_zero(iov);
-    iov.iov_base = data;
+    iov.iov_base = (void*) data;
     iov.iov_len = l;
 
     pa_zero(cmsg);
+    cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(int) * nfd);
+    cmsg.hdr.cmsg_level = SOL_SOCKET;
+    cmsg.hdr.cmsg_type = SCM_RIGHTS;
+    memcpy(CMSG_DATA(&cmsg.hdr), fds, sizeof(int) * nfd);
+
     pa_zero(mh);
     mh.msg_iov = &iov;
     mh.msg_iovlen = 1;
     mh.msg_control = &cmsg;
+    mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfd);
+
+    if ((r = sendmsg(io->ofd, &mh, MSG_NOSIGNAL)) >= 0) {
+        io->writable = io->hungup = FALSE;
+        enable_events(io);
+    }
+
+    return r;
+}
+
+ssize_t pa_iochannel_read_with_ancil_data(pa_iochannel*io, void*data, size_t l, pa_cmsg_ancil_data *ancil_data) {
+    struct iovec iov;
+
+    pa_assert(data);
+    pa_assert(l);
+
+    pa_zero(iov);
+    iov.iov_base = data;
+    iov.iov_len = l;
+
+    return pa_iochannel_readv_with_ancil_data(io, &iov, 1, ancil_data);
+}
+
+ssize_t pa_iochannel_readv_with_ancil_data(pa_iochannel*io, const struct iovec *iov, int n, pa_cmsg_ancil_data *ancil_data) {
+    ssize_t r;
+    struct msghdr mh;
+    union {
+        struct cmsghdr hdr;
+        uint8_t data[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int) * MAX_ANCIL_FDS)];
+    } cmsg;
+
+    pa_assert(io);
+    pa_assert(iov);
+    pa_assert(n > 0);
+    pa_assert(io->ifd >= 0);
+    pa_assert(ancil_data);
+
+    pa_zero(cmsg);
+    pa_zero(mh);
+    mh.msg_iov = (struct iovec*) iov;
+    mh.msg_iovlen = (size_t) n;
+    mh.msg_control = &cmsg;
     mh.msg_controllen = sizeof(cmsg);
 
-    if ((r = recvmsg(io->ifd, &mh, 0)) >= 0) {
+    if ((r = recvmsg(io->ifd, &mh, MSG_CMSG_CLOEXEC)) >= 0) {
         struct cmsghdr *cmh;
 
-        *creds_valid = FALSE;
-
         for (cmh = CMSG_FIRSTHDR(&mh); cmh; cmh = CMSG_NXTHDR(&mh, cmh)) {
 
-            if (cmh->cmsg_level == SOL_SOCKET && cmh->cmsg_type == SCM_CREDENTIALS) {
+            if (cmh->cmsg_level != SOL_SOCKET)
+                continue;
+
+            if (cmh->cmsg_type == SCM_CREDENTIALS) {
                 struct ucred u;
                 pa_assert(cmh->cmsg_len == CMSG_LEN(sizeof(struct ucred)));
                 memcpy(&u, CMSG_DATA(cmh), sizeof(struct ucred));
 
-                creds->gid = u.gid;
-                creds->uid = u.uid;
-                *creds_valid = TRUE;
-                break;
+                ancil_data->creds.gid = u.gid;
+                ancil_data->creds.uid = u.uid;
+                ancil_data->creds_valid = TRUE;
+
+            } else if (cmh->cmsg_type == SCM_RIGHTS) {
+                int fds[MAX_ANCIL_FDS];
+                int i, nfd;
+
+                nfd = (int) ((cmh->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+                pa_assert(nfd <= MAX_ANCIL_FDS);
+                memcpy(fds, CMSG_DATA(cmh), sizeof(int) * nfd);
+
+                /* Don't let a peer make us leak file descriptors */
+                for (i = 0; i < nfd; i++) {
+                    if (ancil_data->nfd < MAX_ANCIL_FDS)
+                        ancil_data->fds[ancil_data->nfd++] = fds[i];
+                    else {
+                        pa_log_warn("Received more file descriptors than expected, closing them.");
+                        pa_close(fds[i]);
+                    }
+                }
             }
         }
 
+        if (mh.msg_flags & MSG_CTRUNC)
+            pa_log_warn("Ancillary data of a message was truncated.");
+
         io->readable = io->hungup = FALSE;
         enable_events(io);
     }
@@ -390,6 +522,17 @@ ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_cr
     return r;
 }
 
+void pa_cmsg_ancil_data_close_fds(pa_cmsg_ancil_data *ancil_data) {
+    int i;
+
+    pa_assert(ancil_data);
+
+    for (i = 0; i < ancil_data->nfd; i++)
+        pa_close(ancil_data->fds[i]);
+
+    ancil_data->nfd = 0;
+}
+
 #endif /* HAVE_CREDS */
 
 void pa_iochannel_set_callback(pa_iochannel*io, pa_iochannel_cb_t _callback, void *userdata) {
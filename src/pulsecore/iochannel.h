@@ -29,6 +29,10 @@
 
 #include <sys/types.h>
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #include <pulse/mainloop-api.h>
 #include <pulsecore/creds.h>
 #include <pulsecore/macro.h>
@@ -51,12 +55,28 @@ void pa_iochannel_free(pa_iochannel*io);
 ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l);
 ssize_t pa_iochannel_read(pa_iochannel*io, void*data, size_t l);
 
+#ifdef HAVE_SYS_UIO_H
+/* Gather the data to write from resp. scatter the data read into n
+ * buffers, with a single syscall */
+ssize_t pa_iochannel_writev(pa_iochannel*io, const struct iovec *iov, int n);
+ssize_t pa_iochannel_readv(pa_iochannel*io, const struct iovec *iov, int n);
+#endif
+
 #ifdef HAVE_CREDS
 pa_bool_t pa_iochannel_creds_supported(pa_iochannel *io);
 int pa_iochannel_creds_enable(pa_iochannel *io);
 
 ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l, const pa_creds *ucred);
-ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_creds *ucred, pa_bool_t *creds_valid);
+
+/* Pass nfd file descriptors to the peer along with the data. The
+ * caller keeps ownership of the file descriptors. */
+ssize_t pa_iochannel_write_with_fds(pa_iochannel*io, const void*data, size_t l, int nfd, const int *fds);
+
+/* Read data and any credentials and file descriptors that came with
+ * it. Received file descriptors are appended to ancil_data->fds, the
+ * caller owns them. */
+ssize_t pa_iochannel_read_with_ancil_data(pa_iochannel*io, void*data, size_t l, pa_cmsg_ancil_data *ancil_data);
+ssize_t pa_iochannel_readv_with_ancil_data(pa_iochannel*io, const struct iovec *iov, int n, pa_cmsg_ancil_data *ancil_data);
 #endif
 
 pa_bool_t pa_iochannel_is_readable(pa_iochannel*io);
@@ -0,0 +1,49 @@
+#ifndef foopulsememhfoo
+#define foopulsememhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulsecore/macro.h>
+
+/* The kind of memory backing a pa_shm segment or a memory pool */
+typedef enum pa_mem_type {
+    PA_MEM_TYPE_PRIVATE,          /* Anonymous memory, not shareable */
+    PA_MEM_TYPE_SHARED_POSIX,     /* POSIX shm_open() segment, attached by name */
+    PA_MEM_TYPE_SHARED_MEMFD,     /* Linux memfd, attached by passing the fd */
+} pa_mem_type_t;
+
+static inline const char *pa_mem_type_to_string(pa_mem_type_t type) {
+    switch (type) {
+        case PA_MEM_TYPE_PRIVATE:
+            return "private";
+        case PA_MEM_TYPE_SHARED_POSIX:
+            return "shared posix-shm";
+        case PA_MEM_TYPE_SHARED_MEMFD:
+            return "shared memfd";
+    }
+
+    pa_assert_not_reached();
+}
+
+static inline pa_bool_t pa_mem_type_is_shared(pa_mem_type_t type) {
+    return type == PA_MEM_TYPE_SHARED_POSIX || type == PA_MEM_TYPE_SHARED_MEMFD;
+}
+
+#endif
@@ -41,6 +41,7 @@
 #include <pulsecore/shm.h>
 #include <pulsecore/log.h>
 #include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
 #include <pulsecore/semaphore.h>
 #include <pulsecore/mutex.h>
 #include <pulsecore/macro.h>
@@ -55,10 +56,27 @@
 /* We can allocate 64*1024*1024 bytes at maximum. That's 64MB. Please
  * note that the footprint is usually much smaller, since the data is
  * stored in SHM and our OS does not commit the memory before we use
- * it for the first time. */
+ * it for the first time.
+ *
+ * The pool is cut into chunks of the largest slot size. Whenever a
+ * size class runs out of free slots, another chunk is cut into slots
+ * of that size. Chunks that are entirely unused again are handed back
+ * by pa_mempool_vacuum(). */
+#define PA_MEMPOOL_CHUNKS_MAX 256
+
+/* The slots a single size class may use at most */
 #define PA_MEMPOOL_SLOTS_MAX 1024
+
+/* The slot size that pa_mempool_block_size_max() is based on */
 #define PA_MEMPOOL_SLOT_SIZE (64*1024)
 
+static const size_t slot_class_size[PA_MEMPOOL_SLOT_CLASSES_MAX] = {
+    4*1024,
+    16*1024,
+    64*1024,
+    256*1024
+};
+
 #define PA_MEMEXPORT_SLOTS_MAX 128
 
 #define PA_MEMIMPORT_SLOTS_MAX 160
@@ -139,26 +157,46 @@ struct pa_memexport {
     PA_LLIST_FIELDS(pa_memexport);
 };
 
+struct mempool_slot_class {
+    size_t slot_size;
+    unsigned slots_per_chunk;
+
+    /* The number of chunks cut into slots of this size */
+    pa_atomic_t n_chunks;
+    unsigned n_chunks_max;
+
+    /* A list of free slots that may be reused */
+    pa_flist *free_slots;
+};
+
 struct pa_mempool {
     pa_semaphore *semaphore;
     pa_mutex *mutex;
 
     pa_shm memory;
-    size_t block_size;
-    unsigned n_blocks;
+    size_t chunk_size;
+    unsigned n_chunks;
 
     pa_atomic_t n_init;
 
+    /* The size class each chunk has been cut into, only valid while
+     * the chunk is in use */
+    uint8_t *chunk_class;
+
+    /* A list of chunks that were handed back and may be reused */
+    pa_flist *free_chunks;
+
+    unsigned default_class;
+    struct mempool_slot_class classes[PA_MEMPOOL_SLOT_CLASSES_MAX];
+
     PA_LLIST_HEAD(pa_memimport, imports);
     PA_LLIST_HEAD(pa_memexport, exports);
 
-    /* A list of free slots that may be reused */
-    pa_flist *free_slots;
-
     pa_mempool_stat stat;
 };
 
 static void segment_detach(pa_memimport_segment *seg);
+static void segment_block_gone(pa_memimport_segment *seg);
 
 PA_STATIC_FLIST_DECLARE(unused_memblocks, 0, pa_xfree);
 
@@ -246,66 +284,142 @@ static pa_memblock *memblock_new_appended(pa_mempool *p, size_t length) {
 }
 
 /* No lock necessary */
-static struct mempool_slot* mempool_allocate_slot(pa_mempool *p) {
+static uint8_t* mempool_allocate_chunk(pa_mempool *p) {
+    uint8_t *chunk;
+    int idx;
+
+    pa_assert(p);
+
+    if ((chunk = pa_flist_pop(p->free_chunks)))
+        return chunk;
+
+    /* No chunk was handed back, we have to take a new one */
+
+    if ((unsigned) (idx = pa_atomic_inc(&p->n_init)) >= p->n_chunks) {
+        pa_atomic_dec(&p->n_init);
+        return NULL;
+    }
+
+    return (uint8_t*) p->memory.ptr + (p->chunk_size * (size_t) idx);
+}
+
+/* No lock necessary */
+static struct mempool_slot* mempool_allocate_slot(pa_mempool *p, unsigned class) {
+    struct mempool_slot_class *c;
     struct mempool_slot *slot;
+
     pa_assert(p);
+    pa_assert(class < PA_MEMPOOL_SLOT_CLASSES_MAX);
 
-    if (!(slot = pa_flist_pop(p->free_slots))) {
-        int idx;
+    c = &p->classes[class];
+
+    if (!(slot = pa_flist_pop(c->free_slots))) {
+        uint8_t *chunk;
+        unsigned i;
 
-        /* The free list was empty, we have to allocate a new entry */
+        /* The free list was empty, we have to cut a new chunk into
+         * slots of this size */
 
-        if ((unsigned) (idx = pa_atomic_inc(&p->n_init)) >= p->n_blocks)
-            pa_atomic_dec(&p->n_init);
-        else
-            slot = (struct mempool_slot*) ((uint8_t*) p->memory.ptr + (p->block_size * (size_t) idx));
+        if ((unsigned) pa_atomic_inc(&c->n_chunks) >= c->n_chunks_max) {
+            pa_atomic_dec(&c->n_chunks);
+            return NULL;
+        }
 
-        if (!slot) {
-            if (pa_log_ratelimit(PA_LOG_DEBUG))
-                pa_log_debug("Pool full");
-            pa_atomic_inc(&p->stat.n_pool_full);
+        if (!(chunk = mempool_allocate_chunk(p))) {
+            pa_atomic_dec(&c->n_chunks);
             return NULL;
         }
+
+        p->chunk_class[(size_t) (chunk - (uint8_t*) p->memory.ptr) / p->chunk_size] = (uint8_t) class;
+        pa_atomic_add(&p->stat.n_slots_by_class[class], (int) c->slots_per_chunk);
+
+        /* We keep the first slot for ourselves */
+        for (i = 1; i < c->slots_per_chunk; i++)
+            while (pa_flist_push(c->free_slots, chunk + c->slot_size * i) < 0)
+                ;
+
+        slot = (struct mempool_slot*) chunk;
     }
 
+    pa_atomic_inc(&p->stat.n_used_slots_by_class[class]);
+
 /* #ifdef HAVE_VALGRIND_MEMCHECK_H */
 /*     if (PA_UNLIKELY(pa_in_valgrind())) { */
-/*         VALGRIND_MALLOCLIKE_BLOCK(slot, p->block_size, 0, 0); */
+/*         VALGRIND_MALLOCLIKE_BLOCK(slot, c->slot_size, 0, 0); */
 /*     } */
 /* #endif */
 
     return slot;
 }
 
+/* No lock necessary. Returns the smallest size class that can hold
+ * length bytes, or PA_MEMPOOL_SLOT_CLASSES_MAX if there is none */
+static unsigned mempool_slot_class(pa_mempool *p, size_t length) {
+    unsigned k;
+
+    pa_assert(p);
+
+    for (k = 0; k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++)
+        if (p->classes[k].slot_size >= length)
+            break;
+
+    return k;
+}
+
+/* No lock necessary. Tries the smallest size class that fits first,
+ * and the larger ones if that one is exhausted. */
+static struct mempool_slot* mempool_allocate_slot_for(pa_mempool *p, size_t length, unsigned *class) {
+    struct mempool_slot *slot;
+    unsigned k;
+
+    pa_assert(p);
+    pa_assert(class);
+
+    for (k = mempool_slot_class(p, length); k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++)
+        if ((slot = mempool_allocate_slot(p, k))) {
+            *class = k;
+            return slot;
+        }
+
+    return NULL;
+}
+
 /* No lock necessary, totally redundant anyway */
 static inline void* mempool_slot_data(struct mempool_slot *slot) {
     return slot;
 }
 
 /* No lock necessary */
-static unsigned mempool_slot_idx(pa_mempool *p, void *ptr) {
+static unsigned mempool_chunk_idx(pa_mempool *p, void *ptr) {
     pa_assert(p);
 
     pa_assert((uint8_t*) ptr >= (uint8_t*) p->memory.ptr);
     pa_assert((uint8_t*) ptr < (uint8_t*) p->memory.ptr + p->memory.size);
 
-    return (unsigned) ((size_t) ((uint8_t*) ptr - (uint8_t*) p->memory.ptr) / p->block_size);
+    return (unsigned) ((size_t) ((uint8_t*) ptr - (uint8_t*) p->memory.ptr) / p->chunk_size);
 }
 
 /* No lock necessary */
-static struct mempool_slot* mempool_slot_by_ptr(pa_mempool *p, void *ptr) {
-    unsigned idx;
+static struct mempool_slot* mempool_slot_by_ptr(pa_mempool *p, void *ptr, unsigned *class) {
+    size_t offset;
 
-    if ((idx = mempool_slot_idx(p, ptr)) == (unsigned) -1)
-        return NULL;
+    pa_assert(class);
+
+    *class = p->chunk_class[mempool_chunk_idx(p, ptr)];
+
+    /* Chunks are aligned to the largest slot size, hence the slots
+     * are aligned to their own size */
+    offset = (size_t) ((uint8_t*) ptr - (uint8_t*) p->memory.ptr);
+    offset = PA_ROUND_DOWN(offset, p->classes[*class].slot_size);
 
-    return (struct mempool_slot*) ((uint8_t*) p->memory.ptr + (idx * p->block_size));
+    return (struct mempool_slot*) ((uint8_t*) p->memory.ptr + offset);
 }
 
 /* No lock necessary */
 pa_memblock *pa_memblock_new_pool(pa_mempool *p, size_t length) {
     pa_memblock *b = NULL;
     struct mempool_slot *slot;
+    unsigned class;
     static int mempool_disable = 0;
 
     pa_assert(p);
@@ -318,35 +432,40 @@ pa_memblock *pa_memblock_new_pool(pa_mempool *p, size_t length) {
         return NULL;
 
     /* If -1 is passed as length we choose the size for the caller: we
-     * take the largest size that fits in one of our slots. */
+     * take the largest size that fits in one of our default slots. */
 
     if (length == (size_t) -1)
         length = pa_mempool_block_size_max(p);
 
-    if (p->block_size >= PA_ALIGN(sizeof(pa_memblock)) + length) {
+    if (length > p->classes[PA_MEMPOOL_SLOT_CLASSES_MAX-1].slot_size) {
+        pa_log_debug("Memory block too large for pool: %lu > %lu",
+                     (unsigned long) length, (unsigned long) p->classes[PA_MEMPOOL_SLOT_CLASSES_MAX-1].slot_size);
+        pa_atomic_inc(&p->stat.n_too_large_for_pool);
+        return NULL;
+    }
 
-        if (!(slot = mempool_allocate_slot(p)))
-            return NULL;
+    if (!(slot = mempool_allocate_slot_for(p, length, &class))) {
+        if (pa_log_ratelimit(PA_LOG_DEBUG))
+            pa_log_debug("Pool full");
+        pa_atomic_inc(&p->stat.n_pool_full);
+        return NULL;
+    }
+
+    /* If the header doesn't fit into the slot too, we keep it outside
+     * of the pool instead of wasting a slot twice as large */
+    if (p->classes[class].slot_size >= PA_ALIGN(sizeof(pa_memblock)) + length) {
 
         b = mempool_slot_data(slot);
         b->type = PA_MEMBLOCK_POOL;
         pa_atomic_ptr_store(&b->data, (uint8_t*) b + PA_ALIGN(sizeof(pa_memblock)));
 
-    } else if (p->block_size >= length) {
-
-        if (!(slot = mempool_allocate_slot(p)))
-            return NULL;
+    } else {
 
         if (!(b = pa_flist_pop(PA_STATIC_FLIST_GET(unused_memblocks))))
             b = pa_xnew(pa_memblock, 1);
 
         b->type = PA_MEMBLOCK_POOL_EXTERNAL;
         pa_atomic_ptr_store(&b->data, mempool_slot_data(slot));
-
-    } else {
-        pa_log_debug("Memory block too large for pool: %lu > %lu", (unsigned long) length, (unsigned long) p->block_size);
-        pa_atomic_inc(&p->stat.n_too_large_for_pool);
-        return NULL;
     }
 
     PA_REFCNT_INIT(b);
@@ -543,9 +662,7 @@ static void memblock_free(pa_memblock *b) {
 
             pa_assert_se(pa_hashmap_remove(import->blocks, PA_UINT32_TO_PTR(b->per_type.imported.id)));
 
-            pa_assert(segment->n_blocks >= 1);
-            if (-- segment->n_blocks <= 0)
-                segment_detach(segment);
+            segment_block_gone(segment);
 
             pa_mutex_unlock(import->mutex);
 
@@ -560,22 +677,25 @@ static void memblock_free(pa_memblock *b) {
         case PA_MEMBLOCK_POOL_EXTERNAL:
         case PA_MEMBLOCK_POOL: {
             struct mempool_slot *slot;
+            unsigned class;
             pa_bool_t call_free;
 
-            pa_assert_se(slot = mempool_slot_by_ptr(b->pool, pa_atomic_ptr_load(&b->data)));
+            pa_assert_se(slot = mempool_slot_by_ptr(b->pool, pa_atomic_ptr_load(&b->data), &class));
 
             call_free = b->type == PA_MEMBLOCK_POOL_EXTERNAL;
 
 /* #ifdef HAVE_VALGRIND_MEMCHECK_H */
 /*             if (PA_UNLIKELY(pa_in_valgrind())) { */
-/*                 VALGRIND_FREELIKE_BLOCK(slot, b->pool->block_size); */
+/*                 VALGRIND_FREELIKE_BLOCK(slot, b->pool->classes[class].slot_size); */
 /*             } */
 /* #endif */
 
+            pa_atomic_dec(&b->pool->stat.n_used_slots_by_class[class]);
+
             /* The free list dimensions should easily allow all slots
              * to fit in, hence try harder if pushing this slot into
              * the free list fails */
-            while (pa_flist_push(b->pool->free_slots, slot) < 0)
+            while (pa_flist_push(b->pool->classes[class].free_slots, slot) < 0)
                 ;
 
             if (call_free)
@@ -626,10 +746,11 @@ static void memblock_make_local(pa_memblock *b) {
 
     pa_atomic_dec(&b->pool->stat.n_allocated_by_type[b->type]);
 
-    if (b->length <= b->pool->block_size) {
+    if (b->length <= b->pool->chunk_size) {
         struct mempool_slot *slot;
+        unsigned class;
 
-        if ((slot = mempool_allocate_slot(b->pool))) {
+        if ((slot = mempool_allocate_slot_for(b->pool, b->length, &class))) {
             void *new_data;
             /* We can move it into a local pool, perfect! */
 
@@ -705,59 +826,80 @@ static void memblock_replace_import(pa_memblock *b) {
 
     memblock_make_local(b);
 
-    pa_assert(segment->n_blocks >= 1);
-    if (-- segment->n_blocks <= 0)
-        segment_detach(segment);
+    segment_block_gone(segment);
 
     pa_mutex_unlock(import->mutex);
 }
 
-pa_mempool* pa_mempool_new(pa_bool_t shared, size_t size) {
+pa_mempool* pa_mempool_new(pa_mem_type_t type, size_t size) {
     pa_mempool *p;
+    unsigned k;
     char t1[PA_BYTES_SNPRINT_MAX], t2[PA_BYTES_SNPRINT_MAX];
 
     p = pa_xnew(pa_mempool, 1);
 
-    p->block_size = PA_PAGE_ALIGN(PA_MEMPOOL_SLOT_SIZE);
-    if (p->block_size < PA_PAGE_SIZE)
-        p->block_size = PA_PAGE_SIZE;
+    p->chunk_size = PA_PAGE_ALIGN(slot_class_size[PA_MEMPOOL_SLOT_CLASSES_MAX-1]);
 
     if (size <= 0)
-        p->n_blocks = PA_MEMPOOL_SLOTS_MAX;
+        p->n_chunks = PA_MEMPOOL_CHUNKS_MAX;
     else {
-        p->n_blocks = (unsigned) (size / p->block_size);
+        p->n_chunks = (unsigned) (size / p->chunk_size);
 
-        if (p->n_blocks < 2)
-            p->n_blocks = 2;
+        if (p->n_chunks < 2)
+            p->n_chunks = 2;
     }
 
-    if (pa_shm_create_rw(&p->memory, p->n_blocks * p->block_size, shared, 0700) < 0) {
+    if (pa_shm_create_rw(&p->memory, type, p->n_chunks * p->chunk_size, 0700) < 0) {
         pa_xfree(p);
         return NULL;
     }
 
-    pa_log_debug("Using %s memory pool with %u slots of size %s each, total size is %s, maximum usable slot size is %lu",
-                 p->memory.shared ? "shared" : "private",
-                 p->n_blocks,
-                 pa_bytes_snprint(t1, sizeof(t1), (unsigned) p->block_size),
-                 pa_bytes_snprint(t2, sizeof(t2), (unsigned) (p->n_blocks * p->block_size)),
-                 (unsigned long) pa_mempool_block_size_max(p));
-
     memset(&p->stat, 0, sizeof(p->stat));
     pa_atomic_store(&p->n_init, 0);
 
+    p->chunk_class = pa_xnew0(uint8_t, p->n_chunks);
+    p->free_chunks = pa_flist_new(p->n_chunks);
+
+    p->default_class = 0;
+
+    for (k = 0; k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++) {
+        struct mempool_slot_class *c = &p->classes[k];
+
+        /* On systems with large pages, several classes may end up
+         * with the same slot size. That's harmless, the first one
+         * wins. */
+        c->slot_size = PA_PAGE_ALIGN(slot_class_size[k]);
+        c->slots_per_chunk = (unsigned) (p->chunk_size / c->slot_size);
+
+        c->n_chunks_max = PA_MAX(PA_MEMPOOL_SLOTS_MAX / c->slots_per_chunk, 1U);
+        c->n_chunks_max = PA_MIN(c->n_chunks_max, p->n_chunks);
+        pa_atomic_store(&c->n_chunks, 0);
+
+        c->free_slots = pa_flist_new(c->n_chunks_max * c->slots_per_chunk);
+
+        if (c->slot_size <= PA_PAGE_ALIGN(PA_MEMPOOL_SLOT_SIZE))
+            p->default_class = k;
+    }
+
+    pa_log_debug("Using %s memory pool with %u chunks of size %s each, total size is %s, maximum usable slot size is %lu",
+                 pa_mem_type_to_string(p->memory.type),
+                 p->n_chunks,
+                 pa_bytes_snprint(t1, sizeof(t1), (unsigned) p->chunk_size),
+                 pa_bytes_snprint(t2, sizeof(t2), (unsigned) (p->n_chunks * p->chunk_size)),
+                 (unsigned long) pa_mempool_block_size_max(p));
+
     PA_LLIST_HEAD_INIT(pa_memimport, p->imports);
     PA_LLIST_HEAD_INIT(pa_memexport, p->exports);
 
     p->mutex = pa_mutex_new(TRUE, TRUE);
     p->semaphore = pa_semaphore_new(0);
 
-    p->free_slots = pa_flist_new(p->n_blocks);
-
     return p;
 }
 
 void pa_mempool_free(pa_mempool *p) {
+    unsigned k;
+
     pa_assert(p);
 
     pa_mutex_lock(p->mutex);
@@ -770,44 +912,46 @@ void pa_mempool_free(pa_mempool *p) {
 
     pa_mutex_unlock(p->mutex);
 
-    pa_flist_free(p->free_slots, NULL);
-
     if (pa_atomic_load(&p->stat.n_allocated) > 0) {
 
         /* Ouch, somebody is retaining a memory block reference! */
 
 #ifdef DEBUG_REF
-        unsigned i;
-        pa_flist *list;
+        pa_idxset *free_chunks, *free_slots;
+        unsigned i, j, n_init;
+        void *v;
 
         /* Let's try to find at least one of those leaked memory blocks */
 
-        list = pa_flist_new(p->n_blocks);
+        free_chunks = pa_idxset_new(NULL, NULL);
+        free_slots = pa_idxset_new(NULL, NULL);
 
-        for (i = 0; i < (unsigned) pa_atomic_load(&p->n_init); i++) {
-            struct mempool_slot *slot;
-            pa_memblock *b, *k;
+        while ((v = pa_flist_pop(p->free_chunks)))
+            pa_idxset_put(free_chunks, v, NULL);
 
-            slot = (struct mempool_slot*) ((uint8_t*) p->memory.ptr + (p->block_size * (size_t) i));
-            b = mempool_slot_data(slot);
+        for (k = 0; k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++)
+            while ((v = pa_flist_pop(p->classes[k].free_slots)))
+                pa_idxset_put(free_slots, v, NULL);
 
-            while ((k = pa_flist_pop(p->free_slots))) {
-                while (pa_flist_push(list, k) < 0)
-                    ;
+        n_init = PA_MIN((unsigned) pa_atomic_load(&p->n_init), p->n_chunks);
 
-                if (b == k)
-                    break;
-            }
+        for (i = 0; i < n_init; i++) {
+            uint8_t *chunk = (uint8_t*) p->memory.ptr + (p->chunk_size * (size_t) i);
+            struct mempool_slot_class *c = &p->classes[p->chunk_class[i]];
 
-            if (!k)
-                pa_log("REF: Leaked memory block %p", b);
+            if (pa_idxset_get_by_data(free_chunks, chunk, NULL))
+                continue;
 
-            while ((k = pa_flist_pop(list)))
-                while (pa_flist_push(p->free_slots, k) < 0)
-                    ;
+            for (j = 0; j < c->slots_per_chunk; j++) {
+                pa_memblock *b = mempool_slot_data((struct mempool_slot*) (chunk + c->slot_size * j));
+
+                if (!pa_idxset_get_by_data(free_slots, b, NULL))
+                    pa_log("REF: Leaked memory block %p", b);
+            }
         }
 
-        pa_flist_free(list, NULL);
+        pa_idxset_free(free_chunks, NULL);
+        pa_idxset_free(free_slots, NULL);
 
 #endif
 
@@ -816,6 +960,12 @@ void pa_mempool_free(pa_mempool *p) {
 /*         PA_DEBUG_TRAP; */
     }
 
+    for (k = 0; k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++)
+        pa_flist_free(p->classes[k].free_slots, NULL);
+
+    pa_flist_free(p->free_chunks, NULL);
+    pa_xfree(p->chunk_class);
+
     pa_shm_free(&p->memory);
 
     pa_mutex_free(p->mutex);
@@ -835,37 +985,82 @@ const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p) {
 size_t pa_mempool_block_size_max(pa_mempool *p) {
     pa_assert(p);
 
-    return p->block_size - PA_ALIGN(sizeof(pa_memblock));
+    return p->classes[p->default_class].slot_size - PA_ALIGN(sizeof(pa_memblock));
 }
 
 /* No lock necessary */
+size_t pa_mempool_slot_class_size(pa_mempool *p, unsigned class) {
+    pa_assert(p);
+    pa_assert(class < PA_MEMPOOL_SLOT_CLASSES_MAX);
+
+    return p->classes[class].slot_size;
+}
+
+/* No lock necessary. Gives the memory of all free slots back to the
+ * OS, and chunks that are entirely free back to the pool, so that
+ * they may be cut into slots of a different size. */
 void pa_mempool_vacuum(pa_mempool *p) {
-    struct mempool_slot *slot;
-    pa_flist *list;
+    unsigned *n_free;
+    unsigned k, i, n_init;
 
     pa_assert(p);
 
-    list = pa_flist_new(p->n_blocks);
+    n_free = pa_xnew0(unsigned, p->n_chunks);
 
-    while ((slot = pa_flist_pop(p->free_slots)))
-        while (pa_flist_push(list, slot) < 0)
-            ;
+    for (k = 0; k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++) {
+        struct mempool_slot_class *c = &p->classes[k];
+        struct mempool_slot *slot;
+        pa_flist *list;
+
+        list = pa_flist_new(c->n_chunks_max * c->slots_per_chunk);
+
+        while ((slot = pa_flist_pop(c->free_slots))) {
+            n_free[mempool_chunk_idx(p, slot)]++;
+
+            while (pa_flist_push(list, slot) < 0)
+                ;
+        }
+
+        /* A slot is either in use or in the free list. If we hold all
+         * slots of a chunk, nobody else can be using it. */
+        while ((slot = pa_flist_pop(list))) {
+            if (n_free[mempool_chunk_idx(p, slot)] == c->slots_per_chunk)
+                continue;
 
-    while ((slot = pa_flist_pop(list))) {
-        pa_shm_punch(&p->memory, (size_t) ((uint8_t*) slot - (uint8_t*) p->memory.ptr), p->block_size);
+            pa_shm_punch(&p->memory, (size_t) ((uint8_t*) slot - (uint8_t*) p->memory.ptr), c->slot_size);
 
-        while (pa_flist_push(p->free_slots, slot))
-            ;
+            while (pa_flist_push(c->free_slots, slot))
+                ;
+        }
+
+        pa_flist_free(list, NULL);
+
+        n_init = PA_MIN((unsigned) pa_atomic_load(&p->n_init), p->n_chunks);
+
+        for (i = 0; i < n_init; i++) {
+            if (n_free[i] != c->slots_per_chunk || p->chunk_class[i] != k)
+                continue;
+
+            n_free[i] = 0;
+
+            pa_shm_punch(&p->memory, p->chunk_size * (size_t) i, p->chunk_size);
+
+            pa_atomic_dec(&c->n_chunks);
+            pa_atomic_sub(&p->stat.n_slots_by_class[k], (int) c->slots_per_chunk);
+
+            while (pa_flist_push(p->free_chunks, (uint8_t*) p->memory.ptr + p->chunk_size * (size_t) i) < 0)
+                ;
+        }
     }
 
-    pa_flist_free(list, NULL);
+    pa_xfree(n_free);
 }
 
 /* No lock necessary */
 int pa_mempool_get_shm_id(pa_mempool *p, uint32_t *id) {
     pa_assert(p);
 
-    if (!p->memory.shared)
+    if (!pa_mem_type_is_shared(p->memory.type))
         return -1;
 
     *id = p->memory.id;
@@ -877,7 +1072,23 @@ int pa_mempool_get_shm_id(pa_mempool *p, uint32_t *id) {
 pa_bool_t pa_mempool_is_shared(pa_mempool *p) {
     pa_assert(p);
 
-    return !!p->memory.shared;
+    return pa_mem_type_is_shared(p->memory.type);
+}
+
+/* No lock necessary */
+pa_bool_t pa_mempool_is_memfd_backed(pa_mempool *p) {
+    pa_assert(p);
+
+    return p->memory.type == PA_MEM_TYPE_SHARED_MEMFD;
+}
+
+/* No lock necessary */
+int pa_mempool_get_memfd_fd(pa_mempool *p) {
+    pa_assert(p);
+    pa_assert(pa_mempool_is_memfd_backed(p));
+    pa_assert(p->memory.fd >= 0);
+
+    return p->memory.fd;
 }
 
 /* For receiving blocks from other nodes */
@@ -905,7 +1116,7 @@ pa_memimport* pa_memimport_new(pa_mempool *p, pa_memimport_release_cb_t cb, void
 static void memexport_revoke_blocks(pa_memexport *e, pa_memimport *i);
 
 /* Should be called locked */
-static pa_memimport_segment* segment_attach(pa_memimport *i, uint32_t shm_id) {
+static pa_memimport_segment* segment_attach(pa_memimport *i, pa_mem_type_t type, uint32_t shm_id, int memfd_fd) {
     pa_memimport_segment* seg;
 
     if (pa_hashmap_size(i->segments) >= PA_MEMIMPORT_SEGMENTS_MAX)
@@ -913,7 +1124,7 @@ static pa_memimport_segment* segment_attach(pa_memimport *i, uint32_t shm_id) {
 
     seg = pa_xnew0(pa_memimport_segment, 1);
 
-    if (pa_shm_attach_ro(&seg->memory, shm_id) < 0) {
+    if (pa_shm_attach(&seg->memory, type, shm_id, memfd_fd, FALSE) < 0) {
         pa_xfree(seg);
         return NULL;
     }
@@ -938,10 +1149,23 @@ static void segment_detach(pa_memimport_segment *seg) {
     pa_xfree(seg);
 }
 
+/* Should be called locked. POSIX segments can be attached again by
+ * name when needed, so we let go of them as soon as no block uses
+ * them anymore. A memfd segment can only be attached once, when the
+ * other side registers it, so it stays until the import goes away. */
+static void segment_block_gone(pa_memimport_segment *seg) {
+    pa_assert(seg);
+    pa_assert(seg->n_blocks >= 1);
+
+    if (--seg->n_blocks <= 0 && seg->memory.type != PA_MEM_TYPE_SHARED_MEMFD)
+        segment_detach(seg);
+}
+
 /* Self-locked. Not multiple-caller safe */
 void pa_memimport_free(pa_memimport *i) {
     pa_memexport *e;
     pa_memblock *b;
+    pa_memimport_segment *seg;
 
     pa_assert(i);
 
@@ -950,7 +1174,11 @@ void pa_memimport_free(pa_memimport *i) {
     while ((b = pa_hashmap_first(i->blocks)))
         memblock_replace_import(b);
 
-    pa_assert(pa_hashmap_size(i->segments) == 0);
+    while ((seg = pa_hashmap_first(i->segments))) {
+        pa_assert(seg->memory.type == PA_MEM_TYPE_SHARED_MEMFD);
+        pa_assert(seg->n_blocks == 0);
+        segment_detach(seg);
+    }
 
     pa_mutex_unlock(i->mutex);
 
@@ -972,8 +1200,35 @@ void pa_memimport_free(pa_memimport *i) {
     pa_xfree(i);
 }
 
+/* Self-locked. Makes the memfd segment the other side sent us
+ * available for pa_memimport_get(). The fd stays owned by the
+ * caller. */
+int pa_memimport_attach_memfd(pa_memimport *i, uint32_t shm_id, int memfd_fd) {
+    int ret = -1;
+
+    pa_assert(i);
+    pa_assert(memfd_fd >= 0);
+
+    pa_mutex_lock(i->mutex);
+
+    if (pa_hashmap_get(i->segments, PA_UINT32_TO_PTR(shm_id))) {
+        pa_log("Memory segment %u is registered already.", shm_id);
+        goto finish;
+    }
+
+    if (!segment_attach(i, PA_MEM_TYPE_SHARED_MEMFD, shm_id, memfd_fd))
+        goto finish;
+
+    ret = 0;
+
+finish:
+    pa_mutex_unlock(i->mutex);
+
+    return ret;
+}
+
 /* Self-locked */
-pa_memblock* pa_memimport_get(pa_memimport *i, uint32_t block_id, uint32_t shm_id, size_t offset, size_t size) {
+pa_memblock* pa_memimport_get(pa_memimport *i, pa_mem_type_t type, uint32_t block_id, uint32_t shm_id, size_t offset, size_t size) {
     pa_memblock *b = NULL;
     pa_memimport_segment *seg;
 
@@ -989,9 +1244,17 @@ pa_memblock* pa_memimport_get(pa_memimport *i, uint32_t block_id, uint32_t shm_i
     if (pa_hashmap_size(i->blocks) >= PA_MEMIMPORT_SLOTS_MAX)
         goto finish;
 
-    if (!(seg = pa_hashmap_get(i->segments, PA_UINT32_TO_PTR(shm_id))))
-        if (!(seg = segment_attach(i, shm_id)))
+    if ((seg = pa_hashmap_get(i->segments, PA_UINT32_TO_PTR(shm_id)))) {
+        if (seg->memory.type != type)
             goto finish;
+    } else {
+        /* memfd segments need to be registered first */
+        if (type != PA_MEM_TYPE_SHARED_POSIX)
+            goto finish;
+
+        if (!(seg = segment_attach(i, type, shm_id, -1)))
+            goto finish;
+    }
 
     if (offset+size > seg->memory.size)
         goto finish;
@@ -1050,7 +1313,7 @@ pa_memexport* pa_memexport_new(pa_mempool *p, pa_memexport_revoke_cb_t cb, void
     pa_assert(p);
     pa_assert(cb);
 
-    if (!p->memory.shared)
+    if (!pa_mempool_is_shared(p))
         return NULL;
 
     e = pa_xnew(pa_memexport, 1);
@@ -1155,11 +1418,18 @@ static pa_memblock *memblock_shared_copy(pa_mempool *p, pa_memblock *b) {
     pa_assert(p);
     pa_assert(b);
 
-    if (b->type == PA_MEMBLOCK_IMPORTED ||
-        b->type == PA_MEMBLOCK_POOL ||
-        b->type == PA_MEMBLOCK_POOL_EXTERNAL) {
-        pa_assert(b->pool == p);
-        return pa_memblock_ref(b);
+    /* Blocks in our own pool and blocks imported via POSIX shm can be
+     * referenced by the other side directly. Everything else, blocks
+     * of other pools and memfd blocks the other side can't map,
+     * needs to be copied first. */
+    if (b->pool == p) {
+        if (b->type == PA_MEMBLOCK_POOL ||
+            b->type == PA_MEMBLOCK_POOL_EXTERNAL)
+            return pa_memblock_ref(b);
+
+        if (b->type == PA_MEMBLOCK_IMPORTED &&
+            b->per_type.imported.segment->memory.type == PA_MEM_TYPE_SHARED_POSIX)
+            return pa_memblock_ref(b);
     }
 
     if (!(n = pa_memblock_new_pool(p, b->length)))
@@ -1170,18 +1440,18 @@ static pa_memblock *memblock_shared_copy(pa_mempool *p, pa_memblock *b) {
 }
 
 /* Self-locked */
-int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32_t *shm_id, size_t *offset, size_t * size) {
+int pa_memexport_put(pa_memexport *e, pa_memblock *b, pa_mem_type_t *type, uint32_t *block_id, uint32_t *shm_id, size_t *offset, size_t * size) {
     pa_shm *memory;
     struct memexport_slot *slot;
     void *data;
 
     pa_assert(e);
     pa_assert(b);
+    pa_assert(type);
     pa_assert(block_id);
     pa_assert(shm_id);
     pa_assert(offset);
     pa_assert(size);
-    pa_assert(b->pool == e->pool);
 
     if (!(b = memblock_shared_copy(e->pool, b)))
         return -1;
@@ -1220,6 +1490,7 @@ int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32
     pa_assert(data >= memory->ptr);
     pa_assert((uint8_t*) data + b->length <= (uint8_t*) memory->ptr + memory->size);
 
+    *type = memory->type;
     *shm_id = memory->id;
     *offset = (size_t) ((uint8_t*) data - (uint8_t*) memory->ptr);
     *size = b->length;
@@ -30,6 +30,7 @@ typedef struct pa_memblock pa_memblock;
 
 #include <pulse/def.h>
 #include <pulsecore/atomic.h>
+#include <pulsecore/mem.h>
 #include <pulsecore/memchunk.h>
 
 /* A pa_memblock is a reference counted memory block. PulseAudio
@@ -48,6 +49,9 @@ typedef enum pa_memblock_type {
     PA_MEMBLOCK_TYPE_MAX
 } pa_memblock_type_t;
 
+/* The number of slot sizes a memory pool offers */
+#define PA_MEMPOOL_SLOT_CLASSES_MAX 4
+
 typedef struct pa_mempool pa_mempool;
 typedef struct pa_mempool_stat pa_mempool_stat;
 typedef struct pa_memimport_segment pa_memimport_segment;
@@ -76,12 +80,17 @@ struct pa_mempool_stat {
 
     pa_atomic_t n_allocated_by_type[PA_MEMBLOCK_TYPE_MAX];
     pa_atomic_t n_accumulated_by_type[PA_MEMBLOCK_TYPE_MAX];
+
+    /* Slots of each size that were cut out of the pool, and how many
+     * of them are in use */
+    pa_atomic_t n_slots_by_class[PA_MEMPOOL_SLOT_CLASSES_MAX];
+    pa_atomic_t n_used_slots_by_class[PA_MEMPOOL_SLOT_CLASSES_MAX];
 };
 
 /* Allocate a new memory block of type PA_MEMBLOCK_MEMPOOL or PA_MEMBLOCK_APPENDED, depending on the size */
 pa_memblock *pa_memblock_new(pa_mempool *, size_t length);
 
-/* Allocate a new memory block of type PA_MEMBLOCK_MEMPOOL. If the requested size is too large, return NULL */
+/* Allocate a new memory block of type PA_MEMBLOCK_MEMPOOL in the smallest slot it fits in. If the requested size is too large, return NULL */
 pa_memblock *pa_memblock_new_pool(pa_mempool *, size_t length);
 
 /* Allocate a new memory block of type PA_MEMBLOCK_USER */
@@ -119,24 +128,28 @@ pa_mempool * pa_memblock_get_pool(pa_memblock *b);
 pa_memblock *pa_memblock_will_need(pa_memblock *b);
 
 /* The memory block manager */
-pa_mempool* pa_mempool_new(pa_bool_t shared, size_t size);
+pa_mempool* pa_mempool_new(pa_mem_type_t type, size_t size);
 void pa_mempool_free(pa_mempool *p);
 const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p);
 void pa_mempool_vacuum(pa_mempool *p);
 int pa_mempool_get_shm_id(pa_mempool *p, uint32_t *id);
 pa_bool_t pa_mempool_is_shared(pa_mempool *p);
+pa_bool_t pa_mempool_is_memfd_backed(pa_mempool *p);
+int pa_mempool_get_memfd_fd(pa_mempool *p);
 size_t pa_mempool_block_size_max(pa_mempool *p);
+size_t pa_mempool_slot_class_size(pa_mempool *p, unsigned class);
 
 /* For receiving blocks from other nodes */
 pa_memimport* pa_memimport_new(pa_mempool *p, pa_memimport_release_cb_t cb, void *userdata);
 void pa_memimport_free(pa_memimport *i);
-pa_memblock* pa_memimport_get(pa_memimport *i, uint32_t block_id, uint32_t shm_id, size_t offset, size_t size);
+int pa_memimport_attach_memfd(pa_memimport *i, uint32_t shm_id, int memfd_fd);
+pa_memblock* pa_memimport_get(pa_memimport *i, pa_mem_type_t type, uint32_t block_id, uint32_t shm_id, size_t offset, size_t size);
 int pa_memimport_process_revoke(pa_memimport *i, uint32_t block_id);
 
 /* For sending blocks to other nodes */
 pa_memexport* pa_memexport_new(pa_mempool *p, pa_memexport_revoke_cb_t cb, void *userdata);
 void pa_memexport_free(pa_memexport *e);
-int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32_t *shm_id, size_t *offset, size_t *size);
+int pa_memexport_put(pa_memexport *e, pa_memblock *b, pa_mem_type_t *type, uint32_t *block_id, uint32_t *shm_id, size_t *offset, size_t *size);
 int pa_memexport_process_release(pa_memexport *e, uint32_t id);
 
 #endif
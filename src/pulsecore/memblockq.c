@@ -32,24 +32,31 @@
 #include <pulsecore/log.h>
 #include <pulsecore/mcalign.h>
 #include <pulsecore/macro.h>
-#include <pulsecore/flist.h>
 
 #include "memblockq.h"
 
 /* #define MEMBLOCKQ_DEBUG */
 
+/* The blocks are kept in index order in a ring of descriptors, so that
+ * the one for any index can be found with a binary search. Queues with
+ * a lot of history, like the ones of sinks that can rewind by seconds,
+ * easily hold thousands of them. */
 struct list_item {
-    struct list_item *next, *prev;
     int64_t index;
     pa_memchunk chunk;
 };
 
-PA_STATIC_FLIST_DECLARE(list_items, 0, pa_xfree);
+#define ITEMS_MIN 16
 
 struct pa_memblockq {
-    struct list_item *blocks, *blocks_tail;
-    struct list_item *current_read, *current_write;
-    unsigned n_blocks;
+    struct list_item *items;
+    unsigned items_size, head, n_blocks;
+
+    /* The position of the next block to play, relative to head, or
+     * n_blocks if everything was played. Only a hint outside of
+     * fix_current_read(). */
+    unsigned current_read;
+
     size_t maxlength, tlength, base, prebuf, minreq, maxrewind;
     int64_t read_index, write_index;
     pa_bool_t in_prebuf;
@@ -111,6 +118,7 @@ void pa_memblockq_free(pa_memblockq* bq) {
     pa_assert(bq);
 
     pa_memblockq_silence(bq);
+    pa_xfree(bq->items);
 
     if (bq->silence.memblock)
         pa_memblock_unref(bq->silence.memblock);
@@ -122,94 +130,182 @@ void pa_memblockq_free(pa_memblockq* bq) {
     pa_xfree(bq);
 }
 
-static void fix_current_read(pa_memblockq *bq) {
-    pa_assert(bq);
+static struct list_item *item_at(pa_memblockq *bq, unsigned i) {
+    return bq->items + ((bq->head + i) & (bq->items_size - 1));
+}
 
-    if (PA_UNLIKELY(!bq->blocks)) {
-        bq->current_read = NULL;
-        return;
+static int64_t item_end(struct list_item *q) {
+    return q->index + (int64_t) q->chunk.length;
+}
+
+/* Moves the n blocks from position i on one up, going through the ring
+ * in contiguous pieces from the end */
+static void move_up(pa_memblockq *bq, unsigned i, unsigned n) {
+    unsigned mask = bq->items_size - 1;
+
+    while (n > 0) {
+        unsigned from, to, k;
+
+        from = (bq->head + i + n - 1) & mask;
+        to = (from + 1) & mask;
+        k = PA_MIN(n, PA_MIN(from, to) + 1);
+
+        memmove(bq->items + to + 1 - k, bq->items + from + 1 - k, k * sizeof(struct list_item));
+        n -= k;
     }
+}
 
-    if (PA_UNLIKELY(!bq->current_read))
-        bq->current_read = bq->blocks;
+/* Moves the n blocks from position i on one down */
+static void move_down(pa_memblockq *bq, unsigned i, unsigned n) {
+    unsigned mask = bq->items_size - 1;
 
-    /* Scan left */
-    while (PA_UNLIKELY(bq->current_read->index > bq->read_index))
+    while (n > 0) {
+        unsigned from, to, k;
 
-        if (bq->current_read->prev)
-            bq->current_read = bq->current_read->prev;
-        else
-            break;
+        from = (bq->head + i) & mask;
+        to = (from - 1) & mask;
+        k = PA_MIN(n, bq->items_size - PA_MAX(from, to));
+
+        memmove(bq->items + to, bq->items + from, k * sizeof(struct list_item));
+        i += k;
+        n -= k;
+    }
+}
 
-    /* Scan right */
-    while (PA_LIKELY(bq->current_read != NULL) && PA_UNLIKELY(bq->current_read->index + (int64_t) bq->current_read->chunk.length <= bq->read_index))
-        bq->current_read = bq->current_read->next;
+/* Makes room for a block at position i, by moving the blocks of the
+ * shorter side by one, and returns it */
+static struct list_item *insert_item(pa_memblockq *bq, unsigned i) {
+    unsigned k;
 
-    /* At this point current_read will either point at or left of the
-       next block to play. It may be NULL in case everything in
-       the queue was already played */
+    pa_assert(i <= bq->n_blocks);
+
+    if (bq->n_blocks >= bq->items_size) {
+        struct list_item *items;
+        unsigned size;
+
+        size = PA_MAX(bq->items_size * 2, ITEMS_MIN);
+        items = pa_xnew(struct list_item, size);
+
+        for (k = 0; k < bq->n_blocks; k++)
+            items[k] = *item_at(bq, k);
+
+        pa_xfree(bq->items);
+        bq->items = items;
+        bq->items_size = size;
+        bq->head = 0;
+    }
+
+    if (i < bq->n_blocks - i) {
+        bq->head = (bq->head - 1) & (bq->items_size - 1);
+        move_down(bq, 1, i);
+    } else
+        move_up(bq, i, bq->n_blocks - i);
+
+    bq->n_blocks++;
+
+    if (bq->current_read >= i)
+        bq->current_read++;
+
+    return item_at(bq, i);
+}
+
+static void remove_item(pa_memblockq *bq, unsigned i) {
+    pa_assert(i < bq->n_blocks);
+
+    if (i < bq->n_blocks - 1 - i) {
+        move_up(bq, 0, i);
+        bq->head = (bq->head + 1) & (bq->items_size - 1);
+    } else
+        move_down(bq, i + 1, bq->n_blocks - 1 - i);
+
+    bq->n_blocks--;
+
+    if (bq->current_read > i)
+        bq->current_read--;
 }
 
-static void fix_current_write(pa_memblockq *bq) {
+/* Returns whether position i is the first block that ends after the
+ * read index */
+static pa_bool_t is_current_read(pa_memblockq *bq, unsigned i) {
+    if (i > bq->n_blocks)
+        return FALSE;
+
+    if (i < bq->n_blocks && item_end(item_at(bq, i)) <= bq->read_index)
+        return FALSE;
+
+    return i == 0 || item_end(item_at(bq, i - 1)) <= bq->read_index;
+}
+
+static void fix_current_read(pa_memblockq *bq) {
+    unsigned lo, hi;
+
     pa_assert(bq);
 
-    if (PA_UNLIKELY(!bq->blocks)) {
-        bq->current_write = NULL;
+    /* Usually we are still in the same block, or moved on to the next
+     * one */
+    if (is_current_read(bq, bq->current_read))
+        return;
+
+    if (is_current_read(bq, bq->current_read + 1)) {
+        bq->current_read++;
         return;
     }
 
-    if (PA_UNLIKELY(!bq->current_write))
-        bq->current_write = bq->blocks_tail;
+    /* After a seek or rewind we have to look for it */
+    lo = 0;
+    hi = bq->n_blocks;
 
-    /* Scan right */
-    while (PA_UNLIKELY(bq->current_write->index + (int64_t) bq->current_write->chunk.length <= bq->write_index))
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
 
-        if (bq->current_write->next)
-            bq->current_write = bq->current_write->next;
+        if (item_end(item_at(bq, mid)) > bq->read_index)
+            hi = mid;
         else
-            break;
+            lo = mid + 1;
+    }
 
-    /* Scan left */
-    while (PA_LIKELY(bq->current_write != NULL) && PA_UNLIKELY(bq->current_write->index > bq->write_index))
-        bq->current_write = bq->current_write->prev;
+    bq->current_read = lo;
 
-    /* At this point current_write will either point at or right of
-       the next block to write data to. It may be NULL in case
-       everything in the queue is still to be played */
+    /* At this point current_read will either point at or left of the
+       next block to play. It is n_blocks in case everything in the
+       queue was already played */
 }
 
-static void drop_block(pa_memblockq *bq, struct list_item *q) {
-    pa_assert(bq);
-    pa_assert(q);
+/* The next block to play, or NULL if everything was played */
+static struct list_item *current_read_item(pa_memblockq *bq) {
+    return bq->current_read < bq->n_blocks ? item_at(bq, bq->current_read) : NULL;
+}
 
-    pa_assert(bq->n_blocks >= 1);
+/* Returns the position of the first block that starts at or after the
+ * given index, or n_blocks if there is none */
+static unsigned find_block_after(pa_memblockq *bq, int64_t idx) {
+    unsigned lo, hi;
 
-    if (q->prev)
-        q->prev->next = q->next;
-    else {
-        pa_assert(bq->blocks == q);
-        bq->blocks = q->next;
-    }
+    /* Usually we're appending */
+    if (bq->n_blocks <= 0 || item_at(bq, bq->n_blocks - 1)->index < idx)
+        return bq->n_blocks;
 
-    if (q->next)
-        q->next->prev = q->prev;
-    else {
-        pa_assert(bq->blocks_tail == q);
-        bq->blocks_tail = q->prev;
-    }
+    lo = 0;
+    hi = bq->n_blocks - 1;
 
-    if (bq->current_write == q)
-        bq->current_write = q->prev;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
 
-    if (bq->current_read == q)
-        bq->current_read = q->next;
+        if (item_at(bq, mid)->index >= idx)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
 
-    pa_memblock_unref(q->chunk.memblock);
+    return lo;
+}
 
-    if (pa_flist_push(PA_STATIC_FLIST_GET(list_items), q) < 0)
-        pa_xfree(q);
+static void drop_block(pa_memblockq *bq, unsigned i) {
+    pa_assert(bq);
+    pa_assert(bq->n_blocks >= 1);
 
-    bq->n_blocks--;
+    pa_memblock_unref(item_at(bq, i)->chunk.memblock);
+    remove_item(bq, i);
 }
 
 static void drop_backlog(pa_memblockq *bq) {
@@ -218,8 +314,8 @@ static void drop_backlog(pa_memblockq *bq) {
 
     boundary = bq->read_index - (int64_t) bq->maxrewind;
 
-    while (bq->blocks && (bq->blocks->index + (int64_t) bq->blocks->chunk.length <= boundary))
-        drop_block(bq, bq->blocks);
+    while (bq->n_blocks > 0 && item_end(item_at(bq, 0)) <= boundary)
+        drop_block(bq, 0);
 }
 
 static pa_bool_t can_push(pa_memblockq *bq, size_t l) {
@@ -236,7 +332,7 @@ static pa_bool_t can_push(pa_memblockq *bq, size_t l) {
             return TRUE;
     }
 
-    end = bq->blocks_tail ? bq->blocks_tail->index + (int64_t) bq->blocks_tail->chunk.length : bq->write_index;
+    end = bq->n_blocks > 0 ? item_end(item_at(bq, bq->n_blocks - 1)) : bq->write_index;
 
     /* Make sure that the list doesn't get too long */
     if (bq->write_index + (int64_t) l > end)
@@ -280,6 +376,7 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
     struct list_item *q, *n;
     pa_memchunk chunk;
     int64_t old;
+    int i;
 
     pa_assert(bq);
     pa_assert(uchunk);
@@ -295,56 +392,44 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
     old = bq->write_index;
     chunk = *uchunk;
 
-    fix_current_write(bq);
-    q = bq->current_write;
-
-    /* First we advance the q pointer right of where we want to
-     * write to */
+    /* First we move right of where we want to write to */
+    i = (int) find_block_after(bq, bq->write_index + (int64_t) chunk.length);
 
-    if (q) {
-        while (bq->write_index + (int64_t) chunk.length > q->index)
-            if (q->next)
-                q = q->next;
-            else
-                break;
-    }
-
-    if (!q)
-        q = bq->blocks_tail;
+    if (i >= (int) bq->n_blocks)
+        i = (int) bq->n_blocks - 1;
 
     /* We go from back to front to look for the right place to add
      * this new entry. Drop data we will overwrite on the way */
 
-    while (q) {
+    while (i >= 0) {
+        q = item_at(bq, (unsigned) i);
 
-        if (bq->write_index >= q->index + (int64_t) q->chunk.length)
+        if (bq->write_index >= item_end(q))
             /* We found the entry where we need to place the new entry immediately after */
             break;
         else if (bq->write_index + (int64_t) chunk.length <= q->index) {
             /* This entry isn't touched at all, let's skip it */
-            q = q->prev;
+            i--;
         } else if (bq->write_index <= q->index &&
-                   bq->write_index + (int64_t) chunk.length >= q->index + (int64_t) q->chunk.length) {
+                   bq->write_index + (int64_t) chunk.length >= item_end(q)) {
 
             /* This entry is fully replaced by the new entry, so let's drop it */
-
-            struct list_item *p;
-            p = q;
-            q = q->prev;
-            drop_block(bq, p);
+            drop_block(bq, (unsigned) i);
+            i--;
         } else if (bq->write_index >= q->index) {
             /* The write index points into this memblock, so let's
              * truncate or split it */
 
-            if (bq->write_index + (int64_t) chunk.length < q->index + (int64_t) q->chunk.length) {
+            if (bq->write_index + (int64_t) chunk.length < item_end(q)) {
 
                 /* We need to save the end of this memchunk */
                 struct list_item *p;
                 size_t d;
 
-                /* Create a new list entry for the end of the memchunk */
-                if (!(p = pa_flist_pop(PA_STATIC_FLIST_GET(list_items))))
-                    p = pa_xnew(struct list_item, 1);
+                /* Create a new entry for the end of the memchunk, which
+                 * may move q */
+                p = insert_item(bq, (unsigned) i + 1);
+                q = item_at(bq, (unsigned) i);
 
                 p->chunk = q->chunk;
                 pa_memblock_ref(p->chunk.memblock);
@@ -356,24 +441,12 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
                 /* Drop it from the new entry */
                 p->index = q->index + (int64_t) d;
                 p->chunk.length -= d;
-
-                /* Add it to the list */
-                p->prev = q;
-                if ((p->next = q->next))
-                    q->next->prev = p;
-                else
-                    bq->blocks_tail = p;
-                q->next = p;
-
-                bq->n_blocks++;
             }
 
             /* Truncate the chunk */
             if (!(q->chunk.length = (size_t) (bq->write_index - q->index))) {
-                struct list_item *p;
-                p = q;
-                q = q->prev;
-                drop_block(bq, p);
+                drop_block(bq, (unsigned) i);
+                i--;
             }
 
             /* We had to truncate this block, hence we're now at the right position */
@@ -382,7 +455,7 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
             size_t d;
 
             pa_assert(bq->write_index + (int64_t)chunk.length > q->index &&
-                      bq->write_index + (int64_t)chunk.length < q->index + (int64_t)q->chunk.length &&
+                      bq->write_index + (int64_t)chunk.length < item_end(q) &&
                       bq->write_index < q->index);
 
             /* The job overwrites the current entry at the end, so let's drop the beginning of this entry */
@@ -392,50 +465,36 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
             q->chunk.index += d;
             q->chunk.length -= d;
 
-            q = q->prev;
+            i--;
         }
     }
 
-    if (q) {
-        pa_assert(bq->write_index >=  q->index + (int64_t)q->chunk.length);
-        pa_assert(!q->next || (bq->write_index + (int64_t)chunk.length <= q->next->index));
+    if (i >= 0) {
+        q = item_at(bq, (unsigned) i);
+
+        pa_assert(bq->write_index >= item_end(q));
+        pa_assert(i + 1 >= (int) bq->n_blocks || (bq->write_index + (int64_t)chunk.length <= item_at(bq, (unsigned) i + 1)->index));
 
         /* Try to merge memory blocks */
 
         if (q->chunk.memblock == chunk.memblock &&
             q->chunk.index + q->chunk.length == chunk.index &&
-            bq->write_index == q->index + (int64_t) q->chunk.length) {
+            bq->write_index == item_end(q)) {
 
             q->chunk.length += chunk.length;
             bq->write_index += (int64_t) chunk.length;
             goto finish;
         }
     } else
-        pa_assert(!bq->blocks || (bq->write_index + (int64_t)chunk.length <= bq->blocks->index));
+        pa_assert(bq->n_blocks <= 0 || (bq->write_index + (int64_t)chunk.length <= item_at(bq, 0)->index));
 
-    if (!(n = pa_flist_pop(PA_STATIC_FLIST_GET(list_items))))
-        n = pa_xnew(struct list_item, 1);
+    n = insert_item(bq, (unsigned) (i + 1));
 
     n->chunk = chunk;
     pa_memblock_ref(n->chunk.memblock);
     n->index = bq->write_index;
     bq->write_index += (int64_t) n->chunk.length;
 
-    n->next = q ? q->next : bq->blocks;
-    n->prev = q;
-
-    if (n->next)
-        n->next->prev = n;
-    else
-        bq->blocks_tail = n;
-
-    if (n->prev)
-        n->prev->next = n;
-    else
-        bq->blocks = n;
-
-    bq->n_blocks++;
-
 finish:
 
     write_index_changed(bq, old, TRUE);
@@ -473,6 +532,7 @@ static pa_bool_t update_prebuf(pa_memblockq *bq) {
 }
 
 int pa_memblockq_peek(pa_memblockq* bq, pa_memchunk *chunk) {
+    struct list_item *item;
     int64_t d;
     pa_assert(bq);
     pa_assert(chunk);
@@ -482,14 +542,15 @@ int pa_memblockq_peek(pa_memblockq* bq, pa_memchunk *chunk) {
         return -1;
 
     fix_current_read(bq);
+    item = current_read_item(bq);
 
     /* Do we need to spit out silence? */
-    if (!bq->current_read || bq->current_read->index > bq->read_index) {
+    if (!item || item->index > bq->read_index) {
         size_t length;
 
         /* How much silence shall we return? */
-        if (bq->current_read)
-            length = (size_t) (bq->current_read->index - bq->read_index);
+        if (item)
+            length = (size_t) (item->index - bq->read_index);
         else if (bq->write_index > bq->read_index)
             length = (size_t) (bq->write_index - bq->read_index);
         else
@@ -519,11 +580,11 @@ int pa_memblockq_peek(pa_memblockq* bq, pa_memchunk *chunk) {
     }
 
     /* Ok, let's pass real data to the caller */
-    *chunk = bq->current_read->chunk;
+    *chunk = item->chunk;
     pa_memblock_ref(chunk->memblock);
 
-    pa_assert(bq->read_index >= bq->current_read->index);
-    d = bq->read_index - bq->current_read->index;
+    pa_assert(bq->read_index >= item->index);
+    d = bq->read_index - item->index;
     chunk->index += (size_t) d;
     chunk->length -= (size_t) d;
 
@@ -533,6 +594,7 @@ int pa_memblockq_peek(pa_memblockq* bq, pa_memchunk *chunk) {
 int pa_memblockq_peek_fixed_size(pa_memblockq *bq, size_t block_size, pa_memchunk *chunk) {
     pa_memchunk tchunk, rchunk;
     int64_t ri;
+    unsigned i;
     struct list_item *item;
 
     pa_assert(bq);
@@ -560,11 +622,13 @@ int pa_memblockq_peek_fixed_size(pa_memblockq *bq, size_t block_size, pa_memchun
 
     /* We don't need to call fix_current_read() here, since
      * pa_memblock_peek() already did that */
-    item = bq->current_read;
+    i = bq->current_read;
     ri = bq->read_index + tchunk.length;
 
     while (rchunk.index < block_size) {
 
+        item = i < bq->n_blocks ? item_at(bq, i) : NULL;
+
         if (!item || item->index > ri) {
             /* Do we need to append silence? */
             tchunk = bq->silence;
@@ -583,7 +647,7 @@ int pa_memblockq_peek_fixed_size(pa_memblockq *bq, size_t block_size, pa_memchun
             tchunk.length -= (size_t) d;
 
             /* Go to next item for the next iteration */
-            item = item->next;
+            i++;
         }
 
         rchunk.length = tchunk.length = PA_MIN(tchunk.length, block_size - rchunk.index);
@@ -608,20 +672,28 @@ void pa_memblockq_drop(pa_memblockq *bq, size_t length) {
     old = bq->read_index;
 
     while (length > 0) {
+        struct list_item *item;
 
         /* Do not drop any data when we are in prebuffering mode */
         if (update_prebuf(bq))
             break;
 
+        /* If prebuf cannot kick in on the way we can skip ahead right
+         * away, no matter how many blocks that are */
+        if (bq->prebuf <= 0 || bq->read_index + (int64_t) length <= bq->write_index) {
+            bq->read_index += (int64_t) length;
+            break;
+        }
+
         fix_current_read(bq);
 
-        if (bq->current_read) {
+        if ((item = current_read_item(bq))) {
             int64_t p, d;
 
             /* We go through this piece by piece to make sure we don't
              * drop more than allowed by prebuf */
 
-            p = bq->current_read->index + (int64_t) bq->current_read->chunk.length;
+            p = item_end(item);
             pa_assert(p >= bq->read_index);
             d = p - bq->read_index;
 
@@ -707,7 +779,7 @@ void pa_memblockq_seek(pa_memblockq *bq, int64_t offset, pa_seek_mode_t seek, pa
             bq->write_index = bq->read_index + offset;
             break;
         case PA_SEEK_RELATIVE_END:
-            bq->write_index = (bq->blocks_tail ? bq->blocks_tail->index + (int64_t) bq->blocks_tail->chunk.length : bq->read_index) + offset;
+            bq->write_index = (bq->n_blocks > 0 ? item_end(item_at(bq, bq->n_blocks - 1)) : bq->read_index) + offset;
             break;
         default:
             pa_assert_not_reached();
@@ -974,14 +1046,14 @@ int pa_memblockq_splice(pa_memblockq *bq, pa_memblockq *source) {
 }
 
 void pa_memblockq_willneed(pa_memblockq *bq) {
-    struct list_item *q;
+    unsigned i;
 
     pa_assert(bq);
 
     fix_current_read(bq);
 
-    for (q = bq->current_read; q; q = q->next)
-        pa_memchunk_will_need(&q->chunk);
+    for (i = bq->current_read; i < bq->n_blocks; i++)
+        pa_memchunk_will_need(&item_at(bq, i)->chunk);
 }
 
 void pa_memblockq_set_silence(pa_memblockq *bq, pa_memchunk *silence) {
@@ -1000,16 +1072,16 @@ void pa_memblockq_set_silence(pa_memblockq *bq, pa_memchunk *silence) {
 pa_bool_t pa_memblockq_is_empty(pa_memblockq *bq) {
     pa_assert(bq);
 
-    return !bq->blocks;
+    return bq->n_blocks <= 0;
 }
 
 void pa_memblockq_silence(pa_memblockq *bq) {
     pa_assert(bq);
 
-    while (bq->blocks)
-        drop_block(bq, bq->blocks);
+    while (bq->n_blocks > 0)
+        drop_block(bq, bq->n_blocks - 1);
 
-    pa_assert(bq->n_blocks == 0);
+    bq->current_read = 0;
 }
 
 unsigned pa_memblockq_get_nblocks(pa_memblockq *bq) {
@@ -26,6 +26,7 @@
 #endif
 
 #include <math.h>
+#include <string.h>
 
 #include <pulsecore/sample-util.h>
 #include <pulsecore/macro.h>
@@ -36,6 +37,15 @@
 
 #define VOLUME_PADDING 32
 
+/* From this many streams on, the streams are no longer all read for every
+ * sample. Instead they are accumulated one after the other into a tile of
+ * wide partial sums, so that only two memory streams are active at a time
+ * and the cost stays linear in the number of streams. */
+#define TILE_STREAMS_MIN 8
+
+/* Number of samples in one such tile */
+#define TILE_SAMPLES 512
+
 static void calc_linear_integer_volume(int32_t linear[], const pa_cvolume *volume) {
     unsigned channel, nchannels, padding;
 
@@ -241,8 +251,47 @@ static void pa_mix_generic_s16ne(pa_mix_info streams[], unsigned nstreams, unsig
     }
 }
 
+static void pa_mix_tiled_s16ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
+    int32_t acc[TILE_SAMPLES];
+    unsigned offset = 0;
+
+    length /= sizeof(int16_t);
+
+    while (length > 0) {
+        unsigned i, k, n = PA_MIN(length, TILE_SAMPLES);
+
+        memset(acc, 0, n * sizeof(int32_t));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const int16_t *ptr = m->ptr;
+            unsigned channel = offset;
+
+            for (k = 0; k < n; k++) {
+                int32_t cv = m->linear[channel].i;
+
+                if (PA_LIKELY(cv > 0))
+                    acc[k] += pa_mult_s16_volume(ptr[k], cv);
+
+                if (PA_UNLIKELY(++channel >= channels))
+                    channel = 0;
+            }
+
+            m->ptr = (uint8_t*) m->ptr + n * sizeof(int16_t);
+        }
+
+        for (k = 0; k < n; k++)
+            *data++ = PA_CLAMP_UNLIKELY(acc[k], -0x8000, 0x7FFF);
+
+        length -= n;
+        offset = (offset + n) % channels;
+    }
+}
+
 static void pa_mix_s16ne_c(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
-    if (nstreams == 2 && channels == 1)
+    if (nstreams >= TILE_STREAMS_MIN)
+        pa_mix_tiled_s16ne(streams, nstreams, channels, data, length);
+    else if (nstreams == 2 && channels == 1)
         pa_mix2_ch1_s16ne(streams, data, length);
     else if (nstreams == 2 && channels == 2)
         pa_mix2_ch2_s16ne(streams, data, length);
@@ -280,9 +329,51 @@ static void pa_mix_s16re_c(pa_mix_info streams[], unsigned nstreams, unsigned ch
     }
 }
 
+static void pa_mix_tiled_s32ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
+    int64_t acc[TILE_SAMPLES];
+    unsigned offset = 0;
+
+    length /= sizeof(int32_t);
+
+    while (length > 0) {
+        unsigned i, k, n = PA_MIN(length, TILE_SAMPLES);
+
+        memset(acc, 0, n * sizeof(int64_t));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const int32_t *ptr = m->ptr;
+            unsigned channel = offset;
+
+            for (k = 0; k < n; k++) {
+                int32_t cv = m->linear[channel].i;
+
+                if (PA_LIKELY(cv > 0))
+                    acc[k] += ((int64_t) ptr[k] * cv) >> 16;
+
+                if (PA_UNLIKELY(++channel >= channels))
+                    channel = 0;
+            }
+
+            m->ptr = (uint8_t*) m->ptr + n * sizeof(int32_t);
+        }
+
+        for (k = 0; k < n; k++)
+            *data++ = (int32_t) PA_CLAMP_UNLIKELY(acc[k], -0x80000000LL, 0x7FFFFFFFLL);
+
+        length -= n;
+        offset = (offset + n) % channels;
+    }
+}
+
 static void pa_mix_s32ne_c(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
     unsigned channel = 0;
 
+    if (nstreams >= TILE_STREAMS_MIN) {
+        pa_mix_tiled_s32ne(streams, nstreams, channels, data, length);
+        return;
+    }
+
     length /= sizeof(int32_t);
 
     for (; length > 0; length--, data++) {
@@ -537,9 +628,51 @@ static void pa_mix_alaw_c(pa_mix_info streams[], unsigned nstreams, unsigned cha
     }
 }
 
+static void pa_mix_tiled_float32ne(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    float acc[TILE_SAMPLES];
+    unsigned offset = 0;
+
+    length /= sizeof(float);
+
+    while (length > 0) {
+        unsigned i, k, n = PA_MIN(length, TILE_SAMPLES);
+
+        memset(acc, 0, n * sizeof(float));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const float *ptr = m->ptr;
+            unsigned channel = offset;
+
+            for (k = 0; k < n; k++) {
+                float cv = m->linear[channel].f;
+
+                if (PA_LIKELY(cv > 0))
+                    acc[k] += ptr[k] * cv;
+
+                if (PA_UNLIKELY(++channel >= channels))
+                    channel = 0;
+            }
+
+            m->ptr = (uint8_t*) m->ptr + n * sizeof(float);
+        }
+
+        memcpy(data, acc, n * sizeof(float));
+
+        data += n;
+        length -= n;
+        offset = (offset + n) % channels;
+    }
+}
+
 static void pa_mix_float32ne_c(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
     unsigned channel = 0;
 
+    if (nstreams >= TILE_STREAMS_MIN) {
+        pa_mix_tiled_float32ne(streams, nstreams, channels, data, length);
+        return;
+    }
+
     length /= sizeof(float);
 
     for (; length > 0; length--, data++) {
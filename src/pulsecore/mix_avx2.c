@@ -0,0 +1,292 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/sample-util.h>
+
+#include "cpu-x86.h"
+#include "mix.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <immintrin.h>
+
+/* See mix_sse.c; must be a multiple of 16 here */
+#define TILE_SAMPLES 256
+
+#define VOLUME_PADDING 16
+
+static void expand_volume_i(const pa_mix_info *m, unsigned channels, int32_t vol[]) {
+    unsigned k, c = 0;
+
+    for (k = 0; k < channels + VOLUME_PADDING; k++) {
+        vol[k] = PA_MAX(m->linear[c].i, 0);
+
+        if (++c >= channels)
+            c = 0;
+    }
+}
+
+static void expand_volume_f(const pa_mix_info *m, unsigned channels, float vol[]) {
+    unsigned k, c = 0;
+
+    for (k = 0; k < channels + VOLUME_PADDING; k++) {
+        vol[k] = m->linear[c].f > 0 ? m->linear[c].f : 0;
+
+        if (++c >= channels)
+            c = 0;
+    }
+}
+
+/* v * cv >> 16 for 16 samples at once, see mult_s16_volume_sse2(). The
+ * unpack instructions work within 128 bit lanes, so r0 holds samples 0-3 and
+ * 8-11, r1 holds samples 4-7 and 12-15. A later pack restores the order. */
+static inline void mult_s16_volume_avx2(__m256i v, __m256i lo, __m256i hi, __m256i *r0, __m256i *r1) {
+    __m256i pl, ph, l;
+
+    pl = _mm256_mullo_epi16(v, hi);
+    ph = _mm256_mulhi_epi16(v, hi);
+
+    l = _mm256_mulhi_epu16(v, lo);
+    l = _mm256_sub_epi16(l, _mm256_and_si256(_mm256_srai_epi16(v, 15), lo));
+
+    *r0 = _mm256_add_epi32(_mm256_unpacklo_epi16(pl, ph), _mm256_srai_epi32(_mm256_unpacklo_epi16(l, l), 16));
+    *r1 = _mm256_add_epi32(_mm256_unpackhi_epi16(pl, ph), _mm256_srai_epi32(_mm256_unpackhi_epi16(l, l), 16));
+}
+
+static void mix_s16ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
+    PA_DECLARE_ALIGNED(32, int32_t, acc[TILE_SAMPLES]);
+    int32_t vol[PA_CHANNELS_MAX + VOLUME_PADDING];
+    int16_t lo[PA_CHANNELS_MAX + VOLUME_PADDING], hi[PA_CHANNELS_MAX + VOLUME_PADDING];
+    unsigned step = 16 % channels, offset = 0;
+
+    length /= sizeof(int16_t);
+
+    while (length > 0) {
+        unsigned i, k, n = PA_MIN(length, TILE_SAMPLES);
+        unsigned nvec = n & ~15U;
+
+        memset(acc, 0, n * sizeof(int32_t));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const int16_t *src = m->ptr;
+            unsigned c = offset;
+            __m256i r0, r1;
+
+            expand_volume_i(m, channels, vol);
+            for (k = 0; k < channels + VOLUME_PADDING; k++) {
+                lo[k] = (int16_t) (vol[k] & 0xFFFF);
+                hi[k] = (int16_t) (vol[k] >> 16);
+            }
+
+            /* Within a 16 sample block the partial sums are kept in the lane
+             * order of mult_s16_volume_avx2() */
+            if (step == 0) {
+                const __m256i vlo = _mm256_loadu_si256((const __m256i *) (lo + c));
+                const __m256i vhi = _mm256_loadu_si256((const __m256i *) (hi + c));
+
+                for (k = 0; k < nvec; k += 16) {
+                    mult_s16_volume_avx2(_mm256_loadu_si256((const __m256i *) (src + k)), vlo, vhi, &r0, &r1);
+                    _mm256_store_si256((__m256i *) (acc + k), _mm256_add_epi32(_mm256_load_si256((__m256i *) (acc + k)), r0));
+                    _mm256_store_si256((__m256i *) (acc + k + 8), _mm256_add_epi32(_mm256_load_si256((__m256i *) (acc + k + 8)), r1));
+                }
+            } else {
+                for (k = 0; k < nvec; k += 16) {
+                    mult_s16_volume_avx2(_mm256_loadu_si256((const __m256i *) (src + k)),
+                                         _mm256_loadu_si256((const __m256i *) (lo + c)),
+                                         _mm256_loadu_si256((const __m256i *) (hi + c)), &r0, &r1);
+                    _mm256_store_si256((__m256i *) (acc + k), _mm256_add_epi32(_mm256_load_si256((__m256i *) (acc + k)), r0));
+                    _mm256_store_si256((__m256i *) (acc + k + 8), _mm256_add_epi32(_mm256_load_si256((__m256i *) (acc + k + 8)), r1));
+
+                    c += step;
+                    if (c >= channels)
+                        c -= channels;
+                }
+            }
+
+            for (k = nvec; k < n; k++) {
+                acc[k] += pa_mult_s16_volume(src[k], vol[c]);
+
+                if (PA_UNLIKELY(++c >= channels))
+                    c = 0;
+            }
+
+            m->ptr = (uint8_t *) m->ptr + n * sizeof(int16_t);
+        }
+
+        for (k = 0; k < nvec; k += 16)
+            _mm256_storeu_si256((__m256i *) (data + k),
+                                _mm256_packs_epi32(_mm256_load_si256((__m256i *) (acc + k)), _mm256_load_si256((__m256i *) (acc + k + 8))));
+
+        for (k = nvec; k < n; k++)
+            data[k] = (int16_t) PA_CLAMP_UNLIKELY(acc[k], -0x8000, 0x7FFF);
+
+        data += n;
+        length -= n;
+        offset = (offset + n) % channels;
+    }
+}
+
+/* (v * cv) >> 16 with 64 bit intermediates for the even lanes of v and cv.
+ * There is no arithmetic 64 bit shift, so it is done on the value biased by
+ * 2^63. */
+static inline __m256i mult_s32_volume_even_avx2(__m256i v, __m256i cv) {
+    const __m256i sign = _mm256_set1_epi64x((int64_t) 0x8000000000000000ULL);
+    const __m256i bias = _mm256_set1_epi64x(0x800000000000LL);
+
+    return _mm256_sub_epi64(_mm256_srli_epi64(_mm256_xor_si256(_mm256_mul_epi32(v, cv), sign), 16), bias);
+}
+
+static void mix_s32ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
+    PA_DECLARE_ALIGNED(32, int64_t, acc[TILE_SAMPLES]);
+    int32_t vol[PA_CHANNELS_MAX + VOLUME_PADDING];
+    unsigned step = 8 % channels, offset = 0;
+
+    length /= sizeof(int32_t);
+
+    while (length > 0) {
+        unsigned i, k, n = PA_MIN(length, TILE_SAMPLES);
+        unsigned nvec = n & ~7U;
+
+        memset(acc, 0, n * sizeof(int64_t));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const int32_t *src = m->ptr;
+            unsigned c = offset;
+
+            expand_volume_i(m, channels, vol);
+
+            for (k = 0; k < nvec; k += 8) {
+                __m256i v, cv, e, o;
+
+                v = _mm256_loadu_si256((const __m256i *) (src + k));
+                cv = _mm256_loadu_si256((const __m256i *) (vol + c));
+
+                e = mult_s32_volume_even_avx2(v, cv);
+                o = mult_s32_volume_even_avx2(_mm256_srli_epi64(v, 32), _mm256_srli_epi64(cv, 32));
+
+                /* e holds samples 0, 2, 4, 6 and o holds 1, 3, 5, 7 */
+                v = _mm256_unpacklo_epi64(e, o);
+                cv = _mm256_unpackhi_epi64(e, o);
+                e = _mm256_permute2x128_si256(v, cv, 0x20);
+                o = _mm256_permute2x128_si256(v, cv, 0x31);
+
+                _mm256_store_si256((__m256i *) (acc + k), _mm256_add_epi64(_mm256_load_si256((__m256i *) (acc + k)), e));
+                _mm256_store_si256((__m256i *) (acc + k + 4), _mm256_add_epi64(_mm256_load_si256((__m256i *) (acc + k + 4)), o));
+
+                c += step;
+                if (c >= channels)
+                    c -= channels;
+            }
+
+            for (k = nvec; k < n; k++) {
+                acc[k] += ((int64_t) src[k] * vol[c]) >> 16;
+
+                if (PA_UNLIKELY(++c >= channels))
+                    c = 0;
+            }
+
+            m->ptr = (uint8_t *) m->ptr + n * sizeof(int32_t);
+        }
+
+        for (k = 0; k < n; k++)
+            data[k] = (int32_t) PA_CLAMP_UNLIKELY(acc[k], -0x80000000LL, 0x7FFFFFFFLL);
+
+        data += n;
+        length -= n;
+        offset = (offset + n) % channels;
+    }
+}
+
+static void mix_float32ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    PA_DECLARE_ALIGNED(32, float, acc[TILE_SAMPLES]);
+    float vol[PA_CHANNELS_MAX + VOLUME_PADDING];
+    unsigned step = 8 % channels, offset = 0;
+
+    length /= sizeof(float);
+
+    while (length > 0) {
+        unsigned i, k, n = PA_MIN(length, TILE_SAMPLES);
+        unsigned nvec = n & ~7U;
+
+        memset(acc, 0, n * sizeof(float));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const float *src = m->ptr;
+            unsigned c = offset;
+
+            expand_volume_f(m, channels, vol);
+
+            /* Multiply and add are kept separate (no FMA) so that the result
+             * is bit exact with the generic C code */
+            if (step == 0) {
+                const __m256 cv = _mm256_loadu_ps(vol + c);
+
+                for (k = 0; k < nvec; k += 8)
+                    _mm256_store_ps(acc + k, _mm256_add_ps(_mm256_load_ps(acc + k), _mm256_mul_ps(_mm256_loadu_ps(src + k), cv)));
+            } else {
+                for (k = 0; k < nvec; k += 8) {
+                    _mm256_store_ps(acc + k, _mm256_add_ps(_mm256_load_ps(acc + k), _mm256_mul_ps(_mm256_loadu_ps(src + k), _mm256_loadu_ps(vol + c))));
+
+                    c += step;
+                    if (c >= channels)
+                        c -= channels;
+                }
+            }
+
+            for (k = nvec; k < n; k++) {
+                acc[k] += src[k] * vol[c];
+
+                if (PA_UNLIKELY(++c >= channels))
+                    c = 0;
+            }
+
+            m->ptr = (uint8_t *) m->ptr + n * sizeof(float);
+        }
+
+        memcpy(data, acc, n * sizeof(float));
+
+        data += n;
+        length -= n;
+        offset = (offset + n) % channels;
+    }
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_mix_func_init_avx2(pa_cpu_x86_flag_t flags) {
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized mixing functions.");
+
+        pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) mix_s16ne_avx2);
+        pa_set_mix_func(PA_SAMPLE_S32NE, (pa_do_mix_func_t) mix_s32ne_avx2);
+        pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) mix_float32ne_avx2);
+    }
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
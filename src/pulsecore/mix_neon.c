@@ -18,6 +18,8 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <pulsecore/macro.h>
 #include <pulsecore/endianmacros.h>
 
@@ -86,9 +88,120 @@ static void pa_mix_s16ne_neon(pa_mix_info streams[], unsigned nstreams, unsigned
         fallback(streams, nstreams, nchannels, data, length);
 }
 
+/* Number of samples accumulated at a time, see mix_sse.c */
+#define TILE_SAMPLES 256
+
+#define VOLUME_PADDING 4
+
+static void pa_mix_s32ne_neon(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
+    int64_t acc[TILE_SAMPLES] __attribute__((aligned(16)));
+    int32_t vol[PA_CHANNELS_MAX + VOLUME_PADDING];
+    unsigned step = 4 % channels, offset = 0;
+
+    length /= sizeof(int32_t);
+
+    while (length > 0) {
+        unsigned i, k, n = PA_MIN(length, TILE_SAMPLES);
+        unsigned nvec = n & ~3U;
+
+        memset(acc, 0, n * sizeof(int64_t));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const int32_t *src = m->ptr;
+            unsigned c = offset;
+
+            for (k = 0; k < channels + VOLUME_PADDING; k++)
+                vol[k] = PA_MAX(m->linear[k % channels].i, 0);
+
+            for (k = 0; k < nvec; k += 4) {
+                int32x4_t v = vld1q_s32(src + k);
+                int32x4_t cv = vld1q_s32(vol + c);
+
+                vst1q_s64(acc + k, vaddq_s64(vld1q_s64(acc + k), vshrq_n_s64(vmull_s32(vget_low_s32(v), vget_low_s32(cv)), 16)));
+                vst1q_s64(acc + k + 2, vaddq_s64(vld1q_s64(acc + k + 2), vshrq_n_s64(vmull_s32(vget_high_s32(v), vget_high_s32(cv)), 16)));
+
+                c += step;
+                if (c >= channels)
+                    c -= channels;
+            }
+
+            for (k = nvec; k < n; k++) {
+                acc[k] += ((int64_t) src[k] * vol[c]) >> 16;
+
+                if (PA_UNLIKELY(++c >= channels))
+                    c = 0;
+            }
+
+            m->ptr = (uint8_t *) m->ptr + n * sizeof(int32_t);
+        }
+
+        for (k = 0; k < nvec; k += 4)
+            vst1q_s32(data + k, vcombine_s32(vqmovn_s64(vld1q_s64(acc + k)), vqmovn_s64(vld1q_s64(acc + k + 2))));
+
+        for (k = nvec; k < n; k++)
+            data[k] = (int32_t) PA_CLAMP_UNLIKELY(acc[k], -0x80000000LL, 0x7FFFFFFFLL);
+
+        data += n;
+        length -= n;
+        offset = (offset + n) % channels;
+    }
+}
+
+static void pa_mix_float32ne_neon(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    float acc[TILE_SAMPLES] __attribute__((aligned(16)));
+    float vol[PA_CHANNELS_MAX + VOLUME_PADDING];
+    unsigned step = 4 % channels, offset = 0;
+
+    length /= sizeof(float);
+
+    while (length > 0) {
+        unsigned i, k, n = PA_MIN(length, TILE_SAMPLES);
+        unsigned nvec = n & ~3U;
+
+        memset(acc, 0, n * sizeof(float));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const float *src = m->ptr;
+            unsigned c = offset;
+
+            for (k = 0; k < channels + VOLUME_PADDING; k++)
+                vol[k] = m->linear[k % channels].f > 0 ? m->linear[k % channels].f : 0;
+
+            /* vmla rounds like a separate multiply and add, but spell it out
+             * to stay bit exact with the generic C code */
+            for (k = 0; k < nvec; k += 4) {
+                vst1q_f32(acc + k, vaddq_f32(vld1q_f32(acc + k), vmulq_f32(vld1q_f32(src + k), vld1q_f32(vol + c))));
+
+                c += step;
+                if (c >= channels)
+                    c -= channels;
+            }
+
+            for (k = nvec; k < n; k++) {
+                acc[k] += src[k] * vol[c];
+
+                if (PA_UNLIKELY(++c >= channels))
+                    c = 0;
+            }
+
+            m->ptr = (uint8_t *) m->ptr + n * sizeof(float);
+        }
+
+        memcpy(data, acc, n * sizeof(float));
+
+        data += n;
+        length -= n;
+        offset = (offset + n) % channels;
+    }
+}
+
 void pa_mix_func_init_neon(pa_cpu_arm_flag_t flags) {
     pa_log_info("Initialising ARM NEON optimized mixing functions.");
 
     fallback = pa_get_mix_func(PA_SAMPLE_S16NE);
     pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) pa_mix_s16ne_neon);
+    pa_set_mix_func(PA_SAMPLE_S32NE, (pa_do_mix_func_t) pa_mix_s32ne_neon);
+    pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) pa_mix_float32ne_neon);
 }
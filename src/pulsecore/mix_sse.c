@@ -0,0 +1,294 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/sample-util.h>
+
+#include "cpu-x86.h"
+#include "mix.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <emmintrin.h>
+
+/* Number of samples accumulated at a time. The partial sums for one tile
+ * stay in L1 while all streams are added to it, one stream at a time. Must
+ * be a multiple of 8. */
+#define TILE_SAMPLES 256
+
+/* Volume factors of a stream, repeated so that a vector load starting at any
+ * channel offset picks up the right factor for every lane. Negative factors
+ * are skipped by the generic C code, so they are treated as silence here. */
+#define VOLUME_PADDING 8
+
+static void expand_volume_i(const pa_mix_info *m, unsigned channels, int32_t vol[]) {
+    unsigned k, c = 0;
+
+    for (k = 0; k < channels + VOLUME_PADDING; k++) {
+        vol[k] = PA_MAX(m->linear[c].i, 0);
+
+        if (++c >= channels)
+            c = 0;
+    }
+}
+
+static void expand_volume_f(const pa_mix_info *m, unsigned channels, float vol[]) {
+    unsigned k, c = 0;
+
+    for (k = 0; k < channels + VOLUME_PADDING; k++) {
+        vol[k] = m->linear[c].f > 0 ? m->linear[c].f : 0;
+
+        if (++c >= channels)
+            c = 0;
+    }
+}
+
+/* v * cv >> 16 for 8 samples at once. The volume is split into its signed
+ * high and unsigned low 16 bits, so that v * hi is exact in 32 bits and the
+ * low part contributes the high word of v * lo. */
+static inline void mult_s16_volume_sse2(__m128i v, __m128i lo, __m128i hi, __m128i *r0, __m128i *r1) {
+    __m128i pl, ph, l;
+
+    pl = _mm_mullo_epi16(v, hi);
+    ph = _mm_mulhi_epi16(v, hi);
+
+    l = _mm_mulhi_epu16(v, lo);
+    l = _mm_sub_epi16(l, _mm_and_si128(_mm_srai_epi16(v, 15), lo));
+
+    *r0 = _mm_add_epi32(_mm_unpacklo_epi16(pl, ph), _mm_srai_epi32(_mm_unpacklo_epi16(l, l), 16));
+    *r1 = _mm_add_epi32(_mm_unpackhi_epi16(pl, ph), _mm_srai_epi32(_mm_unpackhi_epi16(l, l), 16));
+}
+
+static void mix_s16ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
+    PA_DECLARE_ALIGNED(16, int32_t, acc[TILE_SAMPLES]);
+    int32_t vol[PA_CHANNELS_MAX + VOLUME_PADDING];
+    int16_t lo[PA_CHANNELS_MAX + VOLUME_PADDING], hi[PA_CHANNELS_MAX + VOLUME_PADDING];
+    unsigned step = 8 % channels, offset = 0;
+
+    length /= sizeof(int16_t);
+
+    while (length > 0) {
+        unsigned i, k, n = PA_MIN(length, TILE_SAMPLES);
+        unsigned nvec = n & ~7U;
+
+        memset(acc, 0, n * sizeof(int32_t));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const int16_t *src = m->ptr;
+            unsigned c = offset;
+            __m128i r0, r1;
+
+            expand_volume_i(m, channels, vol);
+            for (k = 0; k < channels + VOLUME_PADDING; k++) {
+                lo[k] = (int16_t) (vol[k] & 0xFFFF);
+                hi[k] = (int16_t) (vol[k] >> 16);
+            }
+
+            if (step == 0) {
+                /* The channel layout repeats within one vector (mono,
+                 * stereo, quad, 7.1), so the volume vectors are constant */
+                const __m128i vlo = _mm_loadu_si128((const __m128i *) (lo + c));
+                const __m128i vhi = _mm_loadu_si128((const __m128i *) (hi + c));
+
+                for (k = 0; k < nvec; k += 8) {
+                    mult_s16_volume_sse2(_mm_loadu_si128((const __m128i *) (src + k)), vlo, vhi, &r0, &r1);
+                    _mm_store_si128((__m128i *) (acc + k), _mm_add_epi32(_mm_load_si128((__m128i *) (acc + k)), r0));
+                    _mm_store_si128((__m128i *) (acc + k + 4), _mm_add_epi32(_mm_load_si128((__m128i *) (acc + k + 4)), r1));
+                }
+            } else {
+                for (k = 0; k < nvec; k += 8) {
+                    mult_s16_volume_sse2(_mm_loadu_si128((const __m128i *) (src + k)),
+                                         _mm_loadu_si128((const __m128i *) (lo + c)),
+                                         _mm_loadu_si128((const __m128i *) (hi + c)), &r0, &r1);
+                    _mm_store_si128((__m128i *) (acc + k), _mm_add_epi32(_mm_load_si128((__m128i *) (acc + k)), r0));
+                    _mm_store_si128((__m128i *) (acc + k + 4), _mm_add_epi32(_mm_load_si128((__m128i *) (acc + k + 4)), r1));
+
+                    c += step;
+                    if (c >= channels)
+                        c -= channels;
+                }
+            }
+
+            for (k = nvec; k < n; k++) {
+                acc[k] += pa_mult_s16_volume(src[k], vol[c]);
+
+                if (PA_UNLIKELY(++c >= channels))
+                    c = 0;
+            }
+
+            m->ptr = (uint8_t *) m->ptr + n * sizeof(int16_t);
+        }
+
+        for (k = 0; k < nvec; k += 8)
+            _mm_storeu_si128((__m128i *) (data + k),
+                             _mm_packs_epi32(_mm_load_si128((__m128i *) (acc + k)), _mm_load_si128((__m128i *) (acc + k + 4))));
+
+        for (k = nvec; k < n; k++)
+            data[k] = (int16_t) PA_CLAMP_UNLIKELY(acc[k], -0x8000, 0x7FFF);
+
+        data += n;
+        length -= n;
+        offset = (offset + n) % channels;
+    }
+}
+
+/* (v * cv) >> 16 with 64 bit intermediates for the even (0 and 2) lanes of
+ * v and cv. SSE2 only has an unsigned 32x32 multiply and no arithmetic 64 bit
+ * shift: cv is never negative, so the product is corrected for negative v,
+ * and the shift is done on the value biased by 2^63. */
+static inline __m128i mult_s32_volume_even_sse2(__m128i v, __m128i cv) {
+    const __m128i sign = _mm_set_epi32(0x80000000, 0, 0x80000000, 0);
+    const __m128i bias = _mm_set_epi32(0x8000, 0, 0x8000, 0);
+    __m128i p;
+
+    p = _mm_mul_epu32(v, cv);
+    p = _mm_sub_epi64(p, _mm_slli_epi64(_mm_and_si128(_mm_srai_epi32(v, 31), cv), 32));
+
+    return _mm_sub_epi64(_mm_srli_epi64(_mm_xor_si128(p, sign), 16), bias);
+}
+
+static void mix_s32ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
+    PA_DECLARE_ALIGNED(16, int64_t, acc[TILE_SAMPLES]);
+    int32_t vol[PA_CHANNELS_MAX + VOLUME_PADDING];
+    unsigned step = 4 % channels, offset = 0;
+
+    length /= sizeof(int32_t);
+
+    while (length > 0) {
+        unsigned i, k, n = PA_MIN(length, TILE_SAMPLES);
+        unsigned nvec = n & ~3U;
+
+        memset(acc, 0, n * sizeof(int64_t));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const int32_t *src = m->ptr;
+            unsigned c = offset;
+
+            expand_volume_i(m, channels, vol);
+
+            for (k = 0; k < nvec; k += 4) {
+                __m128i v, cv, e, o;
+
+                v = _mm_loadu_si128((const __m128i *) (src + k));
+                cv = _mm_loadu_si128((const __m128i *) (vol + c));
+
+                e = mult_s32_volume_even_sse2(v, cv);
+                o = mult_s32_volume_even_sse2(_mm_srli_epi64(v, 32), _mm_srli_epi64(cv, 32));
+
+                _mm_store_si128((__m128i *) (acc + k), _mm_add_epi64(_mm_load_si128((__m128i *) (acc + k)), _mm_unpacklo_epi64(e, o)));
+                _mm_store_si128((__m128i *) (acc + k + 2), _mm_add_epi64(_mm_load_si128((__m128i *) (acc + k + 2)), _mm_unpackhi_epi64(e, o)));
+
+                c += step;
+                if (c >= channels)
+                    c -= channels;
+            }
+
+            for (k = nvec; k < n; k++) {
+                acc[k] += ((int64_t) src[k] * vol[c]) >> 16;
+
+                if (PA_UNLIKELY(++c >= channels))
+                    c = 0;
+            }
+
+            m->ptr = (uint8_t *) m->ptr + n * sizeof(int32_t);
+        }
+
+        for (k = 0; k < n; k++)
+            data[k] = (int32_t) PA_CLAMP_UNLIKELY(acc[k], -0x80000000LL, 0x7FFFFFFFLL);
+
+        data += n;
+        length -= n;
+        offset = (offset + n) % channels;
+    }
+}
+
+static void mix_float32ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    PA_DECLARE_ALIGNED(16, float, acc[TILE_SAMPLES]);
+    float vol[PA_CHANNELS_MAX + VOLUME_PADDING];
+    unsigned step = 4 % channels, offset = 0;
+
+    length /= sizeof(float);
+
+    while (length > 0) {
+        unsigned i, k, n = PA_MIN(length, TILE_SAMPLES);
+        unsigned nvec = n & ~3U;
+
+        memset(acc, 0, n * sizeof(float));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const float *src = m->ptr;
+            unsigned c = offset;
+
+            expand_volume_f(m, channels, vol);
+
+            if (step == 0) {
+                const __m128 cv = _mm_loadu_ps(vol + c);
+
+                for (k = 0; k < nvec; k += 4)
+                    _mm_store_ps(acc + k, _mm_add_ps(_mm_load_ps(acc + k), _mm_mul_ps(_mm_loadu_ps(src + k), cv)));
+            } else {
+                for (k = 0; k < nvec; k += 4) {
+                    _mm_store_ps(acc + k, _mm_add_ps(_mm_load_ps(acc + k), _mm_mul_ps(_mm_loadu_ps(src + k), _mm_loadu_ps(vol + c))));
+
+                    c += step;
+                    if (c >= channels)
+                        c -= channels;
+                }
+            }
+
+            for (k = nvec; k < n; k++) {
+                acc[k] += src[k] * vol[c];
+
+                if (PA_UNLIKELY(++c >= channels))
+                    c = 0;
+            }
+
+            m->ptr = (uint8_t *) m->ptr + n * sizeof(float);
+        }
+
+        memcpy(data, acc, n * sizeof(float));
+
+        data += n;
+        length -= n;
+        offset = (offset + n) % channels;
+    }
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_mix_func_init_sse(pa_cpu_x86_flag_t flags) {
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE2 optimized mixing functions.");
+
+        pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) mix_s16ne_sse2);
+        pa_set_mix_func(PA_SAMPLE_S32NE, (pa_do_mix_func_t) mix_s32ne_sse2);
+        pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) mix_float32ne_sse2);
+    }
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
@@ -25,6 +25,7 @@
 
 #include <pulse/cdecl.h>
 #include <pulse/def.h>
+#include <pulse/timeval.h>
 
 PA_C_DECL_BEGIN
 
@@ -176,9 +177,44 @@ enum {
     /* Supported since protocol v27 (3.0) */
     PA_COMMAND_SET_PORT_LATENCY_OFFSET,
 
+    /* Supported since protocol v29 (5.0) */
+    PA_COMMAND_ENABLE_SRBCHANNEL,
+
+    /* Supported since protocol v30 (5.0) */
+    PA_COMMAND_REGISTER_MEMFD_SHMID,
+
+    /* Supported since protocol v31 (5.0) */
+    PA_COMMAND_GET_INFO_LIST_FILTERED,
+
+    /* Supported since protocol v32 (5.0) */
+    PA_COMMAND_SUBSCRIBE_BATCHED,
+    PA_COMMAND_SUBSCRIBE_EVENT_BATCH,
+
+    /* Supported since protocol v33 (5.0) */
+    PA_COMMAND_ENABLE_STREAM_RING,
+
     PA_COMMAND_MAX
 };
 
+/* How many keys and how many matches PA_COMMAND_GET_INFO_LIST_FILTERED
+ * may carry, each */
+#define PA_INFO_FILTER_MAX 256
+
+/* The longest PA_COMMAND_SUBSCRIBE_BATCHED lets the server hold back
+ * events, and the most events one PA_COMMAND_SUBSCRIBE_EVENT_BATCH may
+ * carry */
+#define PA_SUBSCRIBE_BATCH_DELAY_MAX PA_USEC_PER_SEC
+#define PA_SUBSCRIBE_BATCH_EVENTS_MAX 1024
+
+/* The largest ring PA_COMMAND_ENABLE_STREAM_RING hands out */
+#define PA_STREAM_RING_SIZE_MAX (4*1024*1024)
+
+/* The upper bits of the version sent with PA_COMMAND_AUTH and its
+ * reply tell the other side what kind of shared memory we can use */
+#define PA_PROTOCOL_FLAG_SHM     0x80000000U /* Since protocol v13 */
+#define PA_PROTOCOL_FLAG_MEMFD   0x40000000U /* Since protocol v30 */
+#define PA_PROTOCOL_VERSION_MASK 0x0000FFFFU
+
 #define PA_NATIVE_COOKIE_LENGTH 256
 #define PA_NATIVE_COOKIE_FILE ".config/pulse/cookie"
 #define PA_NATIVE_COOKIE_FILE_FALLBACK ".pulse-cookie"
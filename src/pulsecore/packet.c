@@ -24,22 +24,59 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <pulse/xmalloc.h>
+
+#include <pulsecore/flist.h>
 #include <pulsecore/macro.h>
 
 #include "packet.h"
 
+static void packet_free_cb(void *p) {
+    pa_packet *packet = p;
+
+    pa_xfree(packet->heap);
+    pa_xfree(packet);
+}
+
+PA_STATIC_FLIST_DECLARE(packets, 0, packet_free_cb);
+
+static pa_packet *packet_get(void) {
+    pa_packet *p;
+
+    if (!(p = pa_flist_pop(PA_STATIC_FLIST_GET(packets)))) {
+        p = pa_xnew(pa_packet, 1);
+        p->heap = NULL;
+        p->heap_size = 0;
+    }
+
+    PA_REFCNT_INIT(p);
+
+    return p;
+}
+
 pa_packet* pa_packet_new(size_t length) {
     pa_packet *p;
 
     pa_assert(length > 0);
 
-    p = pa_xmalloc(PA_ALIGN(sizeof(pa_packet)) + length);
-    PA_REFCNT_INIT(p);
+    p = packet_get();
     p->length = length;
-    p->data = (uint8_t*) p + PA_ALIGN(sizeof(pa_packet));
-    p->type = PA_PACKET_APPENDED;
+
+    if (length <= sizeof(p->appended)) {
+        p->data = p->appended;
+        p->type = PA_PACKET_APPENDED;
+    } else {
+        if (p->heap_size < length) {
+            pa_xfree(p->heap);
+            p->heap = pa_xmalloc(length);
+            p->heap_size = length;
+        }
+
+        p->data = p->heap;
+        p->type = PA_PACKET_DYNAMIC;
+    }
 
     return p;
 }
@@ -50,15 +87,29 @@ pa_packet* pa_packet_new_dynamic(void* data, size_t length) {
     pa_assert(data);
     pa_assert(length > 0);
 
-    p = pa_xnew(pa_packet, 1);
-    PA_REFCNT_INIT(p);
+    p = packet_get();
     p->length = length;
-    p->data = data;
+
+    /* We take over the buffer */
+    pa_xfree(p->heap);
+    p->data = p->heap = data;
+    p->heap_size = length;
     p->type = PA_PACKET_DYNAMIC;
 
     return p;
 }
 
+pa_packet* pa_packet_new_data(const void* data, size_t length) {
+    pa_packet *p;
+
+    pa_assert(data);
+
+    p = pa_packet_new(length);
+    memcpy(p->data, data, length);
+
+    return p;
+}
+
 pa_packet* pa_packet_ref(pa_packet *p) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) >= 1);
@@ -72,8 +123,13 @@ void pa_packet_unref(pa_packet *p) {
     pa_assert(PA_REFCNT_VALUE(p) >= 1);
 
     if (PA_REFCNT_DEC(p) <= 0) {
-        if (p->type == PA_PACKET_DYNAMIC)
-            pa_xfree(p->data);
-        pa_xfree(p);
+        if (p->heap_size > PA_MAX_POOLED_SIZE) {
+            pa_xfree(p->heap);
+            p->heap = NULL;
+            p->heap_size = 0;
+        }
+
+        if (pa_flist_push(PA_STATIC_FLIST_GET(packets), p) < 0)
+            packet_free_cb(p);
     }
 }
@@ -27,16 +27,34 @@
 
 #include <pulsecore/refcnt.h>
 
+/* Packets up to this size don't need a buffer of their own */
+#define PA_PACKET_APPENDED_SIZE (128)
+
+/* A heap buffer up to this size stays with a packet or tagstruct when
+ * it is freed, so that the next one built doesn't have to allocate it
+ * again. Bigger ones are rare, and not worth keeping around. */
+#define PA_MAX_POOLED_SIZE (8*1024)
+
 typedef struct pa_packet {
     PA_REFCNT_DECLARE;
     enum { PA_PACKET_APPENDED, PA_PACKET_DYNAMIC } type;
     size_t length;
     uint8_t *data;
+
+    /* Packets are recycled, together with any heap buffer that isn't
+     * too big */
+    uint8_t *heap;
+    size_t heap_size;
+
+    uint8_t appended[PA_PACKET_APPENDED_SIZE];
 } pa_packet;
 
 pa_packet* pa_packet_new(size_t length);
 pa_packet* pa_packet_new_dynamic(void* data, size_t length);
 
+/* Copies the data */
+pa_packet* pa_packet_new_data(const void* data, size_t length);
+
 pa_packet* pa_packet_ref(pa_packet *p);
 void pa_packet_unref(pa_packet *p);
 
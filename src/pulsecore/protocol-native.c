@@ -46,6 +46,8 @@
 #include <pulsecore/tagstruct.h>
 #include <pulsecore/pdispatch.h>
 #include <pulsecore/pstream-util.h>
+#include <pulsecore/srbchannel.h>
+#include <pulsecore/shmring.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/core-scache.h>
 #include <pulsecore/core-subscribe.h>
@@ -121,6 +123,10 @@ typedef struct playback_stream {
     pa_sink_input *sink_input;
     pa_memblockq *memblockq;
 
+    /* Where the client writes to instead of sending memblocks, if it
+     * asked for that. Only used from thread context once set. */
+    pa_shmring *ring;
+
     pa_bool_t adjust_latency:1;
     pa_bool_t early_requests:1;
 
@@ -181,6 +187,15 @@ struct pa_native_connection {
     uint32_t rrobin_index;
     pa_subscription *subscription;
     pa_time_event *auth_timeout_event;
+    pa_srbchannel *srbpending;
+
+    /* If memfd was negotiated: the pool of this client alone, which
+     * the blocks we send to it are exported from */
+    pa_mempool *mempool;
+
+    /* While answering PA_COMMAND_GET_INFO_LIST_FILTERED: the properties
+     * the client asked for, NULL-terminated */
+    const char **info_keys;
 };
 
 #define PA_NATIVE_CONNECTION(o) (pa_native_connection_cast(o))
@@ -196,6 +211,9 @@ struct pa_native_protocol {
     pa_hook hooks[PA_NATIVE_HOOK_MAX];
 
     pa_hashmap *extensions;
+
+    /* How big the last reply to each of the info commands was */
+    size_t reply_size_hint[PA_COMMAND_MAX];
 };
 
 enum {
@@ -210,7 +228,8 @@ enum {
     SINK_INPUT_MESSAGE_SEEK,
     SINK_INPUT_MESSAGE_PREBUF_FORCE,
     SINK_INPUT_MESSAGE_UPDATE_LATENCY,
-    SINK_INPUT_MESSAGE_UPDATE_BUFFER_ATTR
+    SINK_INPUT_MESSAGE_UPDATE_BUFFER_ATTR,
+    SINK_INPUT_MESSAGE_SET_RING
 };
 
 enum {
@@ -294,6 +313,10 @@ static void command_extension(pa_pdispatch *pd, uint32_t command, uint32_t tag,
 static void command_set_card_profile(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_sink_or_source_port(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_port_latency_offset(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_register_memfd_shmid(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_enable_stream_ring(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_get_info_list_filtered(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 
 static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_ERROR] = NULL,
@@ -397,6 +420,15 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
 
     [PA_COMMAND_SET_PORT_LATENCY_OFFSET] = command_set_port_latency_offset,
 
+    [PA_COMMAND_ENABLE_SRBCHANNEL] = command_enable_srbchannel,
+    [PA_COMMAND_REGISTER_MEMFD_SHMID] = command_register_memfd_shmid,
+
+    [PA_COMMAND_GET_INFO_LIST_FILTERED] = command_get_info_list_filtered,
+
+    [PA_COMMAND_SUBSCRIBE_BATCHED] = command_subscribe,
+
+    [PA_COMMAND_ENABLE_STREAM_RING] = command_enable_stream_ring,
+
     [PA_COMMAND_EXTENSION] = command_extension
 };
 
@@ -785,6 +817,9 @@ static void playback_stream_free(pa_object* o) {
 
     playback_stream_unlink(s);
 
+    if (s->ring)
+        pa_shmring_free(s->ring);
+
     pa_memblockq_free(s->memblockq);
     pa_xfree(s);
 }
@@ -1169,6 +1204,7 @@ static playback_stream* playback_stream_new(
     s->connection = c;
     s->syncid = syncid;
     s->sink_input = sink_input;
+    s->ring = NULL;
     s->is_underrun = TRUE;
     s->drain_request = FALSE;
     pa_atomic_store(&s->missing, 0);
@@ -1332,6 +1368,18 @@ static void native_connection_unlink(pa_native_connection *c) {
     if (c->pstream)
         pa_pstream_unlink(c->pstream);
 
+    if (c->srbpending) {
+        pa_srbchannel_free(c->srbpending);
+        c->srbpending = NULL;
+    }
+
+    /* The pstream let go of all blocks it exported when it was
+     * unlinked */
+    if (c->mempool) {
+        pa_mempool_free(c->mempool);
+        c->mempool = NULL;
+    }
+
     if (c->auth_timeout_event) {
         c->protocol->core->mainloop->time_free(c->auth_timeout_event);
         c->auth_timeout_event = NULL;
@@ -1434,6 +1482,68 @@ static void handle_seek(playback_stream *s, int64_t indexw) {
     playback_stream_request_bytes(s);
 }
 
+/* Called from thread context */
+static void playback_stream_take_ring(playback_stream *s) {
+    size_t length, max;
+
+    playback_stream_assert_ref(s);
+
+    if (!s->ring)
+        return;
+
+    max = pa_mempool_block_size_max(s->sink_input->core->mempool);
+
+    /* Take no more than what the queue would have asked the client
+     * for, the rest stays in the ring until the sink needs it */
+    while ((length = pa_memblockq_get_length(s->memblockq)) < s->buffer_attr.tlength) {
+        pa_memchunk chunk;
+        const void *src;
+        void *dst;
+        size_t l;
+
+        l = PA_MIN((size_t) s->buffer_attr.tlength - length, max);
+
+        src = pa_shmring_peek(s->ring, &l);
+
+        if (l <= 0)
+            break;
+
+        chunk.memblock = pa_memblock_new(s->sink_input->core->mempool, l);
+        chunk.index = 0;
+        chunk.length = l;
+
+        dst = pa_memblock_acquire(chunk.memblock);
+        memcpy(dst, src, l);
+        pa_memblock_release(chunk.memblock);
+
+        pa_shmring_drop(s->ring, l);
+
+        if (pa_memblockq_push_align(s->memblockq, &chunk) < 0) {
+            if (pa_log_ratelimit(PA_LOG_WARN))
+                pa_log_warn("Failed to push ring data into queue");
+            pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_OVERFLOW, NULL, 0, NULL, NULL);
+            pa_memblockq_seek(s->memblockq, (int64_t) l, PA_SEEK_RELATIVE, TRUE);
+        }
+
+        pa_memblock_unref(chunk.memblock);
+    }
+}
+
+/* Called from thread context */
+static void playback_stream_sync_ring(playback_stream *s, pa_bool_t flush) {
+    playback_stream_assert_ref(s);
+
+    if (!s->ring)
+        return;
+
+    /* Whatever the client wrote to the ring before a command was
+     * written before the command, too */
+    if (flush)
+        pa_shmring_drop(s->ring, pa_shmring_readable(s->ring));
+    else
+        playback_stream_take_ring(s);
+}
+
 static void flush_write_no_account(pa_memblockq *q) {
     pa_memblockq_flush_write(q, FALSE);
 }
@@ -1509,6 +1619,7 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
             }
 
             windex = pa_memblockq_get_write_index(s->memblockq);
+            playback_stream_sync_ring(s, code == SINK_INPUT_MESSAGE_FLUSH);
             func(s->memblockq);
             handle_seek(s, windex);
 
@@ -1516,6 +1627,7 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
             for (isync = i->sync_prev; isync; isync = isync->sync_prev) {
                 playback_stream *ssync = PLAYBACK_STREAM(isync->userdata);
                 windex = pa_memblockq_get_write_index(ssync->memblockq);
+                playback_stream_sync_ring(ssync, code == SINK_INPUT_MESSAGE_FLUSH);
                 func(ssync->memblockq);
                 handle_seek(ssync, windex);
             }
@@ -1523,6 +1635,7 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
             for (isync = i->sync_next; isync; isync = isync->sync_next) {
                 playback_stream *ssync = PLAYBACK_STREAM(isync->userdata);
                 windex = pa_memblockq_get_write_index(ssync->memblockq);
+                playback_stream_sync_ring(ssync, code == SINK_INPUT_MESSAGE_FLUSH);
                 func(ssync->memblockq);
                 handle_seek(ssync, windex);
             }
@@ -1578,6 +1691,10 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
             pa_memblockq_get_attr(s->memblockq, &s->buffer_attr);
             return 0;
         }
+
+        case SINK_INPUT_MESSAGE_SET_RING:
+            s->ring = userdata;
+            return 0;
     }
 
     return pa_sink_input_process_msg(o, code, userdata, offset, chunk);
@@ -1617,6 +1734,8 @@ static bool sink_input_process_underrun_cb(pa_sink_input *i) {
     s = PLAYBACK_STREAM(i->userdata);
     playback_stream_assert_ref(s);
 
+    playback_stream_take_ring(s);
+
     return handle_input_underrun(s, true);
 }
 
@@ -1634,6 +1753,8 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     pa_log("%s, pop(): %lu", pa_proplist_gets(i->proplist, PA_PROP_MEDIA_NAME), (unsigned long) pa_memblockq_get_length(s->memblockq));
 #endif
 
+    playback_stream_take_ring(s);
+
     if (!handle_input_underrun(s, false))
         s->is_underrun = false;
 
@@ -1963,6 +2084,22 @@ static pa_tagstruct *reply_new(uint32_t tag) {
     return reply;
 }
 
+/* Info replies are assembled from many small pieces, and clients tend
+ * to ask for the same ones again and again. Start with as much room as
+ * the last reply to the command needed. */
+static pa_tagstruct *info_reply_new(pa_native_connection *c, uint32_t command, uint32_t tag) {
+    pa_tagstruct *reply;
+
+    reply = reply_new(tag);
+    pa_tagstruct_reserve(reply, c->protocol->reply_size_hint[command]);
+    return reply;
+}
+
+static void info_reply_send(pa_native_connection *c, uint32_t command, pa_tagstruct *reply) {
+    pa_tagstruct_data(reply, &c->protocol->reply_size_hint[command]);
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
 static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     playback_stream *s;
@@ -2566,11 +2703,68 @@ static void command_exit(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_pstream_send_simple_ack(c->pstream, tag); /* nonsense */
 }
 
+/* Offer the client a shared memory ring buffer channel. It is only
+ * used once the client confirms it with PA_COMMAND_ENABLE_SRBCHANNEL. */
+static void setup_srbchannel(pa_native_connection *c) {
+#ifdef HAVE_CREDS
+    pa_srbchannel_template srbt;
+    pa_srbchannel *srb;
+    pa_tagstruct *t;
+    int fdlist[3], nfd = 2;
+
+    if (!c->options->srbchannel) {
+        pa_log_debug("Not using a ring buffer channel, disabled by module argument.");
+        return;
+    }
+
+    if (c->version < 29) {
+        pa_log_debug("Not using a ring buffer channel, client protocol version too old.");
+        return;
+    }
+
+    if (!pa_pstream_get_shm(c->pstream)) {
+        pa_log_debug("Not using a ring buffer channel, SHM is not in use.");
+        return;
+    }
+
+    /* Clients that use memfd might not be able to open POSIX shm */
+    if (!(srb = pa_srbchannel_new(c->protocol->core->mainloop,
+                                  c->mempool ? PA_MEM_TYPE_SHARED_MEMFD : PA_MEM_TYPE_SHARED_POSIX))) {
+        pa_log_debug("Failed to create ring buffer channel.");
+        return;
+    }
+
+    pa_srbchannel_export(srb, &srbt);
+    fdlist[0] = srbt.readfd;
+    fdlist[1] = srbt.writefd;
+
+    if (srbt.memfd >= 0)
+        fdlist[nfd++] = srbt.memfd;
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(t, PA_COMMAND_ENABLE_SRBCHANNEL);
+    pa_tagstruct_putu32(t, (uint32_t) (size_t) srb); /* tag */
+    pa_tagstruct_putu32(t, srbt.shm_id);
+
+    if (pa_pstream_send_tagstruct_with_fds(c->pstream, t, nfd, fdlist) < 0) {
+        pa_srbchannel_free(srb);
+        return;
+    }
+
+    pa_log_debug("Offering ring buffer channel to client.");
+
+    /* The file descriptors have to stay open until the packet has
+     * been sent, so we keep the channel around until the client
+     * replies or goes away */
+    c->srbpending = srb;
+#endif
+}
+
 static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     const void*cookie;
     pa_tagstruct *reply;
-    pa_bool_t shm_on_remote = FALSE, do_shm;
+    pa_bool_t shm_on_remote = FALSE, memfd_on_remote = FALSE, do_shm, do_memfd = FALSE;
 
     pa_native_connection_assert_ref(c);
     pa_assert(t);
@@ -2590,10 +2784,14 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
 
     /* Starting with protocol version 13 the MSB of the version tag
        reflects if shm is available for this pa_native_connection or
-       not. */
+       not, starting with version 30 the next bit if memfd is. */
     if (c->version >= 13) {
-        shm_on_remote = !!(c->version & 0x80000000U);
-        c->version &= 0x7FFFFFFFU;
+        shm_on_remote = !!(c->version & PA_PROTOCOL_FLAG_SHM);
+        memfd_on_remote = !!(c->version & PA_PROTOCOL_FLAG_MEMFD);
+        c->version &= PA_PROTOCOL_VERSION_MASK;
+
+        if (c->version < 30)
+            memfd_on_remote = FALSE;
     }
 
     pa_log_debug("Protocol version: remote %u, local %u", c->version, PA_PROTOCOL_VERSION);
@@ -2680,8 +2878,24 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_log_debug("Negotiated SHM: %s", pa_yes_no(do_shm));
     pa_pstream_enable_shm(c->pstream, do_shm);
 
+#if defined(HAVE_MEMFD) && defined(HAVE_CREDS)
+    /* With memfd the client doesn't need access to our POSIX shm
+     * segments: it gets a pool of its own, passed over the socket. A
+     * client hogging its blocks then can't starve the others. */
+    if (do_shm && memfd_on_remote && !c->protocol->core->disable_memfd) {
+        if ((c->mempool = pa_mempool_new(PA_MEM_TYPE_SHARED_MEMFD, c->protocol->core->shm_size)))
+            do_memfd = TRUE;
+        else
+            pa_log_warn("Failed to allocate memfd memory pool for client, falling back to POSIX shm.");
+    }
+#endif
+
+    pa_log_debug("Negotiated memfd: %s", pa_yes_no(do_memfd));
+
     reply = reply_new(tag);
-    pa_tagstruct_putu32(reply, PA_PROTOCOL_VERSION | (do_shm ? 0x80000000 : 0));
+    pa_tagstruct_putu32(reply, PA_PROTOCOL_VERSION |
+                        (do_shm ? PA_PROTOCOL_FLAG_SHM : 0) |
+                        (do_memfd ? PA_PROTOCOL_FLAG_MEMFD : 0));
 
 #ifdef HAVE_CREDS
 {
@@ -2697,6 +2911,13 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
 #else
     pa_pstream_send_tagstruct(c->pstream, reply);
 #endif
+
+    /* The client knows about memfd from the reply now, so the pool
+     * has to be registered before anything references it */
+    if (do_memfd)
+        pa_assert_se(pa_pstream_register_memfd_mempool(c->pstream, c->mempool) == 0);
+
+    setup_srbchannel(c);
 }
 
 static void command_set_client_name(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -3111,6 +3332,31 @@ static void fixup_sample_spec(pa_native_connection *c, pa_sample_spec *fixed, co
     }
 }
 
+/* Puts the properties of an object, or only the ones the client asked
+ * for if this is for PA_COMMAND_GET_INFO_LIST_FILTERED */
+static void fill_proplist(pa_native_connection *c, pa_tagstruct *t, pa_proplist *p) {
+    pa_proplist *projected;
+    const char **k;
+
+    if (!c->info_keys) {
+        pa_tagstruct_put_proplist(t, p);
+        return;
+    }
+
+    projected = pa_proplist_new();
+
+    for (k = c->info_keys; *k; k++) {
+        const void *data;
+        size_t nbytes;
+
+        if (pa_proplist_get(p, *k, &data, &nbytes) >= 0)
+            pa_proplist_set(projected, *k, data, nbytes);
+    }
+
+    pa_tagstruct_put_proplist(t, projected);
+    pa_proplist_free(projected);
+}
+
 static void sink_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_sink *sink) {
     pa_sample_spec fixed_ss;
 
@@ -3137,7 +3383,7 @@ static void sink_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_sin
         PA_TAG_INVALID);
 
     if (c->version >= 13) {
-        pa_tagstruct_put_proplist(t, sink->proplist);
+        fill_proplist(c, t, sink->proplist);
         pa_tagstruct_put_usec(t, pa_sink_get_requested_latency(sink));
     }
 
@@ -3207,7 +3453,7 @@ static void source_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_s
         PA_TAG_INVALID);
 
     if (c->version >= 13) {
-        pa_tagstruct_put_proplist(t, source->proplist);
+        fill_proplist(c, t, source->proplist);
         pa_tagstruct_put_usec(t, pa_source_get_requested_latency(source));
     }
 
@@ -3261,7 +3507,7 @@ static void client_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_c
     pa_tagstruct_puts(t, client->driver);
 
     if (c->version >= 13)
-        pa_tagstruct_put_proplist(t, client->proplist);
+        fill_proplist(c, t, client->proplist);
 }
 
 static void card_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_card *card) {
@@ -3288,7 +3534,7 @@ static void card_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_car
     }
 
     pa_tagstruct_puts(t, card->active_profile->name);
-    pa_tagstruct_put_proplist(t, card->proplist);
+    fill_proplist(c, t, card->proplist);
 
     if (c->version < 26)
         return;
@@ -3328,7 +3574,7 @@ static void module_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_m
         pa_tagstruct_put_boolean(t, FALSE); /* autoload is obsolete */
 
     if (c->version >= 15)
-        pa_tagstruct_put_proplist(t, module->proplist);
+        fill_proplist(c, t, module->proplist);
 }
 
 static void sink_input_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_sink_input *s) {
@@ -3363,7 +3609,7 @@ static void sink_input_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t,
     if (c->version >= 11)
         pa_tagstruct_put_boolean(t, pa_sink_input_get_mute(s));
     if (c->version >= 13)
-        pa_tagstruct_put_proplist(t, s->proplist);
+        fill_proplist(c, t, s->proplist);
     if (c->version >= 19)
         pa_tagstruct_put_boolean(t, (pa_sink_input_get_state(s) == PA_SINK_INPUT_CORKED));
     if (c->version >= 20) {
@@ -3403,7 +3649,7 @@ static void source_output_fill_tagstruct(pa_native_connection *c, pa_tagstruct *
     pa_tagstruct_puts(t, pa_resample_method_to_string(pa_source_output_get_resample_method(s)));
     pa_tagstruct_puts(t, s->driver);
     if (c->version >= 13)
-        pa_tagstruct_put_proplist(t, s->proplist);
+        fill_proplist(c, t, s->proplist);
     if (c->version >= 19)
         pa_tagstruct_put_boolean(t, (pa_source_output_get_state(s) == PA_SOURCE_OUTPUT_CORKED));
     if (c->version >= 22) {
@@ -3444,7 +3690,7 @@ static void scache_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_s
     pa_tagstruct_puts(t, e->filename);
 
     if (c->version >= 13)
-        pa_tagstruct_put_proplist(t, e->proplist);
+        fill_proplist(c, t, e->proplist);
 }
 
 static void command_get_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -3524,7 +3770,7 @@ static void command_get_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, p
         return;
     }
 
-    reply = reply_new(tag);
+    reply = info_reply_new(c, command, tag);
     if (sink)
         sink_fill_tagstruct(c, reply, sink);
     else if (source)
@@ -3541,11 +3787,67 @@ static void command_get_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, p
         source_output_fill_tagstruct(c, reply, so);
     else
         scache_fill_tagstruct(c, reply, sce);
-    pa_pstream_send_tagstruct(c->pstream, reply);
+    info_reply_send(c, command, reply);
+}
+
+/* The objects a PA_COMMAND_GET_*_INFO_LIST command lists, and the
+ * facility of their subscription events */
+static pa_idxset *info_list_objects(pa_native_connection *c, uint32_t command, pa_subscription_event_type_t *facility) {
+    pa_core *core = c->protocol->core;
+
+    switch (command) {
+        case PA_COMMAND_GET_SINK_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_SINK;
+            return core->sinks;
+        case PA_COMMAND_GET_SOURCE_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_SOURCE;
+            return core->sources;
+        case PA_COMMAND_GET_CLIENT_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_CLIENT;
+            return core->clients;
+        case PA_COMMAND_GET_CARD_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_CARD;
+            return core->cards;
+        case PA_COMMAND_GET_MODULE_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_MODULE;
+            return core->modules;
+        case PA_COMMAND_GET_SINK_INPUT_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_SINK_INPUT;
+            return core->sink_inputs;
+        case PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT;
+            return core->source_outputs;
+        default:
+            pa_assert(command == PA_COMMAND_GET_SAMPLE_INFO_LIST);
+            *facility = PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE;
+            return core->scache;
+    }
+}
+
+static void info_list_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, uint32_t command, void *p) {
+    if (command == PA_COMMAND_GET_SINK_INFO_LIST)
+        sink_fill_tagstruct(c, t, p);
+    else if (command == PA_COMMAND_GET_SOURCE_INFO_LIST)
+        source_fill_tagstruct(c, t, p);
+    else if (command == PA_COMMAND_GET_CLIENT_INFO_LIST)
+        client_fill_tagstruct(c, t, p);
+    else if (command == PA_COMMAND_GET_CARD_INFO_LIST)
+        card_fill_tagstruct(c, t, p);
+    else if (command == PA_COMMAND_GET_MODULE_INFO_LIST)
+        module_fill_tagstruct(c, t, p);
+    else if (command == PA_COMMAND_GET_SINK_INPUT_INFO_LIST)
+        sink_input_fill_tagstruct(c, t, p);
+    else if (command == PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST)
+        source_output_fill_tagstruct(c, t, p);
+    else {
+        pa_assert(command == PA_COMMAND_GET_SAMPLE_INFO_LIST);
+        scache_fill_tagstruct(c, t, p);
+    }
 }
 
 static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_subscription_event_type_t facility;
     pa_idxset *i;
     uint32_t idx;
     void *p;
@@ -3561,51 +3863,213 @@ static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t t
 
     CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
 
-    reply = reply_new(tag);
+    reply = info_reply_new(c, command, tag);
 
-    if (command == PA_COMMAND_GET_SINK_INFO_LIST)
-        i = c->protocol->core->sinks;
-    else if (command == PA_COMMAND_GET_SOURCE_INFO_LIST)
-        i = c->protocol->core->sources;
-    else if (command == PA_COMMAND_GET_CLIENT_INFO_LIST)
-        i = c->protocol->core->clients;
-    else if (command == PA_COMMAND_GET_CARD_INFO_LIST)
-        i = c->protocol->core->cards;
-    else if (command == PA_COMMAND_GET_MODULE_INFO_LIST)
-        i = c->protocol->core->modules;
-    else if (command == PA_COMMAND_GET_SINK_INPUT_INFO_LIST)
-        i = c->protocol->core->sink_inputs;
-    else if (command == PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST)
-        i = c->protocol->core->source_outputs;
-    else {
-        pa_assert(command == PA_COMMAND_GET_SAMPLE_INFO_LIST);
-        i = c->protocol->core->scache;
+    if ((i = info_list_objects(c, command, &facility)))
+        PA_IDXSET_FOREACH(p, i, idx)
+            info_list_fill_tagstruct(c, reply, command, p);
+
+    info_reply_send(c, command, reply);
+}
+
+static pa_proplist *info_list_proplist(uint32_t command, void *p) {
+    switch (command) {
+        case PA_COMMAND_GET_SINK_INFO_LIST:
+            return ((pa_sink*) p)->proplist;
+        case PA_COMMAND_GET_SOURCE_INFO_LIST:
+            return ((pa_source*) p)->proplist;
+        case PA_COMMAND_GET_CLIENT_INFO_LIST:
+            return ((pa_client*) p)->proplist;
+        case PA_COMMAND_GET_CARD_INFO_LIST:
+            return ((pa_card*) p)->proplist;
+        case PA_COMMAND_GET_MODULE_INFO_LIST:
+            return ((pa_module*) p)->proplist;
+        case PA_COMMAND_GET_SINK_INPUT_INFO_LIST:
+            return ((pa_sink_input*) p)->proplist;
+        case PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST:
+            return ((pa_source_output*) p)->proplist;
+        default:
+            pa_assert(command == PA_COMMAND_GET_SAMPLE_INFO_LIST);
+            return ((pa_scache_entry*) p)->proplist;
     }
+}
 
-    if (i) {
-        PA_IDXSET_FOREACH(p, i, idx) {
-            if (command == PA_COMMAND_GET_SINK_INFO_LIST)
-                sink_fill_tagstruct(c, reply, p);
-            else if (command == PA_COMMAND_GET_SOURCE_INFO_LIST)
-                source_fill_tagstruct(c, reply, p);
-            else if (command == PA_COMMAND_GET_CLIENT_INFO_LIST)
-                client_fill_tagstruct(c, reply, p);
-            else if (command == PA_COMMAND_GET_CARD_INFO_LIST)
-                card_fill_tagstruct(c, reply, p);
-            else if (command == PA_COMMAND_GET_MODULE_INFO_LIST)
-                module_fill_tagstruct(c, reply, p);
-            else if (command == PA_COMMAND_GET_SINK_INPUT_INFO_LIST)
-                sink_input_fill_tagstruct(c, reply, p);
-            else if (command == PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST)
-                source_output_fill_tagstruct(c, reply, p);
-            else {
-                pa_assert(command == PA_COMMAND_GET_SAMPLE_INFO_LIST);
-                scache_fill_tagstruct(c, reply, p);
-            }
+static uint32_t info_list_index(uint32_t command, void *p) {
+    switch (command) {
+        case PA_COMMAND_GET_SINK_INFO_LIST:
+            return ((pa_sink*) p)->index;
+        case PA_COMMAND_GET_SOURCE_INFO_LIST:
+            return ((pa_source*) p)->index;
+        case PA_COMMAND_GET_CLIENT_INFO_LIST:
+            return ((pa_client*) p)->index;
+        case PA_COMMAND_GET_CARD_INFO_LIST:
+            return ((pa_card*) p)->index;
+        case PA_COMMAND_GET_MODULE_INFO_LIST:
+            return ((pa_module*) p)->index;
+        case PA_COMMAND_GET_SINK_INPUT_INFO_LIST:
+            return ((pa_sink_input*) p)->index;
+        case PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST:
+            return ((pa_source_output*) p)->index;
+        default:
+            pa_assert(command == PA_COMMAND_GET_SAMPLE_INFO_LIST);
+            return ((pa_scache_entry*) p)->index;
+    }
+}
+
+/* A NULL value only asks for the property to be there */
+static pa_bool_t info_list_matches(pa_proplist *p, const char **match_keys, const char **match_values, unsigned n_match) {
+    unsigned k;
+
+    for (k = 0; k < n_match; k++) {
+        const char *v;
+
+        if (!match_values[k]) {
+            if (!pa_proplist_contains(p, match_keys[k]))
+                return FALSE;
+
+            continue;
         }
+
+        if (!(v = pa_proplist_gets(p, match_keys[k])) || !pa_streq(v, match_values[k]))
+            return FALSE;
     }
 
-    pa_pstream_send_tagstruct(c->pstream, reply);
+    return TRUE;
+}
+
+/* Like the PA_COMMAND_GET_*_INFO_LIST commands, but only lists what
+ * matches the client's properties and what changed since the generation
+ * it got the last time, and only with the properties it asked for */
+static void command_get_info_list_filtered(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_core *core;
+    pa_subscription_event_type_t facility;
+    uint32_t list_command, n_keys, n_match = 0, idx, *removed = NULL;
+    uint64_t since;
+    const char **keys = NULL, **match_keys = NULL, **match_values = NULL;
+    unsigned n_removed = 0, k;
+    pa_bool_t full, ok = TRUE;
+    pa_idxset *i;
+    void *p;
+    pa_tagstruct *reply;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    core = c->protocol->core;
+
+    if (pa_tagstruct_getu32(t, &list_command) < 0 ||
+        pa_tagstruct_getu64(t, &since) < 0 ||
+        pa_tagstruct_getu32(t, &n_keys) < 0 ||
+        (n_keys != PA_INVALID_INDEX && n_keys > PA_INFO_FILTER_MAX)) {
+        protocol_error(c);
+        return;
+    }
+
+    if (n_keys != PA_INVALID_INDEX) {
+        keys = pa_xnew0(const char*, n_keys + 1);
+
+        for (k = 0; k < n_keys && ok; k++)
+            ok = pa_tagstruct_gets(t, &keys[k]) >= 0 && keys[k];
+    }
+
+    if (ok && (pa_tagstruct_getu32(t, &n_match) < 0 || n_match > PA_INFO_FILTER_MAX))
+        ok = FALSE;
+
+    if (ok && n_match > 0) {
+        match_keys = pa_xnew(const char*, n_match);
+        match_values = pa_xnew(const char*, n_match);
+
+        for (k = 0; k < n_match && ok; k++)
+            ok = pa_tagstruct_gets(t, &match_keys[k]) >= 0 && match_keys[k] &&
+                pa_tagstruct_gets(t, &match_values[k]) >= 0;
+    }
+
+    if (!ok || !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        goto finish;
+    }
+
+    if (!c->authorized) {
+        pa_pstream_send_error(c->pstream, tag, PA_ERR_ACCESS);
+        goto finish;
+    }
+
+    if (c->version < 31) {
+        pa_pstream_send_error(c->pstream, tag, PA_ERR_PROTOCOL);
+        goto finish;
+    }
+
+    ok = list_command == PA_COMMAND_GET_SINK_INFO_LIST ||
+        list_command == PA_COMMAND_GET_SOURCE_INFO_LIST ||
+        list_command == PA_COMMAND_GET_CLIENT_INFO_LIST ||
+        list_command == PA_COMMAND_GET_CARD_INFO_LIST ||
+        list_command == PA_COMMAND_GET_MODULE_INFO_LIST ||
+        list_command == PA_COMMAND_GET_SINK_INPUT_INFO_LIST ||
+        list_command == PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST ||
+        list_command == PA_COMMAND_GET_SAMPLE_INFO_LIST;
+
+    for (k = 0; keys && keys[k] && ok; k++)
+        ok = pa_proplist_key_valid(keys[k]);
+
+    for (k = 0; k < n_match && ok; k++)
+        ok = pa_proplist_key_valid(match_keys[k]);
+
+    if (!ok) {
+        pa_pstream_send_error(c->pstream, tag, PA_ERR_INVALID);
+        goto finish;
+    }
+
+    i = info_list_objects(c, list_command, &facility);
+
+    /* If the removals since then have been forgotten already, the client
+     * gets the whole list again */
+    full = since == 0 || pa_subscription_get_removed(core, facility, since, &removed, &n_removed) < 0;
+
+    /* To the client, objects that changed and don't match anymore are
+     * gone, too */
+    if (!full && i && n_match > 0) {
+        removed = pa_xrenew(uint32_t, removed, n_removed + pa_idxset_size(i));
+
+        PA_IDXSET_FOREACH(p, i, idx)
+            if (pa_subscription_get_generation(core, facility, info_list_index(list_command, p)) > since &&
+                !info_list_matches(info_list_proplist(list_command, p), match_keys, match_values, n_match))
+                removed[n_removed++] = info_list_index(list_command, p);
+    }
+
+    reply = info_reply_new(c, command, tag);
+    pa_tagstruct_putu64(reply, core->generation);
+    pa_tagstruct_put_boolean(reply, full);
+
+    if (!full) {
+        pa_tagstruct_putu32(reply, n_removed);
+
+        for (k = 0; k < n_removed; k++)
+            pa_tagstruct_putu32(reply, removed[k]);
+    }
+
+    c->info_keys = keys;
+
+    if (i)
+        PA_IDXSET_FOREACH(p, i, idx) {
+            if (!full && pa_subscription_get_generation(core, facility, info_list_index(list_command, p)) <= since)
+                continue;
+
+            if (!info_list_matches(info_list_proplist(list_command, p), match_keys, match_values, n_match))
+                continue;
+
+            info_list_fill_tagstruct(c, reply, list_command, p);
+        }
+
+    c->info_keys = NULL;
+
+    info_reply_send(c, command, reply);
+
+finish:
+    pa_xfree(keys);
+    pa_xfree(match_keys);
+    pa_xfree(match_values);
+    pa_xfree(removed);
 }
 
 static void command_get_server_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -3668,30 +4132,61 @@ static void subscription_cb(pa_core *core, pa_subscription_event_type_t e, uint3
     pa_pstream_send_tagstruct(c->pstream, t);
 }
 
+static void subscription_batch_cb(pa_core *core, const pa_subscription_batch_event *events, unsigned n, void *userdata) {
+    pa_tagstruct *t;
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    unsigned k, l;
+
+    pa_native_connection_assert_ref(c);
+
+    for (k = 0; k < n; k += l) {
+        unsigned i;
+
+        l = PA_MIN(n - k, PA_SUBSCRIBE_BATCH_EVENTS_MAX);
+
+        t = pa_tagstruct_new(NULL, 0);
+        pa_tagstruct_putu32(t, PA_COMMAND_SUBSCRIBE_EVENT_BATCH);
+        pa_tagstruct_putu32(t, (uint32_t) -1);
+        pa_tagstruct_putu32(t, l);
+
+        for (i = k; i < k + l; i++) {
+            pa_tagstruct_putu32(t, events[i].type);
+            pa_tagstruct_putu32(t, events[i].index);
+        }
+
+        pa_pstream_send_tagstruct(c->pstream, t);
+    }
+}
+
 static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     pa_subscription_mask_t m;
+    pa_usec_t max_delay = 0;
 
     pa_native_connection_assert_ref(c);
     pa_assert(t);
 
     if (pa_tagstruct_getu32(t, &m) < 0 ||
+        (command == PA_COMMAND_SUBSCRIBE_BATCHED && pa_tagstruct_get_usec(t, &max_delay) < 0) ||
         !pa_tagstruct_eof(t)) {
         protocol_error(c);
         return;
     }
 
     CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream, command != PA_COMMAND_SUBSCRIBE_BATCHED || c->version >= 32, tag, PA_ERR_PROTOCOL);
     CHECK_VALIDITY(c->pstream, (m & ~PA_SUBSCRIPTION_MASK_ALL) == 0, tag, PA_ERR_INVALID);
+    CHECK_VALIDITY(c->pstream, max_delay <= PA_SUBSCRIBE_BATCH_DELAY_MAX, tag, PA_ERR_INVALID);
 
     if (c->subscription)
         pa_subscription_free(c->subscription);
 
-    if (m != 0) {
-        c->subscription = pa_subscription_new(c->protocol->core, m, subscription_cb, c);
-        pa_assert(c->subscription);
-    } else
+    if (m == 0)
         c->subscription = NULL;
+    else if (command == PA_COMMAND_SUBSCRIBE_BATCHED)
+        c->subscription = pa_subscription_new_batched(c->protocol->core, m, max_delay, subscription_batch_cb, c);
+    else
+        c->subscription = pa_subscription_new(c->protocol->core, m, subscription_cb, c);
 
     pa_pstream_send_simple_ack(c->pstream, tag);
 }
@@ -4805,16 +5300,114 @@ static void command_set_port_latency_offset(pa_pdispatch *pd, uint32_t command,
     pa_pstream_send_simple_ack(c->pstream, tag);
 }
 
+static void command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (!pa_tagstruct_eof(t) ||
+        !c->srbpending ||
+        tag != (uint32_t) (size_t) c->srbpending) {
+        protocol_error(c);
+        return;
+    }
+
+    pa_log_debug("Client enabled the ring buffer channel.");
+
+    pa_pstream_set_srbchannel(c->pstream, c->srbpending);
+    c->srbpending = NULL;
+}
+
+static void command_register_memfd_shmid(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t shm_id;
+    const int *fds;
+    int nfd;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &shm_id) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    fds = pa_pdispatch_fds(pd, &nfd);
+
+    if (!fds || nfd != 1 || c->version < 30) {
+        protocol_error(c);
+        return;
+    }
+
+    /* Without SHM we simply don't use it */
+    if (pa_pstream_attach_memfd_shmid(c->pstream, shm_id, fds[0]) < 0)
+        pa_log_debug("Failed to attach memfd pool %u of client.", shm_id);
+}
+
+static void command_enable_stream_ring(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t channel;
+    playback_stream *s;
+    pa_shmring *ring;
+    pa_tagstruct *reply;
+    int memfd;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &channel) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    /* Older clients would choke on the marker that goes with the reply */
+    CHECK_VALIDITY(c->pstream, c->version >= 33, tag, PA_ERR_PROTOCOL);
+    s = pa_idxset_get_by_index(c->output_streams, channel);
+    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, playback_stream_isinstance(s), tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, !s->ring, tag, PA_ERR_BADSTATE);
+    CHECK_VALIDITY(c->pstream, pa_pstream_get_shm(c->pstream), tag, PA_ERR_NOTSUPPORTED);
+
+    /* The ring lives in a segment of its own, so that the client can
+     * write to it without talking to us. A memfd one only if memfd was
+     * negotiated, otherwise the client can't receive it. */
+    if (!(ring = pa_shmring_new(c->mempool ? PA_MEM_TYPE_SHARED_MEMFD : PA_MEM_TYPE_SHARED_POSIX,
+                                PA_MIN((size_t) s->buffer_attr.tlength, (size_t) PA_STREAM_RING_SIZE_MAX),
+                                pa_frame_size(&s->sink_input->sample_spec)))) {
+        pa_pstream_send_error(c->pstream, tag, PA_ERR_INTERNAL);
+        return;
+    }
+
+    pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_SET_RING, ring, 0, NULL) == 0);
+
+    pa_log_debug("Client enabled the ring for playback stream %u, %lu bytes.", channel, (unsigned long) pa_shmring_get_capacity(ring));
+
+    reply = reply_new(tag);
+    pa_tagstruct_putu32(reply, pa_shmring_get_shm_id(ring));
+    pa_tagstruct_putu32(reply, (uint32_t) pa_shmring_get_capacity(ring));
+
+    if ((memfd = pa_shmring_get_memfd(ring)) >= 0)
+        pa_pstream_send_tagstruct_with_fds(c->pstream, reply, 1, &memfd);
+    else
+        pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
 /*** pstream callbacks ***/
 
-static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata) {
+static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
 
     pa_assert(p);
     pa_assert(packet);
     pa_native_connection_assert_ref(c);
 
-    if (pa_pdispatch_run(c->pdispatch, packet, creds, c) < 0) {
+    if (pa_pdispatch_run(c->pdispatch, packet, ancil_data, c) < 0) {
         pa_log("invalid packet.");
         native_connection_unlink(c);
     }
@@ -5029,6 +5622,7 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
 
     c->is_local = pa_iochannel_socket_is_local(io);
     c->version = 8;
+    c->info_keys = NULL;
 
     c->client = client;
     c->client->kill = client_kill_cb;
@@ -5084,6 +5678,8 @@ static pa_native_protocol* native_protocol_new(pa_core *c) {
     p->core = c;
     p->connections = pa_idxset_new(NULL, NULL);
 
+    memset(p->reply_size_hint, 0, sizeof(p->reply_size_hint));
+
     p->servers = NULL;
 
     p->extensions = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
@@ -5200,6 +5796,8 @@ pa_native_options* pa_native_options_new(void) {
     o = pa_xnew0(pa_native_options, 1);
     PA_REFCNT_INIT(o);
 
+    o->srbchannel = TRUE;
+
     return o;
 }
 
@@ -5243,6 +5841,11 @@ int pa_native_options_parse(pa_native_options *o, pa_core *c, pa_modargs *ma) {
         return -1;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "srbchannel", &o->srbchannel) < 0) {
+        pa_log("srbchannel= expects a boolean argument.");
+        return -1;
+    }
+
     enabled = TRUE;
     if (pa_modargs_get_value_boolean(ma, "auth-group-enable", &enabled) < 0) {
         pa_log("auth-group-enable= expects a boolean argument.");
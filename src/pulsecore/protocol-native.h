@@ -47,6 +47,9 @@ typedef struct pa_native_options {
     char *auth_group;
     pa_ip_acl *auth_ip_acl;
     pa_auth_cookie *auth_cookie;
+
+    /* Offer local clients a shared memory ring buffer channel */
+    pa_bool_t srbchannel;
 } pa_native_options;
 
 typedef enum pa_native_hook {
@@ -23,25 +23,83 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <pulsecore/native-common.h>
+#include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 
 #include "pstream-util.h"
 
-void pa_pstream_send_tagstruct_with_creds(pa_pstream *p, pa_tagstruct *t, const pa_creds *creds) {
+static void send_tagstruct_with_ancil_data(pa_pstream *p, pa_tagstruct *t, const pa_cmsg_ancil_data *ancil_data) {
     size_t length;
-    uint8_t *data;
+    const uint8_t *data;
     pa_packet *packet;
 
     pa_assert(p);
     pa_assert(t);
 
-    pa_assert_se(data = pa_tagstruct_free_data(t, &length));
-    pa_assert_se(packet = pa_packet_new_dynamic(data, length));
-    pa_pstream_send_packet(p, packet, creds);
+    pa_assert_se(data = pa_tagstruct_data(t, &length));
+
+    if (length > PA_MAX_POOLED_SIZE) {
+        /* Neither side would keep a buffer this big, so hand it over */
+        pa_assert_se(data = pa_tagstruct_free_data(t, &length));
+        pa_assert_se(packet = pa_packet_new_dynamic((uint8_t*) data, length));
+    } else {
+        /* Copying a small buffer is cheaper than allocating: both the
+         * tagstruct and the packet keep theirs for the next time */
+        pa_assert_se(packet = pa_packet_new_data(data, length));
+        pa_tagstruct_free(t);
+    }
+
+    pa_pstream_send_packet(p, packet, ancil_data);
     pa_packet_unref(packet);
 }
 
+#ifdef HAVE_CREDS
+
+void pa_pstream_send_tagstruct_with_creds(pa_pstream *p, pa_tagstruct *t, const pa_creds *creds) {
+    if (creds) {
+        pa_cmsg_ancil_data a;
+
+        a.nfd = 0;
+        a.creds_valid = TRUE;
+        a.creds = *creds;
+        send_tagstruct_with_ancil_data(p, t, &a);
+    } else
+        send_tagstruct_with_ancil_data(p, t, NULL);
+}
+
+int pa_pstream_send_tagstruct_with_fds(pa_pstream *p, pa_tagstruct *t, int nfd, const int *fds) {
+    pa_cmsg_ancil_data a;
+
+    pa_assert(nfd > 0);
+    pa_assert(nfd <= MAX_ANCIL_FDS);
+    pa_assert(fds);
+
+    a.creds_valid = FALSE;
+    a.nfd = nfd;
+    memcpy(a.fds, fds, sizeof(int) * nfd);
+    send_tagstruct_with_ancil_data(p, t, &a);
+
+    return 0;
+}
+
+#else
+
+void pa_pstream_send_tagstruct_with_creds(pa_pstream *p, pa_tagstruct *t, const pa_creds *creds) {
+    send_tagstruct_with_ancil_data(p, t, NULL);
+}
+
+int pa_pstream_send_tagstruct_with_fds(pa_pstream *p, pa_tagstruct *t, int nfd, const int *fds) {
+    pa_log_warn("Cannot send file descriptors on this platform.");
+    pa_tagstruct_free(t);
+
+    return -1;
+}
+
+#endif
+
 void pa_pstream_send_error(pa_pstream *p, uint32_t tag, uint32_t error) {
     pa_tagstruct *t;
 
@@ -52,6 +110,32 @@ void pa_pstream_send_error(pa_pstream *p, uint32_t tag, uint32_t error) {
     pa_pstream_send_tagstruct(p, t);
 }
 
+int pa_pstream_register_memfd_mempool(pa_pstream *p, pa_mempool *pool) {
+    pa_tagstruct *t;
+    uint32_t shm_id;
+    int fd;
+
+    pa_assert(p);
+    pa_assert(pool);
+    pa_assert(pa_mempool_is_memfd_backed(pool));
+
+    pa_assert_se(pa_mempool_get_shm_id(pool, &shm_id) == 0);
+    fd = pa_mempool_get_memfd_fd(pool);
+
+    pa_assert_se(t = pa_tagstruct_new(NULL, 0));
+    pa_tagstruct_putu32(t, PA_COMMAND_REGISTER_MEMFD_SHMID);
+    pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
+    pa_tagstruct_putu32(t, shm_id);
+
+    /* The pool keeps the fd open for as long as it lives */
+    if (pa_pstream_send_tagstruct_with_fds(p, t, 1, &fd) < 0)
+        return -1;
+
+    pa_pstream_enable_memfd(p, pool);
+
+    return 0;
+}
+
 void pa_pstream_send_simple_ack(pa_pstream *p, uint32_t tag) {
     pa_tagstruct *t;
 
@@ -30,8 +30,17 @@
 /* The tagstruct is freed!*/
 void pa_pstream_send_tagstruct_with_creds(pa_pstream *p, pa_tagstruct *t, const pa_creds *creds);
 
+/* The tagstruct is freed! The file descriptors are not closed and
+ * have to stay open until the packet has been sent. */
+int pa_pstream_send_tagstruct_with_fds(pa_pstream *p, pa_tagstruct *t, int nfd, const int *fds);
+
 #define pa_pstream_send_tagstruct(p, t) pa_pstream_send_tagstruct_with_creds((p), (t), NULL)
 
+/* Send the memfd of the pool to the other side with
+ * PA_COMMAND_REGISTER_MEMFD_SHMID and export blocks through it from
+ * then on */
+int pa_pstream_register_memfd_mempool(pa_pstream *p, pa_mempool *pool);
+
 void pa_pstream_send_error(pa_pstream *p, uint32_t tag, uint32_t error);
 void pa_pstream_send_simple_ack(pa_pstream *p, uint32_t tag);
 
@@ -26,7 +26,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <errno.h>
 
 #ifdef HAVE_NETINET_IN_H
 #include <netinet/in.h>
@@ -35,6 +37,7 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/socket.h>
+#include <pulsecore/core-util.h>
 #include <pulsecore/queue.h>
 #include <pulsecore/log.h>
 #include <pulsecore/creds.h>
@@ -45,11 +48,17 @@
 #include "pstream.h"
 
 /* We piggyback information if audio data blocks are stored in SHM on the seek mode */
-#define PA_FLAG_SHMDATA    0x80000000LU
-#define PA_FLAG_SHMRELEASE 0x40000000LU
-#define PA_FLAG_SHMREVOKE  0xC0000000LU
-#define PA_FLAG_SHMMASK    0xFF000000LU
-#define PA_FLAG_SEEKMASK   0x000000FFLU
+#define PA_FLAG_SHMDATA             0x80000000LU
+#define PA_FLAG_SHMDATA_MEMFD_BLOCK 0x20000000LU
+#define PA_FLAG_SHMRELEASE          0x40000000LU
+#define PA_FLAG_SHMREVOKE           0xC0000000LU
+#define PA_FLAG_SHMMASK             0xFF000000LU
+#define PA_FLAG_SEEKMASK            0x000000FFLU
+
+/* A packet frame with no payload and this flag marks the place in the
+ * ring buffer channel of a packet that was sent over the socket,
+ * because it came with ancillary data */
+#define PA_FLAG_ANCIL_MARKER        0x00010000LU
 
 /* The sequence descriptor header consists of 5 32bit integers: */
 enum {
@@ -76,6 +85,14 @@ typedef uint32_t pa_pstream_descriptor[PA_PSTREAM_DESCRIPTOR_MAX];
 
 #define MINIBUF_SIZE (256)
 
+/* How many queued items go out with one writev() at most */
+#define WRITE_BATCH_MAX (16)
+
+/* How much is read from the socket beyond the end of the frame part
+ * we are waiting for, to pick up the small frames that follow it
+ * without another syscall */
+#define READAHEAD_SIZE (4096)
+
 /* To allow uploading a single sample in one frame, this value should be the
  * same size (16 MB) as PA_SCACHE_ENTRY_SIZE_MAX from pulsecore/core-scache.h.
  */
@@ -94,8 +111,8 @@ struct item_info {
     /* packet info */
     pa_packet *packet;
 #ifdef HAVE_CREDS
-    pa_bool_t with_creds;
-    pa_creds creds;
+    pa_bool_t with_ancil_data;
+    pa_cmsg_ancil_data ancil_data;
 #endif
 
     /* memblock info */
@@ -108,6 +125,27 @@ struct item_info {
     uint32_t block_id;
 };
 
+struct pstream_write {
+    union {
+        uint8_t minibuf[MINIBUF_SIZE];
+        pa_pstream_descriptor descriptor;
+    };
+    struct item_info* current;
+    void *data;
+    size_t index;
+    int minibuf_validsize;
+    pa_memchunk memchunk;
+};
+
+struct pstream_read {
+    pa_pstream_descriptor descriptor;
+    pa_memblock *memblock;
+    pa_packet *packet;
+    uint32_t shm_info[PA_PSTREAM_SHM_MAX];
+    void *data;
+    size_t index;
+};
+
 struct pa_pstream {
     PA_REFCNT_DECLARE;
 
@@ -115,32 +153,38 @@ struct pa_pstream {
     pa_defer_event *defer_event;
     pa_iochannel *io;
 
+    /* Once the peers agreed on it, everything but packets with
+     * ancillary data goes through the ring buffer channel */
+    pa_srbchannel *srb, *srbpending;
+    pa_bool_t is_srbpending;
+    pa_bool_t srb_used_by_peer;
+
+    /* How much of the marker for the current item went into the ring
+     * buffer, and how many packets the markers we read announced that
+     * we still have to read from the socket */
+    size_t srb_marker_index;
+    unsigned srb_ancil_pending;
+
     pa_queue *send_queue;
 
     pa_bool_t dead;
 
-    struct {
-        union {
-            uint8_t minibuf[MINIBUF_SIZE];
-            pa_pstream_descriptor descriptor;
-        };
-        struct item_info* current;
-        void *data;
-        size_t index;
-        int minibuf_validsize;
-        pa_memchunk memchunk;
-    } write;
-
-    struct {
-        pa_pstream_descriptor descriptor;
-        pa_memblock *memblock;
-        pa_packet *packet;
-        uint32_t shm_info[PA_PSTREAM_SHM_MAX];
-        void *data;
-        size_t index;
-    } read;
+    struct pstream_write write;
+
+    /* The items following the current one, already set up to go out
+     * with the same writev() */
+    struct pstream_write batch[WRITE_BATCH_MAX - 1];
+    unsigned n_batch;
+
+    struct pstream_read readio, readsrb;
+
+    /* What the last read from the socket returned beyond what readio
+     * asked for */
+    uint8_t readahead[READAHEAD_SIZE];
+    size_t readahead_index, readahead_length;
 
     pa_bool_t use_shm;
+    pa_bool_t use_memfd;
     pa_memimport *import;
     pa_memexport *export;
 
@@ -165,15 +209,63 @@ struct pa_pstream {
     pa_mempool *mempool;
 
 #ifdef HAVE_CREDS
-    pa_creds read_creds, write_creds;
-    pa_bool_t read_creds_valid, send_creds_now;
+    pa_cmsg_ancil_data read_ancil_data, write_ancil_data;
+    pa_bool_t send_ancil_data_now;
+
+    /* What came along with the data in the read ahead buffer */
+    pa_cmsg_ancil_data readahead_ancil_data;
 #endif
 };
 
 static int do_write(pa_pstream *p);
-static int do_read(pa_pstream *p);
+static int do_read(pa_pstream *p, struct pstream_read *re);
+
+/* Whether what is in the socket may be read now. Once the peer uses
+ * the ring buffer, it only sends packets with ancillary data over the
+ * socket, and each of them only after a marker in the ring buffer. */
+static pa_bool_t socket_readable_now(pa_pstream *p) {
+    return !p->srb || !p->srb_used_by_peer || p->srb_ancil_pending > 0;
+}
+
+/* Read everything that is in the ring buffer. Until the peer starts to
+ * use it, we need to read the socket first: whatever the peer sent
+ * there before switching over is already in our socket buffer by the
+ * time its first ring buffer write becomes visible to us. The same
+ * goes for a packet announced by a marker. */
+static int do_read_srb(pa_pstream *p) {
+    int r;
+
+    for (;;) {
+        /* A packet handler may have unlinked us */
+        if (p->dead || !p->srb)
+            return 0;
+
+        if (socket_readable_now(p)) {
+            while ((r = do_read(p, &p->readio)) == 0 && !p->dead && socket_readable_now(p))
+                ;
+
+            if (r < 0)
+                return -1;
+
+            if (p->dead || !p->srb)
+                return 0;
+
+            /* The rest of it is still on its way, and we'll be woken
+             * up by the socket */
+            if (p->srb_used_by_peer && p->srb_ancil_pending > 0)
+                return 0;
+        }
+
+        if ((r = do_read(p, &p->readsrb)) != 0)
+            return r < 0 ? -1 : 0;
+
+        p->srb_used_by_peer = TRUE;
+    }
+}
 
 static void do_pstream_read_write(pa_pstream *p) {
+    int r = 0;
+
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
@@ -181,16 +273,43 @@ static void do_pstream_read_write(pa_pstream *p) {
 
     p->mainloop->defer_enable(p->defer_event, 0);
 
-    if (!p->dead && pa_iochannel_is_readable(p->io)) {
-        if (do_read(p) < 0)
+    if (!p->dead && p->srb) {
+        if (do_read_srb(p) < 0)
+            goto fail;
+    }
+
+    /* The marker of what came in on the socket may have been written
+     * after we looked at the ring buffer */
+    if (!p->dead && pa_iochannel_is_readable(p->io) && !socket_readable_now(p))
+        if (do_read_srb(p) < 0)
+            goto fail;
+
+    if (!p->dead && pa_iochannel_is_readable(p->io) && socket_readable_now(p)) {
+        if (do_read(p, &p->readio) < 0)
             goto fail;
+
+        /* The socket won't wake us up again for what we already read
+         * ahead */
+        while (!p->dead && p->readahead_length > 0 && socket_readable_now(p))
+            if (do_read(p, &p->readio) < 0)
+                goto fail;
+
+        /* That may have been the packet the ring buffer was waiting for */
+        if (!p->dead && p->srb && p->srb_used_by_peer)
+            if (do_read_srb(p) < 0)
+                goto fail;
+
     } else if (!p->dead && pa_iochannel_is_hungup(p->io))
         goto fail;
 
-    if (!p->dead && pa_iochannel_is_writable(p->io)) {
-        if (do_write(p) < 0)
-            goto fail;
-    }
+    /* On the socket we do one write per main loop iteration, which
+     * covers several queued items. The ring buffer is filled as far as
+     * possible */
+    while (!p->dead && (r = do_write(p)) == 0 && p->srb)
+        ;
+
+    if (r < 0)
+        goto fail;
 
     pa_pstream_unref(p);
     return;
@@ -204,6 +323,26 @@ fail:
     pa_pstream_unref(p);
 }
 
+static pa_bool_t srb_callback(pa_srbchannel *srb, void *userdata) {
+    pa_bool_t b;
+    pa_pstream *p = userdata;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(p->srb == srb);
+
+    pa_pstream_ref(p);
+
+    do_pstream_read_write(p);
+
+    /* If either the pstream or the channel went away, the channel has
+     * been freed and must not be touched anymore */
+    b = (PA_REFCNT_VALUE(p) > 1) && (p->srb == srb);
+    pa_pstream_unref(p);
+
+    return b;
+}
+
 static void io_callback(pa_iochannel*io, void *userdata) {
     pa_pstream *p = userdata;
 
@@ -246,12 +385,20 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
 
     p->send_queue = pa_queue_new();
 
+    p->srb = p->srbpending = NULL;
+    p->is_srbpending = FALSE;
+    p->srb_used_by_peer = FALSE;
+    p->srb_marker_index = 0;
+    p->srb_ancil_pending = 0;
+
     p->write.current = NULL;
     p->write.index = 0;
     pa_memchunk_reset(&p->write.memchunk);
-    p->read.memblock = NULL;
-    p->read.packet = NULL;
-    p->read.index = 0;
+    p->n_batch = 0;
+    p->readio.memblock = p->readsrb.memblock = NULL;
+    p->readio.packet = p->readsrb.packet = NULL;
+    p->readio.index = p->readsrb.index = 0;
+    p->readahead_index = p->readahead_length = 0;
 
     p->receive_packet_callback = NULL;
     p->receive_packet_callback_userdata = NULL;
@@ -269,6 +416,7 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
     p->mempool = pool;
 
     p->use_shm = FALSE;
+    p->use_memfd = FALSE;
     p->export = NULL;
 
     /* We do importing unconditionally */
@@ -278,8 +426,11 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
     pa_iochannel_socket_set_sndbuf(io, pa_mempool_block_size_max(p->mempool));
 
 #ifdef HAVE_CREDS
-    p->send_creds_now = FALSE;
-    p->read_creds_valid = FALSE;
+    p->send_ancil_data_now = FALSE;
+    p->read_ancil_data.creds_valid = FALSE;
+    p->read_ancil_data.nfd = 0;
+    p->readahead_ancil_data.creds_valid = FALSE;
+    p->readahead_ancil_data.nfd = 0;
 #endif
     return p;
 }
@@ -300,7 +451,22 @@ static void item_free(void *item) {
         pa_xfree(i);
 }
 
+static void pstream_write_done(struct pstream_write *w) {
+    pa_assert(w);
+    pa_assert(w->current);
+
+    item_free(w->current);
+    w->current = NULL;
+
+    if (w->memchunk.memblock)
+        pa_memblock_unref(w->memchunk.memblock);
+
+    pa_memchunk_reset(&w->memchunk);
+}
+
 static void pstream_free(pa_pstream *p) {
+    unsigned i;
+
     pa_assert(p);
 
     pa_pstream_unlink(p);
@@ -308,21 +474,32 @@ static void pstream_free(pa_pstream *p) {
     pa_queue_free(p->send_queue, item_free);
 
     if (p->write.current)
-        item_free(p->write.current);
+        pstream_write_done(&p->write);
 
-    if (p->write.memchunk.memblock)
-        pa_memblock_unref(p->write.memchunk.memblock);
+    for (i = 0; i < p->n_batch; i++)
+        pstream_write_done(&p->batch[i]);
 
-    if (p->read.memblock)
-        pa_memblock_unref(p->read.memblock);
+    if (p->readio.memblock)
+        pa_memblock_unref(p->readio.memblock);
 
-    if (p->read.packet)
-        pa_packet_unref(p->read.packet);
+    if (p->readio.packet)
+        pa_packet_unref(p->readio.packet);
+
+    if (p->readsrb.memblock)
+        pa_memblock_unref(p->readsrb.memblock);
+
+    if (p->readsrb.packet)
+        pa_packet_unref(p->readsrb.packet);
+
+#ifdef HAVE_CREDS
+    pa_cmsg_ancil_data_close_fds(&p->read_ancil_data);
+    pa_cmsg_ancil_data_close_fds(&p->readahead_ancil_data);
+#endif
 
     pa_xfree(p);
 }
 
-void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *creds) {
+void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data) {
     struct item_info *i;
 
     pa_assert(p);
@@ -339,8 +516,10 @@ void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *cre
     i->packet = pa_packet_ref(packet);
 
 #ifdef HAVE_CREDS
-    if ((i->with_creds = !!creds))
-        i->creds = *creds;
+    if ((i->with_ancil_data = !!ancil_data)) {
+        pa_assert(ancil_data->nfd >= 0 && ancil_data->nfd <= MAX_ANCIL_FDS);
+        i->ancil_data = *ancil_data;
+    }
 #endif
 
     pa_queue_push(p->send_queue, i);
@@ -382,7 +561,7 @@ void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa
         i->offset = offset;
         i->seek_mode = seek_mode;
 #ifdef HAVE_CREDS
-        i->with_creds = FALSE;
+        i->with_ancil_data = FALSE;
 #endif
 
         pa_queue_push(p->send_queue, i);
@@ -409,7 +588,7 @@ void pa_pstream_send_release(pa_pstream *p, uint32_t block_id) {
     item->type = PA_PSTREAM_ITEM_SHMRELEASE;
     item->block_id = block_id;
 #ifdef HAVE_CREDS
-    item->with_creds = FALSE;
+    item->with_ancil_data = FALSE;
 #endif
 
     pa_queue_push(p->send_queue, item);
@@ -446,7 +625,7 @@ void pa_pstream_send_revoke(pa_pstream *p, uint32_t block_id) {
     item->type = PA_PSTREAM_ITEM_SHMREVOKE;
     item->block_id = block_id;
 #ifdef HAVE_CREDS
-    item->with_creds = FALSE;
+    item->with_ancil_data = FALSE;
 #endif
 
     pa_queue_push(p->send_queue, item);
@@ -466,69 +645,73 @@ static void memexport_revoke_cb(pa_memexport *e, uint32_t block_id, void *userda
         pa_pstream_send_revoke(p, block_id);
 }
 
-static void prepare_next_write_item(pa_pstream *p) {
+/* Takes the next item off the send queue and sets up w to write it */
+static pa_bool_t prepare_write(pa_pstream *p, struct pstream_write *w) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(w);
 
-    p->write.current = pa_queue_pop(p->send_queue);
+    w->current = pa_queue_pop(p->send_queue);
 
-    if (!p->write.current)
-        return;
-    p->write.index = 0;
-    p->write.data = NULL;
-    p->write.minibuf_validsize = 0;
-    pa_memchunk_reset(&p->write.memchunk);
+    if (!w->current)
+        return FALSE;
+    w->index = 0;
+    w->data = NULL;
+    w->minibuf_validsize = 0;
+    pa_memchunk_reset(&w->memchunk);
 
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = 0;
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = 0;
 
-    if (p->write.current->type == PA_PSTREAM_ITEM_PACKET) {
+    if (w->current->type == PA_PSTREAM_ITEM_PACKET) {
 
-        pa_assert(p->write.current->packet);
-        p->write.data = p->write.current->packet->data;
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) p->write.current->packet->length);
+        pa_assert(w->current->packet);
+        w->data = w->current->packet->data;
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) w->current->packet->length);
 
-        if (p->write.current->packet->length <= MINIBUF_SIZE - PA_PSTREAM_DESCRIPTOR_SIZE) {
-            memcpy(&p->write.minibuf[PA_PSTREAM_DESCRIPTOR_SIZE], p->write.data, p->write.current->packet->length);
-            p->write.minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + p->write.current->packet->length;
+        if (w->current->packet->length <= MINIBUF_SIZE - PA_PSTREAM_DESCRIPTOR_SIZE) {
+            memcpy(&w->minibuf[PA_PSTREAM_DESCRIPTOR_SIZE], w->data, w->current->packet->length);
+            w->minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + w->current->packet->length;
         }
 
-    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMRELEASE) {
+    } else if (w->current->type == PA_PSTREAM_ITEM_SHMRELEASE) {
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMRELEASE);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMRELEASE);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(w->current->block_id);
 
-    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMREVOKE) {
+    } else if (w->current->type == PA_PSTREAM_ITEM_SHMREVOKE) {
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(w->current->block_id);
 
     } else {
         uint32_t flags;
         pa_bool_t send_payload = TRUE;
 
-        pa_assert(p->write.current->type == PA_PSTREAM_ITEM_MEMBLOCK);
-        pa_assert(p->write.current->chunk.memblock);
+        pa_assert(w->current->type == PA_PSTREAM_ITEM_MEMBLOCK);
+        pa_assert(w->current->chunk.memblock);
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl(p->write.current->channel);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl((uint32_t) (((uint64_t) p->write.current->offset) >> 32));
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = htonl((uint32_t) ((uint64_t) p->write.current->offset));
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl(w->current->channel);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl((uint32_t) (((uint64_t) w->current->offset) >> 32));
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = htonl((uint32_t) ((uint64_t) w->current->offset));
 
-        flags = (uint32_t) (p->write.current->seek_mode & PA_FLAG_SEEKMASK);
+        flags = (uint32_t) (w->current->seek_mode & PA_FLAG_SEEKMASK);
 
-        if (p->use_shm) {
+        /* Without an export, our pool is a memfd the other side
+         * doesn't know about */
+        if (p->use_shm && p->export) {
+            pa_mem_type_t type;
             uint32_t block_id, shm_id;
             size_t offset, length;
-            uint32_t *shm_info = (uint32_t *) &p->write.minibuf[PA_PSTREAM_DESCRIPTOR_SIZE];
+            uint32_t *shm_info = (uint32_t *) &w->minibuf[PA_PSTREAM_DESCRIPTOR_SIZE];
             size_t shm_size = sizeof(uint32_t) * PA_PSTREAM_SHM_MAX;
 
-            pa_assert(p->export);
-
             if (pa_memexport_put(p->export,
-                                 p->write.current->chunk.memblock,
+                                 w->current->chunk.memblock,
+                                 &type,
                                  &block_id,
                                  &shm_id,
                                  &offset,
@@ -537,34 +720,205 @@ static void prepare_next_write_item(pa_pstream *p) {
                 flags |= PA_FLAG_SHMDATA;
                 send_payload = FALSE;
 
+                if (type == PA_MEM_TYPE_SHARED_MEMFD) {
+                    pa_assert(p->use_memfd);
+                    flags |= PA_FLAG_SHMDATA_MEMFD_BLOCK;
+                }
+
                 shm_info[PA_PSTREAM_SHM_BLOCKID] = htonl(block_id);
                 shm_info[PA_PSTREAM_SHM_SHMID] = htonl(shm_id);
-                shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + p->write.current->chunk.index));
-                shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
+                shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + w->current->chunk.index));
+                shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) w->current->chunk.length);
 
-                p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(shm_size);
-                p->write.minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + shm_size;
+                w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(shm_size);
+                w->minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + shm_size;
             }
 /*             else */
 /*                 pa_log_warn("Failed to export memory block."); */
         }
 
         if (send_payload) {
-            p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
-            p->write.memchunk = p->write.current->chunk;
-            pa_memblock_ref(p->write.memchunk.memblock);
-            p->write.data = NULL;
+            w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) w->current->chunk.length);
+            w->memchunk = w->current->chunk;
+            pa_memblock_ref(w->memchunk.memblock);
+            w->data = NULL;
         }
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(flags);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(flags);
     }
 
+    return TRUE;
+}
+
+static void prepare_next_write_item(pa_pstream *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    if (p->n_batch > 0) {
+        p->write = p->batch[0];
+        p->n_batch--;
+        memmove(p->batch, p->batch + 1, sizeof(p->batch[0]) * p->n_batch);
+    } else if (!prepare_write(p, &p->write))
+        return;
+
 #ifdef HAVE_CREDS
-    if ((p->send_creds_now = p->write.current->with_creds))
-        p->write_creds = p->write.current->creds;
+    if ((p->send_ancil_data_now = p->write.current->with_ancil_data))
+        p->write_ancil_data = p->write.current->ancil_data;
 #endif
 }
 
+static void check_srbpending(pa_pstream *p) {
+    pa_assert(p);
+
+    if (!p->is_srbpending)
+        return;
+
+    if (p->srb)
+        pa_srbchannel_free(p->srb);
+
+    p->srb = p->srbpending;
+    p->srbpending = NULL;
+    p->is_srbpending = FALSE;
+    p->srb_used_by_peer = FALSE;
+    p->srb_ancil_pending = 0;
+
+    if (p->srb)
+        pa_srbchannel_set_callback(p->srb, srb_callback, p);
+}
+
+static size_t pstream_write_size(struct pstream_write *w) {
+    return PA_PSTREAM_DESCRIPTOR_SIZE + ntohl(w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+}
+
+static void write_complete(pa_pstream *p) {
+    pstream_write_done(&p->write);
+    p->srb_marker_index = 0;
+
+    if (p->drain_callback && !pa_pstream_is_pending(p))
+        p->drain_callback(p, p->drain_callback_userdata);
+}
+
+#ifdef HAVE_SYS_UIO_H
+
+/* Fills iov with what is left to write of w and returns how many
+ * entries were used. If the memblock had to be acquired for that, it
+ * is returned in *acquired. */
+static int pstream_write_iovec(struct pstream_write *w, struct iovec *iov, pa_memblock **acquired) {
+    size_t offset, length;
+    int n = 0;
+
+    *acquired = NULL;
+
+    if (w->minibuf_validsize > 0) {
+        iov[0].iov_base = w->minibuf + w->index;
+        iov[0].iov_len = (size_t) w->minibuf_validsize - w->index;
+        return 1;
+    }
+
+    if (w->index < PA_PSTREAM_DESCRIPTOR_SIZE) {
+        iov[n].iov_base = (uint8_t*) w->descriptor + w->index;
+        iov[n].iov_len = PA_PSTREAM_DESCRIPTOR_SIZE - w->index;
+        n++;
+        offset = 0;
+    } else
+        offset = w->index - PA_PSTREAM_DESCRIPTOR_SIZE;
+
+    length = ntohl(w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+
+    if (length > offset) {
+        void *d;
+
+        pa_assert(w->data || w->memchunk.memblock);
+
+        if (w->data)
+            d = w->data;
+        else {
+            d = pa_memblock_acquire_chunk(&w->memchunk);
+            *acquired = w->memchunk.memblock;
+        }
+
+        iov[n].iov_base = (uint8_t*) d + offset;
+        iov[n].iov_len = length - offset;
+        n++;
+    }
+
+    return n;
+}
+
+/* Writes the current item together with the ones queued after it,
+ * descriptors and payloads alike, with a single writev(). Returns like
+ * do_write(). */
+static int do_write_batch(pa_pstream *p) {
+    struct iovec iov[WRITE_BATCH_MAX * 2];
+    pa_memblock *acquired[WRITE_BATCH_MAX];
+    unsigned i, n_items;
+    int n_iov;
+    ssize_t r;
+    size_t k;
+
+    pa_assert(p->write.current);
+
+    while (p->n_batch < WRITE_BATCH_MAX - 1) {
+#ifdef HAVE_CREDS
+        /* An item with ancillary data needs a sendmsg() of its own */
+        if (p->n_batch > 0 && p->batch[p->n_batch - 1].current->with_ancil_data)
+            break;
+#endif
+
+        if (!prepare_write(p, &p->batch[p->n_batch]))
+            break;
+
+        p->n_batch++;
+    }
+
+    n_iov = pstream_write_iovec(&p->write, iov, &acquired[0]);
+    n_items = 1;
+
+    for (i = 0; i < p->n_batch; i++) {
+#ifdef HAVE_CREDS
+        if (p->batch[i].current->with_ancil_data)
+            break;
+#endif
+
+        n_iov += pstream_write_iovec(&p->batch[i], iov + n_iov, &acquired[n_items++]);
+    }
+
+    r = pa_iochannel_writev(p->io, iov, n_iov);
+
+    for (i = 0; i < n_items; i++)
+        if (acquired[i])
+            pa_memblock_release(acquired[i]);
+
+    if (r < 0)
+        return -1;
+
+    for (k = (size_t) r; k > 0;) {
+        size_t left = pstream_write_size(&p->write) - p->write.index;
+
+        if (k < left) {
+            p->write.index += k;
+            break;
+        }
+
+        k -= left;
+        pstream_write_done(&p->write);
+
+        pa_assert(k == 0 || p->n_batch > 0);
+
+        if (p->n_batch > 0)
+            prepare_next_write_item(p);
+    }
+
+    if (p->drain_callback && !pa_pstream_is_pending(p))
+        p->drain_callback(p, p->drain_callback_userdata);
+
+    return 0;
+}
+
+#endif
+
+/* Returns -1 on error, 0 if something was written and 1 if nothing
+ * can be written right now */
 static int do_write(pa_pstream *p) {
     void *d;
     size_t l;
@@ -574,11 +928,58 @@ static int do_write(pa_pstream *p) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-    if (!p->write.current)
+    if (!p->write.current) {
+        if (p->n_batch == 0 && pa_queue_isempty(p->send_queue))
+            check_srbpending(p);
+
         prepare_next_write_item(p);
+    }
 
     if (!p->write.current)
+        return 1;
+
+#ifdef HAVE_CREDS
+    /* Ancillary data can only be passed over the socket */
+    if ((!p->srb || p->write.current->with_ancil_data) && !pa_iochannel_is_writable(p->io))
+        return 1;
+#else
+    if (!p->srb && !pa_iochannel_is_writable(p->io))
+        return 1;
+#endif
+
+#ifdef HAVE_SYS_UIO_H
+#ifdef HAVE_CREDS
+    if (!p->srb && !p->write.current->with_ancil_data)
+#else
+    if (!p->srb)
+#endif
+        return do_write_batch(p);
+#endif
+
+#ifdef HAVE_CREDS
+    /* The peer reads a packet with ancillary data from the socket only
+     * when it gets to its marker in the ring buffer, so that it stays
+     * in order with what goes through the ring buffer before and after
+     * it. The marker has to be there before the packet, see
+     * do_read_srb(). */
+    if (p->srb && p->write.current->with_ancil_data && p->write.index == 0 &&
+        p->srb_marker_index < PA_PSTREAM_DESCRIPTOR_SIZE) {
+
+        pa_pstream_descriptor marker;
+
+        marker[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
+        marker[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
+        marker[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
+        marker[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
+        marker[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_ANCIL_MARKER);
+
+        if ((r = (ssize_t) pa_srbchannel_write(p->srb, (uint8_t*) marker + p->srb_marker_index, PA_PSTREAM_DESCRIPTOR_SIZE - p->srb_marker_index)) == 0)
+            return 1;
+
+        p->srb_marker_index += (size_t) r;
         return 0;
+    }
+#endif
 
     if (p->write.minibuf_validsize > 0) {
         d = p->write.minibuf + p->write.index;
@@ -603,36 +1004,41 @@ static int do_write(pa_pstream *p) {
     pa_assert(l > 0);
 
 #ifdef HAVE_CREDS
-    if (p->send_creds_now) {
+    if (p->send_ancil_data_now) {
+
+        if (p->write_ancil_data.nfd > 0)
+            r = pa_iochannel_write_with_fds(p->io, d, l, p->write_ancil_data.nfd, p->write_ancil_data.fds);
+        else
+            r = pa_iochannel_write_with_creds(p->io, d, l, p->write_ancil_data.creds_valid ? &p->write_ancil_data.creds : NULL);
 
-        if ((r = pa_iochannel_write_with_creds(p->io, d, l, &p->write_creds)) < 0)
+        if (r < 0)
             goto fail;
 
-        p->send_creds_now = FALSE;
-    } else
+        p->send_ancil_data_now = FALSE;
+    } else if (p->write.current->with_ancil_data || !p->srb) {
+#else
+    if (!p->srb) {
 #endif
+        if ((r = pa_iochannel_write(p->io, d, l)) < 0)
+            goto fail;
+    } else {
+        if ((r = (ssize_t) pa_srbchannel_write(p->srb, d, l)) == 0) {
+            /* The ring buffer is full, we'll be woken up when the
+             * peer made room */
+            if (release_memblock)
+                pa_memblock_release(release_memblock);
 
-    if ((r = pa_iochannel_write(p->io, d, l)) < 0)
-        goto fail;
+            return 1;
+        }
+    }
 
     if (release_memblock)
         pa_memblock_release(release_memblock);
 
     p->write.index += (size_t) r;
 
-    if (p->write.index >= PA_PSTREAM_DESCRIPTOR_SIZE + ntohl(p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH])) {
-        pa_assert(p->write.current);
-        item_free(p->write.current);
-        p->write.current = NULL;
-
-        if (p->write.memchunk.memblock)
-            pa_memblock_unref(p->write.memchunk.memblock);
-
-        pa_memchunk_reset(&p->write.memchunk);
-
-        if (p->drain_callback && !pa_pstream_is_pending(p))
-            p->drain_callback(p, p->drain_callback_userdata);
-    }
+    if (p->write.index >= pstream_write_size(&p->write))
+        write_complete(p);
 
     return 0;
 
@@ -644,7 +1050,104 @@ fail:
     return -1;
 }
 
-static int do_read(pa_pstream *p) {
+#ifdef HAVE_CREDS
+
+static void ancil_data_merge(pa_cmsg_ancil_data *to, pa_cmsg_ancil_data *from) {
+    int i;
+
+    if (from->creds_valid) {
+        to->creds = from->creds;
+        to->creds_valid = TRUE;
+    }
+
+    for (i = 0; i < from->nfd; i++) {
+        if (to->nfd < MAX_ANCIL_FDS)
+            to->fds[to->nfd++] = from->fds[i];
+        else {
+            pa_log_warn("Received more file descriptors than expected, closing them.");
+            pa_close(from->fds[i]);
+        }
+    }
+
+    from->nfd = 0;
+}
+
+#endif
+
+/* Reads from the socket like pa_iochannel_read(), but whatever the
+ * kernel has beyond l bytes is read ahead, up to READAHEAD_SIZE, and
+ * handed out on the next calls without another syscall */
+static ssize_t read_socket(pa_pstream *p, void *d, size_t l) {
+    ssize_t r;
+#ifdef HAVE_SYS_UIO_H
+    struct iovec iov[2];
+#ifdef HAVE_CREDS
+    pa_cmsg_ancil_data ancil_data;
+#endif
+#endif
+
+    if (p->readahead_length > 0) {
+        r = (ssize_t) PA_MIN(l, p->readahead_length);
+        memcpy(d, p->readahead + p->readahead_index, (size_t) r);
+        p->readahead_index += (size_t) r;
+        p->readahead_length -= (size_t) r;
+
+#ifdef HAVE_CREDS
+        if (p->readahead_ancil_data.creds_valid) {
+            p->read_ancil_data.creds = p->readahead_ancil_data.creds;
+            p->read_ancil_data.creds_valid = TRUE;
+        }
+
+        /* The kernel ends a read right after the data file descriptors
+         * were sent with, and those are always sent with the start of
+         * a frame. So they belong to the frame the last byte read is
+         * part of. */
+        if (p->readahead_length == 0) {
+            ancil_data_merge(&p->read_ancil_data, &p->readahead_ancil_data);
+            p->readahead_ancil_data.creds_valid = FALSE;
+        }
+#endif
+
+        return r;
+    }
+
+#ifdef HAVE_SYS_UIO_H
+    iov[0].iov_base = d;
+    iov[0].iov_len = l;
+    iov[1].iov_base = p->readahead;
+    iov[1].iov_len = sizeof(p->readahead);
+
+#ifdef HAVE_CREDS
+    ancil_data.creds_valid = FALSE;
+    ancil_data.nfd = 0;
+
+    r = pa_iochannel_readv_with_ancil_data(p->io, iov, 2, &ancil_data);
+
+    if (r > (ssize_t) l) {
+        p->readahead_ancil_data = ancil_data;
+        ancil_data.nfd = 0;
+    }
+
+    ancil_data_merge(&p->read_ancil_data, &ancil_data);
+#else
+    r = pa_iochannel_readv(p->io, iov, 2);
+#endif
+
+    if (r > (ssize_t) l) {
+        p->readahead_index = 0;
+        p->readahead_length = (size_t) r - l;
+        r = (ssize_t) l;
+    }
+#else
+    r = pa_iochannel_read(p->io, d, l);
+#endif
+
+    return r;
+}
+
+/* Returns -1 on error, 0 if something was read and 1 if nothing is
+ * available right now */
+static int do_read(pa_pstream *p, struct pstream_read *re) {
     void *d;
     size_t l;
     ssize_t r;
@@ -652,47 +1155,54 @@ static int do_read(pa_pstream *p) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-    if (p->read.index < PA_PSTREAM_DESCRIPTOR_SIZE) {
-        d = (uint8_t*) p->read.descriptor + p->read.index;
-        l = PA_PSTREAM_DESCRIPTOR_SIZE - p->read.index;
+    if (re->index < PA_PSTREAM_DESCRIPTOR_SIZE) {
+        d = (uint8_t*) re->descriptor + re->index;
+        l = PA_PSTREAM_DESCRIPTOR_SIZE - re->index;
     } else {
-        pa_assert(p->read.data || p->read.memblock);
+        pa_assert(re->data || re->memblock);
 
-        if (p->read.data)
-            d = p->read.data;
+        if (re->data)
+            d = re->data;
         else {
-            d = pa_memblock_acquire(p->read.memblock);
-            release_memblock = p->read.memblock;
+            d = pa_memblock_acquire(re->memblock);
+            release_memblock = re->memblock;
         }
 
-        d = (uint8_t*) d + p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE;
-        l = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) - (p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE);
+        d = (uint8_t*) d + re->index - PA_PSTREAM_DESCRIPTOR_SIZE;
+        l = ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) - (re->index - PA_PSTREAM_DESCRIPTOR_SIZE);
     }
 
-#ifdef HAVE_CREDS
-    {
-        pa_bool_t b = 0;
+    if (re == &p->readsrb) {
+        if ((r = (ssize_t) pa_srbchannel_read(p->srb, d, l)) == 0) {
+            if (release_memblock)
+                pa_memblock_release(release_memblock);
 
-        if ((r = pa_iochannel_read_with_creds(p->io, d, l, &p->read_creds, &b)) <= 0)
-            goto fail;
+            return 1;
+        }
+    } else {
+        r = read_socket(p, d, l);
 
-        p->read_creds_valid = p->read_creds_valid || b;
+        if (r < 0 && errno == EAGAIN) {
+            if (release_memblock)
+                pa_memblock_release(release_memblock);
+
+            return 1;
+        }
+
+        if (r <= 0)
+            goto fail;
     }
-#else
-    if ((r = pa_iochannel_read(p->io, d, l)) <= 0)
-        goto fail;
-#endif
 
     if (release_memblock)
         pa_memblock_release(release_memblock);
 
-    p->read.index += (size_t) r;
+    re->index += (size_t) r;
 
-    if (p->read.index == PA_PSTREAM_DESCRIPTOR_SIZE) {
+    if (re->index == PA_PSTREAM_DESCRIPTOR_SIZE) {
         uint32_t flags, length, channel;
         /* Reading of frame descriptor complete */
 
-        flags = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]);
+        flags = ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]);
 
         if (!p->use_shm && (flags & PA_FLAG_SHMMASK) != 0) {
             pa_log_warn("Received SHM frame on a socket where SHM is disabled.");
@@ -703,35 +1213,49 @@ static int do_read(pa_pstream *p) {
 
             /* This is a SHM memblock release frame with no payload */
 
-/*             pa_log("Got release frame for %u", ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
+/*             pa_log("Got release frame for %u", ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
 
-            pa_assert(p->export);
-            pa_memexport_process_release(p->export, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+            if (p->export)
+                pa_memexport_process_release(p->export, ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
 
             goto frame_done;
 
+        } else if (flags == PA_FLAG_ANCIL_MARKER) {
+
+            /* The next packet from the socket goes here */
+
+            if (re != &p->readsrb ||
+                ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]) != (uint32_t) -1 ||
+                ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) != 0) {
+                pa_log_warn("Received invalid ancillary data marker.");
+                return -1;
+            }
+
+            p->srb_ancil_pending++;
+            goto frame_done;
+
         } else if (flags == PA_FLAG_SHMREVOKE) {
 
             /* This is a SHM memblock revoke frame with no payload */
 
-/*             pa_log("Got revoke frame for %u", ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
+/*             pa_log("Got revoke frame for %u", ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
 
             pa_assert(p->import);
-            pa_memimport_process_revoke(p->import, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+            pa_memimport_process_revoke(p->import, ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
 
             goto frame_done;
         }
 
-        length = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+        length = ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
 
         if (length > FRAME_SIZE_MAX_ALLOW || length <= 0) {
             pa_log_warn("Received invalid frame size: %lu", (unsigned long) length);
             return -1;
         }
 
-        pa_assert(!p->read.packet && !p->read.memblock);
+        pa_assert(!re->packet && !re->memblock);
 
-        channel = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]);
+        channel = ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]);
 
         if (channel == (uint32_t) -1) {
 
@@ -741,8 +1265,8 @@ static int do_read(pa_pstream *p) {
             }
 
             /* Frame is a packet frame */
-            p->read.packet = pa_packet_new(length);
-            p->read.data = p->read.packet->data;
+            re->packet = pa_packet_new(length);
+            re->data = re->packet->data;
 
         } else {
 
@@ -751,22 +1275,23 @@ static int do_read(pa_pstream *p) {
                 return -1;
             }
 
-            if ((flags & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA) {
+            if ((flags & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA ||
+                (flags & PA_FLAG_SHMMASK) == (PA_FLAG_SHMDATA|PA_FLAG_SHMDATA_MEMFD_BLOCK)) {
 
-                if (length != sizeof(p->read.shm_info)) {
+                if (length != sizeof(re->shm_info)) {
                     pa_log_warn("Received SHM memblock frame with invalid frame length.");
                     return -1;
                 }
 
                 /* Frame is a memblock frame referencing an SHM memblock */
-                p->read.data = p->read.shm_info;
+                re->data = re->shm_info;
 
             } else if ((flags & PA_FLAG_SHMMASK) == 0) {
 
                 /* Frame is a memblock frame */
 
-                p->read.memblock = pa_memblock_new(p->mempool, length);
-                p->read.data = NULL;
+                re->memblock = pa_memblock_new(p->mempool, length);
+                re->data = NULL;
             } else {
 
                 pa_log_warn("Received memblock frame with invalid flags value.");
@@ -774,74 +1299,78 @@ static int do_read(pa_pstream *p) {
             }
         }
 
-    } else if (p->read.index > PA_PSTREAM_DESCRIPTOR_SIZE) {
+    } else if (re->index > PA_PSTREAM_DESCRIPTOR_SIZE) {
         /* Frame payload available */
 
-        if (p->read.memblock && p->receive_memblock_callback) {
+        if (re->memblock && p->receive_memblock_callback) {
 
             /* Is this memblock data? Than pass it to the user */
-            l = (p->read.index - (size_t) r) < PA_PSTREAM_DESCRIPTOR_SIZE ? (size_t) (p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE) : (size_t) r;
+            l = (re->index - (size_t) r) < PA_PSTREAM_DESCRIPTOR_SIZE ? (size_t) (re->index - PA_PSTREAM_DESCRIPTOR_SIZE) : (size_t) r;
 
             if (l > 0) {
                 pa_memchunk chunk;
 
-                chunk.memblock = p->read.memblock;
-                chunk.index = p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE - l;
+                chunk.memblock = re->memblock;
+                chunk.index = re->index - PA_PSTREAM_DESCRIPTOR_SIZE - l;
                 chunk.length = l;
 
                 if (p->receive_memblock_callback) {
                     int64_t offset;
 
                     offset = (int64_t) (
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
+                            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
+                            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
 
                     p->receive_memblock_callback(
                         p,
-                        ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
+                        ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
                         offset,
-                        ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
+                        ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
                         &chunk,
                         p->receive_memblock_callback_userdata);
                 }
 
                 /* Drop seek info for following callbacks */
-                p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] =
-                    p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] =
-                    p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
+                re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] =
+                    re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] =
+                    re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
             }
         }
 
         /* Frame complete */
-        if (p->read.index >= ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) + PA_PSTREAM_DESCRIPTOR_SIZE) {
+        if (re->index >= ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) + PA_PSTREAM_DESCRIPTOR_SIZE) {
 
-            if (p->read.memblock) {
+            if (re->memblock) {
 
                 /* This was a memblock frame. We can unref the memblock now */
-                pa_memblock_unref(p->read.memblock);
+                pa_memblock_unref(re->memblock);
 
-            } else if (p->read.packet) {
+            } else if (re->packet) {
 
                 if (p->receive_packet_callback)
 #ifdef HAVE_CREDS
-                    p->receive_packet_callback(p, p->read.packet, p->read_creds_valid ? &p->read_creds : NULL, p->receive_packet_callback_userdata);
+                    p->receive_packet_callback(p, re->packet,
+                                               re == &p->readio && (p->read_ancil_data.creds_valid || p->read_ancil_data.nfd > 0) ? &p->read_ancil_data : NULL,
+                                               p->receive_packet_callback_userdata);
 #else
-                    p->receive_packet_callback(p, p->read.packet, NULL, p->receive_packet_callback_userdata);
+                    p->receive_packet_callback(p, re->packet, NULL, p->receive_packet_callback_userdata);
 #endif
 
-                pa_packet_unref(p->read.packet);
+                pa_packet_unref(re->packet);
             } else {
                 pa_memblock *b;
+                uint32_t flags = ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]);
 
-                pa_assert((ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA);
+                pa_assert(flags & PA_FLAG_SHMDATA);
 
                 pa_assert(p->import);
 
                 if (!(b = pa_memimport_get(p->import,
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_BLOCKID]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_SHMID]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_INDEX]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH])))) {
+                                          (flags & PA_FLAG_SHMDATA_MEMFD_BLOCK) ? PA_MEM_TYPE_SHARED_MEMFD : PA_MEM_TYPE_SHARED_POSIX,
+                                          ntohl(re->shm_info[PA_PSTREAM_SHM_BLOCKID]),
+                                          ntohl(re->shm_info[PA_PSTREAM_SHM_SHMID]),
+                                          ntohl(re->shm_info[PA_PSTREAM_SHM_INDEX]),
+                                          ntohl(re->shm_info[PA_PSTREAM_SHM_LENGTH])))) {
 
                     if (pa_log_ratelimit(PA_LOG_DEBUG))
                         pa_log_debug("Failed to import memory block.");
@@ -853,17 +1382,17 @@ static int do_read(pa_pstream *p) {
 
                     chunk.memblock = b;
                     chunk.index = 0;
-                    chunk.length = b ? pa_memblock_get_length(b) : ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH]);
+                    chunk.length = b ? pa_memblock_get_length(b) : ntohl(re->shm_info[PA_PSTREAM_SHM_LENGTH]);
 
                     offset = (int64_t) (
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
+                            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
+                            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
 
                     p->receive_memblock_callback(
                             p,
-                            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
+                            ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
                             offset,
-                            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
+                            ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
                             &chunk,
                             p->receive_memblock_callback_userdata);
                 }
@@ -879,13 +1408,21 @@ static int do_read(pa_pstream *p) {
     return 0;
 
 frame_done:
-    p->read.memblock = NULL;
-    p->read.packet = NULL;
-    p->read.index = 0;
-    p->read.data = NULL;
+    re->memblock = NULL;
+    re->packet = NULL;
+    re->index = 0;
+    re->data = NULL;
+
+    if (re == &p->readio && p->srb && p->srb_used_by_peer && p->srb_ancil_pending > 0)
+        p->srb_ancil_pending--;
 
 #ifdef HAVE_CREDS
-    p->read_creds_valid = FALSE;
+    /* File descriptors the packet handler wanted to keep have been
+     * duplicated by it */
+    if (re == &p->readio) {
+        pa_cmsg_ancil_data_close_fds(&p->read_ancil_data);
+        p->read_ancil_data.creds_valid = FALSE;
+    }
 #endif
 
     return 0;
@@ -993,6 +1530,18 @@ void pa_pstream_unlink(pa_pstream *p) {
         p->export = NULL;
     }
 
+    if (p->srb) {
+        pa_srbchannel_free(p->srb);
+        p->srb = NULL;
+    }
+
+    if (p->srbpending) {
+        pa_srbchannel_free(p->srbpending);
+        p->srbpending = NULL;
+    }
+
+    p->is_srbpending = FALSE;
+
     if (p->io) {
         pa_iochannel_free(p->io);
         p->io = NULL;
@@ -1017,7 +1566,10 @@ void pa_pstream_enable_shm(pa_pstream *p, pa_bool_t enable) {
 
     if (enable) {
 
-        if (!p->export)
+        /* The blocks of a memfd pool can only be referenced once the
+         * pool was registered with the other side, see
+         * pa_pstream_enable_memfd() */
+        if (!p->export && !pa_mempool_is_memfd_backed(p->mempool))
             p->export = pa_memexport_new(p->mempool, memexport_revoke_cb, p);
 
     } else {
@@ -1026,12 +1578,64 @@ void pa_pstream_enable_shm(pa_pstream *p, pa_bool_t enable) {
             pa_memexport_free(p->export);
             p->export = NULL;
         }
+
+        p->use_memfd = FALSE;
     }
 }
 
+void pa_pstream_enable_memfd(pa_pstream *p, pa_mempool *pool) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(p->use_shm);
+    pa_assert(pool);
+    pa_assert(pa_mempool_is_memfd_backed(pool));
+
+    if (p->export)
+        pa_memexport_free(p->export);
+
+    p->export = pa_memexport_new(pool, memexport_revoke_cb, p);
+    p->use_memfd = TRUE;
+}
+
+int pa_pstream_attach_memfd_shmid(pa_pstream *p, uint32_t shm_id, int memfd_fd) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(memfd_fd >= 0);
+
+    if (!p->use_shm)
+        return -1;
+
+    pa_assert(p->import);
+
+    return pa_memimport_attach_memfd(p->import, shm_id, memfd_fd);
+}
+
 pa_bool_t pa_pstream_get_shm(pa_pstream *p) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
     return p->use_shm;
 }
+
+void pa_pstream_set_srbchannel(pa_pstream *p, pa_srbchannel *srb) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    if (srb == p->srb)
+        return;
+
+    /* We can't handle quick switches between channels */
+    pa_assert(!p->is_srbpending);
+
+    if (p->dead) {
+        if (srb)
+            pa_srbchannel_free(srb);
+        return;
+    }
+
+    p->srbpending = srb;
+    p->is_srbpending = TRUE;
+
+    /* Switch as soon as the send queue allows it */
+    p->mainloop->defer_enable(p->defer_event, 1);
+}
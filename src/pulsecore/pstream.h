@@ -33,11 +33,12 @@
 #include <pulsecore/iochannel.h>
 #include <pulsecore/memchunk.h>
 #include <pulsecore/creds.h>
+#include <pulsecore/srbchannel.h>
 #include <pulsecore/macro.h>
 
 typedef struct pa_pstream pa_pstream;
 
-typedef void (*pa_pstream_packet_cb_t)(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata);
+typedef void (*pa_pstream_packet_cb_t)(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata);
 typedef void (*pa_pstream_memblock_cb_t)(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata);
 typedef void (*pa_pstream_notify_cb_t)(pa_pstream *p, void *userdata);
 typedef void (*pa_pstream_block_id_cb_t)(pa_pstream *p, uint32_t block_id, void *userdata);
@@ -49,7 +50,10 @@ void pa_pstream_unref(pa_pstream*p);
 
 void pa_pstream_unlink(pa_pstream *p);
 
-void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *creds);
+/* Packets with ancillary data (credentials or file descriptors) are
+ * always sent over the socket. File descriptors have to stay open
+ * until the packet has been sent. */
+void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data);
 void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk);
 void pa_pstream_send_release(pa_pstream *p, uint32_t block_id);
 void pa_pstream_send_revoke(pa_pstream *p, uint32_t block_id);
@@ -66,4 +70,21 @@ pa_bool_t pa_pstream_is_pending(pa_pstream *p);
 void pa_pstream_enable_shm(pa_pstream *p, pa_bool_t enable);
 pa_bool_t pa_pstream_get_shm(pa_pstream *p);
 
+/* Export memory blocks through the memfd backed pool from now on,
+ * copying blocks of other pools into it. The pool has to be
+ * registered with the other side before any block is sent, see
+ * pa_pstream_register_memfd_mempool(), and has to stay around until
+ * the pstream is unlinked. Requires SHM to be enabled. */
+void pa_pstream_enable_memfd(pa_pstream *p, pa_mempool *pool);
+
+/* Make a memfd pool the other side registered available for
+ * importing blocks from it. The fd stays owned by the caller. */
+int pa_pstream_attach_memfd_shmid(pa_pstream *p, uint32_t shm_id, int memfd_fd);
+
+/* Move all further traffic to a shared memory ring buffer channel,
+ * or back to the socket if srb is NULL. The switch happens as soon
+ * as everything queued so far has been written to the old channel.
+ * The pstream takes ownership of the channel. */
+void pa_pstream_set_srbchannel(pa_pstream *p, pa_srbchannel *srb);
+
 #endif
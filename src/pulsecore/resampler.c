@@ -24,6 +24,7 @@
 #endif
 
 #include <string.h>
+#include <math.h>
 
 #ifdef HAVE_LIBSAMPLERATE
 #include <samplerate.h>
@@ -110,6 +111,24 @@ struct pa_resampler {
         struct AVResampleContext *state;
         pa_memchunk buf[PA_CHANNELS_MAX];
     } ffmpeg;
+
+    struct { /* data specific to the polyphase FIR resampler */
+        unsigned quality;
+        unsigned n_taps, n_phases, phase_div;
+        bool interpolate;
+        float cutoff;
+        float *filters;
+
+        /* Planar input, buf_frames per channel: the n_taps - 1 frames
+         * of history followed by the input not consumed yet */
+        float *buf;
+        unsigned buf_frames, buf_len;
+
+        /* Position of the next output frame between buf[0] and buf[1],
+         * in units of 1/o_rate input frames */
+        unsigned frac;
+        uint32_t o_rate;
+    } fir;
 };
 
 static int copy_init(pa_resampler *r);
@@ -119,6 +138,7 @@ static int speex_init(pa_resampler*r);
 #endif
 static int ffmpeg_init(pa_resampler*r);
 static int peaks_init(pa_resampler*r);
+static int fir_init(pa_resampler*r);
 #ifdef HAVE_LIBSAMPLERATE
 static int libsamplerate_init(pa_resampler*r);
 #endif
@@ -191,8 +211,27 @@ static int (* const init_table[])(pa_resampler*r) = {
     [PA_RESAMPLER_AUTO]                    = NULL,
     [PA_RESAMPLER_COPY]                    = copy_init,
     [PA_RESAMPLER_PEAKS]                   = peaks_init,
+    [PA_RESAMPLER_FIR_BASE+0]              = fir_init,
+    [PA_RESAMPLER_FIR_BASE+1]              = fir_init,
+    [PA_RESAMPLER_FIR_BASE+2]              = fir_init,
+    [PA_RESAMPLER_FIR_BASE+3]              = fir_init,
+    [PA_RESAMPLER_FIR_BASE+4]              = fir_init,
+    [PA_RESAMPLER_FIR_BASE+5]              = fir_init,
+    [PA_RESAMPLER_FIR_BASE+6]              = fir_init,
+    [PA_RESAMPLER_FIR_BASE+7]              = fir_init,
+    [PA_RESAMPLER_FIR_BASE+8]              = fir_init,
+    [PA_RESAMPLER_FIR_BASE+9]              = fir_init,
+    [PA_RESAMPLER_FIR_BASE+10]             = fir_init,
 };
 
+static bool format_is_wider_than_s16(pa_sample_format_t f) {
+    return
+        f == PA_SAMPLE_S32NE || f == PA_SAMPLE_S32RE ||
+        f == PA_SAMPLE_FLOAT32NE || f == PA_SAMPLE_FLOAT32RE ||
+        f == PA_SAMPLE_S24NE || f == PA_SAMPLE_S24RE ||
+        f == PA_SAMPLE_S24_32NE || f == PA_SAMPLE_S24_32RE;
+}
+
 pa_resampler* pa_resampler_new(
         pa_mempool *pool,
         const pa_sample_spec *a,
@@ -238,10 +277,7 @@ pa_resampler* pa_resampler_new(
 #ifdef HAVE_SPEEX
         method = PA_RESAMPLER_SPEEX_FLOAT_BASE + 1;
 #else
-        if (flags & PA_RESAMPLER_VARIABLE_RATE)
-            method = PA_RESAMPLER_TRIVIAL;
-        else
-            method = PA_RESAMPLER_FFMPEG;
+        method = PA_RESAMPLER_FIR_BASE + 1;
 #endif
     }
 
@@ -300,6 +336,15 @@ pa_resampler* pa_resampler_new(
         } else
             r->work_format = a->format;
 
+    } else if (method >= PA_RESAMPLER_FIR_BASE && method <= PA_RESAMPLER_FIR_MAX) {
+
+        /* The FIR resampler reads and writes S16 directly, so only go
+         * through float if that would lose precision */
+        if (format_is_wider_than_s16(a->format) || format_is_wider_than_s16(b->format))
+            r->work_format = PA_SAMPLE_FLOAT32NE;
+        else
+            r->work_format = PA_SAMPLE_S16NE;
+
     } else
         r->work_format = PA_SAMPLE_FLOAT32NE;
 
@@ -524,7 +569,18 @@ static const char * const resample_methods[] = {
     "ffmpeg",
     "auto",
     "copy",
-    "peaks"
+    "peaks",
+    "fir-0",
+    "fir-1",
+    "fir-2",
+    "fir-3",
+    "fir-4",
+    "fir-5",
+    "fir-6",
+    "fir-7",
+    "fir-8",
+    "fir-9",
+    "fir-10"
 };
 
 const char *pa_resample_method_to_string(pa_resample_method_t m) {
@@ -570,6 +626,9 @@ pa_resample_method_t pa_parse_resample_method(const char *string) {
     if (pa_streq(string, "speex-float"))
         return PA_RESAMPLER_SPEEX_FLOAT_BASE + 1;
 
+    if (pa_streq(string, "fir"))
+        return PA_RESAMPLER_FIR_BASE + 1;
+
     return PA_RESAMPLER_INVALID;
 }
 
@@ -1730,6 +1789,365 @@ static int ffmpeg_init(pa_resampler *r) {
     return 0;
 }
 
+/*** polyphase FIR implementation ***/
+
+/* Filter length at unity ratio, passband width relative to the lower
+ * of the two Nyquist frequencies when down- and upsampling, and the
+ * Kaiser window beta for each quality level. Lengths and widths are the
+ * ones speex uses, so that fir-N and speex-float-N are comparable. */
+static const struct {
+    unsigned n_taps;
+    double down_bandwidth, up_bandwidth;
+    double beta;
+} fir_quality_map[] = {
+    {   8, 0.830, 0.860,  6.0 },
+    {  16, 0.850, 0.880,  6.0 },
+    {  32, 0.882, 0.910,  6.0 },
+    {  48, 0.895, 0.917,  8.0 },
+    {  64, 0.921, 0.940,  8.0 },
+    {  80, 0.922, 0.940, 10.0 },
+    {  96, 0.940, 0.945, 10.0 },
+    { 128, 0.950, 0.950, 10.0 },
+    { 160, 0.960, 0.960, 10.0 },
+    { 192, 0.968, 0.968, 12.0 },
+    { 256, 0.975, 0.975, 12.0 }
+};
+
+/* Ratios that need more phases than this, and all variable rate
+ * resamplers, interpolate linearly between FIR_INTERPOLATION_PHASES
+ * phases instead */
+#define FIR_PHASES_MAX 512
+#define FIR_INTERPOLATION_PHASES 256
+
+static float fir_dot_generic(const float *x, const float *h, unsigned n) {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+    for (; n > 0; n -= 4, x += 4, h += 4) {
+        s0 += x[0] * h[0];
+        s1 += x[1] * h[1];
+        s2 += x[2] * h[2];
+        s3 += x[3] * h[3];
+    }
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+static pa_resampler_fir_dot_func_t fir_dot_func = fir_dot_generic;
+
+pa_resampler_fir_dot_func_t pa_get_resampler_fir_dot_func(void) {
+    return fir_dot_func;
+}
+
+void pa_set_resampler_fir_dot_func(pa_resampler_fir_dot_func_t func) {
+    pa_assert(func);
+
+    fir_dot_func = func;
+}
+
+static double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    unsigned k;
+
+    for (k = 1; k < 100; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+
+        if (term < sum * 1e-12)
+            break;
+    }
+
+    return sum;
+}
+
+/* Kaiser windowed sinc for an output frame that lies d (0..1) input
+ * frames after the middle of the window, i.e. after tap n_taps/2 - 1 */
+static void fir_design_phase(float *h, unsigned n_taps, double d, double cutoff, double beta) {
+    double sum = 0, i0_beta = bessel_i0(beta);
+    unsigned j;
+
+    for (j = 0; j < n_taps; j++) {
+        double t = (double) j - (double) (n_taps / 2 - 1) - d;
+        double x = t / (n_taps / 2), v;
+
+        if (fabs(x) >= 1.0)
+            v = 0;
+        else if (fabs(t) < 1e-9)
+            v = cutoff;
+        else
+            v = sin(M_PI * cutoff * t) / (M_PI * t) * bessel_i0(beta * sqrt(1 - x * x)) / i0_beta;
+
+        h[j] = (float) v;
+        sum += v;
+    }
+
+    /* Unity gain at DC for every phase */
+    for (j = 0; j < n_taps; j++)
+        h[j] = (float) (h[j] / sum);
+}
+
+static void fir_ensure_buf(pa_resampler *r, unsigned frames) {
+    float *buf;
+    unsigned c, n;
+
+    if (frames <= r->fir.buf_frames)
+        return;
+
+    n = PA_MAX(frames, r->fir.buf_frames * 2);
+    buf = pa_xnew0(float, n * r->work_channels);
+
+    for (c = 0; c < r->work_channels; c++)
+        memcpy(buf + c * n, r->fir.buf + c * r->fir.buf_frames, r->fir.buf_len * sizeof(float));
+
+    pa_xfree(r->fir.buf);
+    r->fir.buf = buf;
+    r->fir.buf_frames = n;
+}
+
+/* Keep the middle of the window where it is when the filter length
+ * changes. Both lengths are multiples of 8, so this is exact. */
+static void fir_resize_window(pa_resampler *r, unsigned n_taps) {
+    unsigned c, shift;
+
+    if (n_taps > r->fir.n_taps) {
+        shift = (n_taps - r->fir.n_taps) / 2;
+        fir_ensure_buf(r, r->fir.buf_len + shift);
+
+        for (c = 0; c < r->work_channels; c++) {
+            float *b = r->fir.buf + c * r->fir.buf_frames;
+
+            memmove(b + shift, b, r->fir.buf_len * sizeof(float));
+            memset(b, 0, shift * sizeof(float));
+        }
+
+        r->fir.buf_len += shift;
+
+    } else if (n_taps < r->fir.n_taps) {
+        shift = PA_MIN((r->fir.n_taps - n_taps) / 2, r->fir.buf_len);
+
+        for (c = 0; c < r->work_channels; c++) {
+            float *b = r->fir.buf + c * r->fir.buf_frames;
+
+            memmove(b, b + shift, (r->fir.buf_len - shift) * sizeof(float));
+        }
+
+        r->fir.buf_len -= shift;
+    }
+}
+
+static void fir_design(pa_resampler *r) {
+    unsigned n_taps, n_phases, p;
+    bool interpolate;
+    double cutoff, beta;
+
+    beta = fir_quality_map[r->fir.quality].beta;
+
+    /* When downsampling, the filter has to be as many input frames
+     * long as it would be output frames at unity ratio */
+    if (r->i_ss.rate > r->o_ss.rate) {
+        cutoff = fir_quality_map[r->fir.quality].down_bandwidth * r->o_ss.rate / r->i_ss.rate;
+        n_taps = (unsigned) (((uint64_t) fir_quality_map[r->fir.quality].n_taps * r->i_ss.rate + r->o_ss.rate - 1) / r->o_ss.rate);
+    } else {
+        cutoff = fir_quality_map[r->fir.quality].up_bandwidth;
+        n_taps = fir_quality_map[r->fir.quality].n_taps;
+    }
+
+    n_taps = PA_ROUND_UP(n_taps, 8);
+
+    n_phases = r->o_ss.rate / pa_gcd(r->i_ss.rate, r->o_ss.rate);
+    interpolate = (r->flags & PA_RESAMPLER_VARIABLE_RATE) || n_phases > FIR_PHASES_MAX;
+
+    if (interpolate)
+        n_phases = FIR_INTERPOLATION_PHASES;
+
+    /* Variable rate users move the rates around a little all the time,
+     * don't recalculate the filters for that */
+    if (r->fir.filters &&
+        n_taps == r->fir.n_taps &&
+        n_phases == r->fir.n_phases &&
+        interpolate == r->fir.interpolate &&
+        fabs(cutoff - r->fir.cutoff) < cutoff * 0.01)
+        return;
+
+    if (r->fir.filters)
+        fir_resize_window(r, n_taps);
+
+    r->fir.n_taps = n_taps;
+    r->fir.n_phases = n_phases;
+    r->fir.phase_div = interpolate ? 0 : r->o_ss.rate / n_phases;
+    r->fir.interpolate = interpolate;
+    r->fir.cutoff = (float) cutoff;
+
+    /* The interpolating filter bank has an extra phase for d = 1 */
+    pa_xfree(r->fir.filters);
+    r->fir.filters = pa_xnew(float, (n_phases + 1) * n_taps);
+
+    for (p = 0; p <= n_phases; p++)
+        fir_design_phase(r->fir.filters + p * n_taps, n_taps, (double) p / n_phases, cutoff, beta);
+
+    pa_log_debug("FIR resampler: %u taps, %u %s phases, cutoff %0.3f",
+                 n_taps, n_phases, interpolate ? "interpolated" : "exact", cutoff);
+}
+
+static void fir_resample(pa_resampler *r, const pa_memchunk *input, unsigned in_n_frames, pa_memchunk *output, unsigned *out_n_frames) {
+    pa_resampler_fir_dot_func_t dot = fir_dot_func;
+    unsigned c, i, channels, n_taps, stride;
+    unsigned pos, frac, step, step_frac, o_rate, o_index = 0;
+    bool s16;
+    void *src, *dst;
+
+    pa_assert(r);
+    pa_assert(input);
+    pa_assert(output);
+    pa_assert(out_n_frames);
+
+    channels = r->work_channels;
+    s16 = r->work_format == PA_SAMPLE_S16NE;
+
+    /* Append the input to the planar buffer, converting from S16 on
+     * the way if necessary */
+    fir_ensure_buf(r, r->fir.buf_len + in_n_frames);
+    stride = r->fir.buf_frames;
+
+    src = pa_memblock_acquire_chunk(input);
+
+    for (c = 0; c < channels; c++) {
+        float *b = r->fir.buf + c * stride + r->fir.buf_len;
+
+        if (s16) {
+            const int16_t *s = (const int16_t*) src + c;
+
+            for (i = 0; i < in_n_frames; i++, s += channels)
+                b[i] = *s;
+        } else {
+            const float *s = (const float*) src + c;
+
+            for (i = 0; i < in_n_frames; i++, s += channels)
+                b[i] = *s;
+        }
+    }
+
+    pa_memblock_release(input->memblock);
+    r->fir.buf_len += in_n_frames;
+
+    n_taps = r->fir.n_taps;
+    o_rate = r->fir.o_rate;
+    step = r->i_ss.rate / o_rate;
+    step_frac = r->i_ss.rate % o_rate;
+    pos = 0;
+    frac = r->fir.frac;
+
+    dst = pa_memblock_acquire_chunk(output);
+
+    for (; pos + n_taps <= r->fir.buf_len; o_index++) {
+        float v[PA_CHANNELS_MAX];
+
+        pa_assert_fp(o_index < *out_n_frames);
+
+        if (!r->fir.interpolate) {
+            const float *h = r->fir.filters + (frac / r->fir.phase_div) * n_taps;
+
+            for (c = 0; c < channels; c++)
+                v[c] = dot(r->fir.buf + c * stride + pos, h, n_taps);
+
+        } else {
+            uint64_t x = (uint64_t) frac * FIR_INTERPOLATION_PHASES;
+            const float *h = r->fir.filters + (unsigned) (x / o_rate) * n_taps;
+            float mu = (float) (x % o_rate) / (float) o_rate;
+
+            for (c = 0; c < channels; c++) {
+                const float *b = r->fir.buf + c * stride + pos;
+                float a = dot(b, h, n_taps);
+
+                v[c] = a + mu * (dot(b, h + n_taps, n_taps) - a);
+            }
+        }
+
+        if (s16) {
+            int16_t *d = (int16_t*) dst + o_index * channels;
+
+            for (c = 0; c < channels; c++)
+                d[c] = (int16_t) PA_CLAMP_UNLIKELY(lrintf(v[c]), -0x8000, 0x7FFF);
+        } else {
+            float *d = (float*) dst + o_index * channels;
+
+            for (c = 0; c < channels; c++)
+                d[c] = v[c];
+        }
+
+        pos += step;
+        frac += step_frac;
+
+        if (frac >= o_rate) {
+            frac -= o_rate;
+            pos++;
+        }
+    }
+
+    pa_memblock_release(output->memblock);
+
+    /* The filter is always longer than the step, so we can't have
+     * skipped past the end of the input */
+    pa_assert(pos <= r->fir.buf_len);
+
+    for (c = 0; c < channels; c++) {
+        float *b = r->fir.buf + c * stride;
+
+        memmove(b, b + pos, (r->fir.buf_len - pos) * sizeof(float));
+    }
+
+    r->fir.buf_len -= pos;
+    r->fir.frac = frac;
+
+    *out_n_frames = o_index;
+}
+
+static void fir_update_rates(pa_resampler *r) {
+    pa_assert(r);
+
+    /* Keep the position between the two input frames */
+    r->fir.frac = (unsigned) (((uint64_t) r->fir.frac * r->o_ss.rate) / r->fir.o_rate);
+    r->fir.o_rate = r->o_ss.rate;
+
+    fir_design(r);
+}
+
+static void fir_reset(pa_resampler *r) {
+    pa_assert(r);
+
+    /* Start with a window of silence, like speex does */
+    fir_ensure_buf(r, r->fir.n_taps - 1);
+    memset(r->fir.buf, 0, r->fir.buf_frames * r->work_channels * sizeof(float));
+
+    r->fir.buf_len = r->fir.n_taps - 1;
+    r->fir.frac = 0;
+}
+
+static void fir_free(pa_resampler *r) {
+    pa_assert(r);
+
+    pa_xfree(r->fir.filters);
+    pa_xfree(r->fir.buf);
+}
+
+static int fir_init(pa_resampler *r) {
+    pa_assert(r);
+    pa_assert(r->method >= PA_RESAMPLER_FIR_BASE && r->method <= PA_RESAMPLER_FIR_MAX);
+    pa_assert(r->work_format == PA_SAMPLE_S16NE || r->work_format == PA_SAMPLE_FLOAT32NE);
+
+    r->fir.quality = r->method - PA_RESAMPLER_FIR_BASE;
+    r->fir.o_rate = r->o_ss.rate;
+
+    fir_design(r);
+    fir_reset(r);
+
+    r->impl_free = fir_free;
+    r->impl_update_rates = fir_update_rates;
+    r->impl_resample = fir_resample;
+    r->impl_reset = fir_reset;
+
+    return 0;
+}
+
 /*** copy (noop) implementation ***/
 
 static int copy_init(pa_resampler *r) {
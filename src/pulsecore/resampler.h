@@ -45,6 +45,8 @@ typedef enum pa_resample_method {
     PA_RESAMPLER_AUTO, /* automatic select based on sample format */
     PA_RESAMPLER_COPY,
     PA_RESAMPLER_PEAKS,
+    PA_RESAMPLER_FIR_BASE,
+    PA_RESAMPLER_FIR_MAX = PA_RESAMPLER_FIR_BASE + 10,
     PA_RESAMPLER_MAX
 } pa_resample_method_t;
 
@@ -99,6 +101,13 @@ const char *pa_resample_method_to_string(pa_resample_method_t m);
 /* Return 1 when the specified resampling method is supported */
 int pa_resample_method_supported(pa_resample_method_t m);
 
+/* Inner loop of the FIR resampler: the dot product of n input samples
+ * and n filter coefficients. n is always a multiple of 8. */
+typedef float (*pa_resampler_fir_dot_func_t)(const float *x, const float *h, unsigned n);
+
+pa_resampler_fir_dot_func_t pa_get_resampler_fir_dot_func(void);
+void pa_set_resampler_fir_dot_func(pa_resampler_fir_dot_func_t func);
+
 const pa_channel_map* pa_resampler_input_channel_map(pa_resampler *r);
 const pa_sample_spec* pa_resampler_input_sample_spec(pa_resampler *r);
 const pa_channel_map* pa_resampler_output_channel_map(pa_resampler *r);
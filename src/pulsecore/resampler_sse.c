@@ -0,0 +1,59 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "cpu-x86.h"
+#include "resampler.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <xmmintrin.h>
+
+/* n is a multiple of 8, so two accumulators don't need a tail loop */
+static float fir_dot_sse(const float *x, const float *h, unsigned n) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    PA_DECLARE_ALIGNED(16, float, t[4]);
+
+    for (; n > 0; n -= 8, x += 8, h += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(x), _mm_loadu_ps(h)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(x + 4), _mm_loadu_ps(h + 4)));
+    }
+
+    _mm_store_ps(t, _mm_add_ps(s0, s1));
+
+    return (t[0] + t[1]) + (t[2] + t[3]);
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_resampler_func_init_sse(pa_cpu_x86_flag_t flags) {
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE optimized resampler functions.");
+
+        pa_set_resampler_fir_dot_func(fir_dot_sse);
+    }
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
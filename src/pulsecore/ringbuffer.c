@@ -0,0 +1,88 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "ringbuffer.h"
+
+static int load_count(pa_ringbuffer *r) {
+    int c = pa_atomic_load(r->count);
+
+    /* The other side may have scribbled over the counter */
+    return PA_CLAMP(c, 0, r->capacity);
+}
+
+void *pa_ringbuffer_peek(pa_ringbuffer *r, int *count) {
+    int c;
+
+    pa_assert(r);
+    pa_assert(count);
+
+    c = load_count(r);
+
+    if (r->readindex + c > r->capacity)
+        *count = r->capacity - r->readindex;
+    else
+        *count = c;
+
+    return r->memory + r->readindex;
+}
+
+pa_bool_t pa_ringbuffer_drop(pa_ringbuffer *r, int count) {
+    pa_bool_t b;
+
+    pa_assert(r);
+    pa_assert(count >= 0);
+    pa_assert(count <= r->capacity - r->readindex);
+
+    b = pa_atomic_sub(r->count, count) >= r->capacity;
+
+    r->readindex += count;
+    if (r->readindex >= r->capacity)
+        r->readindex -= r->capacity;
+
+    return b;
+}
+
+void *pa_ringbuffer_begin_write(pa_ringbuffer *r, int *count) {
+    int c;
+
+    pa_assert(r);
+    pa_assert(count);
+
+    c = load_count(r);
+
+    *count = PA_MIN(r->capacity - r->writeindex, r->capacity - c);
+
+    return r->memory + r->writeindex;
+}
+
+void pa_ringbuffer_end_write(pa_ringbuffer *r, int count) {
+    pa_assert(r);
+    pa_assert(count >= 0);
+    pa_assert(count <= r->capacity - r->writeindex);
+
+    pa_atomic_add(r->count, count);
+
+    r->writeindex += count;
+    if (r->writeindex >= r->capacity)
+        r->writeindex -= r->capacity;
+}
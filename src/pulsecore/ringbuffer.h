@@ -0,0 +1,57 @@
+#ifndef foopulseringbufferhfoo
+#define foopulseringbufferhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+
+/* A lock-free byte ring buffer for exactly one reader and one
+ * writer, which may live in different processes. Only the fill level
+ * is shared (and may be placed in shared memory together with the
+ * buffer itself), the read and write positions are private to the
+ * reader and the writer. Since the other side might not be trusted,
+ * the shared fill level is never relied upon to be in range. */
+
+typedef struct pa_ringbuffer {
+    pa_atomic_t *count;
+    int capacity;
+    uint8_t *memory;
+    int readindex, writeindex;
+} pa_ringbuffer;
+
+/* Returns a pointer to the data that can be read, and in *count the
+ * number of bytes that are available there without wrapping around */
+void *pa_ringbuffer_peek(pa_ringbuffer *r, int *count);
+
+/* Marks count bytes as read. Returns TRUE if the buffer was full
+ * before, i.e. if the writer might be waiting for space. */
+pa_bool_t pa_ringbuffer_drop(pa_ringbuffer *r, int count);
+
+/* Returns a pointer to where data can be written, and in *count the
+ * number of bytes that fit there without wrapping around */
+void *pa_ringbuffer_begin_write(pa_ringbuffer *r, int *count);
+
+/* Marks count bytes as written */
+void pa_ringbuffer_end_write(pa_ringbuffer *r, int count);
+
+#endif
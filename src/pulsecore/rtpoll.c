@@ -28,6 +28,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#define USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
 
 #include <pulse/xmalloc.h>
 #include <pulse/timeval.h>
@@ -46,6 +53,19 @@
 
 /* #define DEBUG_TIMING */
 
+#ifdef USE_EPOLL
+/* The epoll data of the timerfd, every other fd is registered with
+ * its index in the pollfd array */
+#define TIMER_INDEX ((uint32_t) -1)
+
+/* The events we last told epoll about for an entry of the pollfd
+ * array */
+struct epoll_registration {
+    int fd;
+    short events;
+};
+#endif
+
 struct pa_rtpoll {
     struct pollfd *pollfd, *pollfd2;
     unsigned n_pollfd_alloc, n_pollfd_used;
@@ -53,6 +73,23 @@ struct pa_rtpoll {
     struct timeval next_elapse;
     pa_bool_t timer_enabled:1;
 
+    pa_rtpoll_backend_t backend;
+
+#ifdef USE_EPOLL
+    int epoll_fd, timer_fd;
+
+    struct epoll_registration *registered;
+    unsigned n_registered;
+
+    struct epoll_event *epoll_events;
+    unsigned n_epoll_events_alloc;
+
+    /* When the timerfd will fire, zero if it is disarmed */
+    struct timeval timer_armed;
+
+    pa_bool_t epoll_reset_needed:1;
+#endif
+
     pa_bool_t scan_for_dead:1;
     pa_bool_t running:1;
     pa_bool_t rebuild_needed:1;
@@ -86,7 +123,79 @@ struct pa_rtpoll_item {
 
 PA_STATIC_FLIST_DECLARE(items, 0, pa_xfree);
 
-pa_rtpoll *pa_rtpoll_new(void) {
+/* Only set during startup, before any IO thread is running */
+static pa_rtpoll_backend_t default_backend = PA_RTPOLL_BACKEND_POLL;
+
+#ifdef USE_EPOLL
+static int epoll_open(pa_rtpoll *p) {
+    struct epoll_event ev;
+
+    pa_assert(p);
+
+    if ((p->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        pa_log_warn("epoll_create1() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    pa_zero(ev);
+    ev.events = EPOLLIN;
+    ev.data.u32 = TIMER_INDEX;
+
+    if (epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, p->timer_fd, &ev) < 0) {
+        pa_log_warn("Failed to add timerfd to epoll: %s", pa_cstrerror(errno));
+        pa_close(p->epoll_fd);
+        p->epoll_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Fall back to poll() for good, used when epoll can't represent what
+ * the items ask for */
+static void epoll_close(pa_rtpoll *p) {
+    pa_assert(p);
+
+    if (p->epoll_fd >= 0)
+        pa_close(p->epoll_fd);
+    if (p->timer_fd >= 0)
+        pa_close(p->timer_fd);
+
+    p->epoll_fd = p->timer_fd = -1;
+
+    pa_xfree(p->registered);
+    p->registered = NULL;
+    p->n_registered = 0;
+
+    pa_xfree(p->epoll_events);
+    p->epoll_events = NULL;
+    p->n_epoll_events_alloc = 0;
+
+    p->backend = PA_RTPOLL_BACKEND_POLL;
+}
+
+static int epoll_init(pa_rtpoll *p) {
+    pa_assert(p);
+
+    p->epoll_fd = -1;
+
+    if ((p->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC|TFD_NONBLOCK)) < 0) {
+        pa_log_warn("timerfd_create() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (epoll_open(p) < 0) {
+        epoll_close(p);
+        return -1;
+    }
+
+    p->epoll_reset_needed = TRUE;
+
+    return 0;
+}
+#endif
+
+pa_rtpoll *pa_rtpoll_new_with_backend(pa_rtpoll_backend_t backend) {
     pa_rtpoll *p;
 
     p = pa_xnew0(pa_rtpoll, 1);
@@ -95,6 +204,19 @@ pa_rtpoll *pa_rtpoll_new(void) {
     p->pollfd = pa_xnew(struct pollfd, p->n_pollfd_alloc);
     p->pollfd2 = pa_xnew(struct pollfd, p->n_pollfd_alloc);
 
+    p->backend = PA_RTPOLL_BACKEND_POLL;
+
+    if (backend == PA_RTPOLL_BACKEND_EPOLL) {
+#ifdef USE_EPOLL
+        if (epoll_init(p) >= 0)
+            p->backend = PA_RTPOLL_BACKEND_EPOLL;
+        else
+            pa_log_warn("Falling back to poll().");
+#else
+        pa_log_warn("epoll is not supported on this system, falling back to poll().");
+#endif
+    }
+
 #ifdef DEBUG_TIMING
     p->timestamp = pa_rtclock_now();
 #endif
@@ -102,6 +224,45 @@ pa_rtpoll *pa_rtpoll_new(void) {
     return p;
 }
 
+pa_rtpoll *pa_rtpoll_new(void) {
+    return pa_rtpoll_new_with_backend(default_backend);
+}
+
+void pa_rtpoll_set_default_backend(pa_rtpoll_backend_t backend) {
+    default_backend = backend;
+}
+
+pa_rtpoll_backend_t pa_rtpoll_get_backend(pa_rtpoll *p) {
+    pa_assert(p);
+
+    return p->backend;
+}
+
+const char *pa_rtpoll_backend_to_string(pa_rtpoll_backend_t backend) {
+    switch (backend) {
+        case PA_RTPOLL_BACKEND_POLL:
+            return "poll";
+        case PA_RTPOLL_BACKEND_EPOLL:
+            return "epoll";
+    }
+
+    pa_assert_not_reached();
+}
+
+int pa_rtpoll_backend_from_string(const char *s, pa_rtpoll_backend_t *backend) {
+    pa_assert(s);
+    pa_assert(backend);
+
+    if (pa_streq(s, "poll"))
+        *backend = PA_RTPOLL_BACKEND_POLL;
+    else if (pa_streq(s, "epoll"))
+        *backend = PA_RTPOLL_BACKEND_EPOLL;
+    else
+        return -1;
+
+    return 0;
+}
+
 static void rtpoll_rebuild(pa_rtpoll *p) {
 
     struct pollfd *e, *t;
@@ -145,6 +306,11 @@ static void rtpoll_rebuild(pa_rtpoll *p) {
 
     if (ra)
         p->pollfd2 = pa_xrealloc(p->pollfd2, p->n_pollfd_alloc * sizeof(struct pollfd));
+
+#ifdef USE_EPOLL
+    /* The indexes we registered the fds with are stale now */
+    p->epoll_reset_needed = TRUE;
+#endif
 }
 
 static void rtpoll_item_destroy(pa_rtpoll_item *i) {
@@ -173,6 +339,11 @@ void pa_rtpoll_free(pa_rtpoll *p) {
     pa_xfree(p->pollfd);
     pa_xfree(p->pollfd2);
 
+#ifdef USE_EPOLL
+    if (p->backend == PA_RTPOLL_BACKEND_EPOLL)
+        epoll_close(p);
+#endif
+
     pa_xfree(p);
 }
 
@@ -203,6 +374,171 @@ static void reset_all_revents(pa_rtpoll *p) {
     }
 }
 
+/* Sleeps until one of the fds is ready or the timeout elapsed, NULL
+ * means no timeout. Returns the number of ready fds, like poll(). */
+static int rtpoll_poll(pa_rtpoll *p, const struct timeval *timeout) {
+    pa_assert(p);
+
+#ifdef HAVE_PPOLL
+    {
+        struct timespec ts;
+
+        if (timeout) {
+            ts.tv_sec = timeout->tv_sec;
+            ts.tv_nsec = timeout->tv_usec * 1000;
+        }
+
+        return ppoll(p->pollfd, p->n_pollfd_used, timeout ? &ts : NULL, NULL);
+    }
+#else
+    return pa_poll(p->pollfd, p->n_pollfd_used, timeout ? (int) ((timeout->tv_sec*1000) + (timeout->tv_usec / 1000)) : -1);
+#endif
+}
+
+#ifdef USE_EPOLL
+/* Bring the epoll set in line with the pollfd array. Since the items
+ * may change their pollfds at any time, we compare them with what we
+ * registered last time and only tell the kernel about the
+ * differences. */
+static int epoll_sync(pa_rtpoll *p) {
+    unsigned j;
+
+    pa_assert(p);
+
+    if (p->epoll_reset_needed) {
+
+        /* Starting over with a fresh epoll fd makes sure that nothing
+         * registered for a previous layout of the array is left */
+        pa_close(p->epoll_fd);
+
+        if (epoll_open(p) < 0)
+            return -1;
+
+        p->registered = pa_xrealloc(p->registered, PA_MAX(p->n_pollfd_used, 1U) * sizeof(struct epoll_registration));
+        p->n_registered = p->n_pollfd_used;
+
+        for (j = 0; j < p->n_registered; j++)
+            p->registered[j].fd = -1;
+
+        if (p->n_epoll_events_alloc < p->n_pollfd_used + 1) {
+            p->n_epoll_events_alloc = p->n_pollfd_used + 1;
+            p->epoll_events = pa_xrealloc(p->epoll_events, p->n_epoll_events_alloc * sizeof(struct epoll_event));
+        }
+
+        p->epoll_reset_needed = FALSE;
+    }
+
+    for (j = 0; j < p->n_pollfd_used; j++) {
+        struct pollfd *f = &p->pollfd[j];
+        struct epoll_registration *reg = &p->registered[j];
+        struct epoll_event ev;
+
+        if (f->fd < 0 && reg->fd < 0)
+            continue;
+
+        if (f->fd == reg->fd && f->events == reg->events)
+            continue;
+
+        if (reg->fd >= 0) {
+            /* The fd might have been closed already, which removes it
+             * from the set anyway */
+            epoll_ctl(p->epoll_fd, EPOLL_CTL_DEL, reg->fd, NULL);
+            reg->fd = -1;
+        }
+
+        if (f->fd < 0)
+            continue;
+
+        pa_zero(ev);
+        ev.events = (uint32_t) f->events & (EPOLLIN|EPOLLPRI|EPOLLOUT);
+        ev.data.u32 = j;
+
+        /* Fails for the same fd in two places, and for fds that
+         * epoll can't wait on, like regular files */
+        if (epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, f->fd, &ev) < 0) {
+            pa_log_info("Cannot add fd %i to epoll (%s), falling back to poll().", f->fd, pa_cstrerror(errno));
+            return -1;
+        }
+
+        reg->fd = f->fd;
+        reg->events = f->events;
+    }
+
+    return 0;
+}
+
+static void epoll_arm_timer(pa_rtpoll *p, const struct timeval *tv) {
+    struct itimerspec its;
+
+    pa_assert(p);
+
+    if (tv) {
+        if (pa_timeval_cmp(tv, &p->timer_armed) == 0)
+            return;
+
+        p->timer_armed = *tv;
+    } else {
+        if (p->timer_armed.tv_sec == 0 && p->timer_armed.tv_usec == 0)
+            return;
+
+        pa_zero(p->timer_armed);
+    }
+
+    pa_zero(its);
+    its.it_value.tv_sec = p->timer_armed.tv_sec;
+    its.it_value.tv_nsec = p->timer_armed.tv_usec * 1000;
+
+    pa_assert_se(timerfd_settime(p->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == 0);
+}
+
+/* Same as rtpoll_poll(), but with epoll. Timeouts are handled by a
+ * timerfd that is armed for the absolute expiry time, so it only needs
+ * to be touched when that changes. */
+static int rtpoll_epoll(pa_rtpoll *p, const struct timeval *timeout) {
+    int n, k, r = 0;
+    unsigned j;
+
+    pa_assert(p);
+
+    if (epoll_sync(p) < 0) {
+        epoll_close(p);
+        return rtpoll_poll(p, timeout);
+    }
+
+    if (timeout && timeout->tv_sec == 0 && timeout->tv_usec == 0)
+        n = epoll_wait(p->epoll_fd, p->epoll_events, (int) p->n_epoll_events_alloc, 0);
+    else {
+        epoll_arm_timer(p, timeout ? &p->next_elapse : NULL);
+        n = epoll_wait(p->epoll_fd, p->epoll_events, (int) p->n_epoll_events_alloc, -1);
+    }
+
+    if (n < 0)
+        return n;
+
+    for (j = 0; j < p->n_pollfd_used; j++)
+        p->pollfd[j].revents = 0;
+
+    for (k = 0; k < n; k++) {
+        struct epoll_event *ev = &p->epoll_events[k];
+
+        if (ev->data.u32 == TIMER_INDEX) {
+            uint64_t expirations;
+
+            /* The timer is one-shot, so it's disarmed now */
+            pa_read(p->timer_fd, &expirations, sizeof(expirations), NULL);
+            pa_zero(p->timer_armed);
+            continue;
+        }
+
+        pa_assert(ev->data.u32 < p->n_pollfd_used);
+        p->pollfd[ev->data.u32].revents = (short) (ev->events & (EPOLLIN|EPOLLPRI|EPOLLOUT|EPOLLERR|EPOLLHUP));
+        r++;
+    }
+
+    return r;
+}
+#endif
+
 int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
     pa_rtpoll_item *i;
     int r = 0;
@@ -306,16 +642,12 @@ int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
 #endif
 
     /* OK, now let's sleep */
-#ifdef HAVE_PPOLL
-    {
-        struct timespec ts;
-        ts.tv_sec = timeout.tv_sec;
-        ts.tv_nsec = timeout.tv_usec * 1000;
-        r = ppoll(p->pollfd, p->n_pollfd_used, (!wait_op || p->quit || p->timer_enabled) ? &ts : NULL, NULL);
-    }
-#else
-    r = pa_poll(p->pollfd, p->n_pollfd_used, (!wait_op || p->quit || p->timer_enabled) ? (int) ((timeout.tv_sec*1000) + (timeout.tv_usec / 1000)) : -1);
+#ifdef USE_EPOLL
+    if (p->backend == PA_RTPOLL_BACKEND_EPOLL)
+        r = rtpoll_epoll(p, !wait_op || p->quit || p->timer_enabled ? &timeout : NULL);
+    else
 #endif
+        r = rtpoll_poll(p, !wait_op || p->quit || p->timer_enabled ? &timeout : NULL);
 
     p->timer_elapsed = r == 0;
 
@@ -41,7 +41,13 @@
  * 3) It allows arbitrary functions to be run before entering the
  * actual poll() and after it.
  *
- * Only a single interval timer is supported..*/
+ * Only a single interval timer is supported..
+ *
+ * The poll() backend hands the whole pollfd array to the kernel on
+ * every iteration. The epoll backend keeps the fds registered and only
+ * passes on changes, which is cheaper with many fds. It can't wait on
+ * the same fd twice or on fds that epoll doesn't support; if an item
+ * asks for that, the loop falls back to poll() for good. */
 
 typedef struct pa_rtpoll pa_rtpoll;
 typedef struct pa_rtpoll_item pa_rtpoll_item;
@@ -53,9 +59,27 @@ typedef enum pa_rtpoll_priority {
     PA_RTPOLL_NEVER  = INT_MAX,       /* For stuff that doesn't register any callbacks, but only fds to listen on */
 } pa_rtpoll_priority_t;
 
+typedef enum pa_rtpoll_backend {
+    PA_RTPOLL_BACKEND_POLL,           /* ppoll() or poll() */
+    PA_RTPOLL_BACKEND_EPOLL,          /* epoll and a timerfd, Linux only */
+} pa_rtpoll_backend_t;
+
+/* Uses the default backend */
 pa_rtpoll *pa_rtpoll_new(void);
+pa_rtpoll *pa_rtpoll_new_with_backend(pa_rtpoll_backend_t backend);
 void pa_rtpoll_free(pa_rtpoll *p);
 
+/* Sets the backend pa_rtpoll_new() uses. Call this only at startup,
+ * before any rtpoll is created. */
+void pa_rtpoll_set_default_backend(pa_rtpoll_backend_t backend);
+
+/* The backend actually in use, which might be poll() if epoll was
+ * requested but isn't available */
+pa_rtpoll_backend_t pa_rtpoll_get_backend(pa_rtpoll *p);
+
+const char *pa_rtpoll_backend_to_string(pa_rtpoll_backend_t backend);
+int pa_rtpoll_backend_from_string(const char *s, pa_rtpoll_backend_t *backend);
+
 /* Sleep on the rtpoll until the time event, or any of the fd events
  * is triggered. If "wait" is 0 we don't sleep but only update the
  * struct pollfd. Returns negative on error, positive if the loop
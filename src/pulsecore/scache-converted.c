@@ -0,0 +1,295 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-scache.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "scache-converted.h"
+
+/* A file is the header below, the name of the sample file, and the
+ * converted data at the next aligned offset. */
+
+#define CONVERTED_MAGIC "PASCONV1"
+
+struct converted_header {
+    char magic[8];
+    uint64_t source_mtime;
+    uint64_t source_size;
+    uint32_t resample_method;
+    uint32_t resample_flags;
+    pa_sample_spec source_sample_spec;
+    pa_channel_map source_channel_map;
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    uint64_t length;
+    uint32_t filename_length;
+};
+
+static uint64_t hash_string(uint64_t h, const char *s) {
+    for (; *s; s++)
+        h = (h ^ (uint8_t) *s) * 1099511628211ULL;
+
+    return h;
+}
+
+static uint64_t filename_hash(const char *filename) {
+    return hash_string(14695981039346656037ULL, filename);
+}
+
+/* The file is named after a hash of the sample file name and one of
+ * the sink spec. Everything else is checked against the header. */
+char *pa_scache_converted_path(const char *dir, const pa_scache_converted_params *p) {
+    char st[PA_SAMPLE_SPEC_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX];
+    uint64_t h;
+
+    pa_assert(dir);
+    pa_assert(p);
+    pa_assert(p->filename);
+
+    h = hash_string(14695981039346656037ULL, pa_sample_spec_snprint(st, sizeof(st), &p->sample_spec));
+    h = hash_string(h, pa_channel_map_snprint(cm, sizeof(cm), &p->channel_map));
+
+    return pa_sprintf_malloc("%s" PA_PATH_SEP "%016llx-%016llx", dir,
+                             (unsigned long long) filename_hash(p->filename),
+                             (unsigned long long) h);
+}
+
+static size_t data_offset(size_t filename_length) {
+    return PA_ALIGN(sizeof(struct converted_header) + filename_length);
+}
+
+static pa_bool_t header_valid(const struct converted_header *h, size_t size, const pa_scache_converted_params *p) {
+    size_t l = strlen(p->filename);
+
+    return
+        memcmp(h->magic, CONVERTED_MAGIC, sizeof(h->magic)) == 0 &&
+        h->source_mtime == p->mtime &&
+        h->source_size == p->size &&
+        h->resample_method == (uint32_t) p->resample_method &&
+        h->resample_flags == (uint32_t) p->resample_flags &&
+        pa_sample_spec_valid(&h->source_sample_spec) &&
+        pa_channel_map_valid(&h->source_channel_map) &&
+        pa_channel_map_compatible(&h->source_channel_map, &h->source_sample_spec) &&
+        pa_sample_spec_equal(&h->sample_spec, &p->sample_spec) &&
+        pa_channel_map_equal(&h->channel_map, &p->channel_map) &&
+        h->filename_length == l &&
+        data_offset(l) <= size &&
+        memcmp((const uint8_t*) h + sizeof(*h), p->filename, l) == 0 &&
+        h->length > 0 &&
+        h->length <= size - data_offset(l) &&
+        h->length % pa_frame_size(&p->sample_spec) == 0;
+}
+
+int pa_scache_converted_load(const char *path, const pa_scache_converted_params *p, pa_scache_converted_map *m) {
+#ifdef HAVE_SYS_MMAN_H
+    const struct converted_header *h;
+    struct stat st;
+    size_t size;
+    void *map;
+    int fd;
+
+    pa_assert(path);
+    pa_assert(p);
+    pa_assert(m);
+
+    if ((fd = pa_open_cloexec(path, O_RDONLY, 0)) < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0) {
+        pa_assert_se(pa_close(fd) == 0);
+        return -1;
+    }
+
+    if (st.st_size < (off_t) sizeof(struct converted_header) ||
+        st.st_size > (off_t) (2 * PA_SCACHE_ENTRY_SIZE_MAX)) {
+        pa_assert_se(pa_close(fd) == 0);
+        goto invalid;
+    }
+
+    size = (size_t) st.st_size;
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    pa_assert_se(pa_close(fd) == 0);
+
+    if (map == MAP_FAILED)
+        return -1;
+
+    h = map;
+
+    if (!header_valid(h, size, p)) {
+        munmap(map, size);
+        goto invalid;
+    }
+
+    m->map = map;
+    m->map_size = size;
+    m->data = (const uint8_t*) map + data_offset(h->filename_length);
+    m->length = (size_t) h->length;
+    m->source_sample_spec = h->source_sample_spec;
+    m->source_channel_map = h->source_channel_map;
+
+    return 0;
+
+invalid:
+    pa_log_debug("Sample cache file %s is out of date, removing it.", path);
+
+    if (unlink(path) < 0)
+        pa_log_warn("Failed to remove %s: %s", path, pa_cstrerror(errno));
+#endif
+
+    return -1;
+}
+
+void pa_scache_converted_unmap(pa_scache_converted_map *m) {
+    pa_assert(m);
+
+#ifdef HAVE_SYS_MMAN_H
+    if (m->map)
+        munmap(m->map, m->map_size);
+#endif
+
+    m->map = NULL;
+    m->data = NULL;
+}
+
+/* Writes the converted data to a new file that then replaces the old
+ * one, so that nobody maps a file that is only partially written */
+int pa_scache_converted_save(const char *path, const pa_scache_converted_params *p, const pa_sample_spec *source_ss, const pa_channel_map *source_map, const void *data, size_t length) {
+    static const uint8_t zero[sizeof(void*)];
+    struct converted_header h;
+    size_t l, pad;
+    char *tmp;
+    int fd;
+
+    pa_assert(path);
+    pa_assert(p);
+    pa_assert(source_ss);
+    pa_assert(source_map);
+    pa_assert(data);
+    pa_assert(length > 0);
+
+    l = strlen(p->filename);
+    pad = data_offset(l) - sizeof(h) - l;
+
+    pa_zero(h);
+    memcpy(h.magic, CONVERTED_MAGIC, sizeof(h.magic));
+    h.source_mtime = p->mtime;
+    h.source_size = p->size;
+    h.resample_method = (uint32_t) p->resample_method;
+    h.resample_flags = (uint32_t) p->resample_flags;
+    h.source_sample_spec = *source_ss;
+    h.source_channel_map = *source_map;
+    h.sample_spec = p->sample_spec;
+    h.channel_map = p->channel_map;
+    h.length = length;
+    h.filename_length = (uint32_t) l;
+
+    tmp = pa_sprintf_malloc("%s.tmp-%lu", path, (unsigned long) getpid());
+
+    if ((fd = pa_open_cloexec(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0) {
+        pa_log_warn("Failed to open %s: %s", tmp, pa_cstrerror(errno));
+        pa_xfree(tmp);
+        return -1;
+    }
+
+    if (pa_loop_write(fd, &h, sizeof(h), NULL) != (ssize_t) sizeof(h) ||
+        pa_loop_write(fd, p->filename, l, NULL) != (ssize_t) l ||
+        pa_loop_write(fd, zero, pad, NULL) != (ssize_t) pad ||
+        pa_loop_write(fd, data, length, NULL) != (ssize_t) length) {
+
+        pa_log_warn("Failed to write %s: %s", tmp, pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (pa_close(fd) < 0) {
+        fd = -1;
+        pa_log_warn("Failed to write %s: %s", tmp, pa_cstrerror(errno));
+        goto fail;
+    }
+
+    fd = -1;
+
+    if (rename(tmp, path) < 0) {
+        pa_log_warn("Failed to rename %s: %s", tmp, pa_cstrerror(errno));
+        goto fail;
+    }
+
+    pa_xfree(tmp);
+    return 0;
+
+fail:
+    if (fd >= 0)
+        pa_close(fd);
+
+    unlink(tmp);
+    pa_xfree(tmp);
+    return -1;
+}
+
+void pa_scache_converted_prune(const char *dir, const char *filename) {
+    struct dirent *de;
+    char prefix[18];
+    DIR *d;
+
+    pa_assert(dir);
+    pa_assert(filename);
+
+    if (!(d = opendir(dir)))
+        return;
+
+    pa_snprintf(prefix, sizeof(prefix), "%016llx-", (unsigned long long) filename_hash(filename));
+
+    while ((de = readdir(d))) {
+        char *path;
+
+        if (strncmp(de->d_name, prefix, strlen(prefix)) != 0)
+            continue;
+
+        path = pa_sprintf_malloc("%s" PA_PATH_SEP "%s", dir, de->d_name);
+
+        if (unlink(path) < 0)
+            pa_log_warn("Failed to remove %s: %s", path, pa_cstrerror(errno));
+        else
+            pa_log_debug("Removed sample cache file %s.", path);
+
+        pa_xfree(path);
+    }
+
+    closedir(d);
+}
@@ -0,0 +1,71 @@
+#ifndef fooscacheconvertedhfoo
+#define fooscacheconvertedhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include <pulse/sample.h>
+#include <pulse/channelmap.h>
+
+#include <pulsecore/resampler.h>
+
+/* The files in the sample cache directory that hold copies of sample
+ * files converted to the sample spec of a sink, see core-scache.c */
+
+/* What a converted file has to match to be used */
+typedef struct pa_scache_converted_params {
+    const char *filename;
+    uint64_t mtime;
+    uint64_t size;
+    pa_resample_method_t resample_method;
+    pa_resample_flags_t resample_flags;
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+} pa_scache_converted_params;
+
+/* A converted file that is mapped into memory */
+typedef struct pa_scache_converted_map {
+    void *map;
+    size_t map_size;
+
+    const void *data;
+    size_t length;
+
+    pa_sample_spec source_sample_spec;
+    pa_channel_map source_channel_map;
+} pa_scache_converted_map;
+
+/* All files for the same sample file share a prefix, so that they can
+ * be pruned together */
+char *pa_scache_converted_path(const char *dir, const pa_scache_converted_params *p);
+
+int pa_scache_converted_save(const char *path, const pa_scache_converted_params *p, const pa_sample_spec *source_ss, const pa_channel_map *source_map, const void *data, size_t length);
+
+/* Fails if the file doesn't match the parameters anymore, in which
+ * case it is removed */
+int pa_scache_converted_load(const char *path, const pa_scache_converted_params *p, pa_scache_converted_map *m);
+void pa_scache_converted_unmap(pa_scache_converted_map *m);
+
+/* Removes the files of all sink specs for a sample file */
+void pa_scache_converted_prune(const char *dir, const char *filename);
+
+#endif
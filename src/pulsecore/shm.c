@@ -39,6 +39,10 @@
 #include <sys/mman.h>
 #endif
 
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
 /* This is deprecated on glibc but is still used by FreeBSD */
 #if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
 # define MAP_ANONYMOUS MAP_ANON
@@ -95,83 +99,115 @@ struct shm_marker {
 
 #define SHM_MARKER_SIZE PA_ALIGN(sizeof(struct shm_marker))
 
-#ifdef HAVE_SHM_OPEN
+#if defined(HAVE_SHM_OPEN) || defined(HAVE_MEMFD)
 static char *segment_name(char *fn, size_t l, unsigned id) {
     pa_snprintf(fn, l, "/pulse-shm-%u", id);
     return fn;
 }
 #endif
 
-int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
-#ifdef HAVE_SHM_OPEN
-    char fn[32];
-    int fd = -1;
+#if defined(HAVE_MEMFD) && !defined(HAVE_MEMFD_CREATE)
+/* Older C libraries don't wrap the system call yet */
+static int memfd_create(const char *name, unsigned int flags) {
+    return (int) syscall(SYS_memfd_create, name, flags);
+}
 #endif
 
+#if defined(HAVE_MEMFD) && !defined(MFD_CLOEXEC)
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+static int privatemem_create(pa_shm *m, size_t size) {
     pa_assert(m);
     pa_assert(size > 0);
-    pa_assert(size <= MAX_SHM_SIZE);
-    pa_assert(!(mode & ~0777));
-    pa_assert(mode >= 0600);
-
-    /* Each time we create a new SHM area, let's first drop all stale
-     * ones */
-    pa_shm_cleanup();
 
-    /* Round up to make it page aligned */
-    size = PA_PAGE_ALIGN(size);
-
-    if (!shared) {
-        m->id = 0;
-        m->size = size;
+    m->type = PA_MEM_TYPE_PRIVATE;
+    m->id = 0;
+    m->size = size;
+    m->fd = -1;
+    m->do_unlink = FALSE;
 
 #ifdef MAP_ANONYMOUS
-        if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, (off_t) 0)) == MAP_FAILED) {
-            pa_log("mmap() failed: %s", pa_cstrerror(errno));
-            goto fail;
-        }
+    if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, (off_t) 0)) == MAP_FAILED) {
+        pa_log("mmap() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
 #elif defined(HAVE_POSIX_MEMALIGN)
-        {
-            int r;
+    {
+        int r;
 
-            if ((r = posix_memalign(&m->ptr, PA_PAGE_SIZE, size)) < 0) {
-                pa_log("posix_memalign() failed: %s", pa_cstrerror(r));
-                goto fail;
-            }
+        if ((r = posix_memalign(&m->ptr, PA_PAGE_SIZE, size)) < 0) {
+            pa_log("posix_memalign() failed: %s", pa_cstrerror(r));
+            return -1;
         }
+    }
 #else
-        m->ptr = pa_xmalloc(m->size);
+    m->ptr = pa_xmalloc(m->size);
 #endif
 
-        m->do_unlink = FALSE;
+    return 0;
+}
 
-    } else {
+static int sharedmem_create(pa_shm *m, pa_mem_type_t type, size_t size, mode_t mode) {
+#if defined(HAVE_SHM_OPEN) || defined(HAVE_MEMFD)
+    char fn[32];
+    int fd = -1;
+
+    pa_random(&m->id, sizeof(m->id));
+    segment_name(fn, sizeof(fn), m->id);
+
+    switch (type) {
 #ifdef HAVE_SHM_OPEN
-        struct shm_marker *marker;
+        case PA_MEM_TYPE_SHARED_POSIX:
+            /* Each time we create a new SHM area, let's first drop
+             * all stale ones */
+            pa_shm_cleanup();
 
-        pa_random(&m->id, sizeof(m->id));
-        segment_name(fn, sizeof(fn), m->id);
+            if ((fd = shm_open(fn, O_RDWR|O_CREAT|O_EXCL, mode)) < 0) {
+                pa_log("shm_open() failed: %s", pa_cstrerror(errno));
+                goto fail;
+            }
 
-        if ((fd = shm_open(fn, O_RDWR|O_CREAT|O_EXCL, mode)) < 0) {
-            pa_log("shm_open() failed: %s", pa_cstrerror(errno));
-            goto fail;
-        }
+            /* Room for the marker at the end */
+            m->size = size + SHM_MARKER_SIZE;
+            break;
+#endif
+
+#ifdef HAVE_MEMFD
+        case PA_MEM_TYPE_SHARED_MEMFD:
+            /* The name is only for debugging, memfds live in no
+             * namespace and go away with the last reference */
+            if ((fd = memfd_create(fn, MFD_CLOEXEC)) < 0) {
+                pa_log("memfd_create() failed: %s", pa_cstrerror(errno));
+                goto fail;
+            }
 
-        m->size = size + SHM_MARKER_SIZE;
+            m->size = size;
+            break;
+#endif
 
-        if (ftruncate(fd, (off_t) m->size) < 0) {
-            pa_log("ftruncate() failed: %s", pa_cstrerror(errno));
+        default:
             goto fail;
-        }
+    }
+
+    m->type = type;
+
+    if (ftruncate(fd, (off_t) m->size) < 0) {
+        pa_log("ftruncate() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
 
 #ifndef MAP_NORESERVE
 #define MAP_NORESERVE 0
 #endif
 
-        if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_NORESERVE, fd, (off_t) 0)) == MAP_FAILED) {
-            pa_log("mmap() failed: %s", pa_cstrerror(errno));
-            goto fail;
-        }
+    if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_NORESERVE, fd, (off_t) 0)) == MAP_FAILED) {
+        pa_log("mmap() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (type == PA_MEM_TYPE_SHARED_POSIX) {
+        struct shm_marker *marker;
 
         /* We store our PID at the end of the shm block, so that we
          * can check for dead shm segments later */
@@ -180,21 +216,23 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
         pa_atomic_store(&marker->marker, SHM_MARKER);
 
         pa_assert_se(pa_close(fd) == 0);
+        m->fd = -1;
         m->do_unlink = TRUE;
-#else
-        goto fail;
-#endif
+    } else {
+        /* A memfd can only be shared by passing the fd around, so we
+         * keep it for the lifetime of the segment */
+        m->fd = fd;
+        m->do_unlink = FALSE;
     }
 
-    m->shared = shared;
-
     return 0;
 
 fail:
-
-#ifdef HAVE_SHM_OPEN
     if (fd >= 0) {
-        shm_unlink(fn);
+#ifdef HAVE_SHM_OPEN
+        if (type == PA_MEM_TYPE_SHARED_POSIX)
+            shm_unlink(fn);
+#endif
         pa_close(fd);
     }
 #endif
@@ -202,6 +240,22 @@ fail:
     return -1;
 }
 
+int pa_shm_create_rw(pa_shm *m, pa_mem_type_t type, size_t size, mode_t mode) {
+    pa_assert(m);
+    pa_assert(size > 0);
+    pa_assert(size <= MAX_SHM_SIZE);
+    pa_assert(!(mode & ~0777));
+    pa_assert(mode >= 0600);
+
+    /* Round up to make it page aligned */
+    size = PA_PAGE_ALIGN(size);
+
+    if (type == PA_MEM_TYPE_PRIVATE)
+        return privatemem_create(m, size);
+
+    return sharedmem_create(m, type, size, mode);
+}
+
 void pa_shm_free(pa_shm *m) {
     pa_assert(m);
     pa_assert(m->ptr);
@@ -211,7 +265,7 @@ void pa_shm_free(pa_shm *m) {
     pa_assert(m->ptr != MAP_FAILED);
 #endif
 
-    if (!m->shared) {
+    if (m->type == PA_MEM_TYPE_PRIVATE) {
 #ifdef MAP_ANONYMOUS
         if (munmap(m->ptr, m->size) < 0)
             pa_log("munmap() failed: %s", pa_cstrerror(errno));
@@ -221,11 +275,12 @@ void pa_shm_free(pa_shm *m) {
         pa_xfree(m->ptr);
 #endif
     } else {
-#ifdef HAVE_SHM_OPEN
+#if defined(HAVE_SHM_OPEN) || defined(HAVE_MEMFD)
         if (munmap(m->ptr, PA_PAGE_ALIGN(m->size)) < 0)
             pa_log("munmap() failed: %s", pa_cstrerror(errno));
 
-        if (m->do_unlink) {
+#ifdef HAVE_SHM_OPEN
+        if (m->type == PA_MEM_TYPE_SHARED_POSIX && m->do_unlink) {
             char fn[32];
 
             segment_name(fn, sizeof(fn), m->id);
@@ -233,6 +288,10 @@ void pa_shm_free(pa_shm *m) {
             if (shm_unlink(fn) < 0)
                 pa_log(" shm_unlink(%s) failed: %s", fn, pa_cstrerror(errno));
         }
+#endif
+
+        if (m->fd >= 0)
+            pa_assert_se(pa_close(m->fd) == 0);
 #else
         /* We shouldn't be here without shm support */
         pa_assert_not_reached();
@@ -288,21 +347,42 @@ void pa_shm_punch(pa_shm *m, size_t offset, size_t size) {
 #endif
 }
 
-#ifdef HAVE_SHM_OPEN
+#if defined(HAVE_SHM_OPEN) || defined(HAVE_MEMFD)
 
-int pa_shm_attach_ro(pa_shm *m, unsigned id) {
-    char fn[32];
+int pa_shm_attach(pa_shm *m, pa_mem_type_t type, unsigned id, int memfd_fd, pa_bool_t writable) {
     int fd = -1;
     struct stat st;
 
     pa_assert(m);
+    pa_assert(pa_mem_type_is_shared(type));
 
-    segment_name(fn, sizeof(fn), m->id = id);
+    switch (type) {
+#ifdef HAVE_SHM_OPEN
+        case PA_MEM_TYPE_SHARED_POSIX: {
+            char fn[32];
 
-    if ((fd = shm_open(fn, O_RDONLY, 0)) < 0) {
-        if (errno != EACCES && errno != ENOENT)
-            pa_log("shm_open() failed: %s", pa_cstrerror(errno));
-        goto fail;
+            pa_assert(memfd_fd < 0);
+
+            segment_name(fn, sizeof(fn), id);
+
+            if ((fd = shm_open(fn, writable ? O_RDWR : O_RDONLY, 0)) < 0) {
+                if (errno != EACCES && errno != ENOENT)
+                    pa_log("shm_open() failed: %s", pa_cstrerror(errno));
+                goto fail;
+            }
+            break;
+        }
+#endif
+
+#ifdef HAVE_MEMFD
+        case PA_MEM_TYPE_SHARED_MEMFD:
+            pa_assert(memfd_fd >= 0);
+            fd = memfd_fd;
+            break;
+#endif
+
+        default:
+            goto fail;
     }
 
     if (fstat(fd, &st) < 0) {
@@ -317,34 +397,37 @@ int pa_shm_attach_ro(pa_shm *m, unsigned id) {
         goto fail;
     }
 
+    m->type = type;
+    m->id = id;
     m->size = (size_t) st.st_size;
+    m->fd = -1;
 
-    if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), PROT_READ, MAP_SHARED, fd, (off_t) 0)) == MAP_FAILED) {
+    if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), writable ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED, fd, (off_t) 0)) == MAP_FAILED) {
         pa_log("mmap() failed: %s", pa_cstrerror(errno));
         goto fail;
     }
 
     m->do_unlink = FALSE;
-    m->shared = TRUE;
 
-    pa_assert_se(pa_close(fd) == 0);
+    if (fd != memfd_fd)
+        pa_assert_se(pa_close(fd) == 0);
 
     return 0;
 
 fail:
-    if (fd >= 0)
+    if (fd >= 0 && fd != memfd_fd)
         pa_close(fd);
 
     return -1;
 }
 
-#else /* HAVE_SHM_OPEN */
+#else /* HAVE_SHM_OPEN || HAVE_MEMFD */
 
-int pa_shm_attach_ro(pa_shm *m, unsigned id) {
+int pa_shm_attach(pa_shm *m, pa_mem_type_t type, unsigned id, int memfd_fd, pa_bool_t writable) {
     return -1;
 }
 
-#endif /* HAVE_SHM_OPEN */
+#endif /* HAVE_SHM_OPEN || HAVE_MEMFD */
 
 int pa_shm_cleanup(void) {
 
@@ -375,7 +458,7 @@ int pa_shm_cleanup(void) {
         if (pa_atou(de->d_name + SHM_ID_LEN, &id) < 0)
             continue;
 
-        if (pa_shm_attach_ro(&seg, id) < 0)
+        if (pa_shm_attach(&seg, PA_MEM_TYPE_SHARED_POSIX, id, -1, FALSE) < 0)
             continue;
 
         if (seg.size < SHM_MARKER_SIZE) {
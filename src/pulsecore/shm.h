@@ -25,17 +25,28 @@
 #include <sys/types.h>
 
 #include <pulsecore/macro.h>
+#include <pulsecore/mem.h>
 
 typedef struct pa_shm {
+    pa_mem_type_t type;
     unsigned id;
     void *ptr;
     size_t size;
+
+    /* For PA_MEM_TYPE_SHARED_MEMFD segments we created: the memfd,
+     * kept open so that it can be passed to other processes. -1
+     * otherwise. */
+    int fd;
+
     pa_bool_t do_unlink:1;
-    pa_bool_t shared:1;
 } pa_shm;
 
-int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode);
-int pa_shm_attach_ro(pa_shm *m, unsigned id);
+int pa_shm_create_rw(pa_shm *m, pa_mem_type_t type, size_t size, mode_t mode);
+
+/* Attach to a segment created by another process. POSIX segments are
+ * looked up by id; memfd segments are mapped from memfd_fd, which the
+ * caller keeps ownership of. The id is only recorded for those. */
+int pa_shm_attach(pa_shm *m, pa_mem_type_t type, unsigned id, int memfd_fd, pa_bool_t writable);
 
 void pa_shm_punch(pa_shm *m, size_t offset, size_t size);
 
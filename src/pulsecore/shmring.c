@@ -0,0 +1,225 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/ringbuffer.h>
+#include <pulsecore/shm.h>
+
+#include "shmring.h"
+
+/* The header at the start of the shared memory segment */
+struct shmring_header {
+    pa_atomic_t count;
+    int capacity;
+    int offset;
+};
+
+struct pa_shmring {
+    pa_shm shm;
+    pa_ringbuffer rb;
+};
+
+pa_shmring* pa_shmring_new(pa_mem_type_t type, size_t capacity, size_t align) {
+    pa_shmring *r;
+    struct shmring_header *h;
+
+    pa_assert(pa_mem_type_is_shared(type));
+    pa_assert(align > 0);
+
+    capacity = PA_MIN(capacity, (size_t) INT_MAX - PA_ALIGN(sizeof(*h)));
+    capacity = (capacity / align) * align;
+
+    if (capacity <= 0)
+        return NULL;
+
+    r = pa_xnew0(pa_shmring, 1);
+
+    if (pa_shm_create_rw(&r->shm, type, PA_ALIGN(sizeof(*h)) + capacity, 0700) < 0) {
+        pa_xfree(r);
+        return NULL;
+    }
+
+    h = r->shm.ptr;
+    memset(h, 0, sizeof(*h));
+    h->capacity = (int) capacity;
+    h->offset = (int) PA_ALIGN(sizeof(*h));
+
+    /* Don't rely on the header from now on, the peer can write to it */
+    r->rb.capacity = (int) capacity;
+    r->rb.count = &h->count;
+    r->rb.memory = (uint8_t*) h + PA_ALIGN(sizeof(*h));
+
+    return r;
+}
+
+pa_shmring* pa_shmring_attach(pa_mem_type_t type, unsigned shm_id, int memfd) {
+    pa_shmring *r;
+    struct shmring_header *h;
+    int capacity, offset;
+
+    pa_assert(pa_mem_type_is_shared(type));
+
+    r = pa_xnew0(pa_shmring, 1);
+
+    if (pa_shm_attach(&r->shm, type, shm_id, memfd, TRUE) < 0) {
+        pa_xfree(r);
+        return NULL;
+    }
+
+    h = r->shm.ptr;
+
+    if (r->shm.size < sizeof(*h)) {
+        pa_log_warn("Ring segment too small.");
+        goto fail;
+    }
+
+    capacity = h->capacity;
+    offset = h->offset;
+
+    if (capacity <= 0 ||
+        offset < (int) sizeof(*h) ||
+        (size_t) offset + (size_t) capacity > r->shm.size) {
+        pa_log_warn("Invalid ring segment layout.");
+        goto fail;
+    }
+
+    r->rb.capacity = capacity;
+    r->rb.count = &h->count;
+    r->rb.memory = (uint8_t*) h + offset;
+
+    return r;
+
+fail:
+    pa_shmring_free(r);
+    return NULL;
+}
+
+void pa_shmring_free(pa_shmring *r) {
+    pa_assert(r);
+
+    if (r->shm.ptr)
+        pa_shm_free(&r->shm);
+
+    pa_xfree(r);
+}
+
+unsigned pa_shmring_get_shm_id(pa_shmring *r) {
+    pa_assert(r);
+
+    return r->shm.id;
+}
+
+int pa_shmring_get_memfd(pa_shmring *r) {
+    pa_assert(r);
+
+    return r->shm.fd;
+}
+
+size_t pa_shmring_get_capacity(pa_shmring *r) {
+    pa_assert(r);
+
+    return (size_t) r->rb.capacity;
+}
+
+size_t pa_shmring_writable(pa_shmring *r) {
+    int c;
+
+    pa_assert(r);
+
+    c = pa_atomic_load(r->rb.count);
+
+    return (size_t) (r->rb.capacity - PA_CLAMP(c, 0, r->rb.capacity));
+}
+
+size_t pa_shmring_write(pa_shmring *r, const void *data, size_t l) {
+    size_t written = 0;
+
+    pa_assert(r);
+    pa_assert(data || l == 0);
+
+    while (l > 0) {
+        int towrite;
+        void *ptr = pa_ringbuffer_begin_write(&r->rb, &towrite);
+
+        if ((size_t) towrite > l)
+            towrite = (int) l;
+
+        if (towrite == 0)
+            break;
+
+        memcpy(ptr, data, (size_t) towrite);
+        pa_ringbuffer_end_write(&r->rb, towrite);
+
+        written += (size_t) towrite;
+        data = (const uint8_t*) data + towrite;
+        l -= (size_t) towrite;
+    }
+
+    return written;
+}
+
+size_t pa_shmring_readable(pa_shmring *r) {
+    int c;
+
+    pa_assert(r);
+
+    c = pa_atomic_load(r->rb.count);
+
+    return (size_t) PA_CLAMP(c, 0, r->rb.capacity);
+}
+
+const void* pa_shmring_peek(pa_shmring *r, size_t *l) {
+    int count;
+    void *ptr;
+
+    pa_assert(r);
+    pa_assert(l);
+
+    ptr = pa_ringbuffer_peek(&r->rb, &count);
+
+    if ((size_t) count < *l)
+        *l = (size_t) count;
+
+    return ptr;
+}
+
+void pa_shmring_drop(pa_shmring *r, size_t l) {
+    pa_assert(r);
+
+    /* Never more than there is, which may wrap around the end of the
+     * ring: pa_ringbuffer_drop() only goes up to there */
+    l = PA_MIN(l, pa_shmring_readable(r));
+
+    while (l > 0) {
+        size_t n = PA_MIN(l, (size_t) (r->rb.capacity - r->rb.readindex));
+
+        pa_ringbuffer_drop(&r->rb, (int) n);
+        l -= n;
+    }
+}
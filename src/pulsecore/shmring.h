@@ -0,0 +1,69 @@
+#ifndef foopulseshmringhfoo
+#define foopulseshmringhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <sys/types.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/mem.h>
+
+/* A one-way lock-free byte ring buffer in a shared memory segment of
+ * its own, for one writer and one reader in different processes or
+ * threads. Unlike a pa_srbchannel there are no wakeups: the reader is
+ * expected to look at the ring whenever it needs data anyway, like a
+ * sink input does when the sink renders. Neither side trusts what the
+ * other one writes to the segment. */
+
+typedef struct pa_shmring pa_shmring;
+
+/* Creates a ring of at most the given capacity in bytes. The capacity
+ * is rounded down to a multiple of align. */
+pa_shmring* pa_shmring_new(pa_mem_type_t type, size_t capacity, size_t align);
+
+/* Opens the ring the peer created. For memfd segments, memfd is the
+ * file descriptor of the segment, which the caller keeps ownership
+ * of. */
+pa_shmring* pa_shmring_attach(pa_mem_type_t type, unsigned shm_id, int memfd);
+
+void pa_shmring_free(pa_shmring *r);
+
+/* What the peer needs to attach to the ring. The memfd is -1 for POSIX
+ * segments, and stays owned by the ring. */
+unsigned pa_shmring_get_shm_id(pa_shmring *r);
+int pa_shmring_get_memfd(pa_shmring *r);
+
+size_t pa_shmring_get_capacity(pa_shmring *r);
+
+/* For the writer: how many bytes fit, and writing them. Returns the
+ * number of bytes actually written, which is less than l if the ring
+ * is full. */
+size_t pa_shmring_writable(pa_shmring *r);
+size_t pa_shmring_write(pa_shmring *r, const void *data, size_t l);
+
+/* For the reader: how many bytes can be read, where as many as
+ * possible can be read without wrapping around (at most l of them),
+ * and marking them as read. Dropping may wrap around, and never drops
+ * more than can be read. */
+size_t pa_shmring_readable(pa_shmring *r);
+const void* pa_shmring_peek(pa_shmring *r, size_t *l);
+void pa_shmring_drop(pa_shmring *r, size_t l);
+
+#endif
@@ -343,6 +343,8 @@ pa_sink* pa_sink_new(
     PA_LLIST_HEAD_INIT(pa_sink_volume_change, s->thread_info.volume_changes);
     s->thread_info.volume_changes_tail = NULL;
     pa_sw_cvolume_multiply(&s->thread_info.current_hw_volume, &s->soft_volume, &s->real_volume);
+    s->thread_info.mix_info = NULL;
+    s->thread_info.n_mix_info = 0;
     s->thread_info.volume_change_safety_margin = core->deferred_volume_safety_margin_usec;
     s->thread_info.volume_change_extra_delay = core->deferred_volume_extra_delay_usec;
     s->thread_info.latency_offset = s->latency_offset;
@@ -732,6 +734,7 @@ static void sink_free(pa_object *o) {
 
     pa_idxset_free(s->inputs, NULL);
     pa_hashmap_free(s->thread_info.inputs, (pa_free_cb_t) pa_sink_input_unref);
+    pa_xfree(s->thread_info.mix_info);
 
     if (s->silence.memblock)
         pa_memblock_unref(s->silence.memblock);
@@ -998,6 +1001,32 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     }
 }
 
+/* Called from IO thread context */
+static pa_mix_info *get_mix_info(pa_sink *s, pa_mix_info *stack_info, unsigned *maxinfo) {
+    unsigned n;
+
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    n = pa_hashmap_size(s->thread_info.inputs);
+
+    if (n <= MAX_MIX_CHANNELS) {
+        *maxinfo = MAX_MIX_CHANNELS;
+        return stack_info;
+    }
+
+    if (n > s->thread_info.n_mix_info) {
+        /* Leave some headroom so that a growing number of inputs does not
+         * reallocate on every new stream */
+        s->thread_info.n_mix_info = PA_MAX(n, s->thread_info.n_mix_info * 2);
+        pa_xfree(s->thread_info.mix_info);
+        s->thread_info.mix_info = pa_xnew(pa_mix_info, s->thread_info.n_mix_info);
+    }
+
+    *maxinfo = s->thread_info.n_mix_info;
+    return s->thread_info.mix_info;
+}
+
 /* Called from IO thread context */
 static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, unsigned maxinfo) {
     pa_sink_input *i;
@@ -1137,8 +1166,8 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
 
 /* Called from IO thread context */
 void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
-    pa_mix_info info[MAX_MIX_CHANNELS];
-    unsigned n;
+    pa_mix_info stack_info[MAX_MIX_CHANNELS], *info;
+    unsigned n, maxinfo;
     size_t block_size_max;
 
     pa_sink_assert_ref(s);
@@ -1168,7 +1197,8 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
     pa_assert(length > 0);
 
-    n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
+    info = get_mix_info(s, stack_info, &maxinfo);
+    n = fill_mix_info(s, &length, info, maxinfo);
 
     if (n == 0) {
 
@@ -1222,8 +1252,8 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
 /* Called from IO thread context */
 void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
-    pa_mix_info info[MAX_MIX_CHANNELS];
-    unsigned n;
+    pa_mix_info stack_info[MAX_MIX_CHANNELS], *info;
+    unsigned n, maxinfo;
     size_t length, block_size_max;
 
     pa_sink_assert_ref(s);
@@ -1251,7 +1281,8 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
     pa_assert(length > 0);
 
-    n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
+    info = get_mix_info(s, stack_info, &maxinfo);
+    n = fill_mix_info(s, &length, info, maxinfo);
 
     if (n == 0) {
         if (target->length > length)
@@ -0,0 +1,343 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/fdsem.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/ringbuffer.h>
+#include <pulsecore/shm.h>
+
+#include "srbchannel.h"
+
+/* Size of the shared memory segment, including the header */
+#define SRBCHANNEL_SIZE (64*1024)
+
+/* The header at the start of the shared memory segment. "read" and
+ * "write" are as seen from the side that created the channel. */
+struct srbheader {
+    pa_atomic_t read_count;
+    pa_atomic_t write_count;
+
+    pa_fdsem_data read_semdata;
+    pa_fdsem_data write_semdata;
+
+    int capacity;
+    int readbuf_offset;
+    int writebuf_offset;
+};
+
+struct pa_srbchannel {
+    pa_shm shm;
+
+    pa_ringbuffer rb_read, rb_write;
+    pa_fdsem *sem_read, *sem_write;
+
+    pa_mainloop_api *mainloop;
+    pa_io_event *read_event;
+    pa_defer_event *defer_event;
+    pa_bool_t waiting;
+
+    pa_srbchannel_cb_t callback;
+    void *cb_userdata;
+};
+
+size_t pa_srbchannel_write(pa_srbchannel *sr, const void *data, size_t l) {
+    size_t written = 0;
+
+    pa_assert(sr);
+    pa_assert(data || l == 0);
+
+    while (l > 0) {
+        int towrite;
+        void *ptr = pa_ringbuffer_begin_write(&sr->rb_write, &towrite);
+
+        if ((size_t) towrite > l)
+            towrite = (int) l;
+
+        if (towrite == 0)
+            break;
+
+        memcpy(ptr, data, (size_t) towrite);
+        pa_ringbuffer_end_write(&sr->rb_write, towrite);
+
+        written += (size_t) towrite;
+        data = (const uint8_t*) data + towrite;
+        l -= (size_t) towrite;
+    }
+
+    if (written > 0)
+        pa_fdsem_post(sr->sem_write);
+
+    return written;
+}
+
+size_t pa_srbchannel_read(pa_srbchannel *sr, void *data, size_t l) {
+    size_t isread = 0;
+    pa_bool_t was_full = FALSE;
+
+    pa_assert(sr);
+    pa_assert(data || l == 0);
+
+    while (l > 0) {
+        int toread;
+        void *ptr = pa_ringbuffer_peek(&sr->rb_read, &toread);
+
+        if ((size_t) toread > l)
+            toread = (int) l;
+
+        if (toread == 0)
+            break;
+
+        memcpy(data, ptr, (size_t) toread);
+        if (pa_ringbuffer_drop(&sr->rb_read, toread))
+            was_full = TRUE;
+
+        isread += (size_t) toread;
+        data = (uint8_t*) data + toread;
+        l -= (size_t) toread;
+    }
+
+    /* The writer stops when the buffer is full, so it needs a wakeup
+     * once there is room again */
+    if (was_full)
+        pa_fdsem_post(sr->sem_write);
+
+    return isread;
+}
+
+static void dispatch(pa_srbchannel *sr) {
+    pa_assert(sr);
+
+    if (sr->waiting) {
+        pa_fdsem_after_poll(sr->sem_read);
+        sr->waiting = FALSE;
+    }
+
+    do {
+        /* The callback may free the channel */
+        if (sr->callback && !sr->callback(sr, sr->cb_userdata))
+            return;
+
+    } while (pa_fdsem_before_poll(sr->sem_read) < 0);
+
+    sr->waiting = TRUE;
+}
+
+static void semread_cb(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_srbchannel *sr = userdata;
+
+    pa_assert(sr);
+    pa_assert(sr->read_event == e);
+
+    dispatch(sr);
+}
+
+static void defer_cb(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    pa_srbchannel *sr = userdata;
+
+    pa_assert(sr);
+    pa_assert(sr->defer_event == e);
+
+    m->defer_enable(e, 0);
+    dispatch(sr);
+}
+
+pa_srbchannel* pa_srbchannel_new(pa_mainloop_api *m, pa_mem_type_t type) {
+    pa_srbchannel *sr;
+    struct srbheader *srh;
+    int capacity, readfd, writefd;
+
+    pa_assert(m);
+    pa_assert(pa_mem_type_is_shared(type));
+
+    sr = pa_xnew0(pa_srbchannel, 1);
+    sr->mainloop = m;
+
+    if (pa_shm_create_rw(&sr->shm, type, SRBCHANNEL_SIZE, 0700) < 0) {
+        pa_xfree(sr);
+        return NULL;
+    }
+
+    srh = sr->shm.ptr;
+    memset(srh, 0, sizeof(*srh));
+
+    capacity = (int) (((SRBCHANNEL_SIZE - PA_ALIGN(sizeof(*srh))) / 2) & ~(sizeof(void*) - 1));
+
+    srh->capacity = capacity;
+    srh->readbuf_offset = (int) PA_ALIGN(sizeof(*srh));
+    srh->writebuf_offset = srh->readbuf_offset + capacity;
+
+    /* Don't rely on the header from now on, the peer can write to it */
+    sr->rb_read.capacity = capacity;
+    sr->rb_read.count = &srh->read_count;
+    sr->rb_read.memory = (uint8_t*) srh + srh->readbuf_offset;
+    sr->rb_write.capacity = capacity;
+    sr->rb_write.count = &srh->write_count;
+    sr->rb_write.memory = (uint8_t*) srh + srh->writebuf_offset;
+
+    if (!(sr->sem_read = pa_fdsem_new_shm(&srh->read_semdata, &readfd)))
+        goto fail;
+
+    if (!(sr->sem_write = pa_fdsem_new_shm(&srh->write_semdata, &writefd)))
+        goto fail;
+
+    sr->read_event = m->io_new(m, readfd, PA_IO_EVENT_INPUT, semread_cb, sr);
+
+    return sr;
+
+fail:
+    pa_srbchannel_free(sr);
+    return NULL;
+}
+
+pa_srbchannel* pa_srbchannel_new_from_template(pa_mainloop_api *m, pa_srbchannel_template *t) {
+    pa_srbchannel *sr;
+    struct srbheader *srh;
+    int capacity, readbuf_offset, writebuf_offset;
+
+    pa_assert(m);
+    pa_assert(t);
+    pa_assert(t->readfd >= 0);
+    pa_assert(t->writefd >= 0);
+
+    sr = pa_xnew0(pa_srbchannel, 1);
+    sr->mainloop = m;
+
+    if (pa_shm_attach(&sr->shm, t->memfd >= 0 ? PA_MEM_TYPE_SHARED_MEMFD : PA_MEM_TYPE_SHARED_POSIX,
+                      t->shm_id, t->memfd, TRUE) < 0) {
+        pa_xfree(sr);
+        goto fail_fds;
+    }
+
+    /* The mapping keeps the memfd alive */
+    if (t->memfd >= 0) {
+        pa_close(t->memfd);
+        t->memfd = -1;
+    }
+
+    srh = sr->shm.ptr;
+
+    if (sr->shm.size < sizeof(*srh)) {
+        pa_log_warn("Ring buffer segment too small.");
+        goto fail;
+    }
+
+    capacity = srh->capacity;
+    readbuf_offset = srh->readbuf_offset;
+    writebuf_offset = srh->writebuf_offset;
+
+    if (capacity <= 0 ||
+        readbuf_offset < (int) sizeof(*srh) || (size_t) readbuf_offset + (size_t) capacity > sr->shm.size ||
+        writebuf_offset < (int) sizeof(*srh) || (size_t) writebuf_offset + (size_t) capacity > sr->shm.size) {
+        pa_log_warn("Invalid ring buffer segment layout.");
+        goto fail;
+    }
+
+    /* Swap read and write, the template is from the creator's point
+     * of view */
+    sr->rb_read.capacity = capacity;
+    sr->rb_read.count = &srh->write_count;
+    sr->rb_read.memory = (uint8_t*) srh + writebuf_offset;
+    sr->rb_write.capacity = capacity;
+    sr->rb_write.count = &srh->read_count;
+    sr->rb_write.memory = (uint8_t*) srh + readbuf_offset;
+
+    if (!(sr->sem_read = pa_fdsem_open_shm(&srh->write_semdata, t->writefd)))
+        goto fail;
+    t->writefd = -1;
+
+    if (!(sr->sem_write = pa_fdsem_open_shm(&srh->read_semdata, t->readfd)))
+        goto fail;
+    t->readfd = -1;
+
+    sr->read_event = m->io_new(m, pa_fdsem_get(sr->sem_read), PA_IO_EVENT_INPUT, semread_cb, sr);
+
+    return sr;
+
+fail:
+    pa_srbchannel_free(sr);
+
+fail_fds:
+    if (t->readfd >= 0)
+        pa_close(t->readfd);
+    if (t->writefd >= 0)
+        pa_close(t->writefd);
+    if (t->memfd >= 0)
+        pa_close(t->memfd);
+
+    t->readfd = t->writefd = t->memfd = -1;
+
+    return NULL;
+}
+
+void pa_srbchannel_export(pa_srbchannel *sr, pa_srbchannel_template *t) {
+    pa_assert(sr);
+    pa_assert(t);
+
+    t->shm_id = sr->shm.id;
+    t->memfd = sr->shm.fd;
+    t->readfd = pa_fdsem_get(sr->sem_read);
+    t->writefd = pa_fdsem_get(sr->sem_write);
+}
+
+void pa_srbchannel_set_callback(pa_srbchannel *sr, pa_srbchannel_cb_t callback, void *userdata) {
+    pa_assert(sr);
+
+    if (sr->defer_event) {
+        sr->mainloop->defer_free(sr->defer_event);
+        sr->defer_event = NULL;
+    }
+
+    /* Run the callback once right away, the peer might have written
+     * something before we started to listen */
+    if (callback)
+        sr->defer_event = sr->mainloop->defer_new(sr->mainloop, defer_cb, sr);
+
+    sr->callback = callback;
+    sr->cb_userdata = userdata;
+}
+
+void pa_srbchannel_free(pa_srbchannel *sr) {
+    pa_assert(sr);
+
+    if (sr->defer_event)
+        sr->mainloop->defer_free(sr->defer_event);
+    if (sr->read_event)
+        sr->mainloop->io_free(sr->read_event);
+
+    if (sr->sem_read)
+        pa_fdsem_free(sr->sem_read);
+    if (sr->sem_write)
+        pa_fdsem_free(sr->sem_write);
+
+    if (sr->shm.ptr)
+        pa_shm_free(&sr->shm);
+
+    pa_xfree(sr);
+}
@@ -0,0 +1,73 @@
+#ifndef foopulsesrbchannelhfoo
+#define foopulsesrbchannelhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <sys/types.h>
+
+#include <pulse/mainloop-api.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/mem.h>
+
+/* A bidirectional byte channel between two processes, made of two
+ * lock-free ring buffers in a shared memory segment. The peers only
+ * wake each other up (through an fdsem, i.e. an eventfd) if the
+ * other side is actually waiting for data or space, so that busy
+ * channels don't need a system call per message. */
+
+typedef struct pa_srbchannel pa_srbchannel;
+
+/* What the peer needs to open the channel: the ID of the shared
+ * memory segment and the eventfds of the two semaphores, as seen
+ * from the side that created the channel. If the segment is a memfd,
+ * memfd is its file descriptor, otherwise -1. */
+typedef struct pa_srbchannel_template {
+    int readfd, writefd;
+    int memfd;
+    unsigned shm_id;
+} pa_srbchannel_template;
+
+/* Creates a new channel in a segment of the given shared memory
+ * type. Fails if that or eventfd is not available. */
+pa_srbchannel* pa_srbchannel_new(pa_mainloop_api *m, pa_mem_type_t type);
+
+/* Opens the peer side of a channel. Takes over the file descriptors
+ * in the template, also on failure. */
+pa_srbchannel* pa_srbchannel_new_from_template(pa_mainloop_api *m, pa_srbchannel_template *t);
+
+void pa_srbchannel_free(pa_srbchannel *sr);
+
+/* Fills in the template for the peer. The file descriptors stay owned
+ * by the channel. */
+void pa_srbchannel_export(pa_srbchannel *sr, pa_srbchannel_template *t);
+
+/* Both return the number of bytes actually transferred, which is
+ * less than l if the ring buffer was full or empty, respectively. */
+size_t pa_srbchannel_write(pa_srbchannel *sr, const void *data, size_t l);
+size_t pa_srbchannel_read(pa_srbchannel *sr, void *data, size_t l);
+
+/* The callback is called from the main loop whenever the peer has
+ * written data or made room in a full buffer, and is repeated until
+ * it returns without the peer having done anything in the meantime.
+ * It has to return FALSE if it freed the channel. */
+typedef pa_bool_t (*pa_srbchannel_cb_t)(pa_srbchannel *sr, void *userdata);
+void pa_srbchannel_set_callback(pa_srbchannel *sr, pa_srbchannel_cb_t callback, void *userdata);
+
+#endif
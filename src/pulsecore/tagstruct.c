@@ -37,27 +37,61 @@
 
 #include <pulsecore/socket.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/flist.h>
+#include <pulsecore/packet.h>
 
 #include "tagstruct.h"
 
 #define MAX_TAG_SIZE (64*1024)
 
+/* Most packets are small enough to be built in the tagstruct itself */
+#define MAX_APPENDED_SIZE (128)
+
 struct pa_tagstruct {
     uint8_t *data;
     size_t length, allocated;
     size_t rindex;
 
     pa_bool_t dynamic;
+
+    uint8_t *heap;
+    size_t heap_size;
+
+    uint8_t appended[MAX_APPENDED_SIZE];
 };
 
+static void tagstruct_free_cb(void *p) {
+    pa_tagstruct *t = p;
+
+    pa_xfree(t->heap);
+    pa_xfree(t);
+}
+
+PA_STATIC_FLIST_DECLARE(tagstructs, 0, tagstruct_free_cb);
+
 pa_tagstruct *pa_tagstruct_new(const uint8_t* data, size_t length) {
     pa_tagstruct*t;
 
     pa_assert(!data || (data && length));
 
-    t = pa_xnew(pa_tagstruct, 1);
-    t->data = (uint8_t*) data;
-    t->allocated = t->length = data ? length : 0;
+    if (!(t = pa_flist_pop(PA_STATIC_FLIST_GET(tagstructs)))) {
+        t = pa_xnew(pa_tagstruct, 1);
+        t->heap = NULL;
+        t->heap_size = 0;
+    }
+
+    if (data) {
+        t->data = (uint8_t*) data;
+        t->allocated = length;
+    } else if (t->heap) {
+        t->data = t->heap;
+        t->allocated = t->heap_size;
+    } else {
+        t->data = t->appended;
+        t->allocated = sizeof(t->appended);
+    }
+
+    t->length = data ? length : 0;
     t->rindex = 0;
     t->dynamic = !data;
 
@@ -67,9 +101,14 @@ pa_tagstruct *pa_tagstruct_new(const uint8_t* data, size_t length) {
 void pa_tagstruct_free(pa_tagstruct*t) {
     pa_assert(t);
 
-    if (t->dynamic)
-        pa_xfree(t->data);
-    pa_xfree(t);
+    if (t->heap && t->heap_size > PA_MAX_POOLED_SIZE) {
+        pa_xfree(t->heap);
+        t->heap = NULL;
+        t->heap_size = 0;
+    }
+
+    if (pa_flist_push(PA_STATIC_FLIST_GET(tagstructs), t) < 0)
+        tagstruct_free_cb(t);
 }
 
 uint8_t* pa_tagstruct_free_data(pa_tagstruct*t, size_t *l) {
@@ -79,12 +118,38 @@ uint8_t* pa_tagstruct_free_data(pa_tagstruct*t, size_t *l) {
     pa_assert(t->dynamic);
     pa_assert(l);
 
-    p = t->data;
+    if (t->data == t->heap) {
+        p = t->heap;
+        t->heap = NULL;
+        t->heap_size = 0;
+    } else
+        p = pa_xmemdup(t->data, t->length);
+
     *l = t->length;
-    pa_xfree(t);
+    pa_tagstruct_free(t);
     return p;
 }
 
+void pa_tagstruct_reserve(pa_tagstruct *t, size_t length) {
+    pa_assert(t);
+    pa_assert(t->dynamic);
+
+    if (length <= t->allocated)
+        return;
+
+    if (t->data == t->heap)
+        t->heap = pa_xrealloc(t->heap, length);
+    else {
+        /* The old heap buffer was too small anyway */
+        pa_xfree(t->heap);
+        t->heap = pa_xmalloc(length);
+        memcpy(t->heap, t->data, t->length);
+    }
+
+    t->data = t->heap;
+    t->allocated = t->heap_size = length;
+}
+
 static void extend(pa_tagstruct*t, size_t l) {
     pa_assert(t);
     pa_assert(t->dynamic);
@@ -92,7 +157,9 @@ static void extend(pa_tagstruct*t, size_t l) {
     if (t->length+l <= t->allocated)
         return;
 
-    t->data = pa_xrealloc(t->data, t->allocated = t->length+l+100);
+    /* Grow geometrically, info list replies are built from many small
+     * pieces */
+    pa_tagstruct_reserve(t, PA_MAX(t->length+l, t->allocated*2));
 }
 
 void pa_tagstruct_puts(pa_tagstruct*t, const char *s) {
@@ -66,6 +66,10 @@ pa_tagstruct *pa_tagstruct_new(const uint8_t* data, size_t length);
 void pa_tagstruct_free(pa_tagstruct*t);
 uint8_t* pa_tagstruct_free_data(pa_tagstruct*t, size_t *l);
 
+/* Make room for length bytes in total up front, for callers that know
+ * roughly how big the tagstruct is going to be */
+void pa_tagstruct_reserve(pa_tagstruct *t, size_t length);
+
 int pa_tagstruct_eof(pa_tagstruct*t);
 const uint8_t* pa_tagstruct_data(pa_tagstruct*t, size_t *l);
 
@@ -0,0 +1,348 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/refcnt.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/shared.h>
+#include <pulsecore/thread.h>
+
+#include "worker-pool.h"
+
+/* More threads than this won't help, there are only so many filters
+ * on one master sink */
+#define N_THREADS_MAX 8
+
+typedef enum job_state {
+    JOB_IDLE,
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE
+} job_state_t;
+
+struct worker {
+    pa_worker_pool *pool;
+    pa_thread *thread;
+    unsigned cpu;
+};
+
+struct pa_worker_pool {
+    PA_REFCNT_DECLARE;
+
+    pa_core *core;
+
+    /* Protects the queue, the job states and quit */
+    pa_mutex *mutex;
+    pa_cond *cond;
+
+    PA_LLIST_HEAD(pa_worker_job, queue);
+    pa_worker_job *queue_tail;
+    pa_bool_t quit;
+
+    int rtprio;
+
+    unsigned n_threads;
+    struct worker *workers;
+};
+
+struct pa_worker_job {
+    pa_worker_pool *pool;
+
+    pa_worker_job_cb_t cb;
+    void *userdata;
+
+    /* Protected by the pool mutex */
+    job_state_t state;
+    pa_bool_t waiting;
+    PA_LLIST_FIELDS(pa_worker_job);
+
+    /* Posted by the worker when it finishes a job somebody is
+     * waiting for */
+    pa_semaphore *semaphore;
+
+    /* Only accessed by the thread that submits the job */
+    pa_bool_t pending;
+};
+
+static void queue_append(pa_worker_pool *p, pa_worker_job *j) {
+    if (p->queue_tail)
+        PA_LLIST_INSERT_AFTER(pa_worker_job, p->queue, p->queue_tail, j);
+    else
+        PA_LLIST_PREPEND(pa_worker_job, p->queue, j);
+
+    p->queue_tail = j;
+}
+
+static void queue_remove(pa_worker_pool *p, pa_worker_job *j) {
+    if (p->queue_tail == j)
+        p->queue_tail = j->prev;
+
+    PA_LLIST_REMOVE(pa_worker_job, p->queue, j);
+}
+
+static void thread_func(void *userdata) {
+    struct worker *w = userdata;
+    pa_worker_pool *p = w->pool;
+
+    if (p->rtprio > 0)
+        pa_make_realtime(p->rtprio);
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+{
+    cpu_set_t mask;
+
+    CPU_ZERO(&mask);
+    CPU_SET((size_t) w->cpu, &mask);
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) != 0)
+        pa_log_debug("Failed to pin worker thread to CPU %u.", w->cpu);
+}
+#endif
+
+    pa_mutex_lock(p->mutex);
+
+    for (;;) {
+        pa_worker_job *j;
+
+        while (!p->queue && !p->quit)
+            pa_cond_wait(p->cond, p->mutex);
+
+        if (p->quit)
+            break;
+
+        j = p->queue;
+        queue_remove(p, j);
+        j->state = JOB_RUNNING;
+
+        pa_mutex_unlock(p->mutex);
+        j->cb(j->userdata);
+        pa_mutex_lock(p->mutex);
+
+        j->state = JOB_DONE;
+
+        if (j->waiting)
+            pa_semaphore_post(j->semaphore);
+    }
+
+    pa_mutex_unlock(p->mutex);
+}
+
+pa_worker_pool *pa_worker_pool_new(unsigned n_threads, int rtprio) {
+    pa_worker_pool *p;
+    unsigned i, ncpus;
+
+    pa_assert(n_threads > 0);
+
+    p = pa_xnew0(pa_worker_pool, 1);
+    PA_REFCNT_INIT(p);
+
+    p->mutex = pa_mutex_new(FALSE, TRUE);
+    p->cond = pa_cond_new();
+    PA_LLIST_HEAD_INIT(pa_worker_job, p->queue);
+    p->rtprio = rtprio;
+
+    p->n_threads = PA_MIN(n_threads, N_THREADS_MAX);
+    p->workers = pa_xnew0(struct worker, p->n_threads);
+
+    /* Keep CPU 0 free for everything else if we can */
+    ncpus = PA_MAX(pa_ncpus(), 1U);
+
+    for (i = 0; i < p->n_threads; i++) {
+        char name[16];
+
+        p->workers[i].pool = p;
+        p->workers[i].cpu = ncpus > 1 ? 1 + i % (ncpus - 1) : 0;
+
+        pa_snprintf(name, sizeof(name), "worker%u", i);
+        pa_assert_se(p->workers[i].thread = pa_thread_new(name, thread_func, &p->workers[i]));
+    }
+
+    pa_log_debug("Started %u worker threads.", p->n_threads);
+
+    return p;
+}
+
+pa_worker_pool *pa_worker_pool_get(pa_core *c) {
+    pa_worker_pool *p;
+    unsigned ncpus;
+
+    pa_assert(c);
+
+    if ((p = pa_shared_get(c, "worker-pool")))
+        return pa_worker_pool_ref(p);
+
+    /* One CPU is taken by the master sink's IO thread */
+    ncpus = PA_MAX(pa_ncpus(), 1U);
+    p = pa_worker_pool_new(ncpus > 1 ? ncpus - 1 : 1, c->realtime_scheduling ? c->realtime_priority : 0);
+
+    p->core = c;
+    pa_assert_se(pa_shared_set(c, "worker-pool", p) >= 0);
+
+    return p;
+}
+
+pa_worker_pool *pa_worker_pool_ref(pa_worker_pool *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) >= 1);
+
+    PA_REFCNT_INC(p);
+
+    return p;
+}
+
+void pa_worker_pool_unref(pa_worker_pool *p) {
+    unsigned i;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) >= 1);
+
+    if (PA_REFCNT_DEC(p) > 0)
+        return;
+
+    if (p->core)
+        pa_assert_se(pa_shared_remove(p->core, "worker-pool") >= 0);
+
+    /* Every job holds a reference, so the queue must be empty */
+    pa_mutex_lock(p->mutex);
+    pa_assert(!p->queue);
+    p->quit = TRUE;
+    pa_cond_signal(p->cond, 1);
+    pa_mutex_unlock(p->mutex);
+
+    for (i = 0; i < p->n_threads; i++)
+        pa_thread_free(p->workers[i].thread);
+
+    pa_xfree(p->workers);
+    pa_cond_free(p->cond);
+    pa_mutex_free(p->mutex);
+    pa_xfree(p);
+}
+
+unsigned pa_worker_pool_get_n_threads(pa_worker_pool *p) {
+    pa_assert(p);
+
+    return p->n_threads;
+}
+
+pa_worker_job *pa_worker_job_new(pa_worker_pool *p, pa_worker_job_cb_t cb, void *userdata) {
+    pa_worker_job *j;
+
+    pa_assert(p);
+    pa_assert(cb);
+
+    j = pa_xnew0(pa_worker_job, 1);
+    j->pool = pa_worker_pool_ref(p);
+    j->cb = cb;
+    j->userdata = userdata;
+    j->state = JOB_IDLE;
+    j->semaphore = pa_semaphore_new(0);
+    PA_LLIST_INIT(pa_worker_job, j);
+
+    return j;
+}
+
+void pa_worker_job_free(pa_worker_job *j) {
+    pa_assert(j);
+
+    if (j->pending)
+        pa_worker_job_wait(j);
+
+    pa_semaphore_free(j->semaphore);
+    pa_worker_pool_unref(j->pool);
+    pa_xfree(j);
+}
+
+/* Called from IO thread context */
+void pa_worker_job_submit(pa_worker_job *j) {
+    pa_worker_pool *p;
+
+    pa_assert(j);
+    pa_assert(!j->pending);
+
+    p = j->pool;
+
+    pa_mutex_lock(p->mutex);
+    pa_assert(j->state == JOB_IDLE);
+    j->state = JOB_QUEUED;
+    queue_append(p, j);
+    pa_cond_signal(p->cond, 0);
+    pa_mutex_unlock(p->mutex);
+
+    j->pending = TRUE;
+}
+
+/* Called from IO thread context */
+void pa_worker_job_wait(pa_worker_job *j) {
+    pa_worker_pool *p;
+
+    pa_assert(j);
+    pa_assert(j->pending);
+
+    p = j->pool;
+
+    pa_mutex_lock(p->mutex);
+
+    if (j->state == JOB_QUEUED) {
+
+        /* All workers are busy, don't wait for one of them to become
+         * available but do it ourselves */
+        queue_remove(p, j);
+        j->state = JOB_RUNNING;
+        pa_mutex_unlock(p->mutex);
+
+        j->cb(j->userdata);
+
+        pa_mutex_lock(p->mutex);
+
+    } else if (j->state == JOB_RUNNING) {
+        j->waiting = TRUE;
+        pa_mutex_unlock(p->mutex);
+
+        pa_semaphore_wait(j->semaphore);
+
+        pa_mutex_lock(p->mutex);
+        j->waiting = FALSE;
+    }
+
+    j->state = JOB_IDLE;
+    pa_mutex_unlock(p->mutex);
+
+    j->pending = FALSE;
+}
+
+/* Called from IO thread context */
+pa_bool_t pa_worker_job_is_pending(pa_worker_job *j) {
+    pa_assert(j);
+
+    return j->pending;
+}
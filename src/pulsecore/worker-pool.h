@@ -0,0 +1,64 @@
+#ifndef fooworkerpoolhfoo
+#define fooworkerpoolhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulsecore/core.h>
+
+/* A small pool of threads, each pinned to its own CPU, that filter
+ * modules can hand their block processing to. This way several heavy
+ * filters that sit on the same master sink don't all have to run on
+ * the master's IO thread.
+ *
+ * A job is submitted from the IO thread and collected again one
+ * block later with pa_worker_job_wait(). If no worker has picked it up
+ * by then, the IO thread runs it itself, so a busy pool never delays
+ * a job by more than what it would have cost inline. */
+
+typedef struct pa_worker_pool pa_worker_pool;
+typedef struct pa_worker_job pa_worker_job;
+
+typedef void (*pa_worker_job_cb_t)(void *userdata);
+
+/* Returns the pool shared by all modules of this core, creating it
+ * on first use. Called from main context. */
+pa_worker_pool *pa_worker_pool_get(pa_core *c);
+
+/* Creates a private pool with n_threads threads. A realtime priority
+ * of 0 leaves the threads at normal priority. */
+pa_worker_pool *pa_worker_pool_new(unsigned n_threads, int rtprio);
+
+pa_worker_pool *pa_worker_pool_ref(pa_worker_pool *p);
+void pa_worker_pool_unref(pa_worker_pool *p);
+
+unsigned pa_worker_pool_get_n_threads(pa_worker_pool *p);
+
+/* Jobs are allocated in main context and may be submitted again as
+ * soon as they have been waited for. pa_worker_job_free() waits for a
+ * job that is still in flight. */
+pa_worker_job *pa_worker_job_new(pa_worker_pool *p, pa_worker_job_cb_t cb, void *userdata);
+void pa_worker_job_free(pa_worker_job *j);
+
+/* Called from IO thread context, these don't allocate memory */
+void pa_worker_job_submit(pa_worker_job *j);
+void pa_worker_job_wait(pa_worker_job *j);
+pa_bool_t pa_worker_job_is_pending(pa_worker_job *j);
+
+#endif
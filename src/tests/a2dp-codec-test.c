@@ -0,0 +1,258 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <modules/bluetooth/a2dp-codec.h>
+#include <modules/bluetooth/a2dp-codecs.h>
+#include <modules/bluetooth/rtp.h>
+
+/* Runs the A2DP codecs the way module-bluetooth-device does, packet by
+ * packet, without a device. Given a file of raw S16LE 44.1 kHz stereo
+ * samples, it runs the benchmark on that instead of a test tone:
+ *
+ *     a2dp-codec-test music.raw
+ */
+
+#define MTU 895
+
+static const char *input_file = NULL;
+
+struct result {
+    size_t block_size;
+    unsigned n_packets;
+    pa_usec_t encode_usec, decode_usec;
+};
+
+static void sbc_config(a2dp_sbc_t *config, uint8_t max_bitpool) {
+    pa_zero(*config);
+    config->frequency = SBC_SAMPLING_FREQ_44100;
+    config->channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
+    config->allocation_method = SBC_ALLOCATION_LOUDNESS;
+    config->subbands = SBC_SUBBANDS_8;
+    config->block_length = SBC_BLOCK_LENGTH_16;
+    config->min_bitpool = MIN_BITPOOL;
+    config->max_bitpool = max_bitpool;
+}
+
+/* Encodes pcm into packets of at most mtu bytes and decodes them again */
+static void run_codec(const pa_a2dp_codec *codec, const uint8_t *config, size_t config_size,
+                      const uint8_t *pcm, size_t length, size_t mtu, struct result *r) {
+    pa_sample_spec ss, dec_ss;
+    void *enc, *dec;
+    uint8_t *packet, *out;
+    size_t offset, payload_size;
+    pa_usec_t start;
+
+    pa_zero(*r);
+
+    fail_unless((enc = codec->init(config, config_size, true, &ss)) != NULL);
+    fail_unless((dec = codec->init(config, config_size, false, &dec_ss)) != NULL);
+    fail_unless(pa_sample_spec_equal(&ss, &dec_ss));
+
+    payload_size = mtu - sizeof(struct rtp_header);
+    r->block_size = codec->get_block_size(enc, payload_size);
+    fail_unless(r->block_size > 0);
+    fail_unless(r->block_size % pa_frame_size(&ss) == 0);
+
+    packet = pa_xmalloc(payload_size);
+    out = pa_xmalloc(codec->get_block_size(dec, payload_size));
+
+    for (offset = 0; offset + r->block_size <= length; offset += r->block_size) {
+        size_t encoded, decoded, written;
+
+        start = pa_rtclock_now();
+        encoded = codec->encode(enc, pcm + offset, r->block_size, packet, payload_size, &written);
+        r->encode_usec += pa_rtclock_now() - start;
+
+        fail_unless(encoded == r->block_size, "Encoder took %lu of %lu bytes", (unsigned long) encoded, (unsigned long) r->block_size);
+        fail_unless(written <= payload_size);
+
+        start = pa_rtclock_now();
+        decoded = codec->decode(dec, packet, written, out, codec->get_block_size(dec, payload_size), &written);
+        r->decode_usec += pa_rtclock_now() - start;
+
+        fail_unless(decoded > 0);
+        fail_unless(written == r->block_size, "Decoder produced %lu of %lu bytes", (unsigned long) written, (unsigned long) r->block_size);
+
+        r->n_packets++;
+    }
+
+    pa_xfree(out);
+    pa_xfree(packet);
+
+    codec->done(dec);
+    codec->done(enc);
+}
+
+static uint8_t *make_tone(size_t *length) {
+    int16_t *pcm;
+    unsigned i, n = 44100;
+
+    pcm = pa_xnew(int16_t, 2 * n);
+    for (i = 0; i < n; i++) {
+        pcm[2 * i] = (int16_t) (10000 * sin(2 * M_PI * 440 * i / 44100.0));
+        pcm[2 * i + 1] = (int16_t) (10000 * sin(2 * M_PI * 1000 * i / 44100.0));
+    }
+
+    *length = n * 2 * sizeof(int16_t);
+
+    return (uint8_t *) pcm;
+}
+
+static uint8_t *read_file(const char *fn, size_t *length) {
+    FILE *f;
+    uint8_t *data = NULL;
+    size_t size = 0, n;
+
+    fail_unless((f = fopen(fn, "r")) != NULL, "Failed to open %s", fn);
+
+    for (;;) {
+        data = pa_xrealloc(data, size + 65536);
+
+        if ((n = fread(data + size, 1, 65536, f)) == 0)
+            break;
+
+        size += n;
+    }
+
+    fclose(f);
+
+    *length = size;
+
+    return data;
+}
+
+START_TEST (sbc_test) {
+    const pa_a2dp_codec *codec;
+    a2dp_sbc_t config;
+    pa_sample_spec ss;
+    struct result r;
+    uint8_t *pcm;
+    size_t length, block_size;
+    void *enc;
+
+    fail_unless((codec = pa_a2dp_codec_get(A2DP_CODEC_SBC)) == &pa_a2dp_codec_sbc);
+    fail_unless(pa_a2dp_codec_get(A2DP_CODEC_ATRAC) == NULL);
+
+    sbc_config(&config, 53);
+    pcm = make_tone(&length);
+
+    run_codec(codec, (uint8_t *) &config, sizeof(config), pcm, length, MTU, &r);
+    fail_unless(r.n_packets == length / r.block_size);
+
+    /* A smaller bitpool means smaller frames, so more of them fit into a
+     * packet */
+    fail_unless((enc = codec->init((uint8_t *) &config, sizeof(config), true, &ss)) != NULL);
+    block_size = codec->get_block_size(enc, MTU - sizeof(struct rtp_header));
+
+    fail_unless(codec->reduce_bitrate(enc));
+    fail_unless(codec->get_block_size(enc, MTU - sizeof(struct rtp_header)) >= block_size);
+
+    fail_unless(codec->reset_bitrate(enc));
+    fail_unless(codec->get_block_size(enc, MTU - sizeof(struct rtp_header)) == block_size);
+    fail_unless(!codec->reset_bitrate(enc));
+
+    codec->done(enc);
+
+    /* The payload header has room for 15 frames at most */
+    sbc_config(&config, MIN_BITPOOL);
+    run_codec(codec, (uint8_t *) &config, sizeof(config), pcm, length, 2048, &r);
+
+    pa_xfree(pcm);
+}
+END_TEST
+
+START_TEST (sbc_perf_test) {
+    static const uint8_t bitpools[] = { 53, 35, 19 };
+    a2dp_sbc_t config;
+    struct result r;
+    pa_sample_spec ss;
+    uint8_t *pcm;
+    size_t length;
+    unsigned i;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pcm = input_file ? read_file(input_file, &length) : make_tone(&length);
+    pa_sample_spec_init(&ss);
+    ss.format = PA_SAMPLE_S16LE;
+    ss.rate = 44100;
+    ss.channels = 2;
+
+    for (i = 0; i < PA_ELEMENTSOF(bitpools); i++) {
+        double seconds;
+
+        sbc_config(&config, bitpools[i]);
+        run_codec(&pa_a2dp_codec_sbc, (uint8_t *) &config, sizeof(config), pcm, length, MTU, &r);
+
+        if (r.n_packets == 0)
+            continue;
+
+        seconds = (double) pa_bytes_to_usec(r.n_packets * r.block_size, &ss) / PA_USEC_PER_SEC;
+
+        pa_log_debug("SBC bitpool %u: %u packets of %llu usec, encode %.0f usec/s (%.1f usec/packet), decode %.0f usec/s (%.1f usec/packet)",
+                     bitpools[i], r.n_packets, (unsigned long long) pa_bytes_to_usec(r.block_size, &ss),
+                     r.encode_usec / seconds, (double) r.encode_usec / r.n_packets,
+                     r.decode_usec / seconds, (double) r.decode_usec / r.n_packets);
+    }
+
+    pa_xfree(pcm);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (argc > 1)
+        input_file = argv[1];
+
+    s = suite_create("A2DP codec");
+    tc = tcase_create("a2dpcodec");
+    tcase_add_test(tc, sbc_test);
+    tcase_add_test(tc, sbc_perf_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
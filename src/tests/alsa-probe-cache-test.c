@@ -0,0 +1,169 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/log.h>
+#include <pulsecore/core-util.h>
+#include <modules/alsa/alsa-mixer.h>
+
+static char *dir, *profile_set_fn, *path_fn;
+
+static void write_file(const char *fn, const char *contents) {
+    FILE *f;
+
+    fail_unless((f = pa_fopen_cloexec(fn, "w")) != NULL);
+    fail_unless(fputs(contents, f) >= 0);
+    fail_unless(fclose(f) == 0);
+}
+
+static void write_profile_set(const char *comment) {
+    char *t;
+
+    t = pa_sprintf_malloc("; %s\n"
+                          "[General]\n"
+                          "auto-profiles = yes\n"
+                          "\n"
+                          "[Mapping analog-stereo]\n"
+                          "device-strings = hw:%%f\n"
+                          "channel-map = left,right\n"
+                          "paths-output = %s" PA_PATH_SEP "test-output\n",
+                          comment, dir);
+    write_file(profile_set_fn, t);
+    pa_xfree(t);
+}
+
+static uint64_t probe_hash(void) {
+    pa_alsa_profile_set *ps;
+    pa_sample_spec ss;
+    uint64_t h;
+
+    ss.format = PA_SAMPLE_S16LE;
+    ss.rate = 44100;
+    ss.channels = 2;
+
+    fail_unless((ps = pa_alsa_profile_set_new(profile_set_fn, NULL)) != NULL);
+    h = pa_alsa_profile_set_probe_hash(ps, &ss, 4, 25);
+    pa_alsa_profile_set_free(ps);
+
+    return h;
+}
+
+static void setup(void) {
+    char t[] = "/tmp/alsa-probe-cache-test-XXXXXX";
+
+    fail_unless(mkdtemp(t) != NULL);
+    dir = pa_xstrdup(t);
+
+    profile_set_fn = pa_sprintf_malloc("%s" PA_PATH_SEP "test.conf", dir);
+    path_fn = pa_sprintf_malloc("%s" PA_PATH_SEP "test-output.conf", dir);
+
+    write_profile_set("first");
+    write_file(path_fn, "[Element Master]\nvolume = merge\n");
+}
+
+static void teardown(void) {
+    unlink(path_fn);
+    unlink(profile_set_fn);
+    rmdir(dir);
+
+    pa_xfree(path_fn);
+    pa_xfree(profile_set_fn);
+    pa_xfree(dir);
+}
+
+START_TEST (probe_cache_unchanged_test) {
+    setup();
+
+    fail_unless(probe_hash() == probe_hash());
+
+    teardown();
+}
+END_TEST
+
+START_TEST (probe_cache_profile_set_test) {
+    uint64_t h;
+
+    setup();
+
+    h = probe_hash();
+
+    /* Even edits that don't change the parsed profile set count */
+    write_profile_set("second");
+    fail_unless(probe_hash() != h);
+
+    write_profile_set("first");
+    fail_unless(probe_hash() == h);
+
+    teardown();
+}
+END_TEST
+
+START_TEST (probe_cache_path_test) {
+    uint64_t h;
+
+    setup();
+
+    h = probe_hash();
+
+    write_file(path_fn, "[Element Master]\nvolume = ignore\n");
+    fail_unless(probe_hash() != h);
+
+    fail_unless(unlink(path_fn) == 0);
+    fail_unless(probe_hash() != h);
+
+    write_file(path_fn, "[Element Master]\nvolume = merge\n");
+    fail_unless(probe_hash() == h);
+
+    teardown();
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Alsa-probe-cache");
+    tc = tcase_create("alsa-probe-cache");
+    tcase_add_test(tc, probe_cache_unchanged_test);
+    tcase_add_test(tc, probe_cache_profile_set_test);
+    tcase_add_test(tc, probe_cache_path_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,244 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/convolver.h>
+
+#define RATE 48000
+#define CHANNELS 8
+#define CHUNK_FRAMES 1024
+
+/* Direct convolution of CHANNELS inputs to two outputs, the way
+ * module-virtual-surround-sink does it without FFTW: a ring buffer of
+ * the last n_taps input frames, folded with the impulse responses for
+ * every output frame. ir holds n_taps frames of 2 * CHANNELS
+ * coefficients: first the left ear, then the right ear ones. */
+struct direct {
+    unsigned n_taps;
+    const float *ir;
+    float *input_buffer;
+    int input_buffer_offset;
+};
+
+static void direct_process(struct direct *d, const float *src, float *dst, unsigned n) {
+    unsigned j, k, l;
+
+    for (l = 0; l < n; l++) {
+        float sum_left = 0, sum_right = 0;
+
+        memcpy(d->input_buffer + d->input_buffer_offset * CHANNELS, src + l * CHANNELS, CHANNELS * sizeof(float));
+
+        for (j = 0; j < d->n_taps; j++) {
+            for (k = 0; k < CHANNELS; k++) {
+                float current_sample = d->input_buffer[((d->input_buffer_offset + j) % d->n_taps) * CHANNELS + k];
+
+                sum_left += current_sample * d->ir[j * 2 * CHANNELS + k];
+                sum_right += current_sample * d->ir[j * 2 * CHANNELS + CHANNELS + k];
+            }
+        }
+
+        dst[2 * l] = sum_left;
+        dst[2 * l + 1] = sum_right;
+
+        d->input_buffer_offset--;
+        if (d->input_buffer_offset < 0)
+            d->input_buffer_offset += d->n_taps;
+    }
+}
+
+static float *random_samples(unsigned n, float amplitude) {
+    float *f;
+    unsigned i;
+
+    f = pa_xnew(float, n);
+    for (i = 0; i < n; i++)
+        f[i] = amplitude * 2.0f * (rand() / (float) RAND_MAX - 0.5f);
+
+    return f;
+}
+
+static pa_convolver *convolver_new(unsigned block_size, unsigned n_taps, const float *ir) {
+    pa_convolver *c;
+    unsigned k;
+
+    c = pa_convolver_new(block_size, n_taps, CHANNELS, 2);
+
+    for (k = 0; k < CHANNELS; k++) {
+        pa_convolver_set_filter(c, k, 0, ir + k, 2 * CHANNELS);
+        pa_convolver_set_filter(c, k, 1, ir + CHANNELS + k, 2 * CHANNELS);
+    }
+
+    return c;
+}
+
+/* Feed both implementations the same input in randomly sized pieces
+ * and compare the output */
+static void run_convolver_test(unsigned block_size, unsigned n_taps) {
+    const unsigned n = 4 * n_taps + 3 * block_size + 17;
+    struct direct d;
+    pa_convolver *c;
+    float *ir, *src, *out_direct, *out_fft;
+    unsigned i, done;
+
+    ir = random_samples(n_taps * 2 * CHANNELS, 1.0f / (n_taps * CHANNELS));
+    src = random_samples(n * CHANNELS, 1.0f);
+    out_direct = pa_xnew(float, n * 2);
+    out_fft = pa_xnew(float, n * 2);
+
+    d.n_taps = n_taps;
+    d.ir = ir;
+    d.input_buffer = pa_xnew0(float, n_taps * CHANNELS);
+    d.input_buffer_offset = 0;
+    direct_process(&d, src, out_direct, n);
+
+    c = convolver_new(block_size, n_taps, ir);
+
+    for (done = 0; done < n;) {
+        unsigned m = PA_MIN(n - done, 1 + (unsigned) rand() % (2 * block_size));
+
+        pa_convolver_process(c, src + done * CHANNELS, out_fft + done * 2, m);
+        done += m;
+    }
+
+    for (i = 0; i < n * 2; i++)
+        fail_unless(fabsf(out_fft[i] - out_direct[i]) < 1e-5f,
+                    "block size %u, %u taps: sample %u differs: %f != %f",
+                    block_size, n_taps, i, out_fft[i], out_direct[i]);
+
+    /* After a reset, the output must not depend on earlier input */
+    pa_convolver_reset(c);
+    pa_convolver_process(c, src, out_fft, n);
+
+    for (i = 0; i < n * 2; i++)
+        fail_unless(fabsf(out_fft[i] - out_direct[i]) < 1e-5f);
+
+    pa_convolver_free(c);
+    pa_xfree(d.input_buffer);
+    pa_xfree(out_fft);
+    pa_xfree(out_direct);
+    pa_xfree(src);
+    pa_xfree(ir);
+}
+
+START_TEST (convolver_test) {
+    run_convolver_test(64, 64);
+    run_convolver_test(64, 1);
+    run_convolver_test(64, 300);
+    run_convolver_test(100, 1024);
+}
+END_TEST
+
+/* Report the CPU time both implementations need per second of 7.1
+ * audio, rendered in chunks like a sink would */
+static void run_convolver_perf(unsigned block_size, unsigned n_taps) {
+    struct direct d;
+    pa_convolver *c;
+    float *ir, *src, *dst;
+    pa_usec_t start, stop;
+    unsigned i, frames;
+    double direct_usec, fft_usec;
+
+    ir = random_samples(n_taps * 2 * CHANNELS, 1.0f / (n_taps * CHANNELS));
+    src = random_samples(CHUNK_FRAMES * CHANNELS, 1.0f);
+    dst = pa_xnew(float, CHUNK_FRAMES * 2);
+
+    d.n_taps = n_taps;
+    d.ir = ir;
+    d.input_buffer = pa_xnew0(float, n_taps * CHANNELS);
+    d.input_buffer_offset = 0;
+
+    /* Direct convolution gets slow quickly, so only run it for a
+     * fraction of a second and scale up */
+    frames = PA_MAX(CHUNK_FRAMES, RATE * 64 / n_taps / 8);
+    frames = PA_ROUND_UP(frames, CHUNK_FRAMES);
+
+    start = pa_rtclock_now();
+    for (i = 0; i < frames; i += CHUNK_FRAMES)
+        direct_process(&d, src, dst, CHUNK_FRAMES);
+    stop = pa_rtclock_now();
+    direct_usec = (double) (stop - start) * RATE / frames;
+
+    c = convolver_new(block_size, n_taps, ir);
+
+    frames = PA_ROUND_UP(RATE, CHUNK_FRAMES);
+
+    start = pa_rtclock_now();
+    for (i = 0; i < frames; i += CHUNK_FRAMES)
+        pa_convolver_process(c, src, dst, CHUNK_FRAMES);
+    stop = pa_rtclock_now();
+    fft_usec = (double) (stop - start) * RATE / frames;
+
+    pa_log_debug("%u taps, block size %u: direct %.0f usec, fft %.0f usec per second of audio (%.1fx)",
+                 n_taps, block_size, direct_usec, fft_usec, direct_usec / fft_usec);
+
+    pa_convolver_free(c);
+    pa_xfree(d.input_buffer);
+    pa_xfree(dst);
+    pa_xfree(src);
+    pa_xfree(ir);
+}
+
+START_TEST (convolver_perf_test) {
+    static const unsigned taps[] = { 64, 256, 512, 1024, 2048 };
+    unsigned i;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    for (i = 0; i < PA_ELEMENTSOF(taps); i++) {
+        run_convolver_perf(PA_MIN(taps[i], 256), taps[i]);
+        run_convolver_perf(PA_MIN(taps[i], 512), taps[i]);
+    }
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Convolver");
+    tc = tcase_create("convolver");
+    tcase_add_test(tc, convolver_test);
+    tcase_add_test(tc, convolver_perf_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -26,6 +26,7 @@
 #include <math.h>
 
 #include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
 #include <pulsecore/cpu-x86.h>
 #include <pulsecore/cpu-orc.h>
 #include <pulsecore/random.h>
@@ -35,6 +36,7 @@
 #include <pulsecore/remap.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/mix.h>
+#include <pulsecore/resampler.h>
 
 #define PA_CPU_TEST_RUN_START(l, t1, t2)                        \
 {                                                               \
@@ -701,14 +703,17 @@ END_TEST
 
 /* Start mix tests */
 
-/* Only ARM NEON has mix tests, so disable the related functions for other
- * architectures for now to avoid compiler warnings about unused functions. */
-#if defined (__arm__) && defined (__linux__)
-#ifdef HAVE_NEON
+/* Only ARM NEON and x86 SSE2/AVX2 have mix tests, so disable the related
+ * functions for other architectures for now to avoid compiler warnings about
+ * unused functions. */
+#if (defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)) || \
+    ((defined (__i386__) || defined (__amd64__)) && (defined (HAVE_SSE2) || defined (HAVE_AVX2)))
 
 #define SAMPLES 1028
-#define TIMES 1000
+#define TIMES 200
 #define TIMES2 100
+#define MAX_STREAMS 8
+#define MAX_CHANNELS 8
 
 static void acquire_mix_streams(pa_mix_info streams[], unsigned nstreams) {
     unsigned i;
@@ -727,107 +732,162 @@ static void release_mix_streams(pa_mix_info streams[], unsigned nstreams) {
 static void run_mix_test(
         pa_do_mix_func_t func,
         pa_do_mix_func_t orig_func,
+        pa_sample_format_t format,
         int align,
         int channels,
+        unsigned nstreams,
         pa_bool_t correct,
         pa_bool_t perf) {
 
-    PA_DECLARE_ALIGNED(8, int16_t, in0[SAMPLES * 4]) = { 0 };
-    PA_DECLARE_ALIGNED(8, int16_t, in1[SAMPLES * 4]) = { 0 };
-    PA_DECLARE_ALIGNED(8, int16_t, out[SAMPLES * 4]) = { 0 };
-    PA_DECLARE_ALIGNED(8, int16_t, out_ref[SAMPLES * 4]) = { 0 };
-    int16_t *samples0, *samples1;
-    int16_t *samples, *samples_ref;
+    PA_DECLARE_ALIGNED(8, uint8_t, out[SAMPLES * MAX_CHANNELS * 4]) = { 0 };
+    PA_DECLARE_ALIGNED(8, uint8_t, out_ref[SAMPLES * MAX_CHANNELS * 4]) = { 0 };
+    uint8_t *in, *samples, *samples_ref;
+    size_t ss;
     int nsamples;
     pa_mempool *pool;
-    pa_memchunk c0, c1;
-    pa_mix_info m[2];
+    pa_mix_info m[MAX_STREAMS];
+    unsigned k;
     int i;
 
-    pa_assert(channels == 1 || channels == 2 || channels == 4);
+    pa_assert(channels >= 1 && channels <= MAX_CHANNELS);
+    pa_assert(nstreams >= 1 && nstreams <= MAX_STREAMS);
+
+    ss = pa_sample_size_of_format(format);
+    in = pa_xmalloc(nstreams * sizeof(out));
 
     /* Force sample alignment as requested */
-    samples0 = in0 + (8 - align);
-    samples1 = in1 + (8 - align);
-    samples = out + (8 - align);
-    samples_ref = out_ref + (8 - align);
+    samples = out + (8 - align) * ss;
+    samples_ref = out_ref + (8 - align) * ss;
     nsamples = channels * (SAMPLES - (8 - align));
 
-    fail_unless((pool = pa_mempool_new(FALSE, 0)) != NULL, NULL);
+    fail_unless((pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0)) != NULL, NULL);
 
-    pa_random(samples0, nsamples * sizeof(int16_t));
-    c0.memblock = pa_memblock_new_fixed(pool, samples0, nsamples * sizeof(int16_t), FALSE);
-    c0.length = pa_memblock_get_length(c0.memblock);
-    c0.index = 0;
+    for (k = 0; k < nstreams; k++) {
+        uint8_t *samples_in = in + k * sizeof(out) + (8 - align) * ss;
 
-    pa_random(samples1, nsamples * sizeof(int16_t));
-    c1.memblock = pa_memblock_new_fixed(pool, samples1, nsamples * sizeof(int16_t), FALSE);
-    c1.length = pa_memblock_get_length(c1.memblock);
-    c1.index = 0;
+        if (format == PA_SAMPLE_FLOAT32NE) {
+            float *f = (float *) samples_in;
 
-    m[0].chunk = c0;
-    m[0].volume.channels = channels;
-    for (i = 0; i < channels; i++) {
-        m[0].volume.values[i] = PA_VOLUME_NORM;
-        m[0].linear[i].i = 0x5555;
-    }
+            for (i = 0; i < nsamples; i++)
+                f[i] = 2.1f * (rand()/(float) RAND_MAX - 0.5f);
+        } else
+            pa_random(samples_in, nsamples * ss);
 
-    m[1].chunk = c1;
-    m[1].volume.channels = channels;
-    for (i = 0; i < channels; i++) {
-        m[1].volume.values[i] = PA_VOLUME_NORM;
-        m[1].linear[i].i = 0x6789;
-    }
+        m[k].chunk.memblock = pa_memblock_new_fixed(pool, samples_in, nsamples * ss, FALSE);
+        m[k].chunk.length = pa_memblock_get_length(m[k].chunk.memblock);
+        m[k].chunk.index = 0;
 
-    if (correct) {
-        acquire_mix_streams(m, 2);
-        orig_func(m, 2, channels, samples_ref, nsamples * sizeof(int16_t));
-        release_mix_streams(m, 2);
+        m[k].volume.channels = channels;
+        for (i = 0; i < channels; i++) {
+            m[k].volume.values[i] = PA_VOLUME_NORM;
 
-        acquire_mix_streams(m, 2);
-        func(m, 2, channels, samples, nsamples * sizeof(int16_t));
-        release_mix_streams(m, 2);
+            /* Include volumes above 0 dB to get some clipping */
+            if (format == PA_SAMPLE_FLOAT32NE)
+                m[k].linear[i].f = (float) (rand() % 0x18000) / 0x10000;
+            else
+                m[k].linear[i].i = rand() % 0x18000;
+        }
+    }
 
-        for (i = 0; i < nsamples; i++) {
-            if (samples[i] != samples_ref[i]) {
-                pa_log_debug("Correctness test failed: align=%d, channels=%d", align, channels);
-                pa_log_debug("%d: %hd != %04hd (%hd + %hd)\n",
-                    i,
-                    samples[i], samples_ref[i],
-                    samples0[i], samples1[i]);
-                fail();
+    if (correct) {
+        acquire_mix_streams(m, nstreams);
+        orig_func(m, nstreams, channels, samples_ref, nsamples * ss);
+        release_mix_streams(m, nstreams);
+
+        acquire_mix_streams(m, nstreams);
+        func(m, nstreams, channels, samples, nsamples * ss);
+        release_mix_streams(m, nstreams);
+
+        /* The optimized functions must be bit exact, the float variants
+         * add up the streams in the same order as the generic code */
+        if (memcmp(samples, samples_ref, nsamples * ss) != 0) {
+            for (i = 0; i < nsamples; i++) {
+                if (memcmp(samples + i * ss, samples_ref + i * ss, ss) != 0) {
+                    pa_log_debug("Correctness test failed: format=%s, align=%d, channels=%d, streams=%u, sample %d",
+                                 pa_sample_format_to_string(format), align, channels, nstreams, i);
+                    break;
+                }
             }
+            fail();
         }
     }
 
     if (perf) {
-        pa_log_debug("Testing %d-channel mixing performance with %d sample alignment", channels, align);
+        pa_log_debug("Testing %d-channel %u-stream %s mixing performance with %d sample alignment",
+                     channels, nstreams, pa_sample_format_to_string(format), align);
 
         PA_CPU_TEST_RUN_START("func", TIMES, TIMES2) {
-            acquire_mix_streams(m, 2);
-            func(m, 2, channels, samples, nsamples * sizeof(int16_t));
-            release_mix_streams(m, 2);
+            acquire_mix_streams(m, nstreams);
+            func(m, nstreams, channels, samples, nsamples * ss);
+            release_mix_streams(m, nstreams);
         } PA_CPU_TEST_RUN_STOP
 
         PA_CPU_TEST_RUN_START("orig", TIMES, TIMES2) {
-            acquire_mix_streams(m, 2);
-            orig_func(m, 2, channels, samples_ref, nsamples * sizeof(int16_t));
-            release_mix_streams(m, 2);
+            acquire_mix_streams(m, nstreams);
+            orig_func(m, nstreams, channels, samples_ref, nsamples * ss);
+            release_mix_streams(m, nstreams);
         } PA_CPU_TEST_RUN_STOP
     }
 
-    pa_memblock_unref(c0.memblock);
-    pa_memblock_unref(c1.memblock);
+    for (k = 0; k < nstreams; k++)
+        pa_memblock_unref(m[k].chunk.memblock);
 
     pa_mempool_free(pool);
+    pa_xfree(in);
+}
+
+static void mix_test_format(pa_do_mix_func_t func, pa_do_mix_func_t orig_func, pa_sample_format_t format) {
+    unsigned nstreams;
+    int channels, align;
+
+    for (nstreams = 1; nstreams <= MAX_STREAMS; nstreams++)
+        for (channels = 1; channels <= MAX_CHANNELS; channels++)
+            for (align = 0; align < 8; align++)
+                run_mix_test(func, orig_func, format, align, channels, nstreams, TRUE, FALSE);
+
+    run_mix_test(func, orig_func, format, 7, 2, 2, TRUE, TRUE);
+    run_mix_test(func, orig_func, format, 7, 2, MAX_STREAMS, TRUE, TRUE);
+    run_mix_test(func, orig_func, format, 7, 6, MAX_STREAMS, TRUE, TRUE);
 }
-#endif /* HAVE_NEON */
-#endif /* defined (__arm__) && defined (__linux__) */
+
+static void mix_test(void (*init_func)(void)) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_S32NE, PA_SAMPLE_FLOAT32NE };
+    pa_do_mix_func_t orig_func[PA_ELEMENTSOF(formats)];
+    unsigned i;
+
+    for (i = 0; i < PA_ELEMENTSOF(formats); i++)
+        orig_func[i] = pa_get_mix_func(formats[i]);
+
+    init_func();
+
+    for (i = 0; i < PA_ELEMENTSOF(formats); i++) {
+        pa_do_mix_func_t func = pa_get_mix_func(formats[i]);
+
+        if (func == orig_func[i])
+            continue;
+
+        pa_log_debug("Checking %s mix", pa_sample_format_to_string(formats[i]));
+        mix_test_format(func, orig_func[i], formats[i]);
+
+        /* Leave the generic function in place for the next test */
+        pa_set_mix_func(formats[i], orig_func[i]);
+    }
+}
+
+#undef SAMPLES
+#undef TIMES
+#undef TIMES2
+#undef MAX_STREAMS
+#undef MAX_CHANNELS
+#endif
 
 #if defined (__arm__) && defined (__linux__)
 #ifdef HAVE_NEON
+static void init_mix_neon(void) {
+    pa_mix_func_init_neon(PA_CPU_ARM_NEON);
+}
+
 START_TEST (mix_neon_test) {
-    pa_do_mix_func_t orig_func, neon_func;
     pa_cpu_arm_flag_t flags = 0;
 
     pa_cpu_get_arm_flags(&flags);
@@ -837,18 +897,215 @@ START_TEST (mix_neon_test) {
         return;
     }
 
-    orig_func = pa_get_mix_func(PA_SAMPLE_S16NE);
-    pa_mix_func_init_neon(flags);
-    neon_func = pa_get_mix_func(PA_SAMPLE_S16NE);
-
     pa_log_debug("Checking NEON mix");
-    run_mix_test(neon_func, orig_func, 7, 2, TRUE, TRUE);
+    mix_test(init_mix_neon);
 }
 END_TEST
 #endif /* HAVE_NEON */
 #endif /* defined (__arm__) && defined (__linux__) */
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+static void init_mix_sse2(void) {
+    pa_mix_func_init_sse(PA_CPU_X86_SSE2);
+}
+
+START_TEST (mix_sse2_test) {
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    pa_log_debug("Checking SSE2 mix");
+    mix_test(init_mix_sse2);
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_AVX2
+static void init_mix_avx2(void) {
+    pa_mix_func_init_avx2(PA_CPU_X86_AVX2);
+}
+
+START_TEST (mix_avx2_test) {
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    pa_log_debug("Checking AVX2 mix");
+    mix_test(init_mix_avx2);
+}
+END_TEST
+#endif /* HAVE_AVX2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
 /* End mix tests */
 
+/* Start resampler tests */
+
+#if (defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)) || \
+    ((defined (__i386__) || defined (__amd64__)) && (defined (HAVE_SSE2) || defined (HAVE_AVX2)))
+
+#define MAX_TAPS 512
+#define TIMES 10000
+#define TIMES2 100
+
+static void run_fir_dot_test(
+        pa_resampler_fir_dot_func_t func,
+        pa_resampler_fir_dot_func_t orig_func,
+        int align,
+        unsigned n,
+        pa_bool_t correct,
+        pa_bool_t perf) {
+
+    PA_DECLARE_ALIGNED(8, float, x[MAX_TAPS + 8]);
+    PA_DECLARE_ALIGNED(8, float, h[MAX_TAPS + 8]);
+    float *xa, *ha, sum, sum_ref, abs_sum;
+    unsigned i;
+
+    /* The samples in the history buffer can start anywhere, the
+     * filters are always aligned */
+    xa = x + (8 - align);
+    ha = h + 8;
+
+    for (i = 0; i < n; i++) {
+        xa[i] = 2.0f * (rand()/(float) RAND_MAX - 0.5f);
+        ha[i] = 2.0f * (rand()/(float) RAND_MAX - 0.5f) / n;
+    }
+
+    if (correct) {
+        sum_ref = orig_func(xa, ha, n);
+        sum = func(xa, ha, n);
+
+        /* The products are summed up in a different order, so allow
+         * for rounding errors relative to the magnitude of the terms */
+        abs_sum = 0;
+        for (i = 0; i < n; i++)
+            abs_sum += fabsf(xa[i] * ha[i]);
+
+        if (fabsf(sum - sum_ref) > abs_sum * 1e-6f) {
+            pa_log_debug("Correctness test failed: align=%d, n=%u: %.9g != %.9g", align, n, sum, sum_ref);
+            fail();
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %u tap FIR dot product performance with %d sample alignment", n, align);
+
+        PA_CPU_TEST_RUN_START("func", TIMES, TIMES2) {
+            sum = func(xa, ha, n);
+        } PA_CPU_TEST_RUN_STOP
+
+        PA_CPU_TEST_RUN_START("orig", TIMES, TIMES2) {
+            sum_ref = orig_func(xa, ha, n);
+        } PA_CPU_TEST_RUN_STOP
+    }
+}
+
+static void fir_dot_test(void (*init_func)(void)) {
+    pa_resampler_fir_dot_func_t orig_func, func;
+    unsigned n;
+    int align;
+
+    orig_func = pa_get_resampler_fir_dot_func();
+    init_func();
+    func = pa_get_resampler_fir_dot_func();
+
+    if (func == orig_func)
+        return;
+
+    for (n = 8; n <= MAX_TAPS; n += 8)
+        for (align = 0; align < 8; align++)
+            run_fir_dot_test(func, orig_func, align, n, TRUE, FALSE);
+
+    run_fir_dot_test(func, orig_func, 3, 48, TRUE, TRUE);
+    run_fir_dot_test(func, orig_func, 3, 256, TRUE, TRUE);
+
+    /* Leave the generic function in place for the next test */
+    pa_set_resampler_fir_dot_func(orig_func);
+}
+
+#undef MAX_TAPS
+#undef TIMES
+#undef TIMES2
+#endif
+
+#if defined (__arm__) && defined (__linux__)
+#ifdef HAVE_NEON
+static void init_resampler_neon(void) {
+    pa_resampler_func_init_neon(PA_CPU_ARM_NEON);
+}
+
+START_TEST (resampler_neon_test) {
+    pa_cpu_arm_flag_t flags = 0;
+
+    pa_cpu_get_arm_flags(&flags);
+
+    if (!(flags & PA_CPU_ARM_NEON)) {
+        pa_log_info("NEON not supported. Skipping");
+        return;
+    }
+
+    pa_log_debug("Checking NEON FIR dot product");
+    fir_dot_test(init_resampler_neon);
+}
+END_TEST
+#endif /* HAVE_NEON */
+#endif /* defined (__arm__) && defined (__linux__) */
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+static void init_resampler_sse2(void) {
+    pa_resampler_func_init_sse(PA_CPU_X86_SSE2);
+}
+
+START_TEST (resampler_sse2_test) {
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    pa_log_debug("Checking SSE2 FIR dot product");
+    fir_dot_test(init_resampler_sse2);
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_AVX2
+static void init_resampler_avx2(void) {
+    pa_resampler_func_init_avx2(PA_CPU_X86_AVX2);
+}
+
+START_TEST (resampler_avx2_test) {
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    pa_log_debug("Checking AVX2 FIR dot product");
+    fir_dot_test(init_resampler_avx2);
+}
+END_TEST
+#endif /* HAVE_AVX2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
+/* End resampler tests */
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -901,6 +1158,32 @@ int main(int argc, char *argv[]) {
 #if HAVE_NEON
     tcase_add_test(tc, mix_neon_test);
 #endif
+#endif
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+    tcase_add_test(tc, mix_sse2_test);
+#endif
+#ifdef HAVE_AVX2
+    tcase_add_test(tc, mix_avx2_test);
+#endif
+#endif
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    /* Resampler tests */
+    tc = tcase_create("resampler");
+#if defined (__arm__) && defined (__linux__)
+#if HAVE_NEON
+    tcase_add_test(tc, resampler_neon_test);
+#endif
+#endif
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+    tcase_add_test(tc, resampler_sse2_test);
+#endif
+#ifdef HAVE_AVX2
+    tcase_add_test(tc, resampler_avx2_test);
+#endif
 #endif
     tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
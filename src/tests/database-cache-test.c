@@ -0,0 +1,424 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/database.h>
+#include <pulsecore/database-cache.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/module.h>
+
+#define N_UPDATES 10000
+
+static pa_mainloop *mainloop = NULL;
+static pa_core *core = NULL;
+static pa_module *module = NULL;
+static pa_database *database = NULL;
+static char *fn = NULL;
+
+static void setup(void) {
+    char template[] = "database-cache-test-XXXXXX";
+    int fd;
+
+    fail_unless((fd = mkstemp(template)) >= 0);
+    close(fd);
+    unlink(template);
+    fn = pa_xstrdup(template);
+
+    mainloop = pa_mainloop_new();
+    fail_unless((core = pa_core_new(pa_mainloop_get_api(mainloop), FALSE, 0)) != NULL);
+
+    /* Just enough of a module for the cache to publish its numbers */
+    module = pa_xnew0(pa_module, 1);
+    module->core = core;
+    module->name = pa_xstrdup("module-test");
+    module->proplist = pa_proplist_new();
+    module->index = 0;
+
+    fail_unless((database = pa_database_open(fn, TRUE)) != NULL);
+}
+
+/* Whichever backend is in use, these are the files it may create */
+static const char * const suffixes[] = {
+    "."CANONICAL_HOST".gdbm",
+    "."CANONICAL_HOST".mmap",
+    "."CANONICAL_HOST".mmap-index",
+    "."CANONICAL_HOST".simple",
+    ".tdb",
+};
+
+static void teardown(void) {
+    unsigned i;
+
+    pa_database_close(database);
+
+    pa_proplist_free(module->proplist);
+    pa_xfree(module->name);
+    pa_xfree(module);
+
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+
+    for (i = 0; i < PA_ELEMENTSOF(suffixes); i++) {
+        char *t;
+
+        t = pa_sprintf_malloc("%s%s", fn, suffixes[i]);
+        unlink(t);
+        pa_xfree(t);
+    }
+
+    pa_xfree(fn);
+}
+
+static void set(pa_database_cache *c, const char *key, unsigned value) {
+    char data[32];
+    pa_datum k, d;
+
+    pa_snprintf(data, sizeof(data), "%u", value);
+
+    k.data = (void*) key;
+    k.size = strlen(key);
+    d.data = data;
+    d.size = strlen(data) + 1;
+
+    fail_unless(pa_database_cache_set(c, &k, &d, TRUE) == 0);
+}
+
+/* Returns -1 if there's no such key */
+static int get(pa_database_cache *c, const char *key) {
+    pa_datum k, d;
+    int value;
+
+    k.data = (void*) key;
+    k.size = strlen(key);
+
+    if (!pa_database_cache_get(c, &k, &d))
+        return -1;
+
+    value = atoi(d.data);
+    pa_datum_free(&d);
+
+    return value;
+}
+
+static int get_stored(const char *key) {
+    pa_datum k, d;
+    int value;
+
+    k.data = (void*) key;
+    k.size = strlen(key);
+
+    if (!pa_database_get(database, &k, &d))
+        return -1;
+
+    value = atoi(d.data);
+    pa_datum_free(&d);
+
+    return value;
+}
+
+static unsigned get_stat(const char *name) {
+    const char *s;
+    char *key;
+    unsigned v = 0;
+
+    key = pa_sprintf_malloc("module.database.%s", name);
+    fail_unless((s = pa_proplist_gets(module->proplist, key)) != NULL);
+    fail_unless(pa_atou(s, &v) >= 0);
+    pa_xfree(key);
+
+    return v;
+}
+
+START_TEST (cache_coalesce_test) {
+    pa_database_cache *c;
+    pa_datum k, d;
+    unsigned i;
+
+    setup();
+
+    fail_unless((c = pa_database_cache_new(module, database, 10 * PA_USEC_PER_SEC, 1024 * 1024)) != NULL);
+    fail_unless(get_stat("flushes") == 0);
+
+    /* A slider being dragged */
+    for (i = 0; i <= 100; i++)
+        set(c, "sink-input-by-application-name:foo", i);
+
+    fail_unless(get(c, "sink-input-by-application-name:foo") == 100);
+    fail_unless(get_stored("sink-input-by-application-name:foo") == -1);
+
+    set(c, "sink-input-by-application-name:bar", 1);
+
+    k.data = (void*) "sink-input-by-application-name:bar";
+    k.size = strlen(k.data);
+    d.data = (void*) "2";
+    d.size = 2;
+    fail_unless(pa_database_cache_set(c, &k, &d, FALSE) < 0);
+    fail_unless(pa_database_cache_unset(c, &k) == 0);
+    fail_unless(pa_database_cache_unset(c, &k) < 0);
+    fail_unless(get(c, "sink-input-by-application-name:bar") == -1);
+
+    fail_unless(pa_database_cache_flush(c) == 0);
+    fail_unless(get_stat("flushes") == 1);
+    fail_unless(get_stat("entries_written") == 2);
+    fail_unless(get_stat("updates_coalesced") == 101);
+    fail_unless(get_stored("sink-input-by-application-name:foo") == 100);
+    fail_unless(get_stored("sink-input-by-application-name:bar") == -1);
+
+    /* Nothing to do */
+    fail_unless(pa_database_cache_flush(c) == 0);
+    fail_unless(get_stat("flushes") == 1);
+
+    /* Unsetting something that is only in the database */
+    k.data = (void*) "sink-input-by-application-name:foo";
+    k.size = strlen(k.data);
+    fail_unless(pa_database_cache_unset(c, &k) == 0);
+    fail_unless(get_stored("sink-input-by-application-name:foo") == 100);
+    fail_unless(!pa_database_cache_first(c, &k, NULL));
+    fail_unless(get_stored("sink-input-by-application-name:foo") == 100);
+    fail_unless(pa_database_cache_flush(c) == 0);
+    fail_unless(get_stored("sink-input-by-application-name:foo") == -1);
+    fail_unless(get_stat("flushes") == 2);
+
+    /* Clearing hides what's stored */
+    set(c, "a", 1);
+    pa_database_cache_flush(c);
+    fail_unless(pa_database_cache_clear(c) == 0);
+    fail_unless(get(c, "a") == -1);
+    set(c, "b", 2);
+    pa_database_cache_free(c);
+
+    fail_unless(get_stored("a") == -1);
+    fail_unless(get_stored("b") == 2);
+
+    teardown();
+}
+END_TEST
+
+/* Returns the sum of all values, as seen when iterating */
+static unsigned iterate(pa_database_cache *c, unsigned *n) {
+    pa_datum k, d, next;
+    pa_bool_t done;
+    unsigned sum = 0;
+
+    *n = 0;
+    done = !pa_database_cache_first(c, &k, &d);
+
+    while (!done) {
+        (*n)++;
+        sum += (unsigned) atoi(d.data);
+        pa_datum_free(&d);
+
+        done = !pa_database_cache_next(c, &k, &next, &d);
+        pa_datum_free(&k);
+        k = next;
+    }
+
+    return sum;
+}
+
+START_TEST (cache_iterate_test) {
+    pa_database_cache *c;
+    pa_datum k;
+    unsigned n;
+
+    setup();
+
+    fail_unless((c = pa_database_cache_new(module, database, 10 * PA_USEC_PER_SEC, 1024 * 1024)) != NULL);
+
+    fail_unless(iterate(c, &n) == 0 && n == 0);
+
+    set(c, "a", 1);
+    set(c, "b", 2);
+    set(c, "c", 4);
+    fail_unless(iterate(c, &n) == 7 && n == 3);
+
+    fail_unless(pa_database_cache_flush(c) == 0);
+    fail_unless(iterate(c, &n) == 7 && n == 3);
+
+    /* Changed, deleted and new keys on top of the stored ones */
+    set(c, "a", 8);
+    k.data = (void*) "b";
+    k.size = 1;
+    fail_unless(pa_database_cache_unset(c, &k) == 0);
+    set(c, "d", 16);
+    set(c, "e", 32);
+    k.data = (void*) "e";
+    fail_unless(pa_database_cache_unset(c, &k) == 0);
+
+    fail_unless(iterate(c, &n) == 8 + 4 + 16 && n == 3);
+
+    /* Iterating doesn't write anything */
+    fail_unless(get_stat("flushes") == 1);
+    fail_unless(get_stored("a") == 1);
+    fail_unless(get_stored("b") == 2);
+    fail_unless(get_stored("d") == -1);
+
+    fail_unless(pa_database_cache_flush(c) == 0);
+    fail_unless(iterate(c, &n) == 8 + 4 + 16 && n == 3);
+
+    /* Nothing that is stored counts after clearing */
+    fail_unless(pa_database_cache_clear(c) == 0);
+    set(c, "c", 64);
+    fail_unless(iterate(c, &n) == 64 && n == 1);
+
+    pa_database_cache_free(c);
+
+    teardown();
+}
+END_TEST
+
+static void quit_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    a->quit(a, 0);
+}
+
+START_TEST (cache_budget_test) {
+    pa_database_cache *c;
+    pa_time_event *e;
+    unsigned i;
+    char key[32];
+
+    setup();
+
+    /* The size budget */
+    fail_unless((c = pa_database_cache_new(module, database, 10 * PA_USEC_PER_SEC, 50)) != NULL);
+
+    for (i = 0; i < 10; i++) {
+        pa_snprintf(key, sizeof(key), "key-%u", i);
+        set(c, key, i);
+    }
+
+    fail_unless(get_stat("flushes") >= 1);
+    fail_unless(get_stored("key-0") == 0);
+
+    pa_database_cache_free(c);
+
+    /* The time budget */
+    fail_unless((c = pa_database_cache_new(module, database, 50 * PA_USEC_PER_MSEC, 1024 * 1024)) != NULL);
+    set(c, "key-0", 42);
+    fail_unless(get_stored("key-0") == 0);
+
+    e = pa_core_rttime_new(core, pa_rtclock_now() + 200 * PA_USEC_PER_MSEC, quit_cb, NULL);
+    pa_mainloop_run(mainloop, NULL);
+    core->mainloop->time_free(e);
+
+    fail_unless(get_stored("key-0") == 42);
+    fail_unless(get_stat("flushes") == 1);
+
+    pa_database_cache_free(c);
+
+    teardown();
+}
+END_TEST
+
+/* What each change of a slider costs, going to the database directly
+ * or through the cache */
+START_TEST (cache_perf_test) {
+    pa_database_cache *c;
+    pa_usec_t start, direct_usec, cached_usec;
+    pa_datum k, d;
+    char data[32];
+    unsigned i;
+
+    setup();
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    k.data = (void*) "sink-input-by-media-role:music";
+    k.size = strlen(k.data);
+
+    start = pa_rtclock_now();
+    for (i = 0; i < N_UPDATES; i++) {
+        pa_snprintf(data, sizeof(data), "%u", i);
+
+        if (pa_database_get(database, &k, &d))
+            pa_datum_free(&d);
+
+        d.data = data;
+        d.size = strlen(data) + 1;
+        pa_database_set(database, &k, &d, TRUE);
+    }
+    pa_database_sync(database);
+    direct_usec = pa_rtclock_now() - start;
+
+    c = pa_database_cache_new(module, database, 10 * PA_USEC_PER_SEC, 64 * 1024);
+
+    start = pa_rtclock_now();
+    for (i = 0; i < N_UPDATES; i++) {
+        pa_snprintf(data, sizeof(data), "%u", i);
+
+        if (pa_database_cache_get(c, &k, &d))
+            pa_datum_free(&d);
+
+        d.data = data;
+        d.size = strlen(data) + 1;
+        pa_database_cache_set(c, &k, &d, TRUE);
+    }
+    pa_database_cache_flush(c);
+    cached_usec = pa_rtclock_now() - start;
+
+    pa_log_debug("%u updates: direct %llu usec, cached %llu usec, %u flushes",
+                 N_UPDATES, (unsigned long long) direct_usec, (unsigned long long) cached_usec, get_stat("flushes"));
+
+    pa_database_cache_free(c);
+
+    teardown();
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Database cache");
+    tc = tcase_create("databasecache");
+    tcase_add_test(tc, cache_coalesce_test);
+    tcase_add_test(tc, cache_iterate_test);
+    tcase_add_test(tc, cache_budget_test);
+    tcase_add_test(tc, cache_perf_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,486 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/database.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_PERF_ENTRIES 20000
+
+static char *dir = NULL;
+
+static char *db_name(const char *name) {
+    return pa_sprintf_malloc("%s/%s", dir, name);
+}
+
+static char *log_name(const char *name) {
+    return pa_sprintf_malloc("%s/%s."CANONICAL_HOST".mmap", dir, name);
+}
+
+static char *index_name(const char *name) {
+    return pa_sprintf_malloc("%s/%s."CANONICAL_HOST".mmap-index", dir, name);
+}
+
+static off_t file_size(const char *fn) {
+    struct stat st;
+
+    fail_unless(stat(fn, &st) == 0);
+
+    return st.st_size;
+}
+
+static void set_entry(pa_database *db, unsigned i, unsigned value) {
+    char key[32], data[64];
+    pa_datum k, d;
+
+    pa_snprintf(key, sizeof(key), "sink-input-by-media-role:%u", i);
+    pa_snprintf(data, sizeof(data), "volume=%u muted=%u", value, value & 1);
+
+    k.data = key;
+    k.size = strlen(key);
+    d.data = data;
+    d.size = strlen(data) + 1;
+
+    fail_unless(pa_database_set(db, &k, &d, TRUE) == 0);
+}
+
+static pa_bool_t check_entry(pa_database *db, unsigned i, unsigned value) {
+    char key[32], data[64];
+    pa_datum k, d;
+    pa_bool_t ok;
+
+    pa_snprintf(key, sizeof(key), "sink-input-by-media-role:%u", i);
+    pa_snprintf(data, sizeof(data), "volume=%u muted=%u", value, value & 1);
+
+    k.data = key;
+    k.size = strlen(key);
+
+    if (!pa_database_get(db, &k, &d))
+        return FALSE;
+
+    ok = d.size == strlen(data) + 1 && memcmp(d.data, data, d.size) == 0;
+    pa_datum_free(&d);
+
+    return ok;
+}
+
+static pa_bool_t has_entry(pa_database *db, unsigned i) {
+    char key[32];
+    pa_datum k, d;
+
+    pa_snprintf(key, sizeof(key), "sink-input-by-media-role:%u", i);
+    k.data = key;
+    k.size = strlen(key);
+
+    if (!pa_database_get(db, &k, &d))
+        return FALSE;
+
+    pa_datum_free(&d);
+
+    return TRUE;
+}
+
+static void unset_entry(pa_database *db, unsigned i) {
+    char key[32];
+    pa_datum k;
+
+    pa_snprintf(key, sizeof(key), "sink-input-by-media-role:%u", i);
+    k.data = key;
+    k.size = strlen(key);
+
+    fail_unless(pa_database_unset(db, &k) == 0);
+}
+
+static unsigned count_entries(pa_database *db) {
+    pa_datum key, next_key;
+    unsigned n = 0;
+    pa_bool_t done;
+
+    done = !pa_database_first(db, &key, NULL);
+
+    while (!done) {
+        n++;
+        done = !pa_database_next(db, &key, &next_key, NULL);
+        pa_datum_free(&key);
+        key = next_key;
+    }
+
+    return n;
+}
+
+static void remove_dir(void) {
+    DIR *d;
+    struct dirent *de;
+
+    fail_unless((d = opendir(dir)) != NULL);
+
+    while ((de = readdir(d))) {
+        char *fn;
+
+        if (de->d_name[0] == '.' && (de->d_name[1] == 0 || (de->d_name[1] == '.' && de->d_name[2] == 0)))
+            continue;
+
+        fn = pa_sprintf_malloc("%s/%s", dir, de->d_name);
+        unlink(fn);
+        pa_xfree(fn);
+    }
+
+    closedir(d);
+    rmdir(dir);
+}
+
+START_TEST (database_basic_test) {
+    char *fn;
+    pa_database *db;
+    pa_datum k, d;
+    unsigned i;
+
+    fn = db_name("basic");
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+
+    for (i = 0; i < 1000; i++)
+        set_entry(db, i, i);
+
+    fail_unless(pa_database_size(db) == 1000);
+    fail_unless(count_entries(db) == 1000);
+
+    /* Overwriting */
+    k.data = (void*) "sink-input-by-media-role:5";
+    k.size = strlen(k.data);
+    d.data = (void*) "x";
+    d.size = 1;
+    fail_unless(pa_database_set(db, &k, &d, FALSE) < 0);
+    fail_unless(check_entry(db, 5, 5));
+    set_entry(db, 5, 500);
+    fail_unless(check_entry(db, 5, 500));
+
+    for (i = 0; i < 1000; i += 2)
+        unset_entry(db, i);
+
+    k.data = (void*) "sink-input-by-media-role:4";
+    k.size = strlen(k.data);
+    fail_unless(pa_database_unset(db, &k) < 0);
+    fail_unless(pa_database_size(db) == 500);
+    fail_unless(count_entries(db) == 500);
+    pa_database_close(db);
+
+    /* Reading it back, also while a reader has it open */
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    fail_unless(pa_database_size(db) == 500);
+
+    for (i = 0; i < 1000; i++) {
+        if (i % 2 == 0)
+            fail_unless(!has_entry(db, i), "Entry %u is still there", i);
+        else
+            fail_unless(check_entry(db, i, i == 5 ? 500 : i), "Entry %u is wrong", i);
+    }
+
+    pa_database_sync(db);
+
+    {
+        pa_database *reader;
+
+        fail_unless((reader = pa_database_open(fn, FALSE)) != NULL);
+        fail_unless(pa_database_size(reader) == 500);
+        fail_unless(check_entry(reader, 7, 7));
+        fail_unless(pa_database_set(reader, &k, &d, TRUE) < 0);
+        pa_database_close(reader);
+    }
+
+    fail_unless(pa_database_clear(db) == 0);
+    fail_unless(pa_database_size(db) == 0);
+    fail_unless(!pa_database_first(db, &k, NULL));
+    set_entry(db, 1, 1);
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(fn, FALSE)) != NULL);
+    fail_unless(pa_database_size(db) == 1);
+    fail_unless(check_entry(db, 1, 1));
+    pa_database_close(db);
+
+    /* A database that doesn't exist can be read, it's just empty */
+    pa_xfree(fn);
+    fn = db_name("missing");
+    fail_unless((db = pa_database_open(fn, FALSE)) != NULL);
+    fail_unless(pa_database_size(db) == 0);
+    pa_database_close(db);
+
+    pa_xfree(fn);
+}
+END_TEST
+
+START_TEST (database_crash_test) {
+    char *fn, *log;
+    pa_database *db;
+    pid_t pid;
+    int status, fd;
+    unsigned i;
+
+    fn = db_name("crash");
+    log = log_name("crash");
+
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    for (i = 0; i < 100; i++)
+        set_entry(db, i, i);
+    pa_database_close(db);
+
+    /* Modify it and die without syncing */
+    if ((pid = fork()) == 0) {
+        db = pa_database_open(fn, TRUE);
+
+        for (i = 0; i < 100; i++)
+            set_entry(db, i, i + 1000);
+        for (i = 100; i < 200; i++)
+            set_entry(db, i, i);
+        unset_entry(db, 0);
+
+        _exit(0);
+    }
+
+    fail_unless(pid > 0);
+    fail_unless(waitpid(pid, &status, 0) == pid);
+
+    /* And leave half a record behind */
+    fail_unless((fd = open(log, O_WRONLY|O_APPEND)) >= 0);
+    fail_unless(write(fd, "\x12\x34\x56\x78\x9a\xbc\xde\xf0\x10\x00", 10) == 10);
+    close(fd);
+
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    fail_unless(pa_database_size(db) == 199);
+    fail_unless(!has_entry(db, 0));
+
+    for (i = 1; i < 200; i++)
+        fail_unless(check_entry(db, i, i < 100 ? i + 1000 : i), "Entry %u is wrong", i);
+
+    set_entry(db, 0, 0);
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    fail_unless(pa_database_size(db) == 200);
+    fail_unless(check_entry(db, 0, 0));
+    pa_database_close(db);
+
+    pa_xfree(log);
+    pa_xfree(fn);
+}
+END_TEST
+
+/* Overwrites the slots of a clean index */
+static void scribble_index(const char *idx, uint8_t byte, size_t length) {
+    uint8_t buf[4096];
+    int fd;
+
+    /* Right after the header */
+    memset(buf, byte, sizeof(buf));
+    fail_unless(length <= sizeof(buf));
+    fail_unless((fd = open(idx, O_WRONLY)) >= 0);
+    fail_unless(pwrite(fd, buf, length, 48) == (ssize_t) length);
+    close(fd);
+}
+
+START_TEST (database_corrupt_index_test) {
+    char *fn, *idx;
+    pa_database *db;
+    unsigned i, k;
+
+    fn = db_name("corrupt");
+    idx = index_name("corrupt");
+
+    for (k = 0; k < 3; k++) {
+        fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+        for (i = 0; i < 100; i++)
+            set_entry(db, i, i + k);
+        pa_database_close(db);
+
+        switch (k) {
+            case 0:
+                /* Offsets way beyond the end of the log */
+                scribble_index(idx, 0xff, 4096);
+                break;
+            case 1:
+                /* Offsets inside the log, but not at the records the
+                 * slots claim */
+                scribble_index(idx, 0x01, 4096);
+                break;
+            case 2:
+                /* A single slot off by a few bytes */
+                scribble_index(idx, 0x00, 16);
+                break;
+        }
+
+        /* Rebuilt from the log instead of trusted */
+        fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+        fail_unless(pa_database_size(db) == 100);
+        for (i = 0; i < 100; i++)
+            fail_unless(check_entry(db, i, i + k), "Entry %u is wrong", i);
+        fail_unless(count_entries(db) == 100);
+        pa_database_close(db);
+
+        /* Read-only opening rebuilds into memory */
+        scribble_index(idx, 0xff, 4096);
+        fail_unless((db = pa_database_open(fn, FALSE)) != NULL);
+        fail_unless(pa_database_size(db) == 100);
+        fail_unless(check_entry(db, 99, 99 + k));
+        pa_database_close(db);
+    }
+
+    pa_xfree(idx);
+    pa_xfree(fn);
+}
+END_TEST
+
+START_TEST (database_compact_test) {
+    char *fn, *log;
+    pa_database *db;
+    unsigned i, round;
+    off_t size, max_size = 0;
+
+    fn = db_name("compact");
+    log = log_name("compact");
+
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+
+    /* The same few entries saved over and over again, like a restore
+     * module does when volumes change */
+    for (round = 0; round < 200; round++) {
+        for (i = 0; i < 50; i++)
+            set_entry(db, i, round * 50 + i);
+
+        fail_unless(pa_database_sync(db) == 0);
+
+        size = file_size(log);
+        max_size = PA_MAX(max_size, size);
+    }
+
+    fail_unless(max_size < 4 * 64 * 1024, "The log grew to %lu bytes", (unsigned long) max_size);
+
+    for (i = 0; i < 50; i++)
+        fail_unless(check_entry(db, i, 199 * 50 + i));
+
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(fn, FALSE)) != NULL);
+    fail_unless(pa_database_size(db) == 50);
+
+    for (i = 0; i < 50; i++)
+        fail_unless(check_entry(db, i, 199 * 50 + i));
+
+    pa_database_close(db);
+
+    pa_xfree(log);
+    pa_xfree(fn);
+}
+END_TEST
+
+START_TEST (database_perf_test) {
+    char *fn;
+    pa_database *db;
+    pa_usec_t start, set_usec, sync_usec, open_usec, get_usec, update_usec;
+    unsigned i;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    fn = db_name("perf");
+
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+
+    start = pa_rtclock_now();
+    for (i = 0; i < N_PERF_ENTRIES; i++)
+        set_entry(db, i, i);
+    set_usec = pa_rtclock_now() - start;
+
+    start = pa_rtclock_now();
+    pa_database_sync(db);
+    sync_usec = pa_rtclock_now() - start;
+
+    pa_database_close(db);
+
+    start = pa_rtclock_now();
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    open_usec = pa_rtclock_now() - start;
+
+    start = pa_rtclock_now();
+    for (i = 0; i < N_PERF_ENTRIES; i++)
+        fail_unless(check_entry(db, i, i));
+    get_usec = pa_rtclock_now() - start;
+
+    /* What a restore module does when one stream changes */
+    start = pa_rtclock_now();
+    set_entry(db, 42, 4242);
+    pa_database_sync(db);
+    update_usec = pa_rtclock_now() - start;
+
+    pa_database_close(db);
+
+    pa_log_debug("%u entries: set %llu usec, sync %llu usec, open %llu usec, get %llu usec, single update and sync %llu usec",
+                 N_PERF_ENTRIES, (unsigned long long) set_usec, (unsigned long long) sync_usec,
+                 (unsigned long long) open_usec, (unsigned long long) get_usec, (unsigned long long) update_usec);
+
+    pa_xfree(fn);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+    char template[] = "/tmp/database-mmap-test-XXXXXX";
+
+    fail_unless((dir = mkdtemp(template)) != NULL);
+
+    s = suite_create("Database");
+    tc = tcase_create("databasemmap");
+    tcase_add_test(tc, database_basic_test);
+    tcase_add_test(tc, database_crash_test);
+    tcase_add_test(tc, database_corrupt_index_test);
+    tcase_add_test(tc, database_compact_test);
+    tcase_add_test(tc, database_perf_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    remove_dir();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,351 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <fftw3.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <modules/equalizer-dsp.h>
+
+/* Runs the sliding STFT of module-equalizer-sink with its own DSP
+ * code, and, as a reference, the way it used to run one forward and
+ * one inverse transform per channel and hop */
+
+#define RATE 48000
+#define FFT_SIZE 65536
+#define MAX_CHANNELS 8
+
+struct stft {
+    unsigned channels, fft_size, R, window_size, overlap_size, stride;
+    pa_bool_t batched;
+
+    float *W, *H;
+    float *work_buffer;
+    fftwf_complex *spectrum;
+    float *overlap[MAX_CHANNELS];
+    fftwf_plan forward, inverse;
+};
+
+static struct stft *stft_new(unsigned channels, unsigned fft_size, unsigned R, pa_bool_t batched, pa_bool_t flat) {
+    struct stft *s;
+    unsigned c, j;
+
+    s = pa_xnew0(struct stft, 1);
+    s->channels = channels;
+    s->fft_size = fft_size;
+    s->R = R;
+    s->window_size = 2 * R - 1;
+    s->overlap_size = s->window_size - R;
+    s->stride = pa_equalizer_spectrum_stride(fft_size);
+    s->batched = batched;
+
+    s->W = pa_equalizer_alloc(s->window_size, sizeof(float));
+    pa_equalizer_hanning_window(s->W, s->window_size);
+
+    /* Some low shelf, or nothing at all, scaled for the unnormalized
+     * transforms */
+    s->H = pa_equalizer_alloc(fft_size / 2 + 1, sizeof(float));
+    for (j = 0; j < fft_size / 2 + 1; j++)
+        s->H[j] = (flat ? 1.0f : j < fft_size / 16 ? 2.0f : 0.5f) / fft_size;
+
+    s->work_buffer = pa_equalizer_alloc(fft_size * channels, sizeof(float));
+    s->spectrum = pa_equalizer_alloc(s->stride * channels, sizeof(fftwf_complex));
+
+    for (c = 0; c < channels; c++)
+        s->overlap[c] = pa_equalizer_alloc(s->overlap_size, sizeof(float));
+
+    if (batched) {
+        s->forward = pa_equalizer_plan_forward(fft_size, channels, s->work_buffer, s->spectrum);
+        s->inverse = pa_equalizer_plan_inverse(fft_size, channels, s->spectrum, s->work_buffer);
+    } else {
+        s->forward = fftwf_plan_dft_r2c_1d((int) fft_size, s->work_buffer, s->spectrum, FFTW_ESTIMATE);
+        s->inverse = fftwf_plan_dft_c2r_1d((int) fft_size, s->spectrum, s->work_buffer, FFTW_ESTIMATE);
+    }
+
+    return s;
+}
+
+static void stft_free(struct stft *s) {
+    unsigned c;
+
+    fftwf_destroy_plan(s->inverse);
+    fftwf_destroy_plan(s->forward);
+
+    for (c = 0; c < s->channels; c++)
+        fftwf_free(s->overlap[c]);
+
+    fftwf_free(s->spectrum);
+    fftwf_free(s->work_buffer);
+    fftwf_free(s->H);
+    fftwf_free(s->W);
+    pa_xfree(s);
+}
+
+static void interleave(struct stft *s, const float *dst, unsigned c, float *out) {
+    unsigned j;
+
+    for (j = 0; j < s->R; j++)
+        out[j * s->channels + c] = dst[j];
+}
+
+/* The reference, with plain loops */
+static void reference_hop(struct stft *s, float * const *src, float *out) {
+    unsigned c, j;
+
+    for (c = 0; c < s->channels; c++) {
+        float *dst = s->work_buffer;
+
+        for (j = 0; j < s->fft_size; j++)
+            dst[j] = j < s->window_size ? s->W[j] * src[c][j] : 0;
+
+        fftwf_execute_dft_r2c(s->forward, dst, s->spectrum);
+
+        for (j = 0; j < s->fft_size / 2 + 1; j++) {
+            s->spectrum[j][0] *= s->H[j];
+            s->spectrum[j][1] *= s->H[j];
+        }
+
+        fftwf_execute_dft_c2r(s->inverse, s->spectrum, dst);
+
+        for (j = 0; j < s->overlap_size; j++) {
+            dst[j] += s->overlap[c][j];
+            s->overlap[c][j] = dst[s->R + j];
+        }
+
+        interleave(s, dst, c, out);
+    }
+}
+
+/* What process_samples() of the module does */
+static void module_hop(struct stft *s, float * const *src, float *out) {
+    unsigned c;
+
+    for (c = 0; c < s->channels; c++)
+        pa_equalizer_window(s->work_buffer + c * s->fft_size, src[c], s->W, s->window_size, s->fft_size);
+
+    fftwf_execute(s->forward);
+
+    for (c = 0; c < s->channels; c++)
+        pa_equalizer_filter(s->spectrum + c * s->stride, s->H, 1.0f, s->fft_size);
+
+    fftwf_execute(s->inverse);
+
+    for (c = 0; c < s->channels; c++) {
+        float *dst = s->work_buffer + c * s->fft_size;
+
+        pa_equalizer_overlap_add(dst, s->overlap[c], s->overlap_size, s->R);
+        interleave(s, dst, c, out);
+    }
+}
+
+/* Produces R interleaved output frames from window_size frames of
+ * planar input, src[c] being the input of channel c */
+static void stft_hop(struct stft *s, float * const *src, float *out) {
+    if (s->batched)
+        module_hop(s, src, out);
+    else
+        reference_hop(s, src, out);
+}
+
+static float **random_input(unsigned channels, unsigned n) {
+    float **src;
+    unsigned c, j;
+
+    src = pa_xnew(float *, channels);
+    for (c = 0; c < channels; c++) {
+        src[c] = pa_equalizer_alloc(n, sizeof(float));
+        for (j = 0; j < n; j++)
+            src[c][j] = 2.0f * (rand() / (float) RAND_MAX - 0.5f);
+    }
+
+    return src;
+}
+
+static void free_input(float **src, unsigned channels) {
+    unsigned c;
+
+    for (c = 0; c < channels; c++)
+        fftwf_free(src[c]);
+    pa_xfree(src);
+}
+
+/* The module must give the same output as the reference */
+static void run_stft_test(unsigned channels, unsigned fft_size, unsigned R) {
+    const unsigned n_hops = 8;
+    struct stft *reference, *module;
+    float **src, *in[MAX_CHANNELS], *out_reference, *out_module;
+    unsigned c, h, j;
+
+    reference = stft_new(channels, fft_size, R, FALSE, FALSE);
+    module = stft_new(channels, fft_size, R, TRUE, FALSE);
+
+    src = random_input(channels, (n_hops + 1) * R);
+    out_reference = pa_xnew(float, R * channels);
+    out_module = pa_xnew(float, R * channels);
+
+    for (h = 0; h < n_hops; h++) {
+        for (c = 0; c < channels; c++)
+            in[c] = src[c] + h * R;
+
+        stft_hop(reference, in, out_reference);
+        stft_hop(module, in, out_module);
+
+        for (j = 0; j < R * channels; j++)
+            fail_unless(fabsf(out_reference[j] - out_module[j]) < 1e-5f,
+                        "%u channels, hop %u: sample %u differs: %f != %f",
+                        channels, R, j, out_reference[j], out_module[j]);
+    }
+
+    pa_xfree(out_module);
+    pa_xfree(out_reference);
+    free_input(src, channels);
+    stft_free(module);
+    stft_free(reference);
+}
+
+START_TEST (equalizer_batch_test) {
+    run_stft_test(1, 1024, 512);
+    run_stft_test(2, 1024, 256);
+    run_stft_test(6, 1024, 100);
+    run_stft_test(8, 512, 64);
+}
+END_TEST
+
+/* With a flat filter the windows add up to the input again, once the
+ * first hop has ramped in */
+static void run_flat_test(unsigned channels, unsigned fft_size, unsigned R) {
+    const unsigned n_hops = 8;
+    struct stft *module;
+    float **src, *in[MAX_CHANNELS], *out;
+    unsigned c, h, j;
+
+    module = stft_new(channels, fft_size, R, TRUE, TRUE);
+    src = random_input(channels, (n_hops + 1) * R);
+    out = pa_xnew(float, R * channels);
+
+    for (h = 0; h < n_hops; h++) {
+        for (c = 0; c < channels; c++)
+            in[c] = src[c] + h * R;
+
+        stft_hop(module, in, out);
+
+        if (h == 0)
+            continue;
+
+        for (c = 0; c < channels; c++)
+            for (j = 0; j < R; j++)
+                fail_unless(fabsf(out[j * channels + c] - src[c][h * R + j]) < 1e-3f,
+                            "%u channels, hop %u: sample %u of channel %u differs: %f != %f",
+                            channels, R, j, c, out[j * channels + c], src[c][h * R + j]);
+    }
+
+    pa_xfree(out);
+    free_input(src, channels);
+    stft_free(module);
+}
+
+START_TEST (equalizer_flat_test) {
+    run_flat_test(1, 1024, 512);
+    run_flat_test(2, 1024, 256);
+    run_flat_test(6, 1024, 100);
+}
+END_TEST
+
+/* CPU time per second of audio at the fft size the module uses at
+ * 48 kHz */
+static double run_stft_perf(unsigned channels, unsigned R, pa_bool_t batched) {
+    struct stft *s;
+    float **src, *out;
+    pa_usec_t start, stop;
+    unsigned h, n_hops;
+
+    s = stft_new(channels, FFT_SIZE, R, batched, FALSE);
+    src = random_input(channels, s->window_size);
+    out = pa_xnew(float, R * channels);
+
+    n_hops = (RATE + R - 1) / R;
+
+    start = pa_rtclock_now();
+    for (h = 0; h < n_hops; h++)
+        stft_hop(s, src, out);
+    stop = pa_rtclock_now();
+
+    pa_xfree(out);
+    free_input(src, channels);
+    stft_free(s);
+
+    return (double) (stop - start) * RATE / (n_hops * R);
+}
+
+START_TEST (equalizer_perf_test) {
+    static const unsigned channels[] = { 2, 6, 8 };
+    static const unsigned hops[] = { 8000, 1024, 256 };
+    unsigned i, k;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    for (i = 0; i < PA_ELEMENTSOF(channels); i++)
+        for (k = 0; k < PA_ELEMENTSOF(hops); k++) {
+            double reference_usec, module_usec;
+
+            reference_usec = run_stft_perf(channels[i], hops[k], FALSE);
+            module_usec = run_stft_perf(channels[i], hops[k], TRUE);
+
+            pa_log_debug("%u channels, hop size %u: per channel %.0f usec, module %.0f usec per second of audio (%.2fx)",
+                         channels[i], hops[k], reference_usec, module_usec, reference_usec / module_usec);
+        }
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Equalizer");
+    tc = tcase_create("equalizer");
+    tcase_add_test(tc, equalizer_batch_test);
+    tcase_add_test(tc, equalizer_flat_test);
+    tcase_add_test(tc, equalizer_perf_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
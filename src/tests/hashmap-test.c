@@ -0,0 +1,257 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_KEYS 5000
+
+/* Insert enough entries to make the table grow several times, remove
+ * most of them again so that it shrinks, and make sure that lookups
+ * and the insertion order survive all of that */
+START_TEST (hashmap_test) {
+    pa_hashmap *h;
+    char **keys;
+    const void *key;
+    void *state, *v;
+    unsigned i, n;
+
+    h = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    keys = pa_xnew(char *, N_KEYS);
+
+    for (i = 0; i < N_KEYS; i++) {
+        keys[i] = pa_sprintf_malloc("key-%u", i);
+        fail_unless(pa_hashmap_put(h, keys[i], PA_UINT_TO_PTR(i + 1)) == 0);
+    }
+
+    fail_unless(pa_hashmap_put(h, "key-17", NULL) < 0);
+    fail_unless(pa_hashmap_size(h) == N_KEYS);
+
+    for (i = 0; i < N_KEYS; i++)
+        fail_unless(pa_hashmap_get(h, keys[i]) == PA_UINT_TO_PTR(i + 1));
+
+    fail_unless(pa_hashmap_get(h, "no-such-key") == NULL);
+    fail_unless(pa_hashmap_first(h) == PA_UINT_TO_PTR(1));
+    fail_unless(pa_hashmap_last(h) == PA_UINT_TO_PTR(N_KEYS));
+
+    /* Remove all but every tenth entry */
+    for (i = 0; i < N_KEYS; i++)
+        if (i % 10 != 0)
+            fail_unless(pa_hashmap_remove(h, keys[i]) == PA_UINT_TO_PTR(i + 1));
+
+    fail_unless(pa_hashmap_size(h) == N_KEYS / 10);
+
+    for (i = 0; i < N_KEYS; i++)
+        fail_unless(pa_hashmap_get(h, keys[i]) == (i % 10 == 0 ? PA_UINT_TO_PTR(i + 1) : NULL));
+
+    n = 0;
+    PA_HASHMAP_FOREACH(v, h, state) {
+        fail_unless(v == PA_UINT_TO_PTR(n * 10 + 1));
+        n++;
+    }
+    fail_unless(n == N_KEYS / 10);
+
+    n = N_KEYS / 10;
+    for (state = NULL, v = pa_hashmap_iterate_backwards(h, &state, &key); v; v = pa_hashmap_iterate_backwards(h, &state, &key)) {
+        n--;
+        fail_unless(v == PA_UINT_TO_PTR(n * 10 + 1));
+        fail_unless(key == keys[n * 10]);
+    }
+    fail_unless(n == 0);
+
+    for (i = 0; i < N_KEYS / 10; i++)
+        fail_unless(pa_hashmap_steal_first(h) == PA_UINT_TO_PTR(i * 10 + 1));
+
+    fail_unless(pa_hashmap_isempty(h));
+    fail_unless(pa_hashmap_steal_first(h) == NULL);
+
+    pa_hashmap_free(h, NULL);
+
+    for (i = 0; i < N_KEYS; i++)
+        pa_xfree(keys[i]);
+    pa_xfree(keys);
+}
+END_TEST
+
+START_TEST (idxset_test) {
+    pa_idxset *s;
+    uint32_t idx;
+    void *v;
+    unsigned i, n;
+
+    s = pa_idxset_new(NULL, NULL);
+
+    for (i = 0; i < N_KEYS; i++) {
+        fail_unless(pa_idxset_put(s, PA_UINT_TO_PTR(i + 1), &idx) == 0);
+        fail_unless(idx == i);
+    }
+
+    fail_unless(pa_idxset_put(s, PA_UINT_TO_PTR(18), &idx) < 0);
+    fail_unless(idx == 17);
+
+    for (i = 0; i < N_KEYS; i++) {
+        fail_unless(pa_idxset_get_by_index(s, i) == PA_UINT_TO_PTR(i + 1));
+        fail_unless(pa_idxset_get_by_data(s, PA_UINT_TO_PTR(i + 1), &idx) == PA_UINT_TO_PTR(i + 1));
+        fail_unless(idx == i);
+    }
+
+    for (i = 0; i < N_KEYS; i++) {
+        if (i % 10 == 0)
+            continue;
+
+        if (i % 2)
+            fail_unless(pa_idxset_remove_by_index(s, i) == PA_UINT_TO_PTR(i + 1));
+        else
+            fail_unless(pa_idxset_remove_by_data(s, PA_UINT_TO_PTR(i + 1), NULL) == PA_UINT_TO_PTR(i + 1));
+    }
+
+    fail_unless(pa_idxset_size(s) == N_KEYS / 10);
+
+    for (i = 0; i < N_KEYS; i++) {
+        fail_unless(pa_idxset_get_by_index(s, i) == (i % 10 == 0 ? PA_UINT_TO_PTR(i + 1) : NULL));
+        fail_unless(pa_idxset_get_by_data(s, PA_UINT_TO_PTR(i + 1), NULL) == (i % 10 == 0 ? PA_UINT_TO_PTR(i + 1) : NULL));
+    }
+
+    n = 0;
+    PA_IDXSET_FOREACH(v, s, idx) {
+        fail_unless(idx == n * 10);
+        fail_unless(v == PA_UINT_TO_PTR(n * 10 + 1));
+        n++;
+    }
+    fail_unless(n == N_KEYS / 10);
+
+    /* pa_idxset_next() has to skip over removed indexes */
+    idx = 1;
+    fail_unless(pa_idxset_next(s, &idx) == PA_UINT_TO_PTR(11));
+    fail_unless(idx == 10);
+
+    fail_unless(pa_idxset_first(s, &idx) == PA_UINT_TO_PTR(1));
+    fail_unless(idx == 0);
+
+    for (i = 0; i < N_KEYS / 10; i++) {
+        fail_unless(pa_idxset_steal_first(s, &idx) == PA_UINT_TO_PTR(i * 10 + 1));
+        fail_unless(idx == i * 10);
+    }
+
+    fail_unless(pa_idxset_isempty(s));
+
+    pa_idxset_free(s, NULL);
+}
+END_TEST
+
+/* Time inserting, looking up and removing n string keys in a hashmap
+ * and n pointers in an idxset */
+static void run_perf(unsigned n) {
+    pa_hashmap *h;
+    pa_idxset *s;
+    char **keys;
+    pa_usec_t t0, t1, t2, t3;
+    unsigned i;
+
+    keys = pa_xnew(char *, n);
+    for (i = 0; i < n; i++)
+        keys[i] = pa_sprintf_malloc("/org/pulseaudio/core1/stream%u", i);
+
+    h = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+    t0 = pa_rtclock_now();
+    for (i = 0; i < n; i++)
+        pa_hashmap_put(h, keys[i], keys[i]);
+    t1 = pa_rtclock_now();
+    for (i = 0; i < n; i++)
+        fail_unless(pa_hashmap_get(h, keys[i]) == keys[i]);
+    t2 = pa_rtclock_now();
+    for (i = 0; i < n; i++)
+        pa_hashmap_remove(h, keys[i]);
+    t3 = pa_rtclock_now();
+
+    pa_log_debug("hashmap, %u keys: %.3f usec per put, %.3f per get, %.3f per remove",
+                 n, (double) (t1 - t0) / n, (double) (t2 - t1) / n, (double) (t3 - t2) / n);
+
+    pa_hashmap_free(h, NULL);
+
+    s = pa_idxset_new(NULL, NULL);
+
+    t0 = pa_rtclock_now();
+    for (i = 0; i < n; i++)
+        pa_idxset_put(s, keys[i], NULL);
+    t1 = pa_rtclock_now();
+    for (i = 0; i < n; i++)
+        fail_unless(pa_idxset_get_by_data(s, keys[i], NULL) == keys[i]);
+    t2 = pa_rtclock_now();
+    for (i = 0; i < n; i++)
+        pa_idxset_remove_by_data(s, keys[i], NULL);
+    t3 = pa_rtclock_now();
+
+    pa_log_debug("idxset, %u keys: %.3f usec per put, %.3f per get_by_data, %.3f per remove",
+                 n, (double) (t1 - t0) / n, (double) (t2 - t1) / n, (double) (t3 - t2) / n);
+
+    pa_idxset_free(s, NULL);
+
+    for (i = 0; i < n; i++)
+        pa_xfree(keys[i]);
+    pa_xfree(keys);
+}
+
+START_TEST (perf_test) {
+    unsigned n;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    for (n = 100; n <= 1000000; n *= 10)
+        run_perf(n);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Hashmap");
+    tc = tcase_create("hashmap");
+    tcase_add_test(tc, hashmap_test);
+    tcase_add_test(tc, idxset_test);
+    tcase_add_test(tc, perf_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,120 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <modules/ladspa-control.h>
+
+#define N_MAX 8
+
+START_TEST (ladspa_control_single_test) {
+    unsigned long n_control[] = { 3 };
+    double values[N_MAX];
+    pa_bool_t use_default[N_MAX];
+
+    fail_unless(pa_ladspa_parse_control_chain("1,,3", n_control, 1, values, use_default) == 0);
+    fail_unless(!use_default[0] && values[0] == 1.0);
+    fail_unless(use_default[1]);
+    fail_unless(!use_default[2] && values[2] == 3.0);
+
+    fail_unless(pa_ladspa_parse_control_chain("1,2,", n_control, 1, values, use_default) == 0);
+    fail_unless(!use_default[0] && !use_default[1] && use_default[2]);
+
+    fail_unless(pa_ladspa_parse_control_chain(NULL, n_control, 1, values, use_default) == 0);
+    fail_unless(use_default[0] && use_default[1] && use_default[2]);
+
+    fail_unless(pa_ladspa_parse_control_chain("", n_control, 1, values, use_default) == 0);
+    fail_unless(use_default[0] && use_default[1] && use_default[2]);
+
+    fail_unless(pa_ladspa_parse_control_chain("1,2", n_control, 1, values, use_default) < 0);
+    fail_unless(pa_ladspa_parse_control_chain("1,2,3,4", n_control, 1, values, use_default) < 0);
+    fail_unless(pa_ladspa_parse_control_chain("1,x,3", n_control, 1, values, use_default) < 0);
+}
+END_TEST
+
+START_TEST (ladspa_control_chain_test) {
+    unsigned long n_control[] = { 2, 0, 1 };
+    double values[N_MAX];
+    pa_bool_t use_default[N_MAX];
+
+    fail_unless(pa_ladspa_parse_control_chain("1,2||3", n_control, 3, values, use_default) == 0);
+    fail_unless(!use_default[0] && values[0] == 1.0);
+    fail_unless(!use_default[1] && values[1] == 2.0);
+    fail_unless(!use_default[2] && values[2] == 3.0);
+
+    /* Missing segments stand for the defaults */
+    fail_unless(pa_ladspa_parse_control_chain("1,2", n_control, 3, values, use_default) == 0);
+    fail_unless(!use_default[0] && !use_default[1]);
+    fail_unless(use_default[2]);
+
+    /* So do empty ones, also for plugins without controls */
+    fail_unless(pa_ladspa_parse_control_chain("||4", n_control, 3, values, use_default) == 0);
+    fail_unless(use_default[0] && use_default[1]);
+    fail_unless(!use_default[2] && values[2] == 4.0);
+
+    fail_unless(pa_ladspa_parse_control_chain("|", n_control, 3, values, use_default) == 0);
+    fail_unless(use_default[0] && use_default[1] && use_default[2]);
+
+    /* Values for a plugin without controls are an error */
+    fail_unless(pa_ladspa_parse_control_chain("1,2|5|3", n_control, 3, values, use_default) < 0);
+    fail_unless(pa_ladspa_parse_control_chain("|5", n_control, 3, values, use_default) < 0);
+}
+END_TEST
+
+START_TEST (ladspa_control_no_controls_test) {
+    unsigned long n_control[] = { 0, 0 };
+
+    fail_unless(pa_ladspa_parse_control_chain(NULL, n_control, 2, NULL, NULL) == 0);
+    fail_unless(pa_ladspa_parse_control_chain("|", n_control, 2, NULL, NULL) == 0);
+    fail_unless(pa_ladspa_parse_control_chain("|1", n_control, 2, NULL, NULL) < 0);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("LADSPA control");
+    tc = tcase_create("ladspacontrol");
+    tcase_add_test(tc, ladspa_control_single_test);
+    tcase_add_test(tc, ladspa_control_chain_test);
+    tcase_add_test(tc, ladspa_control_no_controls_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
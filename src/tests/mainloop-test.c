@@ -22,6 +22,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <sys/time.h>
 #include <assert.h>
@@ -29,9 +30,12 @@
 
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
 
 #include <pulsecore/core-util.h>
 #include <pulsecore/core-rtclock.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
 
 #ifdef GLIB_MAIN_LOOP
 
@@ -122,6 +126,294 @@ START_TEST (mainloop_test) {
 }
 END_TEST
 
+#ifndef GLIB_MAIN_LOOP
+
+#define N_EVENTS 10000
+#define N_ITERATIONS 1000
+
+static unsigned n_fired;
+static pa_usec_t last_fired;
+
+static void order_cb(pa_mainloop_api*a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    struct timeval ttv = *tv;
+    pa_usec_t t;
+
+    ttv.tv_usec &= ~PA_TIMEVAL_RTCLOCK;
+    t = pa_timeval_load(&ttv);
+
+    fail_unless(t >= last_fired, "time event for %llu fired after the one for %llu",
+                (unsigned long long) t, (unsigned long long) last_fired);
+    fail_unless(t <= pa_rtclock_now());
+
+    last_fired = t;
+    n_fired++;
+}
+
+static void set_rt(struct timeval *tv, pa_usec_t t) {
+    pa_timeval_rtstore(tv, t, TRUE);
+}
+
+/* Time events have to fire in order, and only while they are enabled */
+START_TEST (time_order_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    pa_time_event **e;
+    struct timeval tv;
+    pa_usec_t now;
+    unsigned i, n_expected = 0;
+
+    m = pa_mainloop_new();
+    a = pa_mainloop_get_api(m);
+
+    e = pa_xnew(pa_time_event*, N_EVENTS);
+    now = pa_rtclock_now();
+
+    for (i = 0; i < N_EVENTS; i++) {
+        set_rt(&tv, now + (pa_usec_t) (rand() % 50000));
+        e[i] = a->time_new(a, &tv, order_cb, NULL);
+    }
+
+    /* Free some, disable some, move some */
+    for (i = 0; i < N_EVENTS; i++) {
+        switch (i % 4) {
+            case 0:
+                a->time_free(e[i]);
+                e[i] = NULL;
+                break;
+
+            case 1:
+                a->time_restart(e[i], NULL);
+                break;
+
+            case 2:
+                set_rt(&tv, now + (pa_usec_t) (rand() % 100000));
+                a->time_restart(e[i], &tv);
+                n_expected++;
+                break;
+
+            default:
+                n_expected++;
+        }
+    }
+
+    n_fired = 0;
+    last_fired = 0;
+
+    while (n_fired < n_expected)
+        fail_unless(pa_mainloop_iterate(m, 1, NULL) >= 0);
+
+    /* Nothing left that could fire */
+    fail_unless(pa_mainloop_iterate(m, 0, NULL) == 0);
+    fail_unless(n_fired == n_expected);
+
+    for (i = 0; i < N_EVENTS; i++)
+        if (e[i])
+            a->time_free(e[i]);
+
+    pa_xfree(e);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+struct io_test {
+    int fds[2];
+    pa_io_event *event;
+    struct io_test *victim;
+    unsigned n_called;
+};
+
+static unsigned n_io_called;
+
+static void io_test_cb(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata) {
+    struct io_test *t = userdata;
+    char c;
+
+    fail_unless(e == t->event);
+    fail_unless(fd == t->fds[0]);
+    fail_unless(f & PA_IO_EVENT_INPUT);
+
+    pa_assert_se(read(fd, &c, 1) == 1);
+    t->n_called++;
+    n_io_called++;
+
+    /* Freeing another event from a callback must neither break the
+     * dispatching of the others nor make us dispatch the freed one */
+    if (t->victim) {
+        a->io_free(t->victim->event);
+        t->victim->event = NULL;
+        t->victim = NULL;
+    }
+}
+
+/* Io events are added to and removed from the poll set incrementally,
+ * so check that every callback still ends up with the right fd */
+START_TEST (io_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    struct io_test t[64];
+    unsigned i, n, round;
+
+    m = pa_mainloop_new();
+    a = pa_mainloop_get_api(m);
+
+    for (i = 0; i < PA_ELEMENTSOF(t); i++) {
+        pa_zero(t[i]);
+        fail_unless(pipe(t[i].fds) == 0);
+        t[i].event = a->io_new(a, t[i].fds[0], PA_IO_EVENT_INPUT, io_test_cb, &t[i]);
+    }
+
+    for (round = 0; round < 30; round++) {
+
+        /* Make every third one readable, and let some of those free
+         * their neighbour, which isn't readable */
+        n = 0;
+        for (i = 0; i < PA_ELEMENTSOF(t); i++) {
+            t[i].n_called = 0;
+
+            if ((i + round) % 3 != 0)
+                continue;
+
+            pa_assert_se(write(t[i].fds[1], "x", 1) == 1);
+            n++;
+
+            if ((i + round) % 5 == 0 && i + 1 < PA_ELEMENTSOF(t))
+                t[i].victim = &t[i + 1];
+        }
+
+        n_io_called = 0;
+        while (n_io_called < n)
+            fail_unless(pa_mainloop_iterate(m, 1, NULL) >= 0);
+
+        fail_unless(pa_mainloop_iterate(m, 0, NULL) == 0);
+
+        for (i = 0; i < PA_ELEMENTSOF(t); i++) {
+            fail_unless(t[i].n_called == ((i + round) % 3 == 0 ? 1U : 0U));
+            fail_unless(!t[i].victim);
+        }
+
+        /* Bring the freed ones back for the next round */
+        for (i = 0; i < PA_ELEMENTSOF(t); i++)
+            if (!t[i].event)
+                t[i].event = a->io_new(a, t[i].fds[0], PA_IO_EVENT_INPUT, io_test_cb, &t[i]);
+    }
+
+    for (i = 0; i < PA_ELEMENTSOF(t); i++) {
+        a->io_free(t[i].event);
+        pa_close_pipe(t[i].fds);
+    }
+
+    pa_mainloop_free(m);
+}
+END_TEST
+
+static void tick_cb(pa_mainloop_api*a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    n_fired++;
+}
+
+static void idle_io_cb(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata) {
+    fail_unless(FALSE, "idle io event dispatched");
+}
+
+static void idle_time_cb(pa_mainloop_api*a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    fail_unless(FALSE, "idle time event dispatched");
+}
+
+/* Report what a mainloop iteration costs with N_EVENTS pending timers
+ * and N_EVENTS io events, while a few of them are being restarted or
+ * recreated in every iteration, like a busy daemon would do */
+START_TEST (mainloop_perf_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    pa_time_event **te, *tick;
+    pa_io_event **ioe;
+    struct timeval tv;
+    int fds[2];
+    pa_usec_t start, stop, far;
+    unsigned i;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    m = pa_mainloop_new();
+    a = pa_mainloop_get_api(m);
+
+    far = pa_rtclock_now() + 3600 * PA_USEC_PER_SEC;
+
+    te = pa_xnew(pa_time_event*, N_EVENTS);
+
+    start = pa_rtclock_now();
+    for (i = 0; i < N_EVENTS; i++) {
+        set_rt(&tv, far + (pa_usec_t) (rand() % 1000000));
+        te[i] = a->time_new(a, &tv, idle_time_cb, NULL);
+    }
+    stop = pa_rtclock_now();
+    pa_log_debug("%u time events: %.3f usec per time_new", N_EVENTS, (double) (stop - start) / N_EVENTS);
+
+    tick = a->time_new(a, NULL, tick_cb, NULL);
+    n_fired = 0;
+
+    start = pa_rtclock_now();
+    for (i = 0; i < N_ITERATIONS; i++) {
+        set_rt(&tv, far + (pa_usec_t) (rand() % 1000000));
+        a->time_restart(te[rand() % N_EVENTS], &tv);
+
+        set_rt(&tv, pa_rtclock_now());
+        a->time_restart(tick, &tv);
+
+        fail_unless(pa_mainloop_iterate(m, 1, NULL) >= 0);
+    }
+    stop = pa_rtclock_now();
+
+    fail_unless(n_fired >= N_ITERATIONS);
+    pa_log_debug("%u time events: %.3f usec per iteration", N_EVENTS, (double) (stop - start) / N_ITERATIONS);
+
+    start = pa_rtclock_now();
+    for (i = 0; i < N_EVENTS; i++)
+        a->time_free(te[i]);
+    fail_unless(pa_mainloop_iterate(m, 0, NULL) >= 0);
+    stop = pa_rtclock_now();
+    pa_log_debug("%u time events: %.3f usec per time_free", N_EVENTS, (double) (stop - start) / N_EVENTS);
+
+    /* All io events share the read end of a pipe nothing is ever
+     * written to, so that we don't run out of fds */
+    fail_unless(pipe(fds) == 0);
+    ioe = pa_xnew(pa_io_event*, N_EVENTS);
+
+    for (i = 0; i < N_EVENTS; i++)
+        ioe[i] = a->io_new(a, fds[0], PA_IO_EVENT_INPUT, idle_io_cb, NULL);
+
+    n_fired = 0;
+
+    start = pa_rtclock_now();
+    for (i = 0; i < N_ITERATIONS; i++) {
+        unsigned k = (unsigned) rand() % N_EVENTS;
+
+        a->io_free(ioe[k]);
+        ioe[k] = a->io_new(a, fds[0], PA_IO_EVENT_INPUT, idle_io_cb, NULL);
+
+        set_rt(&tv, pa_rtclock_now());
+        a->time_restart(tick, &tv);
+
+        fail_unless(pa_mainloop_iterate(m, 1, NULL) >= 0);
+    }
+    stop = pa_rtclock_now();
+
+    fail_unless(n_fired >= N_ITERATIONS);
+    pa_log_debug("%u io events: %.3f usec per iteration", N_EVENTS, (double) (stop - start) / N_ITERATIONS);
+
+    for (i = 0; i < N_EVENTS; i++)
+        a->io_free(ioe[i]);
+    a->time_free(tick);
+
+    pa_close_pipe(fds);
+    pa_xfree(ioe);
+    pa_xfree(te);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+#endif /* GLIB_MAIN_LOOP */
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -131,6 +423,12 @@ int main(int argc, char *argv[]) {
     s = suite_create("MainLoop");
     tc = tcase_create("mainloop");
     tcase_add_test(tc, mainloop_test);
+#ifndef GLIB_MAIN_LOOP
+    tcase_add_test(tc, time_order_test);
+    tcase_add_test(tc, io_test);
+    tcase_add_test(tc, mainloop_perf_test);
+    tcase_set_timeout(tc, 120);
+#endif
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
@@ -22,6 +22,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <check.h>
@@ -76,17 +77,18 @@ START_TEST (memblock_test) {
     pa_memblock *mb_a, *mb_b, *mb_c;
     int r, i;
     pa_memblock* blocks[5];
+    pa_mem_type_t type;
     uint32_t id, shm_id;
     size_t offset, size;
     char *x;
 
     const char txt[] = "This is a test!";
 
-    pool_a = pa_mempool_new(TRUE, 0);
+    pool_a = pa_mempool_new(PA_MEM_TYPE_SHARED_POSIX, 0);
     fail_unless(pool_a != NULL);
-    pool_b = pa_mempool_new(TRUE, 0);
+    pool_b = pa_mempool_new(PA_MEM_TYPE_SHARED_POSIX, 0);
     fail_unless(pool_b != NULL);
-    pool_c = pa_mempool_new(TRUE, 0);
+    pool_c = pa_mempool_new(PA_MEM_TYPE_SHARED_POSIX, 0);
     fail_unless(pool_c != NULL);
 
     pa_mempool_get_shm_id(pool_a, &id_a);
@@ -124,22 +126,22 @@ START_TEST (memblock_test) {
         import_c = pa_memimport_new(pool_c, release_cb, (void*) "C");
         fail_unless(import_b != NULL);
 
-        r = pa_memexport_put(export_a, mb_a, &id, &shm_id, &offset, &size);
+        r = pa_memexport_put(export_a, mb_a, &type, &id, &shm_id, &offset, &size);
         fail_unless(r >= 0);
         fail_unless(shm_id == id_a);
 
         pa_log("A: Memory block exported as %u", id);
 
-        mb_b = pa_memimport_get(import_b, id, shm_id, offset, size);
+        mb_b = pa_memimport_get(import_b, type, id, shm_id, offset, size);
         fail_unless(mb_b != NULL);
-        r = pa_memexport_put(export_b, mb_b, &id, &shm_id, &offset, &size);
+        r = pa_memexport_put(export_b, mb_b, &type, &id, &shm_id, &offset, &size);
         fail_unless(r >= 0);
         fail_unless(shm_id == id_a || shm_id == id_b);
         pa_memblock_unref(mb_b);
 
         pa_log("B: Memory block exported as %u", id);
 
-        mb_c = pa_memimport_get(import_c, id, shm_id, offset, size);
+        mb_c = pa_memimport_get(import_c, type, id, shm_id, offset, size);
         fail_unless(mb_c != NULL);
         x = pa_memblock_acquire(mb_c);
         pa_log_debug("1 data=%s", x);
@@ -177,6 +179,164 @@ START_TEST (memblock_test) {
 }
 END_TEST
 
+/* Blocks go into the smallest slot they fit in, slot sizes that run
+ * out of space borrow from the larger ones, and vacuuming hands
+ * unused chunks back so they can be cut up differently */
+START_TEST (memblock_slot_class_test) {
+    pa_mempool *pool;
+    const pa_mempool_stat *stat;
+    pa_memblock **blocks, *b;
+    size_t small;
+    unsigned k, n;
+
+    pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0);
+    fail_unless(pool != NULL);
+    stat = pa_mempool_get_stat(pool);
+
+    for (k = 1; k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++)
+        fail_unless(pa_mempool_slot_class_size(pool, k) >= pa_mempool_slot_class_size(pool, k-1));
+
+    fail_unless(pa_mempool_block_size_max(pool) < pa_mempool_slot_class_size(pool, PA_MEMPOOL_SLOT_CLASSES_MAX-1));
+
+    /* Every size up to the largest slot size comes from the pool */
+    for (k = 0; k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++) {
+        size_t size = pa_mempool_slot_class_size(pool, k);
+
+        fail_unless((b = pa_memblock_new_pool(pool, size)) != NULL);
+        fail_unless(pa_atomic_load(&stat->n_used_slots_by_class[k]) == 1);
+        pa_memblock_unref(b);
+        fail_unless(pa_atomic_load(&stat->n_used_slots_by_class[k]) == 0);
+
+        fail_unless((b = pa_memblock_new_pool(pool, size / 2)) != NULL);
+        fail_unless(pa_atomic_load(&stat->n_used_slots_by_class[k]) == 1);
+        pa_memblock_unref(b);
+    }
+
+    fail_unless(pa_memblock_new_pool(pool, pa_mempool_slot_class_size(pool, PA_MEMPOOL_SLOT_CLASSES_MAX-1) + 1) == NULL);
+    fail_unless(pa_atomic_load(&stat->n_too_large_for_pool) == 1);
+
+    /* Fill up the smallest size and then some */
+    small = pa_mempool_slot_class_size(pool, 0);
+    blocks = pa_xnew(pa_memblock*, 2048);
+
+    for (k = 0; k < 2048; k++) {
+        fail_unless((blocks[k] = pa_memblock_new_pool(pool, small)) != NULL);
+        fail_unless(pa_memblock_get_length(blocks[k]) == small);
+    }
+
+    n = (unsigned) pa_atomic_load(&stat->n_used_slots_by_class[0]);
+    fail_unless(n > 0 && n < 2048);
+    fail_unless(pa_atomic_load(&stat->n_used_slots_by_class[1]) > 0);
+
+    for (k = 0; k < 2048; k++)
+        pa_memblock_unref(blocks[k]);
+    pa_xfree(blocks);
+
+    for (k = 0; k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++) {
+        fail_unless(pa_atomic_load(&stat->n_used_slots_by_class[k]) == 0);
+        fail_unless(pa_atomic_load(&stat->n_slots_by_class[k]) > 0);
+    }
+
+    /* Everything is free now, so all chunks go back */
+    b = pa_memblock_new_pool(pool, small);
+    pa_mempool_vacuum(pool);
+
+    fail_unless(pa_atomic_load(&stat->n_slots_by_class[0]) > 0);
+    for (k = 1; k < PA_MEMPOOL_SLOT_CLASSES_MAX; k++)
+        fail_unless(pa_atomic_load(&stat->n_slots_by_class[k]) == 0);
+
+    pa_memblock_unref(b);
+    pa_mempool_vacuum(pool);
+    fail_unless(pa_atomic_load(&stat->n_slots_by_class[0]) == 0);
+
+    /* ... and may be cut up again */
+    fail_unless((b = pa_memblock_new_pool(pool, pa_mempool_slot_class_size(pool, PA_MEMPOOL_SLOT_CLASSES_MAX-1))) != NULL);
+    pa_memblock_unref(b);
+
+    pa_mempool_free(pool);
+}
+END_TEST
+
+#ifdef HAVE_MEMFD
+/* A memfd pool can only be imported from after it was registered
+ * with its fd, and its blocks are copied when they are passed on to
+ * somebody else, who doesn't have the fd */
+START_TEST (memblock_memfd_test) {
+    pa_mempool *pool_a, *pool_b;
+    unsigned id_a, id_b;
+    pa_memexport *export_a, *export_b;
+    pa_memimport *import_b;
+    pa_memblock *mb_a, *mb_b, *mb_c;
+    pa_mem_type_t type;
+    uint32_t id, shm_id;
+    size_t offset, size;
+    char *x;
+
+    const char txt[] = "This is a test!";
+
+    pool_a = pa_mempool_new(PA_MEM_TYPE_SHARED_MEMFD, 0);
+    fail_unless(pool_a != NULL);
+    fail_unless(pa_mempool_is_memfd_backed(pool_a));
+    pool_b = pa_mempool_new(PA_MEM_TYPE_SHARED_POSIX, 0);
+    fail_unless(pool_b != NULL);
+    fail_unless(!pa_mempool_is_memfd_backed(pool_b));
+
+    pa_mempool_get_shm_id(pool_a, &id_a);
+    pa_mempool_get_shm_id(pool_b, &id_b);
+
+    mb_a = pa_memblock_new_pool(pool_a, sizeof(txt));
+    fail_unless(mb_a != NULL);
+    x = pa_memblock_acquire(mb_a);
+    snprintf(x, pa_memblock_get_length(mb_a), "%s", txt);
+    pa_memblock_release(mb_a);
+
+    export_a = pa_memexport_new(pool_a, revoke_cb, (void*) "A");
+    fail_unless(export_a != NULL);
+    export_b = pa_memexport_new(pool_b, revoke_cb, (void*) "B");
+    fail_unless(export_b != NULL);
+    import_b = pa_memimport_new(pool_b, release_cb, (void*) "B");
+    fail_unless(import_b != NULL);
+
+    fail_unless(pa_memexport_put(export_a, mb_a, &type, &id, &shm_id, &offset, &size) >= 0);
+    fail_unless(type == PA_MEM_TYPE_SHARED_MEMFD);
+    fail_unless(shm_id == id_a);
+
+    /* Not registered yet, and never attached by name */
+    fail_unless(pa_memimport_get(import_b, type, id, shm_id, offset, size) == NULL);
+    fail_unless(pa_memimport_get(import_b, PA_MEM_TYPE_SHARED_POSIX, id, shm_id, offset, size) == NULL);
+
+    fail_unless(pa_memimport_attach_memfd(import_b, id_a, pa_mempool_get_memfd_fd(pool_a)) == 0);
+    fail_unless(pa_memimport_attach_memfd(import_b, id_a, pa_mempool_get_memfd_fd(pool_a)) < 0);
+
+    mb_b = pa_memimport_get(import_b, type, id, shm_id, offset, size);
+    fail_unless(mb_b != NULL);
+    x = pa_memblock_acquire(mb_b);
+    fail_unless(strcmp(x, txt) == 0);
+    pa_memblock_release(mb_b);
+
+    /* Passing it on makes a copy in our own pool */
+    fail_unless(pa_memexport_put(export_b, mb_b, &type, &id, &shm_id, &offset, &size) >= 0);
+    fail_unless(type == PA_MEM_TYPE_SHARED_POSIX);
+    fail_unless(shm_id == id_b);
+    pa_memblock_unref(mb_b);
+
+    /* The segment stays attached without blocks, it couldn't be
+     * attached again */
+    mb_c = pa_memimport_get(import_b, PA_MEM_TYPE_SHARED_MEMFD, 4711, id_a, offset, sizeof(txt));
+    fail_unless(mb_c != NULL);
+    pa_memblock_unref(mb_c);
+
+    pa_memexport_free(export_b);
+    pa_memimport_free(import_b);
+    pa_memexport_free(export_a);
+    pa_memblock_unref(mb_a);
+
+    pa_mempool_free(pool_a);
+    pa_mempool_free(pool_b);
+}
+END_TEST
+#endif
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -189,6 +349,10 @@ int main(int argc, char *argv[]) {
     s = suite_create("Memblock");
     tc = tcase_create("memblock");
     tcase_add_test(tc, memblock_test);
+    tcase_add_test(tc, memblock_slot_class_test);
+#ifdef HAVE_MEMFD
+    tcase_add_test(tc, memblock_memfd_test);
+#endif
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
@@ -33,8 +33,12 @@
 #include <pulsecore/strbuf.h>
 #include <pulsecore/core-util.h>
 
+#include <pulse/rtclock.h>
 #include <pulse/xmalloc.h>
 
+#define N_CHUNKS 10000
+#define N_SEEKS 10000
+
 static const char *fixed[] = {
     "1122444411441144__22__11______3333______________________________",
     "__________________3333__________________________________________"
@@ -110,7 +114,7 @@ START_TEST (memblockq_test) {
 
     pa_log_set_level(PA_LOG_DEBUG);
 
-    p = pa_mempool_new(FALSE, 0);
+    p = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0);
 
     silence.memblock = pa_memblock_new_fixed(p, (char*) "__", 2, 1);
     fail_unless(silence.memblock != NULL);
@@ -214,6 +218,91 @@ START_TEST (memblockq_test) {
 }
 END_TEST
 
+/* Rewind and seek around in a queue with a lot of history, like the
+ * ones of sinks with a big rewind buffer */
+START_TEST (memblockq_seek_test) {
+    pa_mempool *p;
+    pa_memblockq *bq;
+    pa_memchunk chunk, out;
+    pa_usec_t start, stop;
+    size_t total;
+    unsigned i;
+    pa_sample_spec ss = {
+        .format = PA_SAMPLE_S16LE,
+        .rate = 48000,
+        .channels = 1
+    };
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    p = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0);
+
+    total = N_CHUNKS * 4;
+    bq = pa_memblockq_new("test memblockq", 0, 2 * total, total, &ss, 0, 4, total, NULL);
+    fail_unless(bq != NULL);
+
+    /* Chunks that can't be merged, so that we end up with one block for
+     * each of them */
+    chunk.memblock = pa_memblock_new_fixed(p, (char*) "12345678", 8, 1);
+    chunk.index = 0;
+    chunk.length = 4;
+
+    for (i = 0; i < N_CHUNKS; i++)
+        fail_unless(pa_memblockq_push(bq, &chunk) == 0);
+
+    fail_unless(pa_memblockq_get_nblocks(bq) == N_CHUNKS);
+
+    /* Play everything, it is all kept for rewinding */
+    pa_memblockq_drop(bq, total);
+    fail_unless(pa_memblockq_get_nblocks(bq) == N_CHUNKS);
+    fail_unless(pa_memblockq_peek(bq, &out) < 0);
+
+    srand(4711);
+
+    start = pa_rtclock_now();
+    for (i = 0; i < N_SEEKS; i++) {
+        size_t l = 4 * (1 + (size_t) rand() % N_CHUNKS);
+
+        pa_memblockq_rewind(bq, l);
+        fail_unless(pa_memblockq_peek(bq, &out) == 0);
+        fail_unless(out.memblock == chunk.memblock && out.index == 0 && out.length == 4);
+        pa_memblock_unref(out.memblock);
+        pa_memblockq_drop(bq, l);
+    }
+    stop = pa_rtclock_now();
+
+    pa_log_debug("Rewinding %u blocks: %.2f usec per rewind", N_CHUNKS, (double) (stop - start) / N_SEEKS);
+
+    /* Now overwrite some of the history, which splits the blocks
+     * around the write index */
+    pa_memblockq_rewind(bq, total);
+
+    start = pa_rtclock_now();
+    for (i = 0; i < N_SEEKS; i++) {
+        int64_t offset = 4 * (int64_t) ((size_t) rand() % N_CHUNKS) + 2;
+
+        pa_memblockq_seek(bq, offset, PA_SEEK_ABSOLUTE, TRUE);
+        chunk.index = 4;
+        fail_unless(pa_memblockq_push(bq, &chunk) == 0);
+        chunk.index = 0;
+    }
+    stop = pa_rtclock_now();
+
+    pa_log_debug("Seeking in %u blocks: %.2f usec per seek and write", pa_memblockq_get_nblocks(bq), (double) (stop - start) / N_SEEKS);
+
+    fail_unless(pa_memblockq_get_nblocks(bq) >= N_CHUNKS);
+
+    pa_memblockq_seek(bq, 0, PA_SEEK_RELATIVE_END, TRUE);
+    fail_unless(pa_memblockq_get_length(bq) >= total);
+
+    pa_memblockq_free(bq);
+    pa_memblock_unref(chunk.memblock);
+
+    pa_mempool_free(p);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -223,6 +312,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("Memblock Queue");
     tc = tcase_create("memblockq");
     tcase_add_test(tc, memblockq_test);
+    tcase_add_test(tc, memblockq_seek_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
@@ -26,14 +26,17 @@
 
 #include <check.h>
 
+#include <pulse/rtclock.h>
 #include <pulse/sample.h>
 #include <pulse/volume.h>
+#include <pulse/xmalloc.h>
 
 #include <pulsecore/macro.h>
 #include <pulsecore/endianmacros.h>
 #include <pulsecore/memblock.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/mix.h>
+#include <pulsecore/random.h>
 
 
 /* PA_SAMPLE_U8 */
@@ -408,7 +411,7 @@ START_TEST (mix_test) {
     if (!getenv("MAKE_CHECK"))
         pa_log_set_level(PA_LOG_DEBUG);
 
-    fail_unless((pool = pa_mempool_new(FALSE, 0)) != NULL, NULL);
+    fail_unless((pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0)) != NULL, NULL);
 
     a.channels = 1;
     a.rate = 44100;
@@ -466,6 +469,113 @@ START_TEST (mix_test) {
 }
 END_TEST
 
+/* Mixes many stereo streams, compares the result with a straightforward
+ * per-sample mix and reports how long pa_mix() takes per input */
+static void run_mix_streams_test(pa_mempool *pool, pa_sample_format_t format, unsigned nstreams) {
+    const unsigned nframes = 1024, times = 20;
+    pa_sample_spec ss;
+    pa_mix_info *m;
+    size_t length;
+    void *out;
+    pa_usec_t start, stop;
+    unsigned i, j, k;
+
+    ss.format = format;
+    ss.rate = 44100;
+    ss.channels = 2;
+    length = nframes * pa_frame_size(&ss);
+
+    m = pa_xnew0(pa_mix_info, nstreams);
+    out = pa_xmalloc(length);
+
+    for (i = 0; i < nstreams; i++) {
+        void *d = pa_xmalloc(length);
+
+        if (format == PA_SAMPLE_FLOAT32NE) {
+            for (k = 0; k < nframes * 2; k++)
+                ((float *) d)[k] = 2.0f * (rand()/(float) RAND_MAX - 0.5f);
+        } else
+            pa_random(d, length);
+
+        m[i].chunk.memblock = pa_memblock_new_fixed(pool, d, length, FALSE);
+        m[i].chunk.index = 0;
+        m[i].chunk.length = length;
+        m[i].userdata = d;
+
+        m[i].volume.channels = 2;
+        m[i].volume.values[0] = pa_sw_volume_from_linear(1.0 / nstreams + 0.25 * (i % 3));
+        m[i].volume.values[1] = pa_sw_volume_from_linear(0.5 / nstreams);
+    }
+
+    fail_unless(pa_mix(m, nstreams, out, length, &ss, NULL, FALSE) == length);
+
+    /* pa_mix() leaves the linear stream volumes in the info array */
+    for (k = 0; k < nframes * 2; k++) {
+        if (format == PA_SAMPLE_S16NE) {
+            int32_t sum = 0;
+
+            for (j = 0; j < nstreams; j++)
+                if (m[j].linear[k % 2].i > 0)
+                    sum += pa_mult_s16_volume(((int16_t *) m[j].userdata)[k], m[j].linear[k % 2].i);
+
+            fail_unless(((int16_t *) out)[k] == PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF));
+        } else if (format == PA_SAMPLE_S32NE) {
+            int64_t sum = 0;
+
+            for (j = 0; j < nstreams; j++)
+                if (m[j].linear[k % 2].i > 0)
+                    sum += (((int64_t) ((int32_t *) m[j].userdata)[k]) * m[j].linear[k % 2].i) >> 16;
+
+            fail_unless(((int32_t *) out)[k] == PA_CLAMP_UNLIKELY(sum, -0x80000000LL, 0x7FFFFFFFLL));
+        } else {
+            float sum = 0;
+
+            for (j = 0; j < nstreams; j++)
+                if (m[j].linear[k % 2].f > 0)
+                    sum += ((float *) m[j].userdata)[k] * m[j].linear[k % 2].f;
+
+            fail_unless(fabsf(((float *) out)[k] - sum) <= 1e-6f * nstreams);
+        }
+    }
+
+    start = pa_rtclock_now();
+    for (j = 0; j < times; j++)
+        pa_mix(m, nstreams, out, length, &ss, NULL, FALSE);
+    stop = pa_rtclock_now();
+
+    pa_log_debug("%s: %u streams, %u frames: %llu usec per mix, %.3f usec per stream",
+                 pa_sample_format_to_string(format), nstreams, nframes,
+                 (unsigned long long) (stop - start) / times,
+                 (double) (stop - start) / times / nstreams);
+
+    for (i = 0; i < nstreams; i++) {
+        pa_memblock_unref(m[i].chunk.memblock);
+        pa_xfree(m[i].userdata);
+    }
+
+    pa_xfree(m);
+    pa_xfree(out);
+}
+
+START_TEST (mix_streams_test) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_S32NE, PA_SAMPLE_FLOAT32NE };
+    static const unsigned nstreams[] = { 8, 32, 128, 512 };
+    pa_mempool *pool;
+    unsigned i, j;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    fail_unless((pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0)) != NULL, NULL);
+
+    for (i = 0; i < PA_ELEMENTSOF(formats); i++)
+        for (j = 0; j < PA_ELEMENTSOF(nstreams); j++)
+            run_mix_streams_test(pool, formats[i], nstreams[j]);
+
+    pa_mempool_free(pool);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -475,6 +585,8 @@ int main(int argc, char *argv[]) {
     s = suite_create("Mix");
     tc = tcase_create("mix");
     tcase_add_test(tc, mix_test);
+    tcase_add_test(tc, mix_streams_test);
+    tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
@@ -0,0 +1,311 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/creds.h>
+#include <pulsecore/iochannel.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/packet.h>
+#include <pulsecore/pstream.h>
+#include <pulsecore/socket.h>
+#include <pulsecore/srbchannel.h>
+
+#define N_STREAMS 64
+#define N_ROUNDS 200
+#define FD_EVERY 37
+
+static pa_mainloop *mainloop;
+static pa_mainloop_api *api;
+static pa_mempool *pool;
+static pa_pstream *writer, *reader;
+
+/* What the reader has seen so far */
+static size_t n_bytes[N_STREAMS];
+static unsigned n_packets;
+static unsigned n_fds;
+static pa_bool_t done;
+
+static uint8_t stream_byte(uint32_t channel, size_t pos) {
+    return (uint8_t) (channel * 31 + pos * 7 + pos / 253);
+}
+
+static size_t block_size(unsigned round, uint32_t channel) {
+    return 16 + (round * 13 + channel * 5) % 240;
+}
+
+/* A packet says which round it was sent in and whether a file
+ * descriptor came with it */
+static void send_packet(unsigned seq, int fd) {
+    pa_packet *packet;
+    uint32_t data[2];
+
+    data[0] = seq;
+    data[1] = fd >= 0;
+
+    packet = pa_packet_new(sizeof(data));
+    memcpy(packet->data, data, sizeof(data));
+
+#ifdef HAVE_CREDS
+    if (fd >= 0) {
+        pa_cmsg_ancil_data ancil;
+
+        pa_zero(ancil);
+        ancil.nfd = 1;
+        ancil.fds[0] = fd;
+
+        pa_pstream_send_packet(writer, packet, &ancil);
+    } else
+#endif
+        pa_pstream_send_packet(writer, packet, NULL);
+
+    pa_packet_unref(packet);
+}
+
+static void send_block(unsigned round, uint32_t channel, size_t *pos) {
+    pa_memchunk chunk;
+    uint8_t *d;
+    size_t i;
+
+    chunk.index = 0;
+    chunk.length = block_size(round, channel);
+    chunk.memblock = pa_memblock_new(pool, chunk.length);
+
+    d = pa_memblock_acquire(chunk.memblock);
+    for (i = 0; i < chunk.length; i++)
+        d[i] = stream_byte(channel, *pos + i);
+    pa_memblock_release(chunk.memblock);
+
+    pa_pstream_send_memblock(writer, channel, 0, PA_SEEK_RELATIVE, &chunk);
+    pa_memblock_unref(chunk.memblock);
+
+    *pos += chunk.length;
+}
+
+static void packet_cb(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
+    uint32_t data[2];
+
+    fail_unless(packet->length == sizeof(data));
+    memcpy(data, packet->data, sizeof(data));
+
+    fail_unless(data[0] == n_packets, "packet %u arrived as %u", data[0], n_packets);
+
+#ifdef HAVE_CREDS
+    /* The file descriptor has to come with the very packet it was sent
+     * with, however the frames were read */
+    if (data[1]) {
+        char c;
+
+        fail_unless(ancil_data && ancil_data->nfd == 1, "file descriptor of packet %u missing", data[0]);
+        fail_unless(pa_read(ancil_data->fds[0], &c, 1, NULL) == 1);
+        fail_unless(c == (char) data[0]);
+        n_fds++;
+    } else
+        fail_unless(!ancil_data || ancil_data->nfd == 0, "packet %u got a file descriptor", data[0]);
+#endif
+
+    n_packets++;
+}
+
+static void memblock_cb(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
+    const uint8_t *d;
+    size_t i;
+
+    fail_unless(channel < N_STREAMS);
+
+    /* A frame may come in several pieces */
+    d = (const uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index;
+    for (i = 0; i < chunk->length; i++)
+        fail_unless(d[i] == stream_byte(channel, n_bytes[channel] + i));
+    pa_memblock_release(chunk->memblock);
+
+    n_bytes[channel] += chunk->length;
+}
+
+static void drain_cb(pa_pstream *p, void *userdata) {
+    done = TRUE;
+}
+
+static void die_cb(pa_pstream *p, void *userdata) {
+    fail_unless(FALSE, "pstream died");
+}
+
+/* Many streams that each send a small block every round, with control
+ * packets in between, some of them with a file descriptor. With the ring
+ * buffer channel, these have to stay in order with the other packets
+ * although they still go over the socket. */
+static void run_small_streams(pa_bool_t use_srbchannel) {
+    int fds[2];
+    int pipes[N_ROUNDS / FD_EVERY + 1][2];
+    size_t sent[N_STREAMS];
+    unsigned round, n_pipes = 0, n_sent_fds = 0, i;
+    uint32_t channel;
+    pa_usec_t start, stop;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    mainloop = pa_mainloop_new();
+    api = pa_mainloop_get_api(mainloop);
+    fail_unless((pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0)) != NULL);
+
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    writer = pa_pstream_new(api, pa_iochannel_new(api, fds[0], fds[0]), pool);
+    reader = pa_pstream_new(api, pa_iochannel_new(api, fds[1], fds[1]), pool);
+
+    pa_pstream_set_receive_packet_callback(reader, packet_cb, NULL);
+    pa_pstream_set_receive_memblock_callback(reader, memblock_cb, NULL);
+    pa_pstream_set_die_callback(writer, die_cb, NULL);
+    pa_pstream_set_die_callback(reader, die_cb, NULL);
+
+    if (use_srbchannel) {
+        pa_srbchannel *srb;
+        pa_srbchannel_template t;
+
+        fail_unless((srb = pa_srbchannel_new(api, PA_MEM_TYPE_SHARED_POSIX)) != NULL);
+        pa_srbchannel_export(srb, &t);
+        t.readfd = dup(t.readfd);
+        t.writefd = dup(t.writefd);
+        if (t.memfd >= 0)
+            t.memfd = dup(t.memfd);
+
+        pa_pstream_set_srbchannel(reader, pa_srbchannel_new_from_template(api, &t));
+        pa_pstream_set_srbchannel(writer, srb);
+
+        /* They switch over once their send queues are empty */
+        fail_unless(pa_mainloop_iterate(mainloop, 0, NULL) >= 0);
+    }
+
+    memset(sent, 0, sizeof(sent));
+    memset(n_bytes, 0, sizeof(n_bytes));
+    n_packets = n_fds = 0;
+
+    start = pa_rtclock_now();
+
+    for (round = 0; round < N_ROUNDS; round++) {
+        int fd = -1;
+
+#ifdef HAVE_CREDS
+        if (round % FD_EVERY == FD_EVERY - 1) {
+            char c = (char) round;
+
+            fail_unless(pipe(pipes[n_pipes]) == 0);
+            fail_unless(pa_write(pipes[n_pipes][1], &c, 1, NULL) == 1);
+            fd = pipes[n_pipes++][0];
+            n_sent_fds++;
+        }
+#endif
+
+        send_packet(round, fd);
+
+        for (channel = 0; channel < N_STREAMS; channel++)
+            send_block(round, channel, &sent[channel]);
+
+        /* Let some of it go out before the rest is queued */
+        if (round % 10 == 0)
+            pa_mainloop_iterate(mainloop, 0, NULL);
+    }
+
+    done = !pa_pstream_is_pending(writer);
+    pa_pstream_set_drain_callback(writer, drain_cb, NULL);
+
+    while (!done)
+        fail_unless(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+
+    for (;;) {
+        for (channel = 0; channel < N_STREAMS; channel++)
+            if (n_bytes[channel] < sent[channel])
+                break;
+
+        if (channel >= N_STREAMS && n_packets == N_ROUNDS)
+            break;
+
+        fail_unless(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+    }
+
+    stop = pa_rtclock_now();
+
+    for (channel = 0; channel < N_STREAMS; channel++)
+        fail_unless(n_bytes[channel] == sent[channel]);
+    fail_unless(n_packets == N_ROUNDS);
+    fail_unless(n_fds == n_sent_fds);
+
+    pa_log_debug("%s: %u streams, %u frames in %llu usec, %.2f usec per frame",
+                 use_srbchannel ? "ring buffer" : "socket", N_STREAMS, N_ROUNDS * (N_STREAMS + 1), (unsigned long long) (stop - start),
+                 (double) (stop - start) / (N_ROUNDS * (N_STREAMS + 1)));
+
+    for (i = 0; i < n_pipes; i++) {
+        pa_close(pipes[i][0]);
+        pa_close(pipes[i][1]);
+    }
+
+    pa_pstream_unlink(writer);
+    pa_pstream_unref(writer);
+    pa_pstream_unlink(reader);
+    pa_pstream_unref(reader);
+
+    pa_mempool_free(pool);
+    pa_mainloop_free(mainloop);
+}
+
+START_TEST (pstream_small_streams_test) {
+    run_small_streams(FALSE);
+}
+END_TEST
+
+START_TEST (pstream_srbchannel_test) {
+    run_small_streams(TRUE);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("pstream");
+    tc = tcase_create("pstream");
+    tcase_add_test(tc, pstream_small_streams_test);
+    tcase_add_test(tc, pstream_srbchannel_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
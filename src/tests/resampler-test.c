@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <locale.h>
+#include <math.h>
 
 #include <pulse/pulseaudio.h>
 
@@ -39,6 +40,8 @@
 #include <pulsecore/memblock.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/cpu.h>
+#include <pulsecore/sconv.h>
 
 static void dump_block(const char *label, const pa_sample_spec *ss, const pa_memchunk *chunk) {
     void *d;
@@ -253,6 +256,197 @@ static pa_memblock* generate_block(pa_mempool *pool, const pa_sample_spec *ss) {
     return r;
 }
 
+/* Quality and throughput harness: a sine is resampled in chunks of
+ * CHUNK_FRAMES, the way a sink input would do it, and a sine of the same
+ * frequency is fitted to the output. Whatever is left over after
+ * subtracting that is noise and distortion. */
+
+#define CHUNK_FRAMES 1024
+
+struct quality {
+    double snr;
+    double usec_per_second;
+};
+
+static void fit_sine(const float *x, unsigned n, unsigned stride, double w, double *signal, double *noise) {
+    double a = 0, b = 0;
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        a += x[i * stride] * sin(w * i);
+        b += x[i * stride] * cos(w * i);
+    }
+
+    a *= 2.0 / n;
+    b *= 2.0 / n;
+
+    *signal = *noise = 0;
+
+    for (i = 0; i < n; i++) {
+        double y = a * sin(w * i) + b * cos(w * i);
+        double e = x[i * stride] - y;
+
+        *signal += y * y;
+        *noise += e * e;
+    }
+}
+
+static void run_quality(
+        pa_mempool *pool,
+        pa_resample_method_t method,
+        pa_resample_flags_t flags,
+        const pa_sample_spec *a,
+        const pa_sample_spec *b,
+        double freq,
+        unsigned seconds,
+        struct quality *q) {
+
+    pa_resampler *resampler;
+    pa_convert_func_t to_input, to_float;
+    pa_memblock *input;
+    float *f, *out;
+    size_t in_frames, out_frames, max_out_frames, done, skip;
+    pa_usec_t usec = 0;
+    double signal, noise;
+    unsigned i, c;
+    void *d;
+
+    pa_assert_se(resampler = pa_resampler_new(pool, a, NULL, b, NULL, method, flags));
+
+    /* -6 dB sine in every channel */
+    in_frames = (size_t) a->rate * seconds;
+    f = pa_xnew(float, in_frames * a->channels);
+
+    for (i = 0; i < in_frames; i++)
+        for (c = 0; c < a->channels; c++)
+            f[i * a->channels + c] = (float) (0.5 * sin(2 * M_PI * freq * i / a->rate));
+
+    pa_assert_se(to_input = pa_get_convert_from_float32ne_function(a->format));
+    pa_assert_se(to_float = pa_get_convert_to_float32ne_function(b->format));
+
+    input = pa_memblock_new(pool, in_frames * pa_frame_size(a));
+    d = pa_memblock_acquire(input);
+    to_input((unsigned) (in_frames * a->channels), f, d);
+    pa_memblock_release(input);
+    pa_xfree(f);
+
+    max_out_frames = pa_resampler_result(resampler, in_frames * pa_frame_size(a)) / pa_frame_size(b) + CHUNK_FRAMES;
+    out = pa_xnew(float, max_out_frames * b->channels);
+    out_frames = 0;
+
+    for (done = 0; done < in_frames; done += CHUNK_FRAMES) {
+        pa_memchunk i_chunk, o_chunk;
+        pa_usec_t t;
+
+        i_chunk.memblock = input;
+        i_chunk.index = done * pa_frame_size(a);
+        i_chunk.length = PA_MIN(in_frames - done, (size_t) CHUNK_FRAMES) * pa_frame_size(a);
+
+        t = pa_rtclock_now();
+        pa_resampler_run(resampler, &i_chunk, &o_chunk);
+        usec += pa_rtclock_now() - t;
+
+        if (!o_chunk.memblock)
+            continue;
+
+        pa_assert_se(out_frames + o_chunk.length / pa_frame_size(b) <= max_out_frames);
+
+        d = pa_memblock_acquire_chunk(&o_chunk);
+        to_float((unsigned) (o_chunk.length / pa_sample_size(b)), d, out + out_frames * b->channels);
+        pa_memblock_release(o_chunk.memblock);
+        pa_memblock_unref(o_chunk.memblock);
+
+        out_frames += o_chunk.length / pa_frame_size(b);
+    }
+
+    /* Skip the first 100ms to let the filters settle */
+    skip = b->rate / 10;
+    pa_assert_se(out_frames > 2 * skip);
+
+    fit_sine(out + skip * b->channels, (unsigned) (out_frames - skip), b->channels, 2 * M_PI * freq / b->rate, &signal, &noise);
+
+    q->snr = 10 * log10(signal / PA_MAX(noise, 1e-30));
+    q->usec_per_second = (double) usec / seconds;
+
+    pa_xfree(out);
+    pa_memblock_unref(input);
+    pa_resampler_free(resampler);
+}
+
+/* Print SNR at 1 kHz and 10 kHz and CPU time per second of audio for
+ * all resamplers that can change the rate */
+static void benchmark(pa_mempool *pool, const pa_sample_spec *a, const pa_sample_spec *b, unsigned seconds) {
+    pa_resample_method_t m;
+
+    printf("%d Hz %d ch (%s) -> %d Hz %d ch (%s)\n",
+           a->rate, a->channels, pa_sample_format_to_string(a->format),
+           b->rate, b->channels, pa_sample_format_to_string(b->format));
+    printf("%-24s %10s %10s %12s %12s\n", "method", "SNR 1k", "SNR 10k", "usec/s", "usec/s var");
+
+    for (m = 0; m < PA_RESAMPLER_MAX; m++) {
+        struct quality q1, q10, qv;
+        bool variable;
+
+        if (!pa_resample_method_supported(m) || m == PA_RESAMPLER_AUTO || m == PA_RESAMPLER_COPY || m == PA_RESAMPLER_PEAKS)
+            continue;
+
+        run_quality(pool, m, 0, a, b, 1000, seconds, &q1);
+        run_quality(pool, m, 0, a, b, 10000, 1, &q10);
+
+        /* ffmpeg can't do variable rate, pa_resampler_new() would pick
+         * another method */
+        if ((variable = (m != PA_RESAMPLER_FFMPEG)))
+            run_quality(pool, m, PA_RESAMPLER_VARIABLE_RATE, a, b, 1000, seconds, &qv);
+
+        printf("%-24s %7.1f dB %7.1f dB %12.0f ", pa_resample_method_to_string(m), q1.snr, q10.snr, q1.usec_per_second);
+
+        if (variable)
+            printf("%12.0f\n", qv.usec_per_second);
+        else
+            printf("%12s\n", "-");
+    }
+}
+
+/* The FIR resampler has to stay within a few dB of what its filters
+ * are designed for, in fixed and variable rate mode */
+static void check_fir_quality(pa_mempool *pool) {
+    static const struct {
+        uint32_t from, to;
+        pa_sample_format_t format;
+        pa_resample_method_t method;
+        double min_snr;
+    } tests[] = {
+        { 44100, 48000, PA_SAMPLE_FLOAT32NE, PA_RESAMPLER_FIR_BASE + 3, 75 },
+        { 48000, 44100, PA_SAMPLE_FLOAT32NE, PA_RESAMPLER_FIR_BASE + 3, 75 },
+        { 44100, 48000, PA_SAMPLE_S16NE, PA_RESAMPLER_FIR_BASE + 3, 75 },
+        { 8000, 44100, PA_SAMPLE_FLOAT32NE, PA_RESAMPLER_FIR_BASE + 3, 75 },
+        { 96000, 8000, PA_SAMPLE_FLOAT32NE, PA_RESAMPLER_FIR_BASE + 3, 75 },
+        { 44100, 48000, PA_SAMPLE_FLOAT32NE, PA_RESAMPLER_FIR_BASE + 10, 95 },
+        { 44100, 48000, PA_SAMPLE_FLOAT32NE, PA_RESAMPLER_FIR_BASE + 0, 30 },
+    };
+    unsigned i;
+
+    for (i = 0; i < PA_ELEMENTSOF(tests); i++) {
+        pa_sample_spec a, b;
+        struct quality q, qv;
+
+        a.format = b.format = tests[i].format;
+        a.channels = b.channels = 2;
+        a.rate = tests[i].from;
+        b.rate = tests[i].to;
+
+        run_quality(pool, tests[i].method, 0, &a, &b, 1000, 1, &q);
+        run_quality(pool, tests[i].method, PA_RESAMPLER_VARIABLE_RATE, &a, &b, 1000, 1, &qv);
+
+        pa_log_debug("%s, %u -> %u Hz %s: SNR %0.1f dB, %0.1f dB variable rate",
+                     pa_resample_method_to_string(tests[i].method), a.rate, b.rate,
+                     pa_sample_format_to_string(a.format), q.snr, qv.snr);
+
+        pa_assert_se(q.snr >= tests[i].min_snr);
+        pa_assert_se(qv.snr >= tests[i].min_snr);
+    }
+}
+
 static void help(const char *argv0) {
     printf(_("%s [options]\n\n"
              "-h, --help                            Show this help\n"
@@ -265,6 +459,7 @@ static void help(const char *argv0) {
              "      --to-channels=CHANNELS          To number of channels (defaults to 1)\n"
              "      --resample-method=METHOD        Resample method (defaults to auto)\n"
              "      --seconds=SECONDS               From stream duration (defaults to 60)\n"
+             "      --benchmark                     Measure SNR and CPU time of all resamplers\n"
              "\n"
              "If the formats are not specified, the test performs all formats combinations,\n"
              "back and forth.\n"
@@ -286,7 +481,8 @@ enum {
     ARG_TO_CHANNELS,
     ARG_SECONDS,
     ARG_RESAMPLE_METHOD,
-    ARG_DUMP_RESAMPLE_METHODS
+    ARG_DUMP_RESAMPLE_METHODS,
+    ARG_BENCHMARK
 };
 
 static void dump_resample_methods(void) {
@@ -302,7 +498,7 @@ int main(int argc, char *argv[]) {
     pa_mempool *pool = NULL;
     pa_sample_spec a, b;
     int ret = 1, c;
-    pa_bool_t all_formats = TRUE;
+    pa_bool_t all_formats = TRUE, run_benchmark = FALSE;
     pa_resample_method_t method;
     int seconds;
 
@@ -319,6 +515,7 @@ int main(int argc, char *argv[]) {
         {"seconds",               1, NULL, ARG_SECONDS},
         {"resample-method",       1, NULL, ARG_RESAMPLE_METHOD},
         {"dump-resample-methods", 0, NULL, ARG_DUMP_RESAMPLE_METHODS},
+        {"benchmark",             0, NULL, ARG_BENCHMARK},
         {NULL,                    0, NULL, 0}
     };
 
@@ -331,7 +528,7 @@ int main(int argc, char *argv[]) {
     if (!getenv("MAKE_CHECK"))
         pa_log_set_level(PA_LOG_INFO);
 
-    pa_assert_se(pool = pa_mempool_new(FALSE, 0));
+    pa_assert_se(pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0));
 
     a.channels = b.channels = 1;
     a.rate = b.rate = 44100;
@@ -392,6 +589,10 @@ int main(int argc, char *argv[]) {
                 seconds = atoi(optarg);
                 break;
 
+            case ARG_BENCHMARK:
+                run_benchmark = TRUE;
+                break;
+
             case ARG_RESAMPLE_METHOD:
                 if (*optarg == '\0' || pa_streq(optarg, "help")) {
                     dump_resample_methods();
@@ -407,7 +608,31 @@ int main(int argc, char *argv[]) {
     }
 
     ret = 0;
-    pa_assert_se(pool = pa_mempool_new(FALSE, 0));
+    pa_assert_se(pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0));
+
+    if (run_benchmark) {
+        pa_cpu_x86_flag_t x86_flags = 0;
+        pa_cpu_arm_flag_t arm_flags = 0;
+
+        /* Measure what the daemon would actually run */
+        pa_cpu_init_x86(&x86_flags);
+        pa_cpu_init_arm(&arm_flags);
+
+        a.channels = b.channels = 2;
+        a.format = b.format = PA_SAMPLE_S16NE;
+        a.rate = 44100;
+        b.rate = 48000;
+        benchmark(pool, &a, &b, seconds);
+
+        a.format = b.format = PA_SAMPLE_FLOAT32NE;
+        benchmark(pool, &a, &b, seconds);
+
+        a.rate = 48000;
+        b.rate = 44100;
+        benchmark(pool, &a, &b, seconds);
+
+        goto quit;
+    }
 
     if (!all_formats) {
 
@@ -473,6 +698,8 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    check_fir_quality(pool);
+
  quit:
     if (pool)
         pa_mempool_free(pool);
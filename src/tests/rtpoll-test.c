@@ -23,7 +23,16 @@
 
 #include <check.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
 #include <pulsecore/poll.h>
 #include <pulsecore/log.h>
 #include <pulsecore/rtpoll.h>
@@ -42,12 +51,12 @@ static int worker(pa_rtpoll_item *w) {
     return 0;
 }
 
-START_TEST (rtpoll_test) {
+static void run_rtpoll_test(pa_rtpoll_backend_t backend) {
     pa_rtpoll *p;
     pa_rtpoll_item *i, *w;
     struct pollfd *pollfd;
 
-    p = pa_rtpoll_new();
+    p = pa_rtpoll_new_with_backend(backend);
 
     i = pa_rtpoll_item_new(p, PA_RTPOLL_EARLY, 1);
     pa_rtpoll_item_set_before_callback(i, before);
@@ -82,6 +91,220 @@ START_TEST (rtpoll_test) {
 
     pa_rtpoll_free(p);
 }
+
+START_TEST (rtpoll_test) {
+    run_rtpoll_test(PA_RTPOLL_BACKEND_POLL);
+    run_rtpoll_test(PA_RTPOLL_BACKEND_EPOLL);
+}
+END_TEST
+
+#define N_PIPES 4
+
+static pa_rtpoll_item *pipe_item_new(pa_rtpoll *p, int fd, short events) {
+    pa_rtpoll_item *i;
+    struct pollfd *pollfd;
+
+    i = pa_rtpoll_item_new(p, PA_RTPOLL_NEVER, 1);
+
+    pollfd = pa_rtpoll_item_get_pollfd(i, NULL);
+    pollfd->fd = fd;
+    pollfd->events = events;
+
+    return i;
+}
+
+static short pipe_item_revents(pa_rtpoll_item *i) {
+    return pa_rtpoll_item_get_pollfd(i, NULL)->revents;
+}
+
+/* Both backends have to report the same readiness, follow changes of
+ * the pollfds between iterations and items coming and going */
+static void run_events_test(pa_rtpoll_backend_t backend) {
+    pa_rtpoll *p;
+    pa_rtpoll_item *items[N_PIPES];
+    int fds[N_PIPES][2];
+    unsigned k;
+    char c = 'x';
+    pa_usec_t start;
+
+    p = pa_rtpoll_new_with_backend(backend);
+
+    for (k = 0; k < N_PIPES; k++) {
+        fail_unless(pipe(fds[k]) == 0);
+        items[k] = pipe_item_new(p, fds[k][0], POLLIN);
+    }
+
+    /* Nothing to read, so the timer elapses */
+    pa_rtpoll_set_timer_relative(p, 20 * PA_USEC_PER_MSEC);
+    start = pa_rtclock_now();
+    fail_unless(pa_rtpoll_run(p, TRUE) > 0);
+    fail_unless(pa_rtpoll_timer_elapsed(p));
+    fail_unless(pa_rtclock_now() - start >= 20 * PA_USEC_PER_MSEC);
+
+    for (k = 0; k < N_PIPES; k++)
+        fail_unless(pipe_item_revents(items[k]) == 0);
+
+    /* A timer in the past elapses right away */
+    fail_unless(pa_rtpoll_run(p, TRUE) > 0);
+    fail_unless(pa_rtpoll_timer_elapsed(p));
+
+    pa_rtpoll_set_timer_relative(p, 10 * PA_USEC_PER_SEC);
+
+    fail_unless(write(fds[2][1], &c, 1) == 1);
+    fail_unless(pa_rtpoll_run(p, TRUE) > 0);
+    fail_unless(!pa_rtpoll_timer_elapsed(p));
+
+    for (k = 0; k < N_PIPES; k++)
+        fail_unless(pipe_item_revents(items[k]) == (k == 2 ? POLLIN : 0));
+
+    /* Level triggered: still readable until somebody reads */
+    fail_unless(pa_rtpoll_run(p, TRUE) > 0);
+    fail_unless(pipe_item_revents(items[2]) == POLLIN);
+
+    /* Not interested anymore */
+    pa_rtpoll_item_get_pollfd(items[2], NULL)->events = 0;
+    fail_unless(pa_rtpoll_run(p, FALSE) > 0);
+    fail_unless(pa_rtpoll_timer_elapsed(p));
+    fail_unless(pipe_item_revents(items[2]) == 0);
+
+    /* Wait for the write end of another pipe instead */
+    pa_rtpoll_item_get_pollfd(items[2], NULL)->fd = fds[3][1];
+    pa_rtpoll_item_get_pollfd(items[2], NULL)->events = POLLOUT;
+    fail_unless(pa_rtpoll_run(p, TRUE) > 0);
+    fail_unless(pipe_item_revents(items[2]) == POLLOUT);
+    fail_unless(pipe_item_revents(items[3]) == 0);
+
+    /* Remove an item in front of a ready one, the indexes shift */
+    pa_rtpoll_item_free(items[2]);
+    items[2] = NULL;
+    fail_unless(write(fds[3][1], &c, 1) == 1);
+    fail_unless(pa_rtpoll_run(p, TRUE) > 0);
+    fail_unless(pipe_item_revents(items[3]) == POLLIN);
+    fail_unless(pipe_item_revents(items[0]) == 0);
+
+    /* The other end went away */
+    pa_close(fds[1][1]);
+    fail_unless(pa_rtpoll_run(p, TRUE) > 0);
+    fail_unless(pipe_item_revents(items[1]) & POLLHUP);
+
+    for (k = 0; k < N_PIPES; k++) {
+        if (items[k])
+            pa_rtpoll_item_free(items[k]);
+
+        pa_close(fds[k][0]);
+        if (k != 1)
+            pa_close(fds[k][1]);
+    }
+
+    pa_rtpoll_free(p);
+}
+
+START_TEST (rtpoll_events_test) {
+    run_events_test(PA_RTPOLL_BACKEND_POLL);
+    run_events_test(PA_RTPOLL_BACKEND_EPOLL);
+}
+END_TEST
+
+/* The same fd can't be added to epoll twice, such a loop has to keep
+ * working with poll() */
+START_TEST (rtpoll_fallback_test) {
+    pa_rtpoll *p;
+    pa_rtpoll_item *a, *b;
+    int fds[2];
+    char c = 'x';
+
+    p = pa_rtpoll_new_with_backend(PA_RTPOLL_BACKEND_EPOLL);
+
+    fail_unless(pipe(fds) == 0);
+    a = pipe_item_new(p, fds[0], POLLIN);
+    b = pipe_item_new(p, fds[0], POLLIN);
+
+    fail_unless(write(fds[1], &c, 1) == 1);
+    fail_unless(pa_rtpoll_run(p, TRUE) > 0);
+    fail_unless(pipe_item_revents(a) == POLLIN);
+    fail_unless(pipe_item_revents(b) == POLLIN);
+    fail_unless(pa_rtpoll_get_backend(p) == PA_RTPOLL_BACKEND_POLL);
+
+    pa_rtpoll_item_free(a);
+    pa_rtpoll_item_free(b);
+    pa_rtpoll_free(p);
+
+    pa_close(fds[0]);
+    pa_close(fds[1]);
+}
+END_TEST
+
+#define PERIOD_USEC (1 * PA_USEC_PER_MSEC)
+#define N_WAKEUPS 500
+#define N_ITERATIONS 20000
+
+/* With n idle fds: how late does a periodic 1 ms timer wake us up, and
+ * how much CPU does an iteration cost that doesn't sleep? */
+static void run_perf(pa_rtpoll_backend_t backend, unsigned n) {
+    pa_rtpoll *p;
+    pa_rtpoll_item **items;
+    int *fds;
+    pa_usec_t next, now, cpu, jitter_sum = 0, jitter_max = 0;
+    unsigned k;
+
+    p = pa_rtpoll_new_with_backend(backend);
+    items = pa_xnew(pa_rtpoll_item*, n);
+    fds = pa_xnew(int, 2 * n);
+
+    for (k = 0; k < n; k++) {
+        fail_unless(pipe(fds + 2 * k) == 0);
+        items[k] = pipe_item_new(p, fds[2 * k], POLLIN);
+    }
+
+    next = pa_rtclock_now();
+
+    for (k = 0; k < N_WAKEUPS; k++) {
+        pa_usec_t late;
+
+        next += PERIOD_USEC;
+        pa_rtpoll_set_timer_absolute(p, next);
+        fail_unless(pa_rtpoll_run(p, TRUE) > 0);
+
+        now = pa_rtclock_now();
+        late = now > next ? now - next : 0;
+        jitter_sum += late;
+        jitter_max = PA_MAX(jitter_max, late);
+    }
+
+    pa_rtpoll_set_timer_disabled(p);
+
+    cpu = pa_thread_cpu_now();
+    for (k = 0; k < N_ITERATIONS; k++)
+        fail_unless(pa_rtpoll_run(p, FALSE) > 0);
+    cpu = pa_thread_cpu_now() - cpu;
+
+    pa_log_debug("%-5s %4u fds: wakeup late by %5.1f usec on average, %4llu usec at most; %6.2f usec CPU per iteration",
+                 pa_rtpoll_backend_to_string(pa_rtpoll_get_backend(p)), n,
+                 (double) jitter_sum / N_WAKEUPS, (unsigned long long) jitter_max,
+                 (double) cpu / N_ITERATIONS);
+
+    for (k = 0; k < n; k++) {
+        pa_rtpoll_item_free(items[k]);
+        pa_close(fds[2 * k]);
+        pa_close(fds[2 * k + 1]);
+    }
+
+    pa_xfree(fds);
+    pa_xfree(items);
+    pa_rtpoll_free(p);
+}
+
+START_TEST (rtpoll_perf_test) {
+    unsigned n;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    for (n = 1; n <= 256; n *= 4) {
+        run_perf(PA_RTPOLL_BACKEND_POLL, n);
+        run_perf(PA_RTPOLL_BACKEND_EPOLL, n);
+    }
+}
 END_TEST
 
 int main(int argc, char *argv[]) {
@@ -93,6 +316,9 @@ int main(int argc, char *argv[]) {
     s = suite_create("RT Poll");
     tc = tcase_create("rtpoll");
     tcase_add_test(tc, rtpoll_test);
+    tcase_add_test(tc, rtpoll_events_test);
+    tcase_add_test(tc, rtpoll_fallback_test);
+    tcase_add_test(tc, rtpoll_perf_test);
     /* the default timeout is too small,
      * set it to a reasonable large one.
      */
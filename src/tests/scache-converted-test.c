@@ -0,0 +1,240 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/scache-converted.h>
+
+#define N_FRAMES 4410
+
+static char *dir = NULL;
+static int16_t data[2 * N_FRAMES];
+
+static void init_params(pa_scache_converted_params *p, const char *filename, uint32_t rate) {
+    pa_zero(*p);
+    p->filename = filename;
+    p->mtime = 1234567890;
+    p->size = 88244;
+    p->resample_method = PA_RESAMPLER_SPEEX_FLOAT_BASE + 1;
+    p->resample_flags = 0;
+    p->sample_spec.format = PA_SAMPLE_S16NE;
+    p->sample_spec.rate = rate;
+    p->sample_spec.channels = 2;
+    pa_channel_map_init_stereo(&p->channel_map);
+}
+
+static char *save(const pa_scache_converted_params *p) {
+    pa_sample_spec ss;
+    pa_channel_map map;
+    char *path;
+
+    ss.format = PA_SAMPLE_S16LE;
+    ss.rate = 22050;
+    ss.channels = 1;
+    pa_channel_map_init_mono(&map);
+
+    fail_unless((path = pa_scache_converted_path(dir, p)) != NULL);
+    fail_unless(pa_scache_converted_save(path, p, &ss, &map, data, sizeof(data)) == 0);
+
+    return path;
+}
+
+/* Whether a file for these parameters can be loaded */
+static pa_bool_t loads(const char *path, const pa_scache_converted_params *p) {
+    pa_scache_converted_map m;
+
+    if (pa_scache_converted_load(path, p, &m) < 0)
+        return FALSE;
+
+    pa_scache_converted_unmap(&m);
+    return TRUE;
+}
+
+START_TEST (converted_load_test) {
+    pa_scache_converted_params p;
+    pa_scache_converted_map m;
+    char *path;
+
+    init_params(&p, "/usr/share/sounds/bell.ogg", 44100);
+    path = save(&p);
+
+    fail_unless(pa_scache_converted_load(path, &p, &m) == 0);
+    fail_unless(m.length == sizeof(data));
+    fail_unless(memcmp(m.data, data, sizeof(data)) == 0);
+    fail_unless(((uintptr_t) m.data % sizeof(void*)) == 0);
+    fail_unless(m.source_sample_spec.format == PA_SAMPLE_S16LE);
+    fail_unless(m.source_sample_spec.rate == 22050);
+    fail_unless(m.source_sample_spec.channels == 1);
+    fail_unless(m.source_channel_map.channels == 1);
+    pa_scache_converted_unmap(&m);
+    fail_unless(m.map == NULL);
+
+    /* It's still there, and can be loaded again */
+    fail_unless(loads(path, &p));
+
+    fail_unless(unlink(path) == 0);
+    fail_unless(!loads(path, &p));
+
+    pa_xfree(path);
+}
+END_TEST
+
+START_TEST (converted_invalid_test) {
+    pa_scache_converted_params p, q;
+    char *path;
+    FILE *f;
+
+    init_params(&p, "/usr/share/sounds/bell.ogg", 44100);
+
+    /* Whatever changed, the file is not used and removed */
+    path = save(&p);
+    q = p;
+    q.mtime++;
+    fail_unless(!loads(path, &q));
+    fail_unless(access(path, F_OK) < 0);
+    pa_xfree(path);
+
+    path = save(&p);
+    q = p;
+    q.size--;
+    fail_unless(!loads(path, &q));
+    fail_unless(access(path, F_OK) < 0);
+    pa_xfree(path);
+
+    path = save(&p);
+    q = p;
+    q.resample_method = PA_RESAMPLER_TRIVIAL;
+    fail_unless(!loads(path, &q));
+    fail_unless(access(path, F_OK) < 0);
+    pa_xfree(path);
+
+    path = save(&p);
+    q = p;
+    q.resample_flags = PA_RESAMPLER_NO_REMIX;
+    fail_unless(!loads(path, &q));
+    fail_unless(access(path, F_OK) < 0);
+    pa_xfree(path);
+
+    path = save(&p);
+    q = p;
+    q.sample_spec.rate = 48000;
+    fail_unless(!loads(path, &q));
+    fail_unless(access(path, F_OK) < 0);
+    pa_xfree(path);
+
+    /* Same hash, other file */
+    path = save(&p);
+    q = p;
+    q.filename = "/usr/share/sounds/bell.wav";
+    fail_unless(!loads(path, &q));
+    fail_unless(access(path, F_OK) < 0);
+    pa_xfree(path);
+
+    /* Cut off in the middle of the data */
+    path = save(&p);
+    fail_unless(truncate(path, 1024) == 0);
+    fail_unless(!loads(path, &p));
+    fail_unless(access(path, F_OK) < 0);
+    pa_xfree(path);
+
+    /* Not even a header */
+    path = save(&p);
+    fail_unless((f = fopen(path, "w")) != NULL);
+    fputs("PASCONV1", f);
+    fclose(f);
+    fail_unless(!loads(path, &p));
+    fail_unless(access(path, F_OK) < 0);
+    pa_xfree(path);
+}
+END_TEST
+
+START_TEST (converted_prune_test) {
+    pa_scache_converted_params p, q, r;
+    char *p_path, *q_path, *r_path;
+
+    init_params(&p, "/usr/share/sounds/bell.ogg", 44100);
+    init_params(&q, "/usr/share/sounds/bell.ogg", 48000);
+    init_params(&r, "/usr/share/sounds/click.ogg", 44100);
+
+    p_path = save(&p);
+    q_path = save(&q);
+    r_path = save(&r);
+
+    fail_unless(!pa_streq(p_path, q_path));
+
+    pa_scache_converted_prune(dir, p.filename);
+
+    fail_unless(access(p_path, F_OK) < 0);
+    fail_unless(access(q_path, F_OK) < 0);
+    fail_unless(loads(r_path, &r));
+
+    pa_scache_converted_prune(dir, r.filename);
+    fail_unless(access(r_path, F_OK) < 0);
+
+    pa_xfree(p_path);
+    pa_xfree(q_path);
+    pa_xfree(r_path);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+    char template[] = "/tmp/scache-converted-test-XXXXXX";
+    unsigned i;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    fail_unless((dir = mkdtemp(template)) != NULL);
+
+    for (i = 0; i < PA_ELEMENTSOF(data); i++)
+        data[i] = (int16_t) (i * 7);
+
+    s = suite_create("Sample cache files");
+    tc = tcase_create("scacheconverted");
+    tcase_add_test(tc, converted_load_test);
+    tcase_add_test(tc, converted_invalid_test);
+    tcase_add_test(tc, converted_prune_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    rmdir(dir);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
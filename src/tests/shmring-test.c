@@ -0,0 +1,223 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/shmring.h>
+#include <pulsecore/thread.h>
+
+#define DATA_SIZE (4*1024*1024)
+#define FRAME_SIZE 6
+
+struct transfer {
+    pa_shmring *writer, *reader;
+    uint8_t *data;
+};
+
+/* Writes in pieces of varying size, like a client pushing whatever
+ * fits */
+static void writer_thread(void *userdata) {
+    struct transfer *t = userdata;
+    size_t written = 0, n = 0;
+
+    while (written < DATA_SIZE) {
+        size_t l = PA_MIN((n++ % 37 + 1) * FRAME_SIZE, DATA_SIZE - written);
+
+        l = PA_MIN(l, pa_shmring_writable(t->writer) / FRAME_SIZE * FRAME_SIZE);
+
+        if (l == 0) {
+            pa_thread_yield();
+            continue;
+        }
+
+        fail_unless(pa_shmring_write(t->writer, t->data + written, l) == l);
+        written += l;
+    }
+}
+
+static void run_transfer(pa_mem_type_t type) {
+    struct transfer t;
+    pa_thread *thread;
+    size_t read = 0, i;
+
+    fail_unless((t.writer = pa_shmring_new(type, 1000, FRAME_SIZE)) != NULL);
+    fail_unless(pa_shmring_get_capacity(t.writer) == 996);
+
+    fail_unless((t.reader = pa_shmring_attach(type, pa_shmring_get_shm_id(t.writer), pa_shmring_get_memfd(t.writer))) != NULL);
+    fail_unless(pa_shmring_get_capacity(t.reader) == 996);
+
+    t.data = pa_xmalloc(DATA_SIZE);
+    for (i = 0; i < DATA_SIZE; i++)
+        t.data[i] = (uint8_t) (i * 7 + i / 256);
+
+    fail_unless((thread = pa_thread_new("shmring-writer", writer_thread, &t)) != NULL);
+
+    while (read < DATA_SIZE) {
+        const void *p;
+        size_t l = 100;
+
+        p = pa_shmring_peek(t.reader, &l);
+
+        if (l == 0) {
+            pa_thread_yield();
+            continue;
+        }
+
+        fail_unless(memcmp(p, t.data + read, l) == 0);
+        pa_shmring_drop(t.reader, l);
+        read += l;
+    }
+
+    pa_thread_free(thread);
+
+    fail_unless(pa_shmring_readable(t.reader) == 0);
+    fail_unless(pa_shmring_writable(t.writer) == 996);
+
+    pa_shmring_free(t.reader);
+    pa_shmring_free(t.writer);
+    pa_xfree(t.data);
+}
+
+START_TEST (shmring_transfer_test) {
+    run_transfer(PA_MEM_TYPE_SHARED_POSIX);
+#ifdef HAVE_MEMFD
+    run_transfer(PA_MEM_TYPE_SHARED_MEMFD);
+#endif
+}
+END_TEST
+
+/* The fill level is the first thing in the segment, before the ring
+ * at the next aligned offset after the header */
+static pa_atomic_t *ring_count(pa_shmring *r) {
+    size_t l = 0;
+
+    return (pa_atomic_t*) ((uint8_t*) pa_shmring_peek(r, &l) - PA_ALIGN(sizeof(pa_atomic_t) + 2 * sizeof(int)));
+}
+
+/* A peer that scribbles over the shared counter must not make us read
+ * or write outside of the ring */
+START_TEST (shmring_untrusted_test) {
+    pa_shmring *r;
+    pa_atomic_t *count;
+    const void *p;
+    size_t l;
+
+    fail_unless((r = pa_shmring_new(PA_MEM_TYPE_SHARED_POSIX, 4096, 4)) != NULL);
+    count = ring_count(r);
+
+    pa_atomic_store(count, 1 << 30);
+    fail_unless(pa_shmring_readable(r) == 4096);
+    fail_unless(pa_shmring_writable(r) == 0);
+    fail_unless(pa_shmring_write(r, "abcd", 4) == 0);
+
+    l = (size_t) -1;
+    p = pa_shmring_peek(r, &l);
+    fail_unless(p != NULL && l == 4096);
+
+    pa_atomic_store(count, -5);
+    fail_unless(pa_shmring_readable(r) == 0);
+    fail_unless(pa_shmring_writable(r) == 4096);
+
+    l = 100;
+    pa_shmring_peek(r, &l);
+    fail_unless(l == 0);
+
+    pa_shmring_free(r);
+}
+END_TEST
+
+/* Flushing drops everything that can be read, also if it wraps around
+ * the end of the ring, and also if the peer claims the ring is full */
+START_TEST (shmring_drop_wrapped_test) {
+    pa_shmring *r;
+    pa_atomic_t *count;
+    uint8_t buf[3000];
+    const void *p;
+    size_t l;
+
+    fail_unless((r = pa_shmring_new(PA_MEM_TYPE_SHARED_POSIX, 4096, 4)) != NULL);
+    count = ring_count(r);
+    memset(buf, 'x', sizeof(buf));
+
+    fail_unless(pa_shmring_write(r, buf, 3000) == 3000);
+    pa_shmring_drop(r, 3000);
+
+    /* 1096 bytes up to the end, 904 from the start */
+    fail_unless(pa_shmring_write(r, buf, 2000) == 2000);
+    fail_unless(pa_shmring_readable(r) == 2000);
+
+    pa_shmring_drop(r, pa_shmring_readable(r));
+    fail_unless(pa_shmring_readable(r) == 0);
+
+    l = (size_t) -1;
+    pa_shmring_peek(r, &l);
+    fail_unless(l == 0);
+
+    pa_atomic_store(count, 4096);
+    pa_shmring_drop(r, pa_shmring_readable(r));
+    fail_unless(pa_shmring_readable(r) == 0);
+
+    /* We're back where we were, in the middle of the ring */
+    fail_unless(pa_shmring_write(r, "abcd", 4) == 4);
+    l = (size_t) -1;
+    p = pa_shmring_peek(r, &l);
+    fail_unless(l == 4 && memcmp(p, "abcd", 4) == 0);
+
+    /* More than there is */
+    pa_shmring_drop(r, 100);
+    fail_unless(pa_shmring_readable(r) == 0);
+
+    pa_shmring_free(r);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Shared memory ring");
+    tc = tcase_create("shmring");
+    tcase_add_test(tc, shmring_transfer_test);
+    tcase_add_test(tc, shmring_untrusted_test);
+    tcase_add_test(tc, shmring_drop_wrapped_test);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
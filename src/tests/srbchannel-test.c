@@ -0,0 +1,356 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/iochannel.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/packet.h>
+#include <pulsecore/pstream.h>
+#include <pulsecore/socket.h>
+#include <pulsecore/srbchannel.h>
+
+#define N_PACKETS 2500
+#define N_ROUNDTRIPS 20000
+
+static pa_mainloop *mainloop;
+static pa_mainloop_api *api;
+static pa_bool_t done;
+
+static void run_until_done(void) {
+    done = FALSE;
+
+    while (!done)
+        fail_unless(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+}
+
+/* Opens the peer end of a fresh channel, the way libpulse does it
+ * with the file descriptors it got over the socket */
+static pa_srbchannel *open_peer(pa_srbchannel *sr) {
+    pa_srbchannel_template t;
+
+    pa_srbchannel_export(sr, &t);
+    t.readfd = dup(t.readfd);
+    t.writefd = dup(t.writefd);
+    if (t.memfd >= 0)
+        t.memfd = dup(t.memfd);
+
+    return pa_srbchannel_new_from_template(api, &t);
+}
+
+/* Raw channel: push more data than fits into the ring buffer through it
+ * and check that it arrives in order */
+struct raw {
+    pa_srbchannel *writer, *reader;
+    uint8_t *data;
+    size_t size, written, read;
+};
+
+static pa_bool_t raw_writer_cb(pa_srbchannel *sr, void *userdata) {
+    struct raw *r = userdata;
+
+    r->written += pa_srbchannel_write(sr, r->data + r->written, r->size - r->written);
+
+    return TRUE;
+}
+
+static pa_bool_t raw_reader_cb(pa_srbchannel *sr, void *userdata) {
+    struct raw *r = userdata;
+    uint8_t buf[1000];
+    size_t n;
+
+    while ((n = pa_srbchannel_read(sr, buf, PA_MIN(sizeof(buf), r->size - r->read))) > 0) {
+        fail_unless(memcmp(buf, r->data + r->read, n) == 0);
+        r->read += n;
+    }
+
+    if (r->read == r->size)
+        done = TRUE;
+
+    return TRUE;
+}
+
+static void run_raw(pa_mem_type_t type) {
+    struct raw r;
+    size_t i;
+
+    mainloop = pa_mainloop_new();
+    api = pa_mainloop_get_api(mainloop);
+
+    pa_zero(r);
+    fail_unless((r.writer = pa_srbchannel_new(api, type)) != NULL);
+    fail_unless((r.reader = open_peer(r.writer)) != NULL);
+
+    r.size = 1000 * 1000;
+    r.data = pa_xmalloc(r.size);
+    for (i = 0; i < r.size; i++)
+        r.data[i] = (uint8_t) (i * 7 + i / 256);
+
+    pa_srbchannel_set_callback(r.writer, raw_writer_cb, &r);
+    pa_srbchannel_set_callback(r.reader, raw_reader_cb, &r);
+
+    run_until_done();
+
+    fail_unless(r.written == r.size);
+    fail_unless(r.read == r.size);
+
+    /* And the other way round */
+    r.written = r.read = 0;
+    pa_srbchannel_set_callback(r.writer, raw_reader_cb, &r);
+    pa_srbchannel_set_callback(r.reader, raw_writer_cb, &r);
+
+    run_until_done();
+
+    fail_unless(r.read == r.size);
+
+    pa_srbchannel_free(r.reader);
+    pa_srbchannel_free(r.writer);
+    pa_xfree(r.data);
+
+    pa_mainloop_free(mainloop);
+}
+
+START_TEST (srbchannel_test) {
+    run_raw(PA_MEM_TYPE_SHARED_POSIX);
+#ifdef HAVE_MEMFD
+    run_raw(PA_MEM_TYPE_SHARED_MEMFD);
+#endif
+}
+END_TEST
+
+/* Two pstreams on a socket pair that switch over to a ring buffer
+ * channel halfway through. Every packet carries its sequence number
+ * and a size that varies with it. */
+struct side {
+    pa_pstream *pstream;
+    unsigned n_sent, n_received;
+    unsigned n_expected;
+    struct side *peer;
+    pa_bool_t pingpong;
+};
+
+static unsigned n_done;
+
+static void send_packet(struct side *s) {
+    pa_packet *packet;
+    size_t length, i;
+
+    length = sizeof(uint32_t) + s->n_sent % 300;
+    packet = pa_packet_new(length);
+
+    memcpy(packet->data, &s->n_sent, sizeof(uint32_t));
+    for (i = sizeof(uint32_t); i < length; i++)
+        packet->data[i] = (uint8_t) (s->n_sent + i);
+
+    pa_pstream_send_packet(s->pstream, packet, NULL);
+    pa_packet_unref(packet);
+
+    s->n_sent++;
+}
+
+static void packet_cb(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
+    struct side *s = userdata;
+    uint32_t seq;
+    size_t i;
+
+    fail_unless(packet->length >= sizeof(uint32_t));
+    memcpy(&seq, packet->data, sizeof(uint32_t));
+
+    fail_unless(seq == s->n_received, "packet %u arrived as %u", seq, s->n_received);
+    fail_unless(packet->length == sizeof(uint32_t) + seq % 300);
+
+    for (i = sizeof(uint32_t); i < packet->length; i++)
+        fail_unless(packet->data[i] == (uint8_t) (seq + i));
+
+    s->n_received++;
+
+    if (s->pingpong && s->n_sent < s->n_expected)
+        send_packet(s);
+
+    if (s->n_received == s->n_expected)
+        if (++n_done == 2)
+            done = TRUE;
+}
+
+static void die_cb(pa_pstream *p, void *userdata) {
+    fail_unless(FALSE, "pstream died");
+}
+
+static void setup_sides(struct side *a, struct side *b, pa_mempool *pool) {
+    int fds[2];
+
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    pa_zero(*a);
+    pa_zero(*b);
+    a->peer = b;
+    b->peer = a;
+
+    a->pstream = pa_pstream_new(api, pa_iochannel_new(api, fds[0], fds[0]), pool);
+    b->pstream = pa_pstream_new(api, pa_iochannel_new(api, fds[1], fds[1]), pool);
+
+    pa_pstream_set_receive_packet_callback(a->pstream, packet_cb, a);
+    pa_pstream_set_receive_packet_callback(b->pstream, packet_cb, b);
+    pa_pstream_set_die_callback(a->pstream, die_cb, a);
+    pa_pstream_set_die_callback(b->pstream, die_cb, b);
+
+    n_done = 0;
+}
+
+static void free_sides(struct side *a, struct side *b) {
+    pa_pstream_unlink(a->pstream);
+    pa_pstream_unref(a->pstream);
+    pa_pstream_unlink(b->pstream);
+    pa_pstream_unref(b->pstream);
+}
+
+static void enable_srbchannel(struct side *a, struct side *b) {
+    pa_srbchannel *sr;
+
+    fail_unless((sr = pa_srbchannel_new(api, PA_MEM_TYPE_SHARED_POSIX)) != NULL);
+    pa_pstream_set_srbchannel(b->pstream, open_peer(sr));
+    pa_pstream_set_srbchannel(a->pstream, sr);
+}
+
+START_TEST (pstream_switch_test) {
+    pa_mempool *pool;
+    struct side a, b;
+    unsigned i;
+
+    mainloop = pa_mainloop_new();
+    api = pa_mainloop_get_api(mainloop);
+    fail_unless((pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0)) != NULL);
+
+    setup_sides(&a, &b, pool);
+    a.n_expected = b.n_expected = N_PACKETS;
+
+    /* Whatever is still queued when the channel is set goes over the
+     * socket, everything after that over the ring buffer */
+    for (i = 0; i < N_PACKETS / 2; i++) {
+        send_packet(&a);
+        send_packet(&b);
+    }
+
+    enable_srbchannel(&a, &b);
+
+    for (; i < N_PACKETS; i++) {
+        send_packet(&a);
+        send_packet(&b);
+
+        /* Let some of them go out before the others are queued */
+        if (i % 100 == 0)
+            pa_mainloop_iterate(mainloop, 0, NULL);
+    }
+
+    run_until_done();
+
+    fail_unless(a.n_received == N_PACKETS);
+    fail_unless(b.n_received == N_PACKETS);
+
+    free_sides(&a, &b);
+
+    pa_mempool_free(pool);
+    pa_mainloop_free(mainloop);
+}
+END_TEST
+
+/* Round trip time of a small packet, without and with ring buffer */
+static double run_pingpong(pa_bool_t use_srbchannel) {
+    pa_mempool *pool;
+    struct side a, b;
+    pa_usec_t start, stop;
+
+    pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0);
+
+    setup_sides(&a, &b, pool);
+    a.n_expected = b.n_expected = N_ROUNDTRIPS;
+    a.pingpong = b.pingpong = TRUE;
+
+    if (use_srbchannel)
+        enable_srbchannel(&a, &b);
+
+    start = pa_rtclock_now();
+
+    send_packet(&a);
+    run_until_done();
+
+    stop = pa_rtclock_now();
+
+    fail_unless(a.n_received == N_ROUNDTRIPS);
+
+    free_sides(&a, &b);
+    pa_mempool_free(pool);
+
+    return (double) (stop - start) / N_ROUNDTRIPS;
+}
+
+START_TEST (pstream_perf_test) {
+    double socket_usec, srb_usec;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    mainloop = pa_mainloop_new();
+    api = pa_mainloop_get_api(mainloop);
+
+    socket_usec = run_pingpong(FALSE);
+    srb_usec = run_pingpong(TRUE);
+
+    pa_log_debug("Packet round trip: socket %.2f usec, ring buffer %.2f usec", socket_usec, srb_usec);
+
+    pa_mainloop_free(mainloop);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("srbchannel");
+    tc = tcase_create("srbchannel");
+    tcase_add_test(tc, srbchannel_test);
+    tcase_add_test(tc, pstream_switch_test);
+    tcase_add_test(tc, pstream_perf_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
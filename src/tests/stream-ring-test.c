@@ -0,0 +1,243 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/mainloop.h>
+
+#define SINE_HZ 440
+#define SAMPLE_HZ 44100
+
+static pa_context *context = NULL;
+static pa_stream *stream = NULL;
+static pa_mainloop_api *mainloop_api = NULL;
+static const char *bname = NULL;
+
+static int16_t data[SAMPLE_HZ * 2]; /* one second of stereo */
+static size_t n_written = 0;
+static int ring_enabled = 0;
+static int draining = 0;
+static unsigned n_ring_requests = 0;
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = SAMPLE_HZ,
+    .channels = 2
+};
+
+static const pa_buffer_attr buffer_attr = {
+    .maxlength = (uint32_t) -1,
+    .tlength = SAMPLE_HZ * 4 / 10, /* 100 ms */
+    .prebuf = (uint32_t) -1,
+    .minreq = (uint32_t) -1,
+    .fragsize = (uint32_t) -1
+};
+
+static void drain_cb(pa_stream *s, int success, void *userdata) {
+    fail_unless(success);
+
+    fprintf(stderr, "Drained after %u requests\n", n_ring_requests);
+
+    /* The server kept asking for data while it emptied the ring */
+    fail_unless(n_ring_requests > 0);
+
+    pa_stream_disconnect(s);
+    pa_context_disconnect(context);
+}
+
+static void fill_ring(pa_stream *s) {
+    size_t l;
+
+    if (n_written < sizeof(data)) {
+        l = pa_stream_ring_write(s, (uint8_t*) data + n_written, sizeof(data) - n_written);
+        fail_unless(l != (size_t) -1);
+        fail_unless(l % pa_frame_size(&sample_spec) == 0);
+
+        n_written += l;
+    }
+
+    if (n_written >= sizeof(data) && !draining) {
+        fprintf(stderr, "Everything written, draining\n");
+        draining = 1;
+        pa_operation_unref(pa_stream_drain(s, drain_cb, NULL));
+    }
+}
+
+static void write_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    const pa_buffer_attr *attr;
+
+    /* Before the ring is there the server asks for a whole buffer
+     * that we never write with pa_stream_write() */
+    if (!ring_enabled)
+        return;
+
+    n_ring_requests++;
+
+    /* The callback has to be told what fits into the ring, not what
+     * the server asked for over time. The server can only have made
+     * room in the meantime. */
+    attr = pa_stream_get_buffer_attr(s);
+    fail_unless(nbytes <= attr->tlength);
+    fail_unless(nbytes <= pa_stream_writable_size(s));
+    fail_unless(nbytes <= pa_stream_ring_writable_size(s));
+
+    fill_ring(s);
+}
+
+static void enable_ring_cb(pa_stream *s, int success, void *userdata) {
+    fail_unless(success);
+
+    fprintf(stderr, "Ring enabled, %lu bytes writable\n", (unsigned long) pa_stream_ring_writable_size(s));
+
+    ring_enabled = 1;
+    fail_unless(pa_stream_writable_size(s) == pa_stream_ring_writable_size(s));
+
+    fill_ring(s);
+}
+
+/* This routine is called whenever the stream state changes */
+static void stream_state_callback(pa_stream *s, void *userdata) {
+    fail_unless(s != NULL);
+
+    switch (pa_stream_get_state(s)) {
+        case PA_STREAM_UNCONNECTED:
+        case PA_STREAM_CREATING:
+        case PA_STREAM_TERMINATED:
+            break;
+
+        case PA_STREAM_READY: {
+            pa_operation *o;
+
+            fprintf(stderr, "Enabling the ring.\n");
+
+            o = pa_stream_enable_ring(s, enable_ring_cb, NULL);
+            fail_unless(o != NULL);
+            pa_operation_unref(o);
+            break;
+        }
+
+        default:
+        case PA_STREAM_FAILED:
+            fprintf(stderr, "Stream error: %s\n", pa_strerror(pa_context_errno(pa_stream_get_context(s))));
+            fail();
+    }
+}
+
+/* This is called whenever the context status changes */
+static void context_state_callback(pa_context *c, void *userdata) {
+    fail_unless(c != NULL);
+
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_CONNECTING:
+        case PA_CONTEXT_AUTHORIZING:
+        case PA_CONTEXT_SETTING_NAME:
+            break;
+
+        case PA_CONTEXT_READY:
+            fprintf(stderr, "Connection established.\n");
+
+            stream = pa_stream_new(c, "ring stream", &sample_spec, NULL);
+            fail_unless(stream != NULL);
+            pa_stream_set_state_callback(stream, stream_state_callback, NULL);
+            pa_stream_set_write_callback(stream, write_cb, NULL);
+            pa_stream_connect_playback(stream, NULL, &buffer_attr, 0, NULL, NULL);
+            break;
+
+        case PA_CONTEXT_TERMINATED:
+            mainloop_api->quit(mainloop_api, 0);
+            break;
+
+        case PA_CONTEXT_FAILED:
+        default:
+            fprintf(stderr, "Context error: %s\n", pa_strerror(pa_context_errno(c)));
+            fail();
+    }
+}
+
+START_TEST (stream_ring_test) {
+    pa_mainloop* m = NULL;
+    int i, ret = 0;
+
+    for (i = 0; i < SAMPLE_HZ; i++)
+        data[2*i] = data[2*i+1] = (int16_t) (sin(((double) i/SAMPLE_HZ)*2*M_PI*SINE_HZ) * 0x3fff);
+
+    /* Set up a new main loop */
+    m = pa_mainloop_new();
+    fail_unless(m != NULL);
+
+    mainloop_api = pa_mainloop_get_api(m);
+
+    context = pa_context_new(mainloop_api, bname);
+    fail_unless(context != NULL);
+
+    pa_context_set_state_callback(context, context_state_callback, NULL);
+
+    /* Connect the context */
+    if (pa_context_connect(context, NULL, 0, NULL) < 0) {
+        fprintf(stderr, "pa_context_connect() failed.\n");
+        goto quit;
+    }
+
+    if (pa_mainloop_run(m, &ret) < 0)
+        fprintf(stderr, "pa_mainloop_run() failed.\n");
+
+    fail_unless(draining);
+
+quit:
+    pa_context_unref(context);
+
+    if (stream)
+        pa_stream_unref(stream);
+
+    pa_mainloop_free(m);
+
+    fail_unless(ret == 0);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    bname = argv[0];
+
+    s = suite_create("Stream Ring");
+    tc = tcase_create("streamring");
+    tcase_add_test(tc, stream_ring_test);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
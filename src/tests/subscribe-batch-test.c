@@ -0,0 +1,185 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/core-subscribe.h>
+#include <pulsecore/macro.h>
+
+#define SINK_INPUT(t) (PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_##t)
+#define SINK(t) (PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_##t)
+
+#define N_STEPS 1000
+
+static pa_subscription_batch_event last[16];
+static unsigned n_last = 0, n_batches = 0, n_removed = 0;
+
+static void batch_cb(pa_core *c, const pa_subscription_batch_event *events, unsigned n, void *userdata) {
+    unsigned k;
+
+    fail_unless(n > 0);
+
+    for (k = 0; k < n && k < PA_ELEMENTSOF(last); k++)
+        last[k] = events[k];
+
+    n_last = n;
+    n_batches++;
+}
+
+static void subscription_cb(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata) {
+    if (t == SINK_INPUT(REMOVE))
+        n_removed++;
+}
+
+static void run(pa_mainloop *mainloop) {
+    while (pa_mainloop_iterate(mainloop, 0, NULL) > 0)
+        ;
+}
+
+/* A volume ramp and a few streams that come and go, delivered without
+ * delay */
+START_TEST (batch_test) {
+    pa_mainloop *mainloop;
+    pa_core *core;
+    pa_subscription *s, *p;
+    unsigned i;
+
+    mainloop = pa_mainloop_new();
+    fail_unless((core = pa_core_new(pa_mainloop_get_api(mainloop), FALSE, 0)) != NULL);
+
+    s = pa_subscription_new_batched(core, PA_SUBSCRIPTION_MASK_SINK_INPUT|PA_SUBSCRIPTION_MASK_SINK, 0, batch_cb, NULL);
+    p = pa_subscription_new(core, PA_SUBSCRIPTION_MASK_SINK_INPUT|PA_SUBSCRIPTION_MASK_SINK, subscription_cb, NULL);
+
+    pa_subscription_post(core, SINK_INPUT(NEW), 1);
+    pa_subscription_post(core, SINK_INPUT(CHANGE), 7);
+    pa_subscription_post(core, SINK_INPUT(NEW), 2);
+    pa_subscription_post(core, SINK(CHANGE), 1);
+
+    for (i = 0; i < N_STEPS; i++) {
+        pa_subscription_post(core, SINK_INPUT(CHANGE), 7);
+        pa_subscription_post(core, SINK_INPUT(CHANGE), 1);
+        pa_subscription_post(core, SINK(CHANGE), 1);
+    }
+
+    pa_subscription_post(core, SINK_INPUT(REMOVE), 2);
+    pa_subscription_post(core, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE, 1);
+
+    run(mainloop);
+
+    fail_unless(n_batches == 1);
+    fail_unless(n_last == 3);
+    fail_unless(last[0].type == SINK_INPUT(NEW) && last[0].index == 1);
+    fail_unless(last[1].type == SINK_INPUT(CHANGE) && last[1].index == 7);
+    fail_unless(last[2].type == SINK(CHANGE) && last[2].index == 1);
+
+    /* Unlike the ordinary subscription, which is still told about the
+     * stream that came and went */
+    fail_unless(n_removed == 1);
+
+    /* Objects the subscriber knows of are reported as removed */
+    pa_subscription_post(core, SINK_INPUT(CHANGE), 7);
+    pa_subscription_post(core, SINK_INPUT(CHANGE), 1);
+    pa_subscription_post(core, SINK_INPUT(REMOVE), 7);
+
+    run(mainloop);
+
+    fail_unless(n_batches == 2);
+    fail_unless(n_last == 2);
+    fail_unless(last[0].type == SINK_INPUT(CHANGE) && last[0].index == 1);
+    fail_unless(last[1].type == SINK_INPUT(REMOVE) && last[1].index == 7);
+
+    pa_subscription_free(s);
+    pa_subscription_free(p);
+
+    /* Nothing is delivered after the subscription is gone */
+    pa_subscription_post(core, SINK_INPUT(CHANGE), 1);
+    run(mainloop);
+    fail_unless(n_batches == 2);
+
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+}
+END_TEST
+
+/* Events are held back until the delay after the first one is over */
+START_TEST (batch_delay_test) {
+    pa_mainloop *mainloop;
+    pa_core *core;
+    pa_subscription *s;
+    pa_usec_t start;
+    unsigned i;
+
+    n_batches = 0;
+
+    mainloop = pa_mainloop_new();
+    fail_unless((core = pa_core_new(pa_mainloop_get_api(mainloop), FALSE, 0)) != NULL);
+
+    s = pa_subscription_new_batched(core, PA_SUBSCRIPTION_MASK_SINK_INPUT, 50 * PA_USEC_PER_MSEC, batch_cb, NULL);
+
+    start = pa_rtclock_now();
+
+    for (i = 0; i < 10; i++) {
+        pa_subscription_post(core, SINK_INPUT(CHANGE), i % 3);
+        pa_mainloop_iterate(mainloop, 0, NULL);
+    }
+
+    fail_unless(n_batches == 0);
+
+    while (n_batches == 0)
+        pa_mainloop_iterate(mainloop, 1, NULL);
+
+    fail_unless(pa_rtclock_now() - start >= 50 * PA_USEC_PER_MSEC);
+    fail_unless(n_last == 3);
+
+    pa_subscription_free(s);
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Subscription batches");
+    tc = tcase_create("batch");
+    tcase_add_test(tc, batch_test);
+    tcase_add_test(tc, batch_delay_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,138 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/core-subscribe.h>
+#include <pulsecore/macro.h>
+
+#define SINK_INPUT(t) (PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_##t)
+
+static unsigned n_events = 0;
+
+static void subscription_cb(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata) {
+    n_events++;
+}
+
+START_TEST (generation_test) {
+    pa_mainloop *mainloop;
+    pa_core *core;
+    pa_subscription *s;
+    uint64_t g, since;
+    uint32_t *removed;
+    unsigned n, i;
+
+    mainloop = pa_mainloop_new();
+    fail_unless((core = pa_core_new(pa_mainloop_get_api(mainloop), FALSE, 0)) != NULL);
+
+    /* Generations are counted whether anyone listens or not */
+    fail_unless(pa_subscription_get_generation(core, PA_SUBSCRIPTION_EVENT_SINK_INPUT, 0) == 0);
+
+    pa_subscription_post(core, SINK_INPUT(NEW), 0);
+    pa_subscription_post(core, SINK_INPUT(NEW), 1);
+    pa_subscription_post(core, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_NEW, 0);
+
+    fail_unless(pa_subscription_get_generation(core, PA_SUBSCRIPTION_EVENT_SINK_INPUT, 0) == 1);
+    fail_unless(pa_subscription_get_generation(core, PA_SUBSCRIPTION_EVENT_SINK_INPUT, 1) == 2);
+    fail_unless(pa_subscription_get_generation(core, PA_SUBSCRIPTION_EVENT_SINK, 0) == 3);
+    fail_unless(pa_subscription_get_generation(core, PA_SUBSCRIPTION_EVENT_SOURCE, 0) == 0);
+
+    s = pa_subscription_new(core, PA_SUBSCRIPTION_MASK_SINK_INPUT, subscription_cb, NULL);
+
+    /* Duplicate change events are dropped from the queue, but still
+     * count */
+    since = core->generation;
+    pa_subscription_post(core, SINK_INPUT(CHANGE), 0);
+    pa_subscription_post(core, SINK_INPUT(CHANGE), 0);
+    g = pa_subscription_get_generation(core, PA_SUBSCRIPTION_EVENT_SINK_INPUT, 0);
+    fail_unless(g == since + 2 && g == core->generation);
+
+    pa_mainloop_iterate(mainloop, 0, NULL);
+    fail_unless(n_events == 1);
+
+    fail_unless(pa_subscription_get_removed(core, PA_SUBSCRIPTION_EVENT_SINK_INPUT, since, &removed, &n) == 0);
+    fail_unless(n == 0 && !removed);
+
+    pa_subscription_post(core, SINK_INPUT(REMOVE), 1);
+    fail_unless(pa_subscription_get_generation(core, PA_SUBSCRIPTION_EVENT_SINK_INPUT, 1) == 0);
+
+    fail_unless(pa_subscription_get_removed(core, PA_SUBSCRIPTION_EVENT_SINK_INPUT, since, &removed, &n) == 0);
+    fail_unless(n == 1 && removed[0] == 1);
+    pa_xfree(removed);
+
+    fail_unless(pa_subscription_get_removed(core, PA_SUBSCRIPTION_EVENT_SINK_INPUT, core->generation, &removed, &n) == 0);
+    fail_unless(n == 0);
+
+    /* Lots of streams come and go, only the last removals are
+     * remembered */
+    since = core->generation;
+    for (i = 2; i < 1002; i++) {
+        pa_subscription_post(core, SINK_INPUT(NEW), i);
+        pa_subscription_post(core, SINK_INPUT(REMOVE), i);
+    }
+
+    fail_unless(pa_subscription_get_removed(core, PA_SUBSCRIPTION_EVENT_SINK_INPUT, since, &removed, &n) < 0);
+    fail_unless(n == 0 && !removed);
+
+    fail_unless(pa_subscription_get_removed(core, PA_SUBSCRIPTION_EVENT_SINK_INPUT, core->generation - 5, &removed, &n) == 0);
+    fail_unless(n == 3);
+    fail_unless(removed[0] == 999 && removed[1] == 1000 && removed[2] == 1001);
+    pa_xfree(removed);
+
+    /* Other facilities don't care */
+    fail_unless(pa_subscription_get_removed(core, PA_SUBSCRIPTION_EVENT_SINK, since, &removed, &n) == 0);
+    fail_unless(n == 0);
+
+    /* The stream that stayed is still known */
+    fail_unless(pa_subscription_get_generation(core, PA_SUBSCRIPTION_EVENT_SINK_INPUT, 0) == g);
+
+    pa_subscription_free(s);
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Subscription generations");
+    tc = tcase_create("generation");
+    tcase_add_test(tc, generation_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,324 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/packet.h>
+#include <pulsecore/tagstruct.h>
+
+#define N_ENTRIES 20
+#define N_CALLS 10000
+
+/* Count what goes through malloc(), to see what building a reply
+ * costs. This needs glibc to get at the real allocator. */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned n_allocs = 0;
+
+void *malloc(size_t size) {
+    n_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    n_allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    n_allocs++;
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+static void fill(pa_tagstruct *t, unsigned n) {
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_cvolume v;
+    struct timeval tv;
+    uint8_t blob[300];
+    char s[32];
+    unsigned i;
+
+    ss.format = PA_SAMPLE_S16LE;
+    ss.rate = 44100 + n;
+    ss.channels = 2;
+    pa_channel_map_init_stereo(&map);
+    pa_cvolume_set(&v, 2, PA_VOLUME_NORM - n);
+    tv.tv_sec = n;
+    tv.tv_usec = 17;
+
+    for (i = 0; i < sizeof(blob); i++)
+        blob[i] = (uint8_t) (i + n);
+
+    pa_snprintf(s, sizeof(s), "entry-%u", n);
+
+    pa_tagstruct_puts(t, s);
+    pa_tagstruct_puts(t, NULL);
+    pa_tagstruct_putu8(t, (uint8_t) n);
+    pa_tagstruct_putu32(t, n);
+    pa_tagstruct_putu64(t, (uint64_t) n << 40);
+    pa_tagstruct_puts64(t, -(int64_t) n);
+    pa_tagstruct_put_sample_spec(t, &ss);
+    pa_tagstruct_put_arbitrary(t, blob, n % sizeof(blob));
+    pa_tagstruct_put_boolean(t, n & 1);
+    pa_tagstruct_put_timeval(t, &tv);
+    pa_tagstruct_put_usec(t, (pa_usec_t) n * 1000);
+    pa_tagstruct_put_channel_map(t, &map);
+    pa_tagstruct_put_cvolume(t, &v);
+    pa_tagstruct_put_volume(t, PA_VOLUME_NORM / (n + 1));
+}
+
+static void check(pa_tagstruct *t, unsigned n) {
+    const char *s;
+    uint8_t u8;
+    uint32_t u32;
+    uint64_t u64;
+    int64_t s64;
+    pa_sample_spec ss;
+    const void *blob;
+    pa_bool_t b;
+    struct timeval tv;
+    pa_usec_t usec;
+    pa_channel_map map;
+    pa_cvolume v;
+    pa_volume_t vol;
+    char e[32];
+    unsigned i;
+
+    pa_snprintf(e, sizeof(e), "entry-%u", n);
+
+    fail_unless(pa_tagstruct_gets(t, &s) == 0 && pa_streq(s, e));
+    fail_unless(pa_tagstruct_gets(t, &s) == 0 && !s);
+    fail_unless(pa_tagstruct_getu8(t, &u8) == 0 && u8 == (uint8_t) n);
+    fail_unless(pa_tagstruct_getu32(t, &u32) == 0 && u32 == n);
+    fail_unless(pa_tagstruct_getu64(t, &u64) == 0 && u64 == (uint64_t) n << 40);
+    fail_unless(pa_tagstruct_gets64(t, &s64) == 0 && s64 == -(int64_t) n);
+    fail_unless(pa_tagstruct_get_sample_spec(t, &ss) == 0 && ss.rate == 44100 + n && ss.channels == 2);
+    fail_unless(pa_tagstruct_get_arbitrary(t, &blob, n % 300) == 0);
+    for (i = 0; i < n % 300; i++)
+        fail_unless(((const uint8_t*) blob)[i] == (uint8_t) (i + n));
+    fail_unless(pa_tagstruct_get_boolean(t, &b) == 0 && b == (n & 1));
+    fail_unless(pa_tagstruct_get_timeval(t, &tv) == 0 && tv.tv_sec == (time_t) n && tv.tv_usec == 17);
+    fail_unless(pa_tagstruct_get_usec(t, &usec) == 0 && usec == (pa_usec_t) n * 1000);
+    fail_unless(pa_tagstruct_get_channel_map(t, &map) == 0 && map.channels == 2);
+    fail_unless(pa_tagstruct_get_cvolume(t, &v) == 0 && v.channels == 2 && v.values[1] == PA_VOLUME_NORM - n);
+    fail_unless(pa_tagstruct_get_volume(t, &vol) == 0 && vol == PA_VOLUME_NORM / (n + 1));
+}
+
+/* Write and read back tagstructs of all sizes, going through a packet
+ * like the native protocol does */
+START_TEST (tagstruct_roundtrip_test) {
+    unsigned n, i;
+
+    for (n = 0; n < 40; n++) {
+        pa_tagstruct *t;
+        pa_packet *packet;
+        const uint8_t *d;
+        size_t l;
+
+        t = pa_tagstruct_new(NULL, 0);
+
+        /* A recycled tagstruct starts out empty */
+        fail_unless(pa_tagstruct_eof(t));
+        pa_tagstruct_data(t, &l);
+        fail_unless(l == 0);
+
+        if (n % 3 == 0)
+            pa_tagstruct_reserve(t, 64 * n);
+
+        for (i = 0; i < n; i++)
+            fill(t, i);
+
+        if (n == 0)
+            pa_tagstruct_putu32(t, 4711);
+
+        d = pa_tagstruct_data(t, &l);
+        packet = pa_packet_new_data(d, l);
+        pa_tagstruct_free(t);
+
+        fail_unless(packet->length == l);
+
+        t = pa_tagstruct_new(packet->data, packet->length);
+        for (i = 0; i < n; i++)
+            check(t, i);
+        if (n == 0) {
+            uint32_t u;
+            fail_unless(pa_tagstruct_getu32(t, &u) == 0 && u == 4711);
+        }
+        fail_unless(pa_tagstruct_eof(t));
+        pa_tagstruct_free(t);
+
+        pa_packet_unref(packet);
+    }
+
+    /* Taking the data out of small and big tagstructs */
+    for (n = 1; n < 20; n += 10) {
+        pa_tagstruct *t;
+        uint8_t *d;
+        size_t l;
+
+        t = pa_tagstruct_new(NULL, 0);
+        for (i = 0; i < n; i++)
+            fill(t, i);
+
+        d = pa_tagstruct_free_data(t, &l);
+
+        t = pa_tagstruct_new(d, l);
+        for (i = 0; i < n; i++)
+            check(t, i);
+        fail_unless(pa_tagstruct_eof(t));
+        pa_tagstruct_free(t);
+
+        pa_xfree(d);
+    }
+}
+END_TEST
+
+/* Something like the reply to PA_COMMAND_GET_SINK_INPUT_INFO_LIST */
+static size_t build_reply(pa_proplist *p, size_t hint) {
+    pa_tagstruct *t;
+    pa_packet *packet;
+    const uint8_t *d;
+    size_t l;
+    unsigned i;
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_reserve(t, hint);
+
+    pa_tagstruct_putu32(t, 2);
+    pa_tagstruct_putu32(t, 4711);
+
+    for (i = 0; i < N_ENTRIES; i++) {
+        fill(t, i % 8);
+        pa_tagstruct_put_proplist(t, p);
+    }
+
+    d = pa_tagstruct_data(t, &l);
+    packet = pa_packet_new_data(d, l);
+    pa_tagstruct_free(t);
+
+    pa_packet_unref(packet);
+
+    return l;
+}
+
+START_TEST (tagstruct_alloc_test) {
+    pa_proplist *p;
+    pa_usec_t start, stop;
+    size_t hint;
+    unsigned i;
+#ifdef __GLIBC__
+    unsigned allocs;
+#endif
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    p = pa_proplist_new();
+    pa_proplist_sets(p, PA_PROP_APPLICATION_NAME, "Test");
+    pa_proplist_sets(p, PA_PROP_APPLICATION_PROCESS_BINARY, "tagstruct-test");
+    pa_proplist_sets(p, PA_PROP_MEDIA_NAME, "Playback");
+    pa_proplist_sets(p, PA_PROP_MEDIA_ROLE, "music");
+
+    /* The first time around everything has to be allocated */
+    hint = build_reply(p, 0);
+
+#ifdef __GLIBC__
+    allocs = n_allocs;
+    build_reply(p, hint);
+    allocs = n_allocs - allocs;
+
+    pa_log_debug("Building a %lu byte reply: %u allocations", (unsigned long) hint, allocs);
+    fail_unless(allocs == 0);
+#endif
+
+    start = pa_rtclock_now();
+    for (i = 0; i < N_CALLS; i++)
+        build_reply(p, hint);
+    stop = pa_rtclock_now();
+
+    pa_log_debug("%.2f usec per reply", (double) (stop - start) / N_CALLS);
+
+    pa_proplist_free(p);
+}
+END_TEST
+
+/* Big replies are handed over to the packet instead of copied */
+START_TEST (tagstruct_handover_test) {
+    pa_tagstruct *t;
+    pa_packet *packet;
+    const uint8_t *d;
+    uint8_t *b;
+    size_t l, bl;
+    unsigned i;
+
+    t = pa_tagstruct_new(NULL, 0);
+
+    for (i = 0; pa_tagstruct_data(t, &l) && l <= PA_MAX_POOLED_SIZE; i++)
+        fill(t, i % 8);
+
+    d = pa_tagstruct_data(t, &l);
+    b = pa_tagstruct_free_data(t, &bl);
+    fail_unless(b == d);
+    fail_unless(bl == l);
+
+    packet = pa_packet_new_dynamic(b, bl);
+    fail_unless(packet->data == b);
+    fail_unless(packet->length == l);
+    pa_packet_unref(packet);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Tagstruct");
+    tc = tcase_create("tagstruct");
+    tcase_add_test(tc, tagstruct_roundtrip_test);
+    tcase_add_test(tc, tagstruct_alloc_test);
+    tcase_add_test(tc, tagstruct_handover_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
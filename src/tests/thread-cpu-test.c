@@ -0,0 +1,112 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/util.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/thread.h>
+
+#define BUSY_USEC (50*PA_USEC_PER_MSEC)
+
+static volatile unsigned sink;
+
+/* Burn wall clock time on the CPU */
+static void spin(pa_usec_t usec) {
+    pa_usec_t until = pa_rtclock_now() + usec;
+
+    while (pa_rtclock_now() < until)
+        sink++;
+}
+
+static void busy_thread(void *userdata) {
+    spin(BUSY_USEC);
+}
+
+START_TEST (thread_cpu_busy_test) {
+    pa_usec_t start, used;
+
+    if ((start = pa_thread_cpu_now()) == 0)
+        return;
+
+    spin(BUSY_USEC);
+    used = pa_thread_cpu_now() - start;
+
+    pa_log_debug("spinning for %llu usec used %llu usec CPU", (unsigned long long) BUSY_USEC, (unsigned long long) used);
+
+    /* The thread may get preempted, but it can't use more than it ran */
+    fail_unless(used > 0);
+    fail_unless(used <= BUSY_USEC + 10*PA_USEC_PER_MSEC);
+}
+END_TEST
+
+START_TEST (thread_cpu_idle_test) {
+    pa_usec_t start, used;
+    pa_thread *t;
+
+    if ((start = pa_thread_cpu_now()) == 0)
+        return;
+
+    /* Neither sleeping nor other threads' work count */
+    pa_msleep(BUSY_USEC / PA_USEC_PER_MSEC);
+    t = pa_thread_new("busy", busy_thread, NULL);
+    pa_thread_free(t);
+
+    used = pa_thread_cpu_now() - start;
+
+    pa_log_debug("sleeping and waiting used %llu usec CPU", (unsigned long long) used);
+
+    fail_unless(used < BUSY_USEC / 2);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Thread CPU time");
+    tc = tcase_create("threadcpu");
+    tcase_add_test(tc, thread_cpu_busy_test);
+    tcase_add_test(tc, thread_cpu_idle_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
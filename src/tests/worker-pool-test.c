@@ -0,0 +1,267 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/worker-pool.h>
+
+#define N_JOBS 16
+#define N_ROUNDS 1000
+
+struct counter {
+    pa_worker_job *job;
+    unsigned n_runs;
+    unsigned round;
+    pa_bool_t wrong_round;
+};
+
+static void count_cb(void *userdata) {
+    struct counter *c = userdata;
+
+    /* The job must only run once per submission, and only for the
+     * round it was submitted in */
+    if (c->n_runs != c->round)
+        c->wrong_round = TRUE;
+
+    c->n_runs++;
+}
+
+START_TEST (worker_pool_test) {
+    pa_worker_pool *p;
+    struct counter c[N_JOBS];
+    unsigned i, r;
+
+    p = pa_worker_pool_new(3, 0);
+    fail_unless(pa_worker_pool_get_n_threads(p) == 3);
+
+    for (i = 0; i < N_JOBS; i++) {
+        pa_zero(c[i]);
+        c[i].job = pa_worker_job_new(p, count_cb, &c[i]);
+    }
+
+    for (r = 0; r < N_ROUNDS; r++) {
+        for (i = 0; i < N_JOBS; i++) {
+            c[i].round = r;
+            pa_worker_job_submit(c[i].job);
+            fail_unless(pa_worker_job_is_pending(c[i].job));
+        }
+
+        /* Collect them in a different order every time */
+        for (i = 0; i < N_JOBS; i++) {
+            unsigned k = (i * 7 + r) % N_JOBS;
+
+            pa_worker_job_wait(c[k].job);
+            fail_unless(!pa_worker_job_is_pending(c[k].job));
+            fail_unless(c[k].n_runs == r + 1);
+        }
+    }
+
+    for (i = 0; i < N_JOBS; i++) {
+        fail_unless(!c[i].wrong_round);
+        fail_unless(c[i].n_runs == N_ROUNDS);
+    }
+
+    /* Freeing a job that is still in flight waits for it */
+    c[0].round = N_ROUNDS;
+    pa_worker_job_submit(c[0].job);
+
+    for (i = 0; i < N_JOBS; i++)
+        pa_worker_job_free(c[i].job);
+
+    fail_unless(c[0].n_runs == N_ROUNDS + 1);
+
+    pa_worker_pool_unref(p);
+}
+END_TEST
+
+/* With the only worker blocked, waiting for a job has to run it on
+ * the waiting thread instead of blocking as well */
+struct blocker {
+    pa_semaphore *started, *release;
+};
+
+static void block_cb(void *userdata) {
+    struct blocker *b = userdata;
+
+    pa_semaphore_post(b->started);
+    pa_semaphore_wait(b->release);
+}
+
+static void thread_cb(void *userdata) {
+    *(pa_thread**) userdata = pa_thread_self();
+}
+
+START_TEST (worker_pool_inline_test) {
+    pa_worker_pool *p;
+    pa_worker_job *blocking, *job;
+    struct blocker b;
+    pa_thread *ran_on = NULL;
+
+    b.started = pa_semaphore_new(0);
+    b.release = pa_semaphore_new(0);
+
+    p = pa_worker_pool_new(1, 0);
+    blocking = pa_worker_job_new(p, block_cb, &b);
+    job = pa_worker_job_new(p, thread_cb, &ran_on);
+
+    pa_worker_job_submit(blocking);
+    pa_semaphore_wait(b.started);
+
+    pa_worker_job_submit(job);
+    pa_worker_job_wait(job);
+
+    fail_unless(ran_on == pa_thread_self());
+
+    pa_semaphore_post(b.release);
+    pa_worker_job_wait(blocking);
+
+    /* Now that the worker is free again, it should pick jobs up */
+    ran_on = NULL;
+    pa_worker_job_submit(job);
+    while (!ran_on)
+        pa_thread_yield();
+    pa_worker_job_wait(job);
+
+    fail_unless(ran_on != pa_thread_self());
+
+    pa_worker_job_free(job);
+    pa_worker_job_free(blocking);
+    pa_worker_pool_unref(p);
+
+    pa_semaphore_free(b.release);
+    pa_semaphore_free(b.started);
+}
+END_TEST
+
+/* A fake filter that burns about as much CPU per block as a long
+ * convolution would */
+struct filter {
+    pa_worker_job *job;
+    float state;
+    unsigned work;
+};
+
+static void filter_cb(void *userdata) {
+    struct filter *f = userdata;
+    float s = f->state;
+    unsigned i;
+
+    for (i = 0; i < f->work; i++)
+        s = s * 0.999f + sinf((float) i);
+
+    f->state = s;
+}
+
+/* Time a period in which n_filters filters each process one block,
+ * first all inline as the master IO thread would do it today, then
+ * pipelined one block ahead on the pool */
+static void run_perf(pa_worker_pool *p, unsigned n_filters, unsigned work) {
+    struct filter *f;
+    pa_usec_t start, inline_usec, pool_usec;
+    unsigned i, r;
+
+    f = pa_xnew0(struct filter, n_filters);
+
+    for (i = 0; i < n_filters; i++) {
+        f[i].work = work;
+        f[i].job = pa_worker_job_new(p, filter_cb, &f[i]);
+    }
+
+    start = pa_rtclock_now();
+    for (r = 0; r < 100; r++)
+        for (i = 0; i < n_filters; i++)
+            filter_cb(&f[i]);
+    inline_usec = (pa_rtclock_now() - start) / 100;
+
+    start = pa_rtclock_now();
+    for (r = 0; r < 100; r++)
+        for (i = 0; i < n_filters; i++) {
+            if (pa_worker_job_is_pending(f[i].job))
+                pa_worker_job_wait(f[i].job);
+
+            pa_worker_job_submit(f[i].job);
+        }
+    for (i = 0; i < n_filters; i++)
+        pa_worker_job_wait(f[i].job);
+    pool_usec = (pa_rtclock_now() - start) / 100;
+
+    pa_log_debug("%u filters, %u threads: %llu usec per period inline, %llu usec on the pool",
+                 n_filters, pa_worker_pool_get_n_threads(p),
+                 (unsigned long long) inline_usec, (unsigned long long) pool_usec);
+
+    for (i = 0; i < n_filters; i++)
+        pa_worker_job_free(f[i].job);
+
+    pa_xfree(f);
+}
+
+START_TEST (worker_pool_perf_test) {
+    pa_worker_pool *p;
+    unsigned n;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    n = PA_MAX(pa_ncpus(), 2U) - 1;
+    p = pa_worker_pool_new(n, 0);
+
+    run_perf(p, 1, 20000);
+    run_perf(p, 4, 20000);
+    run_perf(p, 8, 20000);
+
+    pa_worker_pool_unref(p);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Worker pool");
+    tc = tcase_create("workerpool");
+    tcase_add_test(tc, worker_pool_test);
+    tcase_add_test(tc, worker_pool_inline_test);
+    tcase_add_test(tc, worker_pool_perf_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}